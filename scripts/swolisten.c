@@ -37,6 +37,9 @@
 #include <limits.h>
 #include <termios.h>
 #include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/time.h>
 
 #define VID       (0x1d50)
 #define PID       (0x6018)
@@ -47,6 +50,16 @@
 #define NUM_FIFOS     32
 #define MAX_FIFOS     128
 
+/* USB capture keeps this many bulk transfers queued so the endpoint is never left unserviced */
+#define USB_TRANSFER_SIZE (4096)
+#define NUM_TRANSFERS     (8)
+
+/* Captured data waiting for the decoder, must be a power of 2 */
+#define RING_SIZE         (1024*1024)
+
+/* Channel output is gathered up to this size and written out in one go */
+#define CHANNEL_BATCH     (512)
+
 #define CHANNELNAME   "chan"
 
 #define BOOL       char
@@ -68,6 +81,22 @@ struct
 struct
 {
   int fifo[MAX_FIFOS];
+
+  /* Single producer (USB capture), single consumer (decoder) ring, so no locks are needed */
+  uint8_t ring[RING_SIZE];
+  atomic_size_t ringHead;
+  atomic_size_t ringTail;
+  atomic_ulong dropped;
+
+  /* Only the capture thread touches these */
+  struct libusb_transfer *transfer[NUM_TRANSFERS];
+  uint8_t transferBuf[NUM_TRANSFERS][USB_TRANSFER_SIZE];
+  int activeTransfers;
+  BOOL capturing;
+
+  /* Only the decoder touches these */
+  uint8_t chanBuf[MAX_FIFOS][CHANNEL_BATCH];
+  int chanLen[MAX_FIFOS];
 } _r;
 
 // ====================================================================================================
@@ -184,14 +213,34 @@ static void _removeFifoTasks(void)
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
+static void _flushChannel(int chan)
+
+{
+  if (_r.chanLen[chan])
+    {
+      /* The pipe is non-blocking, so output nobody is reading is dropped here */
+      write(_r.fifo[chan],_r.chanBuf[chan],_r.chanLen[chan]);
+      _r.chanLen[chan]=0;
+    }
+}
+// ====================================================================================================
+static void _flushChannels(void)
+
+{
+  for (int t=0; t<options.nChannels; t++)
+    _flushChannel(t);
+}
+// ====================================================================================================
 void _handleSWIT(uint8_t addr, uint8_t length, uint8_t *d)
 
 {
-  if (addr<options.nChannels)
-    write(_r.fifo[addr],d,length);
+  if (addr>=options.nChannels)
+    return;
 
-  //  if (addr==0)
-  //  fprintf(stdout,"%c",*d);
+  if (_r.chanLen[addr]+length>CHANNEL_BATCH)
+    _flushChannel(addr);
+  memcpy(&_r.chanBuf[addr][_r.chanLen[addr]],d,length);
+  _r.chanLen[addr]+=length;
 }
 // ====================================================================================================
 void _handleTS(uint8_t length, uint8_t *d)
@@ -337,6 +386,88 @@ void _protocolPump(uint8_t *c)
 #endif
 }
 // ====================================================================================================
+static void _decodeBuffer(uint8_t *d, size_t length)
+
+/* Run a block of captured data through the decoder, then pass on what it gave each channel */
+
+{
+  if (options.dump)
+    {
+      fwrite(d,1,length,stdout);
+      fflush(stdout);
+      return;
+    }
+
+  while (length--)
+    _protocolPump(d++);
+  _flushChannels();
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Capture to decoder ring
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _ringPut(uint8_t *d, size_t length)
+
+/* Called from the capture thread only */
+
+{
+  size_t head=atomic_load_explicit(&_r.ringHead,memory_order_relaxed);
+  size_t tail=atomic_load_explicit(&_r.ringTail,memory_order_acquire);
+  size_t space=RING_SIZE-(head-tail);
+
+  if (length>space)
+    {
+      /* The decoder has fallen behind, so lose the newest data rather than block the capture */
+      atomic_fetch_add_explicit(&_r.dropped,length-space,memory_order_relaxed);
+      length=space;
+    }
+
+  size_t offset=head&(RING_SIZE-1);
+  size_t first=(length<RING_SIZE-offset)?length:RING_SIZE-offset;
+  memcpy(&_r.ring[offset],d,first);
+  memcpy(_r.ring,d+first,length-first);
+  atomic_store_explicit(&_r.ringHead,head+length,memory_order_release);
+}
+// ====================================================================================================
+static void *_decodeThread(void *arg)
+
+/* Drain the ring, decoding straight out of it, for as long as the program runs */
+
+{
+  unsigned long reported=0;
+
+  while (1)
+    {
+      size_t tail=atomic_load_explicit(&_r.ringTail,memory_order_relaxed);
+      size_t head=atomic_load_explicit(&_r.ringHead,memory_order_acquire);
+
+      if (head==tail)
+	{
+	  usleep(1000);
+	  continue;
+	}
+
+      /* Take everything up to the end of the ring in one pass, any wrapped part on the next */
+      size_t offset=tail&(RING_SIZE-1);
+      size_t length=head-tail;
+      if (length>RING_SIZE-offset)
+	length=RING_SIZE-offset;
+      _decodeBuffer(&_r.ring[offset],length);
+      atomic_store_explicit(&_r.ringTail,tail+length,memory_order_release);
+
+      unsigned long dropped=atomic_load_explicit(&_r.dropped,memory_order_relaxed);
+      if ((options.verbose) && (dropped!=reported))
+	{
+	  fprintf(stderr,"Decoder overrun, %lu bytes dropped so far\n",dropped);
+	  reported=dropped;
+	}
+    }
+  return NULL;
+}
+// ====================================================================================================
 void intHandler(int dummy)
 
 {
@@ -410,47 +541,100 @@ int _processOptions(int argc, char *argv[])
   return TRUE;
 }
 // ====================================================================================================
-int usbFeeder(void)
+static void LIBUSB_CALL _usbCallback(struct libusb_transfer *t)
+
+/* A transfer finished, hand its data over and queue it straight back up */
 
 {
+  if (t->status==LIBUSB_TRANSFER_COMPLETED)
+    {
+      _ringPut(t->buffer,t->actual_length);
+      if ((_r.capturing) && (0==libusb_submit_transfer(t)))
+	return;
+    }
 
-  unsigned char cbw[TRANSFER_SIZE];
+  /* Probe gone, or being shut down, so let the rest of the transfers drain */
+  _r.capturing=FALSE;
+  _r.activeTransfers--;
+}
+// ====================================================================================================
+int usbFeeder(void)
+
+{
   libusb_device_handle *handle;
   libusb_device *dev;
-  int size;
+  pthread_t decoder;
 
-  while (1)
+  if (libusb_init(NULL) < 0)
+    {
+      fprintf(stderr,"Failed to initalise USB interface\n");
+      return (-1);
+    }
+
+  for (int t=0; t<NUM_TRANSFERS; t++)
     {
-      if (libusb_init(NULL) < 0)
+      if (!(_r.transfer[t]=libusb_alloc_transfer(0)))
 	{
-	  fprintf(stderr,"Failed to initalise USB interface\n");
+	  fprintf(stderr,"Failed to allocate USB transfers\n");
 	  return (-1);
 	}
+    }
+
+  if (pthread_create(&decoder,NULL,_decodeThread,NULL))
+    {
+      fprintf(stderr,"Failed to start decoder thread\n");
+      return (-1);
+    }
 
+  while (1)
+    {
       while (!(handle = libusb_open_device_with_vid_pid(NULL, VID, PID)))
 	{
 	  usleep(500000);
 	}
 
-      if (!(dev = libusb_get_device(handle)))
-	continue;
+      if ((!(dev = libusb_get_device(handle))) || (libusb_claim_interface (handle, INTERFACE)<0))
+	{
+	  libusb_close(handle);
+	  usleep(500000);
+	  continue;
+	}
+
+      if (options.verbose)
+	{
+	  fprintf(stderr,"Probe opened\n");
+	}
 
-      if (libusb_claim_interface (handle, INTERFACE)<0)
-	continue;
+      _r.capturing=TRUE;
+      _r.activeTransfers=0;
+      for (int t=0; t<NUM_TRANSFERS; t++)
+	{
+	  libusb_fill_bulk_transfer(_r.transfer[t], handle, ENDPOINT, _r.transferBuf[t], USB_TRANSFER_SIZE,
+				    _usbCallback, NULL, 0);
+	  if (libusb_submit_transfer(_r.transfer[t])<0)
+	    {
+	      _r.capturing=FALSE;
+	      break;
+	    }
+	  _r.activeTransfers++;
+	}
 
-      while (0==libusb_bulk_transfer(handle, ENDPOINT, cbw, TRANSFER_SIZE, &size, 10))
+      /* All the capture work happens in the transfer callbacks run from here */
+      while (_r.activeTransfers)
 	{
-	  unsigned char *c=cbw;
-          if (options.dump)
-          {
-              cbw[size] = 0;
-              printf("%s", (char*)cbw);
-          }
-          else
-              while (size--)
-                  _protocolPump(c++);
+	  struct timeval timeout={.tv_sec=0, .tv_usec=100000};
+
+	  if (!_r.capturing)
+	    for (int t=0; t<NUM_TRANSFERS; t++)
+	      libusb_cancel_transfer(_r.transfer[t]);
+	  libusb_handle_events_timeout(NULL,&timeout);
 	}
 
+      if (options.verbose)
+	{
+	  fprintf(stderr,"Probe lost\n");
+	}
+      libusb_release_interface(handle, INTERFACE);
       libusb_close(handle);
     }
 }
@@ -507,9 +691,7 @@ int serialFeeder(void)
 
       while ((t=read(f,cbw,TRANSFER_SIZE))>0)
 	{
-	  unsigned char *c=cbw;
-	  while (t--)
-	    _protocolPump(c++);
+	  _decodeBuffer(cbw,t);
 	}
       if (options.verbose)
 	{
@@ -0,0 +1,87 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "general.h"
+#include "gdb_packet.h"
+#include "buffer_pool.h"
+
+#ifdef ENABLE_RTT
+#include "rtt_if.h"
+#define BUFFER_POOL_RTT_DEFAULT RTT_UP_BUF_SIZE
+#else
+#define BUFFER_POOL_RTT_DEFAULT 0U
+#endif
+
+/* Smallest SWO share, enough for a few USB packets in flight */
+#ifndef BUFFER_POOL_TRACESWO_MIN
+#define BUFFER_POOL_TRACESWO_MIN 1024U
+#endif
+
+/* SWO's share is at the start of the pool, RTT's at the end */
+static uint32_t buffer_pool[BUFFER_POOL_SIZE / sizeof(uint32_t)];
+static size_t buffer_pool_rtt_size = BUFFER_POOL_RTT_DEFAULT;
+/* The split asked for while SWO is capturing, its buffer can't shrink under it until capture restarts */
+static size_t buffer_pool_rtt_size_next = BUFFER_POOL_RTT_DEFAULT;
+static bool buffer_pool_traceswo_active = false;
+
+bool buffer_pool_set_rtt_size(const size_t rtt_size)
+{
+	if (rtt_size > sizeof(buffer_pool) - BUFFER_POOL_TRACESWO_MIN)
+		return false;
+	/* Keeps RTT's share word aligned, as it sits at the end of the pool */
+	buffer_pool_rtt_size_next = ALIGN(rtt_size, 4U);
+	if (!buffer_pool_traceswo_active)
+		buffer_pool_rtt_size = buffer_pool_rtt_size_next;
+	return true;
+}
+
+char *buffer_pool_rtt(size_t *const size)
+{
+	*size = buffer_pool_rtt_size;
+	return (char *)buffer_pool + sizeof(buffer_pool) - buffer_pool_rtt_size;
+}
+
+uint8_t *buffer_pool_traceswo(size_t *const size)
+{
+	buffer_pool_rtt_size = buffer_pool_rtt_size_next;
+	buffer_pool_traceswo_active = true;
+	*size = sizeof(buffer_pool) - buffer_pool_rtt_size;
+	return (uint8_t *)buffer_pool;
+}
+
+void buffer_pool_show(void)
+{
+	gdb_outf("Buffer pool: %zu bytes, RTT %zu bytes, SWO %zu bytes\n", sizeof(buffer_pool), buffer_pool_rtt_size,
+		sizeof(buffer_pool) - buffer_pool_rtt_size);
+	if (buffer_pool_rtt_size_next != buffer_pool_rtt_size)
+		gdb_outf("RTT gets %zu bytes once SWO capture is restarted\n", buffer_pool_rtt_size_next);
+}
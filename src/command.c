@@ -35,6 +35,13 @@
 #include "serialno.h"
 #include "jtagtap.h"
 
+#include "livewatch.h"
+#include "probe_stats.h"
+#include "scheduler.h"
+#include "swj_freq.h"
+#ifdef BUFFER_POOL_SIZE
+#include "buffer_pool.h"
+#endif
 #ifdef ENABLE_RTT
 #include "rtt.h"
 #endif
@@ -42,6 +49,11 @@
 #ifdef PLATFORM_HAS_TRACESWO
 #include "traceswo.h"
 #endif
+#if PC_HOSTED == 1
+#include "gdb_perf.h"
+#include "flm.h"
+#include "snapshot.h"
+#endif
 
 #if defined(_WIN32) || defined(__CYGWIN__)
 #include <malloc.h>
@@ -55,11 +67,17 @@ static bool cmd_help(target_s *t, int argc, const char **argv);
 static bool cmd_jtag_scan(target_s *t, int argc, const char **argv);
 static bool cmd_swdp_scan(target_s *t, int argc, const char **argv);
 static bool cmd_auto_scan(target_s *t, int argc, const char **argv);
+#ifdef PLATFORM_HAS_SETTINGS
+static bool cmd_boot_scan(target_s *t, int argc, const char **argv);
+#endif
 static bool cmd_frequency(target_s *t, int argc, const char **argv);
 static bool cmd_targets(target_s *t, int argc, const char **argv);
 static bool cmd_morse(target_s *t, int argc, const char **argv);
 static bool cmd_halt_timeout(target_s *t, int argc, const char **argv);
 static bool cmd_connect_reset(target_s *t, int argc, const char **argv);
+static bool cmd_flash_incremental(target_s *t, int argc, const char **argv);
+static bool cmd_flash_blank_check(target_s *t, int argc, const char **argv);
+static bool cmd_flash_verify(target_s *t, int argc, const char **argv);
 static bool cmd_reset(target_s *t, int argc, const char **argv);
 static bool cmd_tdi_low_reset(target_s *t, int argc, const char **argv);
 #ifdef PLATFORM_HAS_POWER_SWITCH
@@ -69,14 +87,24 @@ static bool cmd_target_power(target_s *t, int argc, const char **argv);
 static bool cmd_traceswo(target_s *t, int argc, const char **argv);
 #endif
 static bool cmd_heapinfo(target_s *t, int argc, const char **argv);
+#ifdef BUFFER_POOL_SIZE
+static bool cmd_buffer_pool(target_s *t, int argc, const char **argv);
+#endif
 #ifdef ENABLE_RTT
 static bool cmd_rtt(target_s *t, int argc, const char **argv);
 #endif
+static bool cmd_watch(target_s *t, int argc, const char **argv);
+#ifdef ENABLE_PROBE_STATS
+static bool cmd_stats(target_s *t, int argc, const char **argv);
+#endif
 #if defined(PLATFORM_HAS_DEBUG) && PC_HOSTED == 0
 static bool cmd_debug_bmp(target_s *t, int argc, const char **argv);
 #endif
 #if PC_HOSTED == 1
+static bool cmd_perf(target_s *t, int argc, const char **argv);
 static bool cmd_shutdown_bmda(target_s *t, int argc, const char **argv);
+static bool cmd_flm(target_s *t, int argc, const char **argv);
+static bool cmd_snapshot(target_s *t, int argc, const char **argv);
 #endif
 
 const command_s cmd_list[] = {
@@ -85,11 +113,17 @@ const command_s cmd_list[] = {
 	{"jtag_scan", cmd_jtag_scan, "Scan JTAG chain for devices"},
 	{"swdp_scan", cmd_swdp_scan, "Scan SW-DP for devices"},
 	{"auto_scan", cmd_auto_scan, "Automatically scan all chain types for devices"},
-	{"frequency", cmd_frequency, "set minimum high and low times"},
+#ifdef PLATFORM_HAS_SETTINGS
+	{"boot_scan", cmd_boot_scan, "Auto scan at power-up, kept across power cycles: (disable|scan|attach)"},
+#endif
+	{"frequency", cmd_frequency, "set minimum high and low times, or 'auto' to adapt to line errors"},
 	{"targets", cmd_targets, "Display list of available targets"},
 	{"morse", cmd_morse, "Display morse error message"},
 	{"halt_timeout", cmd_halt_timeout, "Timeout (ms) to wait until Cortex-M is halted: (Default 2000)"},
 	{"connect_rst", cmd_connect_reset, "Configure connect under reset: (enable|disable)"},
+	{"flash_incremental", cmd_flash_incremental, "Skip erasing and writing unchanged Flash blocks: (enable|disable)"},
+	{"flash_blank_check", cmd_flash_blank_check, "Skip erasing Flash blocks that are already blank: (enable|disable)"},
+	{"flash_verify", cmd_flash_verify, "Read back Flash as it is being written: (enable|disable)"},
 	{"reset", cmd_reset, "Pulse the nRST line - disconnects target"},
 	{"tdi_low_reset", cmd_tdi_low_reset,
 		"Pulse nRST with TDI set low to attempt to wake certain targets up (eg LPC82x)"},
@@ -97,21 +131,32 @@ const command_s cmd_list[] = {
 	{"tpwr", cmd_target_power, "Supplies power to the target: (enable|disable)"},
 #endif
 #ifdef ENABLE_RTT
-	{"rtt", cmd_rtt, "enable|disable|status|channel 0..15|ident (str)|cblock|ram|poll maxms minms maxerr"},
+	{"rtt", cmd_rtt,
+		"enable|disable|status|channel 0..15|ident (str)|cblock|ram|poll maxms minms maxerr|qos bytes/ms holdoff"},
+#endif
+	{"watch", cmd_watch, "Sample memory while running: add <addr> <len> <period_ms>|del <n>|clear"},
+#ifdef ENABLE_PROBE_STATS
+	{"stats", cmd_stats, "Show or clear the probe hot path counters: (reset)"},
 #endif
 #ifdef PLATFORM_HAS_TRACESWO
 #if defined TRACESWO_PROTOCOL && TRACESWO_PROTOCOL == 2
-	{"traceswo", cmd_traceswo, "Start trace capture, NRZ mode: (baudrate) (decode channel ...)"},
+	{"traceswo", cmd_traceswo, "Start trace capture, NRZ mode: (baudrate|auto) (decode channel ...)"},
 #else
 	{"traceswo", cmd_traceswo, "Start trace capture, Manchester mode: (decode channel ...)"},
 #endif
 #endif
 	{"heapinfo", cmd_heapinfo, "Set semihosting heapinfo"},
+#ifdef BUFFER_POOL_SIZE
+	{"buffer_pool", cmd_buffer_pool, "Bytes of the buffer pool for RTT, SWO gets the rest: (rtt_bytes)"},
+#endif
 #if defined(PLATFORM_HAS_DEBUG) && PC_HOSTED == 0
 	{"debug_bmp", cmd_debug_bmp, "Output BMP \"debug\" strings to the second vcom: (enable|disable)"},
 #endif
 #if PC_HOSTED == 1
+	{"perf", cmd_perf, "Show or clear the GDB packet latency and probe transport times: (reset)"},
 	{"shutdown_bmda", cmd_shutdown_bmda, "Tell the BMDA server to shut down when the GDB connection closes"},
+	{"flm", cmd_flm, "Program Flash using a CMSIS-Pack flash algorithm, reattach after: (file)"},
+	{"snapshot", cmd_snapshot, "Copy RAM, restoring only the pages that changed: (save [addr len]|restore|clear)"},
 #endif
 	{NULL, NULL, NULL},
 };
@@ -341,10 +386,64 @@ bool cmd_auto_scan(target_s *t, int argc, const char **argv)
 	return true;
 }
 
-bool cmd_frequency(target_s *t, int argc, const char **argv)
+#ifdef PLATFORM_HAS_SETTINGS
+static bool cmd_boot_scan(target_s *t, int argc, const char **argv)
 {
 	(void)t;
+	uint32_t settings = platform_settings_get();
+	if (argc > 2) {
+		gdb_out("usage: monitor boot_scan [disable|scan|attach]\n");
+		return false;
+	}
 	if (argc == 2) {
+		settings &= ~(PLATFORM_SETTING_BOOT_SCAN | PLATFORM_SETTING_AUTO_ATTACH);
+		if (!strcmp(argv[1], "scan"))
+			settings |= PLATFORM_SETTING_BOOT_SCAN;
+		else if (!strcmp(argv[1], "attach"))
+			settings |= PLATFORM_SETTING_BOOT_SCAN | PLATFORM_SETTING_AUTO_ATTACH;
+		else if (strcmp(argv[1], "disable") != 0) {
+			gdb_out("usage: monitor boot_scan [disable|scan|attach]\n");
+			return false;
+		}
+		if (!platform_settings_set(settings)) {
+			gdb_out("Saving the setting failed\n");
+			return false;
+		}
+	}
+
+	if (!(settings & PLATFORM_SETTING_BOOT_SCAN))
+		gdb_out("Scan at power-up: disabled\n");
+	else
+		gdb_outf("Scan at power-up: enabled%s\n",
+			settings & PLATFORM_SETTING_AUTO_ATTACH ? ", attaching GDB to the first target found" : "");
+	return true;
+}
+
+/*
+ * The power-up half of 'monitor boot_scan', leaving the target list ready for the first GDB session.
+ * Nobody is listening yet, so unlike 'monitor auto_scan' this doesn't report anything.
+ */
+void command_boot_scan(void)
+{
+	if (!(platform_settings_get() & PLATFORM_SETTING_BOOT_SCAN))
+		return;
+
+	volatile exception_s e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		if (!jtag_scan(NULL))
+			adiv5_swdp_scan(0);
+	}
+	platform_target_clk_output_enable(false);
+}
+#endif
+
+bool cmd_frequency(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 2 && !strcmp(argv[1], "auto")) {
+		if (!swj_freq_adaptive_enable(true))
+			gdb_out("Adaptive mode unavailable as SWJ freq is fixed\n");
+	} else if (argc == 2) {
 		char *multiplier = NULL;
 		uint32_t frequency = strtoul(argv[1], &multiplier, 10);
 		if (!multiplier) {
@@ -359,13 +458,14 @@ bool cmd_frequency(target_s *t, int argc, const char **argv)
 			frequency *= 1000U * 1000U;
 			break;
 		}
+		swj_freq_adaptive_enable(false);
 		platform_max_frequency_set(frequency);
 	}
 	const uint32_t freq = platform_max_frequency_get();
 	if (freq == FREQ_FIXED)
 		gdb_outf("SWJ freq fixed\n");
 	else
-		gdb_outf("Current SWJ freq %" PRIu32 "Hz\n", freq);
+		gdb_outf("Current SWJ freq %" PRIu32 "Hz%s\n", freq, swj_freq_is_adaptive() ? " (adaptive)" : "");
 	return true;
 }
 
@@ -441,6 +541,57 @@ static bool cmd_connect_reset(target_s *t, int argc, const char **argv)
 	return true;
 }
 
+static bool cmd_flash_incremental(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	bool print_status = false;
+	if (argc == 1)
+		print_status = true;
+	else if (argc == 2) {
+		if (parse_enable_or_disable(argv[1], &target_flash_incremental))
+			print_status = true;
+	} else
+		gdb_out("Unrecognized command format\n");
+
+	if (print_status)
+		gdb_outf("Incremental Flash programming: %s\n", target_flash_incremental ? "enabled" : "disabled");
+	return true;
+}
+
+static bool cmd_flash_blank_check(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	bool print_status = false;
+	if (argc == 1)
+		print_status = true;
+	else if (argc == 2) {
+		if (parse_enable_or_disable(argv[1], &target_flash_blank_check))
+			print_status = true;
+	} else
+		gdb_out("Unrecognized command format\n");
+
+	if (print_status)
+		gdb_outf("Flash blank check before erase: %s\n", target_flash_blank_check ? "enabled" : "disabled");
+	return true;
+}
+
+static bool cmd_flash_verify(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	bool print_status = false;
+	if (argc == 1)
+		print_status = true;
+	else if (argc == 2) {
+		if (parse_enable_or_disable(argv[1], &target_flash_verify))
+			print_status = true;
+	} else
+		gdb_out("Unrecognized command format\n");
+
+	if (print_status)
+		gdb_outf("Inline Flash verify: %s\n", target_flash_verify ? "enabled" : "disabled");
+	return true;
+}
+
 static bool cmd_halt_timeout(target_s *t, int argc, const char **argv)
 {
 	(void)t;
@@ -530,6 +681,8 @@ static bool cmd_rtt(target_s *t, int argc, const char **argv)
 			gdb_outf("ram: 0x%08" PRIx32 " 0x%08" PRIx32, rtt_ram_start, rtt_ram_end);
 		gdb_outf(
 			"\nmax poll ms: %u min poll ms: %u max errs: %u\n", rtt_max_poll_ms, rtt_min_poll_ms, rtt_max_poll_errs);
+		gdb_outf("link budget bytes/ms: %" PRIu32 " gdb holdoff ms: %" PRIu32 "\n", scheduler_link_budget,
+			scheduler_gdb_holdoff_ms);
 	} else if (argc >= 2 && strncmp(argv[1], "channel", command_len) == 0) {
 		/* mon rtt channel switches to auto rtt channel selection
 		   mon rtt channel number... selects channels given */
@@ -549,6 +702,13 @@ static bool cmd_rtt(target_s *t, int argc, const char **argv)
 		rtt_ident[0] = '\0';
 	else if (argc == 2 && strncmp(argv[1], "poll", command_len) == 0)
 		gdb_outf("%u %u %u\n", rtt_max_poll_ms, rtt_min_poll_ms, rtt_max_poll_errs);
+	else if (argc == 2 && strncmp(argv[1], "qos", command_len) == 0)
+		gdb_outf("%" PRIu32 " %" PRIu32 "\n", scheduler_link_budget, scheduler_gdb_holdoff_ms);
+	else if (argc == 4 && strncmp(argv[1], "qos", command_len) == 0) {
+		/* Share of the link RTT and live watch get, and how long they give way to GDB for */
+		scheduler_link_budget = MIN(strtoul(argv[2], NULL, 0), SCHEDULER_MAX_LINK_BUDGET);
+		scheduler_gdb_holdoff_ms = strtoul(argv[3], NULL, 0);
+	}
 	else if (argc == 2 && strncmp(argv[1], "cblock", command_len) == 0) {
 		gdb_outf("cbaddr: 0x%x\n", rtt_cbaddr);
 		gdb_out("ch ena i/o buffer@      size   head   tail flag\n");
@@ -583,6 +743,53 @@ static bool cmd_rtt(target_s *t, int argc, const char **argv)
 }
 #endif
 
+static bool cmd_watch(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 1) {
+		livewatch_list();
+		return true;
+	}
+	const size_t command_len = strlen(argv[1]);
+	if (argc == 5 && strncmp(argv[1], "add", command_len) == 0) {
+		const target_addr_t addr = strtoul(argv[2], NULL, 0);
+		const size_t length = strtoul(argv[3], NULL, 0);
+		const uint32_t period = strtoul(argv[4], NULL, 0);
+		if (!livewatch_add(addr, length, period)) {
+			gdb_outf("Could not add watch, at most %u of up to %u bytes each\n", LIVEWATCH_MAX_ENTRIES,
+				LIVEWATCH_MAX_LENGTH);
+			return false;
+		}
+	} else if (argc == 3 && strncmp(argv[1], "del", command_len) == 0) {
+		if (!livewatch_remove(strtoul(argv[2], NULL, 0))) {
+			gdb_out("No such watch\n");
+			return false;
+		}
+	} else if (argc == 2 && strncmp(argv[1], "clear", command_len) == 0)
+		livewatch_clear();
+	else {
+		gdb_out("usage: monitor watch [add <addr> <len> <period_ms>|del <n>|clear]\n");
+		return false;
+	}
+	return true;
+}
+
+#ifdef ENABLE_PROBE_STATS
+static bool cmd_stats(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 1)
+		probe_stats_show();
+	else if (argc == 2 && strcmp(argv[1], "reset") == 0)
+		probe_stats_reset();
+	else {
+		gdb_out("usage: monitor stats [reset]\n");
+		return false;
+	}
+	return true;
+}
+#endif
+
 #ifdef PLATFORM_HAS_TRACESWO
 static bool cmd_traceswo(target_s *t, int argc, const char **argv)
 {
@@ -593,8 +800,15 @@ static bool cmd_traceswo(target_s *t, int argc, const char **argv)
 	uint32_t swo_channelmask = 0; /* swo decoding off */
 	uint8_t decode_arg = 1;
 #if TRACESWO_PROTOCOL == 2
-	/* argument: optional baud rate for async mode */
-	if (argc > 1 && argv[1][0] >= '0' && argv[1][0] <= '9') {
+	/* argument: optional baud rate for async mode, or 'auto' to measure it */
+	if (argc > 1 && !strcmp(argv[1], "auto")) {
+		baudrate = traceswo_detect_baudrate();
+		if (baudrate == 0) {
+			gdb_out("Could not detect the SWO baud rate, is the target sending trace data?\n");
+			return false;
+		}
+		decode_arg = 2;
+	} else if (argc > 1 && argv[1][0] >= '0' && argv[1][0] <= '9') {
 		baudrate = strtoul(argv[1], NULL, 0);
 		if (baudrate == 0)
 			baudrate = SWO_DEFAULT_BAUD;
@@ -654,6 +868,20 @@ static bool cmd_debug_bmp(target_s *t, int argc, const char **argv)
 #endif
 
 #if PC_HOSTED == 1
+static bool cmd_perf(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 1)
+		gdb_perf_show(true);
+	else if (argc == 2 && strcmp(argv[1], "reset") == 0)
+		gdb_perf_reset();
+	else {
+		gdb_out("usage: monitor perf [reset]\n");
+		return false;
+	}
+	return true;
+}
+
 static bool cmd_shutdown_bmda(target_s *t, int argc, const char **argv)
 {
 	(void)t;
@@ -662,10 +890,76 @@ static bool cmd_shutdown_bmda(target_s *t, int argc, const char **argv)
 	shutdown_bmda = true;
 	return true;
 }
+
+static bool cmd_flm(target_s *t, int argc, const char **argv)
+{
+	if (!t) {
+		gdb_out("No target attached\n");
+		return false;
+	}
+	if (argc != 2) {
+		gdb_out("usage: monitor flm <file>\n");
+		return false;
+	}
+	if (!flm_load(t, argv[1])) {
+		gdb_outf("Could not use the flash algorithm in %s\n", argv[1]);
+		return false;
+	}
+	return true;
+}
+
+static bool cmd_snapshot(target_s *t, int argc, const char **argv)
+{
+	if (argc == 1) {
+		snapshot_show();
+		return true;
+	}
+	const size_t command_len = strlen(argv[1]);
+	if (argc == 2 && strncmp(argv[1], "clear", command_len) == 0) {
+		snapshot_clear();
+		return true;
+	}
+	if (!t) {
+		gdb_out("No target attached\n");
+		return false;
+	}
+	if ((argc == 2 || argc == 4) && strncmp(argv[1], "save", command_len) == 0) {
+		const target_addr_t addr = argc == 4 ? strtoul(argv[2], NULL, 0) : 0U;
+		const size_t length = argc == 4 ? strtoul(argv[3], NULL, 0) : 0U;
+		if (!snapshot_save(t, addr, length)) {
+			gdb_out("Could not take the snapshot\n");
+			return false;
+		}
+		snapshot_show();
+		return true;
+	}
+	if (argc == 2 && strncmp(argv[1], "restore", command_len) == 0)
+		return snapshot_restore(t);
+	gdb_out("usage: monitor snapshot [save [addr len]|restore|clear]\n");
+	return false;
+}
+#endif
+
+#ifdef BUFFER_POOL_SIZE
+static bool cmd_buffer_pool(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1 && !buffer_pool_set_rtt_size(strtoul(argv[1], NULL, 0)))
+		gdb_out("That leaves too little of the buffer pool for SWO\n");
+	buffer_pool_show();
+	return true;
+}
 #endif
 
 static bool cmd_heapinfo(target_s *t, int argc, const char **argv)
 {
+	if (argc == 1) {
+		size_t used;
+		size_t high_water;
+		size_t size;
+		target_arena_usage(&used, &high_water, &size);
+		gdb_outf("Target arena: %zu of %zu bytes used, high water mark %zu bytes\n", used, size, high_water);
+	}
 	if (t == NULL)
 		gdb_out("not attached\n");
 	else if (argc == 5) {
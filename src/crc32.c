@@ -20,7 +20,9 @@
 
 #include "general.h"
 #include "target.h"
+#include "target_internal.h"
 #include "gdb_if.h"
+#include "crc32.h"
 
 #if !defined(STM32F0) && !defined(STM32F1) && !defined(STM32F2) && !defined(STM32F3) && !defined(STM32F4) && \
 	!defined(STM32F7) && !defined(STM32L0) && !defined(STM32L1) && !defined(STM32G0) && !defined(STM32G4)
@@ -100,7 +102,47 @@ static uint32_t crc32_calc(const uint32_t crc, const uint8_t data)
 	return (crc << 8U) ^ crc32_table[((crc >> 24U) ^ data) & 0xffU];
 }
 
-bool generic_crc32(target_s *const t, uint32_t *const crc_res, uint32_t base, size_t len)
+#if PC_HOSTED == 1
+/*
+ * Slice-by-8 tables: entry [n][x] is the CRC contribution of byte x followed by n zero bytes,
+ * letting 8 bytes be folded in per step rather than one. [0] is crc32_table itself.
+ */
+static uint32_t crc32_slice_table[8][256];
+static bool crc32_slice_table_valid = false;
+
+static void crc32_slice_table_init(void)
+{
+	for (size_t i = 0; i < 256U; ++i)
+		crc32_slice_table[0][i] = crc32_table[i];
+	for (size_t slice = 1; slice < 8U; ++slice) {
+		for (size_t i = 0; i < 256U; ++i) {
+			const uint32_t prev = crc32_slice_table[slice - 1U][i];
+			crc32_slice_table[slice][i] = (prev << 8U) ^ crc32_table[prev >> 24U];
+		}
+	}
+	crc32_slice_table_valid = true;
+}
+#endif
+
+static uint32_t crc32_calc_buffer(uint32_t crc, const uint8_t *data, size_t len)
+{
+#if PC_HOSTED == 1
+	if (!crc32_slice_table_valid)
+		crc32_slice_table_init();
+	for (; len >= 8U; data += 8U, len -= 8U) {
+		crc ^= ((uint32_t)data[0] << 24U) | ((uint32_t)data[1] << 16U) | ((uint32_t)data[2] << 8U) | data[3];
+		crc = crc32_slice_table[7][crc >> 24U] ^ crc32_slice_table[6][(crc >> 16U) & 0xffU] ^
+			crc32_slice_table[5][(crc >> 8U) & 0xffU] ^ crc32_slice_table[4][crc & 0xffU] ^
+			crc32_slice_table[3][data[4]] ^ crc32_slice_table[2][data[5]] ^ crc32_slice_table[1][data[6]] ^
+			crc32_slice_table[0][data[7]];
+	}
+#endif
+	for (size_t i = 0; i < len; ++i)
+		crc = crc32_calc(crc, data[i]);
+	return crc;
+}
+
+bool generic_crc32_readback(target_s *const t, uint32_t *const crc_res, uint32_t base, size_t len)
 {
 	uint32_t crc = 0xffffffffU;
 #if PC_HOSTED == 1
@@ -129,22 +171,41 @@ bool generic_crc32(target_s *const t, uint32_t *const crc_res, uint32_t base, si
 			return false;
 		}
 
-		for (size_t i = 0; i < read_len; i++)
-			crc = crc32_calc(crc, bytes[i]);
+		crc = crc32_calc_buffer(crc, bytes, read_len);
 
 		base += read_len;
 		len -= read_len;
 	}
-	DEBUG_WARN("%" PRIu32 " ms\n", platform_time_ms() - start_time);
+	DEBUG_INFO("%" PRIu32 " ms\n", platform_time_ms() - start_time);
 	*crc_res = crc;
 	return true;
 }
 #else
 #include <libopencm3/stm32/crc.h>
 
-bool generic_crc32(target_s *const t, uint32_t *const crc_res, uint32_t base, size_t len)
+static uint32_t crc32_calc(uint32_t crc, const uint8_t data)
 {
-	uint8_t bytes[128];
+	crc ^= (uint32_t)data << 24U;
+	for (size_t i = 0; i < 8U; i++) {
+		if (crc & 0x80000000U)
+			crc = (crc << 1U) ^ 0x4c11db7U;
+		else
+			crc <<= 1U;
+	}
+	return crc;
+}
+
+static uint32_t crc32_calc_buffer(uint32_t crc, const uint8_t *const data, const size_t len)
+{
+	for (size_t i = 0; i < len; ++i)
+		crc = crc32_calc(crc, data[i]);
+	return crc;
+}
+
+bool generic_crc32_readback(target_s *const t, uint32_t *const crc_res, uint32_t base, size_t len)
+{
+	/* Word typed so the CRC unit can be fed with aligned loads, which Cortex-M0 parts require */
+	uint32_t words[32];
 
 	CRC_CR |= CRC_CR_RESET;
 
@@ -155,14 +216,14 @@ bool generic_crc32(target_s *const t, uint32_t *const crc_res, uint32_t base, si
 			last_time = actual_time;
 			gdb_if_putchar(0, true);
 		}
-		const size_t read_len = MIN(sizeof(bytes), len) & ~3U;
-		if (target_mem_read(t, bytes, base, read_len)) {
+		const size_t read_len = MIN(sizeof(words), len) & ~3U;
+		if (target_mem_read(t, words, base, read_len)) {
 			DEBUG_WARN("generic_crc32 error around address 0x%08" PRIx32 "\n", base);
 			return false;
 		}
 
-		for (size_t i = 0; i < read_len; i += 4U)
-			CRC_DR = __builtin_bswap32(*(uint32_t *)(bytes + i));
+		for (size_t i = 0; i < read_len / 4U; ++i)
+			CRC_DR = __builtin_bswap32(words[i]);
 
 		base += read_len;
 		len -= read_len;
@@ -170,21 +231,47 @@ bool generic_crc32(target_s *const t, uint32_t *const crc_res, uint32_t base, si
 
 	uint32_t crc = CRC_DR;
 
-	if (target_mem_read(t, bytes, base, len)) {
+	if (target_mem_read(t, words, base, len)) {
 		DEBUG_WARN("generic_crc32 error around address 0x%08" PRIx32 "\n", base);
 		return false;
 	}
-	uint8_t *data = bytes;
-	while (len--) {
-		crc ^= *data++ << 24U;
-		for (size_t i = 0; i < 8U; i++) {
-			if (crc & 0x80000000U)
-				crc = (crc << 1U) ^ 0x4c11db7U;
-			else
-				crc <<= 1U;
-		}
-	}
-	*crc_res = crc;
+	*crc_res = crc32_calc_buffer(crc, (const uint8_t *)words, len);
 	return true;
 }
 #endif
+
+bool generic_crc32(target_s *const t, uint32_t *const crc_res, const uint32_t base, const size_t len)
+{
+	/* Let the target compute the CRC itself where it can, saving reading the whole region back */
+	if (t->mem_crc32 && t->mem_crc32(t, crc_res, base, len))
+		return true;
+	return generic_crc32_readback(t, crc_res, base, len);
+}
+
+uint32_t generic_crc32_buffer(const void *const data, const size_t len)
+{
+	return crc32_calc_buffer(0xffffffffU, (const uint8_t *)data, len);
+}
+
+/* Erase checks ask for the same block size over and over, so the last result is kept */
+uint32_t generic_crc32_fill(const uint8_t value, const size_t len)
+{
+	static uint8_t last_value;
+	static size_t last_len;
+	static uint32_t last_crc;
+	if (len && len == last_len && value == last_value)
+		return last_crc;
+
+	uint8_t bytes[64];
+	memset(bytes, value, sizeof(bytes));
+	uint32_t crc = 0xffffffffU;
+	for (size_t remaining = len; remaining;) {
+		const size_t chunk = MIN(remaining, sizeof(bytes));
+		crc = crc32_calc_buffer(crc, bytes, chunk);
+		remaining -= chunk;
+	}
+	last_value = value;
+	last_len = len;
+	last_crc = crc;
+	return crc;
+}
@@ -0,0 +1,399 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements evaluation of GDB agent expressions, as sent with the condition list of
+ * breakpoint Z packets, so conditional breakpoints can be checked on the probe itself. Only the
+ * integer subset of the bytecode is supported - anything touching floating point, trace buffers
+ * or trace state variables makes the expression unevaluable and leaves the decision to GDB.
+ *
+ * See https://sourceware.org/gdb/current/onlinedocs/gdb.html/Bytecode-Descriptions.html
+ */
+
+#include "general.h"
+#include "gdb_agent.h"
+#include "hex_utils.h"
+
+#define GDB_AGENT_STACK_DEPTH 16U
+/* Bounds the number of operations executed so a backwards goto can't hang the probe */
+#define GDB_AGENT_MAX_STEPS 1024U
+
+typedef enum gdb_agent_op {
+	GDB_AGENT_OP_ADD = 0x02U,
+	GDB_AGENT_OP_SUB = 0x03U,
+	GDB_AGENT_OP_MUL = 0x04U,
+	GDB_AGENT_OP_DIV_SIGNED = 0x05U,
+	GDB_AGENT_OP_DIV_UNSIGNED = 0x06U,
+	GDB_AGENT_OP_REM_SIGNED = 0x07U,
+	GDB_AGENT_OP_REM_UNSIGNED = 0x08U,
+	GDB_AGENT_OP_LSH = 0x09U,
+	GDB_AGENT_OP_RSH_SIGNED = 0x0aU,
+	GDB_AGENT_OP_RSH_UNSIGNED = 0x0bU,
+	GDB_AGENT_OP_LOG_NOT = 0x0eU,
+	GDB_AGENT_OP_BIT_AND = 0x0fU,
+	GDB_AGENT_OP_BIT_OR = 0x10U,
+	GDB_AGENT_OP_BIT_XOR = 0x11U,
+	GDB_AGENT_OP_BIT_NOT = 0x12U,
+	GDB_AGENT_OP_EQUAL = 0x13U,
+	GDB_AGENT_OP_LESS_SIGNED = 0x14U,
+	GDB_AGENT_OP_LESS_UNSIGNED = 0x15U,
+	GDB_AGENT_OP_EXT = 0x16U,
+	GDB_AGENT_OP_REF8 = 0x17U,
+	GDB_AGENT_OP_REF16 = 0x18U,
+	GDB_AGENT_OP_REF32 = 0x19U,
+	GDB_AGENT_OP_REF64 = 0x1aU,
+	GDB_AGENT_OP_IF_GOTO = 0x20U,
+	GDB_AGENT_OP_GOTO = 0x21U,
+	GDB_AGENT_OP_CONST8 = 0x22U,
+	GDB_AGENT_OP_CONST16 = 0x23U,
+	GDB_AGENT_OP_CONST32 = 0x24U,
+	GDB_AGENT_OP_CONST64 = 0x25U,
+	GDB_AGENT_OP_REG = 0x26U,
+	GDB_AGENT_OP_END = 0x27U,
+	GDB_AGENT_OP_DUP = 0x28U,
+	GDB_AGENT_OP_POP = 0x29U,
+	GDB_AGENT_OP_ZERO_EXT = 0x2aU,
+	GDB_AGENT_OP_SWAP = 0x2bU,
+	GDB_AGENT_OP_PICK = 0x32U,
+	GDB_AGENT_OP_ROT = 0x33U,
+} gdb_agent_op_e;
+
+typedef struct gdb_agent_state {
+	target_s *target;
+	uint64_t stack[GDB_AGENT_STACK_DEPTH];
+	size_t depth;
+} gdb_agent_state_s;
+
+/* Operands are big endian, returns false if the expression ends before the whole operand */
+static bool gdb_agent_operand(
+	const uint8_t *const expr, const size_t length, size_t *const offset, const size_t size, uint64_t *const value)
+{
+	if (*offset + size > length)
+		return false;
+	*value = 0U;
+	for (size_t idx = 0; idx < size; ++idx)
+		*value = (*value << 8U) | expr[(*offset)++];
+	return true;
+}
+
+static bool gdb_agent_push(gdb_agent_state_s *const state, const uint64_t value)
+{
+	if (state->depth == GDB_AGENT_STACK_DEPTH)
+		return false;
+	state->stack[state->depth++] = value;
+	return true;
+}
+
+static inline uint64_t gdb_agent_sign_extend(const uint64_t value, const uint8_t bits)
+{
+	if (!bits || bits >= 64U)
+		return value;
+	const uint64_t sign = UINT64_C(1) << (bits - 1U);
+	const uint64_t masked = value & ((UINT64_C(1) << bits) - 1U);
+	return (masked ^ sign) - sign;
+}
+
+static inline uint64_t gdb_agent_zero_extend(const uint64_t value, const uint8_t bits)
+{
+	if (!bits || bits >= 64U)
+		return value;
+	return value & ((UINT64_C(1) << bits) - 1U);
+}
+
+/* Target memory and registers are read as little endian values */
+static bool gdb_agent_ref(gdb_agent_state_s *const state, const size_t size)
+{
+	uint8_t data[8U];
+	const target_addr_t addr = (target_addr_t)state->stack[state->depth - 1U];
+	if (target_mem_read(state->target, data, addr, size))
+		return false;
+	uint64_t value = 0U;
+	for (size_t idx = size; idx--;)
+		value = (value << 8U) | data[idx];
+	state->stack[state->depth - 1U] = value;
+	return true;
+}
+
+static bool gdb_agent_reg(gdb_agent_state_s *const state, const uint16_t reg)
+{
+	uint8_t data[8U];
+	const ssize_t size = target_reg_read(state->target, reg, data, sizeof(data));
+	if (size <= 0)
+		return false;
+	uint64_t value = 0U;
+	for (size_t idx = (size_t)size; idx--;)
+		value = (value << 8U) | data[idx];
+	return gdb_agent_push(state, value);
+}
+
+/* Apply one of the operations taking a and b off the stack and leaving a single result */
+static bool gdb_agent_binary(gdb_agent_state_s *const state, const uint8_t op)
+{
+	const uint64_t b = state->stack[--state->depth];
+	const uint64_t a = state->stack[state->depth - 1U];
+	uint64_t result;
+	switch (op) {
+	case GDB_AGENT_OP_ADD:
+		result = a + b;
+		break;
+	case GDB_AGENT_OP_SUB:
+		result = a - b;
+		break;
+	case GDB_AGENT_OP_MUL:
+		result = a * b;
+		break;
+	case GDB_AGENT_OP_DIV_SIGNED:
+		if (!b || ((int64_t)a == INT64_MIN && (int64_t)b == -1))
+			return false;
+		result = (uint64_t)((int64_t)a / (int64_t)b);
+		break;
+	case GDB_AGENT_OP_DIV_UNSIGNED:
+		if (!b)
+			return false;
+		result = a / b;
+		break;
+	case GDB_AGENT_OP_REM_SIGNED:
+		if (!b || ((int64_t)a == INT64_MIN && (int64_t)b == -1))
+			return false;
+		result = (uint64_t)((int64_t)a % (int64_t)b);
+		break;
+	case GDB_AGENT_OP_REM_UNSIGNED:
+		if (!b)
+			return false;
+		result = a % b;
+		break;
+	case GDB_AGENT_OP_LSH:
+		result = b < 64U ? a << b : 0U;
+		break;
+	case GDB_AGENT_OP_RSH_SIGNED:
+		result = (uint64_t)((int64_t)a >> MIN(b, 63U));
+		break;
+	case GDB_AGENT_OP_RSH_UNSIGNED:
+		result = b < 64U ? a >> b : 0U;
+		break;
+	case GDB_AGENT_OP_BIT_AND:
+		result = a & b;
+		break;
+	case GDB_AGENT_OP_BIT_OR:
+		result = a | b;
+		break;
+	case GDB_AGENT_OP_BIT_XOR:
+		result = a ^ b;
+		break;
+	case GDB_AGENT_OP_EQUAL:
+		result = a == b;
+		break;
+	case GDB_AGENT_OP_LESS_SIGNED:
+		result = (int64_t)a < (int64_t)b;
+		break;
+	case GDB_AGENT_OP_LESS_UNSIGNED:
+		result = a < b;
+		break;
+	default:
+		return false;
+	}
+	state->stack[state->depth - 1U] = result;
+	return true;
+}
+
+/* Evaluate a single expression, returning false if it can't be evaluated here */
+static bool gdb_agent_eval(target_s *const t, const uint8_t *const expr, const size_t length, uint64_t *const result)
+{
+	gdb_agent_state_s state = {.target = t};
+	size_t offset = 0U;
+	for (size_t steps = 0U; steps < GDB_AGENT_MAX_STEPS && offset < length; ++steps) {
+		const uint8_t op = expr[offset++];
+		uint64_t operand = 0U;
+		switch (op) {
+		case GDB_AGENT_OP_ADD:
+		case GDB_AGENT_OP_SUB:
+		case GDB_AGENT_OP_MUL:
+		case GDB_AGENT_OP_DIV_SIGNED:
+		case GDB_AGENT_OP_DIV_UNSIGNED:
+		case GDB_AGENT_OP_REM_SIGNED:
+		case GDB_AGENT_OP_REM_UNSIGNED:
+		case GDB_AGENT_OP_LSH:
+		case GDB_AGENT_OP_RSH_SIGNED:
+		case GDB_AGENT_OP_RSH_UNSIGNED:
+		case GDB_AGENT_OP_BIT_AND:
+		case GDB_AGENT_OP_BIT_OR:
+		case GDB_AGENT_OP_BIT_XOR:
+		case GDB_AGENT_OP_EQUAL:
+		case GDB_AGENT_OP_LESS_SIGNED:
+		case GDB_AGENT_OP_LESS_UNSIGNED:
+			if (state.depth < 2U || !gdb_agent_binary(&state, op))
+				return false;
+			break;
+		case GDB_AGENT_OP_LOG_NOT:
+		case GDB_AGENT_OP_BIT_NOT:
+			if (!state.depth)
+				return false;
+			state.stack[state.depth - 1U] =
+				op == GDB_AGENT_OP_LOG_NOT ? !state.stack[state.depth - 1U] : ~state.stack[state.depth - 1U];
+			break;
+		case GDB_AGENT_OP_EXT:
+		case GDB_AGENT_OP_ZERO_EXT:
+			if (!state.depth || !gdb_agent_operand(expr, length, &offset, 1U, &operand))
+				return false;
+			state.stack[state.depth - 1U] = op == GDB_AGENT_OP_EXT ?
+				gdb_agent_sign_extend(state.stack[state.depth - 1U], (uint8_t)operand) :
+				gdb_agent_zero_extend(state.stack[state.depth - 1U], (uint8_t)operand);
+			break;
+		case GDB_AGENT_OP_REF8:
+		case GDB_AGENT_OP_REF16:
+		case GDB_AGENT_OP_REF32:
+		case GDB_AGENT_OP_REF64:
+			if (!state.depth || !gdb_agent_ref(&state, 1U << (op - GDB_AGENT_OP_REF8)))
+				return false;
+			break;
+		case GDB_AGENT_OP_IF_GOTO:
+		case GDB_AGENT_OP_GOTO:
+			if (!gdb_agent_operand(expr, length, &offset, 2U, &operand))
+				return false;
+			if (op == GDB_AGENT_OP_IF_GOTO) {
+				if (!state.depth)
+					return false;
+				if (!state.stack[--state.depth])
+					break;
+			}
+			offset = (size_t)operand;
+			break;
+		case GDB_AGENT_OP_CONST8:
+		case GDB_AGENT_OP_CONST16:
+		case GDB_AGENT_OP_CONST32:
+		case GDB_AGENT_OP_CONST64:
+			if (!gdb_agent_operand(expr, length, &offset, 1U << (op - GDB_AGENT_OP_CONST8), &operand) ||
+				!gdb_agent_push(&state, operand))
+				return false;
+			break;
+		case GDB_AGENT_OP_REG:
+			if (!gdb_agent_operand(expr, length, &offset, 2U, &operand) ||
+				!gdb_agent_reg(&state, (uint16_t)operand))
+				return false;
+			break;
+		case GDB_AGENT_OP_END:
+			if (!state.depth)
+				return false;
+			*result = state.stack[state.depth - 1U];
+			return true;
+		case GDB_AGENT_OP_DUP:
+			if (!state.depth || !gdb_agent_push(&state, state.stack[state.depth - 1U]))
+				return false;
+			break;
+		case GDB_AGENT_OP_POP:
+			if (!state.depth)
+				return false;
+			--state.depth;
+			break;
+		case GDB_AGENT_OP_SWAP: {
+			if (state.depth < 2U)
+				return false;
+			const uint64_t top = state.stack[state.depth - 1U];
+			state.stack[state.depth - 1U] = state.stack[state.depth - 2U];
+			state.stack[state.depth - 2U] = top;
+			break;
+		}
+		case GDB_AGENT_OP_PICK:
+			if (!gdb_agent_operand(expr, length, &offset, 1U, &operand) || operand >= state.depth ||
+				!gdb_agent_push(&state, state.stack[state.depth - 1U - operand]))
+				return false;
+			break;
+		case GDB_AGENT_OP_ROT: {
+			/* a b c => c a b */
+			if (state.depth < 3U)
+				return false;
+			uint64_t *const items = state.stack + state.depth - 3U;
+			const uint64_t c = items[2];
+			items[2] = items[1];
+			items[1] = items[0];
+			items[0] = c;
+			break;
+		}
+		default:
+			DEBUG_WARN("Agent expression uses unsupported op %02x\n", op);
+			return false;
+		}
+	}
+	return false;
+}
+
+uint8_t *gdb_agent_conditions_parse(const char *list, size_t *const length)
+{
+	*length = 0U;
+	/* Work out how much space the expressions need, checking the list along the way */
+	size_t total = 0U;
+	for (const char *entry = list; *entry == ';' && entry[1] == 'X';) {
+		char *end = NULL;
+		const unsigned long expr_length = strtoul(entry + 2U, &end, 16);
+		if (*end != ',' || !expr_length || expr_length > UINT16_MAX ||
+			strnlen(end + 1U, expr_length * 2U) < expr_length * 2U) {
+			*length = 1U;
+			return NULL;
+		}
+		total += 2U + expr_length;
+		entry = end + 1U + (expr_length * 2U);
+	}
+	if (!total)
+		return NULL;
+
+	uint8_t *const conditions = malloc(total);
+	if (!conditions) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		*length = 1U;
+		return NULL;
+	}
+	size_t offset = 0U;
+	for (const char *entry = list; offset < total;) {
+		char *end = NULL;
+		const size_t expr_length = strtoul(entry + 2U, &end, 16);
+		conditions[offset++] = expr_length & 0xffU;
+		conditions[offset++] = expr_length >> 8U;
+		unhexify(conditions + offset, end + 1U, expr_length);
+		offset += expr_length;
+		entry = end + 1U + (expr_length * 2U);
+	}
+	*length = total;
+	return conditions;
+}
+
+bool gdb_agent_conditions_eval(target_s *const t, const uint8_t *const conditions, const size_t length)
+{
+	for (size_t offset = 0U; offset + 2U <= length;) {
+		const size_t expr_length = conditions[offset] | (conditions[offset + 1U] << 8U);
+		offset += 2U;
+		uint64_t result = 0U;
+		if (!gdb_agent_eval(t, conditions + offset, MIN(expr_length, length - offset), &result) || result)
+			return true;
+		offset += expr_length;
+	}
+	return false;
+}
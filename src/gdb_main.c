@@ -31,14 +31,22 @@
 #include "gdb_packet.h"
 #include "gdb_main.h"
 #include "gdb_hostio.h"
+#include "gdb_agent.h"
+#include "gdb_trace.h"
+#include "gdb_rtos.h"
+#include "gdb_symbol.h"
 #include "target.h"
 #include "target_internal.h"
 #include "command.h"
 #include "crc32.h"
 #include "morse.h"
+#include "scheduler.h"
 #ifdef ENABLE_RTT
 #include "rtt.h"
 #endif
+#if PC_HOSTED == 1
+#include "gdb_perf.h"
+#endif
 
 #if defined(_WIN32) || defined(__CYGWIN__)
 #include <malloc.h>
@@ -54,14 +62,19 @@ typedef enum gdb_signal {
 	GDB_SIGLOST = 29,
 } gdb_signal_e;
 
-#define GDB_MAX_PACKET_SIZE 1024U
-
 #define ERROR_IF_NO_TARGET()   \
 	if (!cur_target) {         \
 		gdb_putpacketz("EFF"); \
 		break;                 \
 	}
 
+/*
+ * Halt polling runs on every pass of the poll loop for the first GDB_POLL_FAST_MS after the target
+ * is resumed or interrupted, then backs off, doubling the interval up to GDB_POLL_MAX_INTERVAL_MS
+ */
+#define GDB_POLL_FAST_MS         50U
+#define GDB_POLL_MAX_INTERVAL_MS 32U
+
 typedef struct cmd_executer {
 	const char *cmd_prefix;
 	void (*func)(const char *packet, size_t len);
@@ -70,25 +83,99 @@ typedef struct cmd_executer {
 target_s *cur_target;
 target_s *last_target;
 bool gdb_target_running = false;
+/* Set by QNonStop:1, GDB then keeps talking to us while the target runs and halts are notified */
+bool gdb_non_stop = false;
 static bool gdb_needs_detach_notify = false;
+/*
+ * vFlashWrite is acknowledged as soon as its data is in the packet buffer, and programmed while GDB
+ * sends the next one. A failure is remembered here and reported by the following vFlashWrite or vFlashDone.
+ */
+static bool gdb_flash_write_failed = false;
+/* A halt requested with vCont;t, to be reported with signal 0 rather than as an interrupt */
+static bool gdb_stop_requested = false;
+/* The [start, end) range of a vCont;r, which the current thread is stepped over here until the PC leaves it */
+static bool gdb_range_stepping = false;
+static target_addr_t gdb_range_start;
+static target_addr_t gdb_range_end;
+/*
+ * A conditional breakpoint that stopped the current thread with all its conditions false, taken out while
+ * the thread steps off it. It goes back in on the next stop, after which the threads last continued are
+ * resumed again unless GDB asked for a halt in the meantime.
+ */
+static bool gdb_step_over_pending = false;
+static bool gdb_step_over_resume = false;
+static breakwatch_s gdb_step_over;
+static target_s *gdb_continued_thread;
+
+static uint32_t gdb_poll_start_ms;
+static uint32_t gdb_poll_last_ms;
+static uint32_t gdb_poll_interval_ms;
+/* Halt reason picked up by someone else polling the target, see gdb_poll_report() */
+static target_halt_reason_e gdb_poll_reason = TARGET_HALT_RUNNING;
+static target_addr_t gdb_poll_watch;
+
+/*
+ * The cores of the attached target, exposed to GDB as threads. Thread 1 is the core GDB attached to,
+ * the rest are the other targets from the scan with the same driver and register layout, which only
+ * get attached once GDB first selects them. Each core keeps its own register cache in its target.
+ */
+#define GDB_MAX_THREADS 8U
+
+static target_s *gdb_threads[GDB_MAX_THREADS];
+static bool gdb_thread_running[GDB_MAX_THREADS];
+static size_t gdb_thread_count;
+/* The thread selected with Hc to be resumed on its own, NULL to resume them all */
+static target_s *gdb_resume_thread;
+
+/*
+ * GDB reads qXfer objects in chunks, always starting at offset 0. The memory map is generated on that
+ * first read and the following chunks are served from the copy kept for the target it was made for.
+ * Target descriptions are constant and owned by the target, so need no such copy.
+ */
+typedef struct gdb_xfer_cache {
+	const target_s *target;
+	char *data;
+	size_t length;
+} gdb_xfer_cache_s;
+
+static gdb_xfer_cache_s gdb_memory_map_cache;
 
 static void handle_q_packet(char *packet, size_t len);
 static void handle_v_packet(char *packet, size_t len);
+static void handle_q_set_packet(const char *packet, size_t len);
+static void gdb_stop_reply(const char *prefix, bool notify);
 static void handle_z_packet(char *packet, size_t len);
 static void handle_kill_target(void);
 
+static void gdb_xfer_cache_drop(gdb_xfer_cache_s *const cache, const target_s *const t)
+{
+	if (t && cache->target != t)
+		return;
+	free(cache->data);
+	cache->data = NULL;
+	cache->length = 0;
+	cache->target = NULL;
+}
+
 static void gdb_target_destroy_callback(target_controller_s *tc, target_s *t)
 {
 	(void)tc;
 	if (cur_target == t) {
-		gdb_put_notificationz("%Stop:W00");
+		gdb_put_notificationz("Stop:W00");
 		gdb_out("You are now detached from the previous target.\n");
 		cur_target = NULL;
 		gdb_needs_detach_notify = true;
 	}
+	/* The thread list goes with the core it was built for */
+	if (cur_target == NULL || (gdb_thread_count && gdb_threads[0] == t)) {
+		gdb_thread_count = 0;
+		gdb_resume_thread = NULL;
+	}
 
 	if (last_target == t)
 		last_target = NULL;
+	gdb_xfer_cache_drop(&gdb_memory_map_cache, t);
+	gdb_trace_target_destroyed(t);
 }
 
 static void gdb_target_printf(target_controller_s *tc, const char *fmt, va_list ap)
@@ -115,6 +202,153 @@ target_controller_s gdb_controller = {
 	.system = hostio_system,
 };
 
+/* Build the thread list for a freshly attached target */
+static void gdb_threads_setup(target_s *const t)
+{
+	gdb_thread_count = 0;
+	gdb_resume_thread = NULL;
+	memset(gdb_thread_running, 0, sizeof(gdb_thread_running));
+	if (!t)
+		return;
+	gdb_threads[gdb_thread_count++] = t;
+	for (target_s *sibling = target_list; sibling && gdb_thread_count < GDB_MAX_THREADS; sibling = sibling->next) {
+		if (sibling == t || !sibling->driver || !t->driver || strcmp(sibling->driver, t->driver) != 0 ||
+			sibling->regs_size != t->regs_size)
+			continue;
+		gdb_threads[gdb_thread_count++] = sibling;
+	}
+}
+
+static uint32_t gdb_thread_id(const target_s *const t)
+{
+	for (size_t i = 0; i < gdb_thread_count; ++i) {
+		if (gdb_threads[i] == t)
+			return i + 1U;
+	}
+	return 1U;
+}
+
+/*
+ * With a single core in all-stop mode, the tasks of an RTOS GDB told us the symbols of stand in for
+ * the cores as threads, the task running on the core being the current thread
+ */
+static bool gdb_rtos_threads(void)
+{
+	return cur_target && gdb_rtos_active() && !gdb_non_stop && gdb_thread_count <= 1U;
+}
+
+static uint32_t gdb_current_thread_id(void)
+{
+	const uint32_t task = gdb_rtos_threads() ? gdb_rtos_current_thread(cur_target) : 0U;
+	return task ? task : gdb_thread_id(cur_target);
+}
+
+/* Look up a thread by its ID, attaching to the core on first use */
+static target_s *gdb_thread_target(const uint32_t thread_id)
+{
+	if (!gdb_thread_count)
+		return thread_id == 1U ? cur_target : NULL;
+	if (!thread_id || thread_id > gdb_thread_count)
+		return NULL;
+	target_s *const t = gdb_threads[thread_id - 1U];
+	if (!t || target_attached(t))
+		return t;
+	return target_attach(t, &gdb_controller);
+}
+
+/* Detach from every core but the current one, which the caller deals with */
+static void gdb_threads_detach(void)
+{
+	for (size_t i = 0; i < gdb_thread_count; ++i) {
+		target_s *const t = gdb_threads[i];
+		if (t && t != cur_target && target_attached(t))
+			target_detach(t);
+	}
+	gdb_thread_count = 0;
+	gdb_resume_thread = NULL;
+}
+
+/*
+ * Resume either just the thread given, or every attached one. A step only ever applies
+ * to a single thread, the current one if none is given.
+ */
+static void gdb_threads_resume(target_s *thread, const bool step)
+{
+	gdb_rtos_invalidate();
+	if (!thread && (step || !gdb_thread_count))
+		thread = cur_target;
+	if (!step)
+		gdb_continued_thread = thread;
+	for (size_t i = 0; i < gdb_thread_count; ++i) {
+		target_s *const t = gdb_threads[i];
+		if (!t || !target_attached(t) || (thread && t != thread))
+			continue;
+		target_halt_resume(t, step);
+		gdb_thread_running[i] = true;
+	}
+	if (!gdb_thread_count)
+		target_halt_resume(thread, step);
+}
+
+/* Whether the halt request sent to an earlier running thread stops this one too, through a cross trigger */
+static bool gdb_thread_halt_grouped(const size_t thread)
+{
+	const uintptr_t group = gdb_threads[thread]->halt_group;
+	for (size_t i = 0; group && i < thread; ++i) {
+		if (gdb_thread_running[i] && gdb_threads[i]->halt_group == group)
+			return true;
+	}
+	return false;
+}
+
+static void gdb_threads_halt_request(void)
+{
+	if (!gdb_thread_count) {
+		target_halt_request(cur_target);
+		return;
+	}
+	for (size_t i = 0; i < gdb_thread_count; ++i) {
+		if (gdb_thread_running[i] && !gdb_thread_halt_grouped(i))
+			target_halt_request(gdb_threads[i]);
+	}
+}
+
+/* Once one thread has stopped, stop the rest too so GDB gets to see them all halted */
+static void gdb_threads_halt(void)
+{
+	gdb_threads_halt_request();
+	for (size_t i = 0; i < gdb_thread_count; ++i) {
+		if (!gdb_thread_running[i])
+			continue;
+		target_s *const t = gdb_threads[i];
+		platform_timeout_s timeout;
+		platform_timeout_set(&timeout, 500);
+		target_addr_t watch;
+		while (target_halt_poll(t, &watch) == TARGET_HALT_RUNNING && !platform_timeout_is_expired(&timeout))
+			continue;
+		gdb_thread_running[i] = false;
+	}
+}
+
+/* Poll the running threads, making the first one found halted the current thread */
+static target_halt_reason_e gdb_threads_poll(target_addr_t *const watch)
+{
+	if (!gdb_thread_count)
+		return target_halt_poll(cur_target, watch);
+	for (size_t i = 0; i < gdb_thread_count; ++i) {
+		if (!gdb_thread_running[i])
+			continue;
+		const target_halt_reason_e reason = target_halt_poll(gdb_threads[i], watch);
+		if (reason == TARGET_HALT_RUNNING)
+			continue;
+		gdb_thread_running[i] = false;
+		cur_target = gdb_threads[i];
+		gdb_threads_halt();
+		return reason;
+	}
+	return TARGET_HALT_RUNNING;
+}
+
 /* execute gdb remote command stored in 'pbuf'. returns immediately, no busy waiting. */
 
 int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t size, bool in_syscall)
@@ -126,6 +360,9 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 	/* Implementation of these is mandatory! */
 	case 'g': { /* 'g': Read general registers */
 		ERROR_IF_NO_TARGET();
+		if (gdb_trace_frame_regs(cur_target, pbuf, pbuf_size) ||
+			(gdb_rtos_threads() && gdb_rtos_thread_regs(cur_target, pbuf, pbuf_size)))
+			break;
 		const size_t reg_size = target_regs_size(cur_target);
 		if (reg_size) {
 			uint8_t gp_regs[reg_size];
@@ -145,6 +382,8 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 			break;
 		}
 		DEBUG_GDB("m packet: addr = %" PRIx32 ", len = %" PRIx32 "\n", addr, len);
+		if (gdb_trace_frame_mem(addr, len, pbuf))
+			break;
 		uint8_t mem[len];
 		if (target_mem_read(cur_target, mem, addr, len))
 			gdb_putpacketz("E01");
@@ -154,6 +393,11 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 	}
 	case 'G': { /* 'G XX': Write general registers */
 		ERROR_IF_NO_TARGET();
+		/* The saved context of a switched out task is left alone */
+		if (gdb_rtos_threads() && gdb_rtos_thread_switched_out()) {
+			gdb_putpacketz("E01");
+			break;
+		}
 		const size_t reg_size = target_regs_size(cur_target);
 		if (reg_size) {
 			uint8_t gp_regs[reg_size];
@@ -183,13 +427,41 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 		break;
 	}
 	/* '[m|M|g|G|c][thread-id]' : Set the thread ID for the given subsequent operation
-	 * (we don't actually care which as we only care about the TID for whether to send OK or an error)
+	 * 'c' picks the thread to resume, everything else the one register and memory accesses go to.
+	 * Thread 0 means any thread and -1 all of them.
 	 */
 	case 'H': {
 		char operation = 0;
 		uint32_t thread_id = 0;
 		sscanf(pbuf, "H%c%" SCNx32, &operation, &thread_id);
-		if (thread_id <= 1)
+		if (thread_id == 0U || thread_id == UINT32_MAX || (!cur_target && thread_id == 1U)) {
+			if (operation == 'c')
+				gdb_resume_thread = NULL;
+			gdb_putpacketz("OK");
+			break;
+		}
+		/* Tasks all run on the one core, so resuming any of them resumes everything */
+		if (gdb_rtos_threads() && (operation == 'c' ? gdb_rtos_thread_alive(cur_target, thread_id) :
+													   gdb_rtos_thread_select(cur_target, thread_id))) {
+			gdb_putpacketz("OK");
+			break;
+		}
+		target_s *const thread = gdb_thread_target(thread_id);
+		if (!thread) {
+			gdb_putpacketz("E01");
+			break;
+		}
+		if (operation == 'c')
+			gdb_resume_thread = thread;
+		else
+			cur_target = thread;
+		gdb_putpacketz("OK");
+		break;
+	}
+	case 'T': { /* 'T thread-id': Is the thread alive */
+		uint32_t thread_id = 0;
+		sscanf(pbuf, "T%" SCNx32, &thread_id);
+		if ((gdb_rtos_threads() && gdb_rtos_thread_alive(cur_target, thread_id)) || gdb_thread_target(thread_id))
 			gdb_putpacketz("OK");
 		else
 			gdb_putpacketz("E01");
@@ -205,19 +477,47 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 			break;
 		}
 
-		target_halt_resume(cur_target, single_step);
+		gdb_threads_resume(gdb_resume_thread, single_step);
 		SET_RUN_STATE(true);
 		single_step = false;
+		/* In non-stop mode, resuming is acknowledged straight away and the halt notified later */
+		if (gdb_non_stop) {
+			gdb_poll_restart();
+			gdb_target_running = true;
+			gdb_putpacketz("OK");
+			break;
+		}
 		/* fall through */
 	case '?': { /* '?': Request reason for target halt */
 		/*
 		 * This packet isn't documented as being mandatory,
 		 * but GDB doesn't work without it.
 		 */
+#if PC_HOSTED == 1
+		/* A session on one of the extra GDB ports lands on the target of the same number */
+		if (!cur_target && gdb_if_connection_port() != 0U) {
+			cur_target = target_attach_n(gdb_if_connection_port() + 1U, &gdb_controller);
+			gdb_threads_setup(cur_target);
+		}
+#elif defined(PLATFORM_HAS_SETTINGS)
+		/* With 'monitor boot_scan attach', a session lands on the first target the power-up scan found */
+		if (!cur_target && target_list && (platform_settings_get() & PLATFORM_SETTING_AUTO_ATTACH)) {
+			cur_target = target_attach_n(1U, &gdb_controller);
+			gdb_threads_setup(cur_target);
+		}
+#endif
 		if (!cur_target) {
 			gdb_putpacketz("W00"); /* Report "target exited" if no target */
 			break;
 		}
+		/* In non-stop mode, ask after a running target with OK and a halted one with its stop reply */
+		if (gdb_non_stop) {
+			if (gdb_target_running)
+				gdb_putpacketz("OK");
+			else
+				gdb_stop_reply("T05", false);
+			break;
+		}
 
 		/*
 		 * The target is running, so there is no response to give.
@@ -248,7 +548,9 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 	}
 	case 'P': { /* Write single register */
 		ERROR_IF_NO_TARGET();
-		if (cur_target->reg_write) {
+		if (gdb_rtos_threads() && gdb_rtos_thread_switched_out())
+			gdb_putpacketz("E01");
+		else if (cur_target->reg_write) {
 			uint32_t reg;
 			int n;
 			sscanf(pbuf, "P%" SCNx32 "=%n", &reg, &n);
@@ -290,12 +592,16 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 #endif
 		if (cur_target) {
 			SET_RUN_STATE(true);
+			gdb_threads_detach();
 			target_detach(cur_target);
 			last_target = cur_target;
 			cur_target = NULL;
 		}
 		if (pbuf[0] == 'D')
 			gdb_putpacketz("OK");
+		else
+			/* The connection went away, the next session starts out in all-stop mode */
+			gdb_non_stop = false;
 		break;
 
 	case 'k': /* Kill the target */
@@ -308,6 +614,7 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 			target_reset(cur_target);
 		else if (last_target) {
 			cur_target = target_attach(last_target, &gdb_controller);
+			gdb_threads_setup(cur_target);
 			if (cur_target)
 				morse(NULL, false);
 			target_reset(cur_target);
@@ -315,16 +622,24 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 		break;
 
 	case 'X': { /* 'X addr,len:XX': Write binary data to addr */
-		uint32_t addr, len;
-		int bin;
+		uint32_t addr = 0;
+		uint32_t len = 0;
+		int bin = 0;
 		ERROR_IF_NO_TARGET();
-		sscanf(pbuf, "X%" SCNx32 ",%" SCNx32 ":%n", &addr, &len, &bin);
-		if (len > (unsigned)(size - bin)) {
+		/* The payload has already been unescaped by gdb_getpacket(), so it can be written out as-is */
+		if (sscanf(pbuf, "X%" SCNx32 ",%" SCNx32 ":%n", &addr, &len, &bin) != 2 || !bin ||
+			len > (unsigned)(size - bin)) {
 			gdb_putpacketz("E02");
 			break;
 		}
 		DEBUG_GDB("X packet: addr = %" PRIx32 ", len = %" PRIx32 "\n", addr, len);
-		if (target_mem_write(cur_target, addr, pbuf + bin, len))
+		/*
+		 * GDB probes for binary download support by sending a zero length write,
+		 * answer it without touching the target so the probe can't fail
+		 */
+		if (!len)
+			gdb_putpacketz("OK");
+		else if (target_mem_write(cur_target, addr, pbuf + bin, len))
 			gdb_putpacketz("E01");
 		else
 			gdb_putpacketz("OK");
@@ -335,6 +650,10 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 		handle_q_packet(pbuf, size);
 		break;
 
+	case 'Q': /* General set packet */
+		handle_q_set_packet(pbuf, size);
+		break;
+
 	case 'v': /* Verbose command packet */
 		handle_v_packet(pbuf, size);
 		break;
@@ -390,9 +709,21 @@ static void exec_q_rcmd(const char *packet, const size_t length)
 	}
 }
 
-static void handle_q_string_reply(const char *reply, const char *param)
+static char *gdb_generate_memory_map(target_s *const t)
+{
+	const size_t length = target_mem_map(t, NULL, 0) + 1U;
+	char *const map = malloc(length);
+	if (!map) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return NULL;
+	}
+	target_mem_map(t, map, length);
+	return map;
+}
+
+/* Serve the requested chunk of a qXfer object */
+static void handle_q_string_reply(const char *const reply, const size_t reply_length, const char *const param)
 {
-	const size_t reply_length = strlen(reply);
 	uint32_t addr = 0;
 	uint32_t len = 0;
 
@@ -418,7 +749,9 @@ static void exec_q_supported(const char *packet, const size_t length)
 {
 	(void)packet;
 	(void)length;
-	gdb_putpacket_f("PacketSize=%X;qXfer:memory-map:read+;qXfer:features:read+", GDB_MAX_PACKET_SIZE);
+	gdb_putpacket_f("PacketSize=%X;qXfer:memory-map:read+;qXfer:features:read+;QNonStop+;ConditionalBreakpoints+;"
+					"QStartNoAckMode+",
+		GDB_PACKET_BUFFER_SIZE);
 }
 
 static void exec_q_memory_map(const char *packet, const size_t length)
@@ -433,9 +766,16 @@ static void exec_q_memory_map(const char *packet, const size_t length)
 		gdb_putpacketz("E01");
 		return;
 	}
-	char buf[1024];
-	target_mem_map(target, buf, sizeof(buf)); /* Fixme: Check size!*/
-	handle_q_string_reply(buf, packet);
+	/* A read from the start gets a freshly generated map, the rest of the chunks come from that */
+	gdb_xfer_cache_s *const cache = &gdb_memory_map_cache;
+	uint32_t offset = 0;
+	if (sscanf(packet, "%08" PRIx32, &offset) != 1 || offset == 0U || cache->target != target) {
+		gdb_xfer_cache_drop(cache, NULL);
+		cache->data = gdb_generate_memory_map(target);
+		cache->length = cache->data ? strlen(cache->data) : 0U;
+		cache->target = target;
+	}
+	handle_q_string_reply(cache->data ? cache->data : "", cache->length, packet);
 }
 
 static void exec_q_feature_read(const char *packet, const size_t length)
@@ -451,8 +791,7 @@ static void exec_q_feature_read(const char *packet, const size_t length)
 		return;
 	}
 	const char *const description = target_regs_description(target);
-	handle_q_string_reply(description ? description : "", packet);
-	free((void *)description);
+	handle_q_string_reply(description ? description : "", description ? strlen(description) : 0U, packet);
 }
 
 static void exec_q_crc(const char *packet, const size_t length)
@@ -474,32 +813,62 @@ static void exec_q_crc(const char *packet, const size_t length)
 }
 
 /*
- * qC queries are for the current thread. We don't support threads but GDB 11 and 12 require this,
- * so we always answer that the current thread is thread 1.
+ * qC queries are for the current thread, which is the core register and memory accesses go to.
+ * GDB 11 and 12 require this even with a single core, which is then always thread 1.
  */
 static void exec_q_c(const char *packet, const size_t length)
 {
 	(void)packet;
 	(void)length;
-	gdb_putpacketz("QC1");
+	gdb_putpacket_f("QC%" PRIx32, gdb_current_thread_id());
 }
 
 /*
  * qfThreadInfo queries are required in GDB 11 and 12 as these GDBs require the server to support
- * threading even when there's only the possibility for one thread to exist. In this instance,
- * we have to tell GDB that there is a single active thread so it doesn't think the "thread" died.
- * qsThreadInfo will always follow qfThreadInfo when we reply as we have to specify 'l' at the
- * end to terminate the list.. GDB doesn't like this not happening.
+ * threading even when there's only the possibility for one thread to exist, so there is always
+ * at least thread 1 so GDB doesn't think the "thread" died. Each further core is another thread.
+ * The whole list fits in the reply to qfThreadInfo, so qsThreadInfo only has to terminate it with 'l'.
  */
 static void exec_q_thread_info(const char *packet, const size_t length)
 {
 	(void)length;
-	if (packet[-11] == 'f')
-		gdb_putpacketz("m1");
-	else
+	if (gdb_rtos_threads() && gdb_rtos_thread_list(cur_target, packet[-11] == 'f'))
+		return;
+	if (packet[-11] == 'f') {
+		char reply[2U + (3U * GDB_MAX_THREADS)];
+		size_t offset = snprintf(reply, sizeof(reply), "m1");
+		for (size_t i = 1; i < gdb_thread_count; ++i) {
+			if (gdb_threads[i])
+				offset += snprintf(reply + offset, sizeof(reply) - offset, ",%" PRIx32, (uint32_t)(i + 1U));
+		}
+		gdb_putpacket(reply, offset);
+	} else
 		gdb_putpacketz("l");
 }
 
+/* qSymbol is how GDB offers to look up symbols, which is used to find RTT and the RTOS' data structures */
+static void exec_q_symbol(const char *packet, const size_t length)
+{
+	(void)length;
+	if (!gdb_symbol_exchange(packet))
+		return;
+	gdb_rtos_detect();
+#ifdef ENABLE_RTT
+	/* Have RTT pick up the control block GDB told us about, unless that's the one already in use */
+	if (gdb_symbol_address(GDB_SYMBOL_SEGGER_RTT) != rtt_cbaddr)
+		rtt_found = false;
+#endif
+}
+
+/* qThreadExtraInfo gives the name and state of an RTOS task for GDB's thread list */
+static void exec_q_thread_extra_info(const char *packet, const size_t length)
+{
+	(void)length;
+	const uint32_t thread_id = strtoul(packet, NULL, 16);
+	if (!gdb_rtos_threads() || !gdb_rtos_thread_extra_info(cur_target, thread_id))
+		gdb_putpacketz("E01");
+}
+
 static const cmd_executer_s q_commands[] = {
 	{"qRcmd,", exec_q_rcmd},
 	{"qSupported", exec_q_supported},
@@ -509,6 +878,8 @@ static const cmd_executer_s q_commands[] = {
 	{"qC", exec_q_c},
 	{"qfThreadInfo", exec_q_thread_info},
 	{"qsThreadInfo", exec_q_thread_info},
+	{"qSymbol:", exec_q_symbol},
+	{"qThreadExtraInfo,", exec_q_thread_extra_info},
 	{NULL, NULL},
 };
 
@@ -516,6 +887,7 @@ static void handle_kill_target(void)
 {
 	if (cur_target) {
 		target_reset(cur_target);
+		gdb_threads_detach();
 		target_detach(cur_target);
 		last_target = cur_target;
 		cur_target = NULL;
@@ -524,12 +896,104 @@ static void handle_kill_target(void)
 
 static void handle_q_packet(char *packet, const size_t length)
 {
-	if (exec_command(packet, length, q_commands))
+	if (gdb_trace_packet(cur_target, packet, length) || exec_command(packet, length, q_commands))
 		return;
 	DEBUG_GDB("*** Unsupported packet: %s\n", packet);
 	gdb_putpacket("", 0);
 }
 
+static void handle_q_set_packet(const char *const packet, const size_t length)
+{
+	if (gdb_trace_packet(cur_target, packet, length))
+		return;
+	if (!strcmp(packet, "QNonStop:1")) {
+		gdb_non_stop = true;
+		gdb_putpacketz("OK");
+	} else if (!strcmp(packet, "QNonStop:0")) {
+		gdb_non_stop = false;
+		gdb_putpacketz("OK");
+	} else if (!strcmp(packet, "QStartNoAckMode")) {
+		/* The OK itself still gets acknowledged, the transports are reliable so drop acks from then on */
+		gdb_putpacketz("OK");
+		gdb_set_noackmode(true);
+	} else {
+		DEBUG_GDB("*** Unsupported packet: %s\n", packet);
+		gdb_putpacket("", 0);
+	}
+}
+
+/* 'r start,end': step for as long as the PC stays in the range, reporting only the final stop */
+static void gdb_range_step_setup(const char *const range)
+{
+	char *range_sep = NULL;
+	gdb_range_start = strtoul(range, &range_sep, 16);
+	gdb_range_end = *range_sep == ',' ? strtoul(range_sep + 1U, NULL, 16) : gdb_range_start;
+	gdb_range_stepping = gdb_range_start < gdb_range_end;
+}
+
+/*
+ * vCont: only the first action counts. With a thread ID it applies to just that thread, otherwise
+ * a continue resumes all the threads and a step the current one. Whichever thread halts first then
+ * stops the rest. 'r' (range step) is a step that gdb_poll_target() repeats while the PC stays in
+ * the range. 't' (stop) is only valid in non-stop mode.
+ */
+static void exec_v_cont(const char *const packet)
+{
+	if (!cur_target) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	const char *const action_end = strchr(packet, ';');
+	const char *const thread_sep = strchr(packet, ':');
+	target_s *thread = NULL;
+	if (thread_sep && (!action_end || thread_sep < action_end)) {
+		const uint32_t thread_id = strtoul(thread_sep + 1U, NULL, 16);
+		if (thread_id != 0U && thread_id != UINT32_MAX) {
+			thread = gdb_thread_target(thread_id);
+			if (!thread) {
+				gdb_putpacketz("E01");
+				return;
+			}
+		}
+	}
+	gdb_range_stepping = false;
+	switch (packet[0]) {
+	case 'r':
+		gdb_range_step_setup(packet + 1U);
+		/* fall through */
+	case 'c':
+	case 'C':
+	case 's':
+	case 'S': {
+		const bool step = packet[0] == 's' || packet[0] == 'S' || packet[0] == 'r';
+		gdb_threads_resume(thread, step);
+		SET_RUN_STATE(true);
+		gdb_poll_restart();
+		gdb_target_running = true;
+		/* In all-stop mode the stop reply is the response, gdb_poll_target() sends it */
+		if (gdb_non_stop)
+			gdb_putpacketz("OK");
+		break;
+	}
+	case 't':
+		if (!gdb_non_stop) {
+			gdb_putpacketz("E01");
+			break;
+		}
+		/* The halt gets reported as a stop notification with signal 0 */
+		if (gdb_target_running) {
+			gdb_step_over_resume = false;
+			gdb_threads_halt_request();
+			gdb_poll_restart();
+			gdb_stop_requested = true;
+		}
+		gdb_putpacketz("OK");
+		break;
+	default:
+		gdb_putpacketz("E01");
+	}
+}
+
 static void handle_v_packet(char *packet, const size_t plen)
 {
 	uint32_t addr = 0;
@@ -539,11 +1003,12 @@ static void handle_v_packet(char *packet, const size_t plen)
 	if (sscanf(packet, "vAttach;%08" PRIx32, &addr) == 1) {
 		/* Attach to remote target processor */
 		cur_target = target_attach_n(addr, &gdb_controller);
+		gdb_threads_setup(cur_target);
 		if (cur_target) {
 			morse(NULL, false);
 			/*
-			 * We don't actually support threads, but GDB 11 and 12 can't work without
-			 * us saying we attached to thread 1.. see the following for the low-down of this:
+			 * The core attached to is always thread 1, and GDB 11 and 12 can't work without
+			 * us saying we attached to it.. see the following for the low-down of this:
 			 * https://sourceware.org/bugzilla/show_bug.cgi?id=28405
 			 * https://sourceware.org/bugzilla/show_bug.cgi?id=28874
 			 * https://sourceware.org/pipermail/gdb-patches/2021-December/184171.html
@@ -600,6 +1065,7 @@ static void handle_v_packet(char *packet, const size_t plen)
 			gdb_putpacketz("T05");
 		} else if (last_target) {
 			cur_target = target_attach(last_target, &gdb_controller);
+			gdb_threads_setup(cur_target);
 
 			/* If we were able to attach to the target again */
 			if (cur_target) {
@@ -632,20 +1098,34 @@ static void handle_v_packet(char *packet, const size_t plen)
 		/* Write Flash Memory */
 		const uint32_t count = plen - bin;
 		DEBUG_GDB("Flash Write %08" PRIX32 " %08" PRIX32 "\n", addr, count);
-		if (cur_target && target_flash_write(cur_target, addr, (void *)packet + bin, count))
-			gdb_putpacketz("OK");
-		else {
+		if (!cur_target || gdb_flash_write_failed) {
+			gdb_flash_write_failed = false;
 			target_flash_complete(cur_target);
 			gdb_putpacketz("EFF");
+			return;
+		}
+		/* The packet buffer is left alone until the next packet is read, so the reply can go out first */
+		gdb_putpacketz("OK");
+		if (!target_flash_write(cur_target, addr, (void *)packet + bin, count)) {
+			DEBUG_WARN("Flash write failed at %08" PRIx32 "\n", addr);
+			gdb_flash_write_failed = true;
 		}
 
 	} else if (!strcmp(packet, "vFlashDone")) {
 		/* Commit flash operations. */
-		if (target_flash_complete(cur_target))
+		const bool write_failed = gdb_flash_write_failed;
+		gdb_flash_write_failed = false;
+		if (target_flash_complete(cur_target) && !write_failed)
 			gdb_putpacketz("OK");
 		else
 			gdb_putpacketz("EFF");
 
+	} else if (!strcmp(packet, "vCont?")) {
+		gdb_putpacketz("vCont;c;C;s;S;t;r");
+
+	} else if (!strncmp(packet, "vCont;", 6)) {
+		exec_v_cont(packet + 6);
+
 	} else if (!strcmp(packet, "vStopped")) {
 		if (gdb_needs_detach_notify) {
 			gdb_putpacketz("W00");
@@ -662,6 +1142,21 @@ static void handle_v_packet(char *packet, const size_t plen)
 	}
 }
 
+static breakwatch_s *gdb_breakwatch_find(
+	target_s *const t, const target_breakwatch_e type, const target_addr_t addr, const size_t len)
+{
+	for (breakwatch_s *bw = t->bw_list; bw; bw = bw->next) {
+		if (bw->type == type && bw->addr == addr && bw->size == len)
+			return bw;
+	}
+	return NULL;
+}
+
+/*
+ * Z packets for breakpoints may carry a condition list of agent expressions, which are kept with the
+ * breakpoint for gdb_poll_target() to evaluate. GDB sends the packet again for a breakpoint that is
+ * already in when its conditions change, which only updates them.
+ */
 static void handle_z_packet(char *packet, const size_t plen)
 {
 	(void)plen;
@@ -672,9 +1167,30 @@ static void handle_z_packet(char *packet, const size_t plen)
 	sscanf(packet, "%*[zZ]%" PRIu32 ",%08" PRIx32 ",%" PRIu32, &type, &addr, &len);
 
 	int ret = 0;
-	if (packet[0] == 'Z')
-		ret = target_breakwatch_set(cur_target, type, addr, len);
-	else
+	if (packet[0] == 'Z') {
+		size_t condition_len = 0;
+		uint8_t *condition = NULL;
+		const char *const condition_list = strchr(packet, ';');
+		if (condition_list && (type == TARGET_BREAK_SOFT || type == TARGET_BREAK_HARD)) {
+			condition = gdb_agent_conditions_parse(condition_list, &condition_len);
+			if (!condition && condition_len) {
+				gdb_putpacketz("E01");
+				return;
+			}
+		}
+		breakwatch_s *bw = gdb_breakwatch_find(cur_target, type, addr, len);
+		if (!bw) {
+			ret = target_breakwatch_set(cur_target, type, addr, len);
+			if (ret == 0)
+				bw = gdb_breakwatch_find(cur_target, type, addr, len);
+		}
+		if (bw) {
+			free(bw->condition);
+			bw->condition = condition;
+			bw->condition_len = condition_len;
+		} else
+			free(condition);
+	} else
 		ret = target_breakwatch_clear(cur_target, type, addr, len);
 
 	if (ret < 0)
@@ -687,19 +1203,128 @@ static void handle_z_packet(char *packet, const size_t plen)
 
 void gdb_main(char *pbuf, size_t pbuf_size, size_t size)
 {
+	scheduler_gdb_active();
+#if PC_HOSTED == 1
+	/* The reply overwrites the packet, so it has to be classified up front */
+	gdb_perf_packet_begin(pbuf, size);
+#endif
 	gdb_main_loop(&gdb_controller, pbuf, pbuf_size, size, false);
+#if PC_HOSTED == 1
+	gdb_perf_packet_end();
+#endif
+}
+
+/* Attach the session to the nth target, as if GDB had asked for it with vAttach */
+target_s *gdb_target_attach_n(const size_t n)
+{
+	cur_target = target_attach_n(n, &gdb_controller);
+	gdb_threads_setup(cur_target);
+	return cur_target;
 }
 
 /* halt target */
 void gdb_halt_target(void)
 {
+	gdb_range_stepping = false;
+	gdb_step_over_resume = false;
 	if (cur_target)
-		target_halt_request(cur_target);
+		gdb_threads_halt_request();
 	else
 		/* Report "target exited" if no target */
 		gdb_putpacketz("W00");
 }
 
+/*
+ * Send a stop reply made of the given prefix plus the registers the target asks to have expedited,
+ * either as the response to a packet or, in non-stop mode, as an asynchronous stop notification
+ */
+static void gdb_stop_reply(const char *const prefix, const bool notify)
+{
+	char reply[128U];
+	size_t offset = 0;
+	if (notify)
+		offset = snprintf(reply, sizeof(reply), "Stop:");
+	offset += snprintf(reply + offset, sizeof(reply) - offset, "%s", prefix);
+	/* Non-stop mode, and any session with more than one core or RTOS task, needs to be told which thread stopped */
+	if (gdb_non_stop || gdb_thread_count > 1U || gdb_rtos_threads())
+		offset += snprintf(reply + offset, sizeof(reply) - offset, "thread:%" PRIx32 ";", gdb_current_thread_id());
+
+	for (size_t i = 0; i < cur_target->expedited_regs_count; ++i) {
+		const uint8_t reg = cur_target->expedited_regs[i];
+		uint8_t value[8];
+		const ssize_t size = target_reg_read(cur_target, reg, value, sizeof(value));
+		/* Room for the register number, separators and the hex value */
+		if (size <= 0 || offset + 4U + ((size_t)size * 2U) >= sizeof(reply))
+			break;
+		offset += snprintf(reply + offset, sizeof(reply) - offset, "%02x:", reg);
+		hexify(reply + offset, value, size);
+		offset += (size_t)size * 2U;
+		reply[offset++] = ';';
+	}
+	if (notify)
+		gdb_put_notification(reply, offset);
+	else
+		gdb_putpacket(reply, offset);
+}
+
+/* Go back to polling on every pass, for when the target has just been resumed or interrupted */
+void gdb_poll_restart(void)
+{
+	gdb_poll_start_ms = platform_time_ms();
+	gdb_poll_last_ms = gdb_poll_start_ms;
+	gdb_poll_interval_ms = 0;
+}
+
+/*
+ * Hand over the result of a halt poll done elsewhere (such as by RTT) so it counts as ours - a running
+ * target pushes our next poll back, and a halt gets reported rather than lost
+ */
+void gdb_poll_report(const target_halt_reason_e reason, const target_addr_t watch)
+{
+	gdb_poll_last_ms = platform_time_ms();
+	if (reason != TARGET_HALT_RUNNING) {
+		gdb_poll_reason = reason;
+		gdb_poll_watch = watch;
+	}
+}
+
+/*
+ * Deal with the current thread stopping at a tracepoint (collecting a trace frame) or a breakpoint with
+ * all its conditions false by taking the breakpoint out and stepping the thread off it, returning true.
+ * The stop is never seen by GDB.
+ */
+static bool gdb_breakpoint_skip(void)
+{
+	uint32_t pc = 0;
+	if (cur_target->pc_reg < 0 || target_reg_read(cur_target, cur_target->pc_reg, &pc, sizeof(pc)) != sizeof(pc))
+		return false;
+	const bool traced = gdb_trace_hit(cur_target, pc);
+	breakwatch_s *bw = cur_target->bw_list;
+	for (; bw; bw = bw->next) {
+		if ((bw->type == TARGET_BREAK_SOFT || bw->type == TARGET_BREAK_HARD) && bw->addr == pc)
+			break;
+	}
+	/* A tracepoint that just ended the experiment has had its breakpoint taken out already */
+	if (traced && !bw) {
+		gdb_threads_resume(gdb_continued_thread, false);
+		return true;
+	}
+	if (!bw ||
+		(!traced && (!bw->condition || gdb_agent_conditions_eval(cur_target, bw->condition, bw->condition_len))))
+		return false;
+
+	target_mem_cache_flush();
+	if (!cur_target->breakwatch_clear || cur_target->breakwatch_clear(cur_target, bw) != 0)
+		return false;
+	gdb_step_over = *bw;
+	gdb_step_over.next = NULL;
+	gdb_step_over.condition = NULL;
+	gdb_step_over_pending = true;
+	gdb_step_over_resume = true;
+	gdb_threads_resume(cur_target, true);
+	return true;
+}
+
 /* poll running target */
 void gdb_poll_target(void)
 {
@@ -709,32 +1334,101 @@ void gdb_poll_target(void)
 		return;
 	}
 
-	/* poll target */
-	target_addr_t watch;
-	target_halt_reason_e reason = target_halt_poll(cur_target, &watch);
-	if (!reason)
+	target_addr_t watch = gdb_poll_watch;
+	target_halt_reason_e reason = gdb_poll_reason;
+	gdb_poll_reason = TARGET_HALT_RUNNING;
+	/* Someone else saw the current thread halt, so stop the rest */
+	if (reason != TARGET_HALT_RUNNING) {
+		for (size_t i = 0; i < gdb_thread_count; ++i) {
+			if (gdb_threads[i] == cur_target)
+				gdb_thread_running[i] = false;
+		}
+		gdb_threads_halt();
+	} else {
+		const uint32_t now = platform_time_ms();
+		if (now - gdb_poll_last_ms < gdb_poll_interval_ms)
+			return;
+
+		/* poll target */
+		reason = gdb_threads_poll(&watch);
+		if (!reason) {
+			gdb_poll_last_ms = now;
+			/* Still running after the fast-path window, so back off */
+			if (now - gdb_poll_start_ms >= GDB_POLL_FAST_MS) {
+				gdb_poll_interval_ms = gdb_poll_interval_ms ? gdb_poll_interval_ms * 2U : 1U;
+				if (gdb_poll_interval_ms > GDB_POLL_MAX_INTERVAL_MS)
+					gdb_poll_interval_ms = GDB_POLL_MAX_INTERVAL_MS;
+			}
+			return;
+		}
+	}
+
+	if (gdb_step_over_pending) {
+		/* Put the breakpoint back (unless GDB took it out meanwhile) and carry on if the step is all that happened */
+		gdb_step_over_pending = false;
+		breakwatch_s *const bw =
+			gdb_breakwatch_find(cur_target, gdb_step_over.type, gdb_step_over.addr, gdb_step_over.size);
+		if (bw && cur_target->breakwatch_set) {
+			target_mem_cache_flush();
+			cur_target->breakwatch_set(cur_target, bw);
+		}
+		if (reason == TARGET_HALT_STEPPING) {
+			if (gdb_step_over_resume) {
+				gdb_threads_resume(gdb_continued_thread, false);
+				gdb_poll_restart();
+				return;
+			}
+			reason = TARGET_HALT_REQUEST;
+		}
+	} else if (reason == TARGET_HALT_BREAKPOINT && gdb_breakpoint_skip()) {
+		gdb_poll_restart();
 		return;
+	}
+
+	/*
+	 * A step that is still inside the range of a vCont;r gets the thread stepped again rather than
+	 * reported. Targets that don't say where their PC is get every step reported, which GDB allows.
+	 */
+	if (gdb_range_stepping && reason == TARGET_HALT_STEPPING && cur_target->pc_reg >= 0) {
+		uint32_t pc = 0;
+		if (target_reg_read(cur_target, cur_target->pc_reg, &pc, sizeof(pc)) == sizeof(pc) &&
+			pc >= gdb_range_start && pc < gdb_range_end) {
+			gdb_threads_resume(cur_target, true);
+			gdb_poll_restart();
+			return;
+		}
+	}
+	gdb_range_stepping = false;
 
 	/* switch polling off */
 	gdb_target_running = false;
 	SET_RUN_STATE(0);
 
+	const bool stop_requested = gdb_stop_requested;
+	gdb_stop_requested = false;
+
 	/* Translate reason to GDB signal */
+	char prefix[32U];
 	switch (reason) {
 	case TARGET_HALT_ERROR:
-		gdb_putpacket_f("X%02X", GDB_SIGLOST);
+		if (gdb_non_stop) {
+			snprintf(prefix, sizeof(prefix), "Stop:X%02X", GDB_SIGLOST);
+			gdb_put_notificationz(prefix);
+		} else
+			gdb_putpacket_f("X%02X", GDB_SIGLOST);
 		morse("TARGET LOST.", true);
-		break;
+		return;
 	case TARGET_HALT_REQUEST:
-		gdb_putpacket_f("T%02X", GDB_SIGINT);
+		snprintf(prefix, sizeof(prefix), "T%02X", stop_requested ? 0U : GDB_SIGINT);
 		break;
 	case TARGET_HALT_WATCHPOINT:
-		gdb_putpacket_f("T%02Xwatch:%08X;", GDB_SIGTRAP, watch);
+		snprintf(prefix, sizeof(prefix), "T%02Xwatch:%08" PRIX32 ";", GDB_SIGTRAP, watch);
 		break;
 	case TARGET_HALT_FAULT:
-		gdb_putpacket_f("T%02X", GDB_SIGSEGV);
+		snprintf(prefix, sizeof(prefix), "T%02X", GDB_SIGSEGV);
 		break;
 	default:
-		gdb_putpacket_f("T%02X", GDB_SIGTRAP);
+		snprintf(prefix, sizeof(prefix), "T%02X", GDB_SIGTRAP);
 	}
+	gdb_stop_reply(prefix, gdb_non_stop);
 }
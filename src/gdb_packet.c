@@ -31,10 +31,102 @@
 
 #include <stdarg.h>
 
-size_t gdb_getpacket(char *const packet, const size_t size)
+/* Set once GDB has asked for QStartNoAckMode, after which neither side acknowledges packets */
+static bool gdb_noack_mode = false;
+
+void gdb_set_noackmode(const bool enable)
+{
+	gdb_noack_mode = enable;
+}
+
+/*
+ * Copy the run of plain packet data at the start of the already received input into packet, up
+ * to the first character needing attention, and sum it into the checksum. This lets the bulk of
+ * large packets such as vFlashWrite go through at memory speed rather than a call per character.
+ */
+static size_t gdb_packet_receive_span(char *const packet, const size_t space, unsigned char *const csum)
 {
-	unsigned char csum;
+	const char *data = NULL;
+	size_t length = MIN(gdb_if_peek(&data), space);
+	if (!length)
+		return 0;
+	static const char specials[] = {'#', '$', '}'};
+	for (size_t idx = 0; idx < ARRAY_LENGTH(specials); ++idx) {
+		const char *const found = memchr(data, specials[idx], length);
+		if (found)
+			length = (size_t)(found - data);
+	}
+	memcpy(packet, data, length);
+	for (size_t idx = 0; idx < length; ++idx)
+		*csum += (unsigned char)data[idx];
+	gdb_if_consume(length);
+	return length;
+}
+
+/* Capture the rest of a packet whose '$' has been seen, returning whether its checksum matched */
+static bool gdb_packet_receive(char *const packet, const size_t size, size_t *const length)
+{
+	size_t offset = 0;
+	unsigned char csum = 0;
+	char c = '\0';
+	/* Capture packet data into buffer */
+	while (c != '#') {
+		/* Take whatever plain data is already buffered in one go, then deal with what stopped it */
+		offset += gdb_packet_receive_span(packet + offset, size - offset, &csum);
+		c = gdb_if_getchar();
+		if (c == '#')
+			break;
+		/* If we run out of buffer space, exit early */
+		if (offset == size)
+			break;
+
+		if (c == '$') { /* Restart capture */
+			offset = 0;
+			csum = 0;
+			continue;
+		}
+		if (c == '}') { /* Escaped char */
+			c = gdb_if_getchar();
+			csum += c + '}';
+			packet[offset++] = c ^ 0x20U;
+			continue;
+		}
+		csum += c;
+		packet[offset++] = c;
+	}
 	char recv_csum[3];
+	recv_csum[0] = gdb_if_getchar();
+	recv_csum[1] = gdb_if_getchar();
+	recv_csum[2] = 0;
+	*length = offset;
+	return csum == strtol(recv_csum, NULL, 16);
+}
+
+/* Acknowledge a correctly received packet and terminate it */
+static size_t gdb_packet_accept(char *const packet, const size_t offset)
+{
+	if (!gdb_noack_mode)
+		gdb_if_putchar('+', 1); /* Send ack */
+	packet[offset] = '\0';
+
+#if PC_HOSTED == 1
+	if (DEBUG_LEVEL_ENABLED(BMP_DEBUG_GDB | BMP_DEBUG_WIRE)) {
+		DEBUG_GDB_WIRE("gdb_getpacket : ");
+		for (size_t j = 0; j < offset; j++) {
+			const char c = packet[j];
+			if (c >= ' ' && c < '\x7f')
+				DEBUG_GDB_WIRE("%c", c);
+			else
+				DEBUG_GDB_WIRE("\\x%02X", c);
+		}
+		DEBUG_GDB_WIRE("\n");
+	}
+#endif
+	return offset;
+}
+
+size_t gdb_getpacket(char *const packet, const size_t size)
+{
 	size_t offset = 0;
 
 	while (true) {
@@ -47,8 +139,11 @@ size_t gdb_getpacket(char *const packet, const size_t size)
 			do {
 				/* Smells like bad code */
 				packet[0] = gdb_if_getchar();
-				if (packet[0] == '\x04')
+				if (packet[0] == '\x04') {
+					/* The connection went away, so the next one starts out acknowledging packets again */
+					gdb_noack_mode = false;
 					return 1;
+				}
 			} while (packet[0] != '$' && packet[0] != REMOTE_SOM);
 #if PC_HOSTED == 0
 			if (packet[0] == REMOTE_SOM) {
@@ -74,6 +169,13 @@ size_t gdb_getpacket(char *const packet, const size_t size)
 						getting_remote_packet = false;
 						break;
 
+					case REMOTE_ESCAPE: /* Escaped binary payload byte */
+						if (offset < size)
+							packet[offset++] = (char)(gdb_if_getchar() ^ REMOTE_ESCAPE_XOR);
+						else
+							getting_remote_packet = false;
+						break;
+
 					default:
 						if (offset < size)
 							packet[offset++] = c;
@@ -94,58 +196,26 @@ size_t gdb_getpacket(char *const packet, const size_t size)
 #endif
 		} while (packet[0] != '$');
 
-		offset = 0;
-		csum = 0;
-		char c = '\0';
-		/* Capture packet data into buffer */
-		while (c != '#') {
-			c = gdb_if_getchar();
-			if (c == '#')
-				break;
-			/* If we run out of buffer space, exit early */
-			if (offset == size)
-				break;
-
-			if (c == '$') { /* Restart capture */
-				offset = 0;
-				csum = 0;
-				continue;
-			}
-			if (c == '}') { /* Escaped char */
-				c = gdb_if_getchar();
-				csum += c + '}';
-				packet[offset++] = c ^ 0x20U;
-				continue;
-			}
-			csum += c;
-			packet[offset++] = c;
-		}
-		recv_csum[0] = gdb_if_getchar();
-		recv_csum[1] = gdb_if_getchar();
-		recv_csum[2] = 0;
-
 		/* Return packet if checksum matches */
-		if (csum == strtol(recv_csum, NULL, 16))
+		if (gdb_packet_receive(packet, size, &offset))
 			break;
 
 		/* Get here if checksum fails */
-		gdb_if_putchar('-', 1); /* Send nack */
+		if (!gdb_noack_mode)
+			gdb_if_putchar('-', 1); /* Send nack */
 	}
-	gdb_if_putchar('+', 1); /* Send ack */
-	packet[offset] = '\0';
+	return gdb_packet_accept(packet, offset);
+}
 
-#if PC_HOSTED == 1
-	DEBUG_GDB_WIRE("%s : ", __func__);
-	for (size_t j = 0; j < offset; j++) {
-		const char c = packet[j];
-		if (c >= ' ' && c < '\x7f')
-			DEBUG_GDB_WIRE("%c", c);
-		else
-			DEBUG_GDB_WIRE("\\x%02X", c);
-	}
-	DEBUG_GDB_WIRE("\n");
-#endif
-	return offset;
+size_t gdb_getpacket_started(char *const packet, const size_t size)
+{
+	size_t offset = 0;
+	if (gdb_packet_receive(packet, size, &offset))
+		return gdb_packet_accept(packet, offset);
+	/* GDB will send the packet again after the nack, so pick it up the usual way */
+	if (!gdb_noack_mode)
+		gdb_if_putchar('-', 1);
+	return gdb_getpacket(packet, size);
 }
 
 static void gdb_next_char(const char c, uint8_t *const csum)
@@ -186,7 +256,7 @@ void gdb_putpacket2(const char *const packet1, const size_t size1, const char *c
 		gdb_if_putchar(xmit_csum[0], 0);
 		gdb_if_putchar(xmit_csum[1], 1);
 		DEBUG_GDB_WIRE("\n");
-	} while (gdb_if_getchar_to(2000) != '+' && tries++ < 3U);
+	} while (!gdb_noack_mode && gdb_if_getchar_to(2000) != '+' && tries++ < 3U);
 }
 
 void gdb_putpacket(const char *const packet, const size_t size)
@@ -205,7 +275,7 @@ void gdb_putpacket(const char *const packet, const size_t size)
 		gdb_if_putchar(xmit_csum[0], 0);
 		gdb_if_putchar(xmit_csum[1], 1);
 		DEBUG_GDB_WIRE("\n");
-	} while (gdb_if_getchar_to(2000) != '+' && tries++ < 3U);
+	} while (!gdb_noack_mode && gdb_if_getchar_to(2000) != '+' && tries++ < 3U);
 }
 
 void gdb_put_notification(const char *const packet, const size_t size)
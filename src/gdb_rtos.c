@@ -0,0 +1,357 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements RTOS awareness, presenting the tasks of a FreeRTOS or Zephyr application to GDB
+ * as threads. GDB hands over the addresses of the kernel's symbols through qSymbol, after which the task
+ * lists are walked each time the target halts and GDB asks about threads. Every task control block is
+ * fetched with a single block read, and the registers of a switched out task are rebuilt from its saved
+ * context by the target's regs_unstack hook.
+ *
+ * FreeRTOS needs uxTopUsedPriority kept in the image (as for other debuggers) so the ready lists can be
+ * sized, and a TCB layout without MPU wrappers. Zephyr needs CONFIG_DEBUG_THREAD_INFO and
+ * CONFIG_THREAD_MONITOR, and gives task names with CONFIG_THREAD_NAME.
+ */
+
+#include "general.h"
+#include "gdb_rtos.h"
+#include "gdb_packet.h"
+#include "gdb_symbol.h"
+#include "hex_utils.h"
+#include "target/target_internal.h"
+
+#if PC_HOSTED == 1
+#define GDB_RTOS_MAX_TASKS 128U
+#else
+#define GDB_RTOS_MAX_TASKS 24U
+#endif
+#define GDB_RTOS_NAME_LEN 16U
+
+/* FreeRTOS list and task control block layout for 32-bit targets */
+#define FREERTOS_MAX_PRIORITIES 32U
+#define FREERTOS_LIST_SIZE      20U
+#define FREERTOS_LIST_FIRST     12U /* xListEnd.pxNext */
+#define FREERTOS_ITEM_NEXT      4U
+#define FREERTOS_ITEM_OWNER     12U
+#define FREERTOS_TCB_STATE_ITEM 4U
+#define FREERTOS_TCB_EVENT_ITEM 24U
+#define FREERTOS_TCB_NAME       52U
+
+/* Indices into Zephyr's _kernel_thread_info_offsets */
+#define ZEPHYR_OFFSET_K_CURR_THREAD 1U
+#define ZEPHYR_OFFSET_K_THREADS     2U
+#define ZEPHYR_OFFSET_T_NEXT_THREAD 4U
+#define ZEPHYR_OFFSET_T_STATE       5U
+#define ZEPHYR_OFFSET_T_STACK_PTR   8U
+#define ZEPHYR_OFFSET_T_NAME        9U
+#define ZEPHYR_OFFSET_COUNT         10U
+#define ZEPHYR_OFFSET_UNIMPLEMENTED 0xffffffffU
+/* On Cortex-M the stack pointer is the last of the callee saved registers, after r4-r11 */
+#define ZEPHYR_CALLEE_SAVED_SIZE 32U
+
+#define ZEPHYR_THREAD_PENDING   (1U << 1U)
+#define ZEPHYR_THREAD_PRESTART  (1U << 2U)
+#define ZEPHYR_THREAD_DEAD      (1U << 3U)
+#define ZEPHYR_THREAD_SUSPENDED (1U << 4U)
+
+typedef enum gdb_rtos_kind {
+	GDB_RTOS_NONE,
+	GDB_RTOS_FREERTOS,
+	GDB_RTOS_ZEPHYR,
+} gdb_rtos_kind_e;
+
+typedef struct gdb_rtos_task {
+	uint32_t id; /* The task control block's address, which doubles as the GDB thread ID */
+	target_addr_t stack;
+	const char *state;
+	char name[GDB_RTOS_NAME_LEN + 1U];
+} gdb_rtos_task_s;
+
+static gdb_rtos_kind_e gdb_rtos_kind = GDB_RTOS_NONE;
+
+static gdb_rtos_task_s gdb_rtos_tasks[GDB_RTOS_MAX_TASKS];
+static size_t gdb_rtos_task_count;
+static uint32_t gdb_rtos_current;
+static bool gdb_rtos_scanned;
+static uint32_t gdb_rtos_zephyr_offsets[ZEPHYR_OFFSET_COUNT];
+/* The task register accesses go to, NULL for the one running on the core */
+static const gdb_rtos_task_s *gdb_rtos_selected;
+/* Where the next qsThreadInfo reply carries on from */
+static size_t gdb_rtos_list_next;
+
+void gdb_rtos_detect(void)
+{
+	gdb_rtos_kind = GDB_RTOS_NONE;
+	/* The optional FreeRTOS lists (pending ready, suspended, waiting termination) are just skipped if missing */
+	if (gdb_symbol_address(GDB_SYMBOL_FREERTOS_CURRENT_TCB) &&
+		gdb_symbol_address(GDB_SYMBOL_FREERTOS_READY_LISTS) &&
+		gdb_symbol_address(GDB_SYMBOL_FREERTOS_DELAYED_LIST1) &&
+		gdb_symbol_address(GDB_SYMBOL_FREERTOS_DELAYED_LIST2) &&
+		gdb_symbol_address(GDB_SYMBOL_FREERTOS_TOP_USED_PRIORITY)) {
+		gdb_rtos_kind = GDB_RTOS_FREERTOS;
+		DEBUG_INFO("RTOS: FreeRTOS found, presenting tasks as threads\n");
+	} else if (gdb_symbol_address(GDB_SYMBOL_ZEPHYR_KERNEL) &&
+		gdb_symbol_address(GDB_SYMBOL_ZEPHYR_THREAD_INFO_OFFSETS) &&
+		gdb_symbol_address(GDB_SYMBOL_ZEPHYR_THREAD_INFO_NUM_OFFSETS)) {
+		gdb_rtos_kind = GDB_RTOS_ZEPHYR;
+		DEBUG_INFO("RTOS: Zephyr found, presenting threads\n");
+	}
+	gdb_rtos_invalidate();
+}
+
+bool gdb_rtos_active(void)
+{
+	return gdb_rtos_kind != GDB_RTOS_NONE;
+}
+
+void gdb_rtos_invalidate(void)
+{
+	gdb_rtos_scanned = false;
+	gdb_rtos_task_count = 0;
+	gdb_rtos_current = 0;
+	gdb_rtos_selected = NULL;
+	gdb_rtos_list_next = 0;
+}
+
+static const gdb_rtos_task_s *gdb_rtos_task_find(const uint32_t id)
+{
+	for (size_t idx = 0; idx < gdb_rtos_task_count; ++idx) {
+		if (gdb_rtos_tasks[idx].id == id)
+			return &gdb_rtos_tasks[idx];
+	}
+	return NULL;
+}
+
+static void gdb_rtos_task_add(const uint32_t id, const target_addr_t stack, const char *const name, const char *state)
+{
+	/* A task can sit in more than one list, such as a delayed one and the pending ready list */
+	if (!id || gdb_rtos_task_count == GDB_RTOS_MAX_TASKS || gdb_rtos_task_find(id))
+		return;
+	gdb_rtos_task_s *const task = &gdb_rtos_tasks[gdb_rtos_task_count++];
+	task->id = id;
+	task->stack = stack;
+	task->state = id == gdb_rtos_current ? "Running" : state;
+	if (name)
+		strncpy(task->name, name, GDB_RTOS_NAME_LEN);
+	else
+		task->name[0] = '\0';
+	task->name[GDB_RTOS_NAME_LEN] = '\0';
+}
+
+/* Walk a FreeRTOS list of tasks, which are linked in through the list item at item_offset in their TCBs */
+static void gdb_rtos_freertos_list(
+	target_s *const t, const target_addr_t list, const size_t item_offset, const char *const state)
+{
+	if (!list)
+		return;
+	uint32_t header[FREERTOS_LIST_SIZE / 4U];
+	if (target_mem_read(t, header, list, sizeof(header)))
+		return;
+	uint32_t item = header[FREERTOS_LIST_FIRST / 4U];
+	for (uint32_t idx = 0; idx < header[0] && gdb_rtos_task_count < GDB_RTOS_MAX_TASKS; ++idx) {
+		/* One read gets the saved stack pointer, the list links and the name */
+		const target_addr_t tcb = item - item_offset;
+		uint32_t block[(FREERTOS_TCB_NAME + GDB_RTOS_NAME_LEN) / 4U];
+		if (target_mem_read(t, block, tcb, sizeof(block)) || block[(item_offset + FREERTOS_ITEM_OWNER) / 4U] != tcb)
+			return;
+		gdb_rtos_task_add(tcb, block[0], (const char *)block + FREERTOS_TCB_NAME, state);
+		item = block[(item_offset + FREERTOS_ITEM_NEXT) / 4U];
+	}
+}
+
+static void gdb_rtos_freertos_scan(target_s *const t)
+{
+	gdb_rtos_current = target_mem_read32(t, gdb_symbol_address(GDB_SYMBOL_FREERTOS_CURRENT_TCB));
+	const uint32_t top_priority = target_mem_read32(t, gdb_symbol_address(GDB_SYMBOL_FREERTOS_TOP_USED_PRIORITY));
+	const uint32_t priorities = MIN(top_priority + 1U, FREERTOS_MAX_PRIORITIES);
+	const target_addr_t ready_lists = gdb_symbol_address(GDB_SYMBOL_FREERTOS_READY_LISTS);
+	/* Highest priority first, so the list reads the way the scheduler sees it */
+	for (uint32_t priority = priorities; priority-- > 0U;)
+		gdb_rtos_freertos_list(t, ready_lists + (priority * FREERTOS_LIST_SIZE), FREERTOS_TCB_STATE_ITEM, "Ready");
+	/* Tasks made ready while the scheduler was suspended are linked in through their event list item */
+	gdb_rtos_freertos_list(
+		t, gdb_symbol_address(GDB_SYMBOL_FREERTOS_PENDING_READY_LIST), FREERTOS_TCB_EVENT_ITEM, "Ready");
+	gdb_rtos_freertos_list(
+		t, gdb_symbol_address(GDB_SYMBOL_FREERTOS_DELAYED_LIST1), FREERTOS_TCB_STATE_ITEM, "Blocked");
+	gdb_rtos_freertos_list(
+		t, gdb_symbol_address(GDB_SYMBOL_FREERTOS_DELAYED_LIST2), FREERTOS_TCB_STATE_ITEM, "Blocked");
+	gdb_rtos_freertos_list(
+		t, gdb_symbol_address(GDB_SYMBOL_FREERTOS_SUSPENDED_LIST), FREERTOS_TCB_STATE_ITEM, "Suspended");
+	gdb_rtos_freertos_list(
+		t, gdb_symbol_address(GDB_SYMBOL_FREERTOS_TERMINATION_LIST), FREERTOS_TCB_STATE_ITEM, "Deleted");
+}
+
+static const char *gdb_rtos_zephyr_state(const uint8_t state)
+{
+	if (state & ZEPHYR_THREAD_DEAD)
+		return "Dead";
+	if (state & ZEPHYR_THREAD_SUSPENDED)
+		return "Suspended";
+	if (state & ZEPHYR_THREAD_PENDING)
+		return "Pending";
+	if (state & ZEPHYR_THREAD_PRESTART)
+		return "Not started";
+	return "Ready";
+}
+
+static void gdb_rtos_zephyr_scan(target_s *const t)
+{
+	const uint32_t *const offsets = gdb_rtos_zephyr_offsets;
+	const uint32_t count = target_mem_read32(t, gdb_symbol_address(GDB_SYMBOL_ZEPHYR_THREAD_INFO_NUM_OFFSETS));
+	memset(gdb_rtos_zephyr_offsets, 0xff, sizeof(gdb_rtos_zephyr_offsets));
+	if (count <= ZEPHYR_OFFSET_T_STACK_PTR)
+		return;
+	const target_addr_t offsets_addr = gdb_symbol_address(GDB_SYMBOL_ZEPHYR_THREAD_INFO_OFFSETS);
+	const size_t offsets_size = MIN(count, ZEPHYR_OFFSET_COUNT) * sizeof(uint32_t);
+	if (target_mem_read(t, gdb_rtos_zephyr_offsets, offsets_addr, offsets_size))
+		return;
+
+	const target_addr_t kernel = gdb_symbol_address(GDB_SYMBOL_ZEPHYR_KERNEL);
+	gdb_rtos_current = target_mem_read32(t, kernel + offsets[ZEPHYR_OFFSET_K_CURR_THREAD]);
+	uint32_t thread = target_mem_read32(t, kernel + offsets[ZEPHYR_OFFSET_K_THREADS]);
+	while (thread && gdb_rtos_task_count < GDB_RTOS_MAX_TASKS && !target_check_error(t)) {
+		uint8_t state = 0;
+		char name[GDB_RTOS_NAME_LEN];
+		const bool has_name = offsets[ZEPHYR_OFFSET_T_NAME] != ZEPHYR_OFFSET_UNIMPLEMENTED &&
+			!target_mem_read(t, name, thread + offsets[ZEPHYR_OFFSET_T_NAME], sizeof(name));
+		if (target_mem_read(t, &state, thread + offsets[ZEPHYR_OFFSET_T_STATE], sizeof(state)))
+			return;
+		const uint32_t stack = target_mem_read32(t, thread + offsets[ZEPHYR_OFFSET_T_STACK_PTR]);
+		gdb_rtos_task_add(thread, stack, has_name ? name : NULL, gdb_rtos_zephyr_state(state));
+		thread = target_mem_read32(t, thread + offsets[ZEPHYR_OFFSET_T_NEXT_THREAD]);
+		/* The monitor list is singly linked, so going round again means it's been corrupted */
+		if (gdb_rtos_task_find(thread))
+			break;
+	}
+}
+
+/* Make sure the task list is up to date, returning whether there is one to present */
+static bool gdb_rtos_scan(target_s *const t)
+{
+	if (!t || gdb_rtos_kind == GDB_RTOS_NONE)
+		return false;
+	if (!gdb_rtos_scanned) {
+		gdb_rtos_scanned = true;
+		gdb_rtos_task_count = 0;
+		if (gdb_rtos_kind == GDB_RTOS_FREERTOS)
+			gdb_rtos_freertos_scan(t);
+		else
+			gdb_rtos_zephyr_scan(t);
+		/* Before the scheduler is going there's nothing sensible to show, so stay with the core */
+		if (target_check_error(t) || !gdb_rtos_task_find(gdb_rtos_current))
+			gdb_rtos_task_count = 0;
+	}
+	return gdb_rtos_task_count != 0U;
+}
+
+uint32_t gdb_rtos_current_thread(target_s *const t)
+{
+	return gdb_rtos_scan(t) ? gdb_rtos_current : 0U;
+}
+
+bool gdb_rtos_thread_select(target_s *const t, const uint32_t thread_id)
+{
+	if (!gdb_rtos_scan(t))
+		return false;
+	const gdb_rtos_task_s *const task = gdb_rtos_task_find(thread_id);
+	if (!task)
+		return false;
+	gdb_rtos_selected = task->id == gdb_rtos_current ? NULL : task;
+	return true;
+}
+
+bool gdb_rtos_thread_alive(target_s *const t, const uint32_t thread_id)
+{
+	return gdb_rtos_scan(t) && gdb_rtos_task_find(thread_id);
+}
+
+bool gdb_rtos_thread_list(target_s *const t, const bool first)
+{
+	if (!gdb_rtos_scan(t))
+		return false;
+	if (first)
+		gdb_rtos_list_next = 0;
+	if (gdb_rtos_list_next == gdb_rtos_task_count) {
+		gdb_putpacketz("l");
+		return true;
+	}
+	char reply[256U];
+	size_t offset = 0;
+	reply[offset++] = 'm';
+	for (; gdb_rtos_list_next < gdb_rtos_task_count && offset + 10U < sizeof(reply); ++gdb_rtos_list_next)
+		offset += snprintf(reply + offset, sizeof(reply) - offset, "%s%" PRIx32, offset > 1U ? "," : "",
+			gdb_rtos_tasks[gdb_rtos_list_next].id);
+	gdb_putpacket(reply, offset);
+	return true;
+}
+
+bool gdb_rtos_thread_extra_info(target_s *const t, const uint32_t thread_id)
+{
+	if (!gdb_rtos_scan(t))
+		return false;
+	const gdb_rtos_task_s *const task = gdb_rtos_task_find(thread_id);
+	if (!task)
+		return false;
+	char info[GDB_RTOS_NAME_LEN + 16U];
+	const int length = snprintf(info, sizeof(info), "%s (%s)", task->name[0] ? task->name : "unnamed", task->state);
+	char reply[sizeof(info) * 2U];
+	gdb_putpacket(hexify(reply, info, (size_t)length), (size_t)length * 2U);
+	return true;
+}
+
+bool gdb_rtos_thread_regs(target_s *const t, char *const buffer, const size_t buffer_size)
+{
+	if (!gdb_rtos_selected)
+		return false;
+	const size_t regs_size = target_regs_size(t);
+	uint8_t regs[regs_size];
+	bool unstacked = false;
+	if (gdb_rtos_kind == GDB_RTOS_ZEPHYR) {
+		/* Zephyr keeps r4-r11 in the thread, just ahead of the saved stack pointer */
+		uint32_t callee_saved[ZEPHYR_CALLEE_SAVED_SIZE / 4U];
+		const target_addr_t callee_saved_addr =
+			gdb_rtos_selected->id + gdb_rtos_zephyr_offsets[ZEPHYR_OFFSET_T_STACK_PTR] - ZEPHYR_CALLEE_SAVED_SIZE;
+		unstacked = !target_mem_read(t, callee_saved, callee_saved_addr, sizeof(callee_saved)) &&
+			target_regs_unstack(t, regs, gdb_rtos_selected->stack, callee_saved);
+	} else
+		unstacked = target_regs_unstack(t, regs, gdb_rtos_selected->stack, NULL);
+	if (!unstacked || regs_size * 2U > buffer_size)
+		gdb_putpacketz("E01");
+	else
+		gdb_putpacket(hexify(buffer, regs, regs_size), regs_size * 2U);
+	return true;
+}
+
+bool gdb_rtos_thread_switched_out(void)
+{
+	return gdb_rtos_selected != NULL;
+}
@@ -0,0 +1,68 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GDB_RTOS_H
+#define GDB_RTOS_H
+
+#include "target.h"
+
+/*
+ * Look for a supported RTOS among the symbols from the qSymbol exchange, called once that's done.
+ * If one is found, its tasks get presented to GDB as threads.
+ */
+void gdb_rtos_detect(void);
+/* Whether the symbols for a supported RTOS were found */
+bool gdb_rtos_active(void);
+/* Forget the task list and register selection, called whenever the target is resumed */
+void gdb_rtos_invalidate(void);
+
+/*
+ * The thread handling hooks below all work with the task list read while the target is halted.
+ * Each returns false without doing anything if the RTOS isn't active or doesn't know the thread.
+ */
+/* The thread ID of the task running on the core, or 0 if there is none */
+uint32_t gdb_rtos_current_thread(target_s *t);
+/* Pick the thread register accesses go to */
+bool gdb_rtos_thread_select(target_s *t, uint32_t thread_id);
+bool gdb_rtos_thread_alive(target_s *t, uint32_t thread_id);
+/* Send the reply to qfThreadInfo (first is true) or qsThreadInfo */
+bool gdb_rtos_thread_list(target_s *t, bool first);
+/* Send the reply to qThreadExtraInfo, the task's name and state */
+bool gdb_rtos_thread_extra_info(target_s *t, uint32_t thread_id);
+/*
+ * While a switched out task is selected, its registers come from its saved context. This sends the
+ * 'g' response and returns true then, gdb_rtos_thread_switched_out() telling writes to refuse.
+ */
+bool gdb_rtos_thread_regs(target_s *t, char *buffer, size_t buffer_size);
+bool gdb_rtos_thread_switched_out(void);
+
+#endif /* GDB_RTOS_H */
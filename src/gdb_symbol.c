@@ -0,0 +1,119 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements the qSymbol exchange, through which GDB looks up symbols in the program it has
+ * loaded on the probe's behalf. Knowing where things like the RTT control block or an RTOS' task lists
+ * are saves having to search the target's RAM for them, or lets us find them at all.
+ *
+ * GDB starts the exchange with "qSymbol::" each time it (re)loads symbols, we reply with the next
+ * symbol we want as "qSymbol:<name in hex>", and GDB answers that with "qSymbol:<value>:<name>", the
+ * value being left empty for symbols it doesn't know. Replying "OK" ends the exchange.
+ */
+
+#include "general.h"
+#include "gdb_symbol.h"
+#include "gdb_packet.h"
+#include "hex_utils.h"
+
+typedef struct gdb_symbol {
+	const char *name;
+	/* The first symbol of a group, if GDB doesn't know it the rest of the group gets skipped */
+	bool lead;
+} gdb_symbol_s;
+
+static const gdb_symbol_s gdb_symbols[GDB_SYMBOL_COUNT] = {
+	[GDB_SYMBOL_SEGGER_RTT] = {"_SEGGER_RTT", true},
+	[GDB_SYMBOL_FREERTOS_CURRENT_TCB] = {"pxCurrentTCB", true},
+	[GDB_SYMBOL_FREERTOS_READY_LISTS] = {"pxReadyTasksLists", false},
+	[GDB_SYMBOL_FREERTOS_DELAYED_LIST1] = {"xDelayedTaskList1", false},
+	[GDB_SYMBOL_FREERTOS_DELAYED_LIST2] = {"xDelayedTaskList2", false},
+	[GDB_SYMBOL_FREERTOS_PENDING_READY_LIST] = {"xPendingReadyList", false},
+	[GDB_SYMBOL_FREERTOS_SUSPENDED_LIST] = {"xSuspendedTaskList", false},
+	[GDB_SYMBOL_FREERTOS_TERMINATION_LIST] = {"xTasksWaitingTermination", false},
+	[GDB_SYMBOL_FREERTOS_TOP_USED_PRIORITY] = {"uxTopUsedPriority", false},
+	[GDB_SYMBOL_ZEPHYR_KERNEL] = {"_kernel", true},
+	[GDB_SYMBOL_ZEPHYR_THREAD_INFO_OFFSETS] = {"_kernel_thread_info_offsets", false},
+	[GDB_SYMBOL_ZEPHYR_THREAD_INFO_NUM_OFFSETS] = {"_kernel_thread_info_num_offsets", false},
+};
+
+static target_addr_t gdb_symbol_addr[GDB_SYMBOL_COUNT];
+static size_t gdb_symbol_next;
+
+bool gdb_symbol_exchange(const char *const packet)
+{
+	const char *const separator = strchr(packet, ':');
+	if (!separator) {
+		gdb_putpacketz("OK");
+		return false;
+	}
+	if (separator[1] == '\0') {
+		/* GDB is starting the exchange, having (re)loaded symbols, so start over */
+		memset(gdb_symbol_addr, 0, sizeof(gdb_symbol_addr));
+		gdb_symbol_next = 0;
+	} else {
+		/* An answer to our last request */
+		char name[48U];
+		const size_t length = MIN(strlen(separator + 1U) / 2U, sizeof(name) - 1U);
+		unhexify(name, separator + 1U, length);
+		name[length] = '\0';
+		for (size_t idx = 0; idx < GDB_SYMBOL_COUNT; ++idx) {
+			if (strcmp(name, gdb_symbols[idx].name) != 0)
+				continue;
+			if (separator != packet)
+				gdb_symbol_addr[idx] = strtoul(packet, NULL, 16);
+			gdb_symbol_next = idx + 1U;
+			if (gdb_symbols[idx].lead && !gdb_symbol_addr[idx]) {
+				while (gdb_symbol_next < GDB_SYMBOL_COUNT && !gdb_symbols[gdb_symbol_next].lead)
+					++gdb_symbol_next;
+			}
+			break;
+		}
+	}
+
+	if (gdb_symbol_next >= GDB_SYMBOL_COUNT) {
+		gdb_putpacketz("OK");
+		return true;
+	}
+	const char *const wanted = gdb_symbols[gdb_symbol_next].name;
+	char reply[8U + 64U];
+	memcpy(reply, "qSymbol:", 8U);
+	const size_t length = strlen(wanted);
+	hexify(reply + 8U, wanted, length);
+	gdb_putpacket(reply, 8U + (length * 2U));
+	return false;
+}
+
+target_addr_t gdb_symbol_address(const gdb_symbol_id_e symbol)
+{
+	return symbol < GDB_SYMBOL_COUNT ? gdb_symbol_addr[symbol] : 0U;
+}
@@ -0,0 +1,63 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GDB_SYMBOL_H
+#define GDB_SYMBOL_H
+
+#include "target.h"
+
+/* The symbols asked of GDB through qSymbol, each RTOS' starting with the one that tells it's there */
+typedef enum gdb_symbol_id {
+	GDB_SYMBOL_SEGGER_RTT,
+	GDB_SYMBOL_FREERTOS_CURRENT_TCB,
+	GDB_SYMBOL_FREERTOS_READY_LISTS,
+	GDB_SYMBOL_FREERTOS_DELAYED_LIST1,
+	GDB_SYMBOL_FREERTOS_DELAYED_LIST2,
+	GDB_SYMBOL_FREERTOS_PENDING_READY_LIST,
+	GDB_SYMBOL_FREERTOS_SUSPENDED_LIST,
+	GDB_SYMBOL_FREERTOS_TERMINATION_LIST,
+	GDB_SYMBOL_FREERTOS_TOP_USED_PRIORITY,
+	GDB_SYMBOL_ZEPHYR_KERNEL,
+	GDB_SYMBOL_ZEPHYR_THREAD_INFO_OFFSETS,
+	GDB_SYMBOL_ZEPHYR_THREAD_INFO_NUM_OFFSETS,
+	GDB_SYMBOL_COUNT,
+} gdb_symbol_id_e;
+
+/*
+ * Handle a qSymbol packet (without the "qSymbol:" prefix), asking GDB for the next symbol we've not
+ * had an answer for yet. Returns true once the exchange is complete and the addresses are all known.
+ */
+bool gdb_symbol_exchange(const char *packet);
+/* The address GDB gave for a symbol, or 0 if it doesn't know it or hasn't been asked yet */
+target_addr_t gdb_symbol_address(gdb_symbol_id_e symbol);
+
+#endif /* GDB_SYMBOL_H */
@@ -0,0 +1,591 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements GDB tracepoints with collection done on the probe. When a tracepoint in the
+ * running experiment is hit, the registers and memory ranges its actions ask for are copied into a
+ * trace buffer held here and the thread is resumed straight away, with GDB only getting involved
+ * again to look at the frames with tfind and tdump.
+ *
+ * The actions supported are register collection ('R', which collects the whole register block) and
+ * memory ranges ('M', absolute or relative to a register). Agent expression collection ('X') and
+ * while-stepping actions are accepted but not collected, those values then show as unavailable.
+ *
+ * See https://sourceware.org/gdb/current/onlinedocs/gdb.html/Tracepoint-Packets.html
+ */
+
+#include "general.h"
+#include "gdb_trace.h"
+#include "gdb_packet.h"
+#include "hex_utils.h"
+
+#define GDB_TRACE_MAX_TRACEPOINTS 8U
+#define GDB_TRACE_MAX_RANGES      4U
+#if PC_HOSTED == 1
+#define GDB_TRACE_BUFFER_SIZE (1024U * 1024U)
+#else
+#define GDB_TRACE_BUFFER_SIZE 2048U
+#endif
+
+/* Blocks making up a frame after its header: a type byte, then for memory the address and length */
+#define GDB_TRACE_BLOCK_REGS   'R'
+#define GDB_TRACE_BLOCK_MEMORY 'M'
+#define GDB_TRACE_MEMORY_HDR   7U
+
+typedef struct gdb_trace_range {
+	int32_t base_reg; /* Register the offset is relative to, or -1 for an absolute address */
+	uint32_t offset;
+	uint16_t length;
+} gdb_trace_range_s;
+
+typedef struct gdb_tracepoint {
+	uint32_t number;
+	target_addr_t addr;
+	bool enabled;
+	bool installed;
+	bool collect_regs;
+	uint32_t pass_count;
+	uint32_t hits;
+	size_t range_count;
+	gdb_trace_range_s ranges[GDB_TRACE_MAX_RANGES];
+} gdb_tracepoint_s;
+
+/* Frames are stored back to back in the buffer, each starting with this header */
+typedef struct gdb_trace_frame_header {
+	uint32_t length; /* Of the whole frame, header included */
+	uint32_t tracepoint;
+	target_addr_t pc;
+} gdb_trace_frame_header_s;
+
+typedef struct gdb_trace_command {
+	const char *prefix;
+	void (*func)(target_s *t, const char *args);
+} gdb_trace_command_s;
+
+static gdb_tracepoint_s gdb_tracepoints[GDB_TRACE_MAX_TRACEPOINTS];
+static size_t gdb_tracepoint_count;
+static target_s *gdb_trace_target;
+static bool gdb_trace_running;
+static const char *gdb_trace_stop_reason = "tnotrun:0";
+static char gdb_trace_stop_passcount[24];
+
+static uint8_t *gdb_trace_buffer;
+static size_t gdb_trace_used;
+static uint32_t gdb_trace_frames;
+/* The frame selected with QTFrame and where it starts in the buffer, -1 for none */
+static int32_t gdb_trace_frame = -1;
+static size_t gdb_trace_frame_offset;
+
+static gdb_tracepoint_s *gdb_tracepoint_find(const uint32_t number)
+{
+	for (size_t idx = 0; idx < gdb_tracepoint_count; ++idx) {
+		if (gdb_tracepoints[idx].number == number)
+			return &gdb_tracepoints[idx];
+	}
+	return NULL;
+}
+
+/* Take the tracepoints' breakpoints out and stop collecting, noting why for qTStatus */
+static void gdb_trace_stop(const char *const reason)
+{
+	for (size_t idx = 0; idx < gdb_tracepoint_count; ++idx) {
+		gdb_tracepoint_s *const tracepoint = &gdb_tracepoints[idx];
+		if (tracepoint->installed && gdb_trace_target)
+			target_breakwatch_clear(gdb_trace_target, TARGET_BREAK_HARD, tracepoint->addr, 2U);
+		tracepoint->installed = false;
+	}
+	gdb_trace_running = false;
+	gdb_trace_stop_reason = reason;
+}
+
+static void gdb_trace_buffer_clear(void)
+{
+	gdb_trace_used = 0U;
+	gdb_trace_frames = 0U;
+	gdb_trace_frame = -1;
+}
+
+static void gdb_trace_init(target_s *const t, const char *const args)
+{
+	(void)t;
+	(void)args;
+	if (gdb_trace_running)
+		gdb_trace_stop("tstop:0");
+	gdb_tracepoint_count = 0U;
+	gdb_trace_buffer_clear();
+	free(gdb_trace_buffer);
+	gdb_trace_buffer = NULL;
+	gdb_trace_stop_reason = "tnotrun:0";
+	gdb_putpacketz("OK");
+}
+
+/* 'R mask', 'M basereg,offset,len' or 'X len,expr' added to an existing tracepoint */
+static bool gdb_trace_add_action(gdb_tracepoint_s *const tracepoint, const char *action)
+{
+	/* While-stepping actions are not supported, and neither is collecting expressions */
+	if (action[0] == 'S' || action[0] == 'X')
+		return true;
+	if (action[0] == 'R') {
+		tracepoint->collect_regs = strtoul(action + 1U, NULL, 16) != 0U;
+		return true;
+	}
+	if (action[0] != 'M' || tracepoint->range_count == GDB_TRACE_MAX_RANGES)
+		return false;
+
+	gdb_trace_range_s *const range = &tracepoint->ranges[tracepoint->range_count];
+	char *end = NULL;
+	range->base_reg = (int32_t)strtol(action + 1U, &end, 16);
+	if (*end != ',')
+		return false;
+	/* Offsets are sent as 64-bit values, negative ones included, and only the bottom 32 bits matter */
+	range->offset = (uint32_t)strtoull(end + 1U, &end, 16);
+	if (*end != ',')
+		return false;
+	const unsigned long length = strtoul(end + 1U, NULL, 16);
+	range->length = (uint16_t)MIN(length, UINT16_MAX);
+	++tracepoint->range_count;
+	return true;
+}
+
+/* 'n:addr:ena:step:pass[...]' defines a tracepoint, '-n:addr:action' adds an action to one */
+static void gdb_trace_define(target_s *const t, const char *const args)
+{
+	(void)t;
+	const bool action = args[0] == '-';
+	char *end = NULL;
+	const uint32_t number = strtoul(args + (action ? 1U : 0U), &end, 16);
+	if (*end != ':') {
+		gdb_putpacketz("E01");
+		return;
+	}
+	const target_addr_t addr = strtoul(end + 1U, &end, 16);
+	if (*end != ':') {
+		gdb_putpacketz("E01");
+		return;
+	}
+
+	gdb_tracepoint_s *tracepoint = gdb_tracepoint_find(number);
+	if (action) {
+		if (!tracepoint || tracepoint->addr != addr || !gdb_trace_add_action(tracepoint, end + 1U))
+			gdb_putpacketz("E01");
+		else
+			gdb_putpacketz("OK");
+		return;
+	}
+
+	if (!tracepoint) {
+		if (gdb_tracepoint_count == GDB_TRACE_MAX_TRACEPOINTS) {
+			gdb_putpacketz("E01");
+			return;
+		}
+		tracepoint = &gdb_tracepoints[gdb_tracepoint_count++];
+	}
+	memset(tracepoint, 0, sizeof(*tracepoint));
+	tracepoint->number = number;
+	tracepoint->addr = addr;
+	tracepoint->enabled = end[1] == 'E';
+	/* Skip over the step count, which has to do with while-stepping, to the pass count */
+	const char *const step = strchr(end + 1U, ':');
+	const char *const pass = step ? strchr(step + 1U, ':') : NULL;
+	if (pass)
+		tracepoint->pass_count = strtoul(pass + 1U, NULL, 16);
+	gdb_putpacketz("OK");
+}
+
+static void gdb_trace_start(target_s *const t, const char *const args)
+{
+	(void)args;
+	if (!t) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	if (!gdb_trace_buffer)
+		gdb_trace_buffer = malloc(GDB_TRACE_BUFFER_SIZE);
+	if (!gdb_trace_buffer) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		gdb_putpacketz("E01");
+		return;
+	}
+	gdb_trace_buffer_clear();
+	gdb_trace_target = t;
+
+	/* Tracepoints are hit as hardware breakpoints, the thread only stopping long enough for collection */
+	for (size_t idx = 0; idx < gdb_tracepoint_count; ++idx) {
+		gdb_tracepoint_s *const tracepoint = &gdb_tracepoints[idx];
+		tracepoint->hits = 0U;
+		if (!tracepoint->enabled)
+			continue;
+		if (target_breakwatch_set(t, TARGET_BREAK_HARD, tracepoint->addr, 2U) != 0) {
+			gdb_trace_stop("tnotrun:0");
+			gdb_putpacketz("E01");
+			return;
+		}
+		tracepoint->installed = true;
+	}
+	gdb_trace_running = true;
+	gdb_trace_stop_reason = "tnotrun:0";
+	gdb_putpacketz("OK");
+}
+
+static void gdb_trace_stop_cmd(target_s *const t, const char *const args)
+{
+	(void)t;
+	(void)args;
+	if (gdb_trace_running)
+		gdb_trace_stop("tstop:0");
+	gdb_putpacketz("OK");
+}
+
+static void gdb_trace_status(target_s *const t, const char *const args)
+{
+	(void)t;
+	(void)args;
+	gdb_putpacket_f("T%u;%s;tframes:%" PRIx32 ";tcreated:%" PRIx32 ";tfree:%zx;tsize:%x;circular:0;disconn:0",
+		gdb_trace_running ? 1U : 0U, gdb_trace_stop_reason, gdb_trace_frames, gdb_trace_frames,
+		(size_t)GDB_TRACE_BUFFER_SIZE - gdb_trace_used, GDB_TRACE_BUFFER_SIZE);
+}
+
+/* 'n:addr' asks after the hit count and buffer usage of a tracepoint */
+static void gdb_trace_point_status(target_s *const t, const char *const args)
+{
+	(void)t;
+	const gdb_tracepoint_s *const tracepoint = gdb_tracepoint_find(strtoul(args, NULL, 16));
+	if (!tracepoint) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	gdb_putpacket_f("V%" PRIx32 ":%zx", tracepoint->hits, gdb_trace_used);
+}
+
+static void gdb_trace_enable(target_s *const t, const char *const args, const bool enable)
+{
+	gdb_tracepoint_s *const tracepoint = gdb_tracepoint_find(strtoul(args, NULL, 16));
+	if (!tracepoint) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	tracepoint->enabled = enable;
+	/* A running experiment gets the change straight away */
+	if (gdb_trace_running && t == gdb_trace_target && enable != tracepoint->installed) {
+		if (enable)
+			tracepoint->installed = target_breakwatch_set(t, TARGET_BREAK_HARD, tracepoint->addr, 2U) == 0;
+		else {
+			target_breakwatch_clear(t, TARGET_BREAK_HARD, tracepoint->addr, 2U);
+			tracepoint->installed = false;
+		}
+	}
+	gdb_putpacketz("OK");
+}
+
+static void gdb_trace_enable_cmd(target_s *const t, const char *const args)
+{
+	gdb_trace_enable(t, args, true);
+}
+
+static void gdb_trace_disable_cmd(target_s *const t, const char *const args)
+{
+	gdb_trace_enable(t, args, false);
+}
+
+/* Walk to the start of the frame after the one at offset */
+static inline size_t gdb_trace_next_frame(const size_t offset)
+{
+	gdb_trace_frame_header_s header;
+	memcpy(&header, gdb_trace_buffer + offset, sizeof(header));
+	return offset + header.length;
+}
+
+/*
+ * Select a frame: 'n' by number, or the next one after the current selection that matches
+ * 'pc:addr', 'tdp:t', 'range:start:end' or 'outside:start:end'
+ */
+static void gdb_trace_select(target_s *const t, const char *const args)
+{
+	(void)t;
+	typedef enum { SELECT_NUMBER, SELECT_PC, SELECT_TRACEPOINT, SELECT_RANGE, SELECT_OUTSIDE } select_e;
+	select_e mode = SELECT_NUMBER;
+	const char *values = args;
+	if (!strncmp(args, "pc:", 3U)) {
+		mode = SELECT_PC;
+		values = args + 3U;
+	} else if (!strncmp(args, "tdp:", 4U)) {
+		mode = SELECT_TRACEPOINT;
+		values = args + 4U;
+	} else if (!strncmp(args, "range:", 6U)) {
+		mode = SELECT_RANGE;
+		values = args + 6U;
+	} else if (!strncmp(args, "outside:", 8U)) {
+		mode = SELECT_OUTSIDE;
+		values = args + 8U;
+	}
+	char *end = NULL;
+	const uint32_t first = strtoul(values, &end, 16);
+	const uint32_t second = *end == ':' ? strtoul(end + 1U, NULL, 16) : first;
+
+	/* -1 deselects, as does asking for a number beyond the last frame */
+	if (mode == SELECT_NUMBER && (int32_t)first < 0) {
+		gdb_trace_frame = -1;
+		gdb_putpacketz("F-1");
+		return;
+	}
+	size_t offset = 0U;
+	for (uint32_t frame = 0U; frame < gdb_trace_frames; ++frame, offset = gdb_trace_next_frame(offset)) {
+		if (mode != SELECT_NUMBER && (int32_t)frame <= gdb_trace_frame)
+			continue;
+		gdb_trace_frame_header_s header;
+		memcpy(&header, gdb_trace_buffer + offset, sizeof(header));
+		bool match = false;
+		switch (mode) {
+		case SELECT_NUMBER:
+			match = frame == first;
+			break;
+		case SELECT_PC:
+			match = header.pc == first;
+			break;
+		case SELECT_TRACEPOINT:
+			match = header.tracepoint == first;
+			break;
+		case SELECT_RANGE:
+			match = header.pc >= first && header.pc <= second;
+			break;
+		case SELECT_OUTSIDE:
+			match = header.pc < first || header.pc > second;
+			break;
+		}
+		if (match) {
+			gdb_trace_frame = (int32_t)frame;
+			gdb_trace_frame_offset = offset;
+			gdb_putpacket_f("F%" PRIx32 "T%" PRIx32, frame, header.tracepoint);
+			return;
+		}
+	}
+	gdb_trace_frame = -1;
+	gdb_putpacketz("F-1");
+}
+
+/* Settings and information the probe has no use for, which just need acknowledging */
+static void gdb_trace_ack(target_s *const t, const char *const args)
+{
+	(void)t;
+	(void)args;
+	gdb_putpacketz("OK");
+}
+
+/* Uploading of tracepoints and variables to a new GDB session, of which there are never any to give */
+static void gdb_trace_upload(target_s *const t, const char *const args)
+{
+	(void)t;
+	(void)args;
+	gdb_putpacketz("l");
+}
+
+static const gdb_trace_command_s gdb_trace_commands[] = {
+	{"QTinit", gdb_trace_init},
+	{"QTDPsrc:", gdb_trace_ack},
+	{"QTDP:", gdb_trace_define},
+	{"QTStart", gdb_trace_start},
+	{"QTStop", gdb_trace_stop_cmd},
+	{"QTFrame:", gdb_trace_select},
+	{"QTEnable:", gdb_trace_enable_cmd},
+	{"QTDisable:", gdb_trace_disable_cmd},
+	{"QTDV:", gdb_trace_ack},
+	{"QTro", gdb_trace_ack},
+	{"QTDisconnected:", gdb_trace_ack},
+	{"QTBuffer:", gdb_trace_ack},
+	{"QTNotes:", gdb_trace_ack},
+	{"qTStatus", gdb_trace_status},
+	{"qTP:", gdb_trace_point_status},
+	{"qTfP", gdb_trace_upload},
+	{"qTsP", gdb_trace_upload},
+	{"qTfV", gdb_trace_upload},
+	{"qTsV", gdb_trace_upload},
+	{NULL, NULL},
+};
+
+bool gdb_trace_packet(target_s *const t, const char *const packet, const size_t length)
+{
+	(void)length;
+	for (const gdb_trace_command_s *command = gdb_trace_commands; command->prefix; ++command) {
+		const size_t prefix_length = strlen(command->prefix);
+		if (!strncmp(packet, command->prefix, prefix_length)) {
+			command->func(t, packet + prefix_length);
+			return true;
+		}
+	}
+	return false;
+}
+
+static size_t gdb_trace_frame_size(target_s *const t, const gdb_tracepoint_s *const tracepoint)
+{
+	size_t size = sizeof(gdb_trace_frame_header_s);
+	if (tracepoint->collect_regs)
+		size += 1U + target_regs_size(t);
+	for (size_t idx = 0; idx < tracepoint->range_count; ++idx)
+		size += GDB_TRACE_MEMORY_HDR + tracepoint->ranges[idx].length;
+	return size;
+}
+
+/* Collect a memory range, returning how much of the buffer it took up */
+static size_t gdb_trace_collect_range(target_s *const t, const gdb_trace_range_s *const range, uint8_t *const block)
+{
+	target_addr_t addr = range->offset;
+	if (range->base_reg >= 0) {
+		uint32_t base = 0U;
+		if (target_reg_read(t, range->base_reg, &base, sizeof(base)) != sizeof(base))
+			return 0U;
+		addr += base;
+	}
+	if (target_mem_read(t, block + GDB_TRACE_MEMORY_HDR, addr, range->length))
+		return 0U;
+	block[0] = GDB_TRACE_BLOCK_MEMORY;
+	memcpy(block + 1U, &addr, sizeof(addr));
+	memcpy(block + 5U, &range->length, sizeof(range->length));
+	return GDB_TRACE_MEMORY_HDR + range->length;
+}
+
+bool gdb_trace_hit(target_s *const t, const target_addr_t pc)
+{
+	if (!gdb_trace_running || t != gdb_trace_target)
+		return false;
+	gdb_tracepoint_s *tracepoint = NULL;
+	for (size_t idx = 0; idx < gdb_tracepoint_count && !tracepoint; ++idx) {
+		if (gdb_tracepoints[idx].installed && gdb_tracepoints[idx].addr == pc)
+			tracepoint = &gdb_tracepoints[idx];
+	}
+	if (!tracepoint)
+		return false;
+
+	if (gdb_trace_used + gdb_trace_frame_size(t, tracepoint) > GDB_TRACE_BUFFER_SIZE) {
+		gdb_trace_stop("tfull:0");
+		return true;
+	}
+	uint8_t *const frame = gdb_trace_buffer + gdb_trace_used;
+	size_t length = sizeof(gdb_trace_frame_header_s);
+	if (tracepoint->collect_regs) {
+		frame[length++] = GDB_TRACE_BLOCK_REGS;
+		target_regs_read(t, frame + length);
+		length += target_regs_size(t);
+	}
+	for (size_t idx = 0; idx < tracepoint->range_count; ++idx)
+		length += gdb_trace_collect_range(t, &tracepoint->ranges[idx], frame + length);
+	const gdb_trace_frame_header_s header = {
+		.length = length,
+		.tracepoint = tracepoint->number,
+		.pc = pc,
+	};
+	memcpy(frame, &header, sizeof(header));
+	gdb_trace_used += length;
+	++gdb_trace_frames;
+
+	if (++tracepoint->hits == tracepoint->pass_count) {
+		snprintf(gdb_trace_stop_passcount, sizeof(gdb_trace_stop_passcount), "tpasscount:%" PRIx32,
+			tracepoint->number);
+		gdb_trace_stop(gdb_trace_stop_passcount);
+	}
+	return true;
+}
+
+void gdb_trace_target_destroyed(const target_s *const t)
+{
+	if (t != gdb_trace_target)
+		return;
+	/* The target's breakpoint list goes with it, so there's nothing to take out */
+	for (size_t idx = 0; idx < gdb_tracepoint_count; ++idx)
+		gdb_tracepoints[idx].installed = false;
+	gdb_trace_target = NULL;
+	if (gdb_trace_running) {
+		gdb_trace_running = false;
+		gdb_trace_stop_reason = "tdisconnected:0";
+	}
+}
+
+/* Find the block of the given type in the selected frame covering addr (for memory), or NULL */
+static const uint8_t *gdb_trace_frame_block(const uint8_t type, const target_addr_t addr, size_t *const avail)
+{
+	gdb_trace_frame_header_s header;
+	memcpy(&header, gdb_trace_buffer + gdb_trace_frame_offset, sizeof(header));
+	const uint8_t *const frame = gdb_trace_buffer + gdb_trace_frame_offset;
+	const size_t regs_size = gdb_trace_target ? target_regs_size(gdb_trace_target) : 0U;
+	for (size_t offset = sizeof(header); offset < header.length;) {
+		const uint8_t *const block = frame + offset;
+		if (block[0] == GDB_TRACE_BLOCK_REGS) {
+			if (type == GDB_TRACE_BLOCK_REGS) {
+				*avail = regs_size;
+				return block + 1U;
+			}
+			offset += 1U + regs_size;
+			continue;
+		}
+		target_addr_t start = 0U;
+		uint16_t length = 0U;
+		memcpy(&start, block + 1U, sizeof(start));
+		memcpy(&length, block + 5U, sizeof(length));
+		if (type == GDB_TRACE_BLOCK_MEMORY && addr >= start && addr - start < length) {
+			*avail = length - (addr - start);
+			return block + GDB_TRACE_MEMORY_HDR + (addr - start);
+		}
+		offset += GDB_TRACE_MEMORY_HDR + length;
+	}
+	return NULL;
+}
+
+bool gdb_trace_frame_regs(target_s *const t, char *const buffer, const size_t buffer_size)
+{
+	if (gdb_trace_frame < 0)
+		return false;
+	const size_t regs_size = target_regs_size(t);
+	size_t avail = 0U;
+	const uint8_t *const regs = gdb_trace_frame_block(GDB_TRACE_BLOCK_REGS, 0U, &avail);
+	if (regs && avail == regs_size && regs_size * 2U <= buffer_size)
+		gdb_putpacket(hexify(buffer, regs, regs_size), regs_size * 2U);
+	else {
+		/* Registers that weren't collected get reported as unavailable */
+		const size_t length = MIN(regs_size * 2U, buffer_size);
+		memset(buffer, 'x', length);
+		gdb_putpacket(buffer, length);
+	}
+	return true;
+}
+
+bool gdb_trace_frame_mem(const target_addr_t addr, const size_t len, char *const buffer)
+{
+	if (gdb_trace_frame < 0)
+		return false;
+	size_t avail = 0U;
+	const uint8_t *const data = gdb_trace_frame_block(GDB_TRACE_BLOCK_MEMORY, addr, &avail);
+	/* Memory not collected in the frame can't be read, and a read running off a block gets cut short */
+	if (!data)
+		gdb_putpacketz("E01");
+	else
+		gdb_putpacket(hexify(buffer, data, MIN(avail, len)), MIN(avail, len) * 2U);
+	return true;
+}
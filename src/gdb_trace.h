@@ -0,0 +1,55 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GDB_TRACE_H
+#define GDB_TRACE_H
+
+#include "target.h"
+
+/* Handle a tracepoint packet (QT... or qT...), returning false if it isn't one */
+bool gdb_trace_packet(target_s *t, const char *packet, size_t length);
+/*
+ * Called when a thread stops at a breakpoint with the PC it stopped at. If that's a tracepoint in the
+ * running experiment a frame gets collected and true returned, the thread then wants resuming.
+ */
+bool gdb_trace_hit(target_s *t, target_addr_t pc);
+/* Forget about the given target's tracepoints as it's going away */
+void gdb_trace_target_destroyed(const target_s *t);
+
+/*
+ * While GDB has a trace frame selected, register and memory reads are answered from the frame. These
+ * send the response and return true if a frame is selected, and return false without doing anything if not.
+ */
+bool gdb_trace_frame_regs(target_s *t, char *buffer, size_t buffer_size);
+bool gdb_trace_frame_mem(target_addr_t addr, size_t len, char *buffer);
+
+#endif /* GDB_TRACE_H */
@@ -23,36 +23,141 @@
 #include "general.h"
 #include "hex_utils.h"
 
+#if PC_HOSTED == 1
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HEX_UTILS_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define HEX_UTILS_NEON
+#endif
+#endif
+
+/*
+ * Every byte value's two digit hex representation, so encoding takes one table access per byte.
+ * Built from rows of the form "h0h1...hf" for each leading digit h.
+ */
+#define HEX_ROW(h) #h "0" #h "1" #h "2" #h "3" #h "4" #h "5" #h "6" #h "7" #h "8" #h "9" #h "a" #h "b" #h "c" #h "d" #h "e" #h "f"
+static const char hex_pairs[513] = HEX_ROW(0) HEX_ROW(1) HEX_ROW(2) HEX_ROW(3) HEX_ROW(4) HEX_ROW(5) HEX_ROW(6)
+	HEX_ROW(7) HEX_ROW(8) HEX_ROW(9) HEX_ROW(a) HEX_ROW(b) HEX_ROW(c) HEX_ROW(d) HEX_ROW(e) HEX_ROW(f);
+
+/*
+ * Digit values for the characters '0' through 'f', indexed by the character minus '0'.
+ * Anything that isn't a hex digit decodes as 0.
+ */
+static const uint8_t unhex_digits[] = {
+	0U, 1U, 2U, 3U, 4U, 5U, 6U, 7U, 8U, 9U,                                    /* '0'-'9' */
+	0U, 0U, 0U, 0U, 0U, 0U, 0U,                                                /* ':'-'@' */
+	10U, 11U, 12U, 13U, 14U, 15U,                                              /* 'A'-'F' */
+	0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, /* 'G'-'Z' */
+	0U, 0U, 0U, 0U, 0U, 0U,                                                    /* '['-'`' */
+	10U, 11U, 12U, 13U, 14U, 15U,                                              /* 'a'-'f' */
+};
+
+#if defined(HEX_UTILS_SSE2)
+/* Convert 16 nibble values to their lower case hex digit characters */
+static inline __m128i hexify_nibbles(const __m128i nibbles)
+{
+	const __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+	return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+/* Encode 16 bytes into 32 hex characters */
+static inline void hexify_block(char *const dst, const uint8_t *const src)
+{
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	const __m128i bytes = _mm_loadu_si128((const __m128i *)src);
+	const __m128i high = hexify_nibbles(_mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+	const __m128i low = hexify_nibbles(_mm_and_si128(bytes, mask));
+	_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(high, low));
+	_mm_storeu_si128((__m128i *)(dst + 16U), _mm_unpackhi_epi8(high, low));
+}
+
+/* Turn 16 hex characters into 8 byte values held in the low halves of 16-bit lanes */
+static inline __m128i unhexify_pairs(const char *const src)
+{
+	/* Folding to lower case leaves the digits alone, after which letters are the only values above 9 */
+	const __m128i chars = _mm_or_si128(_mm_loadu_si128((const __m128i *)src), _mm_set1_epi8(0x20));
+	__m128i values = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+	values =
+		_mm_sub_epi8(values, _mm_and_si128(_mm_cmpgt_epi8(values, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10)));
+	/* Each 16-bit lane holds a digit pair, the first (high nibble) digit in its low byte */
+	return _mm_or_si128(_mm_and_si128(_mm_slli_epi16(values, 4), _mm_set1_epi16(0x00f0)), _mm_srli_epi16(values, 8));
+}
+
+/* Decode 32 hex characters into 16 bytes */
+static inline void unhexify_block(uint8_t *const dst, const char *const src)
+{
+	_mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(unhexify_pairs(src), unhexify_pairs(src + 16U)));
+}
+#elif defined(HEX_UTILS_NEON)
 static const char hexdigits[] = "0123456789abcdef";
 
+/* Encode 16 bytes into 32 hex characters */
+static inline void hexify_block(char *const dst, const uint8_t *const src)
+{
+	const uint8x16_t digits = vld1q_u8((const uint8_t *)hexdigits);
+	const uint8x16_t bytes = vld1q_u8(src);
+	uint8x16x2_t result;
+	result.val[0] = vqtbl1q_u8(digits, vshrq_n_u8(bytes, 4));
+	result.val[1] = vqtbl1q_u8(digits, vandq_u8(bytes, vdupq_n_u8(0x0fU)));
+	/* The interleaving store puts each high digit in front of its low digit */
+	vst2q_u8((uint8_t *)dst, result);
+}
+
+static inline uint8x16_t unhexify_digits(const uint8x16_t chars)
+{
+	/* Folding to lower case leaves the digits alone, after which letters are the only values above 9 */
+	const uint8x16_t values = vsubq_u8(vorrq_u8(chars, vdupq_n_u8(0x20U)), vdupq_n_u8('0'));
+	return vsubq_u8(values, vandq_u8(vcgtq_u8(values, vdupq_n_u8(9U)), vdupq_n_u8('a' - '0' - 10)));
+}
+
+/* Decode 32 hex characters into 16 bytes */
+static inline void unhexify_block(uint8_t *const dst, const char *const src)
+{
+	/* The de-interleaving load splits the high and the low digits of each pair apart */
+	const uint8x16x2_t chars = vld2q_u8((const uint8_t *)src);
+	const uint8x16_t high = unhexify_digits(chars.val[0]);
+	const uint8x16_t low = unhexify_digits(chars.val[1]);
+	vst1q_u8(dst, vorrq_u8(vshlq_n_u8(high, 4), low));
+}
+#endif
+
 char *hexify(char *const hex, const void *const buf, const size_t size)
 {
 	char *dst = hex;
 	const uint8_t *const src = buf;
 
-	for (size_t idx = 0; idx < size; ++idx) {
-		*dst++ = hexdigits[src[idx] >> 4U];
-		*dst++ = hexdigits[src[idx] & 0xfU];
+	size_t idx = 0;
+#if defined(HEX_UTILS_SSE2) || defined(HEX_UTILS_NEON)
+	for (; idx + 16U <= size; idx += 16U, dst += 32U)
+		hexify_block(dst, src + idx);
+#endif
+	for (; idx < size; ++idx) {
+		const char *const pair = hex_pairs + (src[idx] * 2U);
+		*dst++ = pair[0];
+		*dst++ = pair[1];
 	}
 	*dst = 0;
 
 	return hex;
 }
 
-static uint8_t unhex_digit(const char hex)
+static inline uint8_t unhex_digit(const char hex)
 {
-	uint8_t tmp = hex - '0';
-	if (tmp > 9U)
-		tmp -= 'A' - '0' - 10U;
-	if (tmp > 16U)
-		tmp -= 'a' - 'A';
-	return tmp;
+	const uint8_t index = (uint8_t)(hex - '0');
+	return index < sizeof(unhex_digits) ? unhex_digits[index] : 0U;
 }
 
 char *unhexify(void *const buf, const char *hex, const size_t size)
 {
 	uint8_t *const dst = buf;
-	for (size_t idx = 0; idx < size; ++idx, hex += 2U)
+	size_t idx = 0;
+#if defined(HEX_UTILS_SSE2) || defined(HEX_UTILS_NEON)
+	for (; idx + 16U <= size; idx += 16U, hex += 32U)
+		unhexify_block(dst + idx, hex);
+#endif
+	for (; idx < size; ++idx, hex += 2U)
 		dst[idx] = (unhex_digit(hex[0]) << 4U) | unhex_digit(hex[1]);
 	return buf;
 }
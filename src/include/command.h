@@ -39,4 +39,9 @@ bool parse_enable_or_disable(const char *s, bool *out);
 extern bool shutdown_bmda;
 #endif
 
+#ifdef PLATFORM_HAS_SETTINGS
+/* Scan for targets at power-up if 'monitor boot_scan' asked for it */
+void command_boot_scan(void);
+#endif
+
 #endif /* INCLUDE_COMMAND_H */
@@ -21,6 +21,12 @@
 #ifndef INCLUDE_CRC32_H
 #define INCLUDE_CRC32_H
 
-bool generic_crc32(target_s *t, uint32_t *crc, uint32_t base, int len);
+bool generic_crc32(target_s *t, uint32_t *crc, uint32_t base, size_t len);
+/* As generic_crc32(), but always reading the region back rather than running code on the target */
+bool generic_crc32_readback(target_s *t, uint32_t *crc, uint32_t base, size_t len);
+/* Compute the same CRC as generic_crc32() over a buffer in our own memory */
+uint32_t generic_crc32_buffer(const void *data, size_t len);
+/* Compute the same CRC as generic_crc32() over len bytes that all hold value */
+uint32_t generic_crc32_fill(uint8_t value, size_t len);
 
 #endif /* INCLUDE_CRC32_H */
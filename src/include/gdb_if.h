@@ -26,9 +26,31 @@
 void gdb_usb_out_cb(usbd_device *dev, uint8_t ep);
 #endif
 
+#if PC_HOSTED == 1
+/*
+ * Set how many consecutive TCP ports to listen on (before gdb_if_init()). GDB sessions are
+ * still served one at a time, and one coming in on the nth extra port attaches target n + 1.
+ */
+void gdb_if_set_ports(size_t count);
+/* Which of the ports the current connection came in on, 0 being the first */
+size_t gdb_if_connection_port(void);
+/*
+ * Take and give up access to the target from a thread other than the main one. The main thread
+ * only lets go of it while waiting on GDB in gdb_if_getchar() and gdb_if_getchar_to().
+ */
+void gdb_if_target_access_acquire(void);
+void gdb_if_target_access_release(void);
+#endif
+
 int gdb_if_init(void);
 char gdb_if_getchar(void);
 char gdb_if_getchar_to(uint32_t timeout);
+/*
+ * Get at the contiguous run of input already received, without waiting, returning its length.
+ * Whatever of it gets used is then taken off the input with gdb_if_consume().
+ */
+size_t gdb_if_peek(const char **data);
+void gdb_if_consume(size_t count);
 
 /* sending gdb_if_putchar(0, true) seems to work as keep alive */
 void gdb_if_putchar(char c, int flush);
@@ -23,8 +23,13 @@
 
 #include "target.h"
 extern bool gdb_target_running;
+extern bool gdb_non_stop;
 extern target_s *cur_target;
 void gdb_poll_target(void);
+void gdb_halt_target(void);
+void gdb_poll_restart(void);
+void gdb_poll_report(target_halt_reason_e reason, target_addr_t watch);
 void gdb_main(char *pbuf, size_t pbuf_size, size_t size);
+target_s *gdb_target_attach_n(size_t n);
 
 #endif /* INCLUDE_GDB_MAIN_H */
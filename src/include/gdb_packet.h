@@ -24,7 +24,19 @@
 #include <stddef.h>
 #include <stdarg.h>
 
+/*
+ * Size of the buffer used to receive GDB packets, and so also the PacketSize advertised to GDB.
+ * Platforms with RAM to spare can override this in platform.h to cut down on round trips.
+ */
+#ifndef GDB_PACKET_BUFFER_SIZE
+#define GDB_PACKET_BUFFER_SIZE 1024U
+#endif
+
 size_t gdb_getpacket(char *packet, size_t size);
+/* Stop (or resume) sending and waiting for packet acknowledgements, as for QStartNoAckMode */
+void gdb_set_noackmode(bool enable);
+/* As gdb_getpacket(), for when the '$' starting the packet has already been read */
+size_t gdb_getpacket_started(char *packet, size_t size);
 void gdb_putpacket(const char *packet, size_t size);
 void gdb_putpacket2(const char *packet1, size_t size1, const char *packet2, size_t size2);
 #define gdb_putpacketz(packet) gdb_putpacket((packet), strlen(packet))
@@ -84,11 +84,13 @@ extern uint32_t delay_cnt;
 	do {                \
 	} while (false)
 #if defined(ENABLE_DEBUG)
-#define DEBUG_WARN(...) PLATFORM_PRINTF(__VA_ARGS__)
-#define DEBUG_INFO(...) PLATFORM_PRINTF(__VA_ARGS__)
+#define DEBUG_WARN(...)            PLATFORM_PRINTF(__VA_ARGS__)
+#define DEBUG_INFO(...)            PLATFORM_PRINTF(__VA_ARGS__)
+#define DEBUG_LEVEL_ENABLED(level) ((level) == BMP_DEBUG_INFO)
 #else
-#define DEBUG_WARN(...) PRINT_NOOP(__VA_ARGS__)
-#define DEBUG_INFO(...) PRINT_NOOP(__VA_ARGS__)
+#define DEBUG_WARN(...)            PRINT_NOOP(__VA_ARGS__)
+#define DEBUG_INFO(...)            PRINT_NOOP(__VA_ARGS__)
+#define DEBUG_LEVEL_ENABLED(level) false
 #endif
 #define DEBUG_GDB(...)      PRINT_NOOP(__VA_ARGS__)
 #define DEBUG_TARGET(...)   PRINT_NOOP(__VA_ARGS__)
@@ -101,83 +103,47 @@ void debug_serial_send_stdout(const uint8_t *data, size_t len);
 #include <stdarg.h>
 extern int cl_debuglevel;
 
-static inline void DEBUG_WARN(const char *format, ...)
-{
-	va_list ap;
-	va_start(ap, format);
-	vfprintf(stderr, format, ap);
-	va_end(ap);
-	return;
-}
-
-static inline void DEBUG_INFO(const char *format, ...)
-{
-	if (~cl_debuglevel & BMP_DEBUG_INFO)
-		return;
-	va_list ap;
-	va_start(ap, format);
-	if (cl_debuglevel & BMP_DEBUG_STDOUT)
-		vfprintf(stdout, format, ap);
-	else
-		vfprintf(stderr, format, ap);
-	va_end(ap);
-	return;
-}
-
-static inline void DEBUG_GDB(const char *format, ...)
-{
-	if (~cl_debuglevel & BMP_DEBUG_GDB)
-		return;
-	va_list ap;
-	va_start(ap, format);
-	vfprintf(stderr, format, ap);
-	va_end(ap);
-	return;
-}
-
-static inline void DEBUG_GDB_WIRE(const char *format, ...)
+/*
+ * Not declared as printf-like as many of the call sites still mix up their size_t and int formats,
+ * which -Wformat would turn into build failures
+ */
+static inline void debug_print(FILE *const stream, const char *const format, ...)
 {
-	if ((cl_debuglevel & (BMP_DEBUG_GDB | BMP_DEBUG_WIRE)) != (BMP_DEBUG_GDB | BMP_DEBUG_WIRE))
-		return;
-	va_list ap;
-	va_start(ap, format);
-	vfprintf(stderr, format, ap);
-	va_end(ap);
-	return;
+	va_list args;
+	va_start(args, format);
+	vfprintf(stream, format, args);
+	va_end(args);
 }
 
-static inline void DEBUG_TARGET(const char *format, ...)
-{
-	if (~cl_debuglevel & BMP_DEBUG_TARGET)
-		return;
-	va_list ap;
-	va_start(ap, format);
-	vfprintf(stderr, format, ap);
-	va_end(ap);
-	return;
-}
+/*
+ * The level checks are done here ahead of the print call so that, when a level is turned off, the
+ * arguments are never evaluated and nothing gets formatted. Code with loops that only exist to print
+ * something can check DEBUG_LEVEL_ENABLED() up front to skip the loop entirely.
+ *
+ * Building with BMDA_NO_WIRE_DEBUG compiles the wire level debug, which sits in the packet handling
+ * hot paths, out completely.
+ */
+#if defined(BMDA_NO_WIRE_DEBUG)
+#define DEBUG_LEVEL_ENABLED(level) \
+	(((level) & BMP_DEBUG_WIRE) == 0U && (cl_debuglevel & (int)(level)) == (int)(level))
+#else
+#define DEBUG_LEVEL_ENABLED(level) ((cl_debuglevel & (int)(level)) == (int)(level))
+#endif
 
-static inline void DEBUG_PROBE(const char *format, ...)
-{
-	if (~cl_debuglevel & BMP_DEBUG_PROBE)
-		return;
-	va_list ap;
-	va_start(ap, format);
-	vfprintf(stderr, format, ap);
-	va_end(ap);
-	return;
-}
+#define DEBUG_PRINT_LEVEL(level, stream, ...) \
+	do {                                      \
+		if (DEBUG_LEVEL_ENABLED(level))       \
+			debug_print(stream, __VA_ARGS__); \
+	} while (false)
 
-static inline void DEBUG_WIRE(const char *format, ...)
-{
-	if (~cl_debuglevel & BMP_DEBUG_WIRE)
-		return;
-	va_list ap;
-	va_start(ap, format);
-	vfprintf(stderr, format, ap);
-	va_end(ap);
-	return;
-}
+#define DEBUG_WARN(...) debug_print(stderr, __VA_ARGS__)
+#define DEBUG_INFO(...) \
+	DEBUG_PRINT_LEVEL(BMP_DEBUG_INFO, (cl_debuglevel & BMP_DEBUG_STDOUT) ? stdout : stderr, __VA_ARGS__)
+#define DEBUG_GDB(...)      DEBUG_PRINT_LEVEL(BMP_DEBUG_GDB, stderr, __VA_ARGS__)
+#define DEBUG_GDB_WIRE(...) DEBUG_PRINT_LEVEL(BMP_DEBUG_GDB | BMP_DEBUG_WIRE, stderr, __VA_ARGS__)
+#define DEBUG_TARGET(...)   DEBUG_PRINT_LEVEL(BMP_DEBUG_TARGET, stderr, __VA_ARGS__)
+#define DEBUG_PROBE(...)    DEBUG_PRINT_LEVEL(BMP_DEBUG_PROBE, stderr, __VA_ARGS__)
+#define DEBUG_WIRE(...)     DEBUG_PRINT_LEVEL(BMP_DEBUG_WIRE, stderr, __VA_ARGS__)
 #endif
 
 #define ALIGN(x, n) (((x) + (n)-1) & ~((n)-1))
@@ -51,6 +51,14 @@ typedef struct jtag_proc {
 	void (*jtagtap_tdi_seq)(const bool final_tms, const uint8_t *data_in, size_t clock_cycles);
 	void (*jtagtap_cycle)(const bool tms, const bool tdi, const size_t clock_cycles);
 
+	/*
+	 * Optional: from Run-Test/Idle, shift ir_in through Shift-IR then, without returning to
+	 * Run-Test/Idle in between, data_in through Shift-DR capturing to data_out (which may be NULL),
+	 * and finish back in Run-Test/Idle. Both sequences are for the whole chain, at most 64 cycles each.
+	 */
+	void (*jtagtap_ir_dr_seq)(
+		const uint8_t *ir_in, size_t ir_cycles, uint8_t *data_out, const uint8_t *data_in, size_t dr_cycles);
+
 	/*
 	 * Some debug controllers such as the RISC-V debug controller use idle
 	 * cycles during operations as part of their function, while others
@@ -58,4 +58,13 @@ uint32_t platform_max_frequency_get(void);
 
 void platform_target_clk_output_enable(bool enable);
 
+#ifdef PLATFORM_HAS_SETTINGS
+/* Probe settings that survive power cycles, kept in the probe's own Flash */
+#define PLATFORM_SETTING_BOOT_SCAN   (1U << 0U) /* Scan for targets at power-up */
+#define PLATFORM_SETTING_AUTO_ATTACH (1U << 1U) /* Attach GDB sessions to the first target found */
+
+uint32_t platform_settings_get(void);
+bool platform_settings_set(uint32_t settings);
+#endif
+
 #endif /* INCLUDE_PLATFORM_SUPPORT_H */
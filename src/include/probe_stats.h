@@ -0,0 +1,97 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDE_PROBE_STATS_H
+#define INCLUDE_PROBE_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Hot path functions whose run time is measured */
+typedef enum probe_stats_timer {
+	PROBE_STATS_SWD_ACCESS,
+	PROBE_STATS_FLASH_WRITE,
+	PROBE_STATS_POLL_RTT,
+	PROBE_STATS_TIMERS,
+} probe_stats_timer_e;
+
+typedef struct probe_stats_time {
+	/* Probe cycles on firmware, microseconds on BMDA */
+	uint64_t total;
+	uint32_t calls;
+	uint32_t max;
+} probe_stats_time_s;
+
+/*
+ * This is sent as-is in reply to the remote protocol stats query,
+ * so only ever append to it and keep it free of padding.
+ */
+typedef struct probe_stats {
+	uint32_t swd_accesses;
+	uint32_t swd_wait_acks;
+	uint32_t swd_fault_acks;
+	uint32_t swd_retries;
+	uint32_t bytes_read;
+	uint32_t bytes_written;
+	uint32_t usb_packets_received;
+	uint32_t usb_packets_sent;
+	probe_stats_time_s time[PROBE_STATS_TIMERS];
+} probe_stats_s;
+
+#if defined(ENABLE_PROBE_STATS)
+extern probe_stats_s probe_stats;
+
+uint32_t probe_stats_timestamp(void);
+void probe_stats_time(probe_stats_timer_e timer, uint32_t start);
+void probe_stats_reset(void);
+void probe_stats_show(void);
+
+#define PROBE_STATS_COUNT(counter)         (++probe_stats.counter)
+#define PROBE_STATS_ADD(counter, amount)   (probe_stats.counter += (amount))
+#define PROBE_STATS_TIME_BEGIN(start)      const uint32_t start = probe_stats_timestamp()
+#define PROBE_STATS_TIME_END(timer, start) probe_stats_time(timer, start)
+#else
+#define PROBE_STATS_COUNT(counter) \
+	do {                           \
+	} while (false)
+#define PROBE_STATS_ADD(counter, amount) \
+	do {                                 \
+	} while (false)
+#define PROBE_STATS_TIME_BEGIN(start) \
+	do {                              \
+	} while (false)
+#define PROBE_STATS_TIME_END(timer, start) \
+	do {                                   \
+	} while (false)
+#endif
+
+#endif /* INCLUDE_PROBE_STATS_H */
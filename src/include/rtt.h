@@ -60,5 +60,7 @@ typedef struct rtt_channel {
 extern rtt_channel_s rtt_channel[MAX_RTT_CHAN];
 
 void poll_rtt(target_s *cur_target);
+/* true while rtt is moving data and wants polling at its fastest rate */
+bool rtt_poll_busy(void);
 
 #endif /* INCLUDE_RTT_H */
@@ -46,7 +46,7 @@ void rtt_serial_receive_callback(usbd_device *dev, uint8_t ep);
 
 #if !defined(RTT_UP_BUF_SIZE) || !defined(RTT_DOWN_BUF_SIZE)
 #if (PC_HOSTED == 1)
-#define RTT_UP_BUF_SIZE   (4096U + 8U)
+#define RTT_UP_BUF_SIZE   (16384U + 8U)
 #define RTT_DOWN_BUF_SIZE 512U
 #elif defined(STM32F7)
 #define RTT_UP_BUF_SIZE   (4096U + 8U)
@@ -60,13 +60,13 @@ void rtt_serial_receive_callback(usbd_device *dev, uint8_t ep);
 #endif
 #endif
 
-/* hosted initialisation */
-int rtt_if_init(void);
+/* hosted initialisation, up channels other than 0 go to files named up_channel_path<N> if given */
+int rtt_if_init(const char *up_channel_path);
 /* hosted teardown */
 int rtt_if_exit(void);
 
-/* target to host: write len bytes from the buffer starting at buf. return number bytes written */
-uint32_t rtt_write(const char *buf, uint32_t len);
+/* target to host: write len bytes from up channel's buffer starting at buf. return number bytes written */
+uint32_t rtt_write(uint32_t channel, const char *buf, uint32_t len);
 /* host to target: read one character, non-blocking. return character, -1 if no character */
 int32_t rtt_getchar();
 /* host to target: true if no characters available for reading */
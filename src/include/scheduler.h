@@ -0,0 +1,90 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2026 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INCLUDE_SCHEDULER_H
+#define INCLUDE_SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Cooperative, run-to-completion task scheduler for the main loop.
+ *
+ * Each task is a short poll function that does a bounded amount of work and returns.
+ * The main loop runs every due task once per pass, and the GDB I/O wait loops hand
+ * background tasks a slice, one at a time, while waiting on the host for packet data.
+ */
+typedef void (*scheduler_task_fn)(void);
+
+typedef struct scheduler_task scheduler_task_s;
+
+struct scheduler_task {
+	const char *name;
+	scheduler_task_fn run;
+	/* Minimum time between runs, 0 to run on every pass */
+	uint32_t period_ms;
+	/* Safe to run from scheduler_yield() while a GDB packet is being received */
+	bool background;
+	/* Target memory traffic draws on the background link budget, and the task waits while GDB is busy */
+	bool budgeted;
+	/* private */
+	uint32_t last_run_ms;
+	scheduler_task_s *next;
+};
+
+void scheduler_register(scheduler_task_s *task);
+/* Run every due task once, from the main loop */
+void scheduler_run(void);
+/* Give the next due background task a slice, if yielding is currently enabled */
+void scheduler_yield(void);
+/* Only the main loop knows when no command is in progress, so it opens and closes the yield window */
+void scheduler_yield_enable(bool enable);
+
+/*
+ * Link arbitration between GDB and the budgeted tasks (RTT and live watch) sharing the debug link.
+ * Budgeted tasks wait until GDB has been quiet for the hold-off time, unless one has been kept waiting
+ * for SCHEDULER_STARVE_MS, and between them move at most the budget in bytes of target memory per
+ * millisecond on average, 0 for no limit.
+ */
+#define SCHEDULER_MAX_LINK_BUDGET 65536U
+#define SCHEDULER_STARVE_MS       100U
+
+extern uint32_t scheduler_link_budget;
+extern uint32_t scheduler_gdb_holdoff_ms;
+
+/* A GDB request has come in, so hold the budgeted tasks off */
+void scheduler_gdb_active(void);
+/* Account target memory traffic to the task running, if it is budgeted */
+void scheduler_link_charge(size_t bytes);
+
+#endif /* INCLUDE_SCHEDULER_H */
@@ -35,6 +35,14 @@ typedef struct swd_proc {
 	void (*seq_out)(uint32_t tms_states, size_t clock_cycles);
 	/* Perform a clock_cycles write + parity with the provided data */
 	void (*seq_out_parity)(uint32_t tms_states, size_t clock_cycles);
+#if PC_HOSTED == 1
+	/*
+	 * Optional, for probes that batch sequences up: queue a clock_cycles read (+ parity if parity_error is
+	 * not NULL) whose results are only stored when flush() next runs, and run everything queued
+	 */
+	void (*seq_in_deferred)(uint32_t *ret, bool *parity_error, size_t clock_cycles);
+	void (*flush)(void);
+#endif
 } swd_proc_s;
 
 extern swd_proc_s swd_proc;
@@ -55,11 +55,17 @@ unsigned int target_designer(target_s *t);
 unsigned int target_part_id(target_s *t);
 
 /* Memory access functions */
-bool target_mem_map(target_s *t, char *buf, size_t len);
+size_t target_mem_map(target_s *t, char *buf, size_t len);
 int target_mem_read(target_s *t, void *dest, target_addr_t src, size_t len);
 int target_mem_write(target_s *t, target_addr_t dest, const void *src, size_t len);
 bool target_mem_access_needs_halt(target_s *t);
 /* Flash memory access functions */
+/* When set, flashing skips erasing and writing blocks whose contents are unchanged */
+extern bool target_flash_incremental;
+extern bool target_flash_blank_check;
+/* When set, each chunk written is read back and checked while the following ones are programmed */
+extern bool target_flash_verify;
+
 bool target_flash_erase(target_s *t, target_addr_t addr, size_t len);
 bool target_flash_write(target_s *t, target_addr_t dest, const void *src, size_t len);
 bool target_flash_complete(target_s *t);
@@ -69,6 +75,8 @@ size_t target_regs_size(target_s *t);
 const char *target_regs_description(target_s *t);
 void target_regs_read(target_s *t, void *data);
 void target_regs_write(target_s *t, const void *data);
+/* Read the registers of a thread an RTOS switched out from its saved context, false if unsupported */
+bool target_regs_unstack(target_s *t, void *data, target_addr_t stack, const uint32_t *callee_saved);
 ssize_t target_reg_read(target_s *t, int reg, void *data, size_t max);
 ssize_t target_reg_write(target_s *t, int reg, const void *data, size_t size);
 
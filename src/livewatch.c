@@ -0,0 +1,175 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements live memory watches: registered regions of target memory are sampled
+ * periodically from the background poll loop while the target runs, without halting it and
+ * without GDB being involved, and each sample is streamed out as a line of text
+ * "<index> <time_ms> <hex bytes>". Firmware sends these to the USB UART endpoint, BMDA to stdout.
+ *
+ * Regions due at the same poll tick that lie close together are fetched with a single block read.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "gdb_packet.h"
+#include "hex_utils.h"
+#include "livewatch.h"
+
+/* Largest span of target memory fetched in one read to service several nearby regions */
+#define LIVEWATCH_BLOCK_SIZE 128U
+
+typedef struct livewatch_entry {
+	target_addr_t addr;
+	uint8_t length; /* 0 for an unused entry */
+	uint32_t period_ms;
+	uint32_t next_ms;
+} livewatch_entry_s;
+
+static livewatch_entry_s livewatch_entries[LIVEWATCH_MAX_ENTRIES];
+/* Whether any entries are in use, so the poll loop has nothing to do in the normal case */
+static bool livewatch_active = false;
+
+static void livewatch_update_active(void)
+{
+	livewatch_active = false;
+	for (size_t i = 0; i < LIVEWATCH_MAX_ENTRIES; ++i)
+		livewatch_active |= livewatch_entries[i].length != 0;
+}
+
+bool livewatch_add(const target_addr_t addr, const size_t length, const uint32_t period_ms)
+{
+	if (length == 0 || length > LIVEWATCH_MAX_LENGTH)
+		return false;
+	for (size_t i = 0; i < LIVEWATCH_MAX_ENTRIES; ++i) {
+		livewatch_entry_s *const entry = &livewatch_entries[i];
+		if (entry->length)
+			continue;
+		entry->addr = addr;
+		entry->length = length;
+		entry->period_ms = period_ms;
+		entry->next_ms = platform_time_ms();
+		livewatch_active = true;
+		gdb_outf("Live watch %zu: 0x%08" PRIx32 ", %zu bytes every %" PRIu32 "ms\n", i, addr, length, period_ms);
+		return true;
+	}
+	return false;
+}
+
+bool livewatch_remove(const size_t index)
+{
+	if (index >= LIVEWATCH_MAX_ENTRIES || !livewatch_entries[index].length)
+		return false;
+	livewatch_entries[index].length = 0;
+	livewatch_update_active();
+	return true;
+}
+
+void livewatch_clear(void)
+{
+	memset(livewatch_entries, 0, sizeof(livewatch_entries));
+	livewatch_active = false;
+}
+
+void livewatch_list(void)
+{
+	for (size_t i = 0; i < LIVEWATCH_MAX_ENTRIES; ++i) {
+		const livewatch_entry_s *const entry = &livewatch_entries[i];
+		if (entry->length)
+			gdb_outf("%zu: 0x%08" PRIx32 ", %u bytes every %" PRIu32 "ms\n", i, entry->addr, entry->length,
+				entry->period_ms);
+	}
+}
+
+static void livewatch_emit(const size_t index, const uint32_t now, const uint8_t *const data, const size_t length)
+{
+	char line[32U + LIVEWATCH_MAX_LENGTH * 2U];
+	const int prefix = snprintf(line, sizeof(line), "%zu %" PRIu32 " ", index, now);
+	if (prefix < 0)
+		return;
+	if (data)
+		hexify(line + prefix, data, length);
+	else
+		snprintf(line + prefix, sizeof(line) - prefix, "error");
+	const size_t line_length = strlen(line);
+	line[line_length] = '\n';
+#if PC_HOSTED == 1
+	fwrite(line, 1, line_length + 1U, stdout);
+	fflush(stdout);
+#else
+	debug_serial_send_stdout((const uint8_t *)line, line_length + 1U);
+#endif
+}
+
+void poll_livewatch(target_s *const cur_target)
+{
+	if (!livewatch_active || !cur_target || target_mem_access_needs_halt(cur_target))
+		return;
+
+	/* Collect the entries that are due, in address order, so neighbours can share a read */
+	const uint32_t now = platform_time_ms();
+	uint8_t due[LIVEWATCH_MAX_ENTRIES];
+	size_t due_count = 0;
+	for (size_t i = 0; i < LIVEWATCH_MAX_ENTRIES; ++i) {
+		livewatch_entry_s *const entry = &livewatch_entries[i];
+		if (!entry->length || (int32_t)(now - entry->next_ms) < 0)
+			continue;
+		entry->next_ms = now + entry->period_ms;
+		size_t slot = due_count++;
+		for (; slot && livewatch_entries[due[slot - 1U]].addr > entry->addr; --slot)
+			due[slot] = due[slot - 1U];
+		due[slot] = i;
+	}
+
+	for (size_t first = 0; first < due_count;) {
+		/* Grow the block while the next region still fits in it */
+		const target_addr_t start = livewatch_entries[due[first]].addr;
+		target_addr_t end = start + livewatch_entries[due[first]].length;
+		size_t last = first + 1U;
+		for (; last < due_count; ++last) {
+			const livewatch_entry_s *const entry = &livewatch_entries[due[last]];
+			const target_addr_t entry_end = entry->addr + entry->length;
+			if (entry_end - start > LIVEWATCH_BLOCK_SIZE)
+				break;
+			if (entry_end > end)
+				end = entry_end;
+		}
+
+		uint8_t block[LIVEWATCH_BLOCK_SIZE];
+		const bool failed = target_mem_read(cur_target, block, start, end - start);
+		for (size_t i = first; i < last; ++i) {
+			const livewatch_entry_s *const entry = &livewatch_entries[due[i]];
+			livewatch_emit(due[i], now, failed ? NULL : block + (entry->addr - start), entry->length);
+		}
+		first = last;
+	}
+}
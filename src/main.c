@@ -28,35 +28,88 @@
 #include "gdb_packet.h"
 #include "morse.h"
 #include "command.h"
+#include "livewatch.h"
+#include "scheduler.h"
 #ifdef ENABLE_RTT
 #include "rtt.h"
 #endif
+#ifdef PLATFORM_HAS_REMOTE_BULK
+#include "remote_if.h"
+#endif
+
+static char pbuf[GDB_PACKET_BUFFER_SIZE + 1U];
+
+static void task_poll_target(void)
+{
+	if (gdb_target_running && cur_target)
+		gdb_poll_target();
+}
+
+#ifdef ENABLE_RTT
+static void task_poll_rtt(void)
+{
+	if (rtt_enabled && gdb_target_running && cur_target)
+		poll_rtt(cur_target);
+}
+#endif
 
-#define BUF_SIZE 1024U
-static char pbuf[BUF_SIZE + 1U];
+static void task_poll_livewatch(void)
+{
+	if (gdb_target_running && cur_target)
+		poll_livewatch(cur_target);
+}
+
+/*
+ * Polling the target can send GDB a stop reply, so that is only ever done
+ * from the main loop and never while part way through receiving a packet.
+ */
+static scheduler_task_s bmp_tasks[] = {
+	{.name = "target", .run = task_poll_target},
+#ifdef ENABLE_RTT
+	{.name = "rtt", .run = task_poll_rtt, .background = true, .budgeted = true},
+#endif
+	{.name = "livewatch", .run = task_poll_livewatch, .background = true, .budgeted = true},
+#ifdef PLATFORM_HAS_REMOTE_BULK
+	{.name = "remote", .run = remote_if_poll, .background = true},
+#endif
+};
+
+static void bmp_tasks_register(void)
+{
+	for (size_t i = 0; i < ARRAY_LENGTH(bmp_tasks); ++i)
+		scheduler_register(&bmp_tasks[i]);
+}
 
 static void bmp_poll_loop(void)
 {
 	SET_IDLE_STATE(false);
+	gdb_poll_restart();
 	while (gdb_target_running && cur_target) {
-		gdb_poll_target();
+		scheduler_run();
 
-		// Check again, as `gdb_poll_target()` may
+		// Check again, as polling the target may
 		// alter these variables.
 		if (!gdb_target_running || !cur_target)
 			break;
 		char c = gdb_if_getchar_to(0);
-		if (c == '\x03' || c == '\x04')
-			target_halt_request(cur_target);
+		if (c == '\x03' || c == '\x04') {
+			gdb_halt_target();
+			gdb_poll_restart();
+		} else if (c == '$' && gdb_non_stop) {
+			/* In non-stop mode GDB carries on sending packets while the target runs */
+			scheduler_yield_enable(true);
+			const size_t size = gdb_getpacket_started(pbuf, GDB_PACKET_BUFFER_SIZE);
+			scheduler_yield_enable(false);
+			gdb_main(pbuf, sizeof(pbuf), size);
+		}
 		platform_pace_poll();
-#ifdef ENABLE_RTT
-		if (rtt_enabled)
-			poll_rtt(cur_target);
-#endif
 	}
 
 	SET_IDLE_STATE(true);
-	size_t size = gdb_getpacket(pbuf, BUF_SIZE);
+	/* Background tasks only get a look in between packets, never part way through running a command */
+	scheduler_yield_enable(true);
+	size_t size = gdb_getpacket(pbuf, GDB_PACKET_BUFFER_SIZE);
+	scheduler_yield_enable(false);
 	// If port closed and target detached, stay idle
 	if (pbuf[0] != '\x04' || cur_target)
 		SET_IDLE_STATE(false);
@@ -72,6 +125,10 @@ int main(int argc, char **argv)
 	(void)argv;
 	platform_init();
 #endif
+	bmp_tasks_register();
+#ifdef PLATFORM_HAS_SETTINGS
+	command_boot_scan();
+#endif
 
 	while (true) {
 		volatile exception_s e;
@@ -85,6 +142,7 @@ int main(int argc, char **argv)
 			morse("TARGET LOST.", true);
 		}
 #if PC_HOSTED == 1
+		platform_probe_restore();
 		if (shutdown_bmda)
 			break;
 #endif
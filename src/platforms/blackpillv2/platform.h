@@ -31,6 +31,8 @@
 
 #define PLATFORM_HAS_TRACESWO
 #define PLATFORM_IDENT "(BlackPillV2) "
+
+#define GDB_PACKET_BUFFER_SIZE 4096U
 /*
  * Important pin mappings for STM32 implementation:
  *   * JTAG/SWD
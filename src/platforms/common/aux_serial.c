@@ -39,14 +39,14 @@
 
 static char aux_serial_receive_buffer[AUX_UART_BUFFER_SIZE];
 /* Fifo in pointer, writes assumed to be atomic, should be only incremented within RX ISR */
-static uint8_t aux_serial_receive_write_index = 0;
+static uint16_t aux_serial_receive_write_index = 0;
 /* Fifo out pointer, writes assumed to be atomic, should be only incremented outside RX ISR */
-static uint8_t aux_serial_receive_read_index = 0;
+static uint16_t aux_serial_receive_read_index = 0;
 
 #if defined(STM32F0) || defined(STM32F1) || defined(STM32F3) || defined(STM32F4) || defined(STM32F7)
 static char aux_serial_transmit_buffer[2U][AUX_UART_BUFFER_SIZE];
 static uint8_t aux_serial_transmit_buffer_index = 0;
-static uint8_t aux_serial_transmit_buffer_consumed = 0;
+static uint16_t aux_serial_transmit_buffer_consumed = 0;
 static bool aux_serial_transmit_complete = true;
 
 static volatile uint8_t aux_serial_led_state = 0;
@@ -210,12 +210,37 @@ void aux_serial_init(void)
 }
 #endif
 
+#if defined(STM32F4) || defined(STM32F7)
+static void aux_serial_set_baudrate(const uint32_t baud_rate)
+{
+	/* USART1 and USART6 are clocked from APB2, the others from APB1 */
+	const uint32_t clock = USBUSART == USART1 || USBUSART == USART6 ? rcc_apb2_frequency : rcc_apb1_frequency;
+	/*
+	 * 16x oversampling tops out at a sixteenth of the USART clock (2.625MBaud on a 42MHz APB1), so
+	 * for anything faster drop to 8x oversampling. BRR then takes the divider with its low nibble
+	 * shifted right by one, leaving BRR[3] clear.
+	 */
+	if (baud_rate > clock / 16U) {
+		const uint32_t divider = ((clock * 2U) + (baud_rate / 2U)) / baud_rate;
+		USART_CR1(USBUSART) |= USART_CR1_OVER8;
+		USART_BRR(USBUSART) = (divider & ~0xfU) | ((divider & 0xfU) >> 1U);
+	} else {
+		USART_CR1(USBUSART) &= ~USART_CR1_OVER8;
+		usart_set_baudrate(USBUSART, baud_rate);
+	}
+}
+#endif
+
 void aux_serial_set_encoding(usb_cdc_line_coding_s *coding)
 {
 	/* Some devices require that the usart is disabled before
 	 * changing the usart registers. */
 	usart_disable(USBUSART);
+#if defined(STM32F4) || defined(STM32F7)
+	aux_serial_set_baudrate(coding->dwDTERate);
+#else
 	usart_set_baudrate(USBUSART, coding->dwDTERate);
+#endif
 
 #if defined(STM32F0) || defined(STM32F1) || defined(STM32F3) || defined(STM32F4) || defined(STM32F7)
 	if (coding->bParityType)
@@ -519,7 +544,7 @@ void USBUART_ISR(void)
 
 		char packet_buf[CDCACM_PACKET_SIZE];
 		uint8_t packet_size = 0;
-		uint8_t buf_out = aux_serial_receive_read_index;
+		uint16_t buf_out = aux_serial_receive_read_index;
 
 		/* copy from uart FIFO into local usb packet buffer */
 		while (aux_serial_receive_write_index != buf_out && packet_size < CDCACM_PACKET_SIZE) {
@@ -27,7 +27,13 @@
 
 #if defined(STM32F0) || defined(STM32F1) || defined(STM32F3) || defined(STM32F4) || defined(STM32F7)
 /* XXX: Does the st_usbfs_v2_usb_driver work on F3 with 128 byte buffers? */
-#if defined(STM32F1) || defined(STM32F3) || defined(STM32F4) || defined(STM32F7)
+#if defined(STM32F4) || defined(STM32F7)
+/*
+ * These parts have RAM to spare, so give the RX DMA enough depth to ride out USB latency at
+ * multi-MBaud rates, and High-Speed probes room for two of their 512 byte bulk packets
+ */
+#define USART_DMA_BUF_SHIFT 10U
+#elif defined(STM32F1) || defined(STM32F3)
 #define USART_DMA_BUF_SHIFT 7U
 #elif defined(STM32F0)
 /* The st_usbfs_v2_usb_driver only works with up to 64-byte buffers on the F0 parts */
@@ -164,51 +164,61 @@ static void jtagtap_tdi_tdo_seq_swd_delay(
 	}
 	const size_t bit = (clock_cycles - 1U) & 7U;
 	const size_t byte = (clock_cycles - 1U) >> 3U;
-	if (bit)
+	if (bit != 7U)
 		data_out[byte] = value;
 }
 
-static inline void jtag_next_tms_tdi(const bool tms, const bool tdi)
+static inline bool jtagtap_tdi_tdo_bit_no_delay(const bool tdi)
 {
-	/* Initiate the falling edge on the bus */
+	/* Initiate the falling edge on the bus, it is then safe to change TDI */
 	gpio_clear(TCK_PORT, TCK_PIN);
-	/* It is now safe to change TMS and TDI */
-	gpio_set_val(TMS_PORT, TMS_PIN, tms);
 	gpio_set_val(TDI_PORT, TDI_PIN, tdi);
+	/* Block the compiler from re-ordering the calculations to preserve timings */
+	__asm__ volatile("" ::: "memory");
+	/* Start the clock cycle and sample TDO */
+	gpio_set(TCK_PORT, TCK_PIN);
+	return gpio_get(TDO_PORT, TDO_PIN) != 0;
 }
 
 static void jtagtap_tdi_tdo_seq_no_delay(
 	const uint8_t *const data_in, uint8_t *const data_out, const bool final_tms, const size_t clock_cycles)
 {
+	/*
+	 * TMS is held low for every cycle but the last, so shift whole bytes without touching it
+	 * and only deal with final_tms when clocking out the final byte
+	 */
+	const size_t last_cycle = clock_cycles - 1U;
+	const size_t last_byte = last_cycle >> 3U;
+	for (size_t byte = 0; byte < last_byte; ++byte) {
+		const uint8_t data = data_in[byte];
+		uint8_t value = 0;
+		for (uint8_t bit = 0; bit < 8U; ++bit) {
+			if (jtagtap_tdi_tdo_bit_no_delay(data & (1U << bit)))
+				value |= 1U << bit;
+		}
+		data_out[byte] = value;
+	}
+
+	const uint8_t data = data_in[last_byte];
+	const uint8_t final_bit = last_cycle & 7U;
 	uint8_t value = 0;
-	for (size_t cycle = 0; cycle < clock_cycles;) {
-		/* Calculate the next bit and byte to consume data from */
-		const uint8_t bit = cycle & 7U;
-		const size_t byte = cycle >> 3U;
-		/* Configure the bus for the next cycle */
-		jtag_next_tms_tdi(cycle + 1U >= clock_cycles && final_tms, data_in[byte] & (1U << bit));
-		/* Increment the cycle counter */
-		++cycle;
-		/* Block the compiler from re-ordering the calculations to preserve timings */
-		__asm__ volatile("" ::: "memory");
-		/* Start the clock cycle */
-		gpio_set(TCK_PORT, TCK_PIN);
-		/* If TDO is high, store a 1 in the appropriate position in the value being accumulated */
-		if (gpio_get(TDO_PORT, TDO_PIN))
+	for (uint8_t bit = 0; bit < final_bit; ++bit) {
+		if (jtagtap_tdi_tdo_bit_no_delay(data & (1U << bit)))
 			value |= 1U << bit;
-		/* If we've got the next whole byte, store the accumulated value and reset state */
-		if (bit == 7U) {
-			data_out[byte] = value;
-			value = 0;
-		}
-		/* Finish the clock cycle */
 	}
 	gpio_clear(TCK_PORT, TCK_PIN);
+	gpio_set_val(TMS_PORT, TMS_PIN, final_tms);
+	if (jtagtap_tdi_tdo_bit_no_delay(data & (1U << final_bit)))
+		value |= 1U << final_bit;
+	data_out[last_byte] = value;
+	gpio_clear(TCK_PORT, TCK_PIN);
 }
 
 static void jtagtap_tdi_tdo_seq(
 	uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, size_t clock_cycles)
 {
+	if (!clock_cycles)
+		return;
 	gpio_clear(TMS_PORT, TMS_PIN);
 	gpio_clear(TDI_PORT, TDI_PIN);
 	if (swd_delay_cnt)
@@ -236,19 +246,31 @@ static void jtagtap_tdi_seq_swd_delay(const uint8_t *const data_in, const bool f
 	}
 }
 
+static inline void jtagtap_tdi_bit_no_delay(const bool tdi)
+{
+	gpio_clear(TCK_PORT, TCK_PIN);
+	gpio_set_val(TDI_PORT, TDI_PIN, tdi);
+	gpio_set(TCK_PORT, TCK_PIN);
+}
+
 static void jtagtap_tdi_seq_no_delay(const uint8_t *const data_in, const bool final_tms, size_t clock_cycles)
 {
-	for (size_t cycle = 0; cycle < clock_cycles; ++cycle) {
-		gpio_clear(TCK_PORT, TCK_PIN);
-		const size_t bit = cycle & 7U;
-		const size_t byte = cycle >> 3U;
-		/* On the last tick, assert final_tms to TMS_PIN */
-		gpio_set_val(TMS_PORT, TMS_PIN, cycle + 1U >= clock_cycles && final_tms);
-		/* Set up the TDI pin and start the clock cycle */
-		gpio_set_val(TDI_PORT, TDI_PIN, data_in[byte] & (1U << bit));
-		gpio_set(TCK_PORT, TCK_PIN);
-		/* Finish the clock cycle */
+	/* As with jtagtap_tdi_tdo_seq_no_delay(), shift whole bytes and leave final_tms to the last cycle */
+	const size_t last_cycle = clock_cycles - 1U;
+	const size_t last_byte = last_cycle >> 3U;
+	for (size_t byte = 0; byte < last_byte; ++byte) {
+		const uint8_t data = data_in[byte];
+		for (uint8_t bit = 0; bit < 8U; ++bit)
+			jtagtap_tdi_bit_no_delay(data & (1U << bit));
 	}
+
+	const uint8_t data = data_in[last_byte];
+	const uint8_t final_bit = last_cycle & 7U;
+	for (uint8_t bit = 0; bit < final_bit; ++bit)
+		jtagtap_tdi_bit_no_delay(data & (1U << bit));
+	gpio_clear(TCK_PORT, TCK_PIN);
+	gpio_set_val(TMS_PORT, TMS_PIN, final_tms);
+	jtagtap_tdi_bit_no_delay(data & (1U << final_bit));
 	__asm__("nop");
 	__asm__("nop");
 	gpio_clear(TCK_PORT, TCK_PIN);
@@ -256,6 +278,8 @@ static void jtagtap_tdi_seq_no_delay(const uint8_t *const data_in, const bool fi
 
 static void jtagtap_tdi_seq(const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
 {
+	if (!clock_cycles)
+		return;
 	gpio_clear(TMS_PORT, TMS_PIN);
 	if (swd_delay_cnt)
 		jtagtap_tdi_seq_swd_delay(data_in, final_tms, clock_cycles);
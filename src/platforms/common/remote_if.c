@@ -0,0 +1,140 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements a vendor-specific bulk interface that carries the BMP
+ * remote protocol directly, so BMDA doesn't have to share the GDB CDC-ACM
+ * interface and its line discipline. Each OUT transfer carries one remote
+ * message which is accumulated by the USB interrupt and then handed to
+ * remote_packet_process() whole from the main loop. Responses go back out the
+ * IN endpoint; the host reads until it sees REMOTE_EOM.
+ */
+
+#include <string.h>
+
+#include "general.h"
+#include "remote.h"
+#include "remote_if.h"
+
+#define REMOTE_IF_BUFFER_SIZE 1024U
+
+static char remote_if_rx_buffer[REMOTE_IF_BUFFER_SIZE];
+static volatile size_t remote_if_rx_length;
+static volatile bool remote_if_rx_ready;
+
+static char remote_if_tx_buffer[REMOTE_ENDPOINT_SIZE];
+static size_t remote_if_tx_count;
+
+static bool remote_if_active;
+
+static void remote_if_out_cb(usbd_device *const dev, const uint8_t ep)
+{
+	(void)ep;
+	/* If the message can't possibly fit, drop what we have and resynchronise on the next start of message */
+	if (REMOTE_IF_BUFFER_SIZE - remote_if_rx_length < REMOTE_ENDPOINT_SIZE)
+		remote_if_rx_length = 0;
+	char *const packet = remote_if_rx_buffer + remote_if_rx_length;
+	const uint16_t count = usbd_ep_read_packet(dev, REMOTE_ENDPOINT, packet, REMOTE_ENDPOINT_SIZE);
+	remote_if_rx_length += count;
+	/*
+	 * The message is complete once its end of message marker arrives or the host ends the transfer
+	 * with a short packet. Hold the host off until the main loop has dealt with it.
+	 */
+	if (memchr(packet, REMOTE_EOM, count) || count < REMOTE_ENDPOINT_SIZE) {
+		remote_if_rx_ready = true;
+		usbd_ep_nak_set(dev, REMOTE_ENDPOINT, 1);
+	}
+}
+
+void remote_if_set_config(usbd_device *const dev, const uint16_t value)
+{
+	(void)value;
+	remote_if_rx_length = 0;
+	remote_if_rx_ready = false;
+	remote_if_tx_count = 0;
+
+	usbd_ep_setup(dev, REMOTE_ENDPOINT, USB_ENDPOINT_ATTR_BULK, REMOTE_ENDPOINT_SIZE, remote_if_out_cb);
+	usbd_ep_setup(dev, REMOTE_ENDPOINT | USB_REQ_TYPE_IN, USB_ENDPOINT_ATTR_BULK, REMOTE_ENDPOINT_SIZE, NULL);
+}
+
+void remote_if_poll(void)
+{
+	if (!remote_if_rx_ready)
+		return;
+
+	/* Unescape the message in place - the decoded form is never longer than what was received */
+	size_t length = 0;
+	bool in_message = false;
+	for (size_t offset = 0; offset < remote_if_rx_length; ++offset) {
+		const char value = remote_if_rx_buffer[offset];
+		if (value == REMOTE_SOM) {
+			/* Start, or restart, of a message */
+			in_message = true;
+			length = 0;
+		} else if (!in_message)
+			continue;
+		else if (value == REMOTE_EOM) {
+			remote_if_rx_buffer[length] = '\0';
+			remote_if_active = true;
+			remote_packet_process(length, remote_if_rx_buffer);
+			remote_if_active = false;
+			break;
+		} else if (value == REMOTE_ESCAPE) {
+			if (++offset < remote_if_rx_length)
+				remote_if_rx_buffer[length++] = (char)(remote_if_rx_buffer[offset] ^ REMOTE_ESCAPE_XOR);
+		} else
+			remote_if_rx_buffer[length++] = value;
+	}
+
+	/* The endpoint is NAKing, so the interrupt can't touch the buffer until we release it here */
+	remote_if_rx_length = 0;
+	remote_if_rx_ready = false;
+	usbd_ep_nak_set(usbdev, REMOTE_ENDPOINT, 0);
+}
+
+bool remote_if_processing(void)
+{
+	return remote_if_active;
+}
+
+void remote_if_putchar(const char c, const int flush)
+{
+	remote_if_tx_buffer[remote_if_tx_count++] = c;
+	if (!flush && remote_if_tx_count != REMOTE_ENDPOINT_SIZE)
+		return;
+	/* Refuse to send if USB isn't configured */
+	if (usb_get_config() == 1) {
+		while (usbd_ep_write_packet(usbdev, REMOTE_ENDPOINT, remote_if_tx_buffer, remote_if_tx_count) <= 0)
+			continue;
+	}
+	remote_if_tx_count = 0;
+}
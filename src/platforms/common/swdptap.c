@@ -173,6 +173,13 @@ static void swdptap_seq_out_no_delay(const uint32_t tms_states, const size_t clo
 static void swdptap_seq_out(const uint32_t tms_states, const size_t clock_cycles)
 {
 	swdptap_turnaround(SWDIO_STATUS_DRIVE);
+#ifdef PLATFORM_HAS_SWD_SPI
+	/* Hand whole request and data phases to the SPI peripheral when running at full speed */
+	if (!swd_delay_cnt && (clock_cycles == 8U || clock_cycles == 32U)) {
+		swd_spi_seq_out(tms_states, clock_cycles);
+		return;
+	}
+#endif
 	if (swd_delay_cnt)
 		swdptap_seq_out_swd_delay(tms_states, clock_cycles);
 	else
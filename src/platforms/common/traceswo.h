@@ -27,6 +27,8 @@
 /* Default line rate, used as default for a request without baudrate */
 #define SWO_DEFAULT_BAUD 2250000U
 void traceswo_init(uint32_t baudrate, uint32_t swo_chan_bitmask);
+/* Measure the line rate of the trace the target is sending, returns 0 if none could be seen */
+uint32_t traceswo_detect_baudrate(void);
 #else
 void traceswo_init(uint32_t swo_chan_bitmask);
 #endif
@@ -28,11 +28,13 @@ extern usbd_device *usbdev;
 extern uint16_t usb_config;
 
 #if defined(USB_HS)
-#define CDCACM_PACKET_SIZE  512U
-#define TRACE_ENDPOINT_SIZE 512U
+#define CDCACM_PACKET_SIZE          512U
+#define TRACE_ENDPOINT_SIZE         512U
+#define CDCACM_UART_OUT_PACKET_SIZE CDCACM_PACKET_SIZE
 #else
-#define CDCACM_PACKET_SIZE  64U
-#define TRACE_ENDPOINT_SIZE 64U
+#define CDCACM_PACKET_SIZE          64U
+#define TRACE_ENDPOINT_SIZE         64U
+#define CDCACM_UART_OUT_PACKET_SIZE (CDCACM_PACKET_SIZE / 2U)
 #endif
 
 #if !defined(USB_MAX_INTERVAL)
@@ -42,15 +44,28 @@ extern uint16_t usb_config;
 #define CDCACM_GDB_ENDPOINT  1U
 #define CDCACM_UART_ENDPOINT 3U
 #define TRACE_ENDPOINT       5U
+#define REMOTE_ENDPOINT      6U
+
+#if defined(USB_HS)
+#define REMOTE_ENDPOINT_SIZE 512U
+#else
+/* Kept small so the remote interface still fits the 512 byte packet memory of the F1 alongside everything else */
+#define REMOTE_ENDPOINT_SIZE 32U
+#endif
 
 #define GDB_IF_NO  0U
 #define UART_IF_NO 2U
 #define DFU_IF_NO  4U
 #ifdef PLATFORM_HAS_TRACESWO
-#define TRACE_IF_NO      5U
-#define TOTAL_INTERFACES 6U
+#define TRACE_IF_NO  5U
+#define REMOTE_IF_NO 6U
+#else
+#define REMOTE_IF_NO 5U
+#endif
+#ifdef PLATFORM_HAS_REMOTE_BULK
+#define TOTAL_INTERFACES (REMOTE_IF_NO + 1U)
 #else
-#define TOTAL_INTERFACES 5U
+#define TOTAL_INTERFACES REMOTE_IF_NO
 #endif
 
 void blackmagic_usb_init(void);
@@ -187,11 +187,7 @@ static const usb_endpoint_descriptor_s uart_data_endp[] = {
 		.bDescriptorType = USB_DT_ENDPOINT,
 		.bEndpointAddress = CDCACM_UART_ENDPOINT,
 		.bmAttributes = USB_ENDPOINT_ATTR_BULK,
-#if defined(USB_HS)
-		.wMaxPacketSize = CDCACM_PACKET_SIZE,
-#else
-		.wMaxPacketSize = CDCACM_PACKET_SIZE / 2U,
-#endif
+		.wMaxPacketSize = CDCACM_UART_OUT_PACKET_SIZE,
 		.bInterval = 1,
 	},
 	{
@@ -359,6 +355,60 @@ static const usb_iface_assoc_descriptor_s trace_assoc = {
 };
 #endif
 
+/* Remote protocol interface */
+
+#ifdef PLATFORM_HAS_REMOTE_BULK
+#ifdef PLATFORM_HAS_TRACESWO
+#define REMOTE_IF_STRING 8U
+#else
+#define REMOTE_IF_STRING 7U
+#endif
+
+static const usb_endpoint_descriptor_s remote_endp[] = {
+	{
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bEndpointAddress = REMOTE_ENDPOINT,
+		.bmAttributes = USB_ENDPOINT_ATTR_BULK,
+		.wMaxPacketSize = REMOTE_ENDPOINT_SIZE,
+		.bInterval = 0,
+	},
+	{
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bEndpointAddress = REMOTE_ENDPOINT | USB_REQ_TYPE_IN,
+		.bmAttributes = USB_ENDPOINT_ATTR_BULK,
+		.wMaxPacketSize = REMOTE_ENDPOINT_SIZE,
+		.bInterval = 0,
+	},
+};
+
+static const usb_interface_descriptor_s remote_iface = {
+	.bLength = USB_DT_INTERFACE_SIZE,
+	.bDescriptorType = USB_DT_INTERFACE,
+	.bInterfaceNumber = REMOTE_IF_NO,
+	.bAlternateSetting = 0,
+	.bNumEndpoints = 2,
+	.bInterfaceClass = 0xff,
+	.bInterfaceSubClass = 0xff,
+	.bInterfaceProtocol = 0x01,
+	.iInterface = REMOTE_IF_STRING,
+
+	.endpoint = remote_endp,
+};
+
+static const usb_iface_assoc_descriptor_s remote_assoc = {
+	.bLength = USB_DT_INTERFACE_ASSOCIATION_SIZE,
+	.bDescriptorType = USB_DT_INTERFACE_ASSOCIATION,
+	.bFirstInterface = REMOTE_IF_NO,
+	.bInterfaceCount = 1,
+	.bFunctionClass = 0xff,
+	.bFunctionSubClass = 0xff,
+	.bFunctionProtocol = 0x01,
+	.iFunction = REMOTE_IF_STRING,
+};
+#endif
+
 /* Interface and configuration descriptors */
 
 static const usb_interface_s ifaces[] = {
@@ -392,6 +442,13 @@ static const usb_interface_s ifaces[] = {
 		.altsetting = &trace_iface,
 	},
 #endif
+#if defined(PLATFORM_HAS_REMOTE_BULK)
+	{
+		.num_altsetting = 1,
+		.iface_assoc = &remote_assoc,
+		.altsetting = &remote_iface,
+	},
+#endif
 };
 
 static const usb_config_descriptor_s config = {
@@ -417,6 +474,9 @@ static const char *const usb_strings[] = {
 #if defined(PLATFORM_HAS_TRACESWO)
 	"Black Magic Trace Capture",
 #endif
+#if defined(PLATFORM_HAS_REMOTE_BULK)
+	"Black Magic Remote Protocol",
+#endif
 };
 
 #endif /* PLATFORMS_COMMON_USB_DESCRIPTORS_H */
@@ -80,8 +80,8 @@ static bool debug_serial_send_complete = true;
 void initialise_monitor_handles(void);
 
 static char debug_serial_debug_buffer[AUX_UART_BUFFER_SIZE];
-static uint8_t debug_serial_debug_write_index;
-static uint8_t debug_serial_debug_read_index;
+static uint16_t debug_serial_debug_write_index;
+static uint16_t debug_serial_debug_read_index;
 #endif
 
 static usbd_request_return_codes_e gdb_serial_control_request(usbd_device *dev, usb_setup_data_s *req, uint8_t **buf,
@@ -159,18 +159,14 @@ void usb_serial_set_config(usbd_device *dev, uint16_t value)
 {
 	usb_config = value;
 
-	/* GDB interface */
-#if defined(STM32F4) || defined(LM4F) || defined(STM32F7)
+	/* GDB interface, received packets are queued up by the OUT callback */
 	usbd_ep_setup(dev, CDCACM_GDB_ENDPOINT, USB_ENDPOINT_ATTR_BULK, CDCACM_PACKET_SIZE, gdb_usb_out_cb);
-#else
-	usbd_ep_setup(dev, CDCACM_GDB_ENDPOINT, USB_ENDPOINT_ATTR_BULK, CDCACM_PACKET_SIZE, NULL);
-#endif
 	usbd_ep_setup(dev, CDCACM_GDB_ENDPOINT | USB_REQ_TYPE_IN, USB_ENDPOINT_ATTR_BULK, CDCACM_PACKET_SIZE, NULL);
 	usbd_ep_setup(dev, (CDCACM_GDB_ENDPOINT + 1U) | USB_REQ_TYPE_IN, USB_ENDPOINT_ATTR_INTERRUPT, 16, NULL);
 
 	/* Serial interface */
-	usbd_ep_setup(
-		dev, CDCACM_UART_ENDPOINT, USB_ENDPOINT_ATTR_BULK, CDCACM_PACKET_SIZE / 2U, debug_serial_receive_callback);
+	usbd_ep_setup(dev, CDCACM_UART_ENDPOINT, USB_ENDPOINT_ATTR_BULK, CDCACM_UART_OUT_PACKET_SIZE,
+		debug_serial_receive_callback);
 	usbd_ep_setup(dev, CDCACM_UART_ENDPOINT | USB_REQ_TYPE_IN, USB_ENDPOINT_ATTR_BULK, CDCACM_PACKET_SIZE,
 		debug_serial_send_callback);
 	usbd_ep_setup(dev, (CDCACM_UART_ENDPOINT + 1U) | USB_REQ_TYPE_IN, USB_ENDPOINT_ATTR_INTERRUPT, 16, NULL);
@@ -210,17 +206,15 @@ void debug_serial_send_stdout(const uint8_t *const data, const size_t len)
 uint32_t debug_serial_fifo_send(const char *const fifo, const uint32_t fifo_begin, const uint32_t fifo_end)
 {
 	/*
+	 * Submit straight out of the FIFO rather than copying into a bounce buffer first. If the data
+	 * wraps, only send up to the end of the FIFO; the remainder goes out in the next packet.
 	 * To avoid the need of sending ZLP don't transmit full packet.
-	 * Also reserve space for copy function overrun.
 	 */
-	char packet[CDCACM_PACKET_SIZE - 1U];
-	uint32_t packet_len = 0;
-	for (uint32_t fifo_index = fifo_begin; fifo_index != fifo_end && packet_len < CDCACM_PACKET_SIZE - 1U;
-		 fifo_index %= AUX_UART_BUFFER_SIZE)
-		packet[packet_len++] = fifo[fifo_index++];
+	const uint32_t contiguous = (fifo_end >= fifo_begin ? fifo_end : AUX_UART_BUFFER_SIZE) - fifo_begin;
+	const uint32_t packet_len = MIN(contiguous, CDCACM_PACKET_SIZE - 1U);
 
 	if (packet_len) {
-		const uint16_t written = usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, packet, packet_len);
+		const uint16_t written = usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, fifo + fifo_begin, packet_len);
 		return (fifo_begin + written) % AUX_UART_BUFFER_SIZE;
 	}
 	return fifo_begin;
@@ -297,7 +291,7 @@ static void debug_serial_receive_callback(usbd_device *dev, uint8_t ep)
 #endif
 
 	char *const transmit_buffer = aux_serial_current_transmit_buffer() + aux_serial_transmit_buffer_fullness();
-	const uint16_t len = usbd_ep_read_packet(dev, ep, transmit_buffer, CDCACM_PACKET_SIZE);
+	const uint16_t len = usbd_ep_read_packet(dev, ep, transmit_buffer, CDCACM_UART_OUT_PACKET_SIZE);
 
 #if defined(BLACKMAGIC)
 	/* Don't bother if uart is disabled.
@@ -311,7 +305,7 @@ static void debug_serial_receive_callback(usbd_device *dev, uint8_t ep)
 
 #if defined(STM32F0) || defined(STM32F1) || defined(STM32F3) || defined(STM32F4) || defined(STM32F7)
 	/* Disable USBUART TX packet reception if buffer does not have enough space */
-	if (AUX_UART_BUFFER_SIZE - aux_serial_transmit_buffer_fullness() < CDCACM_PACKET_SIZE)
+	if (AUX_UART_BUFFER_SIZE - aux_serial_transmit_buffer_fullness() < CDCACM_UART_OUT_PACKET_SIZE)
 		usbd_ep_nak_set(dev, ep, 1);
 #endif
 }
@@ -0,0 +1,429 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements BMDA's benchmark mode (-B, --bench). It measures the sustained RAM and
+ * Flash read rates and RAM write rate, the latency of single word memory accesses, register
+ * reads, halt/resume and single steps and, if asked to, the Flash erase and program rates.
+ * Running it with each kind of probe (BMP, CMSIS-DAP, ST-Link, FTDI, J-Link) on the same target
+ * shows which suits that target best, and comparing runs between releases catches regressions.
+ * Run against the SWD simulator (-d sim:), each result also gives the SWD clock cycles, register
+ * accesses and round trips per operation, which don't depend on the machine it's run on. Built with
+ * ENABLE_PROBE_STATS, the same is given for real probes from the instrumentation counters, and built
+ * with BMDA_BENCH_REPORT (as `make bench` does) each result is also written out as a line of JSON
+ * for tracking performance between releases and driver changes.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "bmp_hosted.h"
+#include "bench.h"
+#include "swd_sim.h"
+#include "probe_stats.h"
+#include "bmp_remote.h"
+#include "crc32.h"
+
+#include <ctype.h>
+
+/* Every measurement repeats its operation for at least this long */
+#define BENCH_DURATION_MS 500U
+/* Largest block moved at once by the throughput measurements */
+#define BENCH_BLOCK_SIZE 16384U
+
+typedef bool (*bench_op_f)(target_s *t, void *context);
+
+typedef struct bench_block {
+	target_addr_t addr;
+	uint8_t *data;
+	size_t length;
+} bench_block_s;
+
+/* Link and wire traffic counts, for whichever of them the probe in use can give */
+typedef struct bench_counters {
+	bool has_clocks;
+	bool has_round_trips;
+	bool has_transactions;
+	uint64_t clocks;
+	uint64_t round_trips;
+	uint64_t transactions;
+} bench_counters_s;
+
+/*
+ * Read the counters, at the start of a measurement if begin is set. Fetching the firmware's own counts
+ * from a BMP is itself a round trip, so that's done outside the span of the link counts being taken.
+ */
+static void bench_counters_get(bench_counters_s *const counters, const bool begin)
+{
+	memset(counters, 0, sizeof(*counters));
+	if (info.bmp_type == BMP_TYPE_SIM) {
+		swd_sim_stats_s stats;
+		swd_sim_stats_get(&stats);
+		counters->has_clocks = true;
+		counters->has_round_trips = true;
+		counters->has_transactions = true;
+		counters->clocks = stats.clocks;
+		counters->round_trips = stats.round_trips;
+		counters->transactions = stats.transactions;
+		return;
+	}
+#if defined(ENABLE_PROBE_STATS)
+	/* A BMP in high level mode does the SWD accesses itself, firmware built with the counters can say how many */
+	probe_stats_s remote_stats = {0};
+	bool remote = false;
+	if (begin && info.bmp_type == BMP_TYPE_BMP)
+		remote = remote_probe_stats(&remote_stats);
+	counters->has_round_trips = true;
+	counters->round_trips = probe_stats.usb_packets_received;
+	counters->has_transactions = true;
+	counters->transactions = probe_stats.swd_accesses;
+	if (!begin && info.bmp_type == BMP_TYPE_BMP)
+		remote = remote_probe_stats(&remote_stats);
+	if (remote)
+		counters->transactions += remote_stats.swd_accesses;
+#else
+	(void)begin;
+#endif
+}
+
+/* Turn the counters at the start of a measurement into the traffic since then */
+static void bench_counters_since(bench_counters_s *const counters)
+{
+	bench_counters_s now;
+	bench_counters_get(&now, false);
+	counters->clocks = now.clocks - counters->clocks;
+	counters->round_trips = now.round_trips - counters->round_trips;
+	counters->transactions = now.transactions - counters->transactions;
+	/*
+	 * SWD accesses are only counted on the host where it drives the wire itself, and the adaptor
+	 * does them for CMSIS-DAP, ST-Link and J-Link, so an operation seeming to need none isn't known
+	 */
+	if (!counters->transactions && !counters->has_clocks)
+		counters->has_transactions = false;
+}
+
+#if defined(BMDA_BENCH_REPORT)
+/* Write a result out as one line of JSON, its phase being the result name in lower snake case */
+static void bench_report_json(const char *const name, const double value, const char *const unit,
+	const size_t count, const uint32_t elapsed_ms, const bench_counters_s *const counters)
+{
+	char phase[32];
+	size_t length = 0;
+	for (const char *c = name; *c && length < sizeof(phase) - 1U; ++c) {
+		if (isalnum((unsigned char)*c))
+			phase[length++] = (char)tolower((unsigned char)*c);
+		else if (length && phase[length - 1U] != '_')
+			phase[length++] = '_';
+	}
+	while (length && phase[length - 1U] == '_')
+		--length;
+	phase[length] = '\0';
+
+	printf("{\"phase\": \"%s\", \"value\": %.1f, \"unit\": \"%s\", \"operations\": %zu, \"elapsed_ms\": %" PRIu32,
+		phase, value, unit, count, elapsed_ms);
+	if (counters->has_round_trips)
+		printf(", \"round_trips\": %" PRIu64, counters->round_trips);
+	else
+		printf(", \"round_trips\": null");
+	if (counters->has_transactions)
+		printf(", \"swd_transactions\": %" PRIu64, counters->transactions);
+	else
+		printf(", \"swd_transactions\": null");
+	if (counters->has_clocks)
+		printf(", \"swd_clocks\": %" PRIu64, counters->clocks);
+	printf("}\n");
+	fflush(stdout);
+}
+#endif
+
+/* Print a result along with the traffic per operation, given the counters from the start of its measurement */
+static void bench_report(const char *const name, const double value, const char *const unit, const size_t count,
+	const uint32_t elapsed_ms, bench_counters_s *const counters)
+{
+	bench_counters_since(counters);
+	DEBUG_INFO("%-22s %10.1f %-5s", name, value, unit);
+	if (count && counters->has_clocks)
+		DEBUG_INFO("  %10.1f clocks", (double)counters->clocks / (double)count);
+	if (count && counters->has_transactions)
+		DEBUG_INFO(" %8.1f accesses", (double)counters->transactions / (double)count);
+	if (count && counters->has_round_trips)
+		DEBUG_INFO(" %8.1f round trips", (double)counters->round_trips / (double)count);
+	DEBUG_INFO("\n");
+#if defined(BMDA_BENCH_REPORT)
+	bench_report_json(name, value, unit, count, elapsed_ms, counters);
+#else
+	(void)elapsed_ms;
+#endif
+}
+
+/* Repeat an operation for the measurement period, returning how many times it ran and how long that took */
+static bool bench_repeat(target_s *const t, const bench_op_f op, void *const context, size_t *const count,
+	uint32_t *const elapsed_ms, bench_counters_s *const counters)
+{
+	*count = 0;
+	*elapsed_ms = 0;
+	bench_counters_get(counters, true);
+	const uint32_t start = platform_time_ms();
+	while (*elapsed_ms < BENCH_DURATION_MS) {
+		if (!op(t, context))
+			return false;
+		++*count;
+		*elapsed_ms = platform_time_ms() - start;
+	}
+	return true;
+}
+
+static double bench_rate(const size_t length, const uint32_t elapsed_ms)
+{
+	return ((double)length * 1000.0) / (1024.0 * MAX(elapsed_ms, 1U));
+}
+
+static bool bench_latency(target_s *const t, const char *const name, const bench_op_f op, void *const context)
+{
+	size_t count;
+	uint32_t elapsed_ms;
+	bench_counters_s counters;
+	if (!bench_repeat(t, op, context, &count, &elapsed_ms, &counters)) {
+		DEBUG_WARN("%s failed\n", name);
+		return false;
+	}
+	bench_report(name, (elapsed_ms * 1000.0) / (double)count, "us", count, elapsed_ms, &counters);
+	return true;
+}
+
+static bool bench_throughput(target_s *const t, const char *const name, const bench_op_f op, bench_block_s *const block)
+{
+	size_t count;
+	uint32_t elapsed_ms;
+	bench_counters_s counters;
+	if (!bench_repeat(t, op, block, &count, &elapsed_ms, &counters)) {
+		DEBUG_WARN("%s failed\n", name);
+		return false;
+	}
+	bench_report(name, bench_rate(count * block->length, elapsed_ms), "KiB/s", count, elapsed_ms, &counters);
+	return true;
+}
+
+static bool bench_mem_read(target_s *const t, void *const context)
+{
+	bench_block_s *const block = (bench_block_s *)context;
+	return target_mem_read(t, block->data, block->addr, block->length) == 0;
+}
+
+static bool bench_mem_write(target_s *const t, void *const context)
+{
+	bench_block_s *const block = (bench_block_s *)context;
+	return target_mem_write(t, block->addr, block->data, block->length) == 0;
+}
+
+static bool bench_mem_read32(target_s *const t, void *const context)
+{
+	const bench_block_s *const block = (const bench_block_s *)context;
+	target_mem_read32(t, block->addr);
+	return !target_check_error(t);
+}
+
+/* Wait for the target to stop again after a resume or step */
+static bool bench_wait_halt(target_s *const t)
+{
+	target_addr_t watch;
+	target_halt_reason_e reason = TARGET_HALT_RUNNING;
+	while (reason == TARGET_HALT_RUNNING)
+		reason = target_halt_poll(t, &watch);
+	return reason != TARGET_HALT_ERROR;
+}
+
+static bool bench_step(target_s *const t, void *const context)
+{
+	(void)context;
+	target_halt_resume(t, true);
+	return bench_wait_halt(t);
+}
+
+/* Stepping drops any register cache, so this shows what fetching the registers costs on top of a step */
+static bool bench_step_regs(target_s *const t, void *const context)
+{
+	if (!bench_step(t, NULL))
+		return false;
+	target_regs_read(t, context);
+	return !target_check_error(t);
+}
+
+static bool bench_halt_resume(target_s *const t, void *const context)
+{
+	(void)context;
+	target_halt_resume(t, false);
+	target_halt_request(t);
+	return bench_wait_halt(t);
+}
+
+static bool bench_data_access(target_s *const t, const target_ram_s *const ram, const target_flash_s *const flash)
+{
+	bool result = true;
+	uint8_t *const data = malloc(BENCH_BLOCK_SIZE);
+	if (!data) {
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	if (ram) {
+		bench_block_s block = {ram->start, data, MIN(ram->length, BENCH_BLOCK_SIZE)};
+		result &= bench_throughput(t, "RAM read", bench_mem_read, &block);
+		/* The read leaves the block holding what's in RAM already, so writing it back changes nothing */
+		if (result)
+			result &= bench_throughput(t, "RAM write", bench_mem_write, &block);
+		result &= bench_latency(t, "Word read", bench_mem_read32, &block);
+	}
+	if (flash) {
+		bench_block_s block = {flash->start, data, MIN(flash->length, BENCH_BLOCK_SIZE)};
+		result &= bench_throughput(t, "Flash read", bench_mem_read, &block);
+	}
+	free(data);
+	return result;
+}
+
+static bool bench_execution(target_s *const t)
+{
+	bool result = true;
+	void *const regs = calloc(1, target_regs_size(t));
+	if (!regs) {
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return false;
+	}
+	result &= bench_latency(t, "Halt/resume", bench_halt_resume, NULL);
+	result &= bench_latency(t, "Single step", bench_step, NULL);
+	result &= bench_latency(t, "Step + register read", bench_step_regs, regs);
+	free(regs);
+	return result;
+}
+
+/* The image phases run once each, as they take a while and erasing over and over wears the Flash */
+static bool bench_flash_erase(target_s *const t, void *const context)
+{
+	const bench_block_s *const block = (const bench_block_s *)context;
+	return target_flash_erase(t, block->addr, block->length) && target_flash_complete(t);
+}
+
+static bool bench_flash_write(target_s *const t, void *const context)
+{
+	const bench_block_s *const block = (const bench_block_s *)context;
+	return target_flash_write(t, block->addr, block->data, block->length) && target_flash_complete(t);
+}
+
+/* Check the image by CRC, which runs on the target where the driver can do so, as a Flash verify does */
+static bool bench_flash_verify(target_s *const t, void *const context)
+{
+	const bench_block_s *const block = (const bench_block_s *)context;
+	uint32_t crc = 0;
+	return generic_crc32(t, &crc, block->addr, block->length) &&
+		crc == generic_crc32_buffer(block->data, block->length);
+}
+
+/* Read the whole image back over the link and compare it */
+static bool bench_flash_read_back(target_s *const t, void *const context)
+{
+	const bench_block_s *const block = (const bench_block_s *)context;
+	uint8_t *const data = malloc(block->length);
+	if (!data) {
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	const bool result = target_mem_read(t, data, block->addr, block->length) == 0 &&
+		memcmp(data, block->data, block->length) == 0;
+	free(data);
+	return result;
+}
+
+static bool bench_once(target_s *const t, const char *const name, const bench_op_f op, bench_block_s *const block)
+{
+	bench_counters_s counters;
+	bench_counters_get(&counters, true);
+	const uint32_t start = platform_time_ms();
+	if (!op(t, block)) {
+		DEBUG_WARN("%s of %zu bytes at 0x%08" PRIx32 " failed\n", name, block->length, block->addr);
+		return false;
+	}
+	const uint32_t elapsed_ms = platform_time_ms() - start;
+	bench_report(name, bench_rate(block->length, elapsed_ms), "KiB/s", 1U, elapsed_ms, &counters);
+	return true;
+}
+
+/* Take a reference image through a full erase, program, verify and read back cycle */
+static bool bench_flash_image(target_s *const t, const target_addr_t addr, const size_t length)
+{
+	uint8_t *const data = malloc(length);
+	if (!data) {
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	/* The same image every time, so runs can be compared */
+	for (size_t i = 0; i < length; ++i)
+		data[i] = (uint8_t)(i * 0x9dU);
+
+	bench_block_s block = {addr, data, length};
+	bool result = bench_once(t, "Flash erase", bench_flash_erase, &block);
+	if (result) {
+		result = bench_once(t, "Flash program", bench_flash_write, &block) &&
+			bench_once(t, "Flash verify", bench_flash_verify, &block) &&
+			bench_once(t, "Flash read back", bench_flash_read_back, &block);
+		/* Leave the range blank again rather than holding our test pattern */
+		result &= bench_flash_erase(t, &block);
+	}
+	free(data);
+	return result;
+}
+
+bool bench_run(target_s *const t, const target_addr_t flash_addr, const size_t flash_length)
+{
+	/* Use the lowest RAM and Flash regions, which are the ones most targets run from */
+	const target_ram_s *ram = NULL;
+	for (const target_ram_s *r = t->ram; r; r = r->next) {
+		if (!ram || r->start < ram->start)
+			ram = r;
+	}
+	const target_flash_s *flash = NULL;
+	for (const target_flash_s *f = t->flash; f; f = f->next) {
+		if (!flash || f->start < flash->start)
+			flash = f;
+	}
+
+	DEBUG_INFO("Benchmarking %s with %s (%s)", target_driver_name(t), info.product, info.version);
+	const uint32_t frequency = platform_max_frequency_get();
+	if (frequency != FREQ_FIXED)
+		DEBUG_INFO(" at %" PRIu32 " kHz", frequency / 1000U);
+	DEBUG_INFO("\n");
+
+	bool result = bench_data_access(t, ram, flash);
+	result &= bench_execution(t);
+	if (flash_length)
+		result &= bench_flash_image(t, flash_addr, flash_length);
+	return result;
+}
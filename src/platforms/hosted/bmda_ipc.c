@@ -0,0 +1,306 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements BMDA's local IPC interface, which gives other processes on the same machine
+ * direct access to target memory, registers and run control without going through GDB's RSP and its
+ * hex encoded memory transfers.
+ *
+ * A thread accepts clients on a UNIX socket and serves one at a time. Each client gets its own
+ * shared memory buffer, created and unlinked straight away so it only lives as long as the mappings,
+ * and the file descriptor for it is passed over the socket with the hello response. Every request
+ * runs with target access taken from the main thread (see gdb_if_target_access_acquire()), so it
+ * operates on the target GDB has attached, between GDB's own packets.
+ */
+
+#include "general.h"
+#include "bmda_ipc.h"
+#include "gdb_if.h"
+#include "gdb_main.h"
+#include "target.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+typedef struct sockaddr_un sockaddr_un_s;
+typedef struct msghdr msghdr_s;
+typedef struct cmsghdr cmsghdr_s;
+typedef struct iovec iovec_s;
+
+static int bmda_ipc_server = -1;
+static char bmda_ipc_path[sizeof(((sockaddr_un_s *)NULL)->sun_path)];
+static pthread_t bmda_ipc_thread;
+
+/* Transfer a whole structure over the socket, returning false if the other end has gone away */
+static bool bmda_ipc_recv(const int client, void *const data, const size_t length)
+{
+	uint8_t *const buffer = (uint8_t *)data;
+	for (size_t offset = 0; offset < length;) {
+		const ssize_t result = read(client, buffer + offset, length - offset);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			return false;
+		offset += (size_t)result;
+	}
+	return true;
+}
+
+static bool bmda_ipc_send(const int client, const void *const data, const size_t length)
+{
+	const uint8_t *const buffer = (const uint8_t *)data;
+	for (size_t offset = 0; offset < length;) {
+		const ssize_t result = write(client, buffer + offset, length - offset);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			return false;
+		offset += (size_t)result;
+	}
+	return true;
+}
+
+/* Send the hello response with the shared buffer's file descriptor attached */
+static bool bmda_ipc_send_hello(const int client, const int buffer_fd)
+{
+	bmda_ipc_response_s response = {
+		.status = BMDA_IPC_OK,
+		.length = BMDA_IPC_BUFFER_SIZE,
+		.value = BMDA_IPC_VERSION,
+	};
+	iovec_s iov = {.iov_base = &response, .iov_len = sizeof(response)};
+	union {
+		cmsghdr_s header;
+		uint8_t space[CMSG_SPACE(sizeof(int))];
+	} control = {};
+	msghdr_s message = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.space,
+		.msg_controllen = sizeof(control.space),
+	};
+	cmsghdr_s *const header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(header), &buffer_fd, sizeof(int));
+
+	ssize_t result;
+	do
+		result = sendmsg(client, &message, 0);
+	while (result < 0 && errno == EINTR);
+	/* Control data only goes with the first byte, so any remainder can be sent as normal */
+	return result > 0 && bmda_ipc_send(client, (const uint8_t *)&response + result, sizeof(response) - (size_t)result);
+}
+
+/* Create a shared buffer with no name left behind, returning its descriptor or -1 */
+static int bmda_ipc_buffer_create(void)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/bmda-ipc-%ld", (long)getpid());
+	const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		DEBUG_WARN("Failed to create the IPC shared buffer: %s\n", strerror(errno));
+		return -1;
+	}
+	shm_unlink(name);
+	if (ftruncate(fd, BMDA_IPC_BUFFER_SIZE) == -1) {
+		DEBUG_WARN("Failed to size the IPC shared buffer: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Carry out one request on the attached target, with target access held */
+static void bmda_ipc_execute(
+	const bmda_ipc_request_s *const request, bmda_ipc_response_s *const response, uint8_t *const buffer)
+{
+	target_s *const target = cur_target;
+	if (request->command == BMDA_IPC_HELLO) {
+		response->length = BMDA_IPC_BUFFER_SIZE;
+		response->value = BMDA_IPC_VERSION;
+		return;
+	}
+	if (!target) {
+		response->status = BMDA_IPC_NO_TARGET;
+		return;
+	}
+	if (request->length > BMDA_IPC_BUFFER_SIZE || request->address > UINT32_MAX) {
+		response->status = BMDA_IPC_INVALID;
+		return;
+	}
+	const target_addr_t address = (target_addr_t)request->address;
+	const size_t length = (size_t)request->length;
+
+	switch (request->command) {
+	case BMDA_IPC_MEM_READ:
+		if (target_mem_read(target, buffer, address, length))
+			response->status = BMDA_IPC_FAULT;
+		else
+			response->length = length;
+		break;
+	case BMDA_IPC_MEM_WRITE:
+		if (target_mem_write(target, address, buffer, length))
+			response->status = BMDA_IPC_FAULT;
+		break;
+	case BMDA_IPC_REG_READ: {
+		const ssize_t size = target_reg_read(target, (int)request->reg, buffer, BMDA_IPC_BUFFER_SIZE);
+		if (size <= 0)
+			response->status = BMDA_IPC_FAULT;
+		else
+			response->length = (uint64_t)size;
+		break;
+	}
+	case BMDA_IPC_REG_WRITE:
+		if (target_reg_write(target, (int)request->reg, buffer, length) <= 0)
+			response->status = BMDA_IPC_FAULT;
+		break;
+	case BMDA_IPC_HALT_REQUEST:
+		target_halt_request(target);
+		break;
+	case BMDA_IPC_HALT_RESUME:
+		target_halt_resume(target, request->value != 0U);
+		break;
+	case BMDA_IPC_HALT_POLL: {
+		target_addr_t watch = 0;
+		response->value = target_halt_poll(target, &watch);
+		response->address = watch;
+		break;
+	}
+	default:
+		response->status = BMDA_IPC_INVALID;
+		break;
+	}
+}
+
+/* Serve requests from one connected client until it goes away */
+static void bmda_ipc_serve(const int client)
+{
+	const int buffer_fd = bmda_ipc_buffer_create();
+	if (buffer_fd == -1)
+		return;
+	uint8_t *const buffer = mmap(NULL, BMDA_IPC_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, buffer_fd, 0);
+	if (buffer == MAP_FAILED) {
+		DEBUG_WARN("Failed to map the IPC shared buffer: %s\n", strerror(errno));
+		close(buffer_fd);
+		return;
+	}
+
+	/* Once the client has the descriptor it holds its own reference, so ours can go */
+	const bool sent = bmda_ipc_send_hello(client, buffer_fd);
+	close(buffer_fd);
+	if (sent) {
+		bmda_ipc_request_s request;
+		while (bmda_ipc_recv(client, &request, sizeof(request))) {
+			bmda_ipc_response_s response = {.status = BMDA_IPC_OK};
+			gdb_if_target_access_acquire();
+			bmda_ipc_execute(&request, &response, buffer);
+			gdb_if_target_access_release();
+			if (!bmda_ipc_send(client, &response, sizeof(response)))
+				break;
+		}
+	}
+	munmap(buffer, BMDA_IPC_BUFFER_SIZE);
+}
+
+static void *bmda_ipc_worker(void *const arg)
+{
+	(void)arg;
+	while (true) {
+		const int client = accept(bmda_ipc_server, NULL, NULL);
+		if (client == -1) {
+			if (errno == EINTR)
+				continue;
+			/* The server socket being closed by bmda_ipc_exit() ends up here too */
+			break;
+		}
+		DEBUG_INFO("IPC client connected\n");
+		bmda_ipc_serve(client);
+		close(client);
+		DEBUG_INFO("IPC client disconnected\n");
+	}
+	return NULL;
+}
+
+int bmda_ipc_init(const char *const path)
+{
+	sockaddr_un_s addr = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		DEBUG_WARN("IPC socket path %s is too long\n", path);
+		return -1;
+	}
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1U);
+
+	bmda_ipc_server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (bmda_ipc_server == -1) {
+		DEBUG_WARN("Failed to create the IPC socket: %s\n", strerror(errno));
+		return -1;
+	}
+	/* A socket left behind by a previous run would stop the bind, so clear it out first */
+	unlink(path);
+	if (bind(bmda_ipc_server, (const struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+		listen(bmda_ipc_server, 1) == -1) {
+		DEBUG_WARN("Failed to listen on IPC socket %s: %s\n", path, strerror(errno));
+		close(bmda_ipc_server);
+		bmda_ipc_server = -1;
+		return -1;
+	}
+	strncpy(bmda_ipc_path, path, sizeof(bmda_ipc_path) - 1U);
+
+	/* Writes to a client that has just gone away must not take BMDA down with them */
+	signal(SIGPIPE, SIG_IGN);
+	if (pthread_create(&bmda_ipc_thread, NULL, bmda_ipc_worker, NULL)) {
+		DEBUG_WARN("Could not start the IPC server thread\n");
+		bmda_ipc_exit();
+		return -1;
+	}
+	DEBUG_WARN("Serving target access over IPC on %s\n", path);
+	return 0;
+}
+
+void bmda_ipc_exit(void)
+{
+	if (bmda_ipc_server == -1)
+		return;
+	shutdown(bmda_ipc_server, SHUT_RDWR);
+	close(bmda_ipc_server);
+	bmda_ipc_server = -1;
+	unlink(bmda_ipc_path);
+}
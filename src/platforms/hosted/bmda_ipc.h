@@ -0,0 +1,87 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PLATFORMS_HOSTED_BMDA_IPC_H
+#define PLATFORMS_HOSTED_BMDA_IPC_H
+
+#include <stdint.h>
+
+/*
+ * Local IPC interface to the target for other processes on the same machine. A client connects to
+ * the UNIX socket given to BMDA with -U, and is handed a shared memory buffer (as a file descriptor
+ * in SCM_RIGHTS ancillary data) along with the hello response. Requests and responses are the fixed
+ * size structures below in host byte order, with bulk data for memory and register accesses passing
+ * through the shared buffer rather than the socket.
+ */
+
+#define BMDA_IPC_VERSION     1U
+#define BMDA_IPC_BUFFER_SIZE (1024U * 1024U)
+
+typedef enum bmda_ipc_command {
+	BMDA_IPC_HELLO = 0,     /* Returns the version in value and the shared buffer size in length */
+	BMDA_IPC_MEM_READ,      /* Reads length bytes from address into the shared buffer */
+	BMDA_IPC_MEM_WRITE,     /* Writes length bytes from the shared buffer to address */
+	BMDA_IPC_REG_READ,      /* Reads register reg into the shared buffer, returning its size in length */
+	BMDA_IPC_REG_WRITE,     /* Writes length bytes from the shared buffer to register reg */
+	BMDA_IPC_HALT_REQUEST,  /* Asks the target to halt */
+	BMDA_IPC_HALT_RESUME,   /* Resumes the target, single stepping it if value is non-zero */
+	BMDA_IPC_HALT_POLL,     /* Returns the target_halt_reason_e in value and any watch address in address */
+} bmda_ipc_command_e;
+
+typedef enum bmda_ipc_status {
+	BMDA_IPC_OK = 0,
+	BMDA_IPC_NO_TARGET = -1, /* No target is attached */
+	BMDA_IPC_FAULT = -2,     /* The target access failed */
+	BMDA_IPC_INVALID = -3,   /* Unknown command or a length beyond the shared buffer */
+} bmda_ipc_status_e;
+
+typedef struct bmda_ipc_request {
+	uint32_t command;
+	uint32_t reg;
+	uint64_t address;
+	uint64_t length;
+	uint64_t value;
+} bmda_ipc_request_s;
+
+typedef struct bmda_ipc_response {
+	int32_t status;
+	uint32_t reserved;
+	uint64_t address;
+	uint64_t length;
+	uint64_t value;
+} bmda_ipc_response_s;
+
+/* Start serving the IPC interface on the given socket path, returning 0 on success */
+int bmda_ipc_init(const char *path);
+void bmda_ipc_exit(void);
+
+#endif /* PLATFORMS_HOSTED_BMDA_IPC_H */
@@ -44,6 +44,10 @@
 #if HOSTED_BMP_ONLY != 1
 #define TRANSFER_IS_DONE   (1U << 0U)
 #define TRANSFER_HAS_ERROR (1U << 1U)
+#define TRANSFER_NO_DEVICE (1U << 2U)
+
+/* Room for a USB bus/port path as BUS-PORT.PORT..., USB allows up to 7 tiers of ports */
+#define USB_PATH_LENGTH 32U
 
 typedef struct transfer_ctx {
 	volatile size_t flags;
@@ -68,6 +72,22 @@ typedef struct usb_link {
 	libusb_transfer_s *rep_trans;
 	void *priv;
 } usb_link_s;
+
+/* Number of bulk transfers a ring can keep in flight on its endpoint */
+#define USB_TRANSFER_RING_DEPTH 8U
+
+/*
+ * A ring of transfers on a single endpoint for keeping several requests or responses queued
+ * with the host controller. Transfers complete in submission order, so the oldest is waited on first.
+ */
+typedef struct usb_transfer_ring {
+	usb_link_s *link;
+	uint8_t endpoint;
+	libusb_transfer_s *transfers[USB_TRANSFER_RING_DEPTH];
+	transfer_ctx_s ctx[USB_TRANSFER_RING_DEPTH];
+	size_t head;
+	size_t count;
+} usb_transfer_ring_s;
 #endif
 
 typedef struct bmp_info {
@@ -84,9 +104,11 @@ typedef struct bmp_info {
 	usb_link_s *usb_link;
 	uint16_t vid;
 	uint16_t pid;
+	char path[USB_PATH_LENGTH];
 	uint8_t interface_num;
 	uint8_t in_ep;
 	uint8_t out_ep;
+	uint8_t swo_ep;
 #endif
 } bmp_info_s;
 
@@ -100,11 +122,19 @@ extern bmp_info_s info;
 void bmp_ident(bmp_info_s *info);
 int find_debuggers(bmda_cli_options_s *cl_opts, bmp_info_s *info);
 void libusb_exit_function(bmp_info_s *info);
+void bmp_probe_release(bmp_info_s *info);
+void bmp_probe_wait(const bmp_info_s *info);
 
 #if HOSTED_BMP_ONLY == 1
 bool device_is_bmp_gdb_port(const char *device);
 #else
 int send_recv(usb_link_s *link, uint8_t *txbuf, size_t txsize, uint8_t *rxbuf, size_t rxsize);
+bool usb_transfer_ring_init(usb_transfer_ring_s *ring, usb_link_s *link, uint8_t endpoint);
+void usb_transfer_ring_free(usb_transfer_ring_s *ring);
+int usb_transfer_ring_submit(usb_transfer_ring_s *ring, uint8_t *buffer, size_t length);
+int usb_transfer_ring_wait(usb_transfer_ring_s *ring);
+bool usb_transfer_ring_ready(usb_transfer_ring_s *ring);
+void usb_transfer_ring_cancel(usb_transfer_ring_s *ring);
 #endif
 
 #if defined(_WIN32) || defined(__CYGWIN__)
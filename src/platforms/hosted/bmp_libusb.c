@@ -22,9 +22,24 @@
 #include <libusb.h>
 #include "cli.h"
 #include "ftdi_bmp.h"
+#include "gdb_perf.h"
+#include "probe_stats.h"
 #include "version.h"
 
 #define NO_SERIAL_NUMBER "<no serial number>"
+/* How many of the probes found get listed when more than one matches */
+#define FIND_DEBUGGERS_MAX_LISTED 32U
+/* How long to wait on the hotplug notification of a probe coming back before looking for it again anyway */
+#define PROBE_ARRIVAL_TIMEOUT_MS 1000U
+/* How often to look for a probe coming back when libusb can't tell us about it */
+#define PROBE_POLL_INTERVAL_MS 250U
+
+typedef struct probe_listing {
+	char serial[64];
+	char manufacturer[128];
+	char product[128];
+	char path[USB_PATH_LENGTH];
+} probe_listing_s;
 
 void bmp_ident(bmp_info_s *info)
 {
@@ -49,6 +64,57 @@ void libusb_exit_function(bmp_info_s *info)
 	}
 }
 
+/* Let go of the probe's USB link and context, so find_debuggers() can start afresh in looking for it */
+void bmp_probe_release(bmp_info_s *const info)
+{
+	libusb_exit_function(info);
+	free(info->usb_link);
+	info->usb_link = NULL;
+	if (info->libusb_ctx) {
+		libusb_exit(info->libusb_ctx);
+		info->libusb_ctx = NULL;
+	}
+}
+
+static int LIBUSB_CALL probe_arrived(libusb_context *const ctx, libusb_device *const dev,
+	const libusb_hotplug_event event, void *const user_data)
+{
+	(void)ctx;
+	(void)dev;
+	(void)event;
+	*(bool *)user_data = true;
+	/* The one arrival is all that's being waited on, so have libusb deregister the callback */
+	return 1;
+}
+
+/*
+ * Wait for a device with the VID:PID of the probe given to turn up on the bus. With hotplug support
+ * this returns as soon as libusb sees one arrive, otherwise it just waits out a poll interval.
+ */
+void bmp_probe_wait(const bmp_info_s *const info)
+{
+	libusb_context *ctx = NULL;
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) || libusb_init(&ctx) != LIBUSB_SUCCESS) {
+		platform_delay(PROBE_POLL_INTERVAL_MS);
+		return;
+	}
+	bool arrived = false;
+	libusb_hotplug_callback_handle callback;
+	const int result = libusb_hotplug_register_callback(ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED,
+		LIBUSB_HOTPLUG_NO_FLAGS, info->vid, info->pid, LIBUSB_HOTPLUG_MATCH_ANY, probe_arrived, &arrived, &callback);
+	if (result != LIBUSB_SUCCESS)
+		platform_delay(PROBE_POLL_INTERVAL_MS);
+	else {
+		const uint32_t start = platform_time_ms();
+		while (!arrived && platform_time_ms() - start < PROBE_ARRIVAL_TIMEOUT_MS) {
+			timeval_s timeout = {.tv_sec = 0, .tv_usec = 100000};
+			libusb_handle_events_timeout_completed(ctx, &timeout, NULL);
+		}
+	}
+	/* This also takes care of the callback if it's still registered */
+	libusb_exit(ctx);
+}
+
 static bmp_type_t find_cmsis_dap_interface(libusb_device *dev, bmp_info_s *info)
 {
 	bmp_type_t type = BMP_TYPE_NONE;
@@ -87,15 +153,22 @@ static bmp_type_t find_cmsis_dap_interface(libusb_device *dev, bmp_info_s *info)
 			continue;
 		type = BMP_TYPE_CMSIS_DAP;
 
-		if (interface->bInterfaceClass == 0xffU && interface->bNumEndpoints == 2U) {
+		/* V2 interfaces have a bulk OUT and IN endpoint pair, optionally followed by an IN endpoint for SWO */
+		if (interface->bInterfaceClass == 0xffU &&
+			(interface->bNumEndpoints == 2U || interface->bNumEndpoints == 3U)) {
 			info->interface_num = interface->bInterfaceNumber;
+			info->in_ep = 0U;
+			info->out_ep = 0U;
+			info->swo_ep = 0U;
 
 			for (uint8_t j = 0; j < interface->bNumEndpoints; ++j) {
 				const uint8_t n = interface->endpoint[j].bEndpointAddress;
-				if (n & 0x80U)
+				if (!(n & 0x80U))
+					info->out_ep = n;
+				else if (!info->in_ep)
 					info->in_ep = n;
 				else
-					info->out_ep = n;
+					info->swo_ep = n;
 			}
 
 			/* V2 is preferred, return early. */
@@ -106,6 +179,16 @@ static bmp_type_t find_cmsis_dap_interface(libusb_device *dev, bmp_info_s *info)
 	return type;
 }
 
+/* Describe where the device is plugged in, as BUS-PORT.PORT... (the same way Linux names it in sysfs) */
+static void usb_device_path(libusb_device *const dev, char *const path, const size_t size)
+{
+	uint8_t ports[7];
+	const int depth = libusb_get_port_numbers(dev, ports, sizeof(ports));
+	size_t offset = (size_t)snprintf(path, size, "%u", libusb_get_bus_number(dev));
+	for (int i = 0; i < depth && offset < size; ++i)
+		offset += (size_t)snprintf(path + offset, size - offset, "%c%u", i ? '.' : '-', ports[i]);
+}
+
 int find_debuggers(bmda_cli_options_s *cl_opts, bmp_info_s *info)
 {
 	libusb_device **devs;
@@ -131,23 +214,25 @@ int find_debuggers(bmda_cli_options_s *cl_opts, bmp_info_s *info)
 		DEBUG_WARN("WARN:libusb_get_device_list() failed");
 		return -1;
 	}
-	bool report = false;
-	size_t found_debuggers;
+	/*
+	 * Opening a device and reading its string descriptors is the slow part of this, so each device is
+	 * only looked at once: the probes that match are remembered for listing should there be several
+	 */
+	probe_listing_s *const listing = calloc(FIND_DEBUGGERS_MAX_LISTED, sizeof(*listing));
+	if (!listing) {
+		DEBUG_WARN("Out of memory listing debuggers\n");
+		libusb_free_device_list(devs, 1);
+		return -1;
+	}
+	size_t found_debuggers = 0;
 	struct libusb_device_descriptor desc;
-	char serial[64];
-	char manufacturer[128];
-	char product[128];
+	char serial[64] = {0};
+	char manufacturer[128] = {0};
+	char product[128] = {0};
+	char path[USB_PATH_LENGTH];
 	bool access_problems = false;
 	char *active_cable = NULL;
 	bool ftdi_unknown = false;
-rescan:
-	found_debuggers = 0;
-	serial[0] = 0;
-	manufacturer[0] = 0;
-	product[0] = 0;
-	access_problems = false;
-	active_cable = NULL;
-	ftdi_unknown = false;
 	for (size_t i = 0; devs[i]; ++i) {
 		libusb_device *dev = devs[i];
 		int res = libusb_get_device_descriptor(dev, &desc);
@@ -162,6 +247,11 @@ rescan:
 		case LIBUSB_CLASS_WIRELESS:
 			continue;
 		}
+		/* Anything that can't match what was asked for gets skipped before it's opened */
+		usb_device_path(dev, path, sizeof(path));
+		if ((cl_opts->opt_usb_path && strcmp(path, cl_opts->opt_usb_path) != 0) ||
+			(cl_opts->opt_serial && !desc.iSerialNumber))
+			continue;
 		libusb_device_handle *handle = NULL;
 		res = libusb_open(dev, &handle);
 		if (res != LIBUSB_SUCCESS) {
@@ -295,12 +385,17 @@ rescan:
 				continue;
 		}
 
-		if (report)
-			DEBUG_WARN("%2zu: %s, %s, %s\n", found_debuggers + 1U, serial[0] ? serial : NO_SERIAL_NUMBER, manufacturer,
-				product);
+		if (found_debuggers < FIND_DEBUGGERS_MAX_LISTED) {
+			probe_listing_s *const entry = &listing[found_debuggers];
+			memcpy(entry->serial, serial, sizeof(entry->serial));
+			memcpy(entry->manufacturer, manufacturer, sizeof(entry->manufacturer));
+			memcpy(entry->product, product, sizeof(entry->product));
+			memcpy(entry->path, path, sizeof(entry->path));
+		}
 
 		info->vid = desc.idVendor;
 		info->pid = desc.idProduct;
+		memcpy(info->path, path, sizeof(info->path));
 		info->bmp_type = type;
 		strncpy(info->serial, serial, sizeof(info->serial));
 		strncpy(info->product, product, sizeof(info->product));
@@ -318,18 +413,20 @@ rescan:
 	if (!found_debuggers && cl_opts->opt_list_only)
 		DEBUG_WARN("No usable debugger found\n");
 	if (found_debuggers > 1U || (found_debuggers == 1U && cl_opts->opt_list_only)) {
-		if (!report) {
-			if (found_debuggers > 1U)
-				DEBUG_WARN("%zu debuggers found!\nSelect with -P <pos> or -s <(partial)serial no.>\n", found_debuggers);
-			report = true;
-			goto rescan;
+		if (found_debuggers > 1U)
+			DEBUG_WARN("%zu debuggers found!\nSelect with -P <pos>, -s <(partial)serial no.> or -u <USB path>\n",
+				found_debuggers);
+		for (size_t idx = 0; idx < MIN(found_debuggers, FIND_DEBUGGERS_MAX_LISTED); ++idx) {
+			const probe_listing_s *const entry = &listing[idx];
+			DEBUG_WARN("%2zu: %s, %s, %s at %s\n", idx + 1U, entry->serial[0] ? entry->serial : NO_SERIAL_NUMBER,
+				entry->manufacturer, entry->product, entry->path);
 		}
-		if (found_debuggers > 0)
-			access_problems = false;
+		access_problems = false;
 		found_debuggers = 0;
 	}
 	if (!found_debuggers && access_problems)
 		DEBUG_WARN("No debugger found. Please check access rights to USB devices!\n");
+	free(listing);
 	libusb_free_device_list(devs, 1);
 	return found_debuggers == 1U ? 0 : -1;
 }
@@ -344,48 +441,73 @@ static void LIBUSB_CALL on_trans_done(libusb_transfer_s *const transfer)
 			DEBUG_WARN(" Timeout\n");
 		else if (transfer->status == LIBUSB_TRANSFER_CANCELLED)
 			DEBUG_WARN(" cancelled\n");
-		else if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE)
+		else if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
 			DEBUG_WARN(" no device\n");
-		else
+			ctx->flags |= TRANSFER_NO_DEVICE;
+		} else
 			DEBUG_WARN(" unknown\n");
 		ctx->flags |= TRANSFER_HAS_ERROR;
 	}
 	ctx->flags |= TRANSFER_IS_DONE;
 }
 
-static int submit_wait(usb_link_s *link, libusb_transfer_s *transfer)
+static int submit_transfer(libusb_transfer_s *const transfer, transfer_ctx_s *const ctx)
 {
-	transfer_ctx_s transfer_ctx;
-
-	transfer_ctx.flags = 0;
+	ctx->flags = 0;
 
 	/* brief intrusion inside the libusb interface */
 	transfer->callback = on_trans_done;
-	transfer->user_data = &transfer_ctx;
+	transfer->user_data = ctx;
 
 	const libusb_error_e error = libusb_submit_transfer(transfer);
 	if (error) {
 		DEBUG_WARN("libusb_submit_transfer(%d): %s\n", error, libusb_strerror(error));
-		exit(-1);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Cancel a submitted transfer and wait for libusb to hand it back, so that neither the transfer
+ * nor its context are still in use by the event loop once we return
+ */
+static void cancel_transfer(usb_link_s *const link, libusb_transfer_s *const transfer, transfer_ctx_s *const ctx)
+{
+	if (ctx->flags)
+		return;
+	libusb_cancel_transfer(transfer);
+	while (ctx->flags == 0) {
+		timeval_s timeout;
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
+		if (libusb_handle_events_timeout(link->ul_libusb_ctx, &timeout))
+			break;
 	}
+}
 
+static int wait_transfer(usb_link_s *const link, libusb_transfer_s *const transfer, transfer_ctx_s *const ctx)
+{
 	const uint32_t start_time = platform_time_ms();
-	while (transfer_ctx.flags == 0) {
+	const uint64_t start = gdb_perf_timestamp();
+	while (ctx->flags == 0) {
 		timeval_s timeout;
 		timeout.tv_sec = 1;
 		timeout.tv_usec = 0;
 		if (libusb_handle_events_timeout(link->ul_libusb_ctx, &timeout)) {
+			gdb_perf_transport(start);
 			DEBUG_WARN("libusb_handle_events()\n");
 			return -1;
 		}
 		const uint32_t now = platform_time_ms();
 		if (now - start_time > 1000U) {
-			libusb_cancel_transfer(transfer);
+			gdb_perf_transport(start);
+			cancel_transfer(link, transfer, ctx);
 			DEBUG_WARN("libusb_handle_events() timeout\n");
 			return -1;
 		}
 	}
-	if (transfer_ctx.flags & TRANSFER_HAS_ERROR) {
+	gdb_perf_transport(start);
+	if (ctx->flags & TRANSFER_HAS_ERROR) {
 		DEBUG_WARN("libusb_handle_events() | has_error\n");
 		return -1;
 	}
@@ -393,51 +515,178 @@ static int submit_wait(usb_link_s *link, libusb_transfer_s *transfer)
 	return 0;
 }
 
-/* One USB transaction */
+static void dump_tx(const uint8_t *const txbuf, const size_t txsize)
+{
+	if (!DEBUG_LEVEL_ENABLED(BMP_DEBUG_WIRE))
+		return;
+	size_t i = 0;
+	DEBUG_WIRE(" Send (%3zu): ", txsize);
+	for (; i < txsize; ++i) {
+		DEBUG_WIRE("%02x", txbuf[i]);
+		if ((i & 7U) == 7U)
+			DEBUG_WIRE(".");
+		if ((i & 31U) == 31U)
+			DEBUG_WIRE("\n             ");
+	}
+	if (!(i & 31U))
+		DEBUG_WIRE("\n");
+}
+
+static void dump_rx(const uint8_t *const rxbuf, const size_t rxsize, const int res)
+{
+	if (res <= 0 || !DEBUG_LEVEL_ENABLED(BMP_DEBUG_WIRE))
+		return;
+	const size_t rxlen = (size_t)res;
+	DEBUG_WIRE(" Rec (%zu/%zu)", rxsize, rxlen);
+	for (size_t i = 0; i < rxlen && i < 32U; ++i) {
+		if (i && ((i & 7U) == 0U))
+			DEBUG_WIRE(".");
+		DEBUG_WIRE("%02x", rxbuf[i]);
+	}
+}
+
+/*
+ * One USB transaction
+ *
+ * The response transfer is submitted alongside the request rather than after it completes,
+ * so the IN endpoint is already being polled when the probe finishes processing the command.
+ */
 int send_recv(usb_link_s *link, uint8_t *txbuf, size_t txsize, uint8_t *rxbuf, size_t rxsize)
 {
-	int res = 0;
+	transfer_ctx_s req_ctx = {0};
+	transfer_ctx_s rep_ctx = {0};
 	if (txsize) {
 		libusb_fill_bulk_transfer(link->req_trans, link->ul_libusb_device_handle, link->ep_tx | LIBUSB_ENDPOINT_OUT,
 			txbuf, txsize, NULL, NULL, 0);
-		size_t i = 0;
-		DEBUG_WIRE(" Send (%3zu): ", txsize);
-		for (; i < txsize; ++i) {
-			DEBUG_WIRE("%02x", txbuf[i]);
-			if ((i & 7U) == 7U)
-				DEBUG_WIRE(".");
-			if ((i & 31U) == 31U)
-				DEBUG_WIRE("\n             ");
-		}
-		if (!(i & 31U))
-			DEBUG_WIRE("\n");
-		if (submit_wait(link, link->req_trans)) {
-			libusb_clear_halt(link->ul_libusb_device_handle, link->ep_tx);
-			return -1;
+		dump_tx(txbuf, txsize);
+		PROBE_STATS_COUNT(usb_packets_sent);
+		if (submit_transfer(link->req_trans, &req_ctx)) {
+			platform_probe_lost();
+			exit(-1);
 		}
 	}
 	/* send_only */
 	if (rxsize != 0) {
-		/* read the response */
+		/* queue the read for the response */
 		libusb_fill_bulk_transfer(link->rep_trans, link->ul_libusb_device_handle, link->ep_rx | LIBUSB_ENDPOINT_IN,
 			rxbuf, rxsize, NULL, NULL, 0);
+		PROBE_STATS_COUNT(usb_packets_received);
+		if (submit_transfer(link->rep_trans, &rep_ctx)) {
+			/* Nothing can be left in flight referencing the contexts on our stack */
+			if (txsize)
+				cancel_transfer(link, link->req_trans, &req_ctx);
+			platform_probe_lost();
+			exit(-1);
+		}
+	}
 
-		if (submit_wait(link, link->rep_trans)) {
+	if (txsize && wait_transfer(link, link->req_trans, &req_ctx)) {
+		if (rxsize)
+			cancel_transfer(link, link->rep_trans, &rep_ctx);
+		libusb_clear_halt(link->ul_libusb_device_handle, link->ep_tx);
+		if (req_ctx.flags & TRANSFER_NO_DEVICE)
+			platform_probe_lost();
+		return -1;
+	}
+
+	int res = 0;
+	if (rxsize != 0) {
+		if (wait_transfer(link, link->rep_trans, &rep_ctx)) {
 			DEBUG_WARN("clear 1\n");
 			libusb_clear_halt(link->ul_libusb_device_handle, link->ep_rx);
+			if (rep_ctx.flags & TRANSFER_NO_DEVICE)
+				platform_probe_lost();
 			return -1;
 		}
 		res = link->rep_trans->actual_length;
-		if (res > 0) {
-			const size_t rxlen = (size_t)res;
-			DEBUG_WIRE(" Rec (%zu/%zu)", rxsize, rxlen);
-			for (size_t i = 0; i < rxlen && i < 32U; ++i) {
-				if (i && ((i & 7U) == 0U))
-					DEBUG_WIRE(".");
-				DEBUG_WIRE("%02x", rxbuf[i]);
-			}
-		}
+		dump_rx(rxbuf, rxsize, res);
 	}
 	DEBUG_WIRE("\n");
 	return res;
 }
+
+bool usb_transfer_ring_init(usb_transfer_ring_s *const ring, usb_link_s *const link, const uint8_t endpoint)
+{
+	memset(ring, 0, sizeof(*ring));
+	ring->link = link;
+	ring->endpoint = endpoint;
+	for (size_t i = 0; i < USB_TRANSFER_RING_DEPTH; ++i) {
+		ring->transfers[i] = libusb_alloc_transfer(0);
+		if (!ring->transfers[i]) {
+			DEBUG_WARN("libusb_alloc_transfer() failed\n");
+			usb_transfer_ring_free(ring);
+			return false;
+		}
+	}
+	return true;
+}
+
+void usb_transfer_ring_free(usb_transfer_ring_s *const ring)
+{
+	usb_transfer_ring_cancel(ring);
+	for (size_t i = 0; i < USB_TRANSFER_RING_DEPTH; ++i) {
+		libusb_free_transfer(ring->transfers[i]);
+		ring->transfers[i] = NULL;
+	}
+}
+
+int usb_transfer_ring_submit(usb_transfer_ring_s *const ring, uint8_t *const buffer, const size_t length)
+{
+	if (ring->count == USB_TRANSFER_RING_DEPTH)
+		return -1;
+	const size_t slot = (ring->head + ring->count) % USB_TRANSFER_RING_DEPTH;
+	libusb_transfer_s *const transfer = ring->transfers[slot];
+	libusb_fill_bulk_transfer(
+		transfer, ring->link->ul_libusb_device_handle, ring->endpoint, buffer, (int)length, NULL, NULL, 0);
+	if (!(ring->endpoint & LIBUSB_ENDPOINT_IN))
+		dump_tx(buffer, length);
+	if (submit_transfer(transfer, &ring->ctx[slot]))
+		return -1;
+	++ring->count;
+	return 0;
+}
+
+int usb_transfer_ring_wait(usb_transfer_ring_s *const ring)
+{
+	if (!ring->count)
+		return -1;
+	const size_t slot = ring->head;
+	libusb_transfer_s *const transfer = ring->transfers[slot];
+	const int result = wait_transfer(ring->link, transfer, &ring->ctx[slot]);
+	ring->head = (ring->head + 1U) % USB_TRANSFER_RING_DEPTH;
+	--ring->count;
+	if (result) {
+		const bool no_device = ring->ctx[slot].flags & TRANSFER_NO_DEVICE;
+		/* Everything queued behind a failed transfer is now out of sequence, so drop it */
+		usb_transfer_ring_cancel(ring);
+		libusb_clear_halt(ring->link->ul_libusb_device_handle, ring->endpoint);
+		if (no_device)
+			platform_probe_lost();
+		return -1;
+	}
+	if (ring->endpoint & LIBUSB_ENDPOINT_IN) {
+		dump_rx(transfer->buffer, (size_t)transfer->length, transfer->actual_length);
+		DEBUG_WIRE("\n");
+	}
+	return transfer->actual_length;
+}
+
+/* Service any pending libusb events without blocking and report if the oldest transfer has completed */
+bool usb_transfer_ring_ready(usb_transfer_ring_s *const ring)
+{
+	if (!ring->count)
+		return false;
+	timeval_s timeout = {0};
+	libusb_handle_events_timeout(ring->link->ul_libusb_ctx, &timeout);
+	return ring->ctx[ring->head].flags != 0;
+}
+
+void usb_transfer_ring_cancel(usb_transfer_ring_s *const ring)
+{
+	for (; ring->count; --ring->count) {
+		const size_t slot = ring->head;
+		cancel_transfer(ring->link, ring->transfers[slot], &ring->ctx[slot]);
+		ring->head = (ring->head + 1U) % USB_TRANSFER_RING_DEPTH;
+	}
+	ring->head = 0;
+}
@@ -144,6 +144,19 @@ void remote_target_clk_output_enable(const bool enable)
 		DEBUG_WARN("remote_target_clk_output_enable failed, error %s\n", length ? buffer + 1 : "unknown");
 }
 
+bool remote_probe_stats(probe_stats_s *const stats)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, "%s", REMOTE_STATS_GET_STR);
+	platform_buffer_write((uint8_t *)construct, s);
+	s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+	/* Firmware built without the counters reports the query as not supported */
+	if (s < 1 + (int)(sizeof(*stats) * 2U) || construct[0] != REMOTE_RESP_OK)
+		return false;
+	unhexify(stats, construct + 1, sizeof(*stats));
+	return true;
+}
+
 static uint32_t remote_adiv5_dp_read(adiv5_debug_port_s *dp, uint16_t addr)
 {
 	(void)dp;
@@ -155,7 +168,7 @@ static uint32_t remote_adiv5_dp_read(adiv5_debug_port_s *dp, uint16_t addr)
 		DEBUG_WARN("%s error %d\n", __func__, s);
 	uint32_t dest;
 	unhexify(&dest, construct + 1, 4);
-	DEBUG_PROBE("dp_read addr %04x: %08" PRIx32 "\n", dest);
+	DEBUG_PROBE("dp_read addr %04x: %08" PRIx32 "\n", addr, dest);
 	return dest;
 }
 
@@ -258,22 +271,489 @@ static void remote_ap_mem_write_sized(
 	}
 }
 
+/* Copy a payload into buffer, escaping it, until either the data or the space runs out */
+static size_t remote_escape_binary(char *const buffer, const size_t space, size_t *const used, const uint8_t *data,
+	const size_t len, const align_e align)
+{
+	size_t offset = 0;
+	size_t written = 0;
+	/* Only ever consume whole transfer units so the length stays a multiple of the access size */
+	const size_t unit = 1U << align;
+	while (offset + unit <= len) {
+		size_t unit_length = 0;
+		for (size_t idx = 0; idx < unit; ++idx)
+			unit_length += remote_needs_escape(data[offset + idx]) ? 2U : 1U;
+		if (written + unit_length > space)
+			break;
+		for (size_t idx = 0; idx < unit; ++idx) {
+			const uint8_t value = data[offset + idx];
+			if (remote_needs_escape(value)) {
+				buffer[written++] = REMOTE_ESCAPE;
+				buffer[written++] = (char)(value ^ REMOTE_ESCAPE_XOR);
+			} else
+				buffer[written++] = (char)value;
+		}
+		offset += unit;
+	}
+	*used = written;
+	return offset;
+}
+
+/* Undo the escaping of a binary response payload, returning the decoded length */
+static size_t remote_unescape_binary(uint8_t *const dest, const char *const src, const size_t len)
+{
+	size_t written = 0;
+	for (size_t offset = 0; offset < len; ++offset) {
+		if (src[offset] == REMOTE_ESCAPE && offset + 1U < len)
+			dest[written++] = (uint8_t)src[++offset] ^ REMOTE_ESCAPE_XOR;
+		else
+			dest[written++] = (uint8_t)src[offset];
+	}
+	return written;
+}
+
+/*
+ * Send the request for one batch of a binary or run-length encoded memory read. The reads below keep
+ * the request for the next batch in flight while the response to the current one is received and
+ * decoded, so the probe is already reading target memory during the host's turnaround. The serial
+ * readers buffer everything that arrives, so the responses are picked up in order from there.
+ */
+static void remote_ap_mem_read_request(
+	adiv5_access_port_s *const ap, const uint32_t addr, const size_t count, const bool rle)
+{
+	char request[0x30U];
+	const int length = rle ? snprintf(request, sizeof(request), REMOTE_AP_MEM_READ_RLE_STR, ap->dp->dp_jd_index,
+								 ap->apsel, ap->csw, addr, count) :
+							 snprintf(request, sizeof(request), REMOTE_AP_MEM_READ_BIN_STR, ap->dp->dp_jd_index,
+								 ap->apsel, ap->csw, addr, count);
+	platform_buffer_write((uint8_t *)request, length);
+}
+
+static void remote_ap_mem_read_binary(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len)
+{
+	if (len == 0)
+		return;
+	/* Binary responses can be at most twice the data length once escaped */
+	char construct[(REMOTE_BINARY_BATCH_SIZE * 2U) + 0x20U];
+	remote_ap_mem_read_request(ap, src, MIN(len, REMOTE_BINARY_BATCH_SIZE), false);
+	for (size_t offset = 0; offset < len; offset += REMOTE_BINARY_BATCH_SIZE) {
+		const size_t count = MIN(len - offset, REMOTE_BINARY_BATCH_SIZE);
+		const size_t next = offset + count;
+		if (next < len)
+			remote_ap_mem_read_request(ap, src + next, MIN(len - next, REMOTE_BINARY_BATCH_SIZE), false);
+		const int s = platform_buffer_read((uint8_t *)construct, sizeof(construct));
+		if (s > 0 && construct[0] == REMOTE_RESP_OK) {
+			const size_t received = remote_unescape_binary((uint8_t *)dest + offset, construct + 1, s - 1);
+			if (received == count)
+				continue;
+			DEBUG_WARN("%s short response (%zu of %zu bytes) around 0x%08zx\n", __func__, received,
+				count, (size_t)src + offset);
+			ap->dp->fault = 1;
+		} else if (s > 0 && construct[0] == REMOTE_RESP_ERR) {
+			ap->dp->fault = 1;
+			DEBUG_WARN(
+				"%s returned REMOTE_RESP_ERR at apsel %u, addr: 0x%08zx\n", __func__, ap->apsel, (size_t)src + offset);
+		} else
+			DEBUG_WARN("%s error %d around 0x%08zx\n", __func__, s, (size_t)src + offset);
+		/* Don't leave the response to the request already sent for the next batch behind */
+		if (next < len)
+			platform_buffer_read((uint8_t *)construct, sizeof(construct));
+		break;
+	}
+}
+
+static void remote_ap_mem_write_sized_binary(
+	adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len, align_e align)
+{
+	if (len == 0)
+		return;
+	char construct[REMOTE_MAX_MSG_SIZE];
+	const uint8_t *const data = (const uint8_t *)src;
+	/* The header is fixed width, so work out how much room is left for the payload and EOM up front */
+	const int header_length = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_AP_MEM_WRITE_SIZED_BIN_STR,
+		ap->dp->dp_jd_index, ap->apsel, ap->csw, align, dest, 0U);
+	assert(header_length > 0);
+	const size_t space = REMOTE_MAX_MSG_SIZE - (size_t)header_length - 2U;
+	for (size_t offset = 0; offset < len;) {
+		size_t payload_length = 0;
+		const size_t count =
+			remote_escape_binary(construct + header_length, space, &payload_length, data + offset, len - offset, align);
+		/* Now the amount of data is known, fill in the real header, taking care not to clobber the payload */
+		char header[0x30U];
+		snprintf(header, sizeof(header), REMOTE_AP_MEM_WRITE_SIZED_BIN_STR, ap->dp->dp_jd_index, ap->apsel, ap->csw,
+			align, dest + offset, count);
+		memcpy(construct, header, header_length);
+		const size_t message_length = header_length + payload_length;
+		construct[message_length] = REMOTE_EOM;
+		construct[message_length + 1U] = '\0';
+		platform_buffer_write((uint8_t *)construct, message_length + 1U);
+
+		char response[REMOTE_MAX_MSG_SIZE];
+		const int s = platform_buffer_read((uint8_t *)response, REMOTE_MAX_MSG_SIZE);
+		if (s > 0 && response[0] == REMOTE_RESP_OK) {
+			offset += count;
+			continue;
+		}
+		ap->dp->fault = 1;
+		if (s > 0 && response[0] == REMOTE_RESP_ERR)
+			DEBUG_WARN(
+				"%s returned REMOTE_RESP_ERR at apsel %u, addr: 0x%08zx\n", __func__, ap->apsel, (size_t)dest + offset);
+		else
+			DEBUG_WARN("%s error %d around address 0x%08zx\n", __func__, s, (size_t)dest + offset);
+		break;
+	}
+}
+
+/* Undo the run-length encoding of an unescaped response payload, returning the decoded length or 0 if malformed */
+static size_t remote_rle_decode(uint8_t *const dest, const size_t space, const uint8_t *const src, const size_t len)
+{
+	size_t written = 0;
+	for (size_t offset = 0; offset < len;) {
+		const uint8_t control = src[offset++];
+		const bool is_run = control >= REMOTE_RLE_RUN;
+		const size_t amount = is_run ? control - REMOTE_RLE_RUN + REMOTE_RLE_MIN_RUN : control + 1U;
+		if ((is_run ? 1U : amount) > len - offset || written + amount > space)
+			return 0;
+		if (is_run)
+			memset(dest + written, src[offset++], amount);
+		else {
+			memcpy(dest + written, src + offset, amount);
+			offset += amount;
+		}
+		written += amount;
+	}
+	return written;
+}
+
+/* Copy a single payload byte into buffer, escaping it as needed */
+static size_t remote_escape_byte(char *const buffer, const uint8_t value)
+{
+	if (!remote_needs_escape(value)) {
+		buffer[0] = (char)value;
+		return 1U;
+	}
+	buffer[0] = REMOTE_ESCAPE;
+	buffer[1] = (char)(value ^ REMOTE_ESCAPE_XOR);
+	return 2U;
+}
+
+/*
+ * Run-length encode and escape a payload into buffer until either the data or the space runs
+ * out, returning how much of the data was consumed. Unlike remote_escape_binary() this can stop
+ * part way into a transfer unit, so callers must round the result down and encode again.
+ */
+static size_t remote_rle_escape(
+	char *const buffer, const size_t space, size_t *const used, const uint8_t *const data, const size_t len)
+{
+	size_t offset = 0;
+	size_t written = 0;
+	while (offset < len) {
+		/* Make sure the largest possible token, a control byte plus an entry, fits before trying */
+		if (written + 4U > space)
+			break;
+		const size_t run = remote_rle_run_length(data + offset, len - offset);
+		if (run >= REMOTE_RLE_MIN_RUN) {
+			written += remote_escape_byte(buffer + written, REMOTE_RLE_RUN + run - REMOTE_RLE_MIN_RUN);
+			written += remote_escape_byte(buffer + written, data[offset]);
+			offset += run;
+			continue;
+		}
+		/* Work out how much of the literal stretch fits, then emit it */
+		const size_t literal = remote_rle_literal_length(data + offset, len - offset);
+		size_t amount = 0;
+		for (size_t cost = 2U; amount < literal; ++amount) {
+			cost += remote_needs_escape(data[offset + amount]) ? 2U : 1U;
+			if (written + cost > space)
+				break;
+		}
+		written += remote_escape_byte(buffer + written, amount - 1U);
+		for (size_t idx = 0; idx < amount; ++idx)
+			written += remote_escape_byte(buffer + written, data[offset + idx]);
+		offset += amount;
+	}
+	*used = written;
+	return offset;
+}
+
+static void remote_ap_mem_read_rle(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len)
+{
+	if (len == 0)
+		return;
+	/* Encoded responses can be longer than the data by a control byte per literal stretch, then escaped */
+	char construct[((REMOTE_BINARY_BATCH_SIZE + (REMOTE_BINARY_BATCH_SIZE / REMOTE_RLE_MAX_LITERAL) + 1U) * 2U) +
+		0x20U];
+	uint8_t payload[sizeof(construct)];
+	remote_ap_mem_read_request(ap, src, MIN(len, REMOTE_BINARY_BATCH_SIZE), true);
+	for (size_t offset = 0; offset < len; offset += REMOTE_BINARY_BATCH_SIZE) {
+		const size_t count = MIN(len - offset, REMOTE_BINARY_BATCH_SIZE);
+		const size_t next = offset + count;
+		if (next < len)
+			remote_ap_mem_read_request(ap, src + next, MIN(len - next, REMOTE_BINARY_BATCH_SIZE), true);
+		const int s = platform_buffer_read((uint8_t *)construct, sizeof(construct));
+		if (s > 0 && construct[0] == REMOTE_RESP_OK) {
+			const size_t encoded = remote_unescape_binary(payload, construct + 1, s - 1);
+			const size_t received = remote_rle_decode((uint8_t *)dest + offset, count, payload, encoded);
+			if (received == count)
+				continue;
+			DEBUG_WARN("%s bad response (%zu of %zu bytes) around 0x%08zx\n", __func__, received, count,
+				(size_t)src + offset);
+		} else if (s > 0 && construct[0] == REMOTE_RESP_ERR)
+			DEBUG_WARN(
+				"%s returned REMOTE_RESP_ERR at apsel %u, addr: 0x%08zx\n", __func__, ap->apsel, (size_t)src + offset);
+		else
+			DEBUG_WARN("%s error %d around 0x%08zx\n", __func__, s, (size_t)src + offset);
+		ap->dp->fault = 1;
+		if (next < len)
+			platform_buffer_read((uint8_t *)construct, sizeof(construct));
+		break;
+	}
+}
+
+static void remote_ap_mem_write_sized_rle(
+	adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len, align_e align)
+{
+	if (len == 0)
+		return;
+	char construct[REMOTE_MAX_MSG_SIZE];
+	const uint8_t *const data = (const uint8_t *)src;
+	const size_t unit = 1U << align;
+	const int header_length = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_AP_MEM_WRITE_SIZED_RLE_STR,
+		ap->dp->dp_jd_index, ap->apsel, ap->csw, align, dest, 0U);
+	assert(header_length > 0);
+	const size_t space = REMOTE_MAX_MSG_SIZE - (size_t)header_length - 2U;
+	for (size_t offset = 0; offset < len;) {
+		size_t payload_length = 0;
+		const size_t amount = MIN(len - offset, REMOTE_RLE_MAX_LENGTH);
+		/*
+		 * Each packet has to end on a transfer unit boundary, so while the encoding stops part way
+		 * into one, encode again up to the last whole unit. Each attempt consumes less, so this ends.
+		 */
+		size_t count = remote_rle_escape(construct + header_length, space, &payload_length, data + offset, amount);
+		while (count % unit)
+			count = remote_rle_escape(
+				construct + header_length, space, &payload_length, data + offset, count & ~(unit - 1U));
+		assert(count);
+		char header[0x30U];
+		snprintf(header, sizeof(header), REMOTE_AP_MEM_WRITE_SIZED_RLE_STR, ap->dp->dp_jd_index, ap->apsel, ap->csw,
+			align, dest + offset, count);
+		memcpy(construct, header, header_length);
+		const size_t message_length = header_length + payload_length;
+		construct[message_length] = REMOTE_EOM;
+		construct[message_length + 1U] = '\0';
+		platform_buffer_write((uint8_t *)construct, message_length + 1U);
+
+		char response[REMOTE_MAX_MSG_SIZE];
+		const int s = platform_buffer_read((uint8_t *)response, REMOTE_MAX_MSG_SIZE);
+		if (s > 0 && response[0] == REMOTE_RESP_OK) {
+			offset += count;
+			continue;
+		}
+		ap->dp->fault = 1;
+		if (s > 0 && response[0] == REMOTE_RESP_ERR)
+			DEBUG_WARN(
+				"%s returned REMOTE_RESP_ERR at apsel %u, addr: 0x%08zx\n", __func__, ap->apsel, (size_t)dest + offset);
+		else
+			DEBUG_WARN("%s error %d around address 0x%08zx\n", __func__, s, (size_t)dest + offset);
+		break;
+	}
+}
+
+/* Wait for a memory location on the probe, splitting long waits so each fits in a single response timeout */
+static bool remote_ap_mem_poll32(adiv5_access_port_s *const ap, const uint32_t addr, const uint32_t mask,
+	const uint32_t value, const uint32_t timeout_ms, uint32_t *const result)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, timeout_ms);
+	while (true) {
+		const uint32_t slice = MIN(timeout_ms, REMOTE_MEM_POLL_MAX_TIMEOUT);
+		int s = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_AP_MEM_POLL_STR, ap->dp->dp_jd_index, ap->apsel, ap->csw,
+			addr, mask, value, slice);
+		platform_buffer_write((uint8_t *)construct, s);
+		s = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+		if (s < 1 || construct[0] != REMOTE_RESP_OK) {
+			DEBUG_WARN("%s error %d at 0x%08" PRIx32 "\n", __func__, s, addr);
+			ap->dp->fault = 1;
+			return false;
+		}
+		unhexify(result, construct + 1, 4);
+		if ((*result & mask) == value)
+			return true;
+		if (platform_timeout_is_expired(&timeout))
+			return false;
+	}
+}
+
+/* Run a Flash programming loop on the probe, sending as many whole strides per packet as are sure to fit */
+static bool remote_ap_mem_write_loop(adiv5_access_port_s *const ap, const uint32_t dest, const void *const src,
+	const size_t len, const align_e align, const adiv5_mem_write_loop_s *const loop, uint32_t *const status)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	const uint8_t *const data = (const uint8_t *)src;
+	const uint32_t timeout = MIN(loop->timeout_ms, REMOTE_MEM_POLL_MAX_TIMEOUT);
+	const int header_length = snprintf(construct, REMOTE_MAX_MSG_SIZE, REMOTE_AP_MEM_WRITE_LOOP_STR,
+		ap->dp->dp_jd_index, ap->apsel, ap->csw, align, dest, 0U, loop->stride, loop->cmd_addr, loop->cmd_value,
+		loop->status_addr, loop->status_mask, loop->status_value, timeout);
+	assert(header_length > 0);
+	/* Size packets for the worst case of every byte needing escaping, so no stride gets split */
+	const size_t space = (REMOTE_MAX_MSG_SIZE - (size_t)header_length - 2U) / 2U;
+	const size_t strides = space / loop->stride;
+	if (!strides) {
+		/* Strides this big don't fit in a packet, so fall back to doing the loop from here */
+		for (size_t offset = 0; offset < len; offset += loop->stride) {
+			remote_ap_mem_write_sized_binary(ap, dest + offset, data + offset, MIN(loop->stride, len - offset), align);
+			if (loop->cmd_addr)
+				remote_ap_mem_write_sized_binary(
+					ap, loop->cmd_addr, &loop->cmd_value, sizeof(loop->cmd_value), ALIGN_WORD);
+			if (ap->dp->fault || !remote_ap_mem_poll32(ap, loop->status_addr, loop->status_mask,
+									 loop->status_value, loop->timeout_ms, status))
+				return false;
+		}
+		return true;
+	}
+
+	for (size_t offset = 0; offset < len;) {
+		size_t payload_length = 0;
+		const size_t amount = MIN(len - offset, strides * loop->stride);
+		const size_t count =
+			remote_escape_binary(construct + header_length, space * 2U, &payload_length, data + offset, amount, align);
+		assert(count == amount);
+		char header[0x60U];
+		snprintf(header, sizeof(header), REMOTE_AP_MEM_WRITE_LOOP_STR, ap->dp->dp_jd_index, ap->apsel, ap->csw,
+			align, dest + offset, count, loop->stride, loop->cmd_addr, loop->cmd_value, loop->status_addr,
+			loop->status_mask, loop->status_value, timeout);
+		memcpy(construct, header, header_length);
+		const size_t message_length = header_length + payload_length;
+		construct[message_length] = REMOTE_EOM;
+		construct[message_length + 1U] = '\0';
+		platform_buffer_write((uint8_t *)construct, message_length + 1U);
+
+		char response[REMOTE_MAX_MSG_SIZE];
+		const int s = platform_buffer_read((uint8_t *)response, REMOTE_MAX_MSG_SIZE);
+		if (s < 1 || response[0] != REMOTE_RESP_OK) {
+			DEBUG_WARN("%s error %d around address 0x%08zx\n", __func__, s, (size_t)dest + offset);
+			ap->dp->fault = 1;
+			return false;
+		}
+		unhexify(status, response + 1, 4);
+		/* The probe stops at the first stride whose status poll timed out */
+		if ((*status & loop->status_mask) != loop->status_value)
+			return false;
+		offset += count;
+	}
+	return true;
+}
+
+/* Send off a batch packet and hand the read results out to the queue entries it was built from */
+static bool remote_adiv5_send_batch(adiv5_debug_port_s *const dp, char *const construct, size_t length,
+	const adiv5_queue_entry_s *const entries, const size_t count)
+{
+	construct[length++] = REMOTE_EOM;
+	construct[length] = '\0';
+	platform_buffer_write((uint8_t *)construct, length);
+
+	char response[REMOTE_MAX_MSG_SIZE];
+	const int s = platform_buffer_read((uint8_t *)response, REMOTE_MAX_MSG_SIZE);
+	if (s < 1 || response[0] != REMOTE_RESP_OK) {
+		DEBUG_WARN("%s error %d\n", __func__, s);
+		dp->fault = 1;
+		return false;
+	}
+	const char *result = response + 1;
+	for (size_t idx = 0; idx < count; ++idx) {
+		if (entries[idx].rnw != ADIV5_LOW_READ || entries[idx].mask)
+			continue;
+		unhexify(entries[idx].result, result, 4);
+		result += 8U;
+	}
+	return true;
+}
+
+static void remote_adiv5_run_queue(adiv5_queue_s *const queue)
+{
+	adiv5_debug_port_s *const dp = queue->dp;
+	char construct[REMOTE_MAX_MSG_SIZE];
+	/* The header is fixed width and gets filled in once we know which AP the batch is for */
+	const size_t header_length = 7U;
+	for (size_t idx = 0; idx < queue->count && !dp->fault;) {
+		const size_t start = idx;
+		const adiv5_access_port_s *ap = NULL;
+		size_t length = header_length;
+		size_t reads = 0;
+		for (; idx < queue->count; ++idx) {
+			const adiv5_queue_entry_s *const entry = &queue->entries[idx];
+			/* Each packet addresses a single AP, and has to fit both itself and its response in a message */
+			if ((entry->ap && ap && entry->ap != ap) || length + 13U + 2U > REMOTE_MAX_MSG_SIZE)
+				break;
+			/* The batch protocol has no way to wait on a register, so leave that to the probe's own pace */
+			if (entry->mask)
+				continue;
+			if (entry->rnw == ADIV5_LOW_READ) {
+				if (reads == REMOTE_BATCH_MAX_READS)
+					break;
+				++reads;
+			}
+			if (entry->ap)
+				ap = entry->ap;
+
+			char op;
+			if (entry->rnw == ADIV5_LOW_READ)
+				op = entry->ap ? REMOTE_BATCH_AP_READ : REMOTE_BATCH_DP_READ;
+			else
+				op = entry->ap ? REMOTE_BATCH_AP_WRITE : REMOTE_BATCH_DP_WRITE;
+			if (entry->rnw == ADIV5_LOW_READ)
+				length += snprintf(construct + length, REMOTE_MAX_MSG_SIZE - length, REMOTE_BATCH_READ_STR, op,
+					entry->addr);
+			else
+				length += snprintf(construct + length, REMOTE_MAX_MSG_SIZE - length, REMOTE_BATCH_WRITE_STR, op,
+					entry->addr, entry->value);
+		}
+
+		char header[16U];
+		snprintf(header, sizeof(header), REMOTE_BATCH_STR, dp->dp_jd_index, ap ? ap->apsel : 0U);
+		memcpy(construct, header, header_length);
+		if (!remote_adiv5_send_batch(dp, construct, length, queue->entries + start, idx - start))
+			break;
+	}
+}
+
 void remote_adiv5_dp_defaults(adiv5_debug_port_s *dp)
 {
 	uint8_t construct[REMOTE_MAX_MSG_SIZE];
 	int s = snprintf((char *)construct, REMOTE_MAX_MSG_SIZE, "%s", REMOTE_HL_CHECK_STR);
 	platform_buffer_write(construct, s);
 	s = platform_buffer_read(construct, REMOTE_MAX_MSG_SIZE);
-	if (s < 1 || construct[0] == REMOTE_RESP_ERR || construct[1] - '0' < REMOTE_HL_VERSION) {
+	if (s < 1 || construct[0] == REMOTE_RESP_ERR || construct[1] - '0' < REMOTE_HL_VERSION_MIN) {
 		DEBUG_WARN("Please update BMP firmware for substantial speed increase!\n");
 		return;
 	}
+	const uint32_t version = remotehston(8, (const char *)construct + 1);
 	dp->low_access = remote_adiv5_low_access;
 	dp->dp_read = remote_adiv5_dp_read;
 	dp->ap_write = remote_adiv5_ap_write;
 	dp->ap_read = remote_adiv5_ap_read;
-	dp->mem_read = remote_ap_mem_read;
-	dp->mem_write = remote_ap_mem_write_sized;
+	/* Firmware speaking HL version 3 or newer can take memory payloads as binary rather than hex */
+	if (version >= 7U) {
+		/* Version 7 adds run-length encoding those payloads */
+		dp->mem_read = remote_ap_mem_read_rle;
+		dp->mem_write = remote_ap_mem_write_sized_rle;
+	} else if (version >= 3U) {
+		dp->mem_read = remote_ap_mem_read_binary;
+		dp->mem_write = remote_ap_mem_write_sized_binary;
+	} else {
+		DEBUG_WARN("Please update BMP firmware to enable binary memory transfers\n");
+		dp->mem_read = remote_ap_mem_read;
+		dp->mem_write = remote_ap_mem_write_sized;
+	}
+	/* And from version 4 on, queued register accesses can be sent as one batch */
+	if (version >= 4U)
+		dp->run_queue = remote_adiv5_run_queue;
+	/* Version 5 adds waiting on a memory location probe-side */
+	if (version >= 5U)
+		dp->mem_poll32 = remote_ap_mem_poll32;
+	/* And version 6 running whole Flash programming loops there */
+	if (version >= 6U)
+		dp->mem_write_loop = remote_ap_mem_write_loop;
 }
 
 void remote_add_jtag_dev(uint32_t i, const jtag_dev_s *jtag_dev)
@@ -24,8 +24,13 @@
 #include "adiv5.h"
 #include "target.h"
 #include "target_internal.h"
+#include "probe_stats.h"
 
 #define REMOTE_MAX_MSG_SIZE 1024U
+/* Largest memory read requested in one binary mode packet, sized to fit the firmware's packet buffer */
+#define REMOTE_BINARY_BATCH_SIZE (REMOTE_MAX_MSG_SIZE - 0x20U)
+/* Oldest HL protocol version that can be used at all */
+#define REMOTE_HL_VERSION_MIN 2
 
 int platform_buffer_write(const uint8_t *data, int size);
 int platform_buffer_read(uint8_t *data, int size);
@@ -41,6 +46,7 @@ bool remote_nrst_get_val(void);
 void remote_max_frequency_set(uint32_t freq);
 uint32_t remote_max_frequency_get(void);
 void remote_target_clk_output_enable(bool enable);
+bool remote_probe_stats(probe_stats_s *stats);
 
 void remote_adiv5_dp_defaults(adiv5_debug_port_s *dp);
 void remote_add_jtag_dev(uint32_t i, const jtag_dev_s *jtag_dev);
@@ -42,11 +42,25 @@ void bmp_ident(bmp_info_s *info)
 	PRINT_INFO("Using:\n %s %s %s\n", info->manufacturer, info->version, info->serial);
 }
 
+/* How often to look for a probe coming back, as without libusb there's no hearing about it */
+#define PROBE_POLL_INTERVAL_MS 250U
+
 void libusb_exit_function(bmp_info_s *info)
 {
 	(void)info;
 };
 
+void bmp_probe_release(bmp_info_s *info)
+{
+	(void)info;
+}
+
+void bmp_probe_wait(const bmp_info_s *info)
+{
+	(void)info;
+	platform_delay(PROBE_POLL_INTERVAL_MS);
+}
+
 #ifdef __APPLE__
 int find_debuggers(bmda_cli_options_s *cl_opts, bmp_info_s *info)
 {
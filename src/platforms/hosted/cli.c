@@ -19,7 +19,7 @@
  */
 
 /* This file allows pc-hosted BMP platforms to erase or read/verify/flash a
- * binary file from the command line.
+ * binary, ELF or Intel HEX file from the command line.
  */
 
 #include "general.h"
@@ -29,13 +29,18 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <getopt.h>
+#include <pthread.h>
 #include "version.h"
 #include "target_internal.h"
 #include "cortexm.h"
 #include "command.h"
+#include "crc32.h"
 
 #include "cli.h"
 #include "bmp_hosted.h"
+#include "flash_image.h"
+#include "flm.h"
+#include "bench.h"
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -45,9 +50,64 @@
 #else
 #include <sys/mman.h>
 #endif
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#endif
+
+/* Most probes a single gang programming run will drive */
+#define CL_GANG_MAX_PROBES 32U
+
+/* Chunk size for reading Flash back for verification and dumping */
+#define WORKSIZE 0x1000U
+/* Granularity of verification when the target can compute CRCs itself */
+#define CL_VERIFY_CRC_BLOCK 0x4000U
+/*
+ * Size of each read the memory dump pipeline issues to the target. The backends split a read into
+ * the largest transfers their transport can carry, so the bigger this is the less per-call overhead
+ * there is, while still giving a useful progress update rate.
+ */
+#define CL_DUMP_BLOCK_SIZE 0x10000U
+#define CL_DUMP_BUFFERS    4U
+/* How often the dump progress line gets updated */
+#define CL_DUMP_PROGRESS_MS 500U
+/* Longest line a batch script may have, and the most words a step is split into */
+#define CL_SCRIPT_LINE_MAX 512U
+#define CL_SCRIPT_ARGS_MAX 4U
+
+/* ELF core file layout, see the System V ABI and the ARM Linux elf_prstatus */
+#define CL_CORE_EHDR_SIZE     52U
+#define CL_CORE_PHDR_SIZE     32U
+#define CL_CORE_ET_CORE       4U
+#define CL_CORE_EM_ARM        40U
+#define CL_CORE_PT_LOAD       1U
+#define CL_CORE_PT_NOTE       4U
+#define CL_CORE_PF_RW         6U
+#define CL_CORE_NT_PRSTATUS   1U
+#define CL_CORE_PRSTATUS_SIZE 148U
+#define CL_CORE_PRSTATUS_REGS 72U
+#define CL_CORE_ARM_REGS      17U
 
 typedef struct option getopt_option_s;
 
+/*
+ * State shared between the probe side of a memory dump and the thread writing it out. The probe
+ * side fills buffers at 'head' while the writer drains them from 'tail', 'pending' counting the
+ * buffers in between that are waiting to be written.
+ */
+typedef struct cl_dump {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	uint8_t buffers[CL_DUMP_BUFFERS][CL_DUMP_BLOCK_SIZE];
+	size_t lengths[CL_DUMP_BUFFERS];
+	size_t head;
+	size_t tail;
+	size_t pending;
+	bool done;
+	bool failed;
+	int fd;
+	const char *file_name;
+} cl_dump_s;
+
 static void cl_target_printf(target_controller_s *tc, const char *fmt, va_list ap)
 {
 	(void)tc;
@@ -62,26 +122,36 @@ static target_controller_s cl_controller = {
 typedef struct mmap_data {
 	void *data;
 	size_t size;
+	/* Size of the whole mapping, 'size' may later be bounded to the Flash size */
+	size_t real_size;
 #if defined(_WIN32) || defined(__CYGWIN__)
 	HANDLE hFile;
 	HANDLE hMapFile;
-#else
-	size_t real_size;
-	int fd;
 #endif
 } mmap_data_s;
 
 int cl_debuglevel;
 
-static bool bmp_mmap(char *file, mmap_data_s *map)
+/*
+ * Map the input file read-only so the Flash write and verify paths consume it straight out of the
+ * page cache rather than from a private copy. The file is walked front to back exactly once per
+ * pass, so tell the OS to read ahead aggressively and drop pages behind us.
+ */
+static bool bmp_mmap(const char *file, mmap_data_s *map)
 {
 #if defined(_WIN32) || defined(__CYGWIN__)
-	map->hFile = CreateFile(file, GENERIC_WRITE | GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_ALWAYS, 0, NULL);
+	map->hFile = CreateFile(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
 	if (map->hFile == INVALID_HANDLE_VALUE) {
-		DEBUG_WARN("Open file %s failed: %s\n", file, strerror(errno));
+		DEBUG_WARN("Open file %s failed: %lu\n", file, (unsigned long)GetLastError());
 		return false;
 	}
-	map->size = GetFileSize(map->hFile, NULL);
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(map->hFile, &file_size) || file_size.QuadPart == 0 || (uint64_t)file_size.QuadPart > SIZE_MAX) {
+		DEBUG_WARN("File %s is empty or too large to map\n", file);
+		CloseHandle(map->hFile);
+		return false;
+	}
+	map->real_size = (size_t)file_size.QuadPart;
 	map->hMapFile = CreateFileMapping(map->hFile, NULL, /* default security       */
 		PAGE_READONLY,                                  /* read only access       */
 		0,                                              /* max. object size high  */
@@ -89,29 +159,43 @@ static bool bmp_mmap(char *file, mmap_data_s *map)
 		NULL);                                          /* name of mapping object */
 
 	if (map->hMapFile == NULL || map->hMapFile == INVALID_HANDLE_VALUE) {
-		DEBUG_WARN("Map file %s failed: %s\n", file, strerror(errno));
+		DEBUG_WARN("Map file %s failed: %lu\n", file, (unsigned long)GetLastError());
 		CloseHandle(map->hFile);
 		return false;
 	}
 	map->data = MapViewOfFile(map->hMapFile, FILE_MAP_READ, 0, 0, 0);
 	if (!map->data) {
-		DEBUG_WARN("Could not create file mapping object (%s).\n", strerror(errno));
+		DEBUG_WARN("Could not create file mapping object (%lu).\n", (unsigned long)GetLastError());
 		CloseHandle(map->hMapFile);
+		CloseHandle(map->hFile);
 		return false;
 	}
 #else
-	map->fd = open(file, O_RDONLY | O_BINARY);
-	if (map->fd < 0) {
+	const int fd = open(file, O_RDONLY | O_BINARY);
+	if (fd < 0) {
 		DEBUG_WARN("Open file %s failed: %s\n", file, strerror(errno));
 		return false;
 	}
 	struct stat stat = {};
-	if (fstat(map->fd, &stat))
+	if (fstat(fd, &stat) || !S_ISREG(stat.st_mode) || stat.st_size <= 0 || (uint64_t)stat.st_size > SIZE_MAX) {
+		DEBUG_WARN("File %s is not a regular file, is empty or is too large to map\n", file);
+		close(fd);
 		return false;
-	map->real_size = stat.st_size;
-	map->size = stat.st_size;
-	map->data = mmap(NULL, map->real_size, PROT_READ, MAP_PRIVATE, map->fd, 0);
+	}
+	map->real_size = (size_t)stat.st_size;
+	map->data = mmap(NULL, map->real_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	/* The mapping holds its own reference to the file, so the descriptor is no longer needed */
+	close(fd);
+	if (map->data == MAP_FAILED) {
+		DEBUG_WARN("Map file %s failed: %s\n", file, strerror(errno));
+		map->data = NULL;
+		return false;
+	}
+#ifdef MADV_SEQUENTIAL
+	madvise(map->data, map->real_size, MADV_SEQUENTIAL);
 #endif
+#endif
+	map->size = map->real_size;
 	return true;
 }
 
@@ -125,15 +209,19 @@ static void bmp_munmap(mmap_data_s *map)
 	/* Use the untainted 'real_size' here, 'size' may have been bounded to the flash size and we want to unmap the whole file */
 	munmap(map->data, map->real_size);
 #endif
+	map->data = NULL;
+	map->size = 0;
+	map->real_size = 0;
 }
 
 static void cl_help(char **argv)
 {
 	bmp_ident(NULL);
 	PRINT_INFO("\n"
-			   "Usage: %s [-h | -l | [-vBITMASK] [-d PATH | -P NUMBER | -s SERIAL | -c TYPE]\n"
-			   "\t[-n NUMBER] [-j | -A] [-C] [-t | -T] [-e] [-p] [-R[h]] [-H] [-M STRING ...]\n"
-			   "\t[-f | -m] [-E | -w | -V | -r] [-a ADDR] [-S number] [file]]\n"
+			   "Usage: %s [-h | -l | [-vBITMASK] [-d PATH | -P NUMBER | -s SERIAL | -u PATH | -c TYPE]\n"
+			   "\t[-n NUMBER] [-j | -A] [-C] [-t | -T] [-D FILE] [-X FILE] [-e] [-p] [-k] [-R[h]] [-H] [-M STRING ...]\n"
+			   "\t[-O FILE] [-Y ID[,PREFIX]] [-b BAUD] [-o PREFIX] [-G COUNT] [-x PORT] [-f | -m]\n"
+			   "\t[-E | -w | -V | -r] [-a ADDR] [-S number] [-i] [-L FILE] [-g PROBES] [file]]\n"
 			   "\n"
 			   "The default is to start a debug server at localhost:2000\n\n"
 			   "Single-shot and verbosity options [-h | -l | -vBITMASK]:\n"
@@ -142,16 +230,21 @@ static void cl_help(char **argv)
 			   "\t-v, --verbose    Set the output verbosity level based on some combination of:\n"
 			   "\t                   1 = INFO, 2 = GDB, 4 = TARGET, 8 = PROBE, 16 = WIRE\n"
 			   "\n"
-			   "Probe selection arguments [-d PATH | -P NUMBER | -s SERIAL | -c TYPE]:\n"
-			   "\t-d, --device     Use a serial device at the given path\n"
+			   "Probe selection arguments [-d PATH | -P NUMBER | -s SERIAL | -u PATH | -c TYPE]:\n"
+			   "\t-d, --device     Use a serial device at the given path, or a probe served by\n"
+			   "\t                   another BMDA as tcp:HOST:PORT, or the built-in SWD target\n"
+			   "\t                   simulator as sim:\n"
 			   "\t-P, --probe      Use the <number>th debug probe found while scanning the\n"
 			   "\t                   system, see the output from list for the order\n"
 			   "\t-s, --serial     Select the debug probe with the given serial number\n"
+			   "\t-u, --usb-path   Select the debug probe plugged in at the given USB path, as\n"
+			   "\t                   BUS-PORT[.PORT...] listed by -l. Other devices aren't opened\n"
 			   "\t-c, --ftdi-type  Select the FTDI-based debug probe with of the given\n"
 			   "\t                   type (cable)\n"
 			   "\n"
-			   "General configuration options: [-n NUMBER] [-j] [-C] [-t | -T] [-e] [-p] [-R[h]]\n"
-			   "\t\t[-H] [-M STRING ...]\n"
+			   "General configuration options: [-n NUMBER] [-j] [-C] [-t | -T] [-e] [-p] [-k] [-R[h]]\n"
+			   "\t\t[-H] [-X FILE] [-M STRING ...] [-O FILE] [-Y ID[,PREFIX]] [-b BAUD] [-o PREFIX]\n"
+			   "\t\t[-G COUNT] [-x PORT] [-K]\n"
 			   "\t-n, --number     Select the target device at the given position in the\n"
 			   "\t                   scan chain (use the -t option to get a scan chain listing)\n"
 			   "\t-j, --jtag       Use JTAG instead of SWD\n"
@@ -163,9 +256,22 @@ static void cl_help(char **argv)
 			   "\t                   connected devices\n"
 			   "\t-T, --timing     Perform continues read- or write-back of a value to allow\n"
 			   "\t                   measurement of protocol timing. Aborted by ^C\n"
+			   "\t-B, --bench      Measure memory throughput and access, register, halt/resume\n"
+			   "\t                   and step latencies for the probe and target. This runs\n"
+			   "\t                   target code. Given -a, also measures erasing and\n"
+			   "\t                   programming -S bytes (default one block) of Flash there\n"
+			   "\t-D, --core-dump  Halt the target and write all its RAM regions and the core\n"
+			   "\t                   registers to FILE as an ELF core file for GDB\n"
+			   "\t-X, --script     Run the batch of steps in FILE ('-' for stdin) in one session,\n"
+			   "\t                   one per line: erase ADDR LENGTH, write FILE [ADDR], verify\n"
+			   "\t                   FILE [ADDR], read FILE ADDR LENGTH, monitor COMMAND, reset\n"
+			   "\t                   and delay MS, stopping at the first step that fails\n"
 			   "\t-e, --ext-res    Assume external resistors for FTDI devices, that is having the\n"
 			   "\t                   FTDI chip connected through resistors to TMS, TDI and TDO\n"
 			   "\t-p, --power      Power the target from the probe (if possible)\n"
+			   "\t-k, --perf       Report the latency of each type of GDB packet, split into\n"
+			   "\t                   probe transport and processing time, on exit (see also\n"
+			   "\t                   'monitor perf')\n"
 			   "\t-R, --reset      Reset the device. If followed by 'h', this will be done using\n"
 			   "\t                   the hardware reset line instead of over the debug link\n"
 			   "\t-H, --high-level Do not use the high level command API (bmp-remote)\n"
@@ -173,25 +279,58 @@ static void cl_help(char **argv)
 			   "\t                   can be repeated for as many commands you wish to run.\n"
 			   "\t                   If the command contains spaces, use quotes around the\n"
 			   "\t                   complete command\n"
+			   "\t-O, --swo-decode Decode the ITM/DWT packets in a raw SWO capture file ('-'\n"
+			   "\t                   for stdin) and report exception timing, no probe needed\n"
+			   "\t-Y, --tpiu       The SWO capture (-O or -b) is TPIU formatted: decode ITM\n"
+			   "\t                   from trace source ID and write the other sources raw to\n"
+			   "\t                   files named PREFIX<id> (default tpiu-source)\n"
+			   "\t-b, --swo-baud   Capture SWO trace at BAUD from an ST-Link or CMSIS-DAP\n"
+			   "\t                   adaptor while debugging and decode the ITM/DWT packets\n"
+			   "\t                   to the terminal\n"
+			   "\t-o, --rtt-output Write RTT up channels other than 0 to their own files (or\n"
+			   "\t                   FIFOs) named PREFIX<channel> instead of the terminal.\n"
+			   "\t                   Start PREFIX with 'frames:' for timestamped frames,\n"
+			   "\t                   'unix:' for framed UNIX sockets or 'ring:' for\n"
+			   "\t                   memory-mapped ring buffer files\n"
+			   "\t-G, --gdb-ports  Listen for GDB on this many consecutive ports (up to 8).\n"
+			   "\t                   Sessions are served one at a time, and one on the nth\n"
+			   "\t                   extra port attaches to target n + 1 if there's none yet\n"
+			   "\t-x, --probe-server Serve the remote protocol of the Black Magic Probe on TCP\n"
+			   "\t                   port PORT for other BMDA instances instead of debugging\n"
+			   "\t-U, --ipc-socket Give other local processes access to the target's memory,\n"
+			   "\t                   registers and run control through the UNIX socket PATH\n"
+			   "\t-K, --reconnect  Keep the GDB server up when the probe drops off the bus,\n"
+			   "\t                   wait for it to come back, then redo the scan, frequency\n"
+			   "\t                   and attach that were in effect\n"
 			   "\n"
 			   "SWD-specific configuration options [-f FREQUENCY | -m TARGET]:\n"
-			   "\t-f, --freq       Set an operating frequency for SWD\n"
+			   "\t-f, --freq       Set an operating frequency for SWD, otherwise the one\n"
+			   "\t                   saved for the target by the last session is used\n"
 			   "\t-m, --mult-drop  Use the given target ID for selection in SWD multi-drop\n"
 			   "\n"
 			   "Flash operation selection options [-E | -w | -V | -r]:\n"
 			   "\t-E, --erase      Erase the target device Flash\n"
-			   "\t-w, --write      Write the specified binary file to the target device\n"
-			   "\t                   Flash (the default)\n"
-			   "\t-V, --verify     Verify the target device Flash against the specified\n"
-			   "\t                   binary file\n"
+			   "\t-w, --write      Write the specified file to the target device Flash (the\n"
+			   "\t                   default), only the segments of ELF and Intel HEX files\n"
+			   "\t                   are erased and programmed\n"
+			   "\t-V, --verify     Verify the target device Flash against the specified file\n"
 			   "\t-r, --read       Read the target device Flash\n"
 			   "\n"
-			   "Flash operation modifiers options: [-a ADDR] [-S number] [FILE]\n"
+			   "Flash operation modifiers options: [-a ADDR] [-S number] [-i] [-L FILE] [-g PROBES]\n"
+			   "\t\t[FILE]\n"
 			   "\t-a, --addr       Start address for the given Flash operation (defaults to\n"
-			   "\t                   the start of Flash)\n"
+			   "\t                   the start of Flash, ignored for ELF and Intel HEX files)\n"
 			   "\t-S, --byte-count Number of bytes to work on in the Flash operation (default\n"
 			   "\t                   is till the operation fails or is complete)\n"
-			   "\t<file>           Binary file to use in Flash operations\n",
+			   "\t-i, --incremental Only erase and write Flash blocks whose contents differ\n"
+			   "\t                   from the new image, also applies to GDB loads\n"
+			   "\t-L, --flm        Program Flash using the CMSIS-Pack flash algorithm (.FLM)\n"
+			   "\t                   in FILE, for parts without a driver of their own. From\n"
+			   "\t                   GDB, use monitor flm FILE then reattach\n"
+			   "\t-g, --gang       Run the Flash operation on several probes at once, given\n"
+			   "\t                   as a comma separated list of (partial) serial numbers,\n"
+			   "\t                   or a count to use the first that many probes listed\n"
+			   "\t<file>           Binary, ELF or Intel HEX file to use in Flash operations\n",
 		argv[0]);
 	exit(0);
 }
@@ -203,6 +342,7 @@ static const getopt_option_s long_options[] = {
 	{"device", required_argument, NULL, 'd'},
 	{"probe", required_argument, NULL, 'P'},
 	{"serial", required_argument, NULL, 's'},
+	{"usb-path", required_argument, NULL, 'u'},
 	{"ftdi-type", required_argument, NULL, 'c'},
 	{"fast-poll", no_argument, NULL, 'F'},
 	{"number", required_argument, NULL, 'n'},
@@ -211,11 +351,23 @@ static const getopt_option_s long_options[] = {
 	{"hw-reset", no_argument, NULL, 'C'},
 	{"list-chain", no_argument, NULL, 't'},
 	{"timing", no_argument, NULL, 'T'},
+	{"bench", no_argument, NULL, 'B'},
+	{"core-dump", required_argument, NULL, 'D'},
+	{"script", required_argument, NULL, 'X'},
 	{"ext-res", no_argument, NULL, 'e'},
 	{"power", no_argument, NULL, 'p'},
+	{"perf", no_argument, NULL, 'k'},
 	{"reset", optional_argument, NULL, 'R'},
 	{"high-level", no_argument, NULL, 'H'},
 	{"monitor", required_argument, NULL, 'M'},
+	{"swo-decode", required_argument, NULL, 'O'},
+	{"tpiu", required_argument, NULL, 'Y'},
+	{"swo-baud", required_argument, NULL, 'b'},
+	{"rtt-output", required_argument, NULL, 'o'},
+	{"gdb-ports", required_argument, NULL, 'G'},
+	{"gang", required_argument, NULL, 'g'},
+	{"probe-server", required_argument, NULL, 'x'},
+	{"ipc-socket", required_argument, NULL, 'U'},
 	{"freq", required_argument, NULL, 'f'},
 	{"multi-drop", required_argument, NULL, 'm'},
 	{"erase", no_argument, NULL, 'E'},
@@ -224,6 +376,9 @@ static const getopt_option_s long_options[] = {
 	{"read", no_argument, NULL, 'r'},
 	{"addr", required_argument, NULL, 'a'},
 	{"byte-count", required_argument, NULL, 'S'},
+	{"incremental", no_argument, NULL, 'i'},
+	{"reconnect", no_argument, NULL, 'K'},
+	{"flm", required_argument, NULL, 'L'},
 	{NULL, 0, NULL, 0},
 };
 
@@ -236,7 +391,8 @@ void cl_init(bmda_cli_options_s *opt, int argc, char **argv)
 	opt->opt_scanmode = BMP_SCAN_SWD;
 	opt->opt_mode = BMP_MODE_DEBUG;
 	while (true) {
-		const int option = getopt_long(argc, argv, "eEFhHv:d:f:s:I:c:Cln:m:M:wVtTa:S:jApP:rR::", long_options, NULL);
+		const int option = getopt_long(
+			argc, argv, "eEFhHv:d:f:s:u:I:c:Cln:m:M:O:Y:b:o:G:g:x:U:wVtTBD:X:a:S:ijApkKL:P:rR::", long_options, NULL);
 		if (option == -1)
 			break;
 
@@ -279,6 +435,9 @@ void cl_init(bmda_cli_options_s *opt, int argc, char **argv)
 		case 'F':
 			opt->fast_poll = true;
 			break;
+		case 'k':
+			opt->opt_perf = true;
+			break;
 		case 'f':
 			if (optarg) {
 				char *p;
@@ -292,12 +451,17 @@ void cl_init(bmda_cli_options_s *opt, int argc, char **argv)
 					break;
 				}
 				opt->opt_max_swj_frequency = frequency;
+				opt->opt_frequency_set = true;
 			}
 			break;
 		case 's':
 			if (optarg)
 				opt->opt_serial = optarg;
 			break;
+		case 'u':
+			if (optarg)
+				opt->opt_usb_path = optarg;
+			break;
 		case 'I':
 			if (optarg)
 				opt->opt_ident_string = optarg;
@@ -312,6 +476,23 @@ void cl_init(bmda_cli_options_s *opt, int argc, char **argv)
 		case 'T':
 			opt->opt_mode = BMP_MODE_SWJ_TEST;
 			break;
+		case 'B':
+			opt->opt_mode = BMP_MODE_BENCH;
+			cl_debuglevel |= BMP_DEBUG_INFO | BMP_DEBUG_STDOUT;
+			break;
+		case 'D':
+			if (optarg) {
+				opt->opt_core_file = optarg;
+				opt->opt_mode = BMP_MODE_CORE_DUMP;
+			}
+			break;
+		case 'X':
+			if (optarg) {
+				opt->opt_script_file = optarg;
+				opt->opt_mode = BMP_MODE_SCRIPT;
+				cl_debuglevel |= BMP_DEBUG_INFO | BMP_DEBUG_STDOUT;
+			}
+			break;
 		case 'w':
 			if (opt->opt_mode == BMP_MODE_FLASH_VERIFY)
 				opt->opt_mode = BMP_MODE_FLASH_WRITE_VERIFY;
@@ -336,6 +517,16 @@ void cl_init(bmda_cli_options_s *opt, int argc, char **argv)
 		case 'p':
 			opt->opt_tpwr = true;
 			break;
+		case 'i':
+			opt->opt_flash_incremental = true;
+			break;
+		case 'K':
+			opt->opt_reconnect = true;
+			break;
+		case 'L':
+			if (optarg)
+				opt->opt_flm_file = optarg;
+			break;
 		case 'a':
 			if (optarg)
 				opt->opt_flash_start = strtol(optarg, NULL, 0);
@@ -352,6 +543,48 @@ void cl_init(bmda_cli_options_s *opt, int argc, char **argv)
 			if (optarg)
 				opt->opt_monitor = optarg;
 			break;
+		case 'O':
+			if (optarg) {
+				opt->opt_swo_file = optarg;
+				opt->opt_mode = BMP_MODE_SWO_DECODE;
+			}
+			break;
+		case 'Y':
+			if (optarg) {
+				char *end = NULL;
+				const unsigned long id = strtoul(optarg, &end, 0);
+				if (end == optarg || id == 0U || id >= 0x70U || (*end && *end != ',')) {
+					DEBUG_WARN("Invalid TPIU trace source ID '%s', it must be from 1 to 0x6f\n", optarg);
+					exit(1);
+				}
+				opt->opt_tpiu_id = (uint8_t)id;
+				opt->opt_tpiu_prefix = *end == ',' ? end + 1 : "tpiu-source";
+			}
+			break;
+		case 'b':
+			if (optarg)
+				opt->opt_swo_baudrate = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			if (optarg)
+				opt->opt_rtt_output = optarg;
+			break;
+		case 'G':
+			if (optarg)
+				opt->opt_gdb_ports = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			if (optarg)
+				opt->opt_gang = optarg;
+			break;
+		case 'x':
+			if (optarg)
+				opt->opt_probe_server = (uint16_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'U':
+			if (optarg)
+				opt->opt_ipc_socket = optarg;
+			break;
 		case 'P':
 			if (optarg)
 				opt->opt_position = strtol(optarg, NULL, 0);
@@ -375,7 +608,7 @@ void cl_init(bmda_cli_options_s *opt, int argc, char **argv)
 			}
 		}
 	}
-	if (optind && argv[optind]) {
+	if (optind && argv[optind] && opt->opt_mode != BMP_MODE_SWO_DECODE) {
 		if (opt->opt_mode == BMP_MODE_DEBUG)
 			opt->opt_mode = BMP_MODE_FLASH_WRITE;
 		opt->opt_flash_file = argv[optind];
@@ -385,7 +618,8 @@ void cl_init(bmda_cli_options_s *opt, int argc, char **argv)
 	/* Checks */
 	if (opt->opt_flash_file &&
 		(opt->opt_mode == BMP_MODE_TEST || opt->opt_mode == BMP_MODE_SWJ_TEST || opt->opt_mode == BMP_MODE_RESET ||
-			opt->opt_mode == BMP_MODE_RESET_HW)) {
+			opt->opt_mode == BMP_MODE_RESET_HW || opt->opt_mode == BMP_MODE_BENCH ||
+			opt->opt_mode == BMP_MODE_CORE_DUMP || opt->opt_mode == BMP_MODE_SCRIPT)) {
 		DEBUG_WARN("Ignoring filename in reset/test mode\n");
 		opt->opt_flash_file = NULL;
 	}
@@ -403,6 +637,563 @@ static void display_target(int i, target_s *t, void *context)
 			"*** %2d %c %s %s\n", i, target_attached(t) ? '*' : ' ', target_driver_name(t), core_name ? core_name : "");
 }
 
+/* Check every segment of the image lands in Flash before anything gets erased */
+static bool cl_image_check(target_s *const t, const flash_image_s *const image)
+{
+	for (size_t idx = 0; idx < image->segment_count; ++idx) {
+		const flash_image_segment_s *const segment = &image->segments[idx];
+		DEBUG_INFO("Segment %zu: %zu bytes at 0x%08" PRIx32 "\n", idx, segment->size, segment->addr);
+		if (!target_flash_for_addr(t, segment->addr) ||
+			!target_flash_for_addr(t, segment->addr + (uint32_t)segment->size - 1U)) {
+			DEBUG_WARN("Segment at 0x%08" PRIx32 " is not in Flash\n", segment->addr);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Erase only the blocks the image's segments actually land in. The segments are in address order,
+ * so tracking the end of the last block erased is enough to take each block at most once even when
+ * neighbouring segments share it, while the gaps between segments are left alone.
+ */
+static bool cl_image_erase(target_s *const t, const flash_image_s *const image)
+{
+	uint64_t erased_end = 0;
+	for (size_t idx = 0; idx < image->segment_count; ++idx) {
+		const flash_image_segment_s *const segment = &image->segments[idx];
+		const uint64_t segment_end = (uint64_t)segment->addr + segment->size;
+		const uint64_t erase_start = MAX((uint64_t)segment->addr, erased_end);
+		if (erase_start >= segment_end)
+			continue;
+		if (!target_flash_erase(t, (target_addr_t)erase_start, (size_t)(segment_end - erase_start)))
+			return false;
+		const target_flash_s *const flash = target_flash_for_addr(t, (target_addr_t)(segment_end - 1U));
+		erased_end = ((segment_end - 1U) | (flash->blocksize - 1U)) + 1U;
+	}
+	return true;
+}
+
+static bool cl_image_write(target_s *const t, const flash_image_s *const image)
+{
+	for (size_t idx = 0; idx < image->segment_count; ++idx) {
+		const flash_image_segment_s *const segment = &image->segments[idx];
+		/* Buffered write cares for padding */
+		if (!target_flash_write(t, segment->addr, segment->data, segment->size))
+			return false;
+	}
+	return target_flash_complete(t);
+}
+
+static bool cl_verify_readback(
+	target_s *const t, const target_addr_t base, const uint8_t *const expected, const size_t len)
+{
+	uint8_t data[WORKSIZE];
+	for (size_t offset = 0; offset < len; offset += WORKSIZE) {
+		const size_t worksize = MIN(len - offset, WORKSIZE);
+		const target_addr_t addr = base + (target_addr_t)offset;
+		if (target_mem_read(t, data, addr, worksize)) {
+			DEBUG_WARN("Read failed at flash address 0x%08" PRIx32 "\n", addr);
+			return false;
+		}
+		if (memcmp(data, expected + offset, worksize) != 0) {
+			DEBUG_WARN("Verify failed at flash region 0x%08" PRIx32 "\n", addr);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Verify the image block by block. Where the target can compute a CRC32 on the core, only that
+ * crosses the link and is checked against the CRC of the image data; blocks whose CRC differs, or
+ * that the target can't compute a CRC for, are read back to find where they differ.
+ */
+static bool cl_image_verify(target_s *const t, const flash_image_s *const image)
+{
+	size_t blocks = 0;
+	size_t blocks_read = 0;
+	for (size_t idx = 0; idx < image->segment_count; ++idx) {
+		const flash_image_segment_s *const segment = &image->segments[idx];
+		for (size_t offset = 0; offset < segment->size; offset += CL_VERIFY_CRC_BLOCK) {
+			const size_t block_len = MIN(segment->size - offset, CL_VERIFY_CRC_BLOCK);
+			const target_addr_t addr = segment->addr + (target_addr_t)offset;
+			const uint8_t *const expected = segment->data + offset;
+			++blocks;
+			/* mem_crc32 is cleared if the target turns out not to be able to run the CRC stub */
+			uint32_t crc = 0;
+			if (t->mem_crc32 && t->mem_crc32(t, &crc, addr, block_len) &&
+				crc == generic_crc32_buffer(expected, block_len))
+				continue;
+			++blocks_read;
+			if (!cl_verify_readback(t, addr, expected, block_len))
+				return false;
+		}
+	}
+	if (blocks_read != blocks)
+		DEBUG_INFO("Verified %zu of %zu blocks by on-target CRC\n", blocks - blocks_read, blocks);
+	return true;
+}
+
+static size_t cl_image_size(const flash_image_s *const image)
+{
+	size_t size = 0;
+	for (size_t idx = 0; idx < image->segment_count; ++idx)
+		size += image->segments[idx].size;
+	return size;
+}
+
+/*
+ * Map and parse an image file, flat binaries being placed at addr and bounded to max_size bytes,
+ * and check it all lands in Flash. Whatever the outcome, release it with cl_image_close().
+ */
+static bool cl_image_open(target_s *const t, const char *const file_name, const target_addr_t addr,
+	const size_t max_size, mmap_data_s *const map, flash_image_s *const image)
+{
+	if (!bmp_mmap(file_name, map)) {
+		DEBUG_WARN("Can not map file %s. Aborting!\n", file_name);
+		return false;
+	}
+	if (!flash_image_load(image, map->data, map->size, addr)) {
+		DEBUG_WARN("Can not load image from %s. Aborting!\n", file_name);
+		return false;
+	}
+	/* ELF and Intel HEX images carry their own addresses, flat binaries go where -a says */
+	if (image->format == FLASH_IMAGE_BINARY && max_size < image->segments[0].size)
+		/* restrict to size given on command line */
+		image->segments[0].size = max_size;
+	DEBUG_INFO("Loaded %s image with %zu segment%s\n", flash_image_format_name(image->format), image->segment_count,
+		image->segment_count == 1U ? "" : "s");
+	return cl_image_check(t, image);
+}
+
+static void cl_image_close(mmap_data_s *const map, flash_image_s *const image)
+{
+	flash_image_free(image);
+	if (map->data)
+		bmp_munmap(map);
+}
+
+static void *cl_dump_writer(void *const arg)
+{
+	cl_dump_s *const dump = (cl_dump_s *)arg;
+	pthread_mutex_lock(&dump->lock);
+	while (true) {
+		while (!dump->pending && !dump->done)
+			pthread_cond_wait(&dump->changed, &dump->lock);
+		if (!dump->pending)
+			break;
+		const uint8_t *const buffer = dump->buffers[dump->tail];
+		const size_t length = dump->lengths[dump->tail];
+		pthread_mutex_unlock(&dump->lock);
+
+		bool failed = false;
+		for (size_t offset = 0; offset < length && !failed;) {
+			const ssize_t written = write(dump->fd, buffer + offset, length - offset);
+			if (written <= 0) {
+				const int error = errno;
+				DEBUG_WARN("Write to %s failed (%d): %s\n", dump->file_name, error, strerror(error));
+				failed = true;
+			} else
+				offset += (size_t)written;
+		}
+
+		pthread_mutex_lock(&dump->lock);
+		dump->tail = (dump->tail + 1U) % CL_DUMP_BUFFERS;
+		--dump->pending;
+		dump->failed |= failed;
+		pthread_cond_signal(&dump->changed);
+		if (failed)
+			break;
+	}
+	pthread_mutex_unlock(&dump->lock);
+	return NULL;
+}
+
+/*
+ * Read a block for the dump. If the whole block can't be read, fall back to smaller reads to
+ * recover as much of it as possible before the end of the readable region.
+ */
+static size_t cl_dump_read(target_s *const t, uint8_t *const buffer, const target_addr_t addr, const size_t len)
+{
+	if (!target_mem_read(t, buffer, addr, len))
+		return len;
+	size_t offset = 0;
+	while (offset < len) {
+		const size_t worksize = MIN(len - offset, WORKSIZE);
+		if (target_mem_read(t, buffer + offset, addr + (target_addr_t)offset, worksize))
+			break;
+		offset += worksize;
+	}
+	return offset;
+}
+
+/*
+ * Dump target memory to a file: reads from the probe are overlapped with writing the file out
+ * from a separate thread through a small ring of large buffers, and the throughput is reported
+ * as the dump runs.
+ */
+static bool cl_dump(target_s *const t, const int fd, const char *const file_name, const target_addr_t base,
+	const size_t size, size_t *const bytes_read)
+{
+	cl_dump_s *const dump = calloc(1, sizeof(*dump));
+	if (!dump) {
+		DEBUG_WARN("Out of memory allocating dump buffers\n");
+		return false;
+	}
+	pthread_mutex_init(&dump->lock, NULL);
+	pthread_cond_init(&dump->changed, NULL);
+	dump->fd = fd;
+	dump->file_name = file_name;
+
+	pthread_t writer;
+	if (pthread_create(&writer, NULL, cl_dump_writer, dump)) {
+		DEBUG_WARN("Could not start the dump writer thread\n");
+		pthread_cond_destroy(&dump->changed);
+		pthread_mutex_destroy(&dump->lock);
+		free(dump);
+		return false;
+	}
+
+	const uint32_t start_time = platform_time_ms();
+	uint32_t last_report = start_time;
+	size_t offset = 0;
+	while (offset < size) {
+		pthread_mutex_lock(&dump->lock);
+		while (dump->pending == CL_DUMP_BUFFERS && !dump->failed)
+			pthread_cond_wait(&dump->changed, &dump->lock);
+		const bool failed = dump->failed;
+		pthread_mutex_unlock(&dump->lock);
+		if (failed)
+			break;
+
+		/* The writer never touches the buffer at 'head' while it isn't pending */
+		const size_t worksize = MIN(size - offset, CL_DUMP_BLOCK_SIZE);
+		const target_addr_t addr = base + (target_addr_t)offset;
+		const size_t length = cl_dump_read(t, dump->buffers[dump->head], addr, worksize);
+		if (length) {
+			pthread_mutex_lock(&dump->lock);
+			dump->lengths[dump->head] = length;
+			dump->head = (dump->head + 1U) % CL_DUMP_BUFFERS;
+			++dump->pending;
+			pthread_cond_signal(&dump->changed);
+			pthread_mutex_unlock(&dump->lock);
+		}
+		offset += length;
+		if (length < worksize) {
+			DEBUG_WARN("\nRead failed at address 0x%08" PRIx32, base + (target_addr_t)offset);
+			break;
+		}
+
+		const uint32_t now = platform_time_ms();
+		if (now - last_report >= CL_DUMP_PROGRESS_MS || offset == size) {
+			last_report = now;
+			DEBUG_WARN("\r%zu/%zu kiB, %8.3fkiB/s", offset / 1024U, size / 1024U,
+				(double)offset / MAX(now - start_time, 1U));
+		}
+	}
+	DEBUG_WARN("\n");
+
+	pthread_mutex_lock(&dump->lock);
+	dump->done = true;
+	pthread_cond_signal(&dump->changed);
+	pthread_mutex_unlock(&dump->lock);
+	pthread_join(writer, NULL);
+
+	const bool result = !dump->failed;
+	pthread_cond_destroy(&dump->changed);
+	pthread_mutex_destroy(&dump->lock);
+	free(dump);
+	*bytes_read = offset;
+	return result;
+}
+
+static void cl_core_put16(uint8_t *const buffer, const size_t offset, const uint16_t value)
+{
+	buffer[offset] = value & 0xffU;
+	buffer[offset + 1U] = value >> 8U;
+}
+
+static void cl_core_put32(uint8_t *const buffer, const size_t offset, const uint32_t value)
+{
+	for (size_t idx = 0; idx < 4U; ++idx)
+		buffer[offset + idx] = (value >> (idx * 8U)) & 0xffU;
+}
+
+static bool cl_core_write(const int fd, const char *const file_name, const void *const data, const size_t length)
+{
+	if (write(fd, data, length) == (ssize_t)length)
+		return true;
+	DEBUG_WARN("Write to %s failed: %s\n", file_name, strerror(errno));
+	return false;
+}
+
+/*
+ * Write an ELF core file GDB can load alongside the program: a PT_LOAD segment for each RAM region
+ * plus, for Cortex-M, a NT_PRSTATUS note holding the core registers in the layout of an ARM Linux
+ * core. The RAM comes from the same pipelined reader as a Flash dump, so the probe is kept busy
+ * with large block reads while the file is streamed out. A region that can't be read in full is
+ * left as zeros past the failure, and the rest of the dump carries on.
+ */
+static bool cl_core_dump(target_s *const t, const char *const file_name)
+{
+	size_t regions = 0;
+	for (const target_ram_s *r = t->ram; r; r = r->next)
+		++regions;
+	const bool arm = cortexm_target(t);
+	const size_t note_offset = CL_CORE_EHDR_SIZE + ((regions + 1U) * CL_CORE_PHDR_SIZE);
+	const size_t note_size = arm ? 20U + CL_CORE_PRSTATUS_SIZE : 0U;
+	size_t data_offset = note_offset + note_size;
+
+	const int fd = open(file_name, O_TRUNC | O_CREAT | O_RDWR | O_BINARY, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		DEBUG_WARN("Error opening core file %s: %s\n", file_name, strerror(errno));
+		return false;
+	}
+
+	uint8_t header[CL_CORE_EHDR_SIZE] = {0x7fU, 'E', 'L', 'F', 1U /* 32-bit */, 1U /* LSB */, 1U /* version */};
+	cl_core_put16(header, 0x10U, CL_CORE_ET_CORE);
+	cl_core_put16(header, 0x12U, arm ? CL_CORE_EM_ARM : 0U);
+	cl_core_put32(header, 0x14U, 1U);
+	cl_core_put32(header, 0x1cU, CL_CORE_EHDR_SIZE);
+	cl_core_put16(header, 0x28U, CL_CORE_EHDR_SIZE);
+	cl_core_put16(header, 0x2aU, CL_CORE_PHDR_SIZE);
+	cl_core_put16(header, 0x2cU, (uint16_t)(regions + 1U));
+	bool result = cl_core_write(fd, file_name, header, sizeof(header));
+
+	/* The note segment first, then one segment per RAM region in the order they're written */
+	uint8_t phdr[CL_CORE_PHDR_SIZE] = {0};
+	cl_core_put32(phdr, 0x00U, CL_CORE_PT_NOTE);
+	cl_core_put32(phdr, 0x04U, note_offset);
+	cl_core_put32(phdr, 0x10U, note_size);
+	result = result && cl_core_write(fd, file_name, phdr, sizeof(phdr));
+	for (const target_ram_s *r = t->ram; r && result; r = r->next) {
+		cl_core_put32(phdr, 0x00U, CL_CORE_PT_LOAD);
+		cl_core_put32(phdr, 0x04U, data_offset);
+		cl_core_put32(phdr, 0x08U, r->start);
+		cl_core_put32(phdr, 0x0cU, r->start);
+		cl_core_put32(phdr, 0x10U, r->length);
+		cl_core_put32(phdr, 0x14U, r->length);
+		cl_core_put32(phdr, 0x18U, CL_CORE_PF_RW);
+		cl_core_put32(phdr, 0x1cU, 4U);
+		result = cl_core_write(fd, file_name, phdr, sizeof(phdr));
+		data_offset += r->length;
+	}
+
+	if (arm && result) {
+		/* prstatus carries the signal (SIGTRAP, as for a breakpoint), a PID and r0-r15 plus xPSR */
+		uint8_t note[20U + CL_CORE_PRSTATUS_SIZE] = {0};
+		cl_core_put32(note, 0U, 5U);
+		cl_core_put32(note, 4U, CL_CORE_PRSTATUS_SIZE);
+		cl_core_put32(note, 8U, CL_CORE_NT_PRSTATUS);
+		memcpy(note + 12U, "CORE", 5U);
+		uint8_t *const prstatus = note + 20U;
+		cl_core_put16(prstatus, 12U, 5U);
+		cl_core_put32(prstatus, 24U, 1U);
+		const size_t regs_size = target_regs_size(t);
+		uint32_t *const regs = calloc(1, MAX(regs_size, CL_CORE_ARM_REGS * sizeof(uint32_t)));
+		if (!regs) {
+			DEBUG_WARN("Out of memory reading registers\n");
+			result = false;
+		} else {
+			target_regs_read(t, regs);
+			for (size_t idx = 0; idx < CL_CORE_ARM_REGS; ++idx)
+				cl_core_put32(prstatus, CL_CORE_PRSTATUS_REGS + (idx * 4U), regs[idx]);
+			free(regs);
+			result = cl_core_write(fd, file_name, note, sizeof(note));
+		}
+	}
+
+	const uint32_t start_time = platform_time_ms();
+	size_t total = 0;
+	size_t offset = note_offset + note_size;
+	for (const target_ram_s *r = t->ram; r && result; r = r->next) {
+		DEBUG_INFO("Dumping RAM at 0x%08" PRIx32 " for %zu bytes\n", r->start, r->length);
+		size_t bytes_read = 0;
+		result = cl_dump(t, fd, file_name, r->start, r->length, &bytes_read);
+		if (bytes_read < r->length)
+			DEBUG_WARN("Region at 0x%08" PRIx32 " only read for %zu of %zu bytes\n", r->start, bytes_read, r->length);
+		total += bytes_read;
+		offset += r->length;
+		/* Keep each segment where its program header says, whatever was or wasn't read of the last */
+		result = result && lseek(fd, (off_t)offset, SEEK_SET) == (off_t)offset;
+	}
+	/* Extend the file over anything missing from the end of the last region */
+	if (result && ftruncate(fd, (off_t)offset) != 0)
+		result = false;
+	close(fd);
+	if (!result) {
+		DEBUG_WARN("Writing core file %s failed\n", file_name);
+		return false;
+	}
+	const uint32_t end_time = platform_time_ms();
+	DEBUG_WARN("Core dump of %zu bytes in %zu region%s written to %s, %8.3fkiB/s\n", total, regions,
+		regions == 1U ? "" : "s", file_name, (double)total / MAX(end_time - start_time, 1U));
+	return true;
+}
+
+/* Parse a number for a batch script step, which may be given in kiB or MiB with a k or M suffix */
+static bool cl_script_number(const char *const text, uint32_t *const value)
+{
+	char *end = NULL;
+	unsigned long result = strtoul(text, &end, 0);
+	if (end == text)
+		return false;
+	if (*end == 'k' || *end == 'K') {
+		result *= 1024U;
+		++end;
+	} else if (*end == 'm' || *end == 'M') {
+		result *= 1024U * 1024U;
+		++end;
+	}
+	if (*end != '\0' || result > UINT32_MAX)
+		return false;
+	*value = (uint32_t)result;
+	return true;
+}
+
+/* Write (erasing just the blocks it covers) or verify an image file, flat binaries going to addr */
+static bool cl_script_image(target_s *const t, const char *const file_name, const target_addr_t addr, const bool write)
+{
+	mmap_data_s map = {};
+	flash_image_s image = {};
+	bool result = cl_image_open(t, file_name, addr, SIZE_MAX, &map, &image);
+	const size_t image_size = cl_image_size(&image);
+	const uint32_t start_time = platform_time_ms();
+	if (result && write) {
+		result = cl_image_erase(t, &image) && cl_image_write(t, &image);
+		if (!result)
+			DEBUG_WARN("Flashing %s failed!\n", file_name);
+	} else if (result)
+		result = cl_image_verify(t, &image);
+	if (result) {
+		const uint32_t end_time = platform_time_ms();
+		DEBUG_INFO("%s %zu bytes, %8.3fkiB/s\n", write ? "Flashed" : "Verified", image_size,
+			(double)image_size / MAX(end_time - start_time, 1U));
+	}
+	cl_image_close(&map, &image);
+	return result;
+}
+
+static bool cl_script_read(
+	target_s *const t, const char *const file_name, const target_addr_t addr, const size_t length)
+{
+	const int fd = open(file_name, O_TRUNC | O_CREAT | O_RDWR | O_BINARY, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		DEBUG_WARN("Error opening %s for read: %s\n", file_name, strerror(errno));
+		return false;
+	}
+	size_t bytes_read = 0;
+	const bool result = cl_dump(t, fd, file_name, addr, length, &bytes_read);
+	close(fd);
+	return result;
+}
+
+/* Run one step of a batch script, already split into words, with line being the untouched step text */
+static bool cl_script_step(target_s *const t, char *const line, const size_t argc, char **const argv)
+{
+	const char *const step = argv[0];
+	uint32_t addr = 0;
+	uint32_t value = 0;
+	if (strcmp(step, "monitor") == 0 && argc > 1U) {
+		/* Hand over everything after the step name as-is, so arguments keep their spacing */
+		char *command = line + strlen(step);
+		while (isspace((unsigned char)*command))
+			++command;
+		if (command_process(t, command) != 0) {
+			DEBUG_WARN("Command \"%s\" failed\n", command);
+			return false;
+		}
+		return true;
+	}
+	if (strcmp(step, "erase") == 0 && argc == 3U && cl_script_number(argv[1], &addr) &&
+		cl_script_number(argv[2], &value)) {
+		if (!target_flash_erase(t, addr, value)) {
+			DEBUG_WARN("Erasure failed!\n");
+			return false;
+		}
+		return true;
+	}
+	if ((strcmp(step, "write") == 0 || strcmp(step, "verify") == 0) && (argc == 2U || argc == 3U)) {
+		addr = UINT32_MAX;
+		for (const target_flash_s *f = t->flash; f; f = f->next)
+			addr = MIN(addr, f->start);
+		if (argc == 3U && !cl_script_number(argv[2], &addr))
+			return false;
+		return cl_script_image(t, argv[1], addr, step[0] == 'w');
+	}
+	if (strcmp(step, "read") == 0 && argc == 4U && cl_script_number(argv[2], &addr) &&
+		cl_script_number(argv[3], &value))
+		return cl_script_read(t, argv[1], addr, value);
+	if (strcmp(step, "reset") == 0 && argc == 1U) {
+		target_reset(t);
+		return true;
+	}
+	if (strcmp(step, "delay") == 0 && argc == 2U && cl_script_number(argv[1], &value)) {
+		platform_delay(value);
+		return true;
+	}
+	DEBUG_WARN("Unknown or malformed step \"%s\"\n", line);
+	return false;
+}
+
+/*
+ * Run a batch script against the attached target, one step per line, stopping at the first that
+ * fails. This saves scanning for and attaching to the target again for every operation. Steps are:
+ *   erase ADDR LENGTH           Erase the Flash blocks covering the range
+ *   write FILE [ADDR]           Erase and program an image, flat binaries at ADDR (default start of Flash)
+ *   verify FILE [ADDR]          Verify the Flash against an image
+ *   read FILE ADDR LENGTH       Read memory out to a file
+ *   monitor COMMAND...          Run a monitor command, such as for option bytes or erase_mass
+ *   reset                       Reset the target
+ *   delay MS                    Wait for the given number of milliseconds
+ * Blank lines and lines starting with '#' are skipped.
+ */
+static bool cl_script_run(target_s *const t, const char *const file_name)
+{
+	FILE *const script = strcmp(file_name, "-") == 0 ? stdin : fopen(file_name, "r");
+	if (!script) {
+		DEBUG_WARN("Error opening script %s: %s\n", file_name, strerror(errno));
+		return false;
+	}
+	const uint32_t start_time = platform_time_ms();
+	char line[CL_SCRIPT_LINE_MAX];
+	size_t line_number = 0;
+	size_t steps = 0;
+	bool result = true;
+	while (result && fgets(line, sizeof(line), script)) {
+		++line_number;
+		line[strcspn(line, "\r\n")] = '\0';
+		char *text = line;
+		while (isspace((unsigned char)*text))
+			++text;
+		if (!*text || *text == '#')
+			continue;
+
+		/* Split a copy into words, keeping the line itself intact for monitor commands */
+		char words[CL_SCRIPT_LINE_MAX];
+		strcpy(words, text);
+		char *argv[CL_SCRIPT_ARGS_MAX + 1U];
+		size_t argc = 0;
+		for (char *word = strtok(words, " \t"); word && argc <= CL_SCRIPT_ARGS_MAX; word = strtok(NULL, " \t"))
+			argv[argc++] = word;
+
+		DEBUG_INFO("%s:%zu: %s\n", file_name, line_number, text);
+		result = cl_script_step(t, text, argc, argv);
+		if (!result)
+			DEBUG_WARN("%s:%zu: step failed, stopping\n", file_name, line_number);
+		++steps;
+	}
+	if (script != stdin)
+		fclose(script);
+	if (result) {
+		const uint32_t end_time = platform_time_ms();
+		DEBUG_WARN("Script %s completed %zu step%s in %" PRIu32 "ms\n", file_name, steps, steps == 1U ? "" : "s",
+			end_time - start_time);
+	}
+	return result;
+}
+
 int cl_execute(bmda_cli_options_s *opt)
 {
 	int num_targets;
@@ -459,6 +1250,11 @@ found_targets:
 		res = -1;
 		goto target_detach;
 	}
+	/* The algorithm's Flash regions have to be in place before the memory map is looked at */
+	if (opt->opt_flm_file && !flm_load(t, opt->opt_flm_file)) {
+		res = -1;
+		goto target_detach;
+	}
 
 	/* List each defined RAM region */
 	size_t ram_regions = 0;
@@ -500,6 +1296,9 @@ found_targets:
 		}
 	}
 
+	/* The benchmark only touches Flash contents when explicitly told where */
+	const bool bench_flash = opt->opt_flash_start != 0xffffffffU;
+	const size_t bench_flash_size = opt->opt_flash_size;
 	if (opt->opt_flash_start == 0xffffffffU)
 		opt->opt_flash_start = lowest_flash_start;
 	if (opt->opt_flash_size == 0xffffffffU && opt->opt_mode != BMP_MODE_FLASH_WRITE &&
@@ -523,14 +1322,38 @@ found_targets:
 	}
 	if (opt->opt_mode == BMP_MODE_TEST || opt->opt_mode == BMP_MODE_SWJ_TEST)
 		goto target_detach;
+	if (opt->opt_mode == BMP_MODE_CORE_DUMP) {
+		if (!cl_core_dump(t, opt->opt_core_file))
+			res = -1;
+		goto target_detach;
+	}
+	if (opt->opt_mode == BMP_MODE_BENCH) {
+		size_t flash_length = 0;
+		if (bench_flash) {
+			const target_flash_s *const f = target_flash_for_addr(t, opt->opt_flash_start);
+			if (bench_flash_size != 0xffffffffU)
+				flash_length = bench_flash_size;
+			else if (f)
+				flash_length = f->blocksize;
+		}
+		if (!bench_run(t, opt->opt_flash_start, flash_length))
+			res = -1;
+		goto target_detach;
+	}
+
+	if (opt->opt_mode == BMP_MODE_SCRIPT) {
+		if (!cl_script_run(t, opt->opt_script_file))
+			res = -1;
+		goto target_detach;
+	}
 
 	mmap_data_s map = {};
+	flash_image_s image = {};
 	if (opt->opt_mode == BMP_MODE_FLASH_WRITE || opt->opt_mode == BMP_MODE_FLASH_VERIFY ||
 		opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY) {
-		if (!bmp_mmap(opt->opt_flash_file, &map)) {
-			DEBUG_WARN("Can not map file: %s. Aborting!\n", strerror(errno));
+		if (!cl_image_open(t, opt->opt_flash_file, opt->opt_flash_start, opt->opt_flash_size, &map, &image)) {
 			res = -1;
-			goto target_detach;
+			goto free_map;
 		}
 	} else if (opt->opt_mode == BMP_MODE_FLASH_READ) {
 		/* Open as binary */
@@ -541,14 +1364,12 @@ found_targets:
 			goto target_detach;
 		}
 	}
-	if (opt->opt_flash_size < map.size)
-		/* restrict to size given on command line */
-		map.size = opt->opt_flash_size;
 	if (opt->opt_monitor) {
 		res = command_process(t, opt->opt_monitor);
 		if (res)
 			DEBUG_WARN("Command \"%s\" failed\n", opt->opt_monitor);
 	}
+	const size_t image_size = cl_image_size(&image);
 	if (opt->opt_mode == BMP_MODE_RESET)
 		target_reset(t);
 	else if (opt->opt_mode == BMP_MODE_FLASH_ERASE) {
@@ -560,84 +1381,53 @@ found_targets:
 		}
 		target_reset(t);
 	} else if (opt->opt_mode == BMP_MODE_FLASH_WRITE || opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY) {
-		DEBUG_INFO("Erasing  %zu bytes at 0x%08" PRIx32 "\n", map.size, opt->opt_flash_start);
+		DEBUG_INFO("Erasing for %zu bytes in %zu segment%s\n", image_size, image.segment_count,
+			image.segment_count == 1U ? "" : "s");
 		const uint32_t start_time = platform_time_ms();
-		if (!target_flash_erase(t, opt->opt_flash_start, map.size)) {
+		if (!cl_image_erase(t, &image)) {
 			DEBUG_WARN("Erasure failed!\n");
 			res = -1;
 			goto free_map;
 		}
-		DEBUG_INFO("Flashing %zu bytes at 0x%08" PRIx32 "\n", map.size, opt->opt_flash_start);
-		/* Buffered write cares for padding*/
-		if (!target_flash_write(t, opt->opt_flash_start, map.data, map.size) || !target_flash_complete(t)) {
+		DEBUG_INFO("Flashing %zu bytes\n", image_size);
+		/* Verifying each chunk as the next is programmed saves a separate readback pass afterwards */
+		target_flash_verify = opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY;
+		if (!cl_image_write(t, &image)) {
 			DEBUG_WARN("Flashing failed!\n");
 			res = -1;
 			goto free_map;
 		}
 		DEBUG_INFO("Success!\n");
 		const uint32_t end_time = platform_time_ms();
-		DEBUG_WARN(
-			"Flash Write succeeded for %zu bytes, %8.3fkiB/s\n", map.size, (double)map.size / (end_time - start_time));
-		if (opt->opt_mode != BMP_MODE_FLASH_WRITE_VERIFY) {
-			target_reset(t);
+		DEBUG_WARN("Flash Write%s succeeded for %zu bytes, %8.3fkiB/s\n",
+			target_flash_verify ? " and Verify" : "", image_size, (double)image_size / (end_time - start_time));
+		target_reset(t);
+		goto free_map;
+	}
+	if (opt->opt_mode == BMP_MODE_FLASH_VERIFY) {
+		const uint32_t start_time = platform_time_ms();
+		if (!cl_image_verify(t, &image)) {
+			res = -1;
 			goto free_map;
 		}
-	}
-	if (opt->opt_mode == BMP_MODE_FLASH_READ || opt->opt_mode == BMP_MODE_FLASH_VERIFY ||
-		opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY) {
-#define WORKSIZE 0x1000U
-		uint8_t data[WORKSIZE];
-		if (opt->opt_mode == BMP_MODE_FLASH_READ)
-			DEBUG_INFO("Reading flash from 0x%08" PRIx32 " for %zu bytes to %s\n", opt->opt_flash_start,
-				opt->opt_flash_size, opt->opt_flash_file);
-		const uint32_t flash_src = opt->opt_flash_start;
-		const size_t size = opt->opt_mode == BMP_MODE_FLASH_READ ? opt->opt_flash_size : map.size;
+		const uint32_t end_time = platform_time_ms();
+		DEBUG_WARN("Read/Verify succeeded for %zu bytes, %8.3fkiB/s\n", image_size,
+			(double)image_size / (end_time - start_time));
+	} else if (opt->opt_mode == BMP_MODE_FLASH_READ) {
+		DEBUG_INFO("Reading flash from 0x%08" PRIx32 " for %zu bytes to %s\n", opt->opt_flash_start,
+			opt->opt_flash_size, opt->opt_flash_file);
 		size_t bytes_read = 0;
-		uint8_t *flash = (uint8_t *)map.data;
 		const uint32_t start_time = platform_time_ms();
-		for (size_t offset = 0; offset < size; offset += WORKSIZE) {
-			const size_t worksize = MIN(size - offset, WORKSIZE);
-			int n_read = target_mem_read(t, data, flash_src + offset, worksize);
-			if (n_read) {
-				if (opt->opt_flash_size == 0) /* we reached end of flash */
-					DEBUG_INFO("Reached end of flash at size %" PRId32 "\n", flash_src - opt->opt_flash_start);
-				else
-					DEBUG_WARN("Read failed at flash address 0x%08" PRIx32 "\n", flash_src);
-				break;
-			}
-			bytes_read += worksize;
-			if (opt->opt_mode == BMP_MODE_FLASH_VERIFY || opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY) {
-				if (memcmp(data, flash + offset, worksize) != 0) {
-					DEBUG_WARN("Verify failed at flash region 0x%08" PRIx32 "\n", flash_src);
-					res = -1;
-					goto free_map;
-				}
-			} else if (read_file != -1) {
-				const ssize_t written = write(read_file, data, worksize);
-				if (written < 0) {
-					const int error = errno;
-					DEBUG_INFO("Write to %s failed (%d): %s\n", opt->opt_flash_file, error, strerror(error));
-					res = -1;
-					goto free_map;
-				}
-				if ((size_t)written < worksize) {
-					DEBUG_WARN("Read failed at flash region 0x%08" PRIx32 "\n", flash_src);
-					res = -1;
-					goto free_map;
-				}
-			}
+		if (!cl_dump(t, read_file, opt->opt_flash_file, opt->opt_flash_start, opt->opt_flash_size, &bytes_read)) {
+			res = -1;
+			goto free_map;
 		}
 		const uint32_t end_time = platform_time_ms();
-		if (read_file != -1)
-			close(read_file);
 		DEBUG_WARN("Read/Verify succeeded for %zu bytes, %8.3fkiB/s\n", bytes_read,
 			(double)bytes_read / (end_time - start_time));
-		if (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)
-			target_reset(t);
 	}
 free_map:
-	if (map.size)
-		bmp_munmap(&map);
+	cl_image_close(&map, &image);
 target_detach:
 	if (read_file != -1)
 		close(read_file);
@@ -646,3 +1436,84 @@ target_detach:
 	target_list_free();
 	return res;
 }
+
+/*
+ * Gang programming: run the Flash operation on every probe in the list at the same time. All the
+ * probe and target state in BMDA is global, so each probe gets its own child process. This
+ * returns in each child with the options narrowed down to that child's probe, while the parent
+ * waits for them all to finish, reports the results and exits.
+ */
+void cl_gang_run(bmda_cli_options_s *const opt)
+{
+	if (opt->opt_mode == BMP_MODE_DEBUG || opt->opt_mode == BMP_MODE_SWO_DECODE || opt->opt_mode == BMP_MODE_MONITOR ||
+		opt->opt_mode == BMP_MODE_CORE_DUMP) {
+		DEBUG_WARN("Gang mode needs a Flash, test or reset operation\n");
+		exit(1);
+	}
+#if defined(_WIN32)
+	DEBUG_WARN("Gang mode is not supported on Windows\n");
+	exit(1);
+#else
+	/* Work out which probes to use: either the first however many, or a list of serial numbers */
+	const char *probe_serial[CL_GANG_MAX_PROBES] = {NULL};
+	size_t probes = 0;
+	char *end = NULL;
+	const unsigned long count = strtoul(opt->opt_gang, &end, 0);
+	if (*end == '\0')
+		probes = MIN(count, CL_GANG_MAX_PROBES);
+	else {
+		for (char *serial = strtok(opt->opt_gang, ","); serial && probes < CL_GANG_MAX_PROBES;
+			 serial = strtok(NULL, ","))
+			probe_serial[probes++] = serial;
+	}
+	if (!probes) {
+		DEBUG_WARN("No probes given for gang mode\n");
+		exit(1);
+	}
+
+	pid_t children[CL_GANG_MAX_PROBES];
+	for (size_t i = 0; i < probes; ++i) {
+		children[i] = fork();
+		if (children[i] == 0) {
+			/* In the child, carry on as if only this probe had been asked for */
+			opt->opt_gang = NULL;
+			if (probe_serial[i])
+				opt->opt_serial = (char *)probe_serial[i];
+			else
+				opt->opt_position = i + 1U;
+			return;
+		}
+		if (children[i] == -1)
+			DEBUG_WARN("Could not start a process for probe %zu: %s\n", i + 1U, strerror(errno));
+	}
+
+	int status[CL_GANG_MAX_PROBES];
+	bool finished[CL_GANG_MAX_PROBES];
+	for (size_t i = 0; i < probes; ++i)
+		finished[i] = children[i] != -1 && waitpid(children[i], &status[i], 0) != -1;
+
+	size_t failures = 0;
+
+	DEBUG_WARN("\nGang results:\n");
+	for (size_t i = 0; i < probes; ++i) {
+		char probe[32];
+		if (probe_serial[i])
+			snprintf(probe, sizeof(probe), "%s", probe_serial[i]);
+		else
+			snprintf(probe, sizeof(probe), "%zu", i + 1U);
+		if (finished[i] && WIFEXITED(status[i]) && WEXITSTATUS(status[i]) == 0)
+			DEBUG_WARN("  %-24s OK\n", probe);
+		else {
+			++failures;
+			if (!finished[i])
+				DEBUG_WARN("  %-24s FAILED (not run)\n", probe);
+			else if (WIFEXITED(status[i]))
+				DEBUG_WARN("  %-24s FAILED (exit status %d)\n", probe, WEXITSTATUS(status[i]));
+			else
+				DEBUG_WARN("  %-24s FAILED (killed by signal %d)\n", probe, WTERMSIG(status[i]));
+		}
+	}
+	DEBUG_WARN("%zu of %zu probes succeeded\n", probes - failures, probes);
+	exit(failures ? 1 : 0);
+#endif
+}
@@ -38,6 +38,10 @@ typedef enum bmda_cli_mode {
 	BMP_MODE_FLASH_VERIFY,
 	BMP_MODE_SWJ_TEST,
 	BMP_MODE_MONITOR,
+	BMP_MODE_SWO_DECODE,
+	BMP_MODE_BENCH,
+	BMP_MODE_CORE_DUMP,
+	BMP_MODE_SCRIPT,
 } bmda_cli_mode_e;
 
 typedef enum bmp_scan_mode {
@@ -54,25 +58,46 @@ typedef struct bmda_cli_options {
 	bool opt_connect_under_reset;
 	bool external_resistor_swd;
 	bool fast_poll;
+	bool opt_perf;
 	bool opt_no_hl;
+	bool opt_flash_incremental;
+	bool opt_frequency_set;
+	bool opt_reconnect;
 	char *opt_flash_file;
+	char *opt_flm_file;
 	char *opt_device;
 	char *opt_serial;
+	char *opt_usb_path;
 	uint32_t opt_targetid;
 	char *opt_ident_string;
 	size_t opt_position;
 	char *opt_cable;
 	char *opt_monitor;
+	char *opt_swo_file;
+	const char *opt_tpiu_prefix;
+	char *opt_rtt_output;
+	size_t opt_gdb_ports;
+	char *opt_gang;
+	uint16_t opt_probe_server;
+	char *opt_ipc_socket;
+	char *opt_core_file;
+	char *opt_script_file;
 	int opt_debuglevel;
 	int opt_target_dev;
 	uint32_t opt_flash_start;
 	uint32_t opt_max_swj_frequency;
+	uint32_t opt_swo_baudrate;
+	uint8_t opt_tpiu_id;
 	size_t opt_flash_size;
 } bmda_cli_options_s;
 
 void cl_init(bmda_cli_options_s *opt, int argc, char **argv);
 int cl_execute(bmda_cli_options_s *opt);
+void cl_gang_run(bmda_cli_options_s *opt);
 int serial_open(const bmda_cli_options_s *opt, const char *serial);
 void serial_close(void);
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+int serial_fd(void);
+#endif
 
 #endif /* PLATFORMS_HOSTED_CLI_H */
@@ -67,6 +67,9 @@
 #include "bmp_hosted.h"
 #include "dap.h"
 #include "cmsis_dap.h"
+#include "swo_decode.h"
+#include "gdb_perf.h"
+#include "probe_stats.h"
 
 #include "cli.h"
 #include "target.h"
@@ -94,11 +97,50 @@ static cmsis_type_e type;
 static libusb_device_handle *usb_handle = NULL;
 static uint8_t in_ep;
 static uint8_t out_ep;
+static uint8_t swo_ep;
 static hid_device *handle = NULL;
 static uint8_t buffer[1024U];
-static size_t report_size = 64U + 1U; // TODO: read actual report size
+/* For HID this includes the report ID byte, and is updated from the adaptor's packet size once connected */
+static size_t report_size = 64U + 1U;
+static bool report_size_fixed = false;
 static bool has_swd_sequence = false;
 
+/*
+ * Bulk probes can have as many commands in flight as they advertise buffers for (DAP_Info packet count).
+ * Each pipeline slot holds a copy of its request and the raw response, including the command byte.
+ */
+#define DAP_PIPELINE_DEPTH USB_TRANSFER_RING_DEPTH
+
+static usb_link_s bulk_link;
+static usb_transfer_ring_s request_ring;
+static usb_transfer_ring_s response_ring;
+static bool pipeline_async = false;
+static bool pipeline_hid = false;
+static size_t pipeline_depth = 1U;
+static size_t pipeline_head = 0U;
+static size_t pipeline_count = 0U;
+static uint8_t pipeline_requests[DAP_PIPELINE_DEPTH][sizeof(buffer)];
+static uint8_t pipeline_responses[DAP_PIPELINE_DEPTH][sizeof(buffer)];
+static ssize_t pipeline_results[DAP_PIPELINE_DEPTH];
+
+/*
+ * SWO capture state. Probes with a dedicated SWO endpoint have a ring of reads kept queued on it so
+ * the trace streams in alongside the debug traffic, while the rest are polled with DAP_SWO_Data.
+ */
+#define DAP_SWO_TRANSFER_SIZE 4096U
+
+typedef struct dap_swo {
+	bool streaming;
+	uint8_t status;
+	usb_transfer_ring_s ring;
+	uint8_t transfer_buffer[USB_TRANSFER_RING_DEPTH][DAP_SWO_TRANSFER_SIZE];
+} dap_swo_s;
+
+static dap_swo_s *dap_swo;
+
+static ssize_t dap_run_cmd_raw(
+	const uint8_t *request_data, size_t request_length, uint8_t *response_data, size_t response_length);
+
 static size_t mbslen(const char *str)
 {
 	const char *const end = str + strlen(str);
@@ -172,6 +214,7 @@ static bool dap_init_hid(const bmp_info_s *const info)
 	if (info->vid == 0x1fc9U && info->pid == 0x0132U) {
 		DEBUG_WARN("Blacklist\n");
 		report_size = 64U + 1U;
+		report_size_fixed = true;
 	}
 	handle = hid_open(info->vid, info->pid, serial[0] ? serial : NULL);
 	if (!handle) {
@@ -199,9 +242,48 @@ static bool dap_init_bulk(const bmp_info_s *const info)
 	}
 	in_ep = info->in_ep;
 	out_ep = info->out_ep;
+	swo_ep = info->swo_ep;
+	bulk_link.ul_libusb_ctx = info->libusb_ctx;
+	bulk_link.ul_libusb_device_handle = usb_handle;
+	bulk_link.interface = info->interface_num;
+	bulk_link.ep_tx = out_ep;
+	bulk_link.ep_rx = in_ep;
 	return true;
 }
 
+static void dap_init_pipeline(void)
+{
+	/*
+	 * The packet size is how much the probe can take in a single command, which can exceed 64 bytes.
+	 * HID reports carry it after the report ID byte.
+	 */
+	uint8_t packet_size[2] = {0};
+	if (!report_size_fixed && dap_info(DAP_INFO_PACKET_SIZE, packet_size, sizeof(packet_size)) == sizeof(packet_size)) {
+		const size_t size = packet_size[0] | ((size_t)packet_size[1] << 8U);
+		if (size > 64U)
+			report_size = MIN(size + (type == CMSIS_TYPE_HID ? 1U : 0U), sizeof(buffer));
+	}
+	uint8_t packet_count = 0;
+	if (!dap_info(DAP_INFO_PACKET_COUNT, &packet_count, sizeof(packet_count)) || packet_count < 2U)
+		return;
+	/* HID reports are written straight out, the adaptor buffering as many as its packet count */
+	if (type == CMSIS_TYPE_HID) {
+		pipeline_depth = MIN(packet_count, DAP_PIPELINE_DEPTH);
+		pipeline_hid = true;
+		DEBUG_INFO("Report size %zu, pipelining %zu reports\n", report_size, pipeline_depth);
+		return;
+	}
+	if (!usb_transfer_ring_init(&request_ring, &bulk_link, out_ep))
+		return;
+	if (!usb_transfer_ring_init(&response_ring, &bulk_link, in_ep)) {
+		usb_transfer_ring_free(&request_ring);
+		return;
+	}
+	pipeline_depth = MIN(packet_count, DAP_PIPELINE_DEPTH);
+	pipeline_async = true;
+	DEBUG_INFO("Packet size %zu, pipelining %zu packets\n", report_size, pipeline_depth);
+}
+
 /* LPC845 Breakout Board Rev. 0 report invalid response with > 65 bytes */
 int dap_init(bmp_info_s *info)
 {
@@ -244,6 +326,7 @@ int dap_init(bmp_info_s *info)
 	if (has_swd_sequence)
 		DEBUG_INFO(", DAP_SWD_Sequence");
 	DEBUG_INFO("\n");
+	dap_init_pipeline();
 	return 0;
 }
 
@@ -343,17 +426,23 @@ void dap_exit_function(void)
 		if (handle) {
 			dap_disconnect();
 			hid_close(handle);
+			handle = NULL;
 		}
 	} else if (type == CMSIS_TYPE_BULK) {
 		if (usb_handle) {
 			dap_disconnect();
+			if (pipeline_async) {
+				usb_transfer_ring_free(&request_ring);
+				usb_transfer_ring_free(&response_ring);
+				pipeline_async = false;
+			}
 			libusb_close(usb_handle);
+			usb_handle = NULL;
 		}
 	}
 }
 
-ssize_t dbg_dap_cmd_hid(const uint8_t *const request_data, const size_t request_length, uint8_t *const response_data,
-	const size_t response_length)
+static void dap_hid_write(const uint8_t *const request_data, const size_t request_length)
 {
 	if (request_length + 1U > report_size) {
 		DEBUG_WARN(
@@ -368,23 +457,36 @@ ssize_t dbg_dap_cmd_hid(const uint8_t *const request_data, const size_t request_
 	const int result = hid_write(handle, buffer, report_size);
 	if (result < 0) {
 		DEBUG_WARN("CMSIS-DAP write error: %ls\n", hid_error(handle));
+		platform_probe_lost();
 		exit(-1);
 	}
+}
 
+/* Read the response to the command given, skipping any stale responses left over from before */
+static int dap_hid_read(uint8_t *const response_data, const size_t response_length, const uint8_t command)
+{
 	int response = 0;
 	do {
 		response = hid_read_timeout(handle, response_data, response_length, 1000);
 		if (response < 0) {
 			DEBUG_WARN("CMSIS-DAP read error: %ls\n", hid_error(handle));
+			platform_probe_lost();
 			exit(-1);
 		} else if (response == 0) {
 			DEBUG_WARN("CMSIS-DAP read timeout\n");
 			exit(-1);
 		}
-	} while (response_data[0] != request_data[0]);
+	} while (response_data[0] != command);
 	return response;
 }
 
+ssize_t dbg_dap_cmd_hid(const uint8_t *const request_data, const size_t request_length, uint8_t *const response_data,
+	const size_t response_length)
+{
+	dap_hid_write(request_data, request_length);
+	return dap_hid_read(response_data, response_length, request_data[0]);
+}
+
 ssize_t dbg_dap_cmd_bulk(const uint8_t *const request_data, const size_t request_length, uint8_t *const response_data,
 	const size_t response_length)
 {
@@ -411,26 +513,34 @@ ssize_t dbg_dap_cmd_bulk(const uint8_t *const request_data, const size_t request
 static ssize_t dap_run_cmd_raw(const uint8_t *const request_data, const size_t request_length,
 	uint8_t *const response_data, const size_t response_length)
 {
-	DEBUG_WIRE(" command: ");
-	for (size_t i = 0; i < request_length; ++i)
-		DEBUG_WIRE("%02x ", request_data[i]);
-	DEBUG_WIRE("\n");
+	if (DEBUG_LEVEL_ENABLED(BMP_DEBUG_WIRE)) {
+		DEBUG_WIRE(" command: ");
+		for (size_t i = 0; i < request_length; ++i)
+			DEBUG_WIRE("%02x ", request_data[i]);
+		DEBUG_WIRE("\n");
+	}
 
-	uint8_t data[65];
+	uint8_t data[sizeof(buffer)];
 
 	ssize_t response = -1;
+	PROBE_STATS_COUNT(usb_packets_sent);
+	PROBE_STATS_COUNT(usb_packets_received);
+	const uint64_t start = gdb_perf_timestamp();
 	if (type == CMSIS_TYPE_HID)
 		response = dbg_dap_cmd_hid(request_data, request_length, data, report_size);
 	else if (type == CMSIS_TYPE_BULK)
 		response = dbg_dap_cmd_bulk(request_data, request_length, data, report_size);
+	gdb_perf_transport(start);
 	if (response < 0)
 		return response;
 	const size_t result = (size_t)response;
 
-	DEBUG_WIRE("response: ");
-	for (size_t i = 0; i < result; i++)
-		DEBUG_WIRE("%02x ", data[i]);
-	DEBUG_WIRE("\n");
+	if (DEBUG_LEVEL_ENABLED(BMP_DEBUG_WIRE)) {
+		DEBUG_WIRE("response: ");
+		for (size_t i = 0; i < result; i++)
+			DEBUG_WIRE("%02x ", data[i]);
+		DEBUG_WIRE("\n");
+	}
 
 	if (response_length)
 		memcpy(response_data, data + 1, MIN(response_length, result));
@@ -451,8 +561,140 @@ ssize_t dbg_dap_cmd(uint8_t *const data, const size_t response_length, const siz
 	return dap_run_cmd_raw(data, request_length, data, response_length);
 }
 
+size_t dap_pipeline_depth(void)
+{
+	return pipeline_depth;
+}
+
+static void dap_pipeline_abort(void)
+{
+	usb_transfer_ring_cancel(&request_ring);
+	usb_transfer_ring_cancel(&response_ring);
+	pipeline_head = 0U;
+	pipeline_count = 0U;
+}
+
+/*
+ * Queue a command with the probe without waiting for its response, which must then be picked up
+ * with dap_collect_cmd(). Without asynchronous transfers to use, the command is run immediately
+ * and its response parked until collected, so callers need not care which they got.
+ */
+bool dap_submit_cmd(const void *const request_data, const size_t request_length)
+{
+	if (pipeline_count == pipeline_depth || request_length > dap_packet_size())
+		return false;
+	const size_t slot = (pipeline_head + pipeline_count) % DAP_PIPELINE_DEPTH;
+	uint8_t *const request = pipeline_requests[slot];
+	memcpy(request, request_data, request_length);
+
+	if (pipeline_hid)
+		dap_hid_write(request, request_length);
+	else if (!pipeline_async) {
+		/* dap_run_cmd_raw() strips the command byte, so put it back to match the asynchronous path */
+		pipeline_responses[slot][0] = request[0];
+		pipeline_results[slot] =
+			dap_run_cmd_raw(request, request_length, pipeline_responses[slot] + 1U, report_size - 1U);
+	} else if (usb_transfer_ring_submit(&response_ring, pipeline_responses[slot], report_size) ||
+		usb_transfer_ring_submit(&request_ring, request, request_length)) {
+		dap_pipeline_abort();
+		return false;
+	}
+	++pipeline_count;
+	return true;
+}
+
+/* Retrieve the response to the oldest outstanding command, stripped of its command byte as with dap_run_cmd() */
+bool dap_collect_cmd(void *const response_data, const size_t response_length)
+{
+	if (!pipeline_count)
+		return false;
+	const size_t slot = pipeline_head;
+	pipeline_head = (pipeline_head + 1U) % DAP_PIPELINE_DEPTH;
+	--pipeline_count;
+
+	const uint8_t *const response = pipeline_responses[slot];
+	ssize_t result = pipeline_results[slot];
+	if (pipeline_hid)
+		result = dap_hid_read(pipeline_responses[slot], report_size, pipeline_requests[slot][0]);
+	else if (pipeline_async) {
+		result = usb_transfer_ring_wait(&request_ring) < 0 ? -1 : usb_transfer_ring_wait(&response_ring);
+		/* A response for a different command means we're out of step with the probe, so give up on the rest */
+		if (result < 1 || response[0] != pipeline_requests[slot][0]) {
+			DEBUG_WARN("CMSIS-DAP pipelined command %02x failed\n", pipeline_requests[slot][0]);
+			dap_pipeline_abort();
+			return false;
+		}
+	}
+	if (result < 1)
+		return false;
+	const size_t length = (size_t)result - 1U;
+	if (response_length)
+		memcpy(response_data, response + 1U, MIN(response_length, length));
+	return length >= response_length;
+}
+
+/* Maximum length of a single command or response, which for HID excludes the report ID */
+size_t dap_packet_size(void)
+{
+	return type == CMSIS_TYPE_HID ? report_size - 1U : report_size;
+}
+
 #define ALIGNOF(x) (((x)&3) == 0 ? ALIGN_WORD : (((x)&1) == 0 ? ALIGN_HALFWORD : ALIGN_BYTE))
 
+/*
+ * A memory access is broken down into a sequence of operations: an AP_TAR setup at the start and at
+ * every 1024 byte boundary (as failing to do so results in it wrapping), and the block transfers in
+ * between, each sized to fit a packet. These are all queued up with the probe as deep as it allows.
+ */
+typedef struct dap_mem_op {
+	uint32_t addr;
+	/* Number of bytes transferred by this operation, or 0 for an AP_TAR setup */
+	size_t length;
+} dap_mem_op_s;
+
+typedef struct dap_mem_op_ring {
+	dap_mem_op_s ops[DAP_PIPELINE_DEPTH];
+	size_t head;
+	size_t count;
+} dap_mem_op_ring_s;
+
+static dap_mem_op_s dap_mem_next_op(
+	const uint32_t addr, const size_t remaining, const size_t blocks_per_transfer, const align_e align, bool *const setup)
+{
+	dap_mem_op_s op = {addr, 0U};
+	if (*setup) {
+		*setup = false;
+		return op;
+	}
+	/* addr can be unaligned to a 1024 byte chunk, so work out how much is left of the chunk */
+	op.length = MIN(MIN(1024U - (addr & 0x3ffU), remaining), blocks_per_transfer << align);
+	*setup = !((addr + op.length) & 0x3ffU);
+	return op;
+}
+
+static dap_mem_op_s *dap_mem_op_push(dap_mem_op_ring_s *const ring)
+{
+	dap_mem_op_s *const op = &ring->ops[(ring->head + ring->count) % DAP_PIPELINE_DEPTH];
+	++ring->count;
+	return op;
+}
+
+static dap_mem_op_s dap_mem_op_pop(dap_mem_op_ring_s *const ring)
+{
+	const dap_mem_op_s op = ring->ops[ring->head];
+	ring->head = (ring->head + 1U) % DAP_PIPELINE_DEPTH;
+	--ring->count;
+	return op;
+}
+
+static bool dap_mem_read_collect(
+	adiv5_access_port_s *const ap, const dap_mem_op_s op, uint8_t *const data, const uint32_t src, const align_e align)
+{
+	if (!op.length)
+		return dap_ap_mem_access_setup_collect(ap);
+	return dap_read_block_collect(ap, data + (op.addr - src), op.addr, op.length, align);
+}
+
 static void dap_mem_read(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len)
 {
 	if (len == 0)
@@ -462,33 +704,48 @@ static void dap_mem_read(adiv5_access_port_s *ap, void *dest, uint32_t src, size
 	/* If the read can be done in a single transaction, use the dap_read_single() fast-path */
 	if ((1U << align) == len)
 		return dap_read_single(ap, dest, src, align);
-	/* Otherwise proceed blockwise */
-	const size_t blocks_per_transfer = (report_size - 4U) >> 2U;
+	/* Otherwise proceed blockwise, each response carrying 1 command byte and 3 header bytes before the data */
+	const size_t blocks_per_transfer = (dap_packet_size() - 4U) >> 2U;
 	uint8_t *const data = (uint8_t *)dest;
-	for (size_t offset = 0; offset < len;) {
-		/* Setup AP_TAR every loop as failing to do so results in it wrapping */
-		dap_ap_mem_access_setup(ap, src + offset, align);
-		/*
-		 * src can start out unaligned to a 1024 byte chunk size,
-		 * so we have to calculate how much is left of the chunk.
-		 * We also have to take into account how much of the chunk the caller
-		 * has requested we fill.
-		 */
-		const size_t chunk_remaining = MIN(1024 - (src & 0x3ffU), len - offset);
-		const size_t blocks = chunk_remaining >> align;
-		for (size_t i = 0; i < blocks; i += blocks_per_transfer) {
-			/* blocks - i gives how many blocks are left to transfer in this 1024 byte chunk */
-			const size_t transfer_length = MIN(blocks - i, blocks_per_transfer) << align;
-			if (!dap_read_block(ap, data + offset, src + offset, transfer_length, align)) {
-				DEBUG_WIRE("mem_read failed: %u\n", ap->dp->fault);
-				return;
-			}
-			offset += transfer_length;
-		}
+	const size_t depth = dap_pipeline_depth();
+	dap_mem_op_ring_s ring = {};
+	bool setup = true;
+	bool result = true;
+	for (size_t offset = 0; result && offset < len;) {
+		if (ring.count == depth)
+			result = dap_mem_read_collect(ap, dap_mem_op_pop(&ring), data, src, align);
+		if (!result)
+			break;
+		dap_mem_op_s *const op = dap_mem_op_push(&ring);
+		*op = dap_mem_next_op(src + offset, len - offset, blocks_per_transfer, align, &setup);
+		if (op->length)
+			result = dap_read_block_submit(ap, op->length, align);
+		else
+			result = dap_ap_mem_access_setup_submit(ap, op->addr, align);
+		offset += op->length;
+	}
+	/* Drain the pipeline, picking up the remaining responses (or aborting if any operation failed) */
+	while (ring.count) {
+		const dap_mem_op_s op = dap_mem_op_pop(&ring);
+		if (result)
+			result = dap_mem_read_collect(ap, op, data, src, align);
+		else
+			dap_collect_cmd(NULL, 0U);
+	}
+	if (!result) {
+		DEBUG_WIRE("mem_read failed: %u\n", ap->dp->fault);
+		return;
 	}
 	DEBUG_WIRE("dap_mem_read transferred %zu blocks\n", len >> align);
 }
 
+static bool dap_mem_write_collect(adiv5_access_port_s *const ap, const dap_mem_op_s op, const align_e align)
+{
+	if (!op.length)
+		return dap_ap_mem_access_setup_collect(ap);
+	return dap_write_block_collect(ap, op.length, align);
+}
+
 static void dap_mem_write(adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len, align_e align)
 {
 	if (len == 0)
@@ -497,29 +754,36 @@ static void dap_mem_write(adiv5_access_port_s *ap, uint32_t dest, const void *sr
 	/* If the write can be done in a single transaction, use the dap_write_single() fast-path */
 	if ((1U << align) == len)
 		return dap_write_single(ap, dest, src, align);
-	/* Otherwise proceed blockwise */
-	const size_t blocks_per_transfer = (report_size - 4U) >> 2U;
+	/* Otherwise proceed blockwise, each request carrying 1 command byte and 4 header bytes before the data */
+	const size_t blocks_per_transfer = (dap_packet_size() - 5U) >> 2U;
 	const uint8_t *const data = (const uint8_t *)src;
-	for (size_t offset = 0; offset < len;) {
-		/* Setup AP_TAR every loop as failing to do so results in it wrapping */
-		dap_ap_mem_access_setup(ap, dest + offset, align);
-		/*
-		 * dest can start out unaligned to a 1024 byte chunk size,
-		 * so we have to calculate how much is left of the chunk.
-		 * We also have to take into account how much of the chunk the caller
-		 * has requested we fill.
-		 */
-		const size_t chunk_remaining = MIN(1024 - (dest & 0x3ffU), len - offset);
-		const size_t blocks = chunk_remaining >> align;
-		for (size_t i = 0; i < blocks; i += blocks_per_transfer) {
-			/* blocks - i gives how many blocks are left to transfer in this 1024 byte chunk */
-			const size_t transfer_length = MIN(blocks - i, blocks_per_transfer) << align;
-			if (!dap_write_block(ap, dest + offset, data + offset, transfer_length, align)) {
-				DEBUG_WIRE("mem_write failed: %u\n", ap->dp->fault);
-				return;
-			}
-			offset += transfer_length;
-		}
+	const size_t depth = dap_pipeline_depth();
+	dap_mem_op_ring_s ring = {};
+	bool setup = true;
+	bool result = true;
+	for (size_t offset = 0; result && offset < len;) {
+		if (ring.count == depth)
+			result = dap_mem_write_collect(ap, dap_mem_op_pop(&ring), align);
+		if (!result)
+			break;
+		dap_mem_op_s *const op = dap_mem_op_push(&ring);
+		*op = dap_mem_next_op(dest + offset, len - offset, blocks_per_transfer, align, &setup);
+		if (op->length)
+			result = dap_write_block_submit(ap, op->addr, data + offset, op->length, align);
+		else
+			result = dap_ap_mem_access_setup_submit(ap, op->addr, align);
+		offset += op->length;
+	}
+	while (ring.count) {
+		const dap_mem_op_s op = dap_mem_op_pop(&ring);
+		if (result)
+			result = dap_mem_write_collect(ap, op, align);
+		else
+			dap_collect_cmd(NULL, 0U);
+	}
+	if (!result) {
+		DEBUG_WIRE("mem_write failed: %u\n", ap->dp->fault);
+		return;
 	}
 	DEBUG_WIRE("dap_mem_write_sized transferred %zu blocks\n", len >> align);
 
@@ -535,6 +799,7 @@ void dap_adiv5_dp_defaults(adiv5_debug_port_s *dp)
 	dp->ap_write = dap_ap_write;
 	dp->mem_read = dap_mem_read;
 	dp->mem_write = dap_mem_write;
+	dp->run_queue = dap_run_queue;
 }
 
 static void cmsis_dap_jtagtap_reset(void)
@@ -588,6 +853,7 @@ bool dap_jtagtap_init(void)
 	jtag_proc.jtagtap_tms_seq = cmsis_dap_jtagtap_tms_seq;
 	jtag_proc.jtagtap_tdi_tdo_seq = cmsis_dap_jtagtap_tdi_tdo_seq;
 	jtag_proc.jtagtap_tdi_seq = cmsis_dap_jtagtap_tdi_seq;
+	jtag_proc.jtagtap_ir_dr_seq = dap_jtagtap_ir_dr_seq;
 	return true;
 }
 
@@ -644,3 +910,131 @@ bool dap_swdptap_init(adiv5_debug_port_s *dp)
 	dp->abort = dap_dp_abort;
 	return true;
 }
+
+static void dap_swo_free(dap_swo_s *const swo)
+{
+	if (swo->streaming)
+		usb_transfer_ring_free(&swo->ring);
+	free(swo);
+}
+
+bool dap_swo_start(const uint32_t baudrate)
+{
+	dap_swo_mode_e swo_mode = DAP_SWO_MODE_OFF;
+	if (dap_caps & DAP_CAP_SWO_UART)
+		swo_mode = DAP_SWO_MODE_UART;
+	else if (dap_caps & DAP_CAP_SWO_MANCHESTER)
+		swo_mode = DAP_SWO_MODE_MANCHESTER;
+	else {
+		DEBUG_WARN("CMSIS-DAP adaptor does not support SWO capture\n");
+		return false;
+	}
+
+	dap_swo_s *const swo = calloc(1, sizeof(*swo));
+	if (!swo) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return false;
+	}
+	/* Stream the trace from the dedicated endpoint when the adaptor has one */
+	swo->streaming = type == CMSIS_TYPE_BULK && swo_ep && (dap_caps & DAP_CAP_SWO_STREAMING);
+	if (swo->streaming && !usb_transfer_ring_init(&swo->ring, &bulk_link, swo_ep)) {
+		free(swo);
+		return false;
+	}
+
+	const dap_swo_transport_e transport = swo->streaming ? DAP_SWO_TRANSPORT_ENDPOINT : DAP_SWO_TRANSPORT_DATA_COMMAND;
+	if (!dap_swo_transport(transport) || !dap_swo_mode(swo_mode)) {
+		DEBUG_WARN("CMSIS-DAP adaptor rejected the SWO configuration\n");
+		dap_swo_free(swo);
+		return false;
+	}
+	const uint32_t actual_baudrate = dap_swo_baudrate(baudrate);
+	if (!actual_baudrate) {
+		DEBUG_WARN("CMSIS-DAP adaptor cannot capture SWO at %" PRIu32 " baud\n", baudrate);
+		dap_swo_mode(DAP_SWO_MODE_OFF);
+		dap_swo_free(swo);
+		return false;
+	}
+	if (actual_baudrate != baudrate)
+		DEBUG_WARN("CMSIS-DAP adaptor set the SWO baud rate to %" PRIu32 " rather than %" PRIu32 "\n",
+			actual_baudrate, baudrate);
+	if (!dap_swo_control(true)) {
+		dap_swo_mode(DAP_SWO_MODE_OFF);
+		dap_swo_free(swo);
+		return false;
+	}
+
+	dap_swo = swo;
+	swo_decode_init();
+	if (swo->streaming) {
+		/* Keep the whole ring of reads queued on the SWO endpoint so no trace waits on the host */
+		for (size_t slot = 0; slot < USB_TRANSFER_RING_DEPTH; ++slot) {
+			if (usb_transfer_ring_submit(&swo->ring, swo->transfer_buffer[slot], DAP_SWO_TRANSFER_SIZE)) {
+				dap_swo_stop();
+				return false;
+			}
+		}
+	}
+	DEBUG_INFO("SWO capture started at %" PRIu32 " baud (%s)\n", actual_baudrate,
+		swo->streaming ? "streaming" : "polled");
+	return true;
+}
+
+void dap_swo_poll(void)
+{
+	dap_swo_s *const swo = dap_swo;
+	if (!swo)
+		return;
+	/*
+	 * Decode at most one ring's worth of trace per poll so a busy stream can't starve the GDB server.
+	 * When streaming, each completed read is decoded and then handed straight back to libusb.
+	 */
+	for (size_t slot = 0; slot < USB_TRANSFER_RING_DEPTH; ++slot) {
+		size_t length = 0;
+		if (swo->streaming) {
+			if (!usb_transfer_ring_ready(&swo->ring))
+				break;
+			const size_t head = swo->ring.head;
+			const int result = usb_transfer_ring_wait(&swo->ring);
+			if (result < 0) {
+				DEBUG_WARN("SWO capture failed, stopping\n");
+				dap_swo_stop();
+				return;
+			}
+			length = (size_t)result;
+			swo_decode(swo->transfer_buffer[head], length);
+			if (usb_transfer_ring_submit(&swo->ring, swo->transfer_buffer[head], DAP_SWO_TRANSFER_SIZE)) {
+				dap_swo_stop();
+				return;
+			}
+		} else {
+			uint8_t status = 0;
+			/* The response carries a status byte and 16-bit count ahead of the trace data */
+			length = dap_swo_data(swo->transfer_buffer[slot], dap_packet_size() - 4U, &status);
+			swo->status |= status;
+			swo_decode(swo->transfer_buffer[slot], length);
+			if (!length)
+				break;
+		}
+	}
+	fflush(stdout);
+}
+
+void dap_swo_stop(void)
+{
+	dap_swo_s *const swo = dap_swo;
+	if (!swo)
+		return;
+	dap_swo = NULL;
+	dap_swo_control(false);
+	uint32_t pending = 0;
+	const uint8_t status = swo->status | dap_swo_status(&pending);
+	dap_swo_mode(DAP_SWO_MODE_OFF);
+	dap_swo_free(swo);
+
+	swo_decode_report();
+	if (status & DAP_SWO_STATUS_OVERRUN)
+		DEBUG_WARN("CMSIS-DAP SWO trace buffer overran, some trace was dropped\n");
+	if (status & DAP_SWO_STATUS_STREAM_ERROR)
+		DEBUG_WARN("CMSIS-DAP SWO trace streaming reported an error\n");
+}
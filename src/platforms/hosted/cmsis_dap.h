@@ -33,6 +33,9 @@ void dap_jtag_dp_init(adiv5_debug_port_s *dp);
 uint32_t dap_swj_clock(uint32_t clock);
 void dap_swd_configure(uint8_t cfg);
 void dap_nrst_set_val(bool assert);
+bool dap_swo_start(uint32_t baudrate);
+void dap_swo_poll(void);
+void dap_swo_stop(void);
 #else
 int dap_init(bmp_info_s *info)
 {
@@ -80,6 +83,19 @@ void dap_nrst_set_val(bool assert)
 {
 }
 
+bool dap_swo_start(uint32_t baudrate)
+{
+	return false;
+}
+
+void dap_swo_poll(void)
+{
+}
+
+void dap_swo_stop(void)
+{
+}
+
 #pragma GCC diagnostic pop
 #endif
 
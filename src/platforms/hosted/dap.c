@@ -56,6 +56,12 @@
 #define ID_DAP_JTAG_SEQUENCE      0x14U
 #define ID_DAP_JTAG_CONFIGURE     0x15U
 #define ID_DAP_JTAG_IDCODE        0x16U
+#define ID_DAP_SWO_TRANSPORT      0x17U
+#define ID_DAP_SWO_MODE           0x18U
+#define ID_DAP_SWO_BAUDRATE       0x19U
+#define ID_DAP_SWO_CONTROL        0x1aU
+#define ID_DAP_SWO_STATUS         0x1bU
+#define ID_DAP_SWO_DATA           0x1cU
 #define ID_DAP_SWD_SEQUENCE       0x1dU
 
 #define DAP_TRANSFER_APnDP       (1U << 0U)
@@ -249,6 +255,85 @@ size_t dap_info(const dap_info_e info, uint8_t *const data, const size_t size)
 	return rsize;
 }
 
+//-----------------------------------------------------------------------------
+bool dap_swo_transport(const dap_swo_transport_e transport)
+{
+	uint8_t buf[2];
+
+	buf[0] = ID_DAP_SWO_TRANSPORT;
+	buf[1] = transport;
+	return dbg_dap_cmd(buf, sizeof(buf), 2) > 1 && buf[0] == DAP_OK;
+}
+
+//-----------------------------------------------------------------------------
+bool dap_swo_mode(const dap_swo_mode_e swo_mode)
+{
+	uint8_t buf[2];
+
+	buf[0] = ID_DAP_SWO_MODE;
+	buf[1] = swo_mode;
+	return dbg_dap_cmd(buf, sizeof(buf), 2) > 1 && buf[0] == DAP_OK;
+}
+
+/* Request a SWO capture baud rate, returning the one the adaptor actually set or 0 if it can't do it */
+uint32_t dap_swo_baudrate(const uint32_t baudrate)
+{
+	uint8_t buf[5];
+
+	buf[0] = ID_DAP_SWO_BAUDRATE;
+	buf[1] = baudrate & 0xffU;
+	buf[2] = (baudrate >> 8U) & 0xffU;
+	buf[3] = (baudrate >> 16U) & 0xffU;
+	buf[4] = (baudrate >> 24U) & 0xffU;
+	if (dbg_dap_cmd(buf, sizeof(buf), 5) < 5)
+		return 0;
+	return buf[0] | (buf[1] << 8U) | (buf[2] << 16U) | ((uint32_t)buf[3] << 24U);
+}
+
+//-----------------------------------------------------------------------------
+bool dap_swo_control(const bool start)
+{
+	uint8_t buf[2];
+
+	buf[0] = ID_DAP_SWO_CONTROL;
+	buf[1] = start ? 1U : 0U;
+	return dbg_dap_cmd(buf, sizeof(buf), 2) > 1 && buf[0] == DAP_OK;
+}
+
+/* Read the capture status (DAP_SWO_STATUS_*), with how many bytes of trace the adaptor holds in count */
+uint8_t dap_swo_status(uint32_t *const count)
+{
+	uint8_t buf[5];
+
+	buf[0] = ID_DAP_SWO_STATUS;
+	if (dbg_dap_cmd(buf, sizeof(buf), 1) < 6) {
+		*count = 0;
+		return 0;
+	}
+	*count = buf[1] | (buf[2] << 8U) | (buf[3] << 16U) | ((uint32_t)buf[4] << 24U);
+	return buf[0];
+}
+
+/* Fetch up to size bytes of captured trace using DAP_SWO_Data, returning how many were read */
+size_t dap_swo_data(uint8_t *const data, const size_t size, uint8_t *const status)
+{
+	uint8_t buf[1024U];
+	const size_t count = MIN(size, sizeof(buf) - 4U);
+
+	buf[0] = ID_DAP_SWO_DATA;
+	buf[1] = count & 0xffU;
+	buf[2] = (count >> 8U) & 0xffU;
+	const ssize_t result = dbg_dap_cmd(buf, sizeof(buf) - 1U, 3);
+	if (result < 4) {
+		*status = 0;
+		return 0;
+	}
+	*status = buf[0];
+	const size_t length = MIN(MIN((size_t)(buf[1] | (buf[2] << 8U)), count), (size_t)result - 4U);
+	memcpy(data, buf + 3U, length);
+	return length;
+}
+
 void dap_reset_pin(int state)
 {
 	uint8_t buf[7];
@@ -368,31 +453,22 @@ void dap_write_reg(adiv5_debug_port_s *dp, uint8_t reg, uint32_t data)
 	}
 }
 
-bool dap_read_block(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len, align_e align)
+static void dap_unpack_block(void *dest, uint32_t src, const uint32_t *const data, const size_t len, const align_e align)
 {
-	const size_t blocks = len >> MIN(align, 2U);
-	uint32_t data[256];
-	if (!perform_dap_transfer_block_read(ap->dp, SWD_AP_DRW, blocks, data)) {
-		DEBUG_WARN("dap_read_block failed\n");
-		return false;
-	}
-
 	if (align > ALIGN_HALFWORD)
 		memcpy(dest, data, len);
 	else {
+		const size_t blocks = len >> align;
 		for (size_t i = 0; i < blocks; ++i) {
 			dest = adiv5_unpack_data(dest, src, data[i], align);
 			src += 1U << align;
 		}
 	}
-	return true;
 }
 
-bool dap_write_block(adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len, align_e align)
+static size_t dap_pack_block(uint32_t dest, const void *src, uint32_t *const data, const size_t len, const align_e align)
 {
 	const size_t blocks = len >> MAX(align, 2U);
-	uint32_t data[256];
-
 	if (align > ALIGN_HALFWORD)
 		memcpy(data, src, len);
 	else {
@@ -401,13 +477,62 @@ bool dap_write_block(adiv5_access_port_s *ap, uint32_t dest, const void *src, si
 			dest += 1U << align;
 		}
 	}
+	return blocks;
+}
 
+bool dap_read_block(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len, align_e align)
+{
+	const size_t blocks = len >> MIN(align, 2U);
+	uint32_t data[256];
+	if (!perform_dap_transfer_block_read(ap->dp, SWD_AP_DRW, blocks, data)) {
+		DEBUG_WARN("dap_read_block failed\n");
+		return false;
+	}
+	dap_unpack_block(dest, src, data, len, align);
+	return true;
+}
+
+bool dap_read_block_submit(adiv5_access_port_s *ap, size_t len, align_e align)
+{
+	return submit_dap_transfer_block_read(ap->dp, SWD_AP_DRW, len >> MIN(align, 2U));
+}
+
+bool dap_read_block_collect(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len, align_e align)
+{
+	uint32_t data[256];
+	if (!collect_dap_transfer_block_read(ap->dp, len >> MIN(align, 2U), data)) {
+		DEBUG_WARN("dap_read_block failed\n");
+		return false;
+	}
+	dap_unpack_block(dest, src, data, len, align);
+	return true;
+}
+
+bool dap_write_block(adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len, align_e align)
+{
+	uint32_t data[256];
+	const size_t blocks = dap_pack_block(dest, src, data, len, align);
 	const bool result = perform_dap_transfer_block_write(ap->dp, SWD_AP_DRW, blocks, data);
 	if (!result)
 		DEBUG_WARN("dap_write_block failed\n");
 	return result;
 }
 
+bool dap_write_block_submit(adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len, align_e align)
+{
+	uint32_t data[256];
+	const size_t blocks = dap_pack_block(dest, src, data, len, align);
+	return submit_dap_transfer_block_write(ap->dp, SWD_AP_DRW, blocks, data);
+}
+
+bool dap_write_block_collect(adiv5_access_port_s *ap, size_t len, align_e align)
+{
+	const bool result = collect_dap_transfer_block_write(ap->dp, len >> MAX(align, 2U));
+	if (!result)
+		DEBUG_WARN("dap_write_block failed\n");
+	return result;
+}
+
 void dap_reset_link(bool jtag)
 {
 	uint8_t buf[128], *p = buf;
@@ -502,6 +627,21 @@ void dap_ap_mem_access_setup(adiv5_access_port_s *ap, uint32_t addr, align_e ali
 	}
 }
 
+bool dap_ap_mem_access_setup_submit(adiv5_access_port_s *ap, uint32_t addr, align_e align)
+{
+	dap_transfer_request_s requests[3];
+	mem_access_setup(ap, requests, addr, align);
+	return submit_dap_transfer(ap->dp, requests, 3U);
+}
+
+bool dap_ap_mem_access_setup_collect(adiv5_access_port_s *ap)
+{
+	const bool result = collect_dap_transfer(ap->dp, 3U, NULL, 0U);
+	if (!result)
+		DEBUG_WARN("Transport error (%u) setting up memory access\n", ap->dp->fault);
+	return result;
+}
+
 uint32_t dap_ap_read(adiv5_access_port_s *ap, uint16_t addr)
 {
 	DEBUG_PROBE("dap_ap_read_start addr %x\n", addr);
@@ -681,6 +821,70 @@ void dap_jtagtap_tdi_tdo_seq(
 	}
 }
 
+/* Append a DAP_JTAG_Sequence entry of up to 64 cycles which all share the same TMS state */
+static uint8_t *dap_jtag_sequence_entry(
+	uint8_t *request, const size_t cycles, const bool tms, const bool capture, const uint64_t tdi)
+{
+	*request++ = (cycles == 64U ? 0U : cycles) | (tms ? DAP_JTAG_TMS : 0U) | (capture ? DAP_JTAG_TDO_CAPTURE : 0U);
+	for (size_t idx = 0; idx < ((cycles + 7U) >> 3U); ++idx)
+		*request++ = (uint8_t)(tdi >> (idx * 8U));
+	return request;
+}
+
+static uint64_t dap_jtag_bits(const uint8_t *const data, const size_t cycles)
+{
+	uint64_t value = 0;
+	for (size_t idx = 0; idx < ((cycles + 7U) >> 3U); ++idx)
+		value |= (uint64_t)data[idx] << (idx * 8U);
+	return value;
+}
+
+/*
+ * Do a whole IR scan followed by a DR scan as one DAP_JTAG_Sequence command, saving the round
+ * trip per TMS move and per scan that building it from the other jtagtap calls would cost.
+ */
+void dap_jtagtap_ir_dr_seq(const uint8_t *const ir_in, const size_t ir_cycles, uint8_t *const data_out,
+	const uint8_t *const data_in, const size_t dr_cycles)
+{
+	DEBUG_PROBE("dap_jtagtap_ir_dr_seq %zu IR, %zu DR ticks\n", ir_cycles, dr_cycles);
+	const uint64_t ir = dap_jtag_bits(ir_in, ir_cycles);
+	const uint64_t dr = dap_jtag_bits(data_in, dr_cycles);
+	const bool capture = data_out != NULL;
+	uint8_t buf[64];
+	uint8_t *request = buf + 2U;
+	/* Run-Test/Idle -> Select-DR-Scan -> Select-IR-Scan -> Capture-IR -> Shift-IR */
+	request = dap_jtag_sequence_entry(request, 2U, true, false, UINT64_MAX);
+	request = dap_jtag_sequence_entry(request, 2U, false, false, UINT64_MAX);
+	if (ir_cycles > 1U)
+		request = dap_jtag_sequence_entry(request, ir_cycles - 1U, false, false, ir);
+	request = dap_jtag_sequence_entry(request, 1U, true, false, ir >> (ir_cycles - 1U));
+	/* Exit1-IR -> Update-IR -> Select-DR-Scan -> Capture-DR -> Shift-DR */
+	request = dap_jtag_sequence_entry(request, 2U, true, false, UINT64_MAX);
+	request = dap_jtag_sequence_entry(request, 2U, false, false, UINT64_MAX);
+	if (dr_cycles > 1U)
+		request = dap_jtag_sequence_entry(request, dr_cycles - 1U, false, capture, dr);
+	request = dap_jtag_sequence_entry(request, 1U, true, capture, dr >> (dr_cycles - 1U));
+	/* Exit1-DR -> Update-DR -> Run-Test/Idle */
+	request = dap_jtag_sequence_entry(request, 1U, true, false, UINT64_MAX);
+	request = dap_jtag_sequence_entry(request, 1U, false, false, UINT64_MAX);
+	buf[0] = ID_DAP_JTAG_SEQUENCE;
+	buf[1] = 8U + (ir_cycles > 1U ? 1U : 0U) + (dr_cycles > 1U ? 1U : 0U);
+
+	dbg_dap_cmd(buf, sizeof(buf), request - buf);
+	if (buf[0] != DAP_OK) {
+		DEBUG_WARN("dap_jtagtap_ir_dr_seq failed %02x\n", buf[0]);
+		return;
+	}
+	if (capture) {
+		/* The captured bits come back in whole bytes per entry, the last bit in a byte of its own */
+		const size_t head_bytes = (dr_cycles + 6U) >> 3U;
+		uint64_t result = dap_jtag_bits(buf + 1U, dr_cycles - 1U) & ((UINT64_C(1) << (dr_cycles - 1U)) - 1U);
+		result |= (uint64_t)(buf[1U + head_bytes] & 1U) << (dr_cycles - 1U);
+		for (size_t idx = 0; idx < ((dr_cycles + 7U) >> 3U); ++idx)
+			data_out[idx] = (uint8_t)(result >> (idx * 8U));
+	}
+}
+
 int dap_jtag_configure(void)
 {
 	uint8_t buf[64], *p = &buf[2];
@@ -58,12 +58,34 @@ typedef enum dap_cap {
 	DAP_CAP_SWO_STREAMING = (1U << 6U),
 } dap_cap_e;
 
+typedef enum dap_swo_transport {
+	DAP_SWO_TRANSPORT_NONE = 0U,
+	DAP_SWO_TRANSPORT_DATA_COMMAND = 1U,
+	DAP_SWO_TRANSPORT_ENDPOINT = 2U,
+} dap_swo_transport_e;
+
+typedef enum dap_swo_mode {
+	DAP_SWO_MODE_OFF = 0U,
+	DAP_SWO_MODE_UART = 1U,
+	DAP_SWO_MODE_MANCHESTER = 2U,
+} dap_swo_mode_e;
+
+#define DAP_SWO_STATUS_ACTIVE       (1U << 0U)
+#define DAP_SWO_STATUS_STREAM_ERROR (1U << 6U)
+#define DAP_SWO_STATUS_OVERRUN      (1U << 7U)
+
 void dap_led(int index, int state);
 void dap_connect(bool jtag);
 void dap_disconnect(void);
 void dap_transfer_configure(uint8_t idle, uint16_t count, uint16_t retry);
 void dap_swd_configure(uint8_t cfg);
 size_t dap_info(dap_info_e info, uint8_t *data, size_t size);
+bool dap_swo_transport(dap_swo_transport_e transport);
+bool dap_swo_mode(dap_swo_mode_e swo_mode);
+uint32_t dap_swo_baudrate(uint32_t baudrate);
+bool dap_swo_control(bool start);
+uint8_t dap_swo_status(uint32_t *count);
+size_t dap_swo_data(uint8_t *data, size_t size, uint8_t *status);
 void dap_reset_target(void);
 void dap_nrst_set_val(bool assert);
 void dap_trst_reset(void);
@@ -77,14 +99,27 @@ uint32_t dap_read_idcode(adiv5_debug_port_s *dp);
 bool dap_read_block(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len, align_e align);
 bool dap_write_block(adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len, align_e align);
 void dap_ap_mem_access_setup(adiv5_access_port_s *ap, uint32_t addr, align_e align);
+bool dap_read_block_submit(adiv5_access_port_s *ap, size_t len, align_e align);
+bool dap_read_block_collect(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len, align_e align);
+bool dap_write_block_submit(adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len, align_e align);
+bool dap_write_block_collect(adiv5_access_port_s *ap, size_t len, align_e align);
+bool dap_ap_mem_access_setup_submit(adiv5_access_port_s *ap, uint32_t addr, align_e align);
+bool dap_ap_mem_access_setup_collect(adiv5_access_port_s *ap);
 uint32_t dap_ap_read(adiv5_access_port_s *ap, uint16_t addr);
 void dap_ap_write(adiv5_access_port_s *ap, uint16_t addr, uint32_t value);
 void dap_read_single(adiv5_access_port_s *ap, void *dest, uint32_t src, align_e align);
 void dap_write_single(adiv5_access_port_s *ap, uint32_t dest, const void *src, align_e align);
 ssize_t dbg_dap_cmd(uint8_t *data, size_t response_length, size_t request_length);
 bool dap_run_cmd(const void *request_data, size_t request_length, void *response_data, size_t response_length);
+size_t dap_packet_size(void);
+size_t dap_pipeline_depth(void);
+bool dap_submit_cmd(const void *request_data, size_t request_length);
+bool dap_collect_cmd(void *response_data, size_t response_length);
+void dap_run_queue(adiv5_queue_s *queue);
 void dap_jtagtap_tdi_tdo_seq(
 	uint8_t *data_out, bool final_tms, const uint8_t *tms, const uint8_t *data_in, size_t clock_cycles);
+void dap_jtagtap_ir_dr_seq(
+	const uint8_t *ir_in, size_t ir_cycles, uint8_t *data_out, const uint8_t *data_in, size_t dr_cycles);
 int dap_jtag_configure(void);
 
 uint32_t dap_swdptap_seq_in(size_t clock_cycles);
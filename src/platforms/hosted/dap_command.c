@@ -42,6 +42,30 @@
 #define DAP_TRANSFER_MATCH_VALUE (1U << 4U)
 #define DAP_TRANSFER_MATCH_MASK  (1U << 5U)
 
+/* DAP_Transfer requests start with the command, DAP index and count, responses with the command, count and status */
+#define DAP_TRANSFER_HEADER_LENGTH 3U
+/* A DAP_Transfer can carry up to 255 transfers, its count being a single byte */
+#define DAP_TRANSFER_MAX_REQUESTS 255U
+/* Largest packet dap_run_queue() builds, and most DAP_Transfer commands it keeps in flight */
+#define DAP_QUEUE_PACKET_MAX    1024U
+#define DAP_QUEUE_MAX_IN_FLIGHT 8U
+
+/* The span of queue entries a DAP_Transfer was built from, so its read results can be handed out */
+typedef struct dap_queue_batch {
+	size_t start;
+	size_t end;
+	size_t requests;
+	size_t reads;
+} dap_queue_batch_s;
+
+/* SELECT and match mask values the adaptor will hold once the transfers built so far have run */
+typedef struct dap_queue_state {
+	bool select_valid;
+	uint32_t select;
+	bool mask_valid;
+	uint32_t mask;
+} dap_queue_state_s;
+
 static inline void write_le2(uint8_t *const buffer, const size_t offset, const uint16_t value)
 {
 	buffer[offset] = value & 0xffU;
@@ -106,42 +130,76 @@ static size_t dap_encode_transfer(
 	return 5U;
 }
 
-bool perform_dap_transfer(adiv5_debug_port_s *const dp, const dap_transfer_request_s *const transfer_requests,
-	const size_t requests, uint32_t *const response_data, const size_t responses)
+static size_t dap_transfer_request(adiv5_debug_port_s *const dp, const dap_transfer_request_s *const transfer_requests,
+	const size_t requests, uint8_t *const request)
 {
 	/* Validate that the number of requests this transfer is valid. We artificially limit it to 12 (from 256) */
-	if (!requests || requests > 12 || (responses && !response_data))
-		return false;
+	if (!requests || requests > 12)
+		return 0;
 
 	DEBUG_PROBE("-> dap_transfer (%zu requests)\n", requests);
-	/* 63 is 3 + (12 * 5) where 5 is the max length of each transfer request */
-	uint8_t request[63] = {
-		DAP_TRANSFER,
-		dp->dp_jd_index,
-		requests,
-	};
-	/* Encode the transfers into the buffer and detect if we're doing any reads */
+	request[0] = DAP_TRANSFER;
+	request[1] = dp->dp_jd_index;
+	request[2] = requests;
+	/* Encode the transfers into the buffer */
 	size_t offset = 3U;
 	for (size_t i = 0; i < requests; ++i)
 		offset += dap_encode_transfer(&transfer_requests[i], request, offset);
+	return offset;
+}
 
-	dap_transfer_response_s response;
-	/* Run the request */
-	if (!dap_run_cmd(request, offset, &response, 2U + (responses * 4U)))
-		return false;
-
+static bool dap_transfer_response(adiv5_debug_port_s *const dp, const dap_transfer_response_s *const response,
+	const size_t requests, uint32_t *const response_data, const size_t responses)
+{
 	/* Look at the response and decipher what went on */
-	if (response.processed == requests && response.status == DAP_TRANSFER_OK) {
+	if (response->processed == requests && response->status == DAP_TRANSFER_OK) {
 		for (size_t i = 0; i < responses; ++i)
-			response_data[i] = read_le4(response.data[i], 0);
+			response_data[i] = read_le4(response->data[i], 0);
 		return true;
 	}
-	dp->fault = response.status;
+	dp->fault = response->status;
 
-	DEBUG_PROBE("-> transfer failed with %u after processing %u requests\n", response.status, response.processed);
+	DEBUG_PROBE("-> transfer failed with %u after processing %u requests\n", response->status, response->processed);
 	return false;
 }
 
+bool perform_dap_transfer(adiv5_debug_port_s *const dp, const dap_transfer_request_s *const transfer_requests,
+	const size_t requests, uint32_t *const response_data, const size_t responses)
+{
+	if (responses && !response_data)
+		return false;
+	/* 63 is 3 + (12 * 5) where 5 is the max length of each transfer request */
+	uint8_t request[63];
+	const size_t request_length = dap_transfer_request(dp, transfer_requests, requests, request);
+	if (!request_length)
+		return false;
+
+	dap_transfer_response_s response;
+	/* Run the request */
+	if (!dap_run_cmd(request, request_length, &response, 2U + (responses * 4U)))
+		return false;
+	return dap_transfer_response(dp, &response, requests, response_data, responses);
+}
+
+bool submit_dap_transfer(
+	adiv5_debug_port_s *const dp, const dap_transfer_request_s *const transfer_requests, const size_t requests)
+{
+	uint8_t request[63];
+	const size_t request_length = dap_transfer_request(dp, transfer_requests, requests, request);
+	return request_length && dap_submit_cmd(request, request_length);
+}
+
+bool collect_dap_transfer(
+	adiv5_debug_port_s *const dp, const size_t requests, uint32_t *const response_data, const size_t responses)
+{
+	if (responses && !response_data)
+		return false;
+	dap_transfer_response_s response;
+	if (!dap_collect_cmd(&response, 2U + (responses * 4U)))
+		return false;
+	return dap_transfer_response(dp, &response, requests, response_data, responses);
+}
+
 bool perform_dap_transfer_recoverable(adiv5_debug_port_s *const dp,
 	const dap_transfer_request_s *const transfer_requests, const size_t requests, uint32_t *const response_data,
 	const size_t responses)
@@ -155,36 +213,91 @@ bool perform_dap_transfer_recoverable(adiv5_debug_port_s *const dp,
 	return perform_dap_transfer(dp, transfer_requests, requests, response_data, responses);
 }
 
+static void dap_transfer_block_read_request(adiv5_debug_port_s *const dp, const uint8_t reg,
+	const uint16_t block_count, dap_transfer_block_request_read_s *const request)
+{
+	DEBUG_PROBE("-> dap_transfer_block (%u transfer blocks)\n", block_count);
+	request->command = DAP_TRANSFER_BLOCK;
+	request->index = dp->dp_jd_index;
+	write_le2(request->block_count, 0, block_count);
+	request->request = reg | DAP_TRANSFER_RnW;
+}
+
+static bool dap_transfer_block_read_response(adiv5_debug_port_s *const dp,
+	const dap_transfer_block_response_read_s *const response, const uint16_t block_count, uint32_t *const blocks)
+{
+	/* Check the response over */
+	const uint16_t blocks_read = read_le2(response->count, 0);
+	if (blocks_read == block_count && response->status == DAP_TRANSFER_OK) {
+		for (size_t i = 0; i < block_count; ++i)
+			blocks[i] = read_le4(response->data[i], 0);
+		return true;
+	}
+	dp->fault = response->status;
+
+	DEBUG_PROBE("-> transfer failed with %u after processing %u blocks\n", response->status, blocks_read);
+	return false;
+}
+
 bool perform_dap_transfer_block_read(
 	adiv5_debug_port_s *const dp, const uint8_t reg, const uint16_t block_count, uint32_t *const blocks)
 {
 	if (block_count > 256U)
 		return false;
 
-	DEBUG_PROBE("-> dap_transfer_block (%u transfer blocks)\n", block_count);
-	dap_transfer_block_request_read_s request = {
-		DAP_TRANSFER_BLOCK,
-		dp->dp_jd_index,
-		{},
-		reg | DAP_TRANSFER_RnW,
-	};
-	write_le2(request.block_count, 0, block_count);
+	dap_transfer_block_request_read_s request;
+	dap_transfer_block_read_request(dp, reg, block_count, &request);
 
 	dap_transfer_block_response_read_s response;
 	/* Run the request having set up the request buffer */
 	if (!dap_run_cmd(&request, sizeof(request), &response, 3U + (block_count * 4U)))
 		return false;
+	return dap_transfer_block_read_response(dp, &response, block_count, blocks);
+}
 
+bool submit_dap_transfer_block_read(adiv5_debug_port_s *const dp, const uint8_t reg, const uint16_t block_count)
+{
+	if (block_count > 256U)
+		return false;
+
+	dap_transfer_block_request_read_s request;
+	dap_transfer_block_read_request(dp, reg, block_count, &request);
+	return dap_submit_cmd(&request, sizeof(request));
+}
+
+bool collect_dap_transfer_block_read(adiv5_debug_port_s *const dp, const uint16_t block_count, uint32_t *const blocks)
+{
+	if (block_count > 256U)
+		return false;
+
+	dap_transfer_block_response_read_s response;
+	if (!dap_collect_cmd(&response, 3U + (block_count * 4U)))
+		return false;
+	return dap_transfer_block_read_response(dp, &response, block_count, blocks);
+}
+
+static void dap_transfer_block_write_request(adiv5_debug_port_s *const dp, const uint8_t reg,
+	const uint16_t block_count, const uint32_t *const blocks, dap_transfer_block_request_write_s *const request)
+{
+	DEBUG_PROBE("-> dap_transfer_block (%u transfer blocks)\n", block_count);
+	request->command = DAP_TRANSFER_BLOCK;
+	request->index = dp->dp_jd_index;
+	write_le2(request->block_count, 0, block_count);
+	request->request = reg & ~DAP_TRANSFER_RnW;
+	for (size_t i = 0; i < block_count; ++i)
+		write_le4(request->data[i], 0, blocks[i]);
+}
+
+static bool dap_transfer_block_write_response(
+	adiv5_debug_port_s *const dp, const dap_transfer_block_response_write_s *const response, const uint16_t block_count)
+{
 	/* Check the response over */
-	const uint16_t blocks_read = read_le2(response.count, 0);
-	if (blocks_read == block_count && response.status == DAP_TRANSFER_OK) {
-		for (size_t i = 0; i < block_count; ++i)
-			blocks[i] = read_le4(response.data[i], 0);
+	const uint16_t blocks_written = read_le2(response->count, 0);
+	if (blocks_written == block_count && response->status == DAP_TRANSFER_OK)
 		return true;
-	}
-	dp->fault = response.status;
+	dp->fault = response->status;
 
-	DEBUG_PROBE("-> transfer failed with %u after processing %u blocks\n", response.status, blocks_read);
+	DEBUG_PROBE("-> transfer failed with %u after processing %u blocks\n", response->status, blocks_written);
 	return false;
 }
 
@@ -194,28 +307,172 @@ bool perform_dap_transfer_block_write(
 	if (block_count > 256U)
 		return false;
 
-	DEBUG_PROBE("-> dap_transfer_block (%u transfer blocks)\n", block_count);
-	dap_transfer_block_request_write_s request = {
-		DAP_TRANSFER_BLOCK,
-		dp->dp_jd_index,
-		{},
-		reg & ~DAP_TRANSFER_RnW,
-	};
-	write_le2(request.block_count, 0, block_count);
-	for (size_t i = 0; i < block_count; ++i)
-		write_le4(request.data[i], 0, blocks[i]);
+	dap_transfer_block_request_write_s request;
+	dap_transfer_block_write_request(dp, reg, block_count, blocks, &request);
 
 	dap_transfer_block_response_write_s response;
 	/* Run the request having set up the request buffer */
 	if (!dap_run_cmd(&request, 5U + (block_count * 4U), &response, sizeof(response)))
 		return false;
+	return dap_transfer_block_write_response(dp, &response, block_count);
+}
 
-	/* Check the response over */
-	const uint16_t blocks_written = read_le2(response.count, 0);
-	if (blocks_written == block_count && response.status == DAP_TRANSFER_OK)
-		return true;
-	dp->fault = response.status;
+bool submit_dap_transfer_block_write(
+	adiv5_debug_port_s *const dp, const uint8_t reg, const uint16_t block_count, const uint32_t *const blocks)
+{
+	if (block_count > 256U)
+		return false;
 
-	DEBUG_PROBE("-> transfer failed with %u after processing %u blocks\n", response.status, blocks_written);
-	return false;
+	dap_transfer_block_request_write_s request;
+	dap_transfer_block_write_request(dp, reg, block_count, blocks, &request);
+	return dap_submit_cmd(&request, 5U + (block_count * 4U));
+}
+
+bool collect_dap_transfer_block_write(adiv5_debug_port_s *const dp, const uint16_t block_count)
+{
+	dap_transfer_block_response_write_s response;
+	if (!dap_collect_cmd(&response, sizeof(response)))
+		return false;
+	return dap_transfer_block_write_response(dp, &response, block_count);
+}
+
+/*
+ * Turn the queue entries from batch->start on into transfers for a single DAP_Transfer command, taking
+ * as many as fit both it and its response in a packet. Returns the encoded request length.
+ */
+static size_t dap_queue_batch_build(adiv5_debug_port_s *const dp, const adiv5_queue_s *const queue,
+	dap_queue_state_s *const state, dap_queue_batch_s *const batch, uint8_t *const request)
+{
+	const size_t packet_size = MIN(dap_packet_size(), DAP_QUEUE_PACKET_MAX);
+	size_t length = DAP_TRANSFER_HEADER_LENGTH;
+	size_t response_length = DAP_TRANSFER_HEADER_LENGTH;
+	batch->requests = 0;
+	batch->reads = 0;
+
+	size_t idx = batch->start;
+	for (; idx < queue->count; ++idx) {
+		const adiv5_queue_entry_s *const entry = &queue->entries[idx];
+		dap_queue_state_s next = *state;
+		dap_transfer_request_s transfers[3];
+		size_t count = 0;
+		/* AP accesses need SELECT pointing at their AP and register bank */
+		if (entry->ap) {
+			const uint32_t select = ((uint32_t)entry->ap->apsel << 24U) | (entry->addr & 0xf0U);
+			if (!next.select_valid || next.select != select) {
+				transfers[count++] = (dap_transfer_request_s){ADIV5_DP_SELECT & 0x0cU, select};
+				next.select_valid = true;
+				next.select = select;
+			}
+		} else if (entry->addr == ADIV5_DP_SELECT && entry->rnw == ADIV5_LOW_WRITE) {
+			next.select_valid = true;
+			next.select = entry->value;
+		}
+
+		const uint8_t transfer = (entry->addr & 0x0cU) | (entry->ap ? DAP_TRANSFER_APnDP : 0U);
+		bool read = false;
+		/* Waits become value match reads, which the adaptor retries until they match */
+		if (entry->mask) {
+			if (!next.mask_valid || next.mask != entry->mask) {
+				transfers[count++] = (dap_transfer_request_s){DAP_TRANSFER_MATCH_MASK, entry->mask};
+				next.mask_valid = true;
+				next.mask = entry->mask;
+			}
+			transfers[count++] =
+				(dap_transfer_request_s){transfer | DAP_TRANSFER_RnW | DAP_TRANSFER_MATCH_VALUE, entry->value};
+		} else if (entry->rnw == ADIV5_LOW_READ) {
+			transfers[count++] = (dap_transfer_request_s){transfer | DAP_TRANSFER_RnW, 0};
+			read = true;
+		} else
+			transfers[count++] = (dap_transfer_request_s){transfer, entry->value};
+
+		/* Plain reads encode as just the request byte, everything else carries a data word too */
+		size_t entry_length = 0;
+		for (size_t i = 0; i < count; ++i) {
+			const uint8_t flags = transfers[i].request & (DAP_TRANSFER_RnW | DAP_TRANSFER_MATCH_VALUE);
+			entry_length += flags == DAP_TRANSFER_RnW ? 1U : 5U;
+		}
+		if (length + entry_length > packet_size || response_length + (read ? 4U : 0U) > packet_size ||
+			batch->requests + count > DAP_TRANSFER_MAX_REQUESTS)
+			break;
+		for (size_t i = 0; i < count; ++i)
+			length += dap_encode_transfer(&transfers[i], request, length);
+		response_length += read ? 4U : 0U;
+		batch->requests += count;
+		batch->reads += read ? 1U : 0U;
+		*state = next;
+	}
+	batch->end = idx;
+	if (!batch->requests)
+		return 0;
+
+	DEBUG_PROBE("-> dap_transfer (%zu queued requests)\n", batch->requests);
+	request[0] = DAP_TRANSFER;
+	request[1] = dp->dp_jd_index;
+	request[2] = (uint8_t)batch->requests;
+	return length;
+}
+
+/* Pick up the response to a batch's DAP_Transfer and hand its read results out to the queue entries */
+static bool dap_queue_batch_collect(
+	adiv5_debug_port_s *const dp, const adiv5_queue_s *const queue, const dap_queue_batch_s *const batch)
+{
+	uint8_t response[DAP_QUEUE_PACKET_MAX];
+	response[0] = 0U;
+	response[1] = 0U;
+	const bool complete = dap_collect_cmd(response, 2U + (batch->reads * 4U));
+	if (!complete || response[0] != batch->requests || response[1] != DAP_TRANSFER_OK) {
+		/* A failed USB transfer leaves no status to go on, so report it as the link going quiet */
+		dp->fault = response[1] && response[1] != DAP_TRANSFER_OK ? response[1] : DAP_TRANSFER_NO_RESPONSE;
+		DEBUG_PROBE("-> queued transfer failed with %u after processing %u requests\n", response[1], response[0]);
+		return false;
+	}
+	size_t offset = 2U;
+	for (size_t idx = batch->start; idx < batch->end; ++idx) {
+		const adiv5_queue_entry_s *const entry = &queue->entries[idx];
+		if (entry->rnw != ADIV5_LOW_READ || entry->mask)
+			continue;
+		*entry->result = read_le4(response, offset);
+		offset += 4U;
+	}
+	return true;
+}
+
+/*
+ * Run a queue of register accesses as DAP_Transfer commands. Each packs in as many accesses as fit in a
+ * packet and as many of those are kept in flight as the adaptor takes, so a whole register file read
+ * takes a round trip or two. SELECT is only written when the AP or register bank changes, and waits
+ * queued with adiv5_queue_ap_match() are done as value match reads so they cost no extra round trips.
+ */
+void dap_run_queue(adiv5_queue_s *const queue)
+{
+	adiv5_debug_port_s *const dp = queue->dp;
+	const size_t depth = MAX(MIN(dap_pipeline_depth(), DAP_QUEUE_MAX_IN_FLIGHT), 1U);
+	dap_queue_batch_s batches[DAP_QUEUE_MAX_IN_FLIGHT];
+	dap_queue_state_s state = {0};
+	size_t head = 0;
+	size_t in_flight = 0;
+	size_t idx = 0;
+
+	while (!dp->fault && (idx < queue->count || in_flight)) {
+		/* Keep the pipeline full while there are entries left, then work through the responses */
+		if (idx < queue->count && in_flight < depth) {
+			dap_queue_batch_s *const batch = &batches[(head + in_flight) % DAP_QUEUE_MAX_IN_FLIGHT];
+			batch->start = idx;
+			uint8_t request[DAP_QUEUE_PACKET_MAX];
+			const size_t length = dap_queue_batch_build(dp, queue, &state, batch, request);
+			if (!length || !dap_submit_cmd(request, length)) {
+				dp->fault = DAP_TRANSFER_NO_RESPONSE;
+				break;
+			}
+			idx = batch->end;
+			++in_flight;
+			continue;
+		}
+		dap_queue_batch_collect(dp, queue, &batches[head]);
+		head = (head + 1U) % DAP_QUEUE_MAX_IN_FLIGHT;
+		--in_flight;
+	}
+	/* After a failure, whatever is still in flight has to be collected to stay in step with the adaptor */
+	for (; in_flight; --in_flight)
+		dap_collect_cmd(NULL, 0U);
 }
@@ -103,4 +103,16 @@ bool perform_dap_transfer_block_read(adiv5_debug_port_s *dp, uint8_t reg, uint16
 bool perform_dap_transfer_block_write(
 	adiv5_debug_port_s *dp, uint8_t reg, uint16_t block_count, const uint32_t *blocks);
 
+/*
+ * Split forms of the above for pipelining: a submit queues the request with the probe and the
+ * matching collect, called in the same order, retrieves and checks its response
+ */
+bool submit_dap_transfer(adiv5_debug_port_s *dp, const dap_transfer_request_s *transfer_requests, size_t requests);
+bool collect_dap_transfer(adiv5_debug_port_s *dp, size_t requests, uint32_t *response_data, size_t responses);
+bool submit_dap_transfer_block_read(adiv5_debug_port_s *dp, uint8_t reg, uint16_t block_count);
+bool collect_dap_transfer_block_read(adiv5_debug_port_s *dp, uint16_t block_count, uint32_t *blocks);
+bool submit_dap_transfer_block_write(
+	adiv5_debug_port_s *dp, uint8_t reg, uint16_t block_count, const uint32_t *blocks);
+bool collect_dap_transfer_block_write(adiv5_debug_port_s *dp, uint16_t block_count);
+
 #endif /*PLATFORMS_HOSTED_DAP_COMMAND_H*/
@@ -0,0 +1,336 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file turns a mapped input file into the list of segments BMDA's command line mode should
+ * program and verify. ELF files contribute their PT_LOAD program headers (at the physical, load,
+ * address) and point straight into the mapped file; Intel HEX files are decoded once into a single
+ * backing buffer; anything else is treated as a flat binary placed at the requested load address.
+ */
+
+#include "general.h"
+#include "flash_image.h"
+
+#define ELF_IDENT_SIZE      16U
+#define ELF_CLASS_32        1U
+#define ELF_DATA_LSB        1U
+#define ELF_DATA_MSB        2U
+#define ELF32_HEADER_SIZE   52U
+#define ELF32_PHDR_SIZE     32U
+#define ELF_PT_LOAD         1U
+#define ELF_EI_CLASS        4U
+#define ELF_EI_DATA         5U
+#define ELF32_E_PHOFF       0x1cU
+#define ELF32_E_PHENTSIZE   0x2aU
+#define ELF32_E_PHNUM       0x2cU
+#define ELF32_P_TYPE        0x00U
+#define ELF32_P_OFFSET      0x04U
+#define ELF32_P_PADDR       0x0cU
+#define ELF32_P_FILESZ      0x10U
+
+#define IHEX_RECORD_DATA             0x00U
+#define IHEX_RECORD_EOF              0x01U
+#define IHEX_RECORD_EXT_SEGMENT_ADDR 0x02U
+#define IHEX_RECORD_START_SEGMENT    0x03U
+#define IHEX_RECORD_EXT_LINEAR_ADDR  0x04U
+#define IHEX_RECORD_START_LINEAR     0x05U
+
+static const uint8_t elf_magic[4] = {0x7fU, 'E', 'L', 'F'};
+
+const char *flash_image_format_name(const flash_image_format_e format)
+{
+	switch (format) {
+	case FLASH_IMAGE_ELF:
+		return "ELF";
+	case FLASH_IMAGE_IHEX:
+		return "Intel HEX";
+	default:
+		return "binary";
+	}
+}
+
+static bool flash_image_add_segment(
+	flash_image_s *const image, const uint32_t addr, const uint8_t *const data, const size_t size)
+{
+	flash_image_segment_s *const segments =
+		realloc(image->segments, sizeof(*segments) * (image->segment_count + 1U));
+	if (!segments) {
+		DEBUG_WARN("Out of memory building the image segment list\n");
+		return false;
+	}
+	segments[image->segment_count].addr = addr;
+	segments[image->segment_count].data = data;
+	segments[image->segment_count].size = size;
+	image->segments = segments;
+	++image->segment_count;
+	return true;
+}
+
+static int flash_image_segment_compare(const void *const lhs, const void *const rhs)
+{
+	const flash_image_segment_s *const a = (const flash_image_segment_s *)lhs;
+	const flash_image_segment_s *const b = (const flash_image_segment_s *)rhs;
+	if (a->addr < b->addr)
+		return -1;
+	return a->addr > b->addr ? 1 : 0;
+}
+
+/* Put the segments in address order and reject images that place two segments on top of each other */
+static bool flash_image_sort_segments(flash_image_s *const image)
+{
+	qsort(image->segments, image->segment_count, sizeof(*image->segments), flash_image_segment_compare);
+	for (size_t idx = 1; idx < image->segment_count; ++idx) {
+		const flash_image_segment_s *const prev = &image->segments[idx - 1U];
+		const flash_image_segment_s *const segment = &image->segments[idx];
+		if ((uint64_t)prev->addr + prev->size > segment->addr) {
+			DEBUG_WARN("Image segments at 0x%08" PRIx32 " and 0x%08" PRIx32 " overlap\n", prev->addr, segment->addr);
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint32_t elf_read32(const uint8_t *const data, const bool msb)
+{
+	if (msb)
+		return ((uint32_t)data[0] << 24U) | ((uint32_t)data[1] << 16U) | ((uint32_t)data[2] << 8U) | data[3];
+	return data[0] | ((uint32_t)data[1] << 8U) | ((uint32_t)data[2] << 16U) | ((uint32_t)data[3] << 24U);
+}
+
+static uint16_t elf_read16(const uint8_t *const data, const bool msb)
+{
+	if (msb)
+		return (uint16_t)((data[0] << 8U) | data[1]);
+	return (uint16_t)(data[0] | (data[1] << 8U));
+}
+
+static bool flash_image_load_elf(flash_image_s *const image, const uint8_t *const data, const size_t size)
+{
+	if (size < ELF32_HEADER_SIZE || data[ELF_EI_CLASS] != ELF_CLASS_32) {
+		DEBUG_WARN("Only 32-bit ELF files are supported\n");
+		return false;
+	}
+	if (data[ELF_EI_DATA] != ELF_DATA_LSB && data[ELF_EI_DATA] != ELF_DATA_MSB) {
+		DEBUG_WARN("Invalid ELF data encoding\n");
+		return false;
+	}
+	const bool msb = data[ELF_EI_DATA] == ELF_DATA_MSB;
+	const uint32_t phdr_offset = elf_read32(data + ELF32_E_PHOFF, msb);
+	const uint16_t phdr_size = elf_read16(data + ELF32_E_PHENTSIZE, msb);
+	const uint16_t phdr_count = elf_read16(data + ELF32_E_PHNUM, msb);
+	if (phdr_size < ELF32_PHDR_SIZE || (uint64_t)phdr_offset + (uint64_t)phdr_size * phdr_count > size) {
+		DEBUG_WARN("ELF program header table is truncated\n");
+		return false;
+	}
+
+	for (uint16_t idx = 0; idx < phdr_count; ++idx) {
+		const uint8_t *const phdr = data + phdr_offset + (size_t)idx * phdr_size;
+		if (elf_read32(phdr + ELF32_P_TYPE, msb) != ELF_PT_LOAD)
+			continue;
+		const uint32_t offset = elf_read32(phdr + ELF32_P_OFFSET, msb);
+		const uint32_t addr = elf_read32(phdr + ELF32_P_PADDR, msb);
+		const uint32_t file_size = elf_read32(phdr + ELF32_P_FILESZ, msb);
+		/* Segments such as .bss occupy memory but have nothing to program */
+		if (!file_size)
+			continue;
+		if ((uint64_t)offset + file_size > size) {
+			DEBUG_WARN("ELF segment at 0x%08" PRIx32 " extends beyond the end of the file\n", addr);
+			return false;
+		}
+		if (!flash_image_add_segment(image, addr, data + offset, file_size))
+			return false;
+	}
+	return true;
+}
+
+static int ihex_nibble(const uint8_t value)
+{
+	if (value >= '0' && value <= '9')
+		return value - '0';
+	if (value >= 'a' && value <= 'f')
+		return value - 'a' + 10;
+	if (value >= 'A' && value <= 'F')
+		return value - 'A' + 10;
+	return -1;
+}
+
+/* Decode 'count' hex byte pairs starting at 'text', returning false on any non-hex character */
+static bool ihex_decode(const uint8_t *const text, uint8_t *const bytes, const size_t count)
+{
+	for (size_t idx = 0; idx < count; ++idx) {
+		const int high = ihex_nibble(text[idx * 2U]);
+		const int low = ihex_nibble(text[idx * 2U + 1U]);
+		if (high < 0 || low < 0)
+			return false;
+		bytes[idx] = (uint8_t)((high << 4U) | low);
+	}
+	return true;
+}
+
+/*
+ * Decode one record starting at the ':' at 'offset', filling in its header and payload.
+ * Returns the offset of the first character after the record, or 0 if the record is malformed.
+ */
+static size_t ihex_parse_record(const uint8_t *const data, const size_t size, const size_t offset,
+	uint8_t *const header, uint8_t *const payload)
+{
+	/* ':' + byte count + 16-bit address + record type, each as hex byte pairs */
+	if (offset + 9U > size || data[offset] != ':' || !ihex_decode(data + offset + 1U, header, 4U))
+		return 0;
+	const size_t length = header[0];
+	if (offset + 11U + length * 2U > size || !ihex_decode(data + offset + 9U, payload, length + 1U))
+		return 0;
+	uint8_t checksum = 0;
+	for (size_t idx = 0; idx < 4U; ++idx)
+		checksum += header[idx];
+	for (size_t idx = 0; idx <= length; ++idx)
+		checksum += payload[idx];
+	if (checksum)
+		return 0;
+	return offset + 11U + length * 2U;
+}
+
+static bool flash_image_load_ihex(flash_image_s *const image, const uint8_t *const data, const size_t size)
+{
+	/* Every data byte takes at least two characters of the file, so half its size always suffices */
+	image->storage = malloc(size / 2U);
+	if (!image->storage) {
+		DEBUG_WARN("Out of memory decoding Intel HEX file\n");
+		return false;
+	}
+
+	size_t stored = 0;
+	uint32_t base = 0;
+	size_t offset = 0;
+	while (offset < size) {
+		if (data[offset] == '\r' || data[offset] == '\n' || data[offset] == ' ' || data[offset] == '\t') {
+			++offset;
+			continue;
+		}
+		uint8_t header[4];
+		uint8_t payload[256];
+		const size_t next = ihex_parse_record(data, size, offset, header, payload);
+		if (!next) {
+			DEBUG_WARN("Malformed Intel HEX record at offset %zu\n", offset);
+			return false;
+		}
+		offset = next;
+
+		const uint8_t length = header[0];
+		const uint32_t addr = base + (((uint32_t)header[1] << 8U) | header[2]);
+		switch (header[3]) {
+		case IHEX_RECORD_DATA: {
+			if (!length)
+				break;
+			memcpy(image->storage + stored, payload, length);
+			flash_image_segment_s *const last =
+				image->segment_count ? &image->segments[image->segment_count - 1U] : NULL;
+			/* Records following on from the previous one just grow its segment */
+			if (last && last->addr + last->size == addr && last->data + last->size == image->storage + stored)
+				last->size += length;
+			else if (!flash_image_add_segment(image, addr, image->storage + stored, length))
+				return false;
+			stored += length;
+			break;
+		}
+		case IHEX_RECORD_EOF:
+			return true;
+		case IHEX_RECORD_EXT_SEGMENT_ADDR:
+			if (length != 2U) {
+				DEBUG_WARN("Malformed Intel HEX address record at offset %zu\n", offset);
+				return false;
+			}
+			base = (((uint32_t)payload[0] << 8U) | payload[1]) << 4U;
+			break;
+		case IHEX_RECORD_EXT_LINEAR_ADDR:
+			if (length != 2U) {
+				DEBUG_WARN("Malformed Intel HEX address record at offset %zu\n", offset);
+				return false;
+			}
+			base = (((uint32_t)payload[0] << 8U) | payload[1]) << 16U;
+			break;
+		case IHEX_RECORD_START_SEGMENT:
+		case IHEX_RECORD_START_LINEAR:
+			/* Entry points don't affect what gets programmed */
+			break;
+		default:
+			DEBUG_WARN("Unknown Intel HEX record type %02x\n", header[3]);
+			return false;
+		}
+	}
+	DEBUG_WARN("Intel HEX file has no end of file record\n");
+	return false;
+}
+
+/* A file is taken to be Intel HEX if it opens with a well formed, correctly checksummed record */
+static bool flash_image_is_ihex(const uint8_t *const data, const size_t size)
+{
+	uint8_t header[4];
+	uint8_t payload[256];
+	return size && data[0] == ':' && ihex_parse_record(data, size, 0, header, payload) != 0;
+}
+
+bool flash_image_load(
+	flash_image_s *const image, const uint8_t *const data, const size_t size, const uint32_t load_addr)
+{
+	memset(image, 0, sizeof(*image));
+	bool result;
+	if (size >= ELF_IDENT_SIZE && memcmp(data, elf_magic, sizeof(elf_magic)) == 0) {
+		image->format = FLASH_IMAGE_ELF;
+		result = flash_image_load_elf(image, data, size);
+	} else if (flash_image_is_ihex(data, size)) {
+		image->format = FLASH_IMAGE_IHEX;
+		result = flash_image_load_ihex(image, data, size);
+	} else {
+		image->format = FLASH_IMAGE_BINARY;
+		result = flash_image_add_segment(image, load_addr, data, size);
+	}
+
+	if (result && !image->segment_count) {
+		DEBUG_WARN("%s file contains nothing to program\n", flash_image_format_name(image->format));
+		result = false;
+	}
+	if (result)
+		result = flash_image_sort_segments(image);
+	if (!result)
+		flash_image_free(image);
+	return result;
+}
+
+void flash_image_free(flash_image_s *const image)
+{
+	free(image->segments);
+	free(image->storage);
+	image->segments = NULL;
+	image->segment_count = 0;
+	image->storage = NULL;
+}
@@ -0,0 +1,66 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PLATFORMS_HOSTED_FLASH_IMAGE_H
+#define PLATFORMS_HOSTED_FLASH_IMAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum flash_image_format {
+	FLASH_IMAGE_BINARY,
+	FLASH_IMAGE_ELF,
+	FLASH_IMAGE_IHEX,
+} flash_image_format_e;
+
+/* One contiguous run of bytes to be programmed at a target address */
+typedef struct flash_image_segment {
+	uint32_t addr;
+	const uint8_t *data;
+	size_t size;
+} flash_image_segment_s;
+
+typedef struct flash_image {
+	flash_image_format_e format;
+	/* Segments, sorted by address and guaranteed not to overlap */
+	flash_image_segment_s *segments;
+	size_t segment_count;
+	/* Decoded data backing the segments of an Intel HEX image, NULL otherwise */
+	uint8_t *storage;
+} flash_image_s;
+
+bool flash_image_load(flash_image_s *image, const uint8_t *data, size_t size, uint32_t load_addr);
+void flash_image_free(flash_image_s *image);
+const char *flash_image_format_name(flash_image_format_e format);
+
+#endif /* PLATFORMS_HOSTED_FLASH_IMAGE_H */
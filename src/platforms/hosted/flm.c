@@ -0,0 +1,620 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2026 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements a Flash driver running the CMSIS-Pack flash algorithms vendors ship as .FLM
+ * files, for parts that have no driver of their own. An FLM is an ELF file holding position
+ * independent code and data (the PrgCode and PrgData sections), a FlashDevice structure describing
+ * the Flash it programs (DevDscr) and the Init, UnInit, EraseSector, ProgramPage and EraseChip entry
+ * points as symbols.
+ *
+ * The algorithm is loaded into the target's largest RAM region behind the breakpoint its calls
+ * return to, followed by its stack and two page buffers, so the next page is uploaded while the
+ * last one is being programmed.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "cortexm.h"
+#include "flm.h"
+
+#include <errno.h>
+
+#define FLM_MAX_FILE_SIZE  (1024U * 1024U)
+#define FLM_MAX_IMAGE_SIZE (64U * 1024U)
+#define FLM_STACK_SIZE     1024U
+/* Ample for Init and UnInit, and a floor under the timeouts the algorithm gives for its operations */
+#define FLM_CALL_TIMEOUT_MS       5000U
+#define FLM_ERASE_CHIP_TIMEOUT_MS 60000U
+#define FLM_NO_FUNC               UINT32_MAX
+
+/* Function codes for Init() and UnInit() */
+#define FLM_FUNC_ERASE   1U
+#define FLM_FUNC_PROGRAM 2U
+
+/* The FlashDevice structure, its sector list ends with an entry of all ones */
+#define FLM_DEVICE_NAME        0x02U
+#define FLM_DEVICE_NAME_LENGTH 128U
+#define FLM_DEVICE_ADDR        0x84U
+#define FLM_DEVICE_SIZE        0x88U
+#define FLM_DEVICE_PAGE_SIZE   0x8cU
+#define FLM_DEVICE_ERASED      0x94U
+#define FLM_DEVICE_TO_PROG     0x98U
+#define FLM_DEVICE_TO_ERASE    0x9cU
+#define FLM_DEVICE_SECTORS     0xa0U
+#define FLM_SECTOR_SIZE        8U
+#define FLM_SECTORS_MAX        512U
+#define FLM_SECTOR_END         0xffffffffU
+
+#define ELF_CLASS_32       1U
+#define ELF_DATA_LSB       1U
+#define ELF_EI_CLASS       4U
+#define ELF_EI_DATA        5U
+#define ELF32_HEADER_SIZE  52U
+#define ELF32_SHDR_SIZE    40U
+#define ELF32_SYM_SIZE     16U
+#define ELF32_E_SHOFF      0x20U
+#define ELF32_E_SHENTSIZE  0x2eU
+#define ELF32_E_SHNUM      0x30U
+#define ELF32_E_SHSTRNDX   0x32U
+#define ELF32_SH_NAME      0x00U
+#define ELF32_SH_TYPE      0x04U
+#define ELF32_SH_FLAGS     0x08U
+#define ELF32_SH_ADDR      0x0cU
+#define ELF32_SH_OFFSET    0x10U
+#define ELF32_SH_SIZE      0x14U
+#define ELF32_SH_LINK      0x18U
+#define ELF32_ST_NAME      0x00U
+#define ELF32_ST_VALUE     0x04U
+#define ELF32_ST_SHNDX     0x0eU
+#define ELF_SHT_SYMTAB     2U
+#define ELF_SHT_NOBITS     8U
+#define ELF_SHF_ALLOC      2U
+
+static const uint8_t elf_magic[4] = {0x7fU, 'E', 'L', 'F'};
+
+/* What the FLM file tells us about the algorithm, offsets being from the start of its image */
+typedef struct flm_algorithm {
+	uint32_t init;
+	uint32_t uninit;
+	uint32_t erase_sector;
+	uint32_t program_page;
+	uint32_t erase_chip;
+	uint32_t static_base; /* Offset of PrgData, which r9 points to while the algorithm runs */
+	size_t image_size;
+	target_addr_t device_addr;
+	uint32_t page_size;
+	uint32_t prog_timeout;
+	uint32_t erase_timeout;
+	uint8_t erased;
+} flm_algorithm_s;
+
+/* Each Flash region carries its own copy of the algorithm, making it self contained */
+typedef struct flm_flash {
+	target_flash_s f;
+	flm_algorithm_s algorithm;
+	target_addr_t return_addr; /* Where the breakpoint ending each call lives, the image follows */
+	target_addr_t image_addr;
+	target_addr_t stack_top;
+	target_addr_t buffer[2];
+	uint8_t buffers; /* 2 if the RAM leaves room to double buffer the pages, otherwise 1 */
+	uint8_t slot;    /* Buffer the next page goes into */
+	uint32_t func;   /* What the algorithm is initialised for, or 0 */
+	cortexm_stub_call_s call;
+	uint32_t call_timeout;
+	uint8_t image[];
+} flm_flash_s;
+
+/* Two Thumb BKPT instructions, the calls return to the first */
+static const uint16_t flm_return_stub[2] = {0xbe00U, 0xbe00U};
+
+static uint32_t flm_read32(const uint8_t *const data)
+{
+	return data[0] | ((uint32_t)data[1] << 8U) | ((uint32_t)data[2] << 16U) | ((uint32_t)data[3] << 24U);
+}
+
+static uint16_t flm_read16(const uint8_t *const data)
+{
+	return (uint16_t)(data[0] | (data[1] << 8U));
+}
+
+static bool flm_call_start(
+	flm_flash_s *const flash, const uint32_t func, const uint32_t arg0, const uint32_t arg1, const uint32_t arg2)
+{
+	flash->call = (cortexm_stub_call_s){
+		.func = flash->image_addr + func,
+		.return_addr = flash->return_addr,
+		.stack_top = flash->stack_top,
+		.static_base = flash->image_addr + flash->algorithm.static_base,
+		.args = {arg0, arg1, arg2, 0},
+	};
+	return cortexm_stub_call_start(flash->f.t, &flash->call);
+}
+
+/* Wait for the call in flight to return, the algorithm's functions return 0 on success */
+static bool flm_call_wait(flm_flash_s *const flash)
+{
+	uint32_t result = 0;
+	if (!cortexm_stub_call_wait(flash->f.t, &flash->call, flash->call_timeout, &result))
+		return false;
+	if (result) {
+		DEBUG_WARN("Flash algorithm call to %08" PRIx32 " failed with %" PRIu32 "\n", flash->call.func, result);
+		return false;
+	}
+	return true;
+}
+
+static bool flm_call(flm_flash_s *const flash, const uint32_t func, const uint32_t timeout, const uint32_t arg0,
+	const uint32_t arg1, const uint32_t arg2)
+{
+	flash->call_timeout = timeout;
+	return flm_call_start(flash, func, arg0, arg1, arg2) && flm_call_wait(flash);
+}
+
+static bool flm_flash_wait(target_flash_s *const f)
+{
+	return flm_call_wait((flm_flash_s *)f);
+}
+
+/* Initialise the algorithm for erasing or programming, taking it out of the other mode first */
+static bool flm_init_for(flm_flash_s *const flash, const uint32_t func)
+{
+	if (flash->func == func)
+		return true;
+	const flm_algorithm_s *const algorithm = &flash->algorithm;
+	if (flash->func && algorithm->uninit != FLM_NO_FUNC &&
+		!flm_call(flash, algorithm->uninit, FLM_CALL_TIMEOUT_MS, flash->func, 0, 0))
+		return false;
+	flash->func = 0;
+	if (!flm_call(flash, algorithm->init, FLM_CALL_TIMEOUT_MS, algorithm->device_addr, 0, func))
+		return false;
+	flash->func = func;
+	return true;
+}
+
+/* Load the algorithm into RAM, the target may have put anything there since the last time */
+static bool flm_flash_prepare(target_flash_s *const f)
+{
+	flm_flash_s *const flash = (flm_flash_s *)f;
+	flash->func = 0;
+	flash->slot = 0;
+	return !target_mem_write(f->t, flash->return_addr, flm_return_stub, sizeof(flm_return_stub)) &&
+		!target_mem_write(f->t, flash->image_addr, flash->image, flash->algorithm.image_size);
+}
+
+/* Erase sector by sector, leaving the last one running for the next operation to wait on */
+static bool flm_flash_erase(target_flash_s *const f, const target_addr_t addr, const size_t len)
+{
+	flm_flash_s *const flash = (flm_flash_s *)f;
+	if (!flm_init_for(flash, FLM_FUNC_ERASE))
+		return false;
+	flash->call_timeout = flash->algorithm.erase_timeout;
+	for (size_t offset = 0; offset < len; offset += f->blocksize) {
+		if (offset && !flm_call_wait(flash))
+			return false;
+		if (!flm_call_start(flash, flash->algorithm.erase_sector, addr + offset, 0, 0))
+			return false;
+	}
+	return true;
+}
+
+static bool flm_flash_erase_all(target_flash_s *const f)
+{
+	flm_flash_s *const flash = (flm_flash_s *)f;
+	return flm_init_for(flash, FLM_FUNC_ERASE) &&
+		flm_call(flash, flash->algorithm.erase_chip, FLM_ERASE_CHIP_TIMEOUT_MS, 0, 0, 0);
+}
+
+/*
+ * Upload the page into the free buffer while the last page may still be programming from the other,
+ * and only then wait for that to finish and set this one going
+ */
+static bool flm_flash_write(target_flash_s *const f, const target_addr_t dest, const void *const src, const size_t len)
+{
+	flm_flash_s *const flash = (flm_flash_s *)f;
+	if (f->busy && flash->buffers == 1U) {
+		f->busy = false;
+		if (!flm_call_wait(flash))
+			return false;
+	}
+	const target_addr_t buffer = flash->buffer[flash->slot];
+	if (target_mem_write(f->t, buffer, src, len))
+		return false;
+	if (f->busy) {
+		f->busy = false;
+		if (!flm_call_wait(flash))
+			return false;
+	}
+	if (!flm_init_for(flash, FLM_FUNC_PROGRAM))
+		return false;
+	flash->call_timeout = flash->algorithm.prog_timeout;
+	if (!flm_call_start(flash, flash->algorithm.program_page, dest, len, buffer))
+		return false;
+	flash->slot = (flash->slot + 1U) % flash->buffers;
+	return true;
+}
+
+static bool flm_flash_done(target_flash_s *const f)
+{
+	flm_flash_s *const flash = (flm_flash_s *)f;
+	const uint32_t func = flash->func;
+	flash->func = 0;
+	if (!func || flash->algorithm.uninit == FLM_NO_FUNC)
+		return true;
+	return flm_call(flash, flash->algorithm.uninit, FLM_CALL_TIMEOUT_MS, func, 0, 0);
+}
+
+static const uint8_t *flm_section_header(const uint8_t *const data, const uint32_t index)
+{
+	return data + flm_read32(data + ELF32_E_SHOFF) + (size_t)index * flm_read16(data + ELF32_E_SHENTSIZE);
+}
+
+/* Fetch a NUL terminated name from a string table section, NULL if it doesn't lie within it */
+static const char *flm_string(const uint8_t *const data, const uint8_t *const strtab, const uint32_t offset)
+{
+	const uint32_t strtab_size = flm_read32(strtab + ELF32_SH_SIZE);
+	if (offset >= strtab_size)
+		return NULL;
+	const char *const name = (const char *)data + flm_read32(strtab + ELF32_SH_OFFSET) + offset;
+	return memchr(name, '\0', strtab_size - offset) ? name : NULL;
+}
+
+static bool flm_elf_valid(const uint8_t *const data, const size_t size)
+{
+	if (size < ELF32_HEADER_SIZE || memcmp(data, elf_magic, sizeof(elf_magic)) != 0 ||
+		data[ELF_EI_CLASS] != ELF_CLASS_32 || data[ELF_EI_DATA] != ELF_DATA_LSB) {
+		DEBUG_WARN("Flash algorithms must be 32-bit little endian ELF files\n");
+		return false;
+	}
+	const uint32_t shdr_offset = flm_read32(data + ELF32_E_SHOFF);
+	const uint16_t shdr_size = flm_read16(data + ELF32_E_SHENTSIZE);
+	const uint16_t shdr_count = flm_read16(data + ELF32_E_SHNUM);
+	if (shdr_size < ELF32_SHDR_SIZE || (uint64_t)shdr_offset + (uint64_t)shdr_size * shdr_count > size ||
+		flm_read16(data + ELF32_E_SHSTRNDX) >= shdr_count) {
+		DEBUG_WARN("ELF section header table is truncated\n");
+		return false;
+	}
+	/* Make sure every section that has contents in the file really is in it */
+	for (uint16_t idx = 0; idx < shdr_count; ++idx) {
+		const uint8_t *const shdr = flm_section_header(data, idx);
+		if (flm_read32(shdr + ELF32_SH_TYPE) != ELF_SHT_NOBITS &&
+			(uint64_t)flm_read32(shdr + ELF32_SH_OFFSET) + flm_read32(shdr + ELF32_SH_SIZE) > size) {
+			DEBUG_WARN("ELF section %u extends beyond the end of the file\n", idx);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Gather the loadable sections into the algorithm's image, which starts at address 0, noting where
+ * PrgData starts and where the DevDscr section holding the FlashDevice structure is
+ */
+static uint8_t *flm_image_build(const uint8_t *const data, flm_algorithm_s *const algorithm,
+	const uint8_t **const device, size_t *const device_size)
+{
+	const uint16_t shdr_count = flm_read16(data + ELF32_E_SHNUM);
+	const uint8_t *const shstrtab = flm_section_header(data, flm_read16(data + ELF32_E_SHSTRNDX));
+	algorithm->image_size = 0;
+	algorithm->static_base = UINT32_MAX;
+	*device = NULL;
+	for (uint16_t idx = 0; idx < shdr_count; ++idx) {
+		const uint8_t *const shdr = flm_section_header(data, idx);
+		const char *const name = flm_string(data, shstrtab, flm_read32(shdr + ELF32_SH_NAME));
+		if (!(flm_read32(shdr + ELF32_SH_FLAGS) & ELF_SHF_ALLOC) || !name)
+			continue;
+		const uint32_t addr = flm_read32(shdr + ELF32_SH_ADDR);
+		const uint32_t size = flm_read32(shdr + ELF32_SH_SIZE);
+		if (strcmp(name, "DevDscr") == 0) {
+			*device = data + flm_read32(shdr + ELF32_SH_OFFSET);
+			*device_size = size;
+			continue;
+		}
+		if (strcmp(name, "PrgData") == 0 && addr < algorithm->static_base)
+			algorithm->static_base = addr;
+		if ((uint64_t)addr + size > FLM_MAX_IMAGE_SIZE) {
+			DEBUG_WARN("Flash algorithm section %s does not fit in %u bytes\n", name, FLM_MAX_IMAGE_SIZE);
+			return NULL;
+		}
+		algorithm->image_size = MAX(algorithm->image_size, addr + size);
+	}
+	if (!*device || algorithm->static_base == UINT32_MAX || !algorithm->image_size) {
+		DEBUG_WARN("Flash algorithm is missing its PrgCode, PrgData or DevDscr sections\n");
+		return NULL;
+	}
+
+	/* Zero initialised data (NOBITS sections) is left as the calloc() found it */
+	uint8_t *const image = calloc(1, algorithm->image_size);
+	if (!image) {
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return NULL;
+	}
+	for (uint16_t idx = 0; idx < shdr_count; ++idx) {
+		const uint8_t *const shdr = flm_section_header(data, idx);
+		const char *const name = flm_string(data, shstrtab, flm_read32(shdr + ELF32_SH_NAME));
+		if (!(flm_read32(shdr + ELF32_SH_FLAGS) & ELF_SHF_ALLOC) || !name || strcmp(name, "DevDscr") == 0 ||
+			flm_read32(shdr + ELF32_SH_TYPE) == ELF_SHT_NOBITS)
+			continue;
+		memcpy(image + flm_read32(shdr + ELF32_SH_ADDR), data + flm_read32(shdr + ELF32_SH_OFFSET),
+			flm_read32(shdr + ELF32_SH_SIZE));
+	}
+	return image;
+}
+
+/* Look up the entry points by name in the symbol table */
+static bool flm_symbols_read(const uint8_t *const data, flm_algorithm_s *const algorithm)
+{
+	algorithm->init = FLM_NO_FUNC;
+	algorithm->uninit = FLM_NO_FUNC;
+	algorithm->erase_sector = FLM_NO_FUNC;
+	algorithm->program_page = FLM_NO_FUNC;
+	algorithm->erase_chip = FLM_NO_FUNC;
+	const struct {
+		const char *name;
+		uint32_t *offset;
+	} entry_points[] = {
+		{"Init", &algorithm->init},
+		{"UnInit", &algorithm->uninit},
+		{"EraseSector", &algorithm->erase_sector},
+		{"ProgramPage", &algorithm->program_page},
+		{"EraseChip", &algorithm->erase_chip},
+	};
+
+	const uint16_t shdr_count = flm_read16(data + ELF32_E_SHNUM);
+	for (uint16_t idx = 0; idx < shdr_count; ++idx) {
+		const uint8_t *const symtab = flm_section_header(data, idx);
+		const uint32_t strtab_index = flm_read32(symtab + ELF32_SH_LINK);
+		if (flm_read32(symtab + ELF32_SH_TYPE) != ELF_SHT_SYMTAB || strtab_index >= shdr_count)
+			continue;
+		const uint8_t *const strtab = flm_section_header(data, strtab_index);
+		const uint8_t *const symbols = data + flm_read32(symtab + ELF32_SH_OFFSET);
+		const size_t symbol_count = flm_read32(symtab + ELF32_SH_SIZE) / ELF32_SYM_SIZE;
+		for (size_t sym = 0; sym < symbol_count; ++sym) {
+			const uint8_t *const symbol = symbols + sym * ELF32_SYM_SIZE;
+			const char *const name = flm_string(data, strtab, flm_read32(symbol + ELF32_ST_NAME));
+			/* Undefined symbols don't count */
+			if (!name || !flm_read16(symbol + ELF32_ST_SHNDX))
+				continue;
+			for (size_t entry = 0; entry < ARRAY_LENGTH(entry_points); ++entry) {
+				if (strcmp(name, entry_points[entry].name) == 0)
+					*entry_points[entry].offset = flm_read32(symbol + ELF32_ST_VALUE) & ~1U;
+			}
+		}
+	}
+	if (algorithm->init == FLM_NO_FUNC || algorithm->erase_sector == FLM_NO_FUNC ||
+		algorithm->program_page == FLM_NO_FUNC) {
+		DEBUG_WARN("Flash algorithm lacks an Init, EraseSector or ProgramPage function\n");
+		return false;
+	}
+	return true;
+}
+
+static target_ram_s *flm_ram_region(target_s *const t)
+{
+	target_ram_s *largest = NULL;
+	for (target_ram_s *ram = t->ram; ram; ram = ram->next) {
+		if (!largest || ram->length > largest->length)
+			largest = ram;
+	}
+	return largest;
+}
+
+static bool flm_overlaps_flash(target_s *const t, const target_addr_t start, const size_t length)
+{
+	for (target_flash_s *f = t->flash; f; f = f->next) {
+		if (start < f->start + f->length && f->start < start + length)
+			return true;
+	}
+	return false;
+}
+
+/* Add one Flash region of equally sized sectors, run by its own copy of the algorithm */
+static bool flm_region_add(target_s *const t, const flm_algorithm_s *const algorithm, const uint8_t *const image,
+	const target_addr_t start, const size_t length, const size_t sector_size, const bool whole_device)
+{
+	const target_ram_s *const ram = flm_ram_region(t);
+	flm_flash_s *const flash = target_arena_calloc(sizeof(*flash) + algorithm->image_size);
+	if (!flash) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return false;
+	}
+	flash->algorithm = *algorithm;
+	memcpy(flash->image, image, algorithm->image_size);
+
+	/* The return breakpoint, then the image, the stack, and the page buffers */
+	flash->return_addr = ram->start;
+	flash->image_addr = ram->start + sizeof(flm_return_stub);
+	flash->stack_top = ALIGN(flash->image_addr + algorithm->image_size, 8U) + FLM_STACK_SIZE;
+	const size_t ram_free = ram->start + ram->length - flash->stack_top;
+	flash->buffers = ram_free >= 2U * algorithm->page_size ? 2U : 1U;
+	for (size_t idx = 0; idx < flash->buffers; ++idx)
+		flash->buffer[idx] = flash->stack_top + idx * algorithm->page_size;
+
+	target_flash_s *const f = &flash->f;
+	f->start = start;
+	f->length = length;
+	f->blocksize = sector_size;
+	f->writesize = algorithm->page_size;
+	f->erased = algorithm->erased;
+	f->prepare = flm_flash_prepare;
+	f->erase = flm_flash_erase;
+	f->write = flm_flash_write;
+	f->done = flm_flash_done;
+	f->wait = flm_flash_wait;
+	f->write_overlaps = true;
+	if (whole_device && algorithm->erase_chip != FLM_NO_FUNC)
+		f->erase_all = flm_flash_erase_all;
+	target_add_flash(t, f);
+	return true;
+}
+
+/* Count the entries of the FlashDevice structure's sector list and check they describe the whole device */
+static size_t flm_sectors_count(
+	const flm_algorithm_s *const algorithm, const uint8_t *const device, const size_t device_size)
+{
+	const size_t device_length = flm_read32(device + FLM_DEVICE_SIZE);
+	size_t sectors = 0;
+	while (sectors < FLM_SECTORS_MAX && FLM_DEVICE_SECTORS + (sectors + 1U) * FLM_SECTOR_SIZE <= device_size &&
+		flm_read32(device + FLM_DEVICE_SECTORS + sectors * FLM_SECTOR_SIZE) != FLM_SECTOR_END)
+		++sectors;
+
+	uint32_t expected_offset = 0;
+	for (size_t idx = 0; idx < sectors; ++idx) {
+		const uint8_t *const sector = device + FLM_DEVICE_SECTORS + idx * FLM_SECTOR_SIZE;
+		const uint32_t sector_size = flm_read32(sector);
+		const uint32_t offset = flm_read32(sector + 4U);
+		const uint32_t end = idx + 1U < sectors ? flm_read32(sector + FLM_SECTOR_SIZE + 4U) : device_length;
+		/* The Flash layer needs power of two sectors holding whole pages */
+		if (offset != expected_offset || !sector_size || (sector_size & (sector_size - 1U)) || end <= offset ||
+			(end - offset) % sector_size || sector_size % algorithm->page_size) {
+			DEBUG_WARN("Flash algorithm has an invalid sector layout at offset 0x%08" PRIx32 "\n", offset);
+			return 0;
+		}
+		expected_offset = end;
+	}
+	if (!sectors)
+		DEBUG_WARN("Flash algorithm describes no sectors\n");
+	return sectors;
+}
+
+/* Read what is needed to run the algorithm out of the FLM file, returning its image */
+static uint8_t *flm_parse(const uint8_t *const data, const size_t size, flm_algorithm_s *const algorithm,
+	const uint8_t **const device, size_t *const device_size)
+{
+	if (!flm_elf_valid(data, size) || !flm_symbols_read(data, algorithm))
+		return NULL;
+	uint8_t *const image = flm_image_build(data, algorithm, device, device_size);
+	if (!image)
+		return NULL;
+	if (*device_size < FLM_DEVICE_SECTORS) {
+		DEBUG_WARN("Flash algorithm's device description is truncated\n");
+		free(image);
+		return NULL;
+	}
+	algorithm->device_addr = flm_read32(*device + FLM_DEVICE_ADDR);
+	algorithm->page_size = flm_read32(*device + FLM_DEVICE_PAGE_SIZE);
+	algorithm->erased = (*device)[FLM_DEVICE_ERASED];
+	algorithm->prog_timeout = MAX(flm_read32(*device + FLM_DEVICE_TO_PROG), FLM_CALL_TIMEOUT_MS);
+	algorithm->erase_timeout = MAX(flm_read32(*device + FLM_DEVICE_TO_ERASE), FLM_CALL_TIMEOUT_MS);
+	if (!algorithm->page_size || (algorithm->page_size & (algorithm->page_size - 1U))) {
+		DEBUG_WARN("Flash algorithm's page size of %" PRIu32 " bytes is not a power of two\n", algorithm->page_size);
+		free(image);
+		return NULL;
+	}
+	return image;
+}
+
+static uint8_t *flm_file_read(const char *const path, size_t *const size)
+{
+	FILE *const file = fopen(path, "rb");
+	if (!file) {
+		DEBUG_WARN("Could not open flash algorithm %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	uint8_t *const data = malloc(FLM_MAX_FILE_SIZE);
+	if (!data) {
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		fclose(file);
+		return NULL;
+	}
+	*size = fread(data, 1, FLM_MAX_FILE_SIZE, file);
+	const bool too_large = *size == FLM_MAX_FILE_SIZE;
+	fclose(file);
+	if (too_large || !*size) {
+		DEBUG_WARN("Flash algorithm %s is %s\n", path, too_large ? "too large" : "empty");
+		free(data);
+		return NULL;
+	}
+	return data;
+}
+
+/* Add a Flash region for each run of equally sized sectors the algorithm describes */
+static bool flm_flash_add(target_s *const t, const flm_algorithm_s *const algorithm, const uint8_t *const image,
+	const uint8_t *const device, const size_t device_size)
+{
+	const target_ram_s *const ram = flm_ram_region(t);
+	const size_t ram_needed =
+		sizeof(flm_return_stub) + ALIGN(algorithm->image_size, 8U) + FLM_STACK_SIZE + algorithm->page_size;
+	if (ram_needed > ram->length) {
+		DEBUG_WARN("Flash algorithm needs 0x%zx bytes of RAM, target has 0x%zx\n", ram_needed, ram->length);
+		return false;
+	}
+	const size_t device_length = flm_read32(device + FLM_DEVICE_SIZE);
+	if (flm_overlaps_flash(t, algorithm->device_addr, device_length)) {
+		DEBUG_WARN("Flash at 0x%08" PRIx32 " is already handled by the target's driver\n", algorithm->device_addr);
+		return false;
+	}
+	const size_t sectors = flm_sectors_count(algorithm, device, device_size);
+	if (!sectors)
+		return false;
+
+	for (size_t idx = 0; idx < sectors; ++idx) {
+		const uint8_t *const sector = device + FLM_DEVICE_SECTORS + idx * FLM_SECTOR_SIZE;
+		const uint32_t offset = flm_read32(sector + 4U);
+		const uint32_t end = idx + 1U < sectors ? flm_read32(sector + FLM_SECTOR_SIZE + 4U) : device_length;
+		if (!flm_region_add(t, algorithm, image, algorithm->device_addr + offset, end - offset, flm_read32(sector),
+				sectors == 1U))
+			return false;
+	}
+
+	char name[FLM_DEVICE_NAME_LENGTH + 1U] = {0};
+	memcpy(name, device + FLM_DEVICE_NAME, FLM_DEVICE_NAME_LENGTH);
+	tc_printf(t, "Flash algorithm for %s: 0x%zx bytes at 0x%08" PRIx32 " in %" PRIu32 " byte pages\n", name,
+		device_length, algorithm->device_addr, algorithm->page_size);
+	return true;
+}
+
+bool flm_load(target_s *const t, const char *const path)
+{
+	if (!cortexm_target(t)) {
+		DEBUG_WARN("Flash algorithms can only be run on Cortex-M targets\n");
+		return false;
+	}
+	if (!flm_ram_region(t)) {
+		DEBUG_WARN("Target has no RAM to run the flash algorithm in\n");
+		return false;
+	}
+
+	size_t size = 0;
+	uint8_t *const data = flm_file_read(path, &size);
+	if (!data)
+		return false;
+	flm_algorithm_s algorithm;
+	const uint8_t *device = NULL;
+	size_t device_size = 0;
+	uint8_t *const image = flm_parse(data, size, &algorithm, &device, &device_size);
+	const bool result = image && flm_flash_add(t, &algorithm, image, device, device_size);
+	free(image);
+	free(data);
+	return result;
+}
@@ -27,15 +27,20 @@
 #include <sys/time.h>
 
 #include "ftdi_bmp.h"
+#include "gdb_perf.h"
+#include "probe_stats.h"
 #include <ftdi.h>
 
-#if defined(USE_USB_VERSION_BIT)
 typedef struct ftdi_transfer_control ftdi_transfer_control_s;
-#endif
 
 ftdi_context_s *ftdic;
 
 #define BUF_SIZE 4096U
+/* The most bytes a single MPSSE clock data command can shift */
+#define MPSSE_MAX_SHIFT_BYTES 65536U
+/* Reads longer than this are streamed in chunks of LIBFTDI_STREAM_CHUNK bytes */
+#define LIBFTDI_STREAM_MIN   1024U
+#define LIBFTDI_STREAM_CHUNK 65536U
 static uint8_t outbuf[BUF_SIZE];
 static uint16_t bufptr = 0;
 
@@ -594,6 +599,8 @@ void libftdi_buffer_flush(void)
 	if (!bufptr)
 		return;
 	DEBUG_WIRE("Flush %d\n", bufptr);
+	PROBE_STATS_COUNT(usb_packets_sent);
+	const uint64_t start = gdb_perf_timestamp();
 #if defined(USE_USB_VERSION_BIT)
 	if (tc_write)
 		ftdi_transfer_data_done(tc_write);
@@ -602,6 +609,7 @@ void libftdi_buffer_flush(void)
 	assert(ftdi_write_data(ftdic, outbuf, bufptr) == bufptr);
 	DEBUG_WIRE("FT2232 libftdi_buffer flush: %d bytes\n", bufptr);
 #endif
+	gdb_perf_transport(start);
 	bufptr = 0;
 }
 
@@ -609,13 +617,15 @@ size_t libftdi_buffer_write(const uint8_t *data, size_t size)
 {
 	if ((bufptr + size) / BUF_SIZE > 0)
 		libftdi_buffer_flush();
-	DEBUG_WIRE("Write %d bytes:", size);
-	for (size_t i = 0; i < size; i++) {
-		DEBUG_WIRE(" %02x", data[i]);
-		if (i && (i & 0xfU) == 0xfU)
-			DEBUG_WIRE("\n\t");
+	if (DEBUG_LEVEL_ENABLED(BMP_DEBUG_WIRE)) {
+		DEBUG_WIRE("Write %zu bytes:", size);
+		for (size_t i = 0; i < size; i++) {
+			DEBUG_WIRE(" %02x", data[i]);
+			if (i && (i & 0xfU) == 0xfU)
+				DEBUG_WIRE("\n\t");
+		}
+		DEBUG_WIRE("\n");
 	}
-	DEBUG_WIRE("\n");
 	memcpy(outbuf + bufptr, data, size);
 	bufptr += size;
 	return size;
@@ -623,54 +633,80 @@ size_t libftdi_buffer_write(const uint8_t *data, size_t size)
 
 size_t libftdi_buffer_read(uint8_t *data, size_t size)
 {
+	PROBE_STATS_COUNT(usb_packets_received);
 #if defined(USE_USB_VERSION_BIT)
 	outbuf[bufptr++] = SEND_IMMEDIATE;
 	libftdi_buffer_flush();
+	const uint64_t start = gdb_perf_timestamp();
 	ftdi_transfer_control_s *tc = ftdi_read_data_submit(ftdic, data, size);
 	ftdi_transfer_data_done(tc);
 #else
 	const uint8_t cmd = SEND_IMMEDIATE;
 	libftdi_buffer_write(&cmd, 1);
 	libftdi_buffer_flush();
+	const uint64_t start = gdb_perf_timestamp();
 	for (size_t index = 0; index < size;)
 		index += ftdi_read_data(ftdic, data + index, size - index);
 #endif
-	DEBUG_WIRE("Read  %d bytes:", size);
-	for (size_t i = 0; i < size; i++) {
-		DEBUG_WIRE(" %02x", data[i]);
-		if ((i & 0xfU) == 0xfU)
-			DEBUG_WIRE("\n\t");
+	gdb_perf_transport(start);
+	if (DEBUG_LEVEL_ENABLED(BMP_DEBUG_WIRE)) {
+		DEBUG_WIRE("Read  %zu bytes:", size);
+		for (size_t i = 0; i < size; i++) {
+			DEBUG_WIRE(" %02x", data[i]);
+			if ((i & 0xfU) == 0xfU)
+				DEBUG_WIRE("\n\t");
+		}
+		DEBUG_WIRE("\n");
 	}
-	DEBUG_WIRE("\n");
 	return size;
 }
 
-void libftdi_jtagtap_tdi_tdo_seq(uint8_t *data_out, const bool final_tms, const uint8_t *data_in, size_t ticks)
+/*
+ * Start collecting size bytes of response before the commands producing it are sent, so the
+ * FTDI's receive buffer gets drained while they are still going out, and the MPSSE never stalls
+ * with the write waiting on it. Complete with libftdi_buffer_read_finish().
+ */
+static ftdi_transfer_control_s *libftdi_buffer_read_start(uint8_t *const data, const size_t size)
 {
-	if (!ticks)
-		return;
-	if (!data_in && !data_out)
-		return;
+	libftdi_buffer_flush();
+	return ftdi_read_data_submit(ftdic, data, size);
+}
 
-	DEBUG_WIRE("libftdi_jtagtap_tdi_tdo_seq %s ticks: %d\n",
-		data_in && data_out ? "read/write" :
-			data_in         ? "write" :
-							  "read",
-		ticks);
+static void libftdi_buffer_read_finish(ftdi_transfer_control_s *const transfer)
+{
+	PROBE_STATS_COUNT(usb_packets_received);
+	const uint8_t cmd = SEND_IMMEDIATE;
+	libftdi_buffer_write(&cmd, 1);
+	libftdi_buffer_flush();
+	const uint64_t start = gdb_perf_timestamp();
+	assert(transfer && ftdi_transfer_data_done(transfer) >= 0);
+	gdb_perf_transport(start);
+}
+
+/*
+ * Queue the MPSSE commands for a sequence without collecting what gets clocked in, returning
+ * how many bytes of response the MPSSE will produce for it if read is set. This lets several
+ * sequences share one read back, see libftdi_jtagtap_tdi_tdo_unpack().
+ */
+size_t libftdi_jtagtap_tdi_tdo_queue(const bool read, const bool final_tms, const uint8_t *const data_in, size_t ticks)
+{
 	if (final_tms)
 		--ticks;
-	uint8_t rticks = ticks & 7U;
+	const uint8_t rticks = ticks & 7U;
 	ticks >>= 3U;
 	uint8_t data[8];
-	uint8_t cmd = (data_out ? MPSSE_DO_READ : 0U) | (data_in ? (MPSSE_DO_WRITE | MPSSE_WRITE_NEG) : 0U) | MPSSE_LSB;
+	uint8_t cmd = (read ? MPSSE_DO_READ : 0U) | (data_in ? (MPSSE_DO_WRITE | MPSSE_WRITE_NEG) : 0U) | MPSSE_LSB;
 	size_t rsize = ticks;
-	if (ticks) {
+	for (size_t offset = 0; offset < ticks;) {
+		const size_t amount = MIN(ticks - offset, MPSSE_MAX_SHIFT_BYTES);
 		data[0] = cmd;
-		data[1] = ticks - 1U;
-		data[2] = 0;
+		data[1] = (amount - 1U) & 0xffU;
+		data[2] = (amount - 1U) >> 8U;
 		libftdi_buffer_write(data, 3U);
-		if (data_in)
-			libftdi_buffer_write(data_in, ticks);
+		/* Hand the data over in pieces the output buffer can always take */
+		for (size_t piece = 0; data_in && piece < amount; piece += BUF_SIZE / 2U)
+			libftdi_buffer_write(data_in + offset + piece, MIN(amount - piece, BUF_SIZE / 2U));
+		offset += amount;
 	}
 	size_t index = 0;
 	if (rticks) {
@@ -682,34 +718,78 @@ void libftdi_jtagtap_tdi_tdo_seq(uint8_t *data_out, const bool final_tms, const
 	}
 	if (final_tms) {
 		rsize++;
-		data[index++] = MPSSE_WRITE_TMS | (data_out ? MPSSE_DO_READ : 0) | MPSSE_LSB | MPSSE_BITMODE | MPSSE_WRITE_NEG;
+		data[index++] = MPSSE_WRITE_TMS | (read ? MPSSE_DO_READ : 0) | MPSSE_LSB | MPSSE_BITMODE | MPSSE_WRITE_NEG;
 		data[index++] = 0;
 		if (data_in)
 			data[index++] = (data_in[ticks] & (1U << rticks)) ? 0x81U : 0x01U;
 	}
 	if (index)
 		libftdi_buffer_write(data, index);
-	if (data_out) {
-		size_t index = 0;
-		uint8_t *tmp = alloca(rsize);
-		libftdi_buffer_read(tmp, rsize);
-		if (final_tms)
-			rsize--;
+	return read ? rsize : 0U;
+}
 
-		while (rsize--)
-			*data_out++ = tmp[index++];
+/* Turn the response to a sequence queued with libftdi_jtagtap_tdi_tdo_queue() into the bits clocked in */
+void libftdi_jtagtap_tdi_tdo_unpack(
+	uint8_t *data_out, const bool final_tms, const uint8_t *const response, size_t ticks)
+{
+	if (final_tms)
+		--ticks;
+	uint8_t rticks = ticks & 7U;
+	size_t rsize = (ticks >> 3U) + (rticks ? 1U : 0U);
+	size_t index = 0;
+	while (rsize--)
+		*data_out++ = response[index++];
+	if (final_tms) {
+		/* The final bit comes in from the TMS shift, as the MSb of its own byte */
 		if (rticks == 0)
 			*data_out++ = 0;
+		rticks++;
+		*(--data_out) >>= 1U;
+		*data_out |= response[index] & 0x80U;
+	} else
+		--data_out;
 
-		if (final_tms) {
-			rticks++;
-			*(--data_out) >>= 1U;
-			*data_out |= tmp[index] & 0x80U;
-		} else
-			--data_out;
+	if (rticks)
+		*data_out >>= (8U - rticks);
+}
 
-		if (rticks)
-			*data_out >>= (8U - rticks);
+void libftdi_jtagtap_tdi_tdo_seq(uint8_t *data_out, const bool final_tms, const uint8_t *data_in, size_t ticks)
+{
+	if (!ticks)
+		return;
+	if (!data_in && !data_out)
+		return;
+
+	DEBUG_WIRE("libftdi_jtagtap_tdi_tdo_seq %s ticks: %d\n",
+		data_in && data_out ? "read/write" :
+			data_in         ? "write" :
+							  "read",
+		ticks);
+	/*
+	 * Long reads are streamed with the whole bytes landing directly in data_out, collecting each
+	 * chunk while its commands go out. The tail bits and the final TMS bit take the path below.
+	 */
+	if (data_out && (ticks >> 3U) > LIBFTDI_STREAM_MIN) {
+		const size_t bytes = (ticks - (final_tms ? 1U : 0U)) >> 3U;
+		for (size_t offset = 0; offset < bytes;) {
+			const size_t amount = MIN(bytes - offset, LIBFTDI_STREAM_CHUNK);
+			ftdi_transfer_control_s *const transfer = libftdi_buffer_read_start(data_out + offset, amount);
+			libftdi_jtagtap_tdi_tdo_queue(true, false, data_in ? data_in + offset : NULL, amount << 3U);
+			libftdi_buffer_read_finish(transfer);
+			offset += amount;
+		}
+		data_out += bytes;
+		if (data_in)
+			data_in += bytes;
+		ticks -= bytes << 3U;
+		if (!ticks)
+			return;
+	}
+	const size_t rsize = libftdi_jtagtap_tdi_tdo_queue(data_out, final_tms, data_in, ticks);
+	if (data_out) {
+		uint8_t *tmp = alloca(rsize);
+		libftdi_buffer_read(tmp, rsize);
+		libftdi_jtagtap_tdi_tdo_unpack(data_out, final_tms, tmp, ticks);
 	}
 }
 
@@ -26,6 +26,7 @@
 #include "jtagtap.h"
 
 #include "bmp_hosted.h"
+#include "adiv5.h"
 
 typedef struct data_desc {
 	int16_t data_low;
@@ -147,6 +148,19 @@ void libftdi_jtagtap_tdi_tdo_seq(
 {
 }
 
+size_t libftdi_jtagtap_tdi_tdo_queue(bool read, bool final_tms, const uint8_t *data_in, size_t ticks)
+{
+	return 0;
+}
+
+void libftdi_jtagtap_tdi_tdo_unpack(uint8_t *data_out, bool final_tms, const uint8_t *response, size_t ticks)
+{
+}
+
+void libftdi_swdptap_dp_defaults(adiv5_debug_port_s *dp)
+{
+}
+
 bool libftdi_swd_possible(void)
 {
 	return false;
@@ -186,6 +200,9 @@ size_t libftdi_buffer_write(const uint8_t *data, size_t size);
 size_t libftdi_buffer_read(uint8_t *data, size_t size);
 const char *libftdi_target_voltage(void);
 void libftdi_jtagtap_tdi_tdo_seq(uint8_t *data_out, bool final_tms, const uint8_t *data_in, size_t ticks);
+size_t libftdi_jtagtap_tdi_tdo_queue(bool read, bool final_tms, const uint8_t *data_in, size_t ticks);
+void libftdi_jtagtap_tdi_tdo_unpack(uint8_t *data_out, bool final_tms, const uint8_t *response, size_t ticks);
+void libftdi_swdptap_dp_defaults(adiv5_debug_port_s *dp);
 bool libftdi_swd_possible(void);
 void libftdi_max_frequency_set(uint32_t freq);
 uint32_t libftdi_max_frequency_get(void);
@@ -44,10 +44,13 @@
 #include <assert.h>
 #include <errno.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "gdb_if.h"
 #include "bmp_hosted.h"
 #include "command.h"
+#include "gdb_perf.h"
 
 static const uint16_t default_port = 2000U;
 static const uint16_t max_port = default_port + 4U;
@@ -65,14 +68,67 @@ static inline int closesocket(const int s)
 }
 #endif
 
-static int gdb_if_serv = -1;
+#define GDB_IF_MAX_PORTS 8U
+
+static int gdb_if_serv[GDB_IF_MAX_PORTS] = {-1, -1, -1, -1, -1, -1, -1, -1};
+static size_t gdb_if_ports = 1U;
+static size_t gdb_if_conn_port = 0U;
 static int gdb_if_conn = -1;
 bool shutdown_bmda = false;
 
-#define GDB_BUFFER_LEN 2048U
+/*
+ * Output is collected until a flush, and the buffer is big enough to hold a whole worst case
+ * packet ('$', a fully escaped payload, '#' and the checksum) so each packet goes out in one send().
+ */
+#define GDB_BUFFER_LEN ((GDB_PACKET_BUFFER_SIZE * 2U) + 4U)
 static size_t gdb_buffer_used = 0U;
 static char gdb_buffer[GDB_BUFFER_LEN];
 
+/*
+ * Input is received in bulk by a dedicated thread and handed out a character at a time from this
+ * ring. That keeps the socket serviced (and a Ctrl-C from GDB seen promptly) while the main thread
+ * is blocked doing probe I/O, which stays single-threaded as the probe and target code expect.
+ */
+#define GDB_RX_BUFFER_LEN 4096U
+
+typedef struct gdb_if_rx {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	pthread_t thread;
+	char buffer[GDB_RX_BUFFER_LEN];
+	size_t head;
+	size_t tail;
+	size_t used;
+	bool closed;
+} gdb_if_rx_s;
+
+static gdb_if_rx_s gdb_rx = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.changed = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+ * Target access is held by the main thread except while it waits on GDB in here, giving other
+ * threads (such as the local IPC server) a window to operate on the target. When it takes access
+ * back it lets any waiting thread go first, so those get in even while GDB is polling a running target.
+ */
+typedef struct gdb_if_target_access {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	bool held;
+	size_t waiting;
+} gdb_if_target_access_s;
+
+static gdb_if_target_access_s gdb_target_access = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.changed = PTHREAD_COND_INITIALIZER,
+	.held = true,
+};
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 typedef struct sockaddr sockaddr_s;
 typedef struct sockaddr_in sockaddr_in_s;
 typedef struct sockaddr_in6 sockaddr_in6_s;
@@ -200,6 +256,49 @@ static void socket_set_flags(const int socket, const int flags)
 #endif
 }
 
+void gdb_if_set_ports(const size_t count)
+{
+	gdb_if_ports = MAX(1U, MIN(count, GDB_IF_MAX_PORTS));
+}
+
+size_t gdb_if_connection_port(void)
+{
+	return gdb_if_conn_port;
+}
+
+/* Set up a socket listening on the given port, returning it or -1 on failure */
+static int gdb_if_listen(const uint16_t port)
+{
+	const sockaddr_storage_s addr = sockaddr_prepare(port);
+	if (addr.ss_family == AF_UNSPEC) {
+		DEBUG_WARN("Failed to get a suitable socket address\n");
+		return -1;
+	}
+
+	const int serv = socket(addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+	if (serv == -1) {
+		display_socket_error(socket_error(), serv, "socket returned");
+		return -1;
+	}
+
+	if (!socket_set_int_opt(serv, SOL_SOCKET, SO_REUSEADDR, 1) ||
+		!socket_set_int_opt(serv, IPPROTO_TCP, TCP_NODELAY, 1))
+		return -1;
+
+	if (bind(serv, (sockaddr_s *)&addr, family_to_size(addr.ss_family)) == -1) {
+		handle_error(serv, "binding socket");
+		return -1;
+	}
+
+	if (listen(serv, 1) == -1) {
+		handle_error(serv, "listening on socket");
+		return -1;
+	}
+	/* Connections are only accepted once select() says one is waiting, but it may go away again */
+	socket_set_flags(serv, socket_get_flags(serv) | O_NONBLOCK);
+	return serv;
+}
+
 int gdb_if_init(void)
 {
 #if defined(_WIN32) || defined(__CYGWIN__)
@@ -210,114 +309,290 @@ int gdb_if_init(void)
 		return -1;
 	}
 #endif
+	/* Find a run of consecutive ports we can listen on all of */
 	for (uint16_t port = default_port; port < max_port; ++port) {
-		const sockaddr_storage_s addr = sockaddr_prepare(port);
-		if (addr.ss_family == AF_UNSPEC) {
-			DEBUG_WARN("Failed to get a suitable socket address\n");
-			return -1;
+		size_t bound = 0;
+		for (; bound < gdb_if_ports; ++bound) {
+			gdb_if_serv[bound] = gdb_if_listen(port + bound);
+			if (gdb_if_serv[bound] == -1)
+				break;
 		}
-
-		gdb_if_serv = socket(addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
-		if (gdb_if_serv == -1) {
-			display_socket_error(socket_error(), gdb_if_serv, "socket returned");
-			continue;
+		if (bound == gdb_if_ports) {
+			if (gdb_if_ports == 1U)
+				DEBUG_WARN("Listening on TCP port: %d\n", port);
+			else
+				DEBUG_WARN("Listening on TCP ports: %d to %zu\n", port, port + gdb_if_ports - 1U);
+			return 0;
+		}
+		while (bound--) {
+			closesocket(gdb_if_serv[bound]);
+			gdb_if_serv[bound] = -1;
 		}
+	}
 
-		if (!socket_set_int_opt(gdb_if_serv, SOL_SOCKET, SO_REUSEADDR, 1) ||
-			!socket_set_int_opt(gdb_if_serv, IPPROTO_TCP, TCP_NODELAY, 1))
-			continue;
+	DEBUG_WARN("Failed to acquire a port to listen on\n");
+	return -1;
+}
 
-		if (bind(gdb_if_serv, (sockaddr_s *)&addr, family_to_size(addr.ss_family)) == -1) {
-			handle_error(gdb_if_serv, "binding socket");
-			continue;
-		}
+void gdb_if_target_access_acquire(void)
+{
+	pthread_mutex_lock(&gdb_target_access.lock);
+	++gdb_target_access.waiting;
+	while (gdb_target_access.held)
+		pthread_cond_wait(&gdb_target_access.changed, &gdb_target_access.lock);
+	--gdb_target_access.waiting;
+	gdb_target_access.held = true;
+	pthread_mutex_unlock(&gdb_target_access.lock);
+}
 
-		if (listen(gdb_if_serv, 1) == -1) {
-			handle_error(gdb_if_serv, "listening on socket");
+void gdb_if_target_access_release(void)
+{
+	pthread_mutex_lock(&gdb_target_access.lock);
+	gdb_target_access.held = false;
+	pthread_cond_broadcast(&gdb_target_access.changed);
+	pthread_mutex_unlock(&gdb_target_access.lock);
+}
+
+/* Take target access back for the main thread, behind anything already waiting for it */
+static void gdb_if_target_access_reclaim(void)
+{
+	pthread_mutex_lock(&gdb_target_access.lock);
+	while (gdb_target_access.held || gdb_target_access.waiting)
+		pthread_cond_wait(&gdb_target_access.changed, &gdb_target_access.lock);
+	gdb_target_access.held = true;
+	pthread_mutex_unlock(&gdb_target_access.lock);
+}
+
+/* Receive from the connection into the ring until the remote end goes away or the socket fails */
+static void *gdb_if_rx_worker(void *const arg)
+{
+	const int conn = (int)(intptr_t)arg;
+	char chunk[GDB_RX_BUFFER_LEN];
+	while (true) {
+		const int result = recv(conn, chunk, GDB_RX_BUFFER_LEN, 0);
+		if (result < 0 && socket_error() == op_needs_retry)
 			continue;
+		if (result <= 0) {
+			display_socket_error(socket_error(), conn, "on socket");
+			break;
 		}
 
-		DEBUG_WARN("Listening on TCP port: %d\n", port);
-		return 0;
+		/* Hand the chunk over, waiting for the main thread to make room where it has to */
+		pthread_mutex_lock(&gdb_rx.lock);
+		for (size_t offset = 0; offset < (size_t)result;) {
+			while (gdb_rx.used == GDB_RX_BUFFER_LEN)
+				pthread_cond_wait(&gdb_rx.changed, &gdb_rx.lock);
+			const size_t space = MIN(GDB_RX_BUFFER_LEN - gdb_rx.used, GDB_RX_BUFFER_LEN - gdb_rx.head);
+			const size_t amount = MIN(space, (size_t)result - offset);
+			memcpy(gdb_rx.buffer + gdb_rx.head, chunk + offset, amount);
+			gdb_rx.head = (gdb_rx.head + amount) % GDB_RX_BUFFER_LEN;
+			gdb_rx.used += amount;
+			offset += amount;
+			pthread_cond_signal(&gdb_rx.changed);
+		}
+		pthread_mutex_unlock(&gdb_rx.lock);
 	}
 
-	DEBUG_WARN("Failed to acquire a port to listen on\n");
-	return -1;
+	pthread_mutex_lock(&gdb_rx.lock);
+	gdb_rx.closed = true;
+	pthread_cond_signal(&gdb_rx.changed);
+	pthread_mutex_unlock(&gdb_rx.lock);
+	return NULL;
 }
 
-char gdb_if_getchar(void)
+/* Tear down the connection once the receive thread has seen it close */
+static void gdb_if_disconnect(void)
 {
-	if (gdb_if_conn == -1) {
-		if (shutdown_bmda)
-			return '\x04';
-		const int flags = socket_get_flags(gdb_if_serv);
-		socket_set_flags(gdb_if_serv, flags | O_NONBLOCK);
-		gdb_if_conn = -1;
-		while (gdb_if_conn == -1) {
-			gdb_if_conn = accept(gdb_if_serv, NULL, NULL);
+	pthread_join(gdb_rx.thread, NULL);
+	closesocket(gdb_if_conn);
+	gdb_if_conn = -1;
+	gdb_buffer_used = 0U;
+}
+
+/* Wait for a connection on any of the ports we listen on */
+static void gdb_if_accept(void)
+{
+	while (gdb_if_conn == -1) {
+		fd_set fds;
+		FD_ZERO(&fds);
+		for (size_t i = 0; i < gdb_if_ports; ++i)
+			FD_SET(gdb_if_serv[i], &fds);
+		timeval_s timeout = {.tv_sec = 0, .tv_usec = 100000};
+		const int result = select(FD_SETSIZE, &fds, NULL, NULL, &timeout);
+		if (result == -1) {
+			const int error = socket_error();
+			if (error == op_needs_retry)
+				continue;
+			display_socket_error(error, gdb_if_serv[0], "waiting for a connection on socket");
+			exit(1);
+		}
+		if (result == 0) {
+			SET_IDLE_STATE(1);
+			if (shutdown_bmda)
+				return;
+			continue;
+		}
+
+		for (size_t i = 0; i < gdb_if_ports && gdb_if_conn == -1; ++i) {
+			if (!FD_ISSET(gdb_if_serv[i], &fds))
+				continue;
+			gdb_if_conn = accept(gdb_if_serv[i], NULL, NULL);
 			if (gdb_if_conn == -1) {
 				const int error = socket_error();
-				if (error == op_would_block) {
-					SET_IDLE_STATE(1);
-					platform_delay(100);
-				} else {
-					display_socket_error(error, gdb_if_serv, "accepting connection from socket");
+				if (error != op_would_block && error != op_needs_retry) {
+					display_socket_error(error, gdb_if_serv[i], "accepting connection from socket");
 					exit(1);
 				}
-				continue;
-			}
+			} else
+				gdb_if_conn_port = i;
 		}
-		DEBUG_INFO("Got connection\n");
-		socket_set_flags(gdb_if_serv, flags);
-		socket_set_flags(gdb_if_conn, socket_get_flags(gdb_if_conn) & ~O_NONBLOCK);
 	}
+	DEBUG_INFO("Got connection on port %zu\n", gdb_if_conn_port);
+	gdb_rx.head = 0U;
+	gdb_rx.tail = 0U;
+	gdb_rx.used = 0U;
+	gdb_rx.closed = false;
+	gdb_buffer_used = 0U;
+	socket_set_flags(gdb_if_conn, socket_get_flags(gdb_if_conn) & ~O_NONBLOCK);
+	if (pthread_create(&gdb_rx.thread, NULL, gdb_if_rx_worker, (void *)(intptr_t)gdb_if_conn)) {
+		DEBUG_WARN("Could not start the GDB receive thread\n");
+		closesocket(gdb_if_conn);
+		gdb_if_conn = -1;
+		return;
+	}
+}
 
-	char value = '\0';
-	int error = op_needs_retry;
-	while (error == op_needs_retry) {
-		const int result = recv(gdb_if_conn, &value, 1, 0);
-		if (result < 0) {
-			error = socket_error();
-			if (error == op_needs_retry)
-				continue;
-		} else
-			error = 0;
+/*
+ * Wait up to the given deadline (or forever when it's NULL) for input. Must be called with the
+ * lock held, and returns whether a character is available.
+ */
+static bool gdb_if_rx_wait(const struct timespec *const deadline)
+{
+	while (!gdb_rx.used && !gdb_rx.closed) {
+		if (!deadline)
+			pthread_cond_wait(&gdb_rx.changed, &gdb_rx.lock);
+		else if (pthread_cond_timedwait(&gdb_rx.changed, &gdb_rx.lock, deadline) == ETIMEDOUT)
+			break;
+	}
+	return gdb_rx.used != 0U;
+}
 
-		if (result <= 0) {
-			handle_error(gdb_if_conn, "on socket");
-			gdb_if_conn = -1;
-			/* Return '+' in case we were waiting for an ACK */
-			return '+';
-		}
+/* Take the next character from the ring, called with the lock held and the ring not empty */
+static char gdb_if_rx_take(void)
+{
+	const char c = gdb_rx.buffer[gdb_rx.tail];
+	gdb_rx.tail = (gdb_rx.tail + 1U) % GDB_RX_BUFFER_LEN;
+	/* Only wake the receive thread if it could have been waiting on the ring being full */
+	if (gdb_rx.used-- == GDB_RX_BUFFER_LEN)
+		pthread_cond_signal(&gdb_rx.changed);
+	return c;
+}
+
+static char gdb_if_receive(void)
+{
+	if (gdb_if_conn == -1) {
+		if (shutdown_bmda)
+			return '\x04';
+		gdb_if_accept();
+		if (gdb_if_conn == -1)
+			return '\x04';
+	}
+
+	pthread_mutex_lock(&gdb_rx.lock);
+	if (gdb_if_rx_wait(NULL)) {
+		const char c = gdb_if_rx_take();
+		pthread_mutex_unlock(&gdb_rx.lock);
+		return c;
 	}
-	return value;
+	pthread_mutex_unlock(&gdb_rx.lock);
+	gdb_if_disconnect();
+	/* Return '+' in case we were waiting for an ACK */
+	return '+';
 }
 
-char gdb_if_getchar_to(uint32_t timeout)
+static char gdb_if_receive_to(const uint32_t timeout)
 {
 	if (gdb_if_conn == -1)
 		return -1;
 
-	timeval_s select_timeout;
-	select_timeout.tv_sec = timeout / 1000U;
-	select_timeout.tv_usec = (timeout % 1000U) * 1000U;
-
-	fd_set fds;
-	FD_ZERO(&fds);
-	FD_SET(gdb_if_conn, &fds);
+	/* Condition variable timeouts are absolute against the realtime clock */
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout / 1000U;
+	deadline.tv_nsec += (long)(timeout % 1000U) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		++deadline.tv_sec;
+		deadline.tv_nsec -= 1000000000L;
+	}
 
-	if (select(FD_SETSIZE, &fds, NULL, NULL, &select_timeout) > 0)
-		return gdb_if_getchar();
+	pthread_mutex_lock(&gdb_rx.lock);
+	const bool available = gdb_if_rx_wait(&deadline);
+	const bool closed = gdb_rx.closed;
+	pthread_mutex_unlock(&gdb_rx.lock);
+	/* Let gdb_if_receive() deal with the connection having gone away */
+	if (available || closed)
+		return gdb_if_receive();
 	return -1;
 }
 
+char gdb_if_getchar(void)
+{
+	gdb_if_target_access_release();
+	const char c = gdb_if_receive();
+	gdb_if_target_access_reclaim();
+	return c;
+}
+
+size_t gdb_if_peek(const char **const data)
+{
+	if (gdb_if_conn == -1)
+		return 0;
+	/* The receive thread only ever adds to the ring, so what's there now stays put until consumed */
+	pthread_mutex_lock(&gdb_rx.lock);
+	*data = gdb_rx.buffer + gdb_rx.tail;
+	const size_t length = MIN(gdb_rx.used, GDB_RX_BUFFER_LEN - gdb_rx.tail);
+	pthread_mutex_unlock(&gdb_rx.lock);
+	return length;
+}
+
+void gdb_if_consume(const size_t count)
+{
+	if (!count)
+		return;
+	pthread_mutex_lock(&gdb_rx.lock);
+	gdb_rx.tail = (gdb_rx.tail + count) % GDB_RX_BUFFER_LEN;
+	/* Only wake the receive thread if it could have been waiting on the ring being full */
+	if (gdb_rx.used == GDB_RX_BUFFER_LEN)
+		pthread_cond_signal(&gdb_rx.changed);
+	gdb_rx.used -= count;
+	pthread_mutex_unlock(&gdb_rx.lock);
+}
+
+char gdb_if_getchar_to(const uint32_t timeout)
+{
+	gdb_if_target_access_release();
+	const char c = gdb_if_receive_to(timeout);
+	gdb_if_target_access_reclaim();
+	return c;
+}
+
 void gdb_if_putchar(char c, int flush)
 {
 	if (gdb_if_conn == -1)
 		return;
 	gdb_buffer[gdb_buffer_used++] = c;
 	if (flush || gdb_buffer_used == GDB_BUFFER_LEN) {
-		send(gdb_if_conn, gdb_buffer, gdb_buffer_used, 0);
+		gdb_perf_output(gdb_buffer_used);
+		/* send() may take only part of the buffer, keep going till it's all out or the connection fails */
+		for (size_t offset = 0; offset < gdb_buffer_used;) {
+			const int result = send(gdb_if_conn, gdb_buffer + offset, gdb_buffer_used - offset, MSG_NOSIGNAL);
+			if (result < 0 && socket_error() == op_needs_retry)
+				continue;
+			/* Errors get picked up and the connection closed by the next gdb_if_getchar() */
+			if (result <= 0)
+				break;
+			offset += (size_t)result;
+		}
 		gdb_buffer_used = 0;
 	}
 }
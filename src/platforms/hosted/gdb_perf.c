@@ -0,0 +1,211 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2026 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements the per GDB packet type latency and traffic accounting
+ * shown by "monitor perf" and, given --perf, when BMDA exits.
+ */
+
+#include "general.h"
+#include "gdb_packet.h"
+#include "gdb_perf.h"
+#include "bmp_hosted.h"
+
+#include <stdarg.h>
+#include <sys/time.h>
+
+#define GDB_PERF_TYPES      32U
+#define GDB_PERF_NAME_LEN   16U
+/* Latency histogram buckets are powers of two in microseconds, the last one catching everything above ~8s */
+#define GDB_PERF_BUCKETS    24U
+
+typedef struct gdb_perf_type {
+	char name[GDB_PERF_NAME_LEN];
+	uint32_t count;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t total_us;
+	uint64_t transport_us;
+	uint32_t max_us;
+	uint32_t histogram[GDB_PERF_BUCKETS];
+} gdb_perf_type_s;
+
+typedef struct gdb_perf_sample {
+	gdb_perf_type_s *type;
+	uint64_t start;
+	uint64_t transport_us;
+	uint64_t bytes_out;
+} gdb_perf_sample_s;
+
+static gdb_perf_type_s gdb_perf_types[GDB_PERF_TYPES];
+static uint64_t gdb_perf_transport_us;
+static uint64_t gdb_perf_bytes_out;
+static gdb_perf_sample_s gdb_perf_current;
+
+uint64_t gdb_perf_timestamp(void)
+{
+	timeval_s tv;
+	gettimeofday(&tv, NULL);
+	return ((uint64_t)tv.tv_sec * 1000000U) + (uint64_t)tv.tv_usec;
+}
+
+void gdb_perf_transport(const uint64_t start)
+{
+	gdb_perf_transport_us += gdb_perf_timestamp() - start;
+}
+
+void gdb_perf_output(const size_t count)
+{
+	gdb_perf_bytes_out += count;
+}
+
+/*
+ * Query and verbose packets are told apart by their name ("qXfer", "vFlashWrite"),
+ * everything else by its leading character. Returns false for things that aren't packets.
+ */
+static bool gdb_perf_name(const char *const packet, const size_t length, char *const name)
+{
+	if (!length || packet[0] < '!' || packet[0] > '~')
+		return false;
+	size_t offset = 1;
+	if (packet[0] == 'q' || packet[0] == 'Q' || packet[0] == 'v') {
+		for (; offset < length && offset < GDB_PERF_NAME_LEN - 1U; ++offset) {
+			if (packet[offset] == ':' || packet[offset] == ',' || packet[offset] == ';' || packet[offset] == '?')
+				break;
+		}
+	}
+	memcpy(name, packet, offset);
+	name[offset] = '\0';
+	return true;
+}
+
+static gdb_perf_type_s *gdb_perf_type(const char *const name)
+{
+	for (size_t i = 0; i < GDB_PERF_TYPES; ++i) {
+		gdb_perf_type_s *const type = &gdb_perf_types[i];
+		if (!type->name[0]) {
+			strncpy(type->name, name, GDB_PERF_NAME_LEN - 1U);
+			return type;
+		}
+		if (strcmp(type->name, name) == 0)
+			return type;
+	}
+	/* Out of slots, so lump the rest together in the last one */
+	gdb_perf_type_s *const other = &gdb_perf_types[GDB_PERF_TYPES - 1U];
+	strncpy(other->name, "(other)", GDB_PERF_NAME_LEN - 1U);
+	return other;
+}
+
+void gdb_perf_packet_begin(const char *const packet, const size_t length)
+{
+	char name[GDB_PERF_NAME_LEN];
+	if (!gdb_perf_name(packet, length, name)) {
+		gdb_perf_current.type = NULL;
+		return;
+	}
+	gdb_perf_current.type = gdb_perf_type(name);
+	gdb_perf_current.type->bytes_in += length;
+	gdb_perf_current.transport_us = gdb_perf_transport_us;
+	gdb_perf_current.bytes_out = gdb_perf_bytes_out;
+	gdb_perf_current.start = gdb_perf_timestamp();
+}
+
+void gdb_perf_packet_end(void)
+{
+	gdb_perf_type_s *const type = gdb_perf_current.type;
+	if (!type)
+		return;
+	gdb_perf_current.type = NULL;
+	const uint64_t elapsed = gdb_perf_timestamp() - gdb_perf_current.start;
+	++type->count;
+	type->total_us += elapsed;
+	type->transport_us += gdb_perf_transport_us - gdb_perf_current.transport_us;
+	type->bytes_out += gdb_perf_bytes_out - gdb_perf_current.bytes_out;
+	if (elapsed > type->max_us)
+		type->max_us = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+	size_t bucket = 0;
+	while (bucket < GDB_PERF_BUCKETS - 1U && elapsed >= (2ULL << bucket))
+		++bucket;
+	++type->histogram[bucket];
+}
+
+void gdb_perf_reset(void)
+{
+	memset(gdb_perf_types, 0, sizeof(gdb_perf_types));
+	gdb_perf_current.type = NULL;
+}
+
+static void gdb_perf_print(const bool to_gdb, const char *const fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	if (to_gdb)
+		gdb_voutf(fmt, ap);
+	else
+		vprintf(fmt, ap);
+	va_end(ap);
+}
+
+/* The upper bound of the histogram bucket the given percentage of the samples fall inside of, capped at the max */
+static uint64_t gdb_perf_percentile(const gdb_perf_type_s *const type, const uint32_t percent)
+{
+	const uint64_t target = (((uint64_t)type->count * percent) + 99U) / 100U;
+	uint64_t seen = 0;
+	for (size_t bucket = 0; bucket < GDB_PERF_BUCKETS; ++bucket) {
+		seen += type->histogram[bucket];
+		if (seen >= target)
+			return bucket == GDB_PERF_BUCKETS - 1U ? type->max_us : MIN(2ULL << bucket, type->max_us);
+	}
+	return type->max_us;
+}
+
+void gdb_perf_show(const bool to_gdb)
+{
+	if (!gdb_perf_types[0].name[0]) {
+		gdb_perf_print(to_gdb, "No GDB packets recorded\n");
+		return;
+	}
+	gdb_perf_print(to_gdb, "%-15s %7s %10s %10s %10s %10s %8s %8s %8s %8s\n", "Packet", "Count", "Bytes in",
+		"Bytes out", "Total ms", "Probe ms", "p50 us", "p90 us", "p99 us", "Max us");
+	for (size_t i = 0; i < GDB_PERF_TYPES && gdb_perf_types[i].name[0]; ++i) {
+		const gdb_perf_type_s *const type = &gdb_perf_types[i];
+		if (!type->count)
+			continue;
+		gdb_perf_print(to_gdb,
+			"%-15s %7" PRIu32 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %8" PRIu64 " %8" PRIu64
+			" %8" PRIu64 " %8" PRIu32 "\n",
+			type->name, type->count, type->bytes_in, type->bytes_out, type->total_us / 1000U,
+			type->transport_us / 1000U, gdb_perf_percentile(type, 50U), gdb_perf_percentile(type, 90U),
+			gdb_perf_percentile(type, 99U), type->max_us);
+	}
+	gdb_perf_print(to_gdb, "Percentiles are histogram bucket upper bounds, probe time is spent in adaptor I/O\n");
+}
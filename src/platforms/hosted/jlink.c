@@ -45,6 +45,7 @@ static uint32_t emu_caps;
 static uint32_t emu_speed_khz;
 static uint16_t emu_min_divisor;
 static uint16_t emu_current_divisor;
+static uint32_t emu_free_memory;
 
 static void jlink_print_caps(bmp_info_s *const info)
 {
@@ -59,6 +60,13 @@ static void jlink_print_caps(bmp_info_s *const info)
 		send_recv(info->usb_link, NULL, 0, res, sizeof(res));
 		DEBUG_INFO("HW: Type %u, Major %u, Minor %u, Rev %u\n", res[3], res[2], res[1], res[0]);
 	}
+	/* This bounds how many SWD transactions fit into one batch */
+	if (emu_caps & JLINK_CAP_GET_FREE_MEMORY) {
+		uint8_t cmd = CMD_GET_FREE_MEMORY;
+		send_recv(info->usb_link, &cmd, 1, res, sizeof(res));
+		emu_free_memory = res[0] | (res[1] << 8U) | (res[2] << 16U) | (res[3] << 24U);
+		DEBUG_INFO("Free memory %" PRIu32 " bytes\n", emu_free_memory);
+	}
 }
 
 static void jlink_print_speed(bmp_info_s *const info)
@@ -228,6 +236,11 @@ bool jlink_init(bmp_info_s *const info)
 	return true;
 }
 
+uint32_t jlink_free_memory(void)
+{
+	return emu_free_memory;
+}
+
 const char *jlink_target_voltage(bmp_info_s *const info)
 {
 	static char ret[7];
@@ -22,27 +22,30 @@
 
 #include <stdbool.h>
 #include "bmp_hosted.h"
+#include "adiv5.h"
 
 /** @cond PRIVATE */
-#define CMD_GET_VERSION    0x01U
-#define CMD_SET_SPEED      0x05U
-#define CMD_GET_HW_STATUS  0x07U
-#define CMD_GET_SPEEDS     0xc0U
-#define CMD_GET_SELECT_IF  0xc7U
-#define CMD_HW_JTAG3       0xcfU
-#define CMD_HW_RESET0      0xdcU
-#define CMD_HW_RESET1      0xddU
-#define CMD_GET_CAPS       0xe8U
-#define CMD_GET_EXT_CAPS   0xedU
-#define CMD_GET_HW_VERSION 0xf0U
+#define CMD_GET_VERSION     0x01U
+#define CMD_SET_SPEED       0x05U
+#define CMD_GET_HW_STATUS   0x07U
+#define CMD_GET_SPEEDS      0xc0U
+#define CMD_GET_SELECT_IF   0xc7U
+#define CMD_HW_JTAG3        0xcfU
+#define CMD_GET_FREE_MEMORY 0xd4U
+#define CMD_HW_RESET0       0xdcU
+#define CMD_HW_RESET1       0xddU
+#define CMD_GET_CAPS        0xe8U
+#define CMD_GET_EXT_CAPS    0xedU
+#define CMD_GET_HW_VERSION  0xf0U
 
 #define JLINK_IF_GET_ACTIVE    0xfeU
 #define JLINK_IF_GET_AVAILABLE 0xffU
 
-#define JLINK_CAP_GET_SPEEDS     (1U << 9U)
-#define JLINK_CAP_GET_HW_VERSION (1U << 1U)
-#define JLINK_IF_JTAG            1U
-#define JLINK_IF_SWD             2U
+#define JLINK_CAP_GET_SPEEDS      (1U << 9U)
+#define JLINK_CAP_GET_HW_VERSION  (1U << 1U)
+#define JLINK_CAP_GET_FREE_MEMORY (1U << 11U)
+#define JLINK_IF_JTAG             1U
+#define JLINK_IF_SWD              2U
 
 #define SELECT_IF_JTAG 0U
 #define SELECT_IF_SWD  1U
@@ -89,6 +92,10 @@ uint32_t jlink_max_frequency_get(bmp_info_s *info)
 	return 0;
 }
 
+void jlink_adiv5_swdp_dp_defaults(adiv5_debug_port_s *dp)
+{
+}
+
 #pragma GCC diagnostic pop
 #else
 bool jlink_init(bmp_info_s *info);
@@ -99,6 +106,9 @@ void jlink_nrst_set_val(bmp_info_s *info, bool assert);
 bool jlink_nrst_get_val(bmp_info_s *info);
 void jlink_max_frequency_set(bmp_info_s *info, uint32_t freq);
 uint32_t jlink_max_frequency_get(bmp_info_s *info);
+void jlink_adiv5_swdp_dp_defaults(adiv5_debug_port_s *dp);
+/* Bytes of buffer the probe reported free for commands, 0 if it can't tell us */
+uint32_t jlink_free_memory(void);
 #endif
 
 #endif /* PLATFORMS_HOSTED_JLINK_H */
@@ -38,6 +38,34 @@ static uint32_t jlink_adiv5_swdp_error(adiv5_debug_port_s *dp, bool protocol_rec
 static uint32_t jlink_adiv5_swdp_low_access(adiv5_debug_port_s *dp, uint8_t RnW, uint16_t addr, uint32_t value);
 static void jlink_adiv5_swdp_abort(adiv5_debug_port_s *dp, uint32_t abort);
 
+/*
+ * Memory accesses are batched into a single HW_JTAG3 command carrying the bit streams of many SWD
+ * transactions back to back. The transactions use the same layout as the single access routines
+ * below, just concatenated: a read is 46 clocks and a write 54, including the trailing idle cycles.
+ * How many fit in a batch depends on the buffer the probe has free, which holds the direction and
+ * data bits on the way in and the sampled bits on the way out. Probes that can't say get the
+ * JLINK_SWD_BATCH_DEFAULT every J-Link manages.
+ */
+#define JLINK_SWD_BATCH_MAX     256U
+#define JLINK_SWD_BATCH_DEFAULT 32U
+#define JLINK_SWD_WRITE_BITS    54U
+#define JLINK_SWD_BATCH_BYTES   ((JLINK_SWD_BATCH_MAX * JLINK_SWD_WRITE_BITS + 7U) / 8U)
+/* Headroom left in the probe's buffer for the command header and status */
+#define JLINK_SWD_BATCH_MARGIN 64U
+
+#define ALIGNOF(x) (((x)&3U) == 0 ? ALIGN_WORD : (((x)&1U) == 0 ? ALIGN_HALFWORD : ALIGN_BYTE))
+
+typedef struct jlink_swd_batch {
+	uint8_t direction[JLINK_SWD_BATCH_BYTES];
+	uint8_t data[JLINK_SWD_BATCH_BYTES];
+	uint16_t offset[JLINK_SWD_BATCH_MAX]; /* Bit offset each transaction starts at */
+	uint8_t rnw[JLINK_SWD_BATCH_MAX];
+	size_t count;
+	size_t bits;
+} jlink_swd_batch_s;
+
+static size_t jlink_swd_batch_limit = JLINK_SWD_BATCH_DEFAULT;
+
 /*
  * Write at least 50 bits high, two bits low and read DP_IDR and put
  * idle cycles at the end
@@ -341,3 +369,220 @@ static void jlink_adiv5_swdp_abort(adiv5_debug_port_s *const dp, const uint32_t
 {
 	adiv5_dp_write(dp, ADIV5_DP_ABORT, abort);
 }
+
+static void jlink_swd_batch_init(jlink_swd_batch_s *const batch)
+{
+	memset(batch, 0, sizeof(*batch));
+}
+
+/* Append bits to the batch, LSb first, either driven by the probe (out) or sampled from the target */
+static void jlink_swd_batch_put(jlink_swd_batch_s *const batch, const uint32_t value, const size_t bits, const bool out)
+{
+	for (size_t bit = 0; bit < bits; ++bit, ++batch->bits) {
+		const size_t byte = batch->bits >> 3U;
+		const uint8_t mask = 1U << (batch->bits & 7U);
+		if (out)
+			batch->direction[byte] |= mask;
+		if (value & (1U << bit))
+			batch->data[byte] |= mask;
+	}
+}
+
+static uint32_t jlink_swd_batch_get(const uint8_t *const response, const size_t offset, const size_t bits)
+{
+	uint32_t value = 0;
+	for (size_t bit = 0; bit < bits; ++bit) {
+		const size_t position = offset + bit;
+		if (response[position >> 3U] & (1U << (position & 7U)))
+			value |= 1U << bit;
+	}
+	return value;
+}
+
+static void jlink_swd_batch_read(jlink_swd_batch_s *const batch, const uint16_t addr)
+{
+	batch->offset[batch->count] = batch->bits;
+	batch->rnw[batch->count++] = ADIV5_LOW_READ;
+	jlink_swd_batch_put(batch, make_packet_request(ADIV5_LOW_READ, addr), 8U, true);
+	/* ACK, data and parity in, then 2 idle cycles */
+	jlink_swd_batch_put(batch, 0U, 3U, false);
+	jlink_swd_batch_put(batch, 0U, 32U, false);
+	jlink_swd_batch_put(batch, 0U, 1U, false);
+	jlink_swd_batch_put(batch, 0U, 2U, true);
+}
+
+static void jlink_swd_batch_write(jlink_swd_batch_s *const batch, const uint16_t addr, const uint32_t value)
+{
+	batch->offset[batch->count] = batch->bits;
+	batch->rnw[batch->count++] = ADIV5_LOW_WRITE;
+	jlink_swd_batch_put(batch, make_packet_request(ADIV5_LOW_WRITE, addr), 8U, true);
+	/* Turnaround and ACK in, turnaround, data and parity out, then 8 idle cycles */
+	jlink_swd_batch_put(batch, 0U, 4U, false);
+	jlink_swd_batch_put(batch, 0U, 1U, true);
+	jlink_swd_batch_put(batch, value, 32U, true);
+	jlink_swd_batch_put(batch, __builtin_popcount(value) & 1U, 1U, true);
+	jlink_swd_batch_put(batch, 0U, 8U, true);
+}
+
+/* Run the whole batch in one USB round trip, leaving the sampled bits in response */
+static void jlink_swd_batch_run(const jlink_swd_batch_s *const batch, uint8_t *const response)
+{
+	uint8_t cmd[4U + 2U * JLINK_SWD_BATCH_BYTES];
+	const size_t bytes = (batch->bits + 7U) >> 3U;
+	cmd[0] = CMD_HW_JTAG3;
+	cmd[1] = 0U;
+	cmd[2] = batch->bits & 0xffU;
+	cmd[3] = batch->bits >> 8U;
+	memcpy(cmd + 4U, batch->direction, bytes);
+	memcpy(cmd + 4U + bytes, batch->data, bytes);
+	send_recv(info.usb_link, cmd, 4U + 2U * bytes, response, bytes);
+	send_recv(info.usb_link, NULL, 0U, response + bytes, 1U);
+	if (response[bytes] != 0)
+		raise_exception(EXCEPTION_ERROR, "Batched access failed");
+}
+
+/*
+ * Check every transaction in a batch was acknowledged (and every read arrived intact),
+ * returning the index of the first that wasn't, or the batch length if all went well
+ */
+static size_t jlink_swd_batch_check(const jlink_swd_batch_s *const batch, const uint8_t *const response)
+{
+	for (size_t idx = 0; idx < batch->count; ++idx) {
+		const size_t offset = batch->offset[idx];
+		if (jlink_swd_batch_get(response, offset + 8U, 3U) != SWDP_ACK_OK)
+			return idx;
+		if (batch->rnw[idx] == ADIV5_LOW_READ) {
+			const uint32_t value = jlink_swd_batch_get(response, offset + 11U, 32U);
+			const uint32_t parity = jlink_swd_batch_get(response, offset + 43U, 1U);
+			if ((__builtin_popcount(value) + parity) & 1U)
+				return idx;
+		}
+	}
+	return batch->count;
+}
+
+/*
+ * Once a transaction in a batch got a WAIT or FAULT response, everything clocked out after it
+ * put the wire out of step with the target, so reset the link and forget what SELECT held
+ */
+static void jlink_adiv5_swdp_recover(adiv5_debug_port_s *const dp)
+{
+	DEBUG_PROBE("Batched SWD access not acknowledged, retrying one access at a time\n");
+	jlink_adiv5_swdp_error(dp, true);
+	adiv5_dp_shadow_invalidate(dp);
+}
+
+static bool jlink_adiv5_mem_read_batch(
+	adiv5_access_port_s *const ap, uint8_t *dest, const uint32_t src, const size_t count, const align_e align)
+{
+	ap_mem_access_setup(ap, src, align);
+	if (ap->dp->fault)
+		return false;
+	/* AP reads are posted, so each result arrives with the next read and the last with RDBUFF */
+	jlink_swd_batch_s batch;
+	jlink_swd_batch_init(&batch);
+	for (size_t idx = 0; idx < count; ++idx)
+		jlink_swd_batch_read(&batch, ADIV5_AP_DRW);
+	jlink_swd_batch_read(&batch, ADIV5_DP_RDBUFF);
+	/* TAR has moved on, and may not have followed us across a 1KiB boundary */
+	ap->shadow_valid &= ~ADIV5_AP_SHADOW_TAR;
+
+	uint8_t response[JLINK_SWD_BATCH_BYTES + 1U];
+	jlink_swd_batch_run(&batch, response);
+	if (jlink_swd_batch_check(&batch, response) != batch.count)
+		return false;
+	for (size_t idx = 1; idx < batch.count; ++idx) {
+		const uint32_t value = jlink_swd_batch_get(response, batch.offset[idx] + 11U, 32U);
+		dest = adiv5_unpack_data(dest, src + ((idx - 1U) << align), value, align);
+	}
+	return true;
+}
+
+static void jlink_adiv5_mem_read_sized(
+	adiv5_access_port_s *const ap, uint8_t *dest, uint32_t src, size_t len, const align_e align)
+{
+	while (len) {
+		/* TAR auto-increment is only guaranteed within a 1KiB block, and RDBUFF needs a slot in the batch */
+		const size_t block = MIN(len, 0x400U - (src & 0x3ffU));
+		const size_t count = MIN(block >> align, jlink_swd_batch_limit - 1U);
+		if (!jlink_adiv5_mem_read_batch(ap, dest, src, count, align)) {
+			/* The access at a time path knows how to deal with WAIT and FAULT responses */
+			jlink_adiv5_swdp_recover(ap->dp);
+			advi5_mem_read_bytes(ap, dest, src, len);
+			return;
+		}
+		const size_t amount = count << align;
+		dest += amount;
+		src += amount;
+		len -= amount;
+	}
+}
+
+static void jlink_adiv5_mem_read(adiv5_access_port_s *const ap, void *const dest, const uint32_t src, const size_t len)
+{
+	/* Split the read into a narrow unaligned head, a word-wide body and a narrow tail */
+	for (size_t offset = 0; offset < len;) {
+		const uint32_t addr = src + offset;
+		const size_t remaining = len - offset;
+		const align_e align = MIN(ALIGNOF(addr), remaining >= 4U ? ALIGN_WORD : ALIGNOF(remaining));
+		const size_t amount = align == ALIGN_WORD ? remaining & ~3U : 1U << align;
+		jlink_adiv5_mem_read_sized(ap, (uint8_t *)dest + offset, addr, amount, align);
+		if (ap->dp->fault)
+			return;
+		offset += amount;
+	}
+}
+
+static void jlink_adiv5_mem_write(
+	adiv5_access_port_s *const ap, uint32_t dest, const void *src, size_t len, const align_e align)
+{
+	while (len) {
+		const size_t block = MIN(len, 0x400U - (dest & 0x3ffU));
+		const size_t count = MIN(block >> align, jlink_swd_batch_limit - 1U);
+		ap_mem_access_setup(ap, dest, align);
+		if (ap->dp->fault)
+			return;
+		jlink_swd_batch_s batch;
+		jlink_swd_batch_init(&batch);
+		const void *data = src;
+		for (size_t idx = 0; idx < count; ++idx) {
+			uint32_t value = 0;
+			data = adiv5_pack_data(dest + (idx << align), data, &value, align);
+			jlink_swd_batch_write(&batch, ADIV5_AP_DRW, value);
+		}
+		/* Make sure the last write is complete by doing a dummy read */
+		jlink_swd_batch_read(&batch, ADIV5_DP_RDBUFF);
+		ap->shadow_valid &= ~ADIV5_AP_SHADOW_TAR;
+
+		uint8_t response[JLINK_SWD_BATCH_BYTES + 1U];
+		jlink_swd_batch_run(&batch, response);
+		const size_t acked = jlink_swd_batch_check(&batch, response);
+		const size_t amount = MIN(acked, count) << align;
+		if (acked != batch.count) {
+			/* Every write acknowledged before the failure went through, so pick up from there */
+			jlink_adiv5_swdp_recover(ap->dp);
+			adiv5_mem_write_bytes(ap, dest + amount, (const uint8_t *)src + amount, len - amount, align);
+			return;
+		}
+		dest += amount;
+		src = (const uint8_t *)src + amount;
+		len -= amount;
+	}
+}
+
+void jlink_adiv5_swdp_dp_defaults(adiv5_debug_port_s *const dp)
+{
+	if (info.is_jtag)
+		return;
+	/* Each batched write takes three bytes' worth of the buffer for every 8 clocks */
+	const uint32_t free_memory = jlink_free_memory();
+	if (free_memory > JLINK_SWD_BATCH_MARGIN) {
+		const size_t batch_bytes = (free_memory - JLINK_SWD_BATCH_MARGIN) / 3U;
+		jlink_swd_batch_limit = MIN((batch_bytes * 8U) / JLINK_SWD_WRITE_BITS, JLINK_SWD_BATCH_MAX);
+		if (jlink_swd_batch_limit < JLINK_SWD_BATCH_DEFAULT)
+			jlink_swd_batch_limit = JLINK_SWD_BATCH_DEFAULT;
+		DEBUG_INFO("Batching up to %zu SWD transactions per transfer\n", jlink_swd_batch_limit);
+	}
+	dp->mem_read = jlink_adiv5_mem_read;
+	dp->mem_write = jlink_adiv5_mem_write;
+}
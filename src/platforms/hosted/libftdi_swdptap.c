@@ -47,6 +47,30 @@ static uint32_t swdptap_seq_in(size_t clock_cycles);
 static void swdptap_seq_out(uint32_t tms_states, size_t clock_cycles);
 static void swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles);
 
+/*
+ * Memory accesses over genuine MPSSE are batched: every transaction of a transfer is queued in the
+ * MPSSE command stream with its reads deferred, and all the responses are collected and checked
+ * in one read back afterwards. Overrun detection is turned on for the duration of a batch so that
+ * a transaction getting a WAIT or FAULT still has its data phase, keeping the wire in step, and
+ * everything after it is refused with FAULT until the sticky error is cleared.
+ */
+#define SWD_BATCH_MAX      36U
+#define SWD_BATCH_DATA_MAX (SWD_BATCH_MAX - 4U)
+/* A read queues a byte for its ACK and 5 for its data and parity */
+#define SWD_BATCH_RESPONSE_MAX (SWD_BATCH_MAX * 6U)
+
+#define SWD_BATCH_CTRLSTAT (ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ)
+
+#define ALIGNOF(x) (((x)&3U) == 0 ? ALIGN_WORD : (((x)&1U) == 0 ? ALIGN_HALFWORD : ALIGN_BYTE))
+
+typedef struct swd_batch {
+	uint8_t rnw[SWD_BATCH_MAX];
+	uint16_t offset[SWD_BATCH_MAX]; /* Where each transaction's response starts */
+	uint32_t value[SWD_BATCH_MAX];  /* Values read, once the batch has run */
+	size_t count;
+	size_t response_length;
+} swd_batch_s;
+
 bool libftdi_swd_possible(void)
 {
 	const bool swd_read = active_cable.mpsse_swd_read.set_data_low || active_cable.mpsse_swd_read.clr_data_low ||
@@ -475,3 +499,152 @@ static void swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles)
 	else
 		swdptap_seq_out_parity_raw(tms_states, parity, clock_cycles);
 }
+
+/* Queue a transaction the same way firmware_swdp_transfer() would clock it, but without reading the response */
+static void swd_batch_queue(swd_batch_s *const batch, const uint8_t rnw, const uint16_t addr, const uint32_t value)
+{
+	batch->rnw[batch->count] = rnw;
+	batch->offset[batch->count++] = batch->response_length;
+	swdptap_seq_out(make_packet_request(rnw, addr), 8U);
+	swdptap_turnaround(SWDIO_STATUS_FLOAT);
+	batch->response_length += libftdi_jtagtap_tdi_tdo_queue(true, false, NULL, 3U);
+	if (rnw)
+		batch->response_length += libftdi_jtagtap_tdi_tdo_queue(true, false, NULL, 33U);
+	else {
+		swdptap_seq_out_parity(value, 32U);
+		swdptap_seq_out(0U, 8U);
+	}
+}
+
+static void swd_batch_init(swd_batch_s *const batch)
+{
+	batch->count = 0;
+	batch->response_length = 0;
+	/* Make sure the DP sees the rest of the batch with overrun detection on */
+	swd_batch_queue(batch, ADIV5_LOW_WRITE, ADIV5_DP_CTRLSTAT, SWD_BATCH_CTRLSTAT | ADIV5_DP_CTRLSTAT_ORUNDETECT);
+}
+
+/*
+ * Turn overrun detection back off, run the batch and check the responses, returning the index of
+ * the first transaction not acknowledged OK (or that failed parity), or the batch length if all went well
+ */
+static size_t swd_batch_run(swd_batch_s *const batch)
+{
+	swd_batch_queue(batch, ADIV5_LOW_WRITE, ADIV5_DP_CTRLSTAT, SWD_BATCH_CTRLSTAT);
+	uint8_t response[SWD_BATCH_RESPONSE_MAX];
+	libftdi_buffer_read(response, batch->response_length);
+	for (size_t idx = 0; idx < batch->count; ++idx) {
+		const uint8_t *const result = response + batch->offset[idx];
+		uint8_t ack = 0;
+		libftdi_jtagtap_tdi_tdo_unpack(&ack, false, result, 3U);
+		if (ack != SWDP_ACK_OK)
+			return idx;
+		if (batch->rnw[idx]) {
+			uint8_t data[5];
+			libftdi_jtagtap_tdi_tdo_unpack(data, false, result + 1U, 33U);
+			const uint32_t value = data[0] | (data[1] << 8U) | (data[2] << 16U) | ((uint32_t)data[3] << 24U);
+			if ((__builtin_parity(value) ^ data[4]) & 1U)
+				return idx;
+			batch->value[idx] = value;
+		}
+	}
+	return batch->count;
+}
+
+/* Clear the sticky errors a failed batch left behind along with overrun detection */
+static void swd_batch_recover(adiv5_debug_port_s *const dp)
+{
+	DEBUG_PROBE("Batched SWD access not acknowledged, retrying one access at a time\n");
+	dp->error(dp, false);
+	adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, SWD_BATCH_CTRLSTAT);
+}
+
+static void libftdi_swdptap_mem_read_sized(
+	adiv5_access_port_s *const ap, uint8_t *dest, uint32_t src, size_t len, const align_e align)
+{
+	ap_mem_access_setup(ap, src, align);
+	/* TAR has moved on, and may not have followed us across a 1KiB boundary */
+	ap->shadow_valid &= ~ADIV5_AP_SHADOW_TAR;
+	while (len && !ap->dp->fault) {
+		/* TAR auto-increment is only guaranteed within a 1KiB block */
+		const size_t block = MIN(len, 0x400U - (src & 0x3ffU));
+		const size_t count = MIN(block >> align, SWD_BATCH_DATA_MAX);
+		swd_batch_s batch;
+		swd_batch_init(&batch);
+		swd_batch_queue(&batch, ADIV5_LOW_WRITE, ADIV5_AP_TAR, src);
+		/* AP reads are posted, so each result arrives with the next read and the last with RDBUFF */
+		const size_t first = batch.count + 1U;
+		for (size_t idx = 0; idx < count; ++idx)
+			swd_batch_queue(&batch, ADIV5_LOW_READ, ADIV5_AP_DRW, 0U);
+		swd_batch_queue(&batch, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0U);
+		if (swd_batch_run(&batch) != batch.count) {
+			/* The access at a time path knows how to deal with WAIT and FAULT responses */
+			swd_batch_recover(ap->dp);
+			advi5_mem_read_bytes(ap, dest, src, len);
+			return;
+		}
+		for (size_t idx = 0; idx < count; ++idx)
+			dest = adiv5_unpack_data(dest, src + (idx << align), batch.value[first + idx], align);
+		const size_t amount = count << align;
+		src += amount;
+		len -= amount;
+	}
+}
+
+static void libftdi_swdptap_mem_read(
+	adiv5_access_port_s *const ap, void *const dest, const uint32_t src, const size_t len)
+{
+	/* Split the read into a narrow unaligned head, a word-wide body and a narrow tail */
+	for (size_t offset = 0; offset < len && !ap->dp->fault;) {
+		const uint32_t addr = src + offset;
+		const size_t remaining = len - offset;
+		const align_e align = MIN(ALIGNOF(addr), remaining >= 4U ? ALIGN_WORD : ALIGNOF(remaining));
+		const size_t amount = align == ALIGN_WORD ? remaining & ~3U : 1U << align;
+		libftdi_swdptap_mem_read_sized(ap, (uint8_t *)dest + offset, addr, amount, align);
+		offset += amount;
+	}
+}
+
+static void libftdi_swdptap_mem_write(
+	adiv5_access_port_s *const ap, uint32_t dest, const void *src, size_t len, const align_e align)
+{
+	ap_mem_access_setup(ap, dest, align);
+	ap->shadow_valid &= ~ADIV5_AP_SHADOW_TAR;
+	while (len && !ap->dp->fault) {
+		const size_t block = MIN(len, 0x400U - (dest & 0x3ffU));
+		const size_t count = MIN(block >> align, SWD_BATCH_DATA_MAX);
+		swd_batch_s batch;
+		swd_batch_init(&batch);
+		swd_batch_queue(&batch, ADIV5_LOW_WRITE, ADIV5_AP_TAR, dest);
+		const size_t first = batch.count;
+		const void *data = src;
+		for (size_t idx = 0; idx < count; ++idx) {
+			uint32_t value = 0;
+			data = adiv5_pack_data(dest + (idx << align), data, &value, align);
+			swd_batch_queue(&batch, ADIV5_LOW_WRITE, ADIV5_AP_DRW, value);
+		}
+		/* Make sure the last write is complete by doing a dummy read */
+		swd_batch_queue(&batch, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0U);
+		const size_t acked = swd_batch_run(&batch);
+		if (acked != batch.count) {
+			/* Every write acknowledged before the failure went through, so pick up from there */
+			const size_t amount = (acked > first ? MIN(acked - first, count) : 0U) << align;
+			swd_batch_recover(ap->dp);
+			adiv5_mem_write_bytes(ap, dest + amount, (const uint8_t *)src + amount, len - amount, align);
+			return;
+		}
+		const size_t amount = count << align;
+		dest += amount;
+		src = (const uint8_t *)src + amount;
+		len -= amount;
+	}
+}
+
+void libftdi_swdptap_dp_defaults(adiv5_debug_port_s *const dp)
+{
+	/* Bit-banged SWD has to read SWDIO back a clock at a time, so only genuine MPSSE is batched */
+	if (info.is_jtag || !do_mpsse)
+		return;
+	dp->mem_read = libftdi_swdptap_mem_read;
+	dp->mem_write = libftdi_swdptap_mem_write;
+}
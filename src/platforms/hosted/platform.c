@@ -29,9 +29,16 @@
 #include "timing.h"
 #include "cli.h"
 #include "gdb_if.h"
+#include "swo_decode.h"
+#include "remote_server.h"
+#include "scheduler.h"
+#include "exception.h"
+#include "gdb_main.h"
+#include "jtag_scan.h"
 #include <signal.h>
 
 #ifdef ENABLE_RTT
+#include "rtt.h"
 #include "rtt_if.h"
 #endif
 
@@ -41,6 +48,15 @@
 #include "ftdi_bmp.h"
 #include "jlink.h"
 #include "cmsis_dap.h"
+#include "target_profile.h"
+#include "swd_sim.h"
+#include "gdb_perf.h"
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+#include "bmda_ipc.h"
+#endif
+
+/* How long a probe that has dropped off the bus gets to come back before BMDA gives up on it */
+#define PROBE_RECONNECT_TIMEOUT_MS 30000U
 
 bmp_info_s info;
 
@@ -49,6 +65,19 @@ swd_proc_s swd_proc;
 
 static bmda_cli_options_s cl_opts;
 
+/* The frequency last applied and the last scan that found something, for putting things back after a reconnect */
+static uint32_t probe_frequency;
+static bool probe_scanned;
+static bool probe_scan_jtag;
+static uint32_t probe_scan_targetid;
+static bool probe_scan_has_irlens;
+static uint8_t probe_scan_irlens[JTAG_MAX_DEVS + 1U];
+
+static bool probe_can_reconnect;
+static bool probe_reconnecting;
+static bool probe_restore_pending;
+static size_t probe_restore_target;
+
 void gdb_ident(char *p, int count)
 {
 	snprintf(p, count, "%s (%s), %s", info.manufacturer, info.product, info.version);
@@ -56,6 +85,14 @@ void gdb_ident(char *p, int count)
 
 static void exit_function(void)
 {
+	if (cl_opts.opt_perf)
+		gdb_perf_show(false);
+	target_profile_save();
+	/* Trace capture has to be shut down while the adaptor is still open */
+	if (info.bmp_type == BMP_TYPE_STLINKV2)
+		stlink_swo_stop();
+	else if (info.bmp_type == BMP_TYPE_CMSIS_DAP)
+		dap_swo_stop();
 	libusb_exit_function(&info);
 
 	switch (info.bmp_type) {
@@ -69,6 +106,9 @@ static void exit_function(void)
 
 #ifdef ENABLE_RTT
 	rtt_if_exit();
+#endif
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+	bmda_ipc_exit();
 #endif
 	fflush(stdout);
 }
@@ -80,59 +120,250 @@ static void sigterm_handler(int sig)
 	exit(0);
 }
 
-void platform_init(int argc, char **argv)
+static void platform_swo_poll(void)
 {
-	cl_init(&cl_opts, argc, argv);
-	atexit(exit_function);
-	signal(SIGTERM, sigterm_handler);
-	signal(SIGINT, sigterm_handler);
+	if (info.bmp_type == BMP_TYPE_STLINKV2)
+		stlink_swo_poll();
+	else if (info.bmp_type == BMP_TYPE_CMSIS_DAP)
+		dap_swo_poll();
+}
 
-	if (cl_opts.opt_device)
-		info.bmp_type = BMP_TYPE_BMP;
-	else if (find_debuggers(&cl_opts, &info))
-		exit(-1);
+/* Drain the adaptor's SWO capture buffer on every pass of the main loop */
+static scheduler_task_s platform_swo_task = {.name = "swo", .run = platform_swo_poll};
 
-	bmp_ident(&info);
+static bool platform_swo_start(void)
+{
+	if (info.bmp_type == BMP_TYPE_STLINKV2)
+		return stlink_swo_start(cl_opts.opt_swo_baudrate);
+	if (info.bmp_type == BMP_TYPE_CMSIS_DAP)
+		return dap_swo_start(cl_opts.opt_swo_baudrate);
+	DEBUG_WARN("SWO capture is only supported on ST-Link and CMSIS-DAP adaptors\n");
+	return false;
+}
 
+/* Open the probe found by find_debuggers() (or given with -d) and get it ready for use */
+static bool platform_probe_open(void)
+{
 	switch (info.bmp_type) {
 	case BMP_TYPE_BMP:
 		if (serial_open(&cl_opts, info.serial))
-			exit(-1);
-		remote_init();
-		break;
+			return false;
+		return remote_init() == 0;
 
 	case BMP_TYPE_STLINKV2:
-		if (stlink_init(&info))
-			exit(-1);
-		break;
+		return stlink_init(&info) == 0;
 
 	case BMP_TYPE_CMSIS_DAP:
-		if (dap_init(&info))
-			exit(-1);
-		break;
+		return dap_init(&info) == 0;
 
 	case BMP_TYPE_LIBFTDI:
-		if (ftdi_bmp_init(&cl_opts, &info))
-			exit(-1);
-		break;
+		return ftdi_bmp_init(&cl_opts, &info) == 0;
 
 	case BMP_TYPE_JLINK:
-		if (!jlink_init(&info))
-			exit(-1);
-		break;
+		return jlink_init(&info);
+
+	case BMP_TYPE_SIM:
+		/* There's nothing to open, the simulator is set up by the scan */
+		return true;
 
 	default:
+		return false;
+	}
+}
+
+/* Let go of the probe, which may well already be gone, so it can be looked for and opened again */
+static void platform_probe_close(void)
+{
+	if (info.bmp_type == BMP_TYPE_STLINKV2)
+		stlink_swo_stop();
+	else if (info.bmp_type == BMP_TYPE_CMSIS_DAP)
+		dap_swo_stop();
+
+	if (info.bmp_type == BMP_TYPE_BMP)
+		serial_close();
+	else if (info.bmp_type == BMP_TYPE_CMSIS_DAP)
+		dap_exit_function();
+	bmp_probe_release(&info);
+}
+
+/*
+ * Wait for the probe to come back after it dropped off the bus, as happens when it or the target's
+ * power is cycled, and reopen it. It's looked for by its serial number, or failing that the USB path
+ * it was plugged in at, so it's the same probe that's picked up again whatever else is plugged in.
+ */
+static bool platform_probe_reconnect(void)
+{
+	static char serial[sizeof(info.serial)];
+#if HOSTED_BMP_ONLY != 1
+	static char path[USB_PATH_LENGTH];
+#endif
+	const bmp_info_s lost = info;
+	if (!cl_opts.opt_device) {
+		cl_opts.opt_position = 0;
+		if (lost.serial[0]) {
+			memcpy(serial, lost.serial, sizeof(serial));
+			cl_opts.opt_serial = serial;
+		}
+#if HOSTED_BMP_ONLY != 1
+		else {
+			memcpy(path, lost.path, sizeof(path));
+			cl_opts.opt_usb_path = path;
+		}
+#endif
+	}
+	DEBUG_WARN("Lost the connection to the probe, waiting for it to come back\n");
+
+	probe_reconnecting = true;
+	bool reconnected = false;
+	const uint32_t start = platform_time_ms();
+	do {
+		volatile exception_s e;
+		TRY_CATCH (e, EXCEPTION_ALL) {
+			platform_probe_close();
+		}
+		bmp_probe_wait(&lost);
+		TRY_CATCH (e, EXCEPTION_ALL) {
+			reconnected = (cl_opts.opt_device || find_debuggers(&cl_opts, &info) == 0) && platform_probe_open();
+		}
+		if (e.type)
+			reconnected = false;
+	} while (!reconnected && platform_time_ms() - start < PROBE_RECONNECT_TIMEOUT_MS);
+	probe_reconnecting = false;
+
+	if (!reconnected) {
+		DEBUG_WARN("The probe did not come back within %us\n", PROBE_RECONNECT_TIMEOUT_MS / 1000U);
+		return false;
+	}
+	DEBUG_WARN("Probe reconnected after %" PRIu32 "ms\n", platform_time_ms() - start);
+	if (cl_opts.opt_swo_baudrate && !platform_swo_start())
+		DEBUG_WARN("Could not restart SWO capture\n");
+	return true;
+}
+
+/*
+ * Called by the probe transports when the link to the probe has failed outright. With --reconnect and
+ * the GDB server up, this waits for the probe to come back, reopens it and unwinds whatever was in
+ * progress to the main loop, which then redoes the scan and attach from platform_probe_restore().
+ * Otherwise it returns, and the caller fails however it always has.
+ */
+void platform_probe_lost(void)
+{
+	/* Failing again part way through reconnecting just means that attempt didn't work out */
+	if (probe_reconnecting)
+		raise_exception(EXCEPTION_ERROR, "Probe lost while reconnecting");
+	if (!probe_can_reconnect)
+		return;
+
+	/* Note which target GDB had, none of them can be detached from cleanly over the new link */
+	probe_restore_target = 0;
+	size_t number = 1U;
+	for (target_s *target = target_list; target; target = target->next, ++number) {
+		if (target == cur_target)
+			probe_restore_target = number;
+		target->attached = false;
+	}
+	if (!platform_probe_reconnect())
+		exit(-1);
+	probe_restore_pending = true;
+	raise_exception(EXCEPTION_ERROR, "Probe reconnected");
+}
+
+/* Once a reconnected probe's failed request has unwound, put back the frequency, scan and GDB's target */
+void platform_probe_restore(void)
+{
+	if (!probe_restore_pending)
+		return;
+	probe_restore_pending = false;
+	target_list_free();
+	if (!probe_scanned)
+		return;
+
+	const uint32_t frequency = probe_frequency;
+	uint32_t devices = 0;
+	volatile exception_s e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		if (probe_scan_jtag)
+			devices = platform_jtag_scan(probe_scan_has_irlens ? probe_scan_irlens : NULL);
+		else
+			devices = platform_adiv5_swdp_scan(probe_scan_targetid);
+	}
+	if (e.type || !devices) {
+		DEBUG_WARN("Rescanning after the probe reconnected found nothing\n");
+		return;
+	}
+	platform_max_frequency_set(frequency);
+	if (probe_restore_target && !gdb_target_attach_n(probe_restore_target))
+		DEBUG_WARN("Could not reattach to target %zu\n", probe_restore_target);
+}
+
+void platform_init(int argc, char **argv)
+{
+	cl_init(&cl_opts, argc, argv);
+	target_flash_incremental = cl_opts.opt_flash_incremental;
+	atexit(exit_function);
+	signal(SIGTERM, sigterm_handler);
+	signal(SIGINT, sigterm_handler);
+
+	if (cl_opts.opt_tpiu_id)
+		swo_decode_tpiu(cl_opts.opt_tpiu_id, cl_opts.opt_tpiu_prefix);
+	/* Decoding a SWO capture doesn't need a probe */
+	if (cl_opts.opt_mode == BMP_MODE_SWO_DECODE)
+		exit(swo_decode_file(cl_opts.opt_swo_file));
+	/* In gang mode, only the per-probe child processes carry on past here */
+	if (cl_opts.opt_gang)
+		cl_gang_run(&cl_opts);
+
+	if (cl_opts.opt_device && swd_sim_select(cl_opts.opt_device, &info))
+		DEBUG_INFO("Using the SWD target simulator\n");
+	else if (cl_opts.opt_device)
+		info.bmp_type = BMP_TYPE_BMP;
+	else if (find_debuggers(&cl_opts, &info))
+		exit(-1);
+
+	bmp_ident(&info);
+
+	if (cl_opts.opt_probe_server && info.bmp_type != BMP_TYPE_BMP) {
+		DEBUG_WARN("Only Black Magic Probes can be served over TCP\n");
 		exit(-1);
 	}
 
+	if (!platform_probe_open())
+		exit(-1);
+	/* In probe server mode, the probe is handed over to the network clients rather than used here */
+	if (cl_opts.opt_probe_server) {
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+		exit(remote_server_run(cl_opts.opt_probe_server, serial_fd()));
+#else
+		DEBUG_WARN("Probe server mode is not supported on this platform\n");
+		exit(-1);
+#endif
+	}
+
 	if (cl_opts.opt_mode != BMP_MODE_DEBUG)
 		exit(cl_execute(&cl_opts));
 	else {
+		gdb_if_set_ports(cl_opts.opt_gdb_ports);
 		gdb_if_init();
 
+		if (cl_opts.opt_swo_baudrate) {
+			if (platform_swo_start())
+				scheduler_register(&platform_swo_task);
+			else
+				DEBUG_WARN("Could not start SWO capture\n");
+		}
+
 #ifdef ENABLE_RTT
-		rtt_if_init();
+		rtt_if_init(cl_opts.opt_rtt_output);
+#endif
+
+		if (cl_opts.opt_ipc_socket) {
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+			bmda_ipc_init(cl_opts.opt_ipc_socket);
+#else
+			DEBUG_WARN("The IPC interface is not supported on this platform\n");
 #endif
+		}
+		probe_can_reconnect = cl_opts.opt_reconnect;
 	}
 }
 
@@ -141,22 +372,37 @@ uint32_t platform_adiv5_swdp_scan(uint32_t targetid)
 	info.is_jtag = false;
 	platform_max_frequency_set(cl_opts.opt_max_swj_frequency);
 
+	uint32_t devices;
 	switch (info.bmp_type) {
 	case BMP_TYPE_BMP:
 	case BMP_TYPE_LIBFTDI:
 	case BMP_TYPE_CMSIS_DAP:
-		return adiv5_swdp_scan(targetid);
+		devices = adiv5_swdp_scan(targetid);
 		break;
 
 	case BMP_TYPE_STLINKV2:
-		return stlink_swdp_scan(&info);
+		devices = stlink_swdp_scan(&info);
+		break;
 
 	case BMP_TYPE_JLINK:
-		return jlink_swdp_scan(&info);
+		devices = jlink_swdp_scan(&info);
+		break;
+
+	case BMP_TYPE_SIM:
+		devices = adiv5_swdp_scan(targetid);
+		swd_sim_targets_setup();
+		break;
 
 	default:
 		return 0;
 	}
+	if (devices) {
+		probe_scanned = true;
+		probe_scan_jtag = false;
+		probe_scan_targetid = targetid;
+		target_profile_apply(cl_opts.opt_frequency_set);
+	}
+	return devices;
 }
 
 bool platform_swdptap_init(adiv5_debug_port_s *dp)
@@ -175,6 +421,9 @@ bool platform_swdptap_init(adiv5_debug_port_s *dp)
 	case BMP_TYPE_LIBFTDI:
 		return libftdi_swdptap_init();
 
+	case BMP_TYPE_SIM:
+		return swd_sim_swdptap_init();
+
 	default:
 		return false;
 	}
@@ -192,19 +441,35 @@ uint32_t platform_jtag_scan(const uint8_t *lrlens)
 
 	platform_max_frequency_set(cl_opts.opt_max_swj_frequency);
 
+	uint32_t devices;
 	switch (info.bmp_type) {
 	case BMP_TYPE_BMP:
 	case BMP_TYPE_LIBFTDI:
 	case BMP_TYPE_JLINK:
 	case BMP_TYPE_CMSIS_DAP:
-		return jtag_scan(lrlens);
+		devices = jtag_scan(lrlens);
+		break;
 
 	case BMP_TYPE_STLINKV2:
-		return jtag_scan_stlinkv2(&info, lrlens);
+		devices = jtag_scan_stlinkv2(&info, lrlens);
+		break;
 
 	default:
 		return 0;
 	}
+	if (devices) {
+		probe_scanned = true;
+		probe_scan_jtag = true;
+		probe_scan_has_irlens = lrlens != NULL;
+		if (lrlens && lrlens != probe_scan_irlens) {
+			size_t idx = 0;
+			for (; idx < JTAG_MAX_DEVS && lrlens[idx]; ++idx)
+				probe_scan_irlens[idx] = lrlens[idx];
+			probe_scan_irlens[idx] = 0U;
+		}
+		target_profile_apply(cl_opts.opt_frequency_set);
+	}
+	return devices;
 }
 
 bool platform_jtagtap_init(void)
@@ -246,6 +511,12 @@ void platform_adiv5_dp_defaults(adiv5_debug_port_s *dp)
 	case BMP_TYPE_CMSIS_DAP:
 		return dap_adiv5_dp_defaults(dp);
 
+	case BMP_TYPE_JLINK:
+		return jlink_adiv5_swdp_dp_defaults(dp);
+
+	case BMP_TYPE_LIBFTDI:
+		return libftdi_swdptap_dp_defaults(dp);
+
 	default:
 		break;
 	}
@@ -286,6 +557,9 @@ char *platform_ident(void)
 	case BMP_TYPE_JLINK:
 		return "J-Link";
 
+	case BMP_TYPE_SIM:
+		return "SWD simulator";
+
 	default:
 		return NULL;
 	}
@@ -306,6 +580,9 @@ const char *platform_target_voltage(void)
 	case BMP_TYPE_JLINK:
 		return jlink_target_voltage(&info);
 
+	case BMP_TYPE_SIM:
+		return "3.3";
+
 	default:
 		return NULL;
 	}
@@ -358,6 +635,7 @@ void platform_max_frequency_set(uint32_t freq)
 {
 	if (!freq)
 		return;
+	probe_frequency = freq;
 
 	switch (info.bmp_type) {
 	case BMP_TYPE_BMP:
@@ -380,12 +658,16 @@ void platform_max_frequency_set(uint32_t freq)
 		jlink_max_frequency_set(&info, freq);
 		break;
 
+	case BMP_TYPE_SIM:
+		break;
+
 	default:
 		DEBUG_WARN("Setting max SWJ frequency not yet implemented\n");
 		break;
 	}
 
 	uint32_t max_freq = platform_max_frequency_get();
+	target_profile_frequency_update(max_freq);
 	if (max_freq == FREQ_FIXED)
 		DEBUG_INFO("Device has fixed frequency for %s\n", (info.is_jtag) ? "JTAG" : "SWD");
 	else
@@ -411,6 +693,10 @@ uint32_t platform_max_frequency_get(void)
 	case BMP_TYPE_JLINK:
 		return jlink_max_frequency_get(&info);
 
+	/* The simulator has no clock, counting cycles instead */
+	case BMP_TYPE_SIM:
+		return FREQ_FIXED;
+
 	default:
 		DEBUG_WARN("Reading max SWJ frequency not yet implemented\n");
 		return 0;
@@ -479,8 +765,16 @@ void platform_buffer_flush(void)
 
 void platform_pace_poll(void)
 {
-	if (!cl_opts.fast_poll)
-		platform_delay(8);
+	if (cl_opts.fast_poll)
+		return;
+#ifdef ENABLE_RTT
+	/* While RTT is streaming, pace the loop at RTT's minimum poll interval rather than ours */
+	if (rtt_poll_busy()) {
+		platform_delay(rtt_min_poll_ms);
+		return;
+	}
+#endif
+	platform_delay(8);
 }
 
 void platform_target_clk_output_enable(const bool enable)
@@ -600,6 +894,7 @@ uint32_t adiv5_dp_read(adiv5_debug_port_s *dp, uint16_t addr)
 
 uint32_t adiv5_dp_error(adiv5_debug_port_s *dp)
 {
+	adiv5_dp_shadow_invalidate(dp);
 	uint32_t ret = dp->error(dp, false);
 	DEBUG_TARGET("DP Error 0x%08" PRIx32 "\n", ret);
 	return ret;
@@ -671,5 +966,6 @@ void adiv5_mem_write_sized(adiv5_access_port_s *ap, uint32_t dest, const void *s
 void adiv5_dp_abort(adiv5_debug_port_s *dp, uint32_t abort)
 {
 	DEBUG_TARGET("Abort: %08" PRIx32 "\n", abort);
+	adiv5_dp_shadow_invalidate(dp);
 	return dp->abort(dp, abort);
 }
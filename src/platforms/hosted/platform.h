@@ -39,6 +39,8 @@
 
 char *platform_ident(void);
 void platform_buffer_flush(void);
+void platform_probe_lost(void);
+void platform_probe_restore(void);
 
 #define PLATFORM_IDENT "(Black Magic Debug App) "
 #define SET_IDLE_STATE(x) \
@@ -51,6 +53,8 @@ void platform_buffer_flush(void);
 
 #define SYSTICKHZ 1000U
 
+#define GDB_PACKET_BUFFER_SIZE 16384U
+
 #define VENDOR_ID_BMP     0x1d50U
 #define PRODUCT_ID_BMP_BL 0x6017U
 #define PRODUCT_ID_BMP    0x6018U
@@ -75,7 +79,8 @@ typedef enum bmp_type_e {
 	BMP_TYPE_STLINKV2,
 	BMP_TYPE_LIBFTDI,
 	BMP_TYPE_CMSIS_DAP,
-	BMP_TYPE_JLINK
+	BMP_TYPE_JLINK,
+	BMP_TYPE_SIM
 } bmp_type_t;
 
 void gdb_ident(char *p, int count);
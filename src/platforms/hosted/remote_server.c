@@ -0,0 +1,181 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements BMDA's probe server mode, which makes the remote protocol of a locally
+ * attached Black Magic Probe available over TCP so another BMDA instance can drive the probe
+ * across the network with `-d tcp:HOST:PORT`.
+ *
+ * The remote protocol is already framed ('!' ... '#' requests, '&' ... '#' responses) and carries
+ * batched ADIv5 accesses and binary memory transfers, so the server relays bytes in both directions
+ * unchanged. It forwards everything a read returns in one go and disables Nagle's algorithm, so
+ * whatever a client sends back to back reaches the probe together and responses come back without
+ * waiting on a timer. One client is served at a time; others queue in the listen backlog.
+ */
+
+#include "general.h"
+#include "remote_server.h"
+
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+#define REMOTE_SERVER_BUFFER_SIZE 4096U
+
+typedef struct addrinfo addrinfo_s;
+
+static int remote_server_listen(const uint16_t port)
+{
+	addrinfo_s hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags = AI_PASSIVE;
+
+	char service[6];
+	snprintf(service, sizeof(service), "%u", port);
+	addrinfo_s *results = NULL;
+	const int res = getaddrinfo(NULL, service, &hints, &results);
+	if (res || !results) {
+		DEBUG_WARN("getaddrinfo failed: %s\n", gai_strerror(res));
+		return -1;
+	}
+
+	int server = -1;
+	for (const addrinfo_s *result = results; result && server == -1; result = result->ai_next) {
+		server = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+		if (server == -1)
+			continue;
+		const int enable = 1;
+		setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+		if (bind(server, result->ai_addr, result->ai_addrlen) == -1 || listen(server, 1) == -1) {
+			close(server);
+			server = -1;
+		}
+	}
+	freeaddrinfo(results);
+	if (server == -1)
+		DEBUG_WARN("Failed to listen on TCP port %u: %s\n", port, strerror(errno));
+	return server;
+}
+
+/* Write a whole buffer out, returning false if the other end has gone away */
+static bool remote_server_write(const int fd, const uint8_t *const data, const size_t length)
+{
+	for (size_t offset = 0; offset < length;) {
+		const ssize_t written = write(fd, data + offset, length - offset);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+		offset += (size_t)written;
+	}
+	return true;
+}
+
+/* Relay between the probe and one connected client until either goes away; returns false if the probe did */
+static bool remote_server_relay(const int client, const int probe_fd)
+{
+	uint8_t buffer[REMOTE_SERVER_BUFFER_SIZE];
+	while (true) {
+		fd_set read_set;
+		FD_ZERO(&read_set);
+		FD_SET(client, &read_set);
+		FD_SET(probe_fd, &read_set);
+		if (select(MAX(client, probe_fd) + 1, &read_set, NULL, NULL, NULL) < 0) {
+			if (errno == EINTR)
+				continue;
+			DEBUG_WARN("Failed on select: %s\n", strerror(errno));
+			return false;
+		}
+
+		if (FD_ISSET(client, &read_set)) {
+			const ssize_t length = read(client, buffer, sizeof(buffer));
+			if (length <= 0)
+				return true;
+			if (!remote_server_write(probe_fd, buffer, (size_t)length)) {
+				DEBUG_WARN("Failed to write to the probe: %s\n", strerror(errno));
+				return false;
+			}
+		}
+		if (FD_ISSET(probe_fd, &read_set)) {
+			const ssize_t length = read(probe_fd, buffer, sizeof(buffer));
+			if (length < 0) {
+				DEBUG_WARN("Failed to read from the probe: %s\n", strerror(errno));
+				return false;
+			}
+			if (length && !remote_server_write(client, buffer, (size_t)length))
+				return true;
+		}
+	}
+}
+
+int remote_server_run(const uint16_t port, const int probe_fd)
+{
+	const int server = remote_server_listen(port);
+	if (server == -1)
+		return -1;
+	DEBUG_WARN("Serving the probe's remote protocol on TCP port %u\n", port);
+
+	/* Writes to a client that has just gone away must not take the server down with them */
+	signal(SIGPIPE, SIG_IGN);
+	while (true) {
+		struct sockaddr_storage peer;
+		socklen_t peer_length = sizeof(peer);
+		const int client = accept(server, (struct sockaddr *)&peer, &peer_length);
+		if (client == -1) {
+			if (errno == EINTR)
+				continue;
+			DEBUG_WARN("Failed to accept a connection: %s\n", strerror(errno));
+			break;
+		}
+		char host[NI_MAXHOST] = "unknown";
+		getnameinfo((struct sockaddr *)&peer, peer_length, host, sizeof(host), NULL, 0, NI_NUMERICHOST);
+		DEBUG_WARN("Client %s connected\n", host);
+
+		const int enable = 1;
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+		const bool probe_ok = remote_server_relay(client, probe_fd);
+		close(client);
+		DEBUG_WARN("Client %s disconnected\n", host);
+		if (!probe_ok)
+			break;
+	}
+	close(server);
+	return -1;
+}
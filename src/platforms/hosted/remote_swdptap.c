@@ -36,6 +36,55 @@ static uint32_t swdptap_seq_in(size_t clock_cycles);
 static void swdptap_seq_out(uint32_t tms_states, size_t clock_cycles);
 static void swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles);
 
+static bool swdptap_batch_seq_in_parity(uint32_t *res, size_t clock_cycles);
+static uint32_t swdptap_batch_seq_in(size_t clock_cycles);
+static void swdptap_batch_seq_in_deferred(uint32_t *res, bool *parity_error, size_t clock_cycles);
+static void swdptap_batch_seq_out(uint32_t tms_states, size_t clock_cycles);
+static void swdptap_batch_seq_out_parity(uint32_t tms_states, size_t clock_cycles);
+static void swdptap_batch_flush(void);
+
+/* Both the batch request and its response have to fit in a remote message */
+#define SWDP_BATCH_SIZE   (REMOTE_MAX_MSG_SIZE - 0x20U)
+#define SWDP_BATCH_PREFIX (sizeof(REMOTE_SWDP_BATCH_STR) - 1U)
+/* Every in's result takes up 8 hex digits in the response, those with parity one more for the status */
+#define SWDP_BATCH_RESULT_LENGTH 9U
+#define SWDP_BATCH_MAX_INS       (SWDP_BATCH_SIZE / 8U)
+
+/* Where the result of a queued in goes, and its parity check if it has one */
+typedef struct swdptap_batch_result {
+	uint32_t *value;
+	bool *parity_error;
+} swdptap_batch_result_s;
+
+/*
+ * Sequences are queued up here until something needs the result of an in, letting a whole access
+ * go to the probe as one remote message rather than one per sequence
+ */
+static char swdptap_batch[SWDP_BATCH_SIZE];
+static size_t swdptap_batch_length = SWDP_BATCH_PREFIX;
+static size_t swdptap_batch_response_length = 0;
+static swdptap_batch_result_s swdptap_batch_results[SWDP_BATCH_MAX_INS];
+static size_t swdptap_batch_ins = 0;
+
+/* Check if the probe understands batches of sequences by sending it an empty one */
+static bool remote_swdptap_batch_init(void)
+{
+	memcpy(swdptap_batch, REMOTE_SWDP_BATCH_STR, SWDP_BATCH_PREFIX);
+	swdptap_batch[SWDP_BATCH_PREFIX] = REMOTE_EOM;
+	platform_buffer_write((uint8_t *)swdptap_batch, SWDP_BATCH_PREFIX + 1U);
+
+	char construct[REMOTE_MAX_MSG_SIZE];
+	const int length = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+	if (length < 1 || construct[0] != REMOTE_RESP_OK) {
+		DEBUG_INFO("Probe does not support batched SWD sequences, falling back to sending them one by one\n");
+		return false;
+	}
+	swdptap_batch_length = SWDP_BATCH_PREFIX;
+	swdptap_batch_response_length = 0;
+	swdptap_batch_ins = 0;
+	return true;
+}
+
 bool remote_swdptap_init(void)
 {
 	DEBUG_WIRE("remote_swdptap_init\n");
@@ -48,13 +97,119 @@ bool remote_swdptap_init(void)
 		exit(-1);
 	}
 
-	swd_proc.seq_in = swdptap_seq_in;
-	swd_proc.seq_in_parity = swdptap_seq_in_parity;
-	swd_proc.seq_out = swdptap_seq_out;
-	swd_proc.seq_out_parity = swdptap_seq_out_parity;
+	if (remote_swdptap_batch_init()) {
+		swd_proc.seq_in = swdptap_batch_seq_in;
+		swd_proc.seq_in_parity = swdptap_batch_seq_in_parity;
+		swd_proc.seq_out = swdptap_batch_seq_out;
+		swd_proc.seq_out_parity = swdptap_batch_seq_out_parity;
+		swd_proc.seq_in_deferred = swdptap_batch_seq_in_deferred;
+		swd_proc.flush = swdptap_batch_flush;
+	} else {
+		swd_proc.seq_in = swdptap_seq_in;
+		swd_proc.seq_in_parity = swdptap_seq_in_parity;
+		swd_proc.seq_out = swdptap_seq_out;
+		swd_proc.seq_out_parity = swdptap_seq_out_parity;
+		swd_proc.seq_in_deferred = NULL;
+		swd_proc.flush = NULL;
+	}
 	return true;
 }
 
+/* Send the queued sequences to the probe in one go and hand the results of the ins back */
+static void swdptap_batch_flush(void)
+{
+	if (swdptap_batch_length == SWDP_BATCH_PREFIX)
+		return;
+	/* Reset the queue before talking to the probe so nothing is left half sent if that fails */
+	const size_t request_length = swdptap_batch_length;
+	const size_t response_length = swdptap_batch_response_length;
+	const size_t ins = swdptap_batch_ins;
+	swdptap_batch_length = SWDP_BATCH_PREFIX;
+	swdptap_batch_response_length = 0;
+	swdptap_batch_ins = 0;
+
+	swdptap_batch[request_length] = REMOTE_EOM;
+	platform_buffer_write((uint8_t *)swdptap_batch, request_length + 1U);
+
+	char construct[REMOTE_MAX_MSG_SIZE];
+	const int length = platform_buffer_read((uint8_t *)construct, REMOTE_MAX_MSG_SIZE);
+	if (length < 1 || construct[0] != REMOTE_RESP_OK || (size_t)length != response_length + 1U) {
+		DEBUG_WARN("swdptap_batch_flush failed, error %s\n", length > 0 ? construct + 1 : "short response");
+		exit(-1);
+	}
+
+	const char *response = construct + 1;
+	for (size_t idx = 0; idx < ins; ++idx) {
+		const swdptap_batch_result_s *const result = &swdptap_batch_results[idx];
+		if (result->parity_error)
+			*result->parity_error = *response++ != REMOTE_RESP_OK;
+		*result->value = remotehston(8, response);
+		response += 8U;
+		DEBUG_PROBE("swdptap_batch_seq_in%s: %08" PRIx32 "%s\n", result->parity_error ? "_parity" : "       ",
+			*result->value, result->parity_error ? (*result->parity_error ? " ERR" : " OK") : "");
+	}
+}
+
+/* Add a sequence to the queue, sending off what is already there first if it won't fit */
+static void swdptap_batch_queue(
+	const char op, const size_t clock_cycles, const uint32_t tms_states, const swdptap_batch_result_s *const result)
+{
+	const size_t entry_length = result ? REMOTE_SWDP_BATCH_IN_LENGTH : REMOTE_SWDP_BATCH_OUT_LENGTH;
+	if (swdptap_batch_length + entry_length >= SWDP_BATCH_SIZE ||
+		(result && (swdptap_batch_ins == SWDP_BATCH_MAX_INS ||
+					   swdptap_batch_response_length + SWDP_BATCH_RESULT_LENGTH >= SWDP_BATCH_SIZE)))
+		swdptap_batch_flush();
+
+	char *const entry = swdptap_batch + swdptap_batch_length;
+	if (result) {
+		snprintf(entry, entry_length + 1U, "%c%02zx", op, clock_cycles);
+		swdptap_batch_results[swdptap_batch_ins++] = *result;
+		swdptap_batch_response_length += result->parity_error ? SWDP_BATCH_RESULT_LENGTH : SWDP_BATCH_RESULT_LENGTH - 1U;
+	} else
+		snprintf(entry, entry_length + 1U, "%c%02zx%08" PRIx32, op, clock_cycles, tms_states);
+	swdptap_batch_length += entry_length;
+}
+
+static void swdptap_batch_seq_in_deferred(uint32_t *const res, bool *const parity_error, const size_t clock_cycles)
+{
+	const swdptap_batch_result_s result = {res, parity_error};
+	swdptap_batch_queue(parity_error ? REMOTE_IN_PAR : REMOTE_IN, clock_cycles, 0, &result);
+}
+
+static bool swdptap_batch_seq_in_parity(uint32_t *const res, const size_t clock_cycles)
+{
+	bool parity_error = false;
+	swdptap_batch_seq_in_deferred(res, &parity_error, clock_cycles);
+	swdptap_batch_flush();
+	return parity_error;
+}
+
+static uint32_t swdptap_batch_seq_in(const size_t clock_cycles)
+{
+	uint32_t res = 0;
+	swdptap_batch_seq_in_deferred(&res, NULL, clock_cycles);
+	swdptap_batch_flush();
+	return res;
+}
+
+static void swdptap_batch_seq_out(const uint32_t tms_states, const size_t clock_cycles)
+{
+	DEBUG_PROBE("swdptap_batch_seq_out  %2zu clock_cycles: %08" PRIx32 "\n", clock_cycles, tms_states);
+	swdptap_batch_queue(REMOTE_OUT, clock_cycles, tms_states, NULL);
+	/*
+	 * Idle cycles end a write, and nothing may come after them for a while,
+	 * so send them off now rather than leave the write sitting in the queue
+	 */
+	if (!tms_states)
+		swdptap_batch_flush();
+}
+
+static void swdptap_batch_seq_out_parity(const uint32_t tms_states, const size_t clock_cycles)
+{
+	DEBUG_PROBE("swdptap_batch_seq_out_parity %2zu clock_cycles: %08" PRIx32 "\n", clock_cycles, tms_states);
+	swdptap_batch_queue(REMOTE_OUT_PAR, clock_cycles, tms_states, NULL);
+}
+
 static bool swdptap_seq_in_parity(uint32_t *res, size_t clock_cycles)
 {
 	char construct[REMOTE_MAX_MSG_SIZE];
@@ -69,7 +224,7 @@ static bool swdptap_seq_in_parity(uint32_t *res, size_t clock_cycles)
 	}
 
 	*res = remotehston(-1, &construct[1]);
-	DEBUG_PROBE("swdptap_seq_in_parity  %2d clock_cycles: %08" PRIx32 " %s\n", clock_cycles, *res,
+	DEBUG_PROBE("swdptap_seq_in_parity  %2zu clock_cycles: %08" PRIx32 " %s\n", clock_cycles, *res,
 		construct[0] != REMOTE_RESP_OK ? "ERR" : "OK");
 	return construct[0] != REMOTE_RESP_OK;
 }
@@ -87,7 +242,7 @@ static uint32_t swdptap_seq_in(size_t clock_cycles)
 		exit(-1);
 	}
 	uint32_t res = remotehston(-1, &construct[1]);
-	DEBUG_PROBE("swdptap_seq_in         %2d clock_cycles: %08" PRIx32 "\n", clock_cycles, res);
+	DEBUG_PROBE("swdptap_seq_in         %2zu clock_cycles: %08" PRIx32 "\n", clock_cycles, res);
 	return res;
 }
 
@@ -95,7 +250,7 @@ static void swdptap_seq_out(uint32_t tms_states, size_t clock_cycles)
 {
 	char construct[REMOTE_MAX_MSG_SIZE];
 
-	DEBUG_PROBE("swdptap_seq_out        %2d clock_cycles: %08" PRIx32 "\n", clock_cycles, tms_states);
+	DEBUG_PROBE("swdptap_seq_out        %2zu clock_cycles: %08" PRIx32 "\n", clock_cycles, tms_states);
 	int length = sprintf(construct, REMOTE_SWDP_OUT_STR, clock_cycles, tms_states);
 	platform_buffer_write((uint8_t *)construct, length);
 
@@ -110,7 +265,7 @@ static void swdptap_seq_out_parity(uint32_t tms_states, size_t clock_cycles)
 {
 	char construct[REMOTE_MAX_MSG_SIZE];
 
-	DEBUG_PROBE("swdptap_seq_out_parity %2d clock_cycles: %08" PRIx32 "\n", clock_cycles, tms_states);
+	DEBUG_PROBE("swdptap_seq_out_parity %2zu clock_cycles: %08" PRIx32 "\n", clock_cycles, tms_states);
 	int length = sprintf(construct, REMOTE_SWDP_OUT_PAR_STR, clock_cycles, tms_states);
 	platform_buffer_write((uint8_t *)construct, length);
 
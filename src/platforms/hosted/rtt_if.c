@@ -27,10 +27,288 @@
 #include <general.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <rtt.h>
 #include <rtt_if.h>
 
 /* maybe rewrite this as tcp server */
 
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#include <sys/time.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/*
+ * Up channels other than 0 can each go to their own output, set up when the channel first has
+ * data, so telemetry on them doesn't get mixed into the console on channel 0. The output path
+ * prefix may start with a mode:
+ *  - no mode: the bytes as they come, to a file or FIFO
+ *  - "frames:": timestamped frames (see rtt_frame_header_s) to a file or FIFO
+ *  - "unix:": timestamped frames to whoever is connected to a listening UNIX socket
+ *  - "ring:": the bytes as they come, into a memory-mapped ring buffer file (see rtt_ring_s)
+ */
+typedef enum rtt_output_mode {
+	RTT_OUTPUT_RAW,
+	RTT_OUTPUT_FRAMES,
+	RTT_OUTPUT_SOCKET,
+	RTT_OUTPUT_RING,
+} rtt_output_mode_e;
+
+/* Precedes each block of data in the framed modes, all fields in host byte order */
+typedef struct rtt_frame_header {
+	uint64_t timestamp_us; /* Host time the data was read from the target, in µs since the epoch */
+	uint32_t channel;
+	uint32_t length; /* Number of data bytes following this header */
+} rtt_frame_header_s;
+
+#define RTT_RING_MAGIC   0x52545452U /* "RTTR" */
+#define RTT_RING_VERSION 1U
+#define RTT_RING_SIZE    (1024U * 1024U)
+
+/*
+ * Layout of a ring buffer file. write_count is the total number of bytes ever written, and is
+ * only advanced once the data is in place - a reader keeps its own count, takes what's between
+ * the two from data[count % size], and has been overrun if it falls more than size behind.
+ */
+typedef struct rtt_ring {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t channel;
+	uint64_t write_count;
+	uint64_t timestamp_us; /* Host time of the most recent write */
+	uint8_t data[];
+} rtt_ring_s;
+
+typedef struct rtt_output {
+	bool opened;
+	int fd; /* File, FIFO or connected client, -1 if none */
+#ifndef WIN32
+	int listen_fd;
+	rtt_ring_s *ring;
+#endif
+} rtt_output_s;
+
+static rtt_output_mode_e up_channel_mode = RTT_OUTPUT_RAW;
+static const char *up_channel_prefix = NULL;
+static rtt_output_s up_channel_output[MAX_RTT_CHAN];
+
+static void rtt_channels_init(const char *const up_channel_path)
+{
+	static const struct {
+		const char *name;
+		rtt_output_mode_e mode;
+	} modes[] = {
+		{"frames:", RTT_OUTPUT_FRAMES},
+#ifndef WIN32
+		{"unix:", RTT_OUTPUT_SOCKET},
+		{"ring:", RTT_OUTPUT_RING},
+#endif
+	};
+
+	up_channel_mode = RTT_OUTPUT_RAW;
+	up_channel_prefix = up_channel_path;
+	for (size_t i = 0; up_channel_path && i < ARRAY_LENGTH(modes); ++i) {
+		const size_t len = strlen(modes[i].name);
+		if (strncmp(up_channel_path, modes[i].name, len) == 0) {
+			up_channel_mode = modes[i].mode;
+			up_channel_prefix = up_channel_path + len;
+			break;
+		}
+	}
+	for (size_t i = 0; i < MAX_RTT_CHAN; ++i) {
+		up_channel_output[i].opened = false;
+		up_channel_output[i].fd = -1;
+#ifndef WIN32
+		up_channel_output[i].listen_fd = -1;
+		up_channel_output[i].ring = NULL;
+#endif
+	}
+}
+
+static void rtt_channels_exit(void)
+{
+	for (size_t i = 0; i < MAX_RTT_CHAN; ++i) {
+		rtt_output_s *const output = &up_channel_output[i];
+		if (output->fd > STDERR_FILENO)
+			close(output->fd);
+		output->fd = -1;
+#ifndef WIN32
+		if (output->listen_fd != -1) {
+			close(output->listen_fd);
+			char path[PATH_MAX];
+			snprintf(path, sizeof(path), "%s%zu", up_channel_prefix, i);
+			unlink(path);
+		}
+		output->listen_fd = -1;
+		if (output->ring)
+			munmap(output->ring, sizeof(rtt_ring_s) + RTT_RING_SIZE);
+		output->ring = NULL;
+#endif
+		output->opened = false;
+	}
+}
+
+static uint64_t rtt_timestamp_us(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return ((uint64_t)now.tv_sec * 1000000U) + (uint64_t)now.tv_usec;
+}
+
+#ifndef WIN32
+static bool rtt_output_open_socket(rtt_output_s *const output, const char *const path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return false;
+	strcpy(addr.sun_path, path);
+	/* Clear out a socket left behind by an earlier run */
+	unlink(path);
+	output->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (output->listen_fd == -1)
+		return false;
+	if (bind(output->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(output->listen_fd, 1) == -1) {
+		close(output->listen_fd);
+		output->listen_fd = -1;
+		return false;
+	}
+	fcntl(output->listen_fd, F_SETFL, fcntl(output->listen_fd, F_GETFL, 0) | O_NONBLOCK);
+	return true;
+}
+
+static bool rtt_output_open_ring(rtt_output_s *const output, const char *const path, const uint32_t channel)
+{
+	const size_t map_size = sizeof(rtt_ring_s) + RTT_RING_SIZE;
+	const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		return false;
+	if (ftruncate(fd, (off_t)map_size) == -1) {
+		close(fd);
+		return false;
+	}
+	void *const map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+	output->ring = map;
+	output->ring->size = RTT_RING_SIZE;
+	output->ring->channel = channel;
+	output->ring->version = RTT_RING_VERSION;
+	/* The magic goes in last, so a reader only looks at the ring once it's set up */
+	__atomic_store_n(&output->ring->magic, RTT_RING_MAGIC, __ATOMIC_RELEASE);
+	return true;
+}
+
+static void rtt_output_ring_write(rtt_ring_s *const ring, const char *const buf, const uint32_t len)
+{
+	const uint64_t count = ring->write_count;
+	for (uint32_t offset = 0; offset < len;) {
+		const uint32_t pos = (count + offset) % ring->size;
+		const uint32_t amount = MIN(len - offset, ring->size - pos);
+		memcpy(ring->data + pos, buf + offset, amount);
+		offset += amount;
+	}
+	ring->timestamp_us = rtt_timestamp_us();
+	__atomic_store_n(&ring->write_count, count + len, __ATOMIC_RELEASE);
+}
+#endif
+
+/* open the output for an up channel, leaving it with no fd if that failed */
+static void rtt_output_open(rtt_output_s *const output, const uint32_t channel)
+{
+	output->opened = true;
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s%" PRIu32, up_channel_prefix, channel);
+	bool result = false;
+	switch (up_channel_mode) {
+	case RTT_OUTPUT_RAW:
+	case RTT_OUTPUT_FRAMES:
+		output->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+		result = output->fd != -1;
+		break;
+#ifndef WIN32
+	case RTT_OUTPUT_SOCKET:
+		result = rtt_output_open_socket(output, path);
+		break;
+	case RTT_OUTPUT_RING:
+		result = rtt_output_open_ring(output, path, channel);
+		break;
+#endif
+	default:
+		break;
+	}
+	if (!result) {
+		DEBUG_WARN("rtt: could not open %s, sending channel %" PRIu32 " to the terminal\n", path, channel);
+		output->fd = STDOUT_FILENO;
+	}
+}
+
+static void rtt_output_write_framed(rtt_output_s *const output, const uint32_t channel, const char *buf, uint32_t len)
+{
+	const rtt_frame_header_s header = {
+		.timestamp_us = rtt_timestamp_us(),
+		.channel = channel,
+		.length = len,
+	};
+#ifndef WIN32
+	if (output->listen_fd != -1) {
+		/* Pick up a client if there's none, data goes nowhere while no one is listening */
+		if (output->fd == -1) {
+			output->fd = accept(output->listen_fd, NULL, NULL);
+			if (output->fd == -1)
+				return;
+			/* Never let a stalled client hold up the GDB server */
+			fcntl(output->fd, F_SETFL, fcntl(output->fd, F_GETFL, 0) | O_NONBLOCK);
+		}
+		if (send(output->fd, &header, sizeof(header), MSG_NOSIGNAL) != sizeof(header) ||
+			send(output->fd, buf, len, MSG_NOSIGNAL) != (ssize_t)len) {
+			/* The client went away (or is too slow to keep up), wait for the next one */
+			close(output->fd);
+			output->fd = -1;
+		}
+		return;
+	}
+#endif
+	int unused = write(output->fd, &header, sizeof(header));
+	unused = write(output->fd, buf, len);
+	(void)unused;
+}
+
+/* write an up channel's data to the terminal, or the channel's own output */
+static void rtt_output_write(const uint32_t channel, const char *const buf, const uint32_t len)
+{
+	if (channel == 0 || channel >= MAX_RTT_CHAN || !up_channel_prefix) {
+		int unused = write(STDOUT_FILENO, buf, len);
+		(void)unused;
+		return;
+	}
+	rtt_output_s *const output = &up_channel_output[channel];
+	if (!output->opened)
+		rtt_output_open(output, channel);
+#ifndef WIN32
+	if (output->ring) {
+		rtt_output_ring_write(output->ring, buf, len);
+		return;
+	}
+#endif
+	if (output->fd != STDOUT_FILENO && up_channel_mode != RTT_OUTPUT_RAW)
+		rtt_output_write_framed(output, channel, buf, len);
+	else {
+		int unused = write(output->fd, buf, len);
+		(void)unused;
+	}
+}
+
 #ifndef WIN32
 #include <termios.h>
 
@@ -42,8 +320,9 @@ static bool tty_saved = false;
 
 /* set up and tear down */
 
-int rtt_if_init()
+int rtt_if_init(const char *const up_channel_path)
 {
+	rtt_channels_init(up_channel_path);
 	terminal_io_state_s ttystate;
 	tcgetattr(STDIN_FILENO, &saved_ttystate);
 	tty_saved = true;
@@ -59,17 +338,17 @@ int rtt_if_init()
 
 int rtt_if_exit()
 {
+	rtt_channels_exit();
 	if (tty_saved)
 		tcsetattr(STDIN_FILENO, TCSANOW, &saved_ttystate);
 	return 0;
 }
 
-/* write buffer to terminal */
+/* write buffer to terminal, or the channel's own file */
 
-uint32_t rtt_write(const char *buf, uint32_t len)
+uint32_t rtt_write(const uint32_t channel, const char *buf, uint32_t len)
 {
-	int unused = write(1, buf, len);
-	(void)unused;
+	rtt_output_write(channel, buf, len);
 	return len;
 }
 
@@ -96,21 +375,23 @@ bool rtt_nodata()
 
 /* windows, output only */
 
-int rtt_if_init()
+int rtt_if_init(const char *const up_channel_path)
 {
+	rtt_channels_init(up_channel_path);
 	return 0;
 }
 
 int rtt_if_exit()
 {
+	rtt_channels_exit();
 	return 0;
 }
 
-/* write buffer to terminal */
+/* write buffer to terminal, or the channel's own file */
 
-uint32_t rtt_write(const char *buf, uint32_t len)
+uint32_t rtt_write(const uint32_t channel, const char *buf, uint32_t len)
 {
-	write(1, buf, len);
+	rtt_output_write(channel, buf, len);
 	return len;
 }
 
@@ -18,22 +18,91 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "general.h"
 #include <sys/stat.h>
 #include <sys/select.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <termios.h>
 #include <unistd.h>
+#include <signal.h>
 
-#include "general.h"
 #include "remote.h"
 #include "bmp_hosted.h"
 #include "utils.h"
 #include "cortexm.h"
+#include "gdb_perf.h"
+#include "probe_stats.h"
 
 static int fd; /* File descriptor for connection to GDB remote */
 
+/* Read-ahead buffer for the remote link, the bytes from read_buffer_offset to read_buffer_fill are pending */
+#define READ_BUFFER_LENGTH 4096U
+static uint8_t read_buffer[READ_BUFFER_LENGTH];
+static size_t read_buffer_fill;
+static size_t read_buffer_offset;
+
+#define REMOTE_TCP_PREFIX "tcp:"
+
+/*
+ * Connect to a probe served by another BMDA instance's probe server, given as "tcp:HOST:PORT".
+ * The socket then stands in for the serial port, as the remote protocol runs over it unchanged.
+ */
+static int remote_tcp_open(const char *const device)
+{
+	char host[256];
+	const char *const address = device + sizeof(REMOTE_TCP_PREFIX) - 1U;
+	const char *const port = strrchr(address, ':');
+	if (!port || port == address || (size_t)(port - address) >= sizeof(host)) {
+		DEBUG_WARN("Probe server address should be given as tcp:HOST:PORT\n");
+		return -1;
+	}
+	memcpy(host, address, port - address);
+	host[port - address] = '\0';
+
+	struct addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	struct addrinfo *results = NULL;
+	const int res = getaddrinfo(host, port + 1U, &hints, &results);
+	if (res || !results) {
+		DEBUG_WARN("Could not resolve %s: %s\n", host, gai_strerror(res));
+		return -1;
+	}
+	fd = -1;
+	for (const struct addrinfo *result = results; result && fd == -1; result = result->ai_next) {
+		fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+		if (fd == -1)
+			continue;
+		if (connect(fd, result->ai_addr, result->ai_addrlen) == -1) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(results);
+	if (fd == -1) {
+		DEBUG_WARN("Couldn't connect to probe server %s:%s: %s\n", host, port + 1U, strerror(errno));
+		return -1;
+	}
+	/* Each remote protocol request is a small write the response to which we then wait on */
+	const int enable = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+	/* The server going away has to show up as a failed write, not kill us with SIGPIPE */
+	signal(SIGPIPE, SIG_IGN);
+	return 0;
+}
+
+int serial_fd(void)
+{
+	return fd;
+}
+
 /* A nice routine grabbed from
  * https://stackoverflow.com/questions/6947413/how-to-open-read-and-write-from-serial-port-in-c
  */
@@ -75,6 +144,8 @@ static int set_interface_attribs(void)
 int serial_open(const bmda_cli_options_s *cl_opts, const char *serial)
 {
 	char name[4096];
+	if (cl_opts->opt_device && begins_with(cl_opts->opt_device, strlen(cl_opts->opt_device), REMOTE_TCP_PREFIX))
+		return remote_tcp_open(cl_opts->opt_device);
 	if (!cl_opts->opt_device) {
 		/* Try to find some BMP if0*/
 		if (!serial) {
@@ -131,6 +202,8 @@ static bool match_serial(const char *const device, const char *const serial)
 int serial_open(const bmda_cli_options_s *const cl_opts, const char *const serial)
 {
 	char name[4096];
+	if (cl_opts->opt_device && begins_with(cl_opts->opt_device, strlen(cl_opts->opt_device), REMOTE_TCP_PREFIX))
+		return remote_tcp_open(cl_opts->opt_device);
 	if (!cl_opts->opt_device) {
 		/* Try to find some BMP if0*/
 		DIR *dir = opendir(DEVICE_BY_ID);
@@ -203,76 +276,111 @@ int serial_open(const bmda_cli_options_s *const cl_opts, const char *const seria
 void serial_close(void)
 {
 	close(fd);
+	read_buffer_fill = 0;
+	read_buffer_offset = 0;
 }
 
 int platform_buffer_write(const uint8_t *data, int size)
 {
 	DEBUG_WIRE("%s\n", data);
+	PROBE_STATS_COUNT(usb_packets_sent);
+	const uint64_t start = gdb_perf_timestamp();
 	const int written = write(fd, data, size);
+	gdb_perf_transport(start);
 	if (written < 0) {
 		const int error = errno;
 		DEBUG_WARN("Failed to write (%d): %s\n", errno, strerror(error));
+		platform_probe_lost();
 		exit(-2);
 	}
 	return size;
 }
 
+/*
+ * Wait for and read whatever the remote has sent so far into the read-ahead buffer, so a response
+ * arrives in as few reads as the OS delivers it in rather than a system call per byte
+ */
+static int serial_fill_buffer(timeval_s *const timeout)
+{
+	fd_set select_set;
+	FD_ZERO(&select_set);
+	FD_SET(fd, &select_set);
+	const uint64_t start = gdb_perf_timestamp();
+	const int result = select(FD_SETSIZE, &select_set, NULL, NULL, timeout);
+	gdb_perf_transport(start);
+	if (result < 0) {
+		DEBUG_WARN("Failed on select\n");
+		return -3;
+	}
+	if (result == 0)
+		return -4;
+	const ssize_t bytes_read = read(fd, read_buffer, sizeof(read_buffer));
+	if (bytes_read <= 0) {
+		const int error = errno;
+		DEBUG_WARN("Failed to read response (%d): %s\n", error, strerror(error));
+		/* Being readable but having nothing to read means the other end has gone away */
+		platform_probe_lost();
+		return -6;
+	}
+	read_buffer_offset = 0;
+	read_buffer_fill = (size_t)bytes_read;
+	return 0;
+}
+
 /* XXX: The size parameter should be size_t and we should either return size_t or bool */
 /* XXX: This needs documenting that it can abort the program with exit(), or the error handling fixed */
 int platform_buffer_read(uint8_t *data, int maxsize)
 {
-	char response = 0;
 	timeval_s timeout = {
 		.tv_sec = cortexm_wait_timeout / 1000U,
 		.tv_usec = 1000U * (cortexm_wait_timeout % 1000U),
 	};
+	PROBE_STATS_COUNT(usb_packets_received);
 
 	/* Drain the buffer for the remote till we see a start-of-response byte */
-	while (response != REMOTE_RESP) {
-		fd_set select_set;
-		FD_ZERO(&select_set);
-		FD_SET(fd, &select_set);
-
-		const int result = select(FD_SETSIZE, &select_set, NULL, NULL, &timeout);
-		if (result < 0) {
-			DEBUG_WARN("Failed on select\n");
-			return -3;
+	while (true) {
+		if (read_buffer_offset == read_buffer_fill) {
+			const int result = serial_fill_buffer(&timeout);
+			if (result == -4)
+				DEBUG_WARN("Timeout while waiting for BMP response\n");
+			if (result)
+				return result;
 		}
-		if (result == 0) {
-			DEBUG_WARN("Timeout while waiting for BMP response\n");
-			return -4;
-		}
-		if (read(fd, &response, 1) != 1) {
-			const int error = errno;
-			DEBUG_WARN("Failed to read response (%d): %s\n", error, strerror(error));
-			return -6;
+		const uint8_t *const start =
+			memchr(read_buffer + read_buffer_offset, REMOTE_RESP, read_buffer_fill - read_buffer_offset);
+		if (start) {
+			read_buffer_offset = (size_t)(start - read_buffer) + 1U;
+			break;
 		}
+		read_buffer_offset = read_buffer_fill;
 	}
-	/* Now collect the response */
+	/* Now collect the response, copying everything up to the end of message marker in one go */
 	for (size_t offset = 0; offset < (size_t)maxsize;) {
-		fd_set select_set;
-		FD_ZERO(&select_set);
-		FD_SET(fd, &select_set);
-		const int result = select(FD_SETSIZE, &select_set, NULL, NULL, &timeout);
-		if (result < 0) {
-			DEBUG_WARN("Failed on select\n");
-			exit(-4);
-		}
-		if (result == 0) {
-			DEBUG_WARN("Timeout on read\n");
-			return -5;
-		}
-		if (read(fd, data + offset, 1) != 1) {
-			const int error = errno;
-			DEBUG_WARN("Failed to read response (%d): %s\n", error, strerror(error));
-			return -6;
+		if (read_buffer_offset == read_buffer_fill) {
+			const int result = serial_fill_buffer(&timeout);
+			if (result == -4) {
+				DEBUG_WARN("Timeout on read\n");
+				return -5;
+			}
+			if (result == -3)
+				exit(-4);
+			if (result)
+				return result;
 		}
-		if (data[offset] == REMOTE_EOM) {
+		const uint8_t *const available = read_buffer + read_buffer_offset;
+		const size_t length = MIN(read_buffer_fill - read_buffer_offset, (size_t)maxsize - offset);
+		const uint8_t *const end = memchr(available, REMOTE_EOM, length);
+		const size_t count = end ? (size_t)(end - available) : length;
+		memcpy(data + offset, available, count);
+		offset += count;
+		read_buffer_offset += count;
+		if (end) {
+			/* Consume the marker, anything after it is kept for the next response */
+			++read_buffer_offset;
 			data[offset] = 0;
 			DEBUG_WIRE("       %s\n", data);
 			return offset;
 		}
-		++offset;
 	}
 
 	DEBUG_WARN("Failed to read\n");
@@ -21,6 +21,8 @@
 #include <windows.h>
 #include "remote.h"
 #include "cli.h"
+#include "gdb_perf.h"
+#include "probe_stats.h"
 
 #include <assert.h>
 #include <string.h>
@@ -52,6 +54,21 @@ static char *format_string(const char *format, ...)
 
 static HANDLE port_handle = INVALID_HANDLE_VALUE;
 
+/*
+ * The port is opened for overlapped I/O so reads can be issued for a whole buffer's worth and complete
+ * as soon as anything arrives, rather than a blocking ReadFile() round trip per byte. The bytes from
+ * read_buffer_offset to read_buffer_fill have been received but not yet consumed.
+ */
+#define READ_BUFFER_LENGTH 4096U
+/* How long a single overlapped read waits for the first byte before returning empty */
+#define READ_WAIT_MS 100U
+
+static OVERLAPPED read_overlap;
+static OVERLAPPED write_overlap;
+static uint8_t read_buffer[READ_BUFFER_LENGTH];
+static size_t read_buffer_fill;
+static size_t read_buffer_offset;
+
 static void display_error(const LSTATUS error, const char *const operation, const char *const path)
 {
 	char *message = NULL;
@@ -166,19 +183,23 @@ static char *find_bmp_device(const bmda_cli_options_s *const cl_opts, const char
 
 int serial_open(const bmda_cli_options_s *const cl_opts, const char *const serial)
 {
+	if (cl_opts->opt_device && strncmp(cl_opts->opt_device, "tcp:", 4U) == 0) {
+		DEBUG_WARN("Connecting to a probe server is not supported on this platform\n");
+		return -1;
+	}
 	char *const device = find_bmp_device(cl_opts, serial);
 	if (!device) {
 		DEBUG_WARN("Unexpected problems finding the device!\n");
 		return -1;
 	}
 
-	port_handle = CreateFile(device,                    /* NT path to the device */
-		GENERIC_READ | GENERIC_WRITE,                   /* Read + Write */
-		0,                                              /* No Sharing */
-		NULL,                                           /* Default security attributes */
-		OPEN_EXISTING,                                  /* Open an existing device only */
-		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, /* Normal I/O without buffering */
-		NULL);                                          /* Do not use a template file */
+	port_handle = CreateFile(device,                  /* NT path to the device */
+		GENERIC_READ | GENERIC_WRITE,                 /* Read + Write */
+		0,                                            /* No Sharing */
+		NULL,                                         /* Default security attributes */
+		OPEN_EXISTING,                                /* Open an existing device only */
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, /* Overlapped I/O */
+		NULL);                                        /* Do not use a template file */
 	free(device);
 
 	if (port_handle == INVALID_HANDLE_VALUE) {
@@ -208,16 +229,29 @@ int serial_open(const bmda_cli_options_s *const cl_opts, const char *const seria
 		return -1;
 	}
 
+	/*
+	 * With both read interval and multiplier at MAXDWORD, a read returns as soon as any bytes are
+	 * available, however many were asked for, and only waits the constant if there are none yet
+	 */
 	COMMTIMEOUTS timeouts = {};
-	timeouts.ReadIntervalTimeout = 10;
-	timeouts.ReadTotalTimeoutConstant = 10;
-	timeouts.ReadTotalTimeoutMultiplier = 10;
+	timeouts.ReadIntervalTimeout = MAXDWORD;
+	timeouts.ReadTotalTimeoutConstant = READ_WAIT_MS;
+	timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
 	timeouts.WriteTotalTimeoutConstant = 10;
 	timeouts.WriteTotalTimeoutMultiplier = 10;
 	if (!SetCommTimeouts(port_handle, &timeouts)) {
 		handle_dev_error(port_handle, "setting communication timeouts for device");
 		return -1;
 	}
+
+	read_overlap.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	write_overlap.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!read_overlap.hEvent || !write_overlap.hEvent) {
+		handle_dev_error(port_handle, "creating I/O completion events for device");
+		return -1;
+	}
+	read_buffer_fill = 0;
+	read_buffer_offset = 0;
 	return 0;
 }
 
@@ -225,6 +259,12 @@ void serial_close(void)
 {
 	CloseHandle(port_handle);
 	port_handle = INVALID_HANDLE_VALUE;
+	if (read_overlap.hEvent)
+		CloseHandle(read_overlap.hEvent);
+	if (write_overlap.hEvent)
+		CloseHandle(write_overlap.hEvent);
+	read_overlap.hEvent = NULL;
+	write_overlap.hEvent = NULL;
 }
 
 /* XXX: This should return bool and the size parameter should be size_t as it cannot be negative. */
@@ -232,49 +272,86 @@ int platform_buffer_write(const uint8_t *data, int size)
 {
 	DEBUG_WIRE("%s\n", data);
 	DWORD written = 0;
+	PROBE_STATS_COUNT(usb_packets_sent);
+	const uint64_t start = gdb_perf_timestamp();
 	for (size_t offset = 0; offset < (size_t)size; offset += written) {
-		if (!WriteFile(port_handle, data + offset, size - offset, &written, NULL)) {
+		ResetEvent(write_overlap.hEvent);
+		if ((!WriteFile(port_handle, data + offset, size - offset, NULL, &write_overlap) &&
+				GetLastError() != ERROR_IO_PENDING) ||
+			!GetOverlappedResult(port_handle, &write_overlap, &written, TRUE)) {
 			DEBUG_WARN("Serial write failed %lu, written %zu\n", GetLastError(), offset);
 			return -1;
 		}
-		offset += written;
 	}
+	gdb_perf_transport(start);
 	return 0;
 }
 
+/*
+ * Read whatever the remote has sent so far into the read-ahead buffer, waiting up to READ_WAIT_MS
+ * for the first byte. Returns false on a hard error, an empty buffer after that meaning nothing came.
+ */
+static bool serial_fill_buffer(void)
+{
+	DWORD bytes_read = 0;
+	ResetEvent(read_overlap.hEvent);
+	if (!ReadFile(port_handle, read_buffer, sizeof(read_buffer), NULL, &read_overlap) &&
+		GetLastError() != ERROR_IO_PENDING)
+		return false;
+	const uint64_t start = gdb_perf_timestamp();
+	const bool result = GetOverlappedResult(port_handle, &read_overlap, &bytes_read, TRUE);
+	gdb_perf_transport(start);
+	if (!result)
+		return false;
+	read_buffer_offset = 0;
+	read_buffer_fill = bytes_read;
+	return true;
+}
+
 /* XXX: The size parameter should be size_t and we should either return size_t or bool */
 /* XXX: This needs documenting that it can abort the program with exit(), or the error handling fixed */
 int platform_buffer_read(uint8_t *data, int maxsize)
 {
-	DWORD read = 0;
-	char response = 0;
 	const uint32_t start_time = platform_time_ms();
 	const uint32_t end_time = start_time + cortexm_wait_timeout;
+	PROBE_STATS_COUNT(usb_packets_received);
 	/* Drain the buffer for the remote till we see a start-of-response byte */
-	while (response != REMOTE_RESP) {
-		if (!ReadFile(port_handle, &response, 1, &read, NULL)) {
+	while (true) {
+		if (read_buffer_offset == read_buffer_fill && !serial_fill_buffer()) {
 			DEBUG_WARN("error occurred while reading response: %lu\n", GetLastError());
 			exit(-3);
 		}
+		const uint8_t *const start =
+			memchr(read_buffer + read_buffer_offset, REMOTE_RESP, read_buffer_fill - read_buffer_offset);
+		if (start) {
+			read_buffer_offset = (size_t)(start - read_buffer) + 1U;
+			break;
+		}
+		read_buffer_offset = read_buffer_fill;
 		if (platform_time_ms() > end_time) {
 			DEBUG_WARN("Timeout while waiting for BMP response\n");
 			exit(-4);
 		}
 	}
-	/* Now collect the response */
+	/* Now collect the response, copying everything up to the end of message marker in one go */
 	for (size_t offset = 0; offset < (size_t)maxsize && platform_time_ms() < end_time;) {
-		if (!ReadFile(port_handle, data + offset, 1, &read, NULL)) {
+		if (read_buffer_offset == read_buffer_fill && !serial_fill_buffer()) {
 			DEBUG_WARN("Error on read\n");
 			exit(-3);
 		}
-		if (read > 0) {
-			DEBUG_WIRE("%c", data[offset]);
-			if (data[offset] == REMOTE_EOM) {
-				data[offset] = 0;
-				DEBUG_WIRE("\n");
-				return offset;
-			}
-			++offset;
+		const uint8_t *const available = read_buffer + read_buffer_offset;
+		const size_t length = MIN(read_buffer_fill - read_buffer_offset, (size_t)maxsize - offset);
+		const uint8_t *const end = memchr(available, REMOTE_EOM, length);
+		const size_t count = end ? (size_t)(end - available) : length;
+		memcpy(data + offset, available, count);
+		offset += count;
+		read_buffer_offset += count;
+		if (end) {
+			/* Consume the marker, anything after it is kept for the next response */
+			++read_buffer_offset;
+			data[offset] = 0;
+			DEBUG_WIRE("%s\n", data);
+			return offset;
 		}
 	}
 	DEBUG_WARN("Failed to read EOM at %u\n", platform_time_ms() - start_time);
@@ -0,0 +1,201 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2026 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements RAM snapshots for putting a target's memory back to a known state between
+ * test cases. BMDA keeps the copy along with a CRC of each page, and on restore has the target
+ * CRC its own memory where it can so that only the pages that changed get read or written back.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "gdb_packet.h"
+#include "crc32.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_PAGE_SIZE 1024U
+#define SNAPSHOT_MAX_SIZE  (64U * 1024U * 1024U)
+
+typedef struct snapshot_region snapshot_region_s;
+
+struct snapshot_region {
+	snapshot_region_s *next;
+	target_addr_t start;
+	size_t length;
+	uint32_t crc;
+	uint32_t *page_crc;
+	uint8_t data[];
+};
+
+static snapshot_region_s *snapshot_regions;
+/* The target the snapshot was taken from, only ever compared against and never dereferenced */
+static const target_s *snapshot_target;
+
+static size_t snapshot_pages(const size_t length)
+{
+	return (length + SNAPSHOT_PAGE_SIZE - 1U) / SNAPSHOT_PAGE_SIZE;
+}
+
+void snapshot_clear(void)
+{
+	while (snapshot_regions) {
+		snapshot_region_s *const next = snapshot_regions->next;
+		free(snapshot_regions->page_crc);
+		free(snapshot_regions);
+		snapshot_regions = next;
+	}
+	snapshot_target = NULL;
+}
+
+/* Append, so the regions stay in the order of the target's memory map */
+static void snapshot_append(snapshot_region_s *const region)
+{
+	snapshot_region_s **tail = &snapshot_regions;
+	while (*tail)
+		tail = &(*tail)->next;
+	region->next = NULL;
+	*tail = region;
+}
+
+static bool snapshot_add(target_s *const t, const target_addr_t start, const size_t length)
+{
+	if (!length || length > SNAPSHOT_MAX_SIZE) {
+		DEBUG_WARN("snapshot: 0x%08" PRIx32 "+%zu is too big\n", start, length);
+		return false;
+	}
+	snapshot_region_s *const region = malloc(sizeof(*region) + length);
+	if (!region) {
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	region->page_crc = calloc(snapshot_pages(length), sizeof(*region->page_crc));
+	if (!region->page_crc) {
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		free(region);
+		return false;
+	}
+	region->start = start;
+	region->length = length;
+	if (target_mem_read(t, region->data, start, length)) {
+		DEBUG_WARN("snapshot: failed reading 0x%08" PRIx32 "+%zu\n", start, length);
+		free(region->page_crc);
+		free(region);
+		return false;
+	}
+	region->crc = generic_crc32_buffer(region->data, length);
+	for (size_t page = 0; page < snapshot_pages(length); ++page) {
+		const size_t offset = page * SNAPSHOT_PAGE_SIZE;
+		region->page_crc[page] = generic_crc32_buffer(region->data + offset, MIN(length - offset, SNAPSHOT_PAGE_SIZE));
+	}
+	snapshot_append(region);
+	return true;
+}
+
+bool snapshot_save(target_s *const t, const target_addr_t start, const size_t length)
+{
+	snapshot_clear();
+	bool result = true;
+	if (length)
+		result = snapshot_add(t, start, length);
+	else {
+		for (const target_ram_s *ram = t->ram; ram && result; ram = ram->next)
+			result = snapshot_add(t, ram->start, ram->length);
+	}
+	if (!result || !snapshot_regions) {
+		snapshot_clear();
+		return false;
+	}
+	snapshot_target = t;
+	return true;
+}
+
+/* Check a page against the snapshot, by CRC on the target if it can or else by reading it back */
+static bool snapshot_page_matches(
+	target_s *const t, const snapshot_region_s *const region, const size_t page, const size_t offset, const size_t len)
+{
+	uint32_t crc = 0;
+	if (t->mem_crc32 && t->mem_crc32(t, &crc, region->start + offset, len))
+		return crc == region->page_crc[page];
+	uint8_t data[SNAPSHOT_PAGE_SIZE];
+	return !target_mem_read(t, data, region->start + offset, len) && !memcmp(data, region->data + offset, len);
+}
+
+static bool snapshot_restore_region(target_s *const t, const snapshot_region_s *const region, size_t *const written)
+{
+	/* Often most of the memory is untouched, so ask about the whole region first */
+	uint32_t crc = 0;
+	if (t->mem_crc32 && t->mem_crc32(t, &crc, region->start, region->length) && crc == region->crc)
+		return true;
+
+	for (size_t page = 0; page < snapshot_pages(region->length); ++page) {
+		const size_t offset = page * SNAPSHOT_PAGE_SIZE;
+		const size_t amount = MIN(region->length - offset, SNAPSHOT_PAGE_SIZE);
+		if (snapshot_page_matches(t, region, page, offset, amount))
+			continue;
+		if (target_mem_write(t, region->start + offset, region->data + offset, amount))
+			return false;
+		++*written;
+	}
+	return true;
+}
+
+bool snapshot_restore(target_s *const t)
+{
+	if (!snapshot_regions || t != snapshot_target) {
+		gdb_out("No snapshot taken of this target\n");
+		return false;
+	}
+	size_t written = 0;
+	size_t pages = 0;
+	for (const snapshot_region_s *region = snapshot_regions; region; region = region->next) {
+		if (!snapshot_restore_region(t, region, &written)) {
+			gdb_outf("Failed restoring 0x%08" PRIx32 "+%zu\n", region->start, region->length);
+			return false;
+		}
+		pages += snapshot_pages(region->length);
+	}
+	gdb_outf("Restored %zu of %zu pages\n", written, pages);
+	return true;
+}
+
+void snapshot_show(void)
+{
+	if (!snapshot_regions) {
+		gdb_out("No snapshot taken\n");
+		return;
+	}
+	for (const snapshot_region_s *region = snapshot_regions; region; region = region->next) {
+		gdb_outf("0x%08" PRIx32 "+0x%zx: %zu pages of %u bytes, CRC 0x%08" PRIx32 "\n", region->start,
+			region->length, snapshot_pages(region->length), SNAPSHOT_PAGE_SIZE, region->crc);
+	}
+}
@@ -44,6 +44,7 @@
 #include <sys/time.h>
 
 #include "cli.h"
+#include "swo_decode.h"
 
 #define STLINK_SWIM_ERR_OK             0x00U
 #define STLINK_SWIM_BUSY               0x01U
@@ -171,8 +172,25 @@
 #define STLINK_TRACE_SIZE   4096U
 #define STLINK_TRACE_MAX_HZ 2000000U
 
+/*
+ * Host-side buffer captured SWO data is queued in ahead of decoding, so bursts of trace don't
+ * have to be decoded (and printed) in the same poll they arrive in
+ */
+#define STLINK_SWO_BUFFER_SIZE (1024U * 1024U)
+/* Most SWO data to decode per poll, so a busy trace stream can't starve the GDB server */
+#define STLINK_SWO_DECODE_CHUNK (16U * 1024U)
+
 #define STLINK_V3_MAX_FREQ_NB 10U
 
+/*
+ * Largest transfer a single memory access command can carry. 8-bit accesses are limited by the
+ * adaptor's byte path, 16 and 32-bit accesses by its data buffer, which is a good deal bigger.
+ */
+#define STLINK_V2_MAX_RW8     64U
+#define STLINK_V3_MAX_RW8     512U
+#define STLINK_V2_MAX_RW16_32 1024U
+#define STLINK_V3_MAX_RW16_32 6144U
+
 typedef enum transport_mode {
 	STLINK_MODE_SWD = 0,
 	STLINK_MODE_JTAG
@@ -192,12 +210,24 @@ typedef struct stlink {
 	uint8_t ver_mass;
 	uint8_t ver_swim;
 	uint8_t ver_bridge;
-	uint16_t block_size;
+	uint16_t block_size;      /* Max 8-bit transfer per command */
+	uint16_t wide_block_size; /* Max 16 and 32-bit transfer per command */
 	bool ap_error;
 } stlink_s;
 
 stlink_s stlink;
 
+typedef struct stlink_swo {
+	usb_transfer_ring_s ring;
+	uint8_t transfer_buffer[USB_TRANSFER_RING_DEPTH][STLINK_TRACE_SIZE];
+	uint8_t *buffer;
+	size_t head;
+	size_t count;
+	size_t dropped;
+} stlink_swo_s;
+
+static stlink_swo_s *stlink_swo;
+
 static int stlink_usb_get_rw_status(bool verbose);
 
 int debug_level = 0;
@@ -405,7 +435,8 @@ static void stlink_version(bmp_info_s *info)
 		stlink.ver_jtag = data[2];
 		stlink.ver_mass = data[3];
 		stlink.ver_bridge = data[4];
-		stlink.block_size = 512;
+		stlink.block_size = STLINK_V3_MAX_RW8;
+		stlink.wide_block_size = STLINK_V3_MAX_RW16_32;
 		stlink.vid = (data[3] << 9U) | data[8];
 		stlink.pid = (data[5] << 11U) | data[10];
 	} else {
@@ -420,7 +451,8 @@ static void stlink_version(bmp_info_s *info)
 		stlink.vid = (data[3] << 8U) | data[2];
 		stlink.pid = (data[5] << 8U) | data[4];
 		uint16_t version = (data[0] << 8U) | data[1]; /* Big endian here!*/
-		stlink.block_size = 64;
+		stlink.block_size = STLINK_V2_MAX_RW8;
+		stlink.wide_block_size = STLINK_V2_MAX_RW16_32;
 		stlink.ver_stlink = (version >> 12U) & 0x0fU;
 		stlink.ver_jtag = (version >> 6U) & 0x3fU;
 		if (stlink.pid == PRODUCT_ID_STLINKV21_MSD || stlink.pid == PRODUCT_ID_STLINKV21)
@@ -838,46 +870,76 @@ static int stlink_usb_get_rw_status(bool verbose)
 	return stlink_usb_error_check(data, verbose);
 }
 
-static void stlink_mem_read(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len)
+#define ALIGNOF(x) (((x)&3U) == 0 ? ALIGN_WORD : (((x)&1U) == 0 ? ALIGN_HALFWORD : ALIGN_BYTE))
+
+static void stlink_mem_command(
+	uint8_t *const cmd, const uint8_t type, const uint32_t addr, const size_t len, const uint8_t apsel)
+{
+	memset(cmd, 0, 16);
+	cmd[0] = STLINK_DEBUG_COMMAND;
+	cmd[1] = type;
+	cmd[2] = addr & 0xffU;
+	cmd[3] = (addr >> 8U) & 0xffU;
+	cmd[4] = (addr >> 16U) & 0xffU;
+	cmd[5] = (addr >> 24U) & 0xffU;
+	cmd[6] = len & 0xffU;
+	cmd[7] = len >> 8U;
+	cmd[8] = apsel;
+}
+
+static bool stlink_mem_read_sized(adiv5_access_port_s *ap, uint8_t *dest, uint32_t src, size_t len, align_e align)
 {
-	if (len == 0)
-		return;
-	size_t read_len = len;
 	uint8_t type;
-	if ((src & 1U) || (len & 1U)) {
+	size_t block_size = stlink.wide_block_size;
+	if (align == ALIGN_BYTE) {
 		type = STLINK_DEBUG_READMEM_8BIT;
-		if (len > stlink.block_size) {
-			DEBUG_WARN("Too large!\n");
-			return;
-		}
-		if (len == 1)
-			++read_len; /* Fix read length as in openocd*/
-	} else if ((src & 3U) || (len & 3U))
+		block_size = stlink.block_size;
+	} else if (align == ALIGN_HALFWORD)
 		type = STLINK_DEBUG_APIV2_READMEM_16BIT;
 	else
 		type = STLINK_DEBUG_READMEM_32BIT;
 
-	uint8_t cmd[16];
-	memset(cmd, 0, sizeof(cmd));
-	cmd[0] = STLINK_DEBUG_COMMAND;
-	cmd[1] = type;
-	cmd[2] = src & 0xffU;
-	cmd[3] = (src >> 8U) & 0xffU;
-	cmd[4] = (src >> 16U) & 0xffU;
-	cmd[5] = (src >> 24U) & 0xffU;
-	cmd[6] = len & 0xffU;
-	cmd[7] = len >> 8U;
-	cmd[8] = ap->apsel;
-	int res = read_retry(cmd, 16, dest, read_len);
-	if (res != STLINK_ERROR_OK) {
-		/* FIXME: What is the right measure when failing?
-		 *
-		 * E.g. TM4C129 gets here when NRF probe reads 0x10000010
-		 * Approach taken:
-		 * Fill the memory with some fixed pattern so hopefully
-		 * the caller notices the error*/
-		DEBUG_WARN("stlink_mem_read from  %" PRIx32 " to %p, len %zu failed\n", src, dest, len);
-		memset(dest, 0xff, len);
+	/* Split the transfer into the largest blocks the adaptor can handle in one command */
+	for (size_t offset = 0; offset < len;) {
+		const size_t amount = MIN(len - offset, block_size);
+		/* Fix read length as in openocd */
+		const size_t read_len = amount == 1U ? 2U : amount;
+		uint8_t buffer[2];
+		uint8_t cmd[16];
+		stlink_mem_command(cmd, type, src + offset, amount, ap->apsel);
+		if (read_retry(cmd, 16, read_len == amount ? dest + offset : buffer, read_len) != STLINK_ERROR_OK)
+			return false;
+		if (read_len != amount)
+			dest[offset] = buffer[0];
+		offset += amount;
+	}
+	return true;
+}
+
+static void stlink_mem_read(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len)
+{
+	/*
+	 * Rather than dropping the whole read to the narrowest width the start address and length allow,
+	 * split it into a narrow unaligned head, one word-wide burst and a narrow tail.
+	 */
+	uint8_t *data = (uint8_t *)dest;
+	for (size_t offset = 0; offset < len;) {
+		const uint32_t addr = src + offset;
+		const size_t remaining = len - offset;
+		const align_e align = MIN(ALIGNOF(addr), remaining >= 4U ? ALIGN_WORD : ALIGNOF(remaining));
+		const size_t amount = align == ALIGN_WORD ? remaining & ~3U : 1U << align;
+		if (!stlink_mem_read_sized(ap, data + offset, addr, amount, align)) {
+			/* FIXME: What is the right measure when failing?
+			 *
+			 * E.g. TM4C129 gets here when NRF probe reads 0x10000010
+			 * Approach taken:
+			 * Fill the memory with some fixed pattern so hopefully
+			 * the caller notices the error*/
+			DEBUG_WARN("stlink_mem_read from  %" PRIx32 " to %p, len %zu failed\n", src, dest, len);
+			memset(dest, 0xff, len);
+			return;
+		}
+		offset += amount;
 	}
 	DEBUG_PROBE("stlink_mem_read from %" PRIx32 " to %p, len %zu\n", src, dest, len);
 }
@@ -885,63 +947,48 @@ static void stlink_mem_read(adiv5_access_port_s *ap, void *dest, uint32_t src, s
 static void stlink_mem_write8(usb_link_s *link, adiv5_access_port_s *ap, uint32_t addr, size_t len, uint8_t *buffer)
 {
 	while (len) {
-		size_t length;
 		/* OpenOCD has some note about writemem8*/
-		if (len > stlink.block_size)
-			length = stlink.block_size;
-		else
-			length = len;
+		const size_t length = MIN(len, stlink.block_size);
 		uint8_t cmd[16];
-		memset(cmd, 0, sizeof(cmd));
-		cmd[0] = STLINK_DEBUG_COMMAND;
-		cmd[1] = STLINK_DEBUG_WRITEMEM_8BIT;
-		cmd[2] = addr & 0xffU;
-		cmd[3] = (addr >> 8U) & 0xffU;
-		cmd[4] = (addr >> 16U) & 0xffU;
-		cmd[5] = (addr >> 24U) & 0xffU;
-		cmd[6] = length & 0xffU;
-		cmd[7] = length >> 8U;
-		cmd[8] = ap->apsel;
+		stlink_mem_command(cmd, STLINK_DEBUG_WRITEMEM_8BIT, addr, length, ap->apsel);
 		send_recv(link, cmd, 16, NULL, 0);
 		send_recv(link, (void *)buffer, length, NULL, 0);
 		stlink_usb_get_rw_status(true);
 		len -= length;
 		addr += length;
+		buffer += length;
 	}
 }
 
 static void stlink_mem_write16(usb_link_s *link, adiv5_access_port_s *ap, uint32_t addr, size_t len, uint16_t *buffer)
 {
-	uint8_t cmd[16];
-	memset(cmd, 0, sizeof(cmd));
-	cmd[0] = STLINK_DEBUG_COMMAND;
-	cmd[1] = STLINK_DEBUG_APIV2_WRITEMEM_16BIT;
-	cmd[2] = addr & 0xffU;
-	cmd[3] = (addr >> 8U) & 0xffU;
-	cmd[4] = (addr >> 16U) & 0xffU;
-	cmd[5] = (addr >> 24U) & 0xffU;
-	cmd[6] = len & 0xffU;
-	cmd[7] = len >> 8U;
-	cmd[8] = ap->apsel;
-	send_recv(link, cmd, 16, NULL, 0);
-	send_recv(link, (void *)buffer, len, NULL, 0);
-	stlink_usb_get_rw_status(true);
+	const uint8_t *data = (const uint8_t *)buffer;
+	while (len) {
+		const size_t length = MIN(len, stlink.wide_block_size);
+		uint8_t cmd[16];
+		stlink_mem_command(cmd, STLINK_DEBUG_APIV2_WRITEMEM_16BIT, addr, length, ap->apsel);
+		send_recv(link, cmd, 16, NULL, 0);
+		send_recv(link, (void *)data, length, NULL, 0);
+		stlink_usb_get_rw_status(true);
+		len -= length;
+		addr += length;
+		data += length;
+	}
 }
 
 static void stlink_mem_write32(adiv5_access_port_s *ap, uint32_t addr, size_t len, uint32_t *buffer)
 {
-	uint8_t cmd[16];
-	memset(cmd, 0, sizeof(cmd));
-	cmd[0] = STLINK_DEBUG_COMMAND;
-	cmd[1] = STLINK_DEBUG_WRITEMEM_32BIT;
-	cmd[2] = addr & 0xffU;
-	cmd[3] = (addr >> 8U) & 0xffU;
-	cmd[4] = (addr >> 16U) & 0xffU;
-	cmd[5] = (addr >> 24U) & 0xffU;
-	cmd[6] = len & 0xffU;
-	cmd[7] = len >> 8U;
-	cmd[8] = ap->apsel;
-	write_retry(cmd, 16, (void *)buffer, len);
+	uint8_t *data = (uint8_t *)buffer;
+	while (len) {
+		const size_t length = MIN(len, stlink.wide_block_size);
+		uint8_t cmd[16];
+		stlink_mem_command(cmd, STLINK_DEBUG_WRITEMEM_32BIT, addr, length, ap->apsel);
+		if (write_retry(cmd, 16, data, length) != STLINK_ERROR_OK)
+			return;
+		len -= length;
+		addr += length;
+		data += length;
+	}
 }
 
 static void stlink_regs_read(adiv5_access_port_s *ap, void *data)
@@ -1205,3 +1252,137 @@ uint32_t stlink_max_frequency_get(bmp_info_s *info)
 		return result / (2U * divisor);
 	return result / (V2_USED_SWD_CYCLES + (V2_CYCLES_PER_CNT * divisor));
 }
+
+/*
+ * The trace data endpoint is the one after the command endpoint, which is EP2 on V2 adaptors
+ * and EP1 on V2.1 and V3 adaptors
+ */
+static uint8_t stlink_swo_endpoint(void)
+{
+	return (stlink.ep_tx == 2U ? 3U : 2U) | LIBUSB_ENDPOINT_IN;
+}
+
+static bool stlink_swo_submit(const size_t slot)
+{
+	return usb_transfer_ring_submit(&stlink_swo->ring, stlink_swo->transfer_buffer[slot], STLINK_TRACE_SIZE) == 0;
+}
+
+bool stlink_swo_start(const uint32_t baudrate)
+{
+	if (stlink.ver_stlink == 2U && stlink.ver_jtag < 13U) {
+		DEBUG_WARN("ST-Link firmware too old for SWO capture, please update it\n");
+		return false;
+	}
+	if (baudrate > STLINK_TRACE_MAX_HZ)
+		DEBUG_WARN("SWO baud rate %" PRIu32 " may be too fast for the ST-Link, which supports up to %u\n", baudrate,
+			STLINK_TRACE_MAX_HZ);
+	stlink_swo_s *const swo = calloc(1, sizeof(*swo));
+	if (swo)
+		swo->buffer = malloc(STLINK_SWO_BUFFER_SIZE);
+	if (!swo || !swo->buffer) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		free(swo);
+		return false;
+	}
+	if (!usb_transfer_ring_init(&swo->ring, info.usb_link, stlink_swo_endpoint())) {
+		free(swo->buffer);
+		free(swo);
+		return false;
+	}
+
+	uint8_t cmd[16] = {
+		STLINK_DEBUG_COMMAND,
+		STLINK_DEBUG_APIV2_START_TRACE_RX,
+		STLINK_TRACE_SIZE & 0xffU,
+		STLINK_TRACE_SIZE >> 8U,
+		baudrate & 0xffU,
+		(baudrate >> 8U) & 0xffU,
+		(baudrate >> 16U) & 0xffU,
+		(baudrate >> 24U) & 0xffU,
+	};
+	uint8_t data[2];
+	send_recv(info.usb_link, cmd, 16, data, 2);
+	if (stlink_usb_error_check(data, true) != STLINK_ERROR_OK) {
+		usb_transfer_ring_free(&swo->ring);
+		free(swo->buffer);
+		free(swo);
+		return false;
+	}
+
+	/* Keep the whole ring of reads queued on the trace endpoint so no data waits on the host */
+	stlink_swo = swo;
+	swo_decode_init();
+	for (size_t slot = 0; slot < USB_TRANSFER_RING_DEPTH; ++slot) {
+		if (!stlink_swo_submit(slot)) {
+			stlink_swo_stop();
+			return false;
+		}
+	}
+	DEBUG_INFO("SWO capture started at %" PRIu32 " baud\n", baudrate);
+	return true;
+}
+
+void stlink_swo_poll(void)
+{
+	stlink_swo_s *const swo = stlink_swo;
+	if (!swo)
+		return;
+	/* Move every completed read into the capture buffer and hand its transfer straight back to libusb */
+	while (usb_transfer_ring_ready(&swo->ring)) {
+		const size_t slot = swo->ring.head;
+		const int result = usb_transfer_ring_wait(&swo->ring);
+		if (result < 0) {
+			DEBUG_WARN("SWO capture failed, stopping\n");
+			stlink_swo_stop();
+			return;
+		}
+		for (size_t offset = 0; offset < (size_t)result; ++offset) {
+			if (swo->count == STLINK_SWO_BUFFER_SIZE) {
+				swo->dropped += (size_t)result - offset;
+				break;
+			}
+			swo->buffer[(swo->head + swo->count++) % STLINK_SWO_BUFFER_SIZE] = swo->transfer_buffer[slot][offset];
+		}
+		if (!stlink_swo_submit(slot)) {
+			stlink_swo_stop();
+			return;
+		}
+	}
+
+	/* Then feed a bounded amount of it to the decoder, in contiguous runs */
+	size_t budget = STLINK_SWO_DECODE_CHUNK;
+	while (swo->count && budget) {
+		const size_t amount = MIN(MIN(swo->count, budget), STLINK_SWO_BUFFER_SIZE - swo->head);
+		swo_decode(swo->buffer + swo->head, amount);
+		swo->head = (swo->head + amount) % STLINK_SWO_BUFFER_SIZE;
+		swo->count -= amount;
+		budget -= amount;
+	}
+	fflush(stdout);
+}
+
+void stlink_swo_stop(void)
+{
+	stlink_swo_s *const swo = stlink_swo;
+	if (!swo)
+		return;
+	stlink_swo = NULL;
+	usb_transfer_ring_free(&swo->ring);
+	uint8_t cmd[16] = {STLINK_DEBUG_COMMAND, STLINK_DEBUG_APIV2_STOP_TRACE_RX};
+	uint8_t data[2];
+	send_recv(info.usb_link, cmd, 16, data, 2);
+	stlink_usb_error_check(data, false);
+
+	/* Decode whatever was still waiting and summarise the capture */
+	while (swo->count) {
+		const size_t amount = MIN(swo->count, STLINK_SWO_BUFFER_SIZE - swo->head);
+		swo_decode(swo->buffer + swo->head, amount);
+		swo->head = (swo->head + amount) % STLINK_SWO_BUFFER_SIZE;
+		swo->count -= amount;
+	}
+	swo_decode_report();
+	if (swo->dropped)
+		DEBUG_WARN("SWO capture buffer overran, %zu bytes of trace were dropped\n", swo->dropped);
+	free(swo->buffer);
+	free(swo);
+}
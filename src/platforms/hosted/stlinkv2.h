@@ -88,6 +88,19 @@ uint32_t stlink_max_frequency_get(bmp_info_s *info)
 	return 0;
 }
 
+bool stlink_swo_start(uint32_t baudrate)
+{
+	return false;
+}
+
+void stlink_swo_poll(void)
+{
+}
+
+void stlink_swo_stop(void)
+{
+}
+
 #pragma GCC diagnostic pop
 #else
 int stlink_init(bmp_info_s *info);
@@ -102,6 +115,9 @@ uint32_t jtag_scan_stlinkv2(bmp_info_s *info, const uint8_t *irlens);
 void stlink_exit_function(bmp_info_s *info);
 void stlink_max_frequency_set(bmp_info_s *info, uint32_t freq);
 uint32_t stlink_max_frequency_get(bmp_info_s *info);
+bool stlink_swo_start(uint32_t baudrate);
+void stlink_swo_poll(void);
+void stlink_swo_stop(void);
 #endif
 
 #endif /* PLATFORMS_HOSTED_STLINKV2_H */
@@ -0,0 +1,659 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements a software model of an SWD target for BMDA, selected with `-d sim:`. It
+ * decodes the SWD packets the bit-banging DP layer sends through swd_proc and answers them from
+ * a DPv1 SW-DP with a single AHB-AP, behind which sit a ROM table, a Cortex-M4 style System Control
+ * Space with the core debug registers, RAM and a Flash region with a minimal controller of its own.
+ *
+ * Nothing is executed: the modelled core only halts, resumes, steps (advancing the PC by one
+ * Thumb instruction) and resets, and every access completes straight away with an OK ACK. That
+ * is enough to run the scan, attach, memory, register and Flash paths of adiv5.c, adiv5_swdp.c and
+ * cortexm.c without hardware, while counting the wire traffic they generate so that changes to
+ * them can be compared by the clock cycles and round trips each operation takes.
+ */
+
+#include "general.h"
+#include "swd.h"
+#include "target.h"
+#include "target_internal.h"
+#include "adiv5.h"
+#include "cortexm.h"
+#include "swd_sim.h"
+
+/* DPv1 SW-DP designed by Arm, as found on Cortex-M3 and M4 parts */
+#define SWD_SIM_DPIDR 0x2ba01477U
+/* AHB-AP, Arm designed, revision 2 */
+#define SWD_SIM_AP_IDR 0x24770011U
+
+#define SWD_SIM_ROM_TABLE 0xe00ff000U
+/* Designer Arm, part number chosen to match none of the parts cortexm_probe() knows */
+#define SWD_SIM_ROM_PIDR 0x00000004000bb4c9ULL
+#define SWD_SIM_ROM_CIDR 0xb105100dU
+/* Cortex-M4 SCS */
+#define SWD_SIM_SCS_PIDR 0x00000004000bb00cULL
+#define SWD_SIM_SCS_CIDR 0xb105e00dU
+/* Cortex-M4 r0p1 */
+#define SWD_SIM_CPUID 0x410fc241U
+
+#define SWD_SIM_PPB_SIZE 0x10000U
+
+#define SWD_SIM_RAM_BASE  0x20000000U
+#define SWD_SIM_RAM_SIZE  0x10000U
+#define SWD_SIM_FLASH_BASE 0x08000000U
+#define SWD_SIM_FLASH_SIZE 0x20000U
+#define SWD_SIM_FLASH_PAGE 0x400U
+
+/* The Flash controller erases and programs instantly, so it has no busy flag */
+#define SWD_SIM_FLASH_CTRL     0x40000000U
+#define SWD_SIM_FLASH_CR       (SWD_SIM_FLASH_CTRL + 0x0U)
+#define SWD_SIM_FLASH_AR       (SWD_SIM_FLASH_CTRL + 0x4U)
+#define SWD_SIM_FLASH_SR       (SWD_SIM_FLASH_CTRL + 0x8U)
+#define SWD_SIM_FLASH_CR_PG    (1U << 0U)
+#define SWD_SIM_FLASH_CR_PER   (1U << 1U)
+#define SWD_SIM_FLASH_CR_STRT  (1U << 6U)
+#define SWD_SIM_FLASH_SR_PGERR (1U << 2U)
+
+#define SWD_SIM_CTRLSTAT_MASK 0x54ffff0dU
+#define SWD_SIM_CPU_REGS      0x80U
+
+typedef enum swd_sim_phase {
+	SWD_SIM_IDLE,
+	/* A packet request has been decoded and the target is to drive the ACK */
+	SWD_SIM_ACK,
+	/* The ACK of a read has been sent and the target is to drive the data */
+	SWD_SIM_READ_DATA,
+	/* The ACK of a write has been sent and the host is to drive the data */
+	SWD_SIM_WRITE_DATA,
+} swd_sim_phase_e;
+
+typedef struct swd_sim {
+	bool powered;
+	/* Wire state */
+	swd_sim_phase_e phase;
+	bool host_driving;
+	uint8_t request;
+	uint32_t read_data;
+	swd_sim_stats_s stats;
+	/* DP */
+	uint32_t ctrlstat;
+	uint32_t select;
+	uint32_t rdbuff;
+	/* MEM-AP 0 */
+	uint32_t csw;
+	uint32_t tar;
+	/* Core debug */
+	bool halted;
+	bool retired;
+	bool reset_seen;
+	uint32_t dhcsr;
+	uint32_t dfsr;
+	uint32_t demcr;
+	uint32_t dcrdr;
+	uint32_t fpb_ctrl;
+	uint32_t regs[SWD_SIM_CPU_REGS];
+	/* Flash controller */
+	uint32_t flash_cr;
+	uint32_t flash_ar;
+	uint32_t flash_sr;
+	/* Memories, the PPB being plain storage underneath the registers modelled in it */
+	uint32_t ppb[SWD_SIM_PPB_SIZE / 4U];
+	uint8_t ram[SWD_SIM_RAM_SIZE];
+	uint8_t flash[SWD_SIM_FLASH_SIZE];
+} swd_sim_s;
+
+static swd_sim_s sim;
+
+static const char swd_sim_driver_str[] = "SWD simulator";
+
+static uint32_t swd_sim_read_le32(const uint8_t *const data)
+{
+	return data[0] | (uint32_t)data[1] << 8U | (uint32_t)data[2] << 16U | (uint32_t)data[3] << 24U;
+}
+
+static void swd_sim_core_reset(void)
+{
+	memset(sim.regs, 0, sizeof(sim.regs));
+	/* SP and PC come from the vector table at the start of Flash, and the core is in Thumb state */
+	sim.regs[13] = swd_sim_read_le32(sim.flash);
+	sim.regs[15] = swd_sim_read_le32(sim.flash + 4U) & ~1U;
+	sim.regs[16] = 0x01000000U;
+	sim.reset_seen = true;
+	sim.halted = sim.demcr & CORTEXM_DEMCR_VC_CORERESET;
+	if (sim.halted)
+		sim.dfsr |= CORTEXM_DFSR_VCATCH;
+}
+
+static void swd_sim_power_on(void)
+{
+	memset(&sim, 0, sizeof(sim));
+	memset(sim.flash, 0xff, sizeof(sim.flash));
+	sim.powered = true;
+	swd_sim_core_reset();
+}
+
+/* PIDR4-7 at 0xfd0, PIDR0-3 at 0xfe0 and CIDR0-3 at 0xff0 each hold one byte of their ID */
+static uint32_t swd_sim_id_reg(const uint32_t offset, const uint64_t pidr, const uint32_t cidr)
+{
+	const uint32_t shift = ((offset >> 2U) & 3U) * 8U;
+	if (offset >= 0xff0U)
+		return (cidr >> shift) & 0xffU;
+	if (offset >= 0xfe0U)
+		return (uint32_t)(pidr >> shift) & 0xffU;
+	if (offset >= 0xfd0U)
+		return (uint32_t)(pidr >> (32U + shift)) & 0xffU;
+	return 0;
+}
+
+static uint32_t swd_sim_rom_read(const uint32_t offset)
+{
+	/* A single entry, pointing to the SCS */
+	if (offset == 0U)
+		return ((CORTEXM_SCS_BASE - SWD_SIM_ROM_TABLE) & ADIV5_ROM_ROMENTRY_OFFSET) | 3U;
+	if (offset == ADIV5_ROM_MEMTYPE)
+		return ADIV5_ROM_MEMTYPE_SYSMEM;
+	return swd_sim_id_reg(offset, SWD_SIM_ROM_PIDR, SWD_SIM_ROM_CIDR);
+}
+
+static uint32_t swd_sim_dhcsr_read(void)
+{
+	uint32_t dhcsr = sim.dhcsr;
+	if (sim.halted)
+		dhcsr |= CORTEXM_DHCSR_S_HALT | CORTEXM_DHCSR_S_REGRDY;
+	/* A running core is always retiring instructions */
+	if (sim.retired || !sim.halted)
+		dhcsr |= CORTEXM_DHCSR_S_RETIRE_ST;
+	if (sim.reset_seen)
+		dhcsr |= CORTEXM_DHCSR_S_RESET_ST;
+	/* The sticky status bits clear on being read */
+	sim.retired = false;
+	sim.reset_seen = false;
+	return dhcsr;
+}
+
+static void swd_sim_dhcsr_write(const uint32_t value)
+{
+	if ((value & 0xffff0000U) != CORTEXM_DHCSR_DBGKEY)
+		return;
+	sim.dhcsr = value & 0x2fU;
+	if (!(value & CORTEXM_DHCSR_C_DEBUGEN))
+		sim.halted = false;
+	else if (value & CORTEXM_DHCSR_C_HALT) {
+		if (!sim.halted)
+			sim.dfsr |= CORTEXM_DFSR_HALTED;
+		sim.halted = true;
+	} else if (sim.halted) {
+		sim.retired = true;
+		if (value & CORTEXM_DHCSR_C_STEP) {
+			sim.regs[15] += 2U;
+			sim.dfsr |= CORTEXM_DFSR_HALTED;
+		} else
+			sim.halted = false;
+	}
+}
+
+static uint32_t swd_sim_reg_read(const uint32_t addr)
+{
+	if (addr >= SWD_SIM_ROM_TABLE && addr < SWD_SIM_ROM_TABLE + 0x1000U)
+		return swd_sim_rom_read(addr - SWD_SIM_ROM_TABLE);
+	if (addr >= CORTEXM_SCS_BASE + 0xfd0U && addr < CORTEXM_SCS_BASE + 0x1000U)
+		return swd_sim_id_reg(addr - CORTEXM_SCS_BASE, SWD_SIM_SCS_PIDR, SWD_SIM_SCS_CIDR);
+
+	switch (addr) {
+	case CORTEXM_DHCSR:
+		return swd_sim_dhcsr_read();
+	case CORTEXM_DCRDR:
+		return sim.dcrdr;
+	case CORTEXM_DEMCR:
+		return sim.demcr;
+	case CORTEXM_DFSR:
+		return sim.dfsr;
+	case CORTEXM_CPUID:
+		return SWD_SIM_CPUID;
+	case CORTEXM_AIRCR:
+		return 0xfa050000U;
+	/* No FPU, so the coprocessor access bits never stick, and no caches */
+	case CORTEXM_CPACR:
+	case CORTEXM_CTR:
+		return 0;
+	/* 6 code and 2 literal comparators */
+	case CORTEXM_FPB_CTRL:
+		return (2U << 8U) | (6U << 4U) | sim.fpb_ctrl;
+	/* 4 watchpoint comparators and a cycle counter */
+	case CORTEXM_DWT_CTRL:
+		return (4U << 28U) | (sim.ppb[(addr - CORTEXM_PPB_BASE) >> 2U] & 0x01ffffffU);
+	case SWD_SIM_FLASH_CR:
+		return sim.flash_cr;
+	case SWD_SIM_FLASH_AR:
+		return sim.flash_ar;
+	case SWD_SIM_FLASH_SR:
+		return sim.flash_sr;
+	default:
+		break;
+	}
+	if (addr >= CORTEXM_PPB_BASE && addr < CORTEXM_PPB_BASE + SWD_SIM_PPB_SIZE)
+		return sim.ppb[(addr - CORTEXM_PPB_BASE) >> 2U];
+	/* Everything else is unimplemented and reads as zero */
+	return 0;
+}
+
+static void swd_sim_reg_write(const uint32_t addr, const uint32_t value)
+{
+	switch (addr) {
+	case CORTEXM_DHCSR:
+		swd_sim_dhcsr_write(value);
+		return;
+	case CORTEXM_DCRSR:
+		/* Register transfers complete immediately, but only happen while halted */
+		if (sim.halted) {
+			const uint32_t reg = value & (SWD_SIM_CPU_REGS - 1U);
+			if (value & CORTEXM_DCRSR_REGWnR)
+				sim.regs[reg] = sim.dcrdr;
+			else
+				sim.dcrdr = sim.regs[reg];
+		}
+		return;
+	case CORTEXM_DCRDR:
+		sim.dcrdr = value;
+		return;
+	case CORTEXM_DEMCR:
+		sim.demcr = value;
+		return;
+	case CORTEXM_DFSR:
+		sim.dfsr &= ~value;
+		return;
+	case CORTEXM_AIRCR:
+		if ((value & 0xffff0000U) == CORTEXM_AIRCR_VECTKEY && (value & CORTEXM_AIRCR_SYSRESETREQ))
+			swd_sim_core_reset();
+		return;
+	case CORTEXM_FPB_CTRL:
+		if (value & CORTEXM_FPB_CTRL_KEY)
+			sim.fpb_ctrl = value & CORTEXM_FPB_CTRL_ENABLE;
+		return;
+	case SWD_SIM_FLASH_CR:
+		sim.flash_cr = value & (SWD_SIM_FLASH_CR_PG | SWD_SIM_FLASH_CR_PER);
+		if ((value & (SWD_SIM_FLASH_CR_PER | SWD_SIM_FLASH_CR_STRT)) ==
+			(SWD_SIM_FLASH_CR_PER | SWD_SIM_FLASH_CR_STRT)) {
+			const uint32_t page = (sim.flash_ar - SWD_SIM_FLASH_BASE) & ~(SWD_SIM_FLASH_PAGE - 1U);
+			if (page < SWD_SIM_FLASH_SIZE)
+				memset(sim.flash + page, 0xff, SWD_SIM_FLASH_PAGE);
+			else
+				sim.flash_sr |= SWD_SIM_FLASH_SR_PGERR;
+		}
+		return;
+	case SWD_SIM_FLASH_AR:
+		sim.flash_ar = value;
+		return;
+	case SWD_SIM_FLASH_SR:
+		sim.flash_sr &= ~value;
+		return;
+	default:
+		break;
+	}
+	if (addr >= CORTEXM_PPB_BASE && addr < CORTEXM_PPB_BASE + SWD_SIM_PPB_SIZE)
+		sim.ppb[(addr - CORTEXM_PPB_BASE) >> 2U] = value;
+}
+
+/* Bus reads are always of the whole word, a narrower access using the byte lanes it needs */
+static uint32_t swd_sim_bus_read(const uint32_t addr)
+{
+	if (addr - SWD_SIM_RAM_BASE < SWD_SIM_RAM_SIZE)
+		return swd_sim_read_le32(sim.ram + (addr - SWD_SIM_RAM_BASE));
+	if (addr - SWD_SIM_FLASH_BASE < SWD_SIM_FLASH_SIZE)
+		return swd_sim_read_le32(sim.flash + (addr - SWD_SIM_FLASH_BASE));
+	return swd_sim_reg_read(addr);
+}
+
+/* Registers take narrower writes as word writes of just the lanes written */
+static void swd_sim_bus_write(const uint32_t addr, const uint32_t value, const uint32_t lanes)
+{
+	uint8_t *memory = NULL;
+	bool flash = false;
+	if (addr - SWD_SIM_RAM_BASE < SWD_SIM_RAM_SIZE)
+		memory = sim.ram + (addr - SWD_SIM_RAM_BASE);
+	else if (addr - SWD_SIM_FLASH_BASE < SWD_SIM_FLASH_SIZE) {
+		/* Flash only takes writes while programming is enabled, and can only clear bits */
+		if (!(sim.flash_cr & SWD_SIM_FLASH_CR_PG)) {
+			sim.flash_sr |= SWD_SIM_FLASH_SR_PGERR;
+			return;
+		}
+		memory = sim.flash + (addr - SWD_SIM_FLASH_BASE);
+		flash = true;
+	} else {
+		swd_sim_reg_write(addr, value & lanes);
+		return;
+	}
+
+	for (size_t lane = 0; lane < 4U; ++lane) {
+		if (!(lanes & (0xffU << (lane * 8U))))
+			continue;
+		const uint8_t data = (uint8_t)(value >> (lane * 8U));
+		memory[lane] = flash ? memory[lane] & data : data;
+	}
+}
+
+/* Run a DRW access, which in packed mode moves a whole word's worth of accesses of the CSW size */
+static uint32_t swd_sim_drw_access(const bool read, const uint32_t value)
+{
+	const uint32_t size = MIN(sim.csw & ADIV5_AP_CSW_SIZE_MASK, ADIV5_AP_CSW_SIZE_WORD);
+	const uint32_t addrinc = sim.csw & ADIV5_AP_CSW_ADDRINC_MASK;
+	const uint32_t width = 1U << size;
+	const uint32_t beats = addrinc == ADIV5_AP_CSW_ADDRINC_PACKED ? 4U / width : 1U;
+
+	uint32_t addr = sim.tar;
+	uint32_t result = 0;
+	for (uint32_t beat = 0; beat < beats; ++beat) {
+		const uint32_t lanes = width == 4U ? UINT32_MAX : ((1U << (width * 8U)) - 1U) << ((addr & 3U) * 8U);
+		if (read)
+			result |= swd_sim_bus_read(addr & ~3U) & lanes;
+		else
+			swd_sim_bus_write(addr & ~3U, value, lanes);
+		addr += width;
+	}
+	/* Auto-increment only ever wraps within the 1KiB TAR block */
+	if (addrinc == ADIV5_AP_CSW_ADDRINC_SINGLE || addrinc == ADIV5_AP_CSW_ADDRINC_PACKED)
+		sim.tar = (sim.tar & ~0x3ffU) | ((sim.tar + width * beats) & 0x3ffU);
+	return result;
+}
+
+static uint32_t swd_sim_ap_read(const uint8_t addr)
+{
+	/* Only AP 0 exists, the others read back with an IDR of 0 */
+	if (sim.select >> 24U)
+		return 0;
+	switch (addr) {
+	case ADIV5_AP_CSW & 0xffU:
+		return sim.csw;
+	case ADIV5_AP_TAR & 0xffU:
+		return sim.tar;
+	case ADIV5_AP_DRW & 0xffU:
+		return swd_sim_drw_access(true, 0);
+	case ADIV5_AP_DB(0) & 0xffU:
+	case ADIV5_AP_DB(1) & 0xffU:
+	case ADIV5_AP_DB(2) & 0xffU:
+	case ADIV5_AP_DB(3) & 0xffU:
+		return swd_sim_bus_read((sim.tar & ~0xfU) | (addr & 0xcU));
+	case ADIV5_AP_BASE & 0xffU:
+		return SWD_SIM_ROM_TABLE | 3U;
+	case ADIV5_AP_IDR & 0xffU:
+		return SWD_SIM_AP_IDR;
+	default:
+		return 0;
+	}
+}
+
+static void swd_sim_ap_write(const uint8_t addr, const uint32_t value)
+{
+	if (sim.select >> 24U)
+		return;
+	switch (addr) {
+	case ADIV5_AP_CSW & 0xffU:
+		/* No transfer is ever in progress, and the debug port always has access */
+		sim.csw = (value & ~(ADIV5_AP_CSW_TRINPROG | ADIV5_AP_CSW_DEVICEEN)) | ADIV5_AP_CSW_DEVICEEN;
+		break;
+	case ADIV5_AP_TAR & 0xffU:
+		sim.tar = value;
+		break;
+	case ADIV5_AP_DRW & 0xffU:
+		swd_sim_drw_access(false, value);
+		break;
+	case ADIV5_AP_DB(0) & 0xffU:
+	case ADIV5_AP_DB(1) & 0xffU:
+	case ADIV5_AP_DB(2) & 0xffU:
+	case ADIV5_AP_DB(3) & 0xffU:
+		swd_sim_bus_write((sim.tar & ~0xfU) | (addr & 0xcU), value, UINT32_MAX);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Carry out the decoded request, the data phase of a read being fetched ahead of time */
+static uint32_t swd_sim_access(const uint32_t value)
+{
+	const bool ap = sim.request & 0x02U;
+	const bool read = sim.request & 0x04U;
+	const uint8_t addr = (sim.request >> 1U) & 0x0cU;
+
+	if (ap) {
+		const uint8_t ap_addr = (sim.select & 0xf0U) | addr;
+		if (!read) {
+			swd_sim_ap_write(ap_addr, value);
+			return 0;
+		}
+		/* AP reads are posted: the data returned is that of the previous one, this one's going to RDBUFF */
+		const uint32_t result = sim.rdbuff;
+		sim.rdbuff = swd_sim_ap_read(ap_addr);
+		return result;
+	}
+
+	switch (addr) {
+	case ADIV5_DP_DPIDR:
+		if (read)
+			return SWD_SIM_DPIDR;
+		/* Nothing ever goes sticky, so there's nothing for ABORT to clear */
+		return 0;
+	case ADIV5_DP_CTRLSTAT: {
+		/* Bank 0 only, the rest of the banked registers are left unimplemented */
+		if (sim.select & 0xfU)
+			return 0;
+		if (!read) {
+			sim.ctrlstat = value & SWD_SIM_CTRLSTAT_MASK;
+			return 0;
+		}
+		/* Power up and reset requests are acknowledged at once, each ACK bit sitting just above its REQ bit */
+		const uint32_t requests = sim.ctrlstat &
+			(ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGRSTREQ);
+		return sim.ctrlstat | requests << 1U;
+	}
+	case ADIV5_DP_SELECT:
+		if (read)
+			return sim.read_data;
+		sim.select = value;
+		return 0;
+	case ADIV5_DP_RDBUFF:
+		return read ? sim.rdbuff : 0;
+	default:
+		return 0;
+	}
+}
+
+/* A packet request is a start bit, APnDP, RnW, A[2:3], even parity over those 4, a stop bit and a park bit */
+static bool swd_sim_request_valid(const uint32_t request)
+{
+	if ((request & 0xc1U) != 0x81U)
+		return false;
+	return (__builtin_popcount(request & 0x1eU) & 1U) == ((request >> 5U) & 1U);
+}
+
+/* Account for a change of SWDIO direction, which takes a turnaround cycle */
+static void swd_sim_direction(const bool host_driving)
+{
+	if (sim.host_driving == host_driving)
+		return;
+	sim.host_driving = host_driving;
+	++sim.stats.clocks;
+	if (!host_driving)
+		++sim.stats.round_trips;
+}
+
+static uint32_t swd_sim_seq_in(const size_t clock_cycles)
+{
+	swd_sim_direction(false);
+	sim.stats.clocks += clock_cycles;
+	if (sim.phase != SWD_SIM_ACK || clock_cycles != 3U) {
+		/* Nobody is driving the line, so the pull-up reads as all 1's */
+		sim.phase = SWD_SIM_IDLE;
+		return clock_cycles >= 32U ? UINT32_MAX : (1U << clock_cycles) - 1U;
+	}
+	if (sim.request & 0x04U) {
+		sim.read_data = swd_sim_access(0);
+		sim.phase = SWD_SIM_READ_DATA;
+	} else
+		sim.phase = SWD_SIM_WRITE_DATA;
+	return SWDP_ACK_OK;
+}
+
+static bool swd_sim_seq_in_parity(uint32_t *const ret, const size_t clock_cycles)
+{
+	swd_sim_direction(false);
+	sim.stats.clocks += clock_cycles + 1U;
+	if (sim.phase != SWD_SIM_READ_DATA || clock_cycles != 32U) {
+		sim.phase = SWD_SIM_IDLE;
+		*ret = clock_cycles >= 32U ? UINT32_MAX : (1U << clock_cycles) - 1U;
+		/* Nothing was driving the line, so report the data as bad */
+		return true;
+	}
+	sim.phase = SWD_SIM_IDLE;
+	*ret = sim.read_data;
+	return false;
+}
+
+static void swd_sim_seq_out(const uint32_t tms_states, const size_t clock_cycles)
+{
+	swd_sim_direction(true);
+	sim.stats.clocks += clock_cycles;
+	/* Anything other than a request out of idle, such as idle cycles or a line reset, ends the packet */
+	if (sim.phase == SWD_SIM_IDLE && clock_cycles == 8U && swd_sim_request_valid(tms_states)) {
+		sim.request = (uint8_t)tms_states;
+		sim.phase = SWD_SIM_ACK;
+		++sim.stats.transactions;
+	} else
+		sim.phase = SWD_SIM_IDLE;
+}
+
+static void swd_sim_seq_out_parity(const uint32_t tms_states, const size_t clock_cycles)
+{
+	swd_sim_direction(true);
+	sim.stats.clocks += clock_cycles + 1U;
+	if (sim.phase == SWD_SIM_WRITE_DATA && clock_cycles == 32U)
+		swd_sim_access(tms_states);
+	sim.phase = SWD_SIM_IDLE;
+}
+
+bool swd_sim_select(const char *const device, bmp_info_s *const info)
+{
+	if (strcmp(device, SWD_SIM_DEVICE) != 0)
+		return false;
+	info->bmp_type = BMP_TYPE_SIM;
+	strncpy(info->manufacturer, "Black Magic Debug", sizeof(info->manufacturer) - 1U);
+	strncpy(info->product, swd_sim_driver_str, sizeof(info->product) - 1U);
+	strncpy(info->version, "Simulated Cortex-M4", sizeof(info->version) - 1U);
+	strncpy(info->serial, SWD_SIM_DEVICE, sizeof(info->serial) - 1U);
+	return true;
+}
+
+bool swd_sim_swdptap_init(void)
+{
+	/* The memories and core keep their state over rescans, as a target that stays powered would */
+	if (!sim.powered)
+		swd_sim_power_on();
+	sim.phase = SWD_SIM_IDLE;
+	sim.host_driving = true;
+	sim.ctrlstat = 0;
+	sim.select = 0;
+	sim.rdbuff = 0;
+	sim.csw = ADIV5_AP_CSW_DEVICEEN;
+	sim.tar = 0;
+
+	swd_proc.seq_in = swd_sim_seq_in;
+	swd_proc.seq_in_parity = swd_sim_seq_in_parity;
+	swd_proc.seq_out = swd_sim_seq_out;
+	swd_proc.seq_out_parity = swd_sim_seq_out_parity;
+	return true;
+}
+
+static bool swd_sim_flash_status(target_s *const t)
+{
+	const uint32_t status = target_mem_read32(t, SWD_SIM_FLASH_SR);
+	if (status & SWD_SIM_FLASH_SR_PGERR) {
+		target_mem_write32(t, SWD_SIM_FLASH_SR, SWD_SIM_FLASH_SR_PGERR);
+		return false;
+	}
+	return !target_check_error(t);
+}
+
+static bool swd_sim_flash_erase(target_flash_s *const f, const target_addr_t addr, const size_t len)
+{
+	target_s *const t = f->t;
+	for (size_t offset = 0; offset < len; offset += f->blocksize) {
+		target_mem_write32(t, SWD_SIM_FLASH_AR, addr + offset);
+		target_mem_write32(t, SWD_SIM_FLASH_CR, SWD_SIM_FLASH_CR_PER | SWD_SIM_FLASH_CR_STRT);
+	}
+	target_mem_write32(t, SWD_SIM_FLASH_CR, 0);
+	return swd_sim_flash_status(t);
+}
+
+static bool swd_sim_flash_write(
+	target_flash_s *const f, const target_addr_t dest, const void *const src, const size_t len)
+{
+	target_s *const t = f->t;
+	target_mem_write32(t, SWD_SIM_FLASH_CR, SWD_SIM_FLASH_CR_PG);
+	target_mem_write(t, dest, src, len);
+	target_mem_write32(t, SWD_SIM_FLASH_CR, 0);
+	return swd_sim_flash_status(t);
+}
+
+void swd_sim_targets_setup(void)
+{
+	for (target_s *t = target_list; t; t = t->next) {
+		/* cortexm_probe() finds no driver for the part, so the memory map is ours to give */
+		if (t->ram || t->flash)
+			continue;
+		t->driver = swd_sim_driver_str;
+		target_add_ram(t, SWD_SIM_RAM_BASE, SWD_SIM_RAM_SIZE);
+
+		target_flash_s *const f = calloc(1, sizeof(*f));
+		if (!f) { /* calloc failed: heap exhaustion */
+			DEBUG_WARN("calloc: failed in %s\n", __func__);
+			return;
+		}
+		f->start = SWD_SIM_FLASH_BASE;
+		f->length = SWD_SIM_FLASH_SIZE;
+		f->blocksize = SWD_SIM_FLASH_PAGE;
+		f->erase = swd_sim_flash_erase;
+		f->write = swd_sim_flash_write;
+		f->erased = 0xffU;
+		target_add_flash(t, f);
+	}
+}
+
+void swd_sim_stats_get(swd_sim_stats_s *const stats)
+{
+	*stats = sim.stats;
+}
+
+void swd_sim_stats_reset(void)
+{
+	memset(&sim.stats, 0, sizeof(sim.stats));
+}
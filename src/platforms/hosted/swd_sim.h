@@ -0,0 +1,63 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PLATFORMS_HOSTED_SWD_SIM_H
+#define PLATFORMS_HOSTED_SWD_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bmp_hosted.h"
+
+/* The -d argument that selects the simulator in place of a probe */
+#define SWD_SIM_DEVICE "sim:"
+
+/* Wire level traffic seen by the simulated target since the last reset of the counts */
+typedef struct swd_sim_stats {
+	/* SWCLK cycles, counting the turnaround cycles each change of SWDIO direction takes */
+	uint64_t clocks;
+	/* Packet requests decoded, each being one DP or AP register access */
+	uint32_t transactions;
+	/* Changes of SWDIO direction from host to target, each a point where the host waits on the target */
+	uint32_t round_trips;
+} swd_sim_stats_s;
+
+/* Returns true if the -d argument names the simulator, filling in the probe information if so */
+bool swd_sim_select(const char *device, bmp_info_s *info);
+/* Reset the simulated target and hook it up as the SWD transport */
+bool swd_sim_swdptap_init(void);
+/* Give the targets found on the simulated DP its memory map */
+void swd_sim_targets_setup(void);
+
+void swd_sim_stats_get(swd_sim_stats_s *stats);
+void swd_sim_stats_reset(void);
+
+#endif /* PLATFORMS_HOSTED_SWD_SIM_H */
@@ -0,0 +1,628 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements a decoder for the ITM/DWT packet protocol carried over SWO, as described in
+ * the ARMv7-M Architecture Reference Manual, Appendix D4 "Debug ITM and DWT Packet Protocol".
+ *
+ * Instrumentation (stimulus port) data is written out per channel, one line at a time, and the
+ * hardware source packets from the DWT are decoded: PC samples, data trace and event counter
+ * overflows are counted and listed, while exception trace is matched up against the local
+ * timestamps to build per-exception timing statistics for swo_decode_report().
+ *
+ * When more than one trace source shares the port, the TPIU formatter wraps the byte stream in
+ * 16 byte frames tagged with trace source IDs, as described in the CoreSight TPIU section of the
+ * CoreSight Architecture Specification. With swo_decode_tpiu() set, the frames are unwrapped first,
+ * the ITM's source is fed to the packet decoder and every other source (ETM, for example) is
+ * written out raw to its own file for a dedicated decoder.
+ */
+
+#include "general.h"
+#include "swo_decode.h"
+
+#include <errno.h>
+
+#define SWO_CHANNELS           32U
+#define SWO_LINE_LENGTH        128U
+#define SWO_EXCEPTIONS         512U
+#define SWO_PENDING_EXCEPTIONS 16U
+
+/* Packet header classification */
+#define SWO_HEADER_SYNC      0x00U
+#define SWO_HEADER_OVERFLOW  0x70U
+#define SWO_HEADER_GTS1      0x94U
+#define SWO_HEADER_GTS2      0xb4U
+#define SWO_HEADER_SIZE_MASK 0x03U
+#define SWO_HEADER_HARDWARE  0x04U
+#define SWO_CONTINUATION     0x80U
+
+/* DWT hardware source packet discriminators */
+#define SWO_DWT_EVENT_COUNTER 0U
+#define SWO_DWT_EXCEPTION     1U
+#define SWO_DWT_PC_SAMPLE     2U
+#define SWO_DWT_DATA_FIRST    8U
+#define SWO_DWT_DATA_LAST     23U
+#define SWO_DWT_COMPARATORS   4U
+
+/* Exception trace function codes */
+#define SWO_EXCEPTION_ENTERED  1U
+#define SWO_EXCEPTION_EXITED   2U
+#define SWO_EXCEPTION_RETURNED 3U
+
+/* TPIU formatter framing */
+#define TPIU_FRAME_LENGTH 16U
+#define TPIU_FULL_SYNC    0x7fffffffU
+#define TPIU_ID_NULL      0x00U
+#define TPIU_ID_RESERVED  0x70U
+#define TPIU_SOURCES      128U
+
+typedef enum swo_decode_state {
+	SWO_STATE_HEADER,
+	SWO_STATE_SOURCE,
+	SWO_STATE_TIMESTAMP,
+	SWO_STATE_GLOBAL_TIMESTAMP,
+	SWO_STATE_EXTENSION,
+} swo_decode_state_e;
+
+typedef struct swo_exception_stats {
+	uint32_t count;
+	uint64_t entered_at;
+	bool active;
+	uint64_t total_cycles;
+	uint64_t min_cycles;
+	uint64_t max_cycles;
+	uint32_t timed;
+} swo_exception_stats_s;
+
+/* Exception trace events waiting for the local timestamp that follows them */
+typedef struct swo_exception_event {
+	uint16_t number;
+	uint8_t function;
+} swo_exception_event_s;
+
+/* A data trace PC or address offset packet, held until the data value packet that follows it */
+typedef struct swo_data_trace_match {
+	bool pending;
+	bool is_address;
+	uint32_t value;
+} swo_data_trace_match_s;
+
+typedef struct swo_decoder {
+	swo_decode_state_e state;
+	uint8_t header;
+	uint8_t payload[4];
+	uint8_t payload_length;
+	uint8_t payload_expected;
+	uint32_t zeros;
+	uint32_t value;
+	uint8_t value_shift;
+
+	uint64_t local_time;
+	uint64_t global_time;
+	bool have_timestamps;
+
+	swo_exception_event_s pending[SWO_PENDING_EXCEPTIONS];
+	uint8_t pending_count;
+	swo_exception_stats_s exceptions[SWO_EXCEPTIONS];
+	swo_data_trace_match_s data_match[SWO_DWT_COMPARATORS];
+
+	char line[SWO_CHANNELS][SWO_LINE_LENGTH];
+	uint8_t line_length[SWO_CHANNELS];
+
+	uint32_t syncs;
+	uint32_t overflows;
+	uint32_t pc_samples;
+	uint32_t sleep_samples;
+	uint32_t data_trace;
+	uint32_t counter_overflows;
+	uint32_t reserved;
+} swo_decoder_s;
+
+static swo_decoder_s decoder;
+
+typedef struct swo_tpiu {
+	/* Configuration, kept across swo_decode_init() */
+	bool enabled;
+	uint8_t itm_id;
+	const char *prefix;
+
+	bool synced;
+	uint32_t sync_word;
+	uint8_t frame[TPIU_FRAME_LENGTH];
+	uint8_t frame_length;
+	uint8_t id;
+
+	uint32_t frames;
+	uint32_t syncs;
+	uint32_t unsynced;
+	uint64_t bytes[TPIU_SOURCES];
+	FILE *output[TPIU_SOURCES];
+	bool output_failed[TPIU_SOURCES];
+} swo_tpiu_s;
+
+static swo_tpiu_s tpiu;
+
+static const char *const swo_exception_names[16] = {
+	NULL,
+	"Reset",
+	"NMI",
+	"HardFault",
+	"MemManage",
+	"BusFault",
+	"UsageFault",
+	"SecureFault",
+	NULL,
+	NULL,
+	NULL,
+	"SVCall",
+	"DebugMonitor",
+	NULL,
+	"PendSV",
+	"SysTick",
+};
+
+static void swo_tpiu_close(void)
+{
+	for (size_t id = 0; id < TPIU_SOURCES; ++id) {
+		if (tpiu.output[id])
+			fclose(tpiu.output[id]);
+		tpiu.output[id] = NULL;
+	}
+}
+
+void swo_decode_init(void)
+{
+	memset(&decoder, 0, sizeof(decoder));
+	swo_tpiu_close();
+	const swo_tpiu_s config = {.enabled = tpiu.enabled, .itm_id = tpiu.itm_id, .prefix = tpiu.prefix};
+	tpiu = config;
+}
+
+/*
+ * Expect the capture to be TPIU formatted, decoding the ITM packets from source itm_id and writing
+ * the other sources to files named <prefix><id>
+ */
+void swo_decode_tpiu(const uint8_t itm_id, const char *const prefix)
+{
+	tpiu.enabled = true;
+	tpiu.itm_id = itm_id;
+	tpiu.prefix = prefix;
+}
+
+static void swo_channel_flush(const uint8_t channel)
+{
+	if (!decoder.line_length[channel])
+		return;
+	printf("[ch%02u] %.*s\n", channel, decoder.line_length[channel], decoder.line[channel]);
+	decoder.line_length[channel] = 0;
+}
+
+static void swo_handle_stimulus(const uint8_t channel, const uint8_t *const data, const uint8_t length)
+{
+	for (uint8_t i = 0; i < length; ++i) {
+		const char c = (char)data[i];
+		if (c == '\n' || decoder.line_length[channel] == SWO_LINE_LENGTH) {
+			swo_channel_flush(channel);
+			if (c == '\n')
+				continue;
+		}
+		if (c != '\r')
+			decoder.line[channel][decoder.line_length[channel]++] = c;
+	}
+}
+
+static void swo_exception_update(const swo_exception_event_s *const event)
+{
+	swo_exception_stats_s *const stats = &decoder.exceptions[event->number];
+	if (event->function == SWO_EXCEPTION_ENTERED) {
+		++stats->count;
+		stats->entered_at = decoder.local_time;
+		stats->active = true;
+	} else if (event->function == SWO_EXCEPTION_EXITED && stats->active) {
+		/* Time from entry to exit, including the time spent in any exceptions that preempted this one */
+		stats->active = false;
+		if (!decoder.have_timestamps)
+			return;
+		const uint64_t cycles = decoder.local_time - stats->entered_at;
+		if (!stats->timed || cycles < stats->min_cycles)
+			stats->min_cycles = cycles;
+		if (cycles > stats->max_cycles)
+			stats->max_cycles = cycles;
+		stats->total_cycles += cycles;
+		++stats->timed;
+	}
+}
+
+/* Apply the exception events seen since the last local timestamp, which is the time they were all stamped with */
+static void swo_exception_pending_flush(void)
+{
+	for (uint8_t i = 0; i < decoder.pending_count; ++i)
+		swo_exception_update(&decoder.pending[i]);
+	decoder.pending_count = 0;
+}
+
+static void swo_handle_exception(const uint16_t number, const uint8_t function)
+{
+	if (decoder.pending_count == SWO_PENDING_EXCEPTIONS)
+		swo_exception_pending_flush();
+	decoder.pending[decoder.pending_count++] = (swo_exception_event_s){number, function};
+}
+
+static void swo_data_match_flush(const uint8_t comparator)
+{
+	swo_data_trace_match_s *const match = &decoder.data_match[comparator];
+	if (!match->pending)
+		return;
+	/* An address offset is the low 16 bits of the matched address */
+	if (match->is_address)
+		printf("[dwt%u] address offset 0x%04" PRIx32 "\n", comparator, match->value);
+	else
+		printf("[dwt%u] pc 0x%08" PRIx32 "\n", comparator, match->value);
+	match->pending = false;
+}
+
+/*
+ * Data trace from a DWT comparator arrives as an optional PC or address offset packet followed
+ * by the data value packet for the same access, so they're paired up and printed as one line.
+ */
+static void swo_handle_data_trace(const uint8_t discriminator, const uint32_t value, const uint8_t length)
+{
+	const uint8_t comparator = (discriminator >> 1U) & 3U;
+	swo_data_trace_match_s *const match = &decoder.data_match[comparator];
+	++decoder.data_trace;
+	if (discriminator < 16U) {
+		swo_data_match_flush(comparator);
+		*match = (swo_data_trace_match_s){.pending = true, .is_address = discriminator & 1U, .value = value};
+		return;
+	}
+
+	const char *const access = discriminator & 1U ? "write" : "read";
+	if (!match->pending)
+		printf("[dwt%u] %s 0x%0*" PRIx32 "\n", comparator, access, length * 2, value);
+	else if (match->is_address)
+		printf("[dwt%u] %s 0x%0*" PRIx32 " at offset 0x%04" PRIx32 "\n", comparator, access, length * 2, value,
+			match->value);
+	else
+		printf("[dwt%u] %s 0x%0*" PRIx32 " from pc 0x%08" PRIx32 "\n", comparator, access, length * 2, value,
+			match->value);
+	match->pending = false;
+}
+
+static void swo_handle_hardware(const uint8_t discriminator, const uint8_t *const data, const uint8_t length)
+{
+	uint32_t value = 0;
+	for (uint8_t i = 0; i < length; ++i)
+		value |= (uint32_t)data[i] << (i * 8U);
+
+	switch (discriminator) {
+	case SWO_DWT_EVENT_COUNTER:
+		++decoder.counter_overflows;
+		break;
+	case SWO_DWT_EXCEPTION:
+		swo_handle_exception(value & 0x1ffU, (value >> 12U) & 3U);
+		break;
+	case SWO_DWT_PC_SAMPLE:
+		/* A single byte PC sample means the core was asleep */
+		if (length == 1U)
+			++decoder.sleep_samples;
+		else
+			++decoder.pc_samples;
+		break;
+	default:
+		if (discriminator >= SWO_DWT_DATA_FIRST && discriminator <= SWO_DWT_DATA_LAST)
+			swo_handle_data_trace(discriminator, value, length);
+		else
+			++decoder.reserved;
+		break;
+	}
+}
+
+static void swo_handle_source(void)
+{
+	const uint8_t address = decoder.header >> 3U;
+	if (decoder.header & SWO_HEADER_HARDWARE)
+		swo_handle_hardware(address, decoder.payload, decoder.payload_length);
+	else
+		swo_handle_stimulus(address, decoder.payload, decoder.payload_length);
+}
+
+static void swo_handle_local_timestamp(const uint32_t delta)
+{
+	decoder.local_time += delta;
+	decoder.have_timestamps = true;
+	swo_exception_pending_flush();
+}
+
+static void swo_decode_header(const uint8_t byte)
+{
+	decoder.header = byte;
+	if (byte == SWO_HEADER_SYNC) {
+		++decoder.zeros;
+		return;
+	}
+	/* A synchronisation packet is at least 47 zero bits followed by a one */
+	if (byte == SWO_CONTINUATION && decoder.zeros >= 5U) {
+		++decoder.syncs;
+		decoder.zeros = 0;
+		return;
+	}
+	decoder.zeros = 0;
+
+	if (byte == SWO_HEADER_OVERFLOW)
+		++decoder.overflows;
+	else if (byte & SWO_HEADER_SIZE_MASK) {
+		/* Source packet, the size field gives 1, 2 or 4 payload bytes */
+		const uint8_t size = byte & SWO_HEADER_SIZE_MASK;
+		decoder.payload_expected = size == 3U ? 4U : size;
+		decoder.payload_length = 0;
+		decoder.state = SWO_STATE_SOURCE;
+	} else if ((byte & 0x0fU) == 0U) {
+		if (!(byte & SWO_CONTINUATION))
+			/* Short local timestamp, the value is in the header */
+			swo_handle_local_timestamp((byte >> 4U) & 7U);
+		else if ((byte & 0xc0U) == 0xc0U) {
+			decoder.value = 0;
+			decoder.value_shift = 0;
+			decoder.state = SWO_STATE_TIMESTAMP;
+		} else
+			++decoder.reserved;
+	} else if (byte == SWO_HEADER_GTS1 || byte == SWO_HEADER_GTS2) {
+		decoder.value = 0;
+		decoder.value_shift = 0;
+		decoder.state = SWO_STATE_GLOBAL_TIMESTAMP;
+	} else if ((byte & 0x0bU) == 0x08U) {
+		/* Extension packet, only the continuation bytes need following */
+		if (byte & SWO_CONTINUATION)
+			decoder.state = SWO_STATE_EXTENSION;
+	} else
+		++decoder.reserved;
+}
+
+/* Accumulate one byte of a variable length value, returning true once the last byte is seen */
+static bool swo_decode_continued(const uint8_t byte)
+{
+	if (decoder.value_shift < 32U)
+		decoder.value |= (uint32_t)(byte & 0x7fU) << decoder.value_shift;
+	decoder.value_shift += 7U;
+	return !(byte & SWO_CONTINUATION);
+}
+
+static void swo_decode_itm(const uint8_t *const data, const size_t length)
+{
+	for (size_t i = 0; i < length; ++i) {
+		const uint8_t byte = data[i];
+		switch (decoder.state) {
+		case SWO_STATE_HEADER:
+			swo_decode_header(byte);
+			break;
+		case SWO_STATE_SOURCE:
+			decoder.payload[decoder.payload_length++] = byte;
+			if (decoder.payload_length == decoder.payload_expected) {
+				swo_handle_source();
+				decoder.state = SWO_STATE_HEADER;
+			}
+			break;
+		case SWO_STATE_TIMESTAMP:
+			if (swo_decode_continued(byte)) {
+				swo_handle_local_timestamp(decoder.value);
+				decoder.state = SWO_STATE_HEADER;
+			}
+			break;
+		case SWO_STATE_GLOBAL_TIMESTAMP:
+			if (swo_decode_continued(byte)) {
+				/* GTS1 carries the low bits of the global timestamp, GTS2 the high bits */
+				if (decoder.header == SWO_HEADER_GTS1)
+					decoder.global_time = (decoder.global_time & ~(uint64_t)0x03ffffffU) | (decoder.value & 0x03ffffffU);
+				else
+					decoder.global_time = (decoder.global_time & 0x03ffffffU) | ((uint64_t)decoder.value << 26U);
+				decoder.state = SWO_STATE_HEADER;
+			}
+			break;
+		case SWO_STATE_EXTENSION:
+			if (!(byte & SWO_CONTINUATION))
+				decoder.state = SWO_STATE_HEADER;
+			break;
+		}
+	}
+}
+
+static void swo_tpiu_write(const uint8_t id, const uint8_t byte)
+{
+	if (id == TPIU_ID_NULL || id >= TPIU_ID_RESERVED)
+		return;
+	++tpiu.bytes[id];
+	if (id == tpiu.itm_id) {
+		swo_decode_itm(&byte, 1U);
+		return;
+	}
+	if (!tpiu.output[id] && !tpiu.output_failed[id]) {
+		char name[256];
+		snprintf(name, sizeof(name), "%s%u", tpiu.prefix, id);
+		tpiu.output[id] = fopen(name, "wb");
+		if (!tpiu.output[id]) {
+			DEBUG_WARN("Could not open %s for trace source %u: %s\n", name, id, strerror(errno));
+			tpiu.output_failed[id] = true;
+		}
+	}
+	if (tpiu.output[id])
+		fputc(byte, tpiu.output[id]);
+}
+
+/*
+ * Unpack one formatter frame. The even bytes either carry a new source ID (bit 0 set) or data
+ * whose bit 0 is held in the matching bit of the last byte of the frame, while the odd bytes are
+ * always data. For an ID change, that auxiliary bit instead says whether the new ID applies only
+ * after the data byte that follows it.
+ */
+static void swo_tpiu_frame(void)
+{
+	const uint8_t aux = tpiu.frame[TPIU_FRAME_LENGTH - 1U];
+	++tpiu.frames;
+	for (uint8_t i = 0; i < TPIU_FRAME_LENGTH - 1U; i += 2U) {
+		const uint8_t byte = tpiu.frame[i];
+		const bool aux_bit = (aux >> (i >> 1U)) & 1U;
+		const bool has_next = i + 1U < TPIU_FRAME_LENGTH - 1U;
+		if (byte & 1U) {
+			const uint8_t id = byte >> 1U;
+			if (!aux_bit)
+				tpiu.id = id;
+			if (has_next)
+				swo_tpiu_write(tpiu.id, tpiu.frame[i + 1U]);
+			tpiu.id = id;
+		} else {
+			swo_tpiu_write(tpiu.id, (byte & 0xfeU) | aux_bit);
+			if (has_next)
+				swo_tpiu_write(tpiu.id, tpiu.frame[i + 1U]);
+		}
+	}
+}
+
+/*
+ * Frames are aligned to the full synchronisation packets the TPIU inserts between them, so
+ * nothing is decoded until the first one is seen, and every one seen realigns the frames.
+ */
+static void swo_tpiu_decode(const uint8_t *const data, const size_t length)
+{
+	for (size_t i = 0; i < length; ++i) {
+		const uint8_t byte = data[i];
+		tpiu.sync_word = (tpiu.sync_word >> 8U) | ((uint32_t)byte << 24U);
+		if (tpiu.sync_word == TPIU_FULL_SYNC) {
+			if (!tpiu.synced && tpiu.unsynced >= 3U)
+				tpiu.unsynced -= 3U;
+			++tpiu.syncs;
+			tpiu.synced = true;
+			tpiu.frame_length = 0;
+			/* Stop the sync bytes being matched again as part of the next one */
+			tpiu.sync_word = 0;
+			continue;
+		}
+		if (!tpiu.synced) {
+			++tpiu.unsynced;
+			continue;
+		}
+		tpiu.frame[tpiu.frame_length++] = byte;
+		if (tpiu.frame_length == TPIU_FRAME_LENGTH) {
+			swo_tpiu_frame();
+			tpiu.frame_length = 0;
+		}
+	}
+}
+
+void swo_decode(const uint8_t *const data, const size_t length)
+{
+	if (tpiu.enabled)
+		swo_tpiu_decode(data, length);
+	else
+		swo_decode_itm(data, length);
+}
+
+static void swo_tpiu_report(void)
+{
+	printf("\nTPIU: %" PRIu32 " frames, %" PRIu32 " syncs, %" PRIu32 " bytes before the first sync\n", tpiu.frames,
+		tpiu.syncs, tpiu.unsynced);
+	for (size_t id = 0; id < TPIU_SOURCES; ++id) {
+		if (!tpiu.bytes[id])
+			continue;
+		if (id == tpiu.itm_id)
+			printf("Source %2zu: %10" PRIu64 " bytes, decoded as ITM\n", id, tpiu.bytes[id]);
+		else if (tpiu.output[id])
+			printf("Source %2zu: %10" PRIu64 " bytes, written to %s%zu\n", id, tpiu.bytes[id], tpiu.prefix, id);
+		else
+			printf("Source %2zu: %10" PRIu64 " bytes, discarded\n", id, tpiu.bytes[id]);
+	}
+	swo_tpiu_close();
+}
+
+void swo_decode_report(void)
+{
+	swo_exception_pending_flush();
+	for (uint8_t channel = 0; channel < SWO_CHANNELS; ++channel)
+		swo_channel_flush(channel);
+	for (uint8_t comparator = 0; comparator < SWO_DWT_COMPARATORS; ++comparator)
+		swo_data_match_flush(comparator);
+	if (tpiu.enabled)
+		swo_tpiu_report();
+
+	printf("\nSWO summary: %" PRIu32 " syncs, %" PRIu32 " overflows, %" PRIu32 " reserved packets\n", decoder.syncs,
+		decoder.overflows, decoder.reserved);
+	printf("DWT: %" PRIu32 " PC samples (%" PRIu32 " asleep), %" PRIu32 " data trace, %" PRIu32
+		   " event counter overflows\n",
+		decoder.pc_samples, decoder.sleep_samples, decoder.data_trace, decoder.counter_overflows);
+	if (decoder.global_time)
+		printf("Last global timestamp: %" PRIu64 "\n", decoder.global_time);
+
+	bool header = false;
+	for (uint16_t number = 0; number < SWO_EXCEPTIONS; ++number) {
+		const swo_exception_stats_s *const stats = &decoder.exceptions[number];
+		if (!stats->count)
+			continue;
+		if (!header) {
+			printf("\n%-16s %10s %12s %12s %12s\n", "Exception", "Count", "Min cycles", "Avg cycles", "Max cycles");
+			header = true;
+		}
+		char name[16];
+		if (number >= 16U)
+			snprintf(name, sizeof(name), "IRQ%u", number - 16U);
+		else if (swo_exception_names[number])
+			snprintf(name, sizeof(name), "%s", swo_exception_names[number]);
+		else
+			snprintf(name, sizeof(name), "Exception%u", number);
+		if (stats->timed)
+			printf("%-16s %10" PRIu32 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n", name, stats->count,
+				stats->min_cycles, stats->total_cycles / stats->timed, stats->max_cycles);
+		else
+			printf("%-16s %10" PRIu32 " %12s %12s %12s\n", name, stats->count, "-", "-", "-");
+	}
+	if (header && !decoder.have_timestamps)
+		printf("No local timestamps seen, enable them in ITM_TCR to get exception timings\n");
+}
+
+/* Decode a raw SWO capture from a file or pipe, "-" meaning stdin */
+int swo_decode_file(const char *const name)
+{
+	FILE *const file = strcmp(name, "-") == 0 ? stdin : fopen(name, "rb");
+	if (!file) {
+		DEBUG_WARN("Could not open %s for SWO decoding\n", name);
+		return -1;
+	}
+	swo_decode_init();
+	uint8_t buffer[4096];
+	size_t length;
+	while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		swo_decode(buffer, length);
+		fflush(stdout);
+	}
+	if (file != stdin)
+		fclose(file);
+	swo_decode_report();
+	return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements BMDA's per-target profile cache. At the end of a session the SWJ frequency
+ * in use, whether picked by hand, by "monitor frequency" or settled on by the adaptive mode, is
+ * stored against the probe type, transport and the target's designer code and part ID. The next
+ * scan that finds the same target with the same kind of probe starts out at that frequency rather
+ * than the 4MHz default, unless one was given with -f. The cache is a plain text file, one profile
+ * per line, in $XDG_CACHE_HOME (or ~/.cache, or %LOCALAPPDATA% on Windows).
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "bmp_hosted.h"
+#include "target_profile.h"
+
+#define TARGET_PROFILE_FILE "blackmagic-profiles"
+#define TARGET_PROFILE_MAX  64U
+
+typedef struct target_profile {
+	bmp_type_t probe;
+	bool is_jtag;
+	uint16_t designer_code;
+	uint16_t part_id;
+	uint32_t frequency;
+} target_profile_s;
+
+static const char *const target_profile_probe_names[] = {
+	[BMP_TYPE_NONE] = "none",
+	[BMP_TYPE_BMP] = "bmp",
+	[BMP_TYPE_STLINKV2] = "stlink",
+	[BMP_TYPE_LIBFTDI] = "ftdi",
+	[BMP_TYPE_CMSIS_DAP] = "cmsis-dap",
+	[BMP_TYPE_JLINK] = "jlink",
+};
+
+static target_profile_s target_profiles[TARGET_PROFILE_MAX];
+static size_t target_profile_count;
+/*
+ * The key for this session's target, filled in by a successful scan, and the frequency the probe
+ * last reported, kept up to date here so saving at exit needn't talk to a probe that may be gone
+ */
+static target_profile_s target_profile_current;
+static bool target_profile_valid = false;
+
+static bool target_profile_path(char *const path, const size_t size)
+{
+	const char *base;
+	const char *suffix = "";
+#if defined(_WIN32) || defined(__CYGWIN__)
+	base = getenv("LOCALAPPDATA");
+#else
+	base = getenv("XDG_CACHE_HOME");
+	if (!base || !base[0]) {
+		base = getenv("HOME");
+		suffix = "/.cache";
+	}
+#endif
+	if (!base || !base[0])
+		return false;
+	const int length = snprintf(path, size, "%s%s/" TARGET_PROFILE_FILE, base, suffix);
+	return length > 0 && (size_t)length < size;
+}
+
+static bool target_profile_probe_parse(const char *const name, bmp_type_t *const probe)
+{
+	for (size_t i = 0; i < ARRAY_LENGTH(target_profile_probe_names); ++i) {
+		if (strcmp(name, target_profile_probe_names[i]) == 0) {
+			*probe = (bmp_type_t)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void target_profile_load(void)
+{
+	target_profile_count = 0;
+	char path[4096];
+	if (!target_profile_path(path, sizeof(path)))
+		return;
+	FILE *const file = fopen(path, "r");
+	if (!file)
+		return;
+
+	char line[128];
+	while (target_profile_count < TARGET_PROFILE_MAX && fgets(line, sizeof(line), file)) {
+		char probe[16];
+		char transport[8];
+		unsigned int designer_code;
+		unsigned int part_id;
+		uint32_t frequency;
+		if (line[0] == '#' ||
+			sscanf(line, "%15s %7s %x %x %" SCNu32, probe, transport, &designer_code, &part_id, &frequency) != 5)
+			continue;
+		target_profile_s *const profile = &target_profiles[target_profile_count];
+		if (!target_profile_probe_parse(probe, &profile->probe) || !frequency || frequency == FREQ_FIXED)
+			continue;
+		profile->is_jtag = strcmp(transport, "jtag") == 0;
+		profile->designer_code = designer_code;
+		profile->part_id = part_id;
+		profile->frequency = frequency;
+		++target_profile_count;
+	}
+	fclose(file);
+}
+
+static target_profile_s *target_profile_find(const target_profile_s *const key)
+{
+	for (size_t i = 0; i < target_profile_count; ++i) {
+		target_profile_s *const profile = &target_profiles[i];
+		if (profile->probe == key->probe && profile->is_jtag == key->is_jtag &&
+			profile->designer_code == key->designer_code && profile->part_id == key->part_id)
+			return profile;
+	}
+	return NULL;
+}
+
+void target_profile_apply(const bool frequency_given)
+{
+	target_profile_valid = false;
+	if (!target_list || !target_list->designer_code)
+		return;
+	target_profile_current.probe = info.bmp_type;
+	target_profile_current.is_jtag = info.is_jtag;
+	target_profile_current.designer_code = target_list->designer_code;
+	target_profile_current.part_id = target_list->part_id;
+	target_profile_valid = true;
+
+	/* A frequency given on the command line always wins */
+	if (frequency_given)
+		return;
+	target_profile_load();
+	const target_profile_s *const profile = target_profile_find(&target_profile_current);
+	if (!profile || target_profile_current.frequency == FREQ_FIXED)
+		return;
+	DEBUG_INFO("Using saved profile for %s: %" PRIu32 "Hz\n", target_list->driver, profile->frequency);
+	platform_max_frequency_set(profile->frequency);
+}
+
+void target_profile_frequency_update(const uint32_t frequency)
+{
+	target_profile_current.frequency = frequency;
+}
+
+void target_profile_save(void)
+{
+	if (!target_profile_valid)
+		return;
+	const uint32_t frequency = target_profile_current.frequency;
+	if (!frequency || frequency == FREQ_FIXED)
+		return;
+
+	target_profile_load();
+	target_profile_s *profile = target_profile_find(&target_profile_current);
+	if (profile && profile->frequency == frequency)
+		return;
+	if (!profile) {
+		/* When full, the oldest profile in the file makes way */
+		if (target_profile_count == TARGET_PROFILE_MAX) {
+			memmove(target_profiles, target_profiles + 1U, sizeof(target_profiles) - sizeof(target_profiles[0]));
+			--target_profile_count;
+		}
+		profile = &target_profiles[target_profile_count++];
+		*profile = target_profile_current;
+	}
+	profile->frequency = frequency;
+
+	char path[4096];
+	if (!target_profile_path(path, sizeof(path)))
+		return;
+	FILE *const file = fopen(path, "w");
+	if (!file) {
+		DEBUG_INFO("Could not save target profile to %s\n", path);
+		return;
+	}
+	fputs("# probe transport designer part_id frequency\n", file);
+	for (size_t i = 0; i < target_profile_count; ++i) {
+		profile = &target_profiles[i];
+		fprintf(file, "%s %s 0x%03x 0x%04x %" PRIu32 "\n", target_profile_probe_names[profile->probe],
+			profile->is_jtag ? "jtag" : "swd", profile->designer_code, profile->part_id, profile->frequency);
+	}
+	fclose(file);
+}
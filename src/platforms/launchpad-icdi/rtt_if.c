@@ -115,9 +115,10 @@ bool rtt_nodata()
 	return recv_head == recv_tail;
 }
 
-/* rtt target to host: write string */
-uint32_t rtt_write(const char *buf, uint32_t len)
+/* rtt target to host: write string, all up channels share the one CDC ACM interface */
+uint32_t rtt_write(const uint32_t channel, const char *buf, uint32_t len)
 {
+	(void)channel;
 	if (len != 0 && usbdev && usb_get_config() && gdb_serial_get_dtr()) {
 		for (uint32_t p = 0; p < len; p += CDCACM_PACKET_SIZE) {
 			uint32_t plen = MIN(CDCACM_PACKET_SIZE, len - p);
@@ -38,6 +38,11 @@
 static void adc_init(void);
 static void setup_vbus_irq(void);
 
+/* About how long platform_init() used to busy-wait for the ADC to start up */
+#define ADC_STARTUP_MS 100U
+static uint32_t adc_power_on_ms;
+static bool adc_calibrated = false;
+
 /* This is defined by the linker script */
 extern char vector_table;
 
@@ -277,13 +282,22 @@ static void adc_init(void)
 	adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_239DOT5CYC);
 
 	adc_power_on(ADC1);
+	adc_power_on_ms = platform_time_ms();
+}
 
-	/* Wait for the ADC to finish starting up */
-	for (volatile size_t i = 0; i < 800000U; ++i)
+/*
+ * The ADC has to settle after power on before it is calibrated. Rather than waiting that out in
+ * platform_init(), ahead of USB coming up, it's done just before the first conversion.
+ */
+static void adc_calibrate_once(void)
+{
+	if (adc_calibrated)
+		return;
+	while (platform_time_ms() - adc_power_on_ms < ADC_STARTUP_MS)
 		continue;
-
 	adc_reset_calibration(ADC1);
 	adc_calibrate(ADC1);
+	adc_calibrated = true;
 }
 
 uint32_t platform_target_voltage_sense(void)
@@ -297,6 +311,7 @@ uint32_t platform_target_voltage_sense(void)
 	if (platform_hwversion() == 0)
 		return 0;
 
+	adc_calibrate_once();
 	uint8_t channel = 8;
 	adc_set_regular_sequence(ADC1, 1, &channel);
 
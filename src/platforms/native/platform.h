@@ -29,6 +29,11 @@
 
 #define PLATFORM_HAS_TRACESWO
 #define PLATFORM_HAS_POWER_SWITCH
+#define PLATFORM_HAS_REMOTE_BULK
+#define PLATFORM_HAS_SETTINGS
+
+/* The last 1KiB Flash page, left out of the firmware's region in blackmagic.ld */
+#define PLATFORM_SETTINGS_ADDR 0x0801fc00U
 
 #ifdef ENABLE_DEBUG
 #define PLATFORM_HAS_DEBUG
@@ -37,6 +37,11 @@ uint16_t nrst_pin;
 static uint32_t rev;
 static void adc_init(void);
 
+/* About how long platform_init() used to busy-wait for the ADC to start up */
+#define ADC_STARTUP_MS 100U
+static uint32_t adc_power_on_ms;
+static bool adc_calibrated = false;
+
 int platform_hwversion(void)
 {
 	return rev;
@@ -117,18 +122,28 @@ static void adc_init(void)
 	adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_28DOT5CYC);
 	adc_enable_temperature_sensor();
 	adc_power_on(ADC1);
+	adc_power_on_ms = platform_time_ms();
+}
 
-	/* Wait for the ADC to finish starting up */
-	for (volatile size_t i = 0; i < 800000U; ++i)
+/*
+ * The ADC has to settle after power on before it is calibrated. Rather than waiting that out in
+ * platform_init(), ahead of USB coming up, it's done just before the first conversion.
+ */
+static void adc_calibrate_once(void)
+{
+	if (adc_calibrated)
+		return;
+	while (platform_time_ms() - adc_power_on_ms < ADC_STARTUP_MS)
 		continue;
-
 	adc_reset_calibration(ADC1);
 	adc_calibrate(ADC1);
+	adc_calibrated = true;
 }
 
 const char *platform_target_voltage(void)
 {
 	static char ret[6] = "0.00V";
+	adc_calibrate_once();
 	const uint8_t channel = 0;
 	adc_set_regular_sequence(ADC1, 1, (uint8_t *)&channel);
 	adc_start_conversion_direct(ADC1);
@@ -68,10 +68,15 @@ extern bool debug_bmp;
 
 #ifndef SWIM_AS_UART
 #define PLATFORM_HAS_TRACESWO 1
+/* SWO capture shares this pool with RTT, by default 8K for SWO plus RTT's own buffer, see buffer_pool.h */
+#ifdef ENABLE_RTT
+#define BUFFER_POOL_SIZE (8192U + 1032U)
+#else
+#define BUFFER_POOL_SIZE 8192U
+#endif
 #endif
 
-#define NUM_TRACE_PACKETS 128U /* This is an 8K buffer */
-#define TRACESWO_PROTOCOL 2U   /* 1 = Manchester, 2 = NRZ / async */
+#define TRACESWO_PROTOCOL 2U /* 1 = Manchester, 2 = NRZ / async */
 
 #define SWD_CR      GPIO_CRH(SWDIO_PORT)
 #define SWD_CR_MULT (1U << ((14U - 8U) << 2U))
@@ -152,6 +157,17 @@ extern bool debug_bmp;
 #define SWO_UART_PORT   GPIOA
 #define SWO_UART_RX_PIN GPIO10
 
+/*
+ * USART1 RX is also TIM1_CH3, used to time the SWO bit width for baud rate detection.
+ * TIM1 sits on APB2 and so runs at the full 72 MHz.
+ */
+#define SWO_TIM         TIM1
+#define SWO_TIM_CLK     RCC_TIM1
+#define SWO_TIM_FREQ    rcc_apb2_frequency
+#define SWO_TIM_IC_RISE TIM_IC3
+#define SWO_TIM_IC_FALL TIM_IC4
+#define SWO_TIM_IC_IN   TIM_IC_IN_TI3
+
 /* This DMA channel is set by the USART in use */
 #define SWO_DMA_BUS    DMA1
 #define SWO_DMA_CLK    RCC_DMA1
@@ -231,6 +231,8 @@ void platform_init(void)
 	extern int vector_table;
 	SCB_VTOR = (uintptr_t)&vector_table;
 
+	swd_spi_init();
+
 	platform_timing_init();
 	blackmagic_usb_init();
 	aux_serial_init();
@@ -83,6 +83,16 @@ extern bool debug_bmp;
 #define NUM_TRACE_PACKETS     (16)
 #define TRACESWO_PROTOCOL     2 /* 1 = Manchester, 2 = NRZ / async */
 
+#define GDB_PACKET_BUFFER_SIZE 8192U
+
+/*
+ * SWDIO and SWCLK double as SPI5 MOSI and SCK, which is used to shift out the request and
+ * write data phases when running flat out (no SWD delay)
+ */
+#define PLATFORM_HAS_SWD_SPI 1
+void swd_spi_init(void);
+void swd_spi_seq_out(uint32_t tms_states, size_t clock_cycles);
+
 #define SWDIO_MODE_REG      GPIO_MODER(TMS_PORT)
 #define SWDIO_MODE_REG_MULT (1 << (9 << 1))
 
@@ -178,6 +188,8 @@ extern const struct _usbd_driver stm32f723_usb_driver;
 #define SWO_UART_PORT   GPIOD
 #define SWO_UART_RX_PIN GPIO2
 #define SWO_UART_PIN_AF GPIO_AF8
+/* UART5 is clocked from APB1 */
+#define SWO_UART_FREQ rcc_apb1_frequency
 
 /* This DMA channel is set by the USART in use */
 #define SWO_DMA_BUS    DMA1
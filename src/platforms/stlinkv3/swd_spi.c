@@ -0,0 +1,81 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This file implements the SPI accelerated SWD output sequences for the STLINK-V3.
+ *
+ * SWDIO (PF9) and SWCLK (PH6) are wired to SPI5's MOSI and SCK, so the host driven request
+ * and write data phases can be shifted out by SPI5 in 1-line transmit mode. The pins are only
+ * handed over to the SPI for the duration of a sequence; turnarounds, reads and parity bits
+ * remain bit-banged by swdptap.c.
+ */
+
+#include "general.h"
+#include "timing.h"
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/spi.h>
+
+#define SWD_SPI             SPI5
+#define SWD_SPI_AF          GPIO_AF5
+#define SWCLK_MODE_REG_MULT (1U << (6U << 1U))
+/* FIFO transmission level, the TX FIFO is empty when this reads back 0 */
+#define SWD_SPI_SR_FTLVL_MASK (3U << 11U)
+
+void swd_spi_init(void)
+{
+	rcc_periph_clock_enable(RCC_SPI5);
+	gpio_set_af(SWDIO_PORT, SWD_SPI_AF, SWDIO_PIN);
+	gpio_set_af(SWCLK_PORT, SWD_SPI_AF, SWCLK_PIN);
+
+	/*
+	 * Mode 0, LSB first: SWDIO changes while SWCLK is low and the target samples it on the
+	 * rising edge, just like the bit-banged sequences. APB2 runs at 108MHz, giving 13.5MHz.
+	 */
+	SPI_CR1(SWD_SPI) = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_BIDIMODE | SPI_CR1_BIDIOE |
+		SPI_CR1_LSBFIRST | SPI_CR1_BAUDRATE_FPCLK_DIV_8;
+}
+
+/* Switch SWDIO and SWCLK between their GPIO output and SPI alternate functions */
+static inline void swd_spi_pins(const bool spi)
+{
+	const uint32_t mode = spi ? GPIO_MODE_AF : GPIO_MODE_OUTPUT;
+	SWDIO_MODE_REG = (SWDIO_MODE_REG & ~(3U * SWDIO_MODE_REG_MULT)) | (mode * SWDIO_MODE_REG_MULT);
+	GPIO_MODER(SWCLK_PORT) = (GPIO_MODER(SWCLK_PORT) & ~(3U * SWCLK_MODE_REG_MULT)) | (mode * SWCLK_MODE_REG_MULT);
+}
+
+void swd_spi_seq_out(const uint32_t tms_states, const size_t clock_cycles)
+{
+	const bool word = clock_cycles == 32U;
+	spi_set_data_size(SWD_SPI, word ? SPI_CR2_DS_16BIT : SPI_CR2_DS_8BIT);
+	spi_enable(SWD_SPI);
+	swd_spi_pins(true);
+
+	if (word) {
+		spi_send(SWD_SPI, tms_states & 0xffffU);
+		spi_send(SWD_SPI, tms_states >> 16U);
+	} else
+		spi_send8(SWD_SPI, tms_states & 0xffU);
+	/* Wait for the last bit to leave the shift register before handing the pins back */
+	while (SPI_SR(SWD_SPI) & (SWD_SPI_SR_FTLVL_MASK | SPI_SR_BSY))
+		continue;
+
+	swd_spi_pins(false);
+	spi_disable(SWD_SPI);
+}
@@ -33,19 +33,64 @@
 #define FLASHBLOCKSIZE 1024U
 #endif
 
-static uint32_t last_erased_page = 0xffffffffU;
+/* Typical page erase and half-word program times from the F1 datasheets */
+#define FLASH_PAGE_ERASE_MS     20U
+#define FLASH_HALF_WORD_PROG_US 53U
+
+#define NO_PAGE 0xffffffffU
+
+static uint32_t last_erased_page = NO_PAGE;
+/* Page the host asked us to erase, whose erase is held back until its data arrives */
+static uint32_t pending_erase_page = NO_PAGE;
+
+static void dfu_flush_pending_erase(void)
+{
+	if (pending_erase_page == NO_PAGE)
+		return;
+	flash_erase_page(pending_erase_page);
+	pending_erase_page = NO_PAGE;
+}
 
 void dfu_check_and_do_sector_erase(uint32_t sector)
 {
 	sector &= ~(FLASHBLOCKSIZE - 1U);
 	if (sector != last_erased_page) {
-		flash_erase_page(sector);
+		/*
+		 * Hold the erase back - if the data that follows for this page matches what's already
+		 * in Flash we can skip both erasing and programming it, which is the common case when
+		 * re-flashing a mostly identical firmware image.
+		 */
+		dfu_flush_pending_erase();
+		pending_erase_page = sector;
 		last_erased_page = sector;
 	}
 }
 
+/* Check if the page holding this block already contains exactly the block data followed by erased Flash */
+static bool dfu_page_unchanged(const uint32_t baseaddr, const uint8_t *const buf, const size_t len)
+{
+	if ((baseaddr & (FLASHBLOCKSIZE - 1U)) != 0U || len > FLASHBLOCKSIZE)
+		return false;
+	const uint8_t *const flash = (const uint8_t *)baseaddr;
+	if (memcmp(flash, buf, len) != 0)
+		return false;
+	for (size_t i = len; i < FLASHBLOCKSIZE; ++i) {
+		if (flash[i] != 0xffU)
+			return false;
+	}
+	return true;
+}
+
 void dfu_flash_program_buffer(const uint32_t baseaddr, const void *const buf, const size_t len)
 {
+	if (pending_erase_page == (baseaddr & ~(FLASHBLOCKSIZE - 1U)) &&
+		dfu_page_unchanged(baseaddr, (const uint8_t *)buf, len)) {
+		pending_erase_page = NO_PAGE;
+		dfu_event();
+		return;
+	}
+	dfu_flush_pending_erase();
+
 	const uint16_t *const buffer = (const uint16_t *)buf;
 	for (size_t i = 0; i < len; i += 2U)
 		flash_program_half_word(baseaddr + i, buffer[i >> 1U]);
@@ -56,10 +101,16 @@ void dfu_flash_program_buffer(const uint32_t baseaddr, const void *const buf, co
 
 uint32_t dfu_poll_timeout(uint8_t cmd, uint32_t addr, uint16_t blocknum)
 {
-	(void)cmd;
 	(void)addr;
-	(void)blocknum;
-	return 100;
+	/*
+	 * The Flash work happens synchronously once the status has been sent, and the host's next
+	 * GETSTATUS is NAK'd until it completes, so only ask for the typical time the operation takes
+	 * rather than a fixed worst case. An erase command may flush a previously deferred erase.
+	 */
+	if (blocknum == 0U && cmd == CMD_ERASE)
+		return FLASH_PAGE_ERASE_MS;
+	/* Deferred page erase plus programming a full transfer of half-words */
+	return FLASH_PAGE_ERASE_MS + ((DFU_TRANSFER_SIZE / 2U) * FLASH_HALF_WORD_PROG_US) / 1000U;
 }
 
 void dfu_protect(bool enable)
@@ -29,16 +29,29 @@
 #include "general.h"
 #include "usb_serial.h"
 #include "gdb_if.h"
+#include "probe_stats.h"
+#include "scheduler.h"
+
+/*
+ * Number of OUT packets that can be queued up from the host before the endpoint NAKs.
+ * The USB interrupt fills these while the main loop is busy, for example programming
+ * the Flash for the previous vFlashWrite, so the host can keep streaming the next one.
+ */
+#ifndef GDB_RX_PACKETS
+#define GDB_RX_PACKETS 4U
+#endif
 
-static uint32_t count_out;
 static uint32_t count_in;
-static uint32_t out_ptr;
-static char buffer_out[CDCACM_PACKET_SIZE];
 static char buffer_in[CDCACM_PACKET_SIZE];
-#if defined(STM32F4) || defined(STM32F7)
-static volatile uint32_t count_new;
-static char double_buffer_out[CDCACM_PACKET_SIZE];
-#endif
+
+/* Receive packet ring: filled at rx_head by the USB interrupt, consumed at rx_tail by the main loop */
+static char rx_buffer[GDB_RX_PACKETS][CDCACM_PACKET_SIZE];
+static volatile uint16_t rx_length[GDB_RX_PACKETS];
+static volatile uint8_t rx_head;
+static volatile uint8_t rx_used;
+static volatile bool rx_nak;
+static uint8_t rx_tail;
+static uint32_t out_ptr;
 
 void gdb_if_putchar(const char c, const int flush)
 {
@@ -52,6 +65,7 @@ void gdb_if_putchar(const char c, const int flush)
 		}
 		while (usbd_ep_write_packet(usbdev, CDCACM_GDB_ENDPOINT, buffer_in, count_in) <= 0)
 			continue;
+		PROBE_STATS_COUNT(usb_packets_sent);
 
 		if (flush && count_in == CDCACM_PACKET_SIZE) {
 			/* We need to send an empty packet for some hosts
@@ -68,42 +82,57 @@ void gdb_if_putchar(const char c, const int flush)
 	}
 }
 
-#if defined(STM32F4) || defined(STM32F7)
 void gdb_usb_out_cb(usbd_device *dev, uint8_t ep)
 {
 	(void)ep;
-	usbd_ep_nak_set(dev, CDCACM_GDB_ENDPOINT, 1);
-	count_new = usbd_ep_read_packet(dev, CDCACM_GDB_ENDPOINT, double_buffer_out, CDCACM_PACKET_SIZE);
-	if (!count_new)
-		usbd_ep_nak_set(dev, CDCACM_GDB_ENDPOINT, 0);
+	/* Filling the last free slot, so hold the host off until the main loop releases one */
+	const bool last_slot = rx_used == GDB_RX_PACKETS - 1U;
+	if (last_slot)
+		usbd_ep_nak_set(dev, CDCACM_GDB_ENDPOINT, 1);
+	const uint16_t count = usbd_ep_read_packet(dev, CDCACM_GDB_ENDPOINT, rx_buffer[rx_head], CDCACM_PACKET_SIZE);
+	if (!count) {
+		if (last_slot)
+			usbd_ep_nak_set(dev, CDCACM_GDB_ENDPOINT, 0);
+		return;
+	}
+	PROBE_STATS_COUNT(usb_packets_received);
+	rx_length[rx_head] = count;
+	rx_head = (rx_head + 1U) % GDB_RX_PACKETS;
+	++rx_used;
+	rx_nak = last_slot;
+}
+
+/* Whether the packet at the tail of the ring still has data for us */
+static inline bool gdb_if_rx_available(void)
+{
+	return rx_used && out_ptr < rx_length[rx_tail];
 }
-#endif
 
 static void gdb_if_update_buf(void)
 {
 	while (usb_get_config() != 1)
 		continue;
-#if !defined(STM32F4) && !defined(STM32F7)
-	count_out = usbd_ep_read_packet(usbdev, CDCACM_GDB_ENDPOINT, buffer_out, CDCACM_PACKET_SIZE);
-	out_ptr = 0;
-#else
 	__asm__ volatile("cpsid i; isb");
-	if (count_new) {
-		memcpy(buffer_out, double_buffer_out, count_new);
-		count_out = count_new;
-		count_new = 0;
+	/* Hand the fully consumed packet back to the interrupt, and let the host send again if it was held off */
+	if (rx_used && out_ptr >= rx_length[rx_tail]) {
+		rx_tail = (rx_tail + 1U) % GDB_RX_PACKETS;
+		--rx_used;
 		out_ptr = 0;
-		usbd_ep_nak_set(usbdev, CDCACM_GDB_ENDPOINT, 0);
+		if (rx_nak) {
+			rx_nak = false;
+			usbd_ep_nak_set(usbdev, CDCACM_GDB_ENDPOINT, 0);
+		}
 	}
 	__asm__ volatile("cpsie i; isb");
-#endif
-	if (!count_out)
+	if (!rx_used)
 		__WFI();
 }
 
 char gdb_if_getchar(void)
 {
-	while (out_ptr >= count_out) {
+	while (!gdb_if_rx_available()) {
+		/* Let RTT, the remote protocol interface etc. run while GDB has nothing for us */
+		scheduler_yield();
 		/*
 		 * Detach if port closed
 		 *
@@ -118,7 +147,20 @@ char gdb_if_getchar(void)
 		gdb_if_update_buf();
 	}
 
-	return buffer_out[out_ptr++];
+	return rx_buffer[rx_tail][out_ptr++];
+}
+
+size_t gdb_if_peek(const char **const data)
+{
+	if (!gdb_if_rx_available())
+		return 0;
+	*data = rx_buffer[rx_tail] + out_ptr;
+	return rx_length[rx_tail] - out_ptr;
+}
+
+void gdb_if_consume(const size_t count)
+{
+	out_ptr += count;
 }
 
 char gdb_if_getchar_to(const uint32_t timeout)
@@ -127,7 +169,7 @@ char gdb_if_getchar_to(const uint32_t timeout)
 	platform_timeout_set(&receive_timeout, timeout);
 
 	/* Wait while we need more data or until the timeout expires */
-	while (out_ptr >= count_out && !platform_timeout_is_expired(&receive_timeout)) {
+	while (!gdb_if_rx_available() && !platform_timeout_is_expired(&receive_timeout)) {
 		/*
 		 * Detach if port closed
 		 *
@@ -138,11 +180,12 @@ char gdb_if_getchar_to(const uint32_t timeout)
 			__WFI();
 			return '\x04';
 		}
+		scheduler_yield();
 		gdb_if_update_buf();
 	}
 
-	if (out_ptr < count_out)
-		return buffer_out[out_ptr++];
+	if (gdb_if_rx_available())
+		return rx_buffer[rx_tail][out_ptr++];
 	/* XXX: Need to find a better way to error return than this. This provides '\xff' characters. */
 	return -1;
 }
@@ -0,0 +1,70 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2026 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements the persistent probe settings for STM32F1 based probes, kept as a single
+ * record in a Flash page reserved for them at the top of the probe's Flash by the linker script.
+ */
+
+#include "general.h"
+#include "platform.h"
+
+#include <libopencm3/stm32/flash.h>
+
+#define SETTINGS_MAGIC 0x53504d42U /* "BMPS" */
+
+typedef struct settings_record {
+	uint32_t magic;
+	uint32_t settings;
+	uint32_t check; /* Inverse of settings, so a partly programmed record doesn't read as valid */
+} settings_record_s;
+
+uint32_t platform_settings_get(void)
+{
+	const settings_record_s *const record = (const settings_record_s *)PLATFORM_SETTINGS_ADDR;
+	if (record->magic != SETTINGS_MAGIC || record->check != ~record->settings)
+		return 0U;
+	return record->settings;
+}
+
+bool platform_settings_set(const uint32_t settings)
+{
+	if (settings == platform_settings_get())
+		return true;
+	const uint32_t record[] = {SETTINGS_MAGIC, settings, ~settings};
+	flash_unlock();
+	flash_erase_page(PLATFORM_SETTINGS_ADDR);
+	for (size_t i = 0; i < ARRAY_LENGTH(record); ++i)
+		flash_program_word(PLATFORM_SETTINGS_ADDR + (i * 4U), record[i]);
+	flash_lock();
+	return platform_settings_get() == settings;
+}
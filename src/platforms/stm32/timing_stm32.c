@@ -29,6 +29,103 @@ uint32_t swd_delay_cnt = 0;
 
 static size_t morse_tick = 0;
 
+#if !defined(SWDIO_IN_PORT)
+#define SWDIO_IN_PORT SWDIO_PORT
+#endif
+#if !defined(SWDIO_IN_PIN)
+#define SWDIO_IN_PIN SWDIO_PIN
+#endif
+
+/*
+ * The SWD bit loops in swdptap.c spend some number of cycles per clock on GPIO accesses and loop
+ * overhead, plus two busy-wait loops of swd_delay_cnt - 2 iterations each. How many cycles that is
+ * depends on the compiler output and the Flash wait states, so rather than assume it we measure
+ * it against SysTick on boot. All periods are kept in 1/256ths of an AHB cycle per SWCLK cycle.
+ *
+ * The defaults are the values previously assumed for the STM32F103 at 72 MHz.
+ */
+#define CALIBRATION_SHIFT  8U
+#define CALIBRATION_CLOCKS (1U << CALIBRATION_SHIFT)
+#define CALIBRATION_DELAY  16U
+
+/* Cycles per SWCLK with swd_delay_cnt == 0, which uses the loops that have no delays */
+static uint32_t swd_fast_period = 22U << CALIBRATION_SHIFT;
+/* Cycles per SWCLK with swd_delay_cnt <= 2, which uses the delay loops but does no iterations */
+static uint32_t swd_delay_period = 42U << CALIBRATION_SHIFT;
+/* Additional cycles per SWCLK for each count above 2 */
+static uint32_t swd_delay_step = 10U << CALIBRATION_SHIFT;
+
+static volatile uint32_t calibration_sink;
+
+static void calibrate_no_delay(size_t clock_cycles) __attribute__((optimize(3)));
+static void calibrate_swd_delay(size_t clock_cycles) __attribute__((optimize(3)));
+
+/*
+ * These mirror swdptap_seq_in_no_delay() and swdptap_seq_in_swd_delay(), but write an empty pin mask
+ * so take the same bus cycles without ever moving SWCLK - the pins may be shared with the UART.
+ */
+static void calibrate_no_delay(const size_t clock_cycles)
+{
+	uint32_t value = 0;
+	for (size_t cycle = 0; cycle < clock_cycles; ++cycle) {
+		gpio_clear(SWCLK_PORT, 0U);
+		value |= gpio_get(SWDIO_IN_PORT, SWDIO_IN_PIN) ? 1U << (cycle & 31U) : 0U;
+		gpio_set(SWCLK_PORT, 0U);
+		__asm__("nop");
+	}
+	gpio_clear(SWCLK_PORT, 0U);
+	calibration_sink = value;
+}
+
+static void calibrate_swd_delay(const size_t clock_cycles)
+{
+	uint32_t value = 0;
+	for (size_t cycle = 0; cycle < clock_cycles; ++cycle) {
+		gpio_clear(SWCLK_PORT, 0U);
+		value |= gpio_get(SWDIO_IN_PORT, SWDIO_IN_PIN) ? 1U << (cycle & 31U) : 0U;
+		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
+			continue;
+		gpio_set(SWCLK_PORT, 0U);
+		for (volatile int32_t cnt = swd_delay_cnt - 2; cnt > 0; cnt--)
+			continue;
+	}
+	gpio_clear(SWCLK_PORT, 0U);
+	calibration_sink = value;
+}
+
+/* Returns the AHB cycles taken by CALIBRATION_CLOCKS SWCLK cycles with the given delay count */
+static uint32_t calibrate_swd_period(const uint32_t delay_cnt)
+{
+	swd_delay_cnt = delay_cnt;
+	uint32_t start = 0;
+	/* Run twice so the second pass is timed with the loop already in the Flash cache */
+	for (size_t pass = 0; pass < 2U; ++pass) {
+		start = systick_get_value();
+		if (delay_cnt)
+			calibrate_swd_delay(CALIBRATION_CLOCKS);
+		else
+			calibrate_no_delay(CALIBRATION_CLOCKS);
+	}
+	const uint32_t end = systick_get_value();
+	const uint32_t reload = systick_get_reload() + 1U;
+	/* SysTick counts down at AHB / 8, and each run is much shorter than a SysTick period */
+	return ((start + reload - end) % reload) * 8U;
+}
+
+static void platform_swd_calibrate(void)
+{
+	const uint32_t fast_period = calibrate_swd_period(0U);
+	const uint32_t delay_period = calibrate_swd_period(2U);
+	const uint32_t slow_period = calibrate_swd_period(2U + CALIBRATION_DELAY);
+	swd_delay_cnt = 0;
+	/* If anything looks off, stick with the defaults rather than pick wildly wrong delays */
+	if (!fast_period || delay_period < fast_period || slow_period <= delay_period)
+		return;
+	swd_fast_period = fast_period;
+	swd_delay_period = delay_period;
+	swd_delay_step = (slow_period - delay_period) / CALIBRATION_DELAY;
+}
+
 void platform_timing_init(void)
 {
 	/* Setup heartbeat timer */
@@ -37,8 +134,10 @@ void platform_timing_init(void)
 	systick_set_reload(rcc_ahb_frequency / (8U * SYSTICKHZ));
 	/* SYSTICK_IRQ with low priority */
 	nvic_set_priority(NVIC_SYSTICK_IRQ, 14U << 4U);
-	systick_interrupt_enable();
 	systick_counter_enable();
+	/* Calibrate the SWD delays now that SysTick is counting, but before its interrupt can disturb the timing */
+	platform_swd_calibrate();
+	systick_interrupt_enable();
 }
 
 void platform_delay(uint32_t ms)
@@ -68,31 +167,31 @@ uint32_t platform_time_ms(void)
 }
 
 /*
- * Assume some USED_SWD_CYCLES per clock and CYCLES_PER_CNT cycles
- * per delay loop count with 2 delay loops per clock
+ * Pick the smallest delay count whose calibrated SWCLK period is no shorter than the one requested,
+ * so the frequency used is the fastest available that does not exceed the request.
  */
-
-/* Values for STM32F103 at 72 MHz */
-#define USED_SWD_CYCLES 22
-#define CYCLES_PER_CNT  10
-
-void platform_max_frequency_set(uint32_t freq)
+void platform_max_frequency_set(const uint32_t freq)
 {
-	uint32_t divisor = rcc_ahb_frequency - USED_SWD_CYCLES * freq;
-	/* If we now have an insanely big divisor, the above operation wrapped to a negative signed number. */
-	if (divisor >= 0x80000000U) {
-		swd_delay_cnt = 0;
+	if (!freq)
 		return;
+	/* Requested period, rounded up, in the same fixed point as the calibration */
+	const uint64_t period = (((uint64_t)rcc_ahb_frequency << CALIBRATION_SHIFT) + freq - 1U) / freq;
+	if (period <= swd_fast_period)
+		swd_delay_cnt = 0;
+	else if (period <= swd_delay_period)
+		swd_delay_cnt = 1;
+	else {
+		const uint64_t extra = period - swd_delay_period;
+		swd_delay_cnt = 2U + (uint32_t)((extra + swd_delay_step - 1U) / swd_delay_step);
 	}
-	divisor /= 2U;
-	swd_delay_cnt = divisor / (CYCLES_PER_CNT * freq);
-	if (swd_delay_cnt * (CYCLES_PER_CNT * freq) < divisor)
-		++swd_delay_cnt;
 }
 
 uint32_t platform_max_frequency_get(void)
 {
-	uint32_t ret = rcc_ahb_frequency;
-	ret /= USED_SWD_CYCLES + CYCLES_PER_CNT * swd_delay_cnt;
-	return ret;
+	uint64_t period = swd_fast_period;
+	if (swd_delay_cnt > 2U)
+		period = swd_delay_period + (uint64_t)swd_delay_step * (swd_delay_cnt - 2U);
+	else if (swd_delay_cnt)
+		period = swd_delay_period;
+	return (uint32_t)(((uint64_t)rcc_ahb_frequency << CALIBRATION_SHIFT) / period);
 }
@@ -39,11 +39,24 @@
 #include <libopencm3/stm32/timer.h>
 #include <libopencm3/stm32/rcc.h>
 
+#ifndef NUM_TRACE_PACKETS
+#define NUM_TRACE_PACKETS 16U
+#endif
+
 /* SWO decoding */
 static bool decoding = false;
 
-static uint8_t trace_usb_buf[64];
-static uint8_t trace_usb_buf_size;
+/*
+ * Captured trace is packed straight into a ring of USB packets, which the trace endpoint is fed
+ * from directly. A packet is handed over once full, or as soon as the endpoint goes idle so a
+ * slow trickle of trace doesn't sit in the ring.
+ */
+static uint8_t trace_rx_buf[NUM_TRACE_PACKETS][TRACE_ENDPOINT_SIZE];
+static uint16_t trace_rx_length[NUM_TRACE_PACKETS];
+static volatile uint32_t write_index; /* Packet currently being filled from the capture */
+static volatile uint32_t read_index;  /* Packet currently waiting to transmit to USB */
+static uint16_t write_offset;
+static volatile bool trace_usb_busy;
 
 void traceswo_init(uint32_t swo_chan_bitmask)
 {
@@ -80,36 +93,59 @@ void traceswo_init(uint32_t swo_chan_bitmask)
 
 	timer_enable_counter(TRACE_TIM);
 
+	write_index = read_index = 0;
+	write_offset = 0;
+	trace_usb_busy = false;
 	traceswo_setmask(swo_chan_bitmask);
 	decoding = (swo_chan_bitmask != 0);
 }
 
-void trace_buf_push(uint8_t *buf, int len)
+/* Called on each IN completion on the trace endpoint, sends the next packet straight out of the ring */
+void trace_buf_drain(usbd_device *dev, uint8_t ep)
 {
-	if (decoding)
-		traceswo_decode(usbdev, CDCACM_UART_ENDPOINT, buf, len);
-	else if (usbd_ep_write_packet(usbdev, USB_REQ_TYPE_IN | TRACE_ENDPOINT, buf, len) != len) {
-		if (trace_usb_buf_size + len > 64) {
-			/* Stall if upstream to too slow. */
-			usbd_ep_stall_set(usbdev, USB_REQ_TYPE_IN | TRACE_ENDPOINT, 1);
-			trace_usb_buf_size = 0;
-			return;
-		}
-		memcpy(trace_usb_buf + trace_usb_buf_size, buf, len);
-		trace_usb_buf_size += len;
+	if (read_index == write_index) {
+		trace_usb_busy = false;
+		return;
 	}
+	if (usbd_ep_write_packet(dev, ep, trace_rx_buf[read_index], trace_rx_length[read_index]))
+		read_index = (read_index + 1U) % NUM_TRACE_PACKETS;
+	else
+		trace_usb_busy = false;
 }
 
-void trace_buf_drain(usbd_device *dev, uint8_t ep)
+/* Hand the packet being filled over to the USB side, kicking the endpoint if it has gone idle */
+static void trace_buf_commit(void)
 {
-	if (!trace_usb_buf_size)
-		return;
+	const uint32_t next_index = (write_index + 1U) % NUM_TRACE_PACKETS;
+	/* Drop the packet if upstream is too slow to have freed up the ring */
+	if (next_index != read_index) {
+		trace_rx_length[write_index] = write_offset;
+		write_index = next_index;
+	}
+	write_offset = 0;
+	if (!trace_usb_busy) {
+		trace_usb_busy = true;
+		trace_buf_drain(usbdev, USB_REQ_TYPE_IN | TRACE_ENDPOINT);
+	}
+}
 
-	if (decoding)
-		traceswo_decode(dev, CDCACM_UART_ENDPOINT, trace_usb_buf, trace_usb_buf_size);
-	else
-		usbd_ep_write_packet(dev, ep, trace_usb_buf, trace_usb_buf_size);
-	trace_usb_buf_size = 0;
+static void trace_buf_push(const uint8_t *buf, size_t len)
+{
+	if (decoding) {
+		traceswo_decode(usbdev, CDCACM_UART_ENDPOINT, buf, len);
+		return;
+	}
+	while (len) {
+		size_t chunk = TRACE_ENDPOINT_SIZE - write_offset;
+		if (chunk > len)
+			chunk = len;
+		memcpy(&trace_rx_buf[write_index][write_offset], buf, chunk);
+		write_offset += chunk;
+		buf += chunk;
+		len -= chunk;
+		if (write_offset == TRACE_ENDPOINT_SIZE || !trace_usb_busy)
+			trace_buf_commit();
+	}
 }
 
 #define ALLOWED_DUTY_ERROR 5
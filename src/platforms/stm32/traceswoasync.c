@@ -32,6 +32,9 @@
 #include "general.h"
 #include "usb.h"
 #include "traceswo.h"
+#if defined(BUFFER_POOL_SIZE)
+#include "buffer_pool.h"
+#endif
 
 #include <libopencmsis/core_cm3.h>
 #include <libopencm3/cm3/nvic.h>
@@ -43,12 +46,26 @@
 static volatile uint32_t write_index; /* Packet currently received via UART */
 static volatile uint32_t read_index;  /* Packet currently waiting to transmit to USB */
 /* Packets arrived from the SWO interface */
+#if defined(BUFFER_POOL_SIZE)
+static uint8_t *trace_rx_buf;
+static uint32_t trace_rx_packets;
+#else
 static uint8_t trace_rx_buf[NUM_TRACE_PACKETS * TRACE_ENDPOINT_SIZE];
+static const uint32_t trace_rx_packets = NUM_TRACE_PACKETS;
+#endif
 /* Packet pingpong buffer used for receiving packets */
 static uint8_t pingpong_buf[2 * TRACE_ENDPOINT_SIZE];
 /* SWO decoding */
 static bool decoding = false;
 
+/* Number of low pulses timed, and how long to wait for them, when detecting the baud rate */
+#define SWO_AUTOBAUD_SAMPLES 128U
+#define SWO_AUTOBAUD_TIMEOUT 250U
+
+#define SWO_TIM_CCR(ic)     MMIO32((SWO_TIM) + 0x34U + ((ic) * 4U))
+#define SWO_TIM_SR_CCIF(ic) (TIM_SR_CC1IF << (ic))
+#define SWO_TIM_SR_CCOF(ic) (TIM_SR_CC1OF << (ic))
+
 void trace_buf_drain(usbd_device *dev, uint8_t ep)
 {
 	static atomic_flag reentry_flag = ATOMIC_FLAG_INIT;
@@ -68,7 +85,7 @@ void trace_buf_drain(usbd_device *dev, uint8_t ep)
 			result =
 				usbd_ep_write_packet(dev, ep, &trace_rx_buf[read_index * TRACE_ENDPOINT_SIZE], TRACE_ENDPOINT_SIZE);
 		if (result)
-			read_index = (read_index + 1U) % NUM_TRACE_PACKETS;
+			read_index = (read_index + 1U) % trace_rx_packets;
 	}
 	atomic_flag_clear_explicit(&reentry_flag, memory_order_relaxed);
 }
@@ -105,6 +122,93 @@ void traceswo_setspeed(uint32_t baudrate)
 	usart_enable_rx_dma(SWO_UART);
 }
 
+static void traceswo_setup_pin(void)
+{
+	gpio_set_mode(SWO_UART_PORT, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL_UPDOWN, SWO_UART_RX_PIN);
+	/* Pull SWO pin high to keep open SWO line ind uart idle state! */
+	gpio_set(SWO_UART_PORT, SWO_UART_RX_PIN);
+}
+
+/* Time the next low pulse on the SWO pin, returns 0 if the capture was unusable */
+static uint16_t traceswo_time_low_pulse(const platform_timeout_s *const timeout)
+{
+	/* Reading the capture registers clears their flags, so we start from a clean slate */
+	(void)SWO_TIM_CCR(SWO_TIM_IC_FALL);
+	(void)SWO_TIM_CCR(SWO_TIM_IC_RISE);
+	TIM_SR(SWO_TIM) &= ~(SWO_TIM_SR_CCOF(SWO_TIM_IC_FALL) | SWO_TIM_SR_CCOF(SWO_TIM_IC_RISE));
+	while (!(TIM_SR(SWO_TIM) & SWO_TIM_SR_CCIF(SWO_TIM_IC_FALL))) {
+		if (platform_timeout_is_expired(timeout))
+			return 0;
+	}
+	while (!(TIM_SR(SWO_TIM) & SWO_TIM_SR_CCIF(SWO_TIM_IC_RISE))) {
+		if (platform_timeout_is_expired(timeout))
+			return 0;
+	}
+	const uint32_t status = TIM_SR(SWO_TIM);
+	const uint16_t fall = SWO_TIM_CCR(SWO_TIM_IC_FALL);
+	const uint16_t rise = SWO_TIM_CCR(SWO_TIM_IC_RISE);
+	/* More edges went by than the two we wanted, so these are not the ends of one pulse */
+	if (status & (SWO_TIM_SR_CCOF(SWO_TIM_IC_FALL) | SWO_TIM_SR_CCOF(SWO_TIM_IC_RISE)))
+		return 0;
+	/*
+	 * If the rising edge came first this wraps to a long pulse, which the shortest pulse
+	 * search discards.
+	 */
+	return rise - fall;
+}
+
+/*
+ * Detect the baud rate by timing low pulses on the SWO pin with the timer that shares it.
+ * The shortest low pulse in busy trace traffic is one bit long (a start bit followed by a 1
+ * at the least, which most ITM headers are); averaging all the one bit pulses then gets us
+ * below a timer tick of resolution.
+ */
+uint32_t traceswo_detect_baudrate(void)
+{
+	traceswo_setup_pin();
+	rcc_periph_clock_enable(SWO_TIM_CLK);
+	timer_disable_counter(SWO_TIM);
+	timer_set_prescaler(SWO_TIM, 0);
+	timer_set_period(SWO_TIM, UINT16_MAX);
+	timer_ic_set_input(SWO_TIM, SWO_TIM_IC_RISE, SWO_TIM_IC_IN);
+	timer_ic_set_input(SWO_TIM, SWO_TIM_IC_FALL, SWO_TIM_IC_IN);
+	timer_ic_set_polarity(SWO_TIM, SWO_TIM_IC_RISE, TIM_IC_RISING);
+	timer_ic_set_polarity(SWO_TIM, SWO_TIM_IC_FALL, TIM_IC_FALLING);
+	timer_ic_enable(SWO_TIM, SWO_TIM_IC_RISE);
+	timer_ic_enable(SWO_TIM, SWO_TIM_IC_FALL);
+	timer_enable_counter(SWO_TIM);
+
+	uint16_t widths[SWO_AUTOBAUD_SAMPLES];
+	size_t samples = 0;
+	uint16_t shortest = UINT16_MAX;
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, SWO_AUTOBAUD_TIMEOUT);
+	while (samples < SWO_AUTOBAUD_SAMPLES && !platform_timeout_is_expired(&timeout)) {
+		const uint16_t width = traceswo_time_low_pulse(&timeout);
+		if (!width)
+			continue;
+		widths[samples++] = width;
+		if (width < shortest)
+			shortest = width;
+	}
+
+	timer_disable_counter(SWO_TIM);
+	timer_ic_disable(SWO_TIM, SWO_TIM_IC_RISE);
+	timer_ic_disable(SWO_TIM, SWO_TIM_IC_FALL);
+	if (samples < SWO_AUTOBAUD_SAMPLES / 4U)
+		return 0;
+
+	uint32_t total = 0;
+	uint32_t count = 0;
+	for (size_t i = 0; i < samples; ++i) {
+		if (widths[i] < shortest + (shortest / 2U)) {
+			total += widths[i];
+			++count;
+		}
+	}
+	return (uint32_t)((((uint64_t)SWO_TIM_FREQ * count) + (total / 2U)) / total);
+}
+
 void SWO_DMA_ISR(void)
 {
 	if (DMA_ISR(SWO_DMA_BUS) & DMA_ISR_HTIF(SWO_DMA_CHAN)) {
@@ -116,7 +220,7 @@ void SWO_DMA_ISR(void)
 		memcpy(
 			&trace_rx_buf[write_index * TRACE_ENDPOINT_SIZE], &pingpong_buf[TRACE_ENDPOINT_SIZE], TRACE_ENDPOINT_SIZE);
 	}
-	write_index = (write_index + 1U) % NUM_TRACE_PACKETS;
+	write_index = (write_index + 1U) % trace_rx_packets;
 	trace_buf_drain(usbdev, TRACE_ENDPOINT | USB_REQ_TYPE_IN);
 }
 
@@ -128,9 +232,14 @@ void traceswo_init(uint32_t baudrate, uint32_t swo_chan_bitmask)
 	rcc_periph_clock_enable(SWO_UART_CLK);
 	rcc_periph_clock_enable(SWO_DMA_CLK);
 
-	gpio_set_mode(SWO_UART_PORT, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL_UPDOWN, SWO_UART_RX_PIN);
-	/* Pull SWO pin high to keep open SWO line ind uart idle state! */
-	gpio_set(SWO_UART_PORT, SWO_UART_RX_PIN);
+#if defined(BUFFER_POOL_SIZE)
+	/* Stop capturing into the old buffer before switching to the pool's current SWO share */
+	nvic_disable_irq(SWO_DMA_IRQ);
+	size_t buf_size;
+	trace_rx_buf = buffer_pool_traceswo(&buf_size);
+	trace_rx_packets = buf_size / TRACE_ENDPOINT_SIZE;
+#endif
+	traceswo_setup_pin();
 	nvic_set_priority(SWO_DMA_IRQ, IRQ_PRI_SWO_DMA);
 	nvic_enable_irq(SWO_DMA_IRQ);
 	traceswo_setspeed(baudrate);
@@ -50,6 +50,10 @@ static uint8_t pingpong_buf[2 * TRACE_ENDPOINT_SIZE];
 /* SWO decoding */
 static bool decoding = false;
 
+/* Number of characters measured, and how long to wait for them, when detecting the baud rate */
+#define SWO_AUTOBAUD_TRIES   16U
+#define SWO_AUTOBAUD_TIMEOUT 250U
+
 void trace_buf_drain(usbd_device *dev, uint8_t ep)
 {
 	static atomic_flag reentry_flag = ATOMIC_FLAG_INIT;
@@ -74,11 +78,38 @@ void trace_buf_drain(usbd_device *dev, uint8_t ep)
 	atomic_flag_clear_explicit(&reentry_flag, memory_order_relaxed);
 }
 
+static void traceswo_set_baudrate(const uint32_t baudrate)
+{
+	/*
+	 * Past what 16x oversampling can reach switch to 8x, doubling the maximum rate at the cost
+	 * of some tolerance to clock mismatch. In this mode BRR[3] must be 0 and BRR[2:0] hold the
+	 * low 4 bits of the divider shifted right by one.
+	 */
+	if (baudrate > SWO_UART_FREQ / 16U) {
+		const uint32_t divider = ((SWO_UART_FREQ * 2U) + (baudrate / 2U)) / baudrate;
+		USART_CR1(SWO_UART) |= USART_CR1_OVER8;
+		USART_BRR(SWO_UART) = (divider & ~0xfU) | ((divider & 0xfU) >> 1U);
+	} else {
+		USART_CR1(SWO_UART) &= ~USART_CR1_OVER8;
+		usart_set_baudrate(SWO_UART, baudrate);
+	}
+}
+
+static uint32_t traceswo_get_baudrate(void)
+{
+	const uint32_t brr = USART_BRR(SWO_UART);
+	if (USART_CR1(SWO_UART) & USART_CR1_OVER8) {
+		const uint32_t divider = (brr & ~0xfU) | ((brr & 0x7U) << 1U);
+		return divider ? (SWO_UART_FREQ * 2U) / divider : 0;
+	}
+	return brr ? SWO_UART_FREQ / brr : 0;
+}
+
 void traceswo_setspeed(uint32_t baudrate)
 {
 	dma_disable_stream(SWO_DMA_BUS, SWO_DMA_STREAM);
 	usart_disable(SWO_UART);
-	usart_set_baudrate(SWO_UART, baudrate);
+	traceswo_set_baudrate(baudrate);
 	usart_set_databits(SWO_UART, 8);
 	usart_set_stopbits(SWO_UART, USART_STOPBITS_1);
 	usart_set_mode(SWO_UART, USART_MODE_RX);
@@ -107,6 +138,64 @@ void traceswo_setspeed(uint32_t baudrate)
 	usart_enable_rx_dma(SWO_UART);
 }
 
+static void traceswo_setup_pin(void)
+{
+	rcc_periph_clock_enable(SWO_UART_CLK);
+	rcc_periph_clock_enable(SWO_DMA_CLK);
+
+	rcc_periph_clock_enable(RCC_GPIOD);
+	gpio_mode_setup(SWO_UART_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE, SWO_UART_RX_PIN);
+	gpio_set_af(SWO_UART_PORT, SWO_UART_PIN_AF, SWO_UART_RX_PIN);
+	/* Pull SWO pin high to keep open SWO line ind uart idle state!*/
+	gpio_set(SWO_UART_PORT, SWO_UART_RX_PIN);
+}
+
+/*
+ * Detect the baud rate using the UART's own auto baud rate hardware, which times the start
+ * bit of a character. That is only the length of one bit when the character's LSB is 1, as
+ * it is for most ITM headers, otherwise the measurement comes out too slow - so we measure
+ * several characters and keep the fastest rate seen.
+ */
+uint32_t traceswo_detect_baudrate(void)
+{
+	traceswo_setup_pin();
+	dma_disable_stream(SWO_DMA_BUS, SWO_DMA_STREAM);
+	usart_disable(SWO_UART);
+	usart_disable_rx_dma(SWO_UART);
+	/* Measure with 8x oversampling so the fastest rates the UART can receive are detectable */
+	traceswo_set_baudrate(SWO_UART_FREQ / 8U);
+	usart_set_databits(SWO_UART, 8);
+	usart_set_stopbits(SWO_UART, USART_STOPBITS_1);
+	usart_set_mode(SWO_UART, USART_MODE_RX);
+	usart_set_parity(SWO_UART, USART_PARITY_NONE);
+	usart_set_flow_control(SWO_UART, USART_FLOWCONTROL_NONE);
+	USART_CR2(SWO_UART) = (USART_CR2(SWO_UART) & ~USART_CR2_ABRMOD_MASK) | USART_CR2_ABREN;
+	usart_enable(SWO_UART);
+
+	uint32_t baudrate = 0;
+	size_t tries = 0;
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, SWO_AUTOBAUD_TIMEOUT);
+	while (tries < SWO_AUTOBAUD_TRIES && !platform_timeout_is_expired(&timeout)) {
+		const uint32_t status = USART_ISR(SWO_UART);
+		if (!(status & USART_ISR_ABRF))
+			continue;
+		if (!(status & USART_ISR_ABRE)) {
+			const uint32_t measured = traceswo_get_baudrate();
+			if (measured > baudrate)
+				baudrate = measured;
+			++tries;
+		}
+		/* Drop the character the measurement was made on and re-arm for the next one */
+		USART_ICR(SWO_UART) = USART_ICR_ORECF | USART_ICR_FECF;
+		USART_RQR(SWO_UART) = USART_RQR_RXFRQ | USART_RQR_ABRRQ;
+	}
+
+	usart_disable(SWO_UART);
+	USART_CR2(SWO_UART) &= ~USART_CR2_ABREN;
+	return baudrate;
+}
+
 void SWO_DMA_ISR(void)
 {
 	if (DMA_LISR(SWO_DMA_BUS) & DMA_LISR_HTIF0) {
@@ -127,14 +216,7 @@ void traceswo_init(uint32_t baudrate, uint32_t swo_chan_bitmask)
 	if (!baudrate)
 		baudrate = SWO_DEFAULT_BAUD;
 
-	rcc_periph_clock_enable(SWO_UART_CLK);
-	rcc_periph_clock_enable(SWO_DMA_CLK);
-
-	rcc_periph_clock_enable(RCC_GPIOD);
-	gpio_mode_setup(SWO_UART_PORT, GPIO_MODE_AF, GPIO_PUPD_NONE, SWO_UART_RX_PIN);
-	gpio_set_af(SWO_UART_PORT, SWO_UART_PIN_AF, SWO_UART_RX_PIN);
-	/* Pull SWO pin high to keep open SWO line ind uart idle state!*/
-	gpio_set(SWO_UART_PORT, SWO_UART_RX_PIN);
+	traceswo_setup_pin();
 	nvic_set_priority(SWO_DMA_IRQ, IRQ_PRI_SWO_DMA);
 	nvic_enable_irq(SWO_DMA_IRQ);
 	traceswo_setspeed(baudrate);
@@ -26,6 +26,10 @@
 /* Commands sent with wBlockNum == 0 as per ST implementation. */
 #define CMD_SETADDR 0x21U
 #define CMD_ERASE   0x41U
+
+/* Size of a single DFU_DNLOAD/DFU_UPLOAD block */
+#define DFU_TRANSFER_SIZE 1024U
+
 extern uintptr_t app_address;
 
 /* dfucore.c - DFU core, common to libopencm3 platforms. */
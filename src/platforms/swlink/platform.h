@@ -57,8 +57,14 @@ extern bool debug_bmp;
 #define LED_UART      GPIO14
 
 #define PLATFORM_HAS_TRACESWO 1
-#define NUM_TRACE_PACKETS     128U /* This is an 8K buffer */
-#define TRACESWO_PROTOCOL     2U   /* 1 = Manchester, 2 = NRZ / async */
+#define TRACESWO_PROTOCOL     2U /* 1 = Manchester, 2 = NRZ / async */
+
+/* SWO capture shares this pool with RTT, by default 8K for SWO plus RTT's own buffer, see buffer_pool.h */
+#ifdef ENABLE_RTT
+#define BUFFER_POOL_SIZE (8192U + 1032U)
+#else
+#define BUFFER_POOL_SIZE 8192U
+#endif
 
 #define SWD_CR      GPIO_CRH(SWDIO_PORT)
 #define SWD_CR_MULT (1U << ((13U - 8U) << 2U))
@@ -139,6 +145,17 @@ extern bool debug_bmp;
 #define SWO_UART_PORT   GPIOA
 #define SWO_UART_RX_PIN GPIO3
 
+/*
+ * USART2 RX is also TIM2_CH4 (unaffected by the partial remap), used to time the SWO bit
+ * width for baud rate detection. APB1 is prescaled, so its timers run at twice its clock.
+ */
+#define SWO_TIM         TIM2
+#define SWO_TIM_CLK     RCC_TIM2
+#define SWO_TIM_FREQ    (rcc_apb1_frequency * 2U)
+#define SWO_TIM_IC_RISE TIM_IC4
+#define SWO_TIM_IC_FALL TIM_IC3
+#define SWO_TIM_IC_IN   TIM_IC_IN_TI4
+
 /* This DMA channel is set by the USART in use */
 #define SWO_DMA_BUS    DMA1
 #define SWO_DMA_CLK    RCC_DMA1
@@ -26,6 +26,7 @@
 #include "general.h"
 #include "gdb_if.h"
 #include "usb_serial.h"
+#include "scheduler.h"
 
 #include <libopencm3/usb/usbd.h>
 
@@ -71,6 +72,7 @@ char gdb_if_getchar(void)
 		if (!gdb_serial_get_dtr())
 			return '\x04';
 
+		scheduler_yield();
 		while (usb_get_config() != 1)
 			continue;
 	}
@@ -78,6 +80,19 @@ char gdb_if_getchar(void)
 	return buffer_out[tail_out++ % sizeof(buffer_out)];
 }
 
+size_t gdb_if_peek(const char **const data)
+{
+	/* Only hand out up to the point the ring wraps */
+	const uint32_t offset = tail_out % sizeof(buffer_out);
+	*data = (const char *)buffer_out + offset;
+	return MIN(head_out - tail_out, sizeof(buffer_out) - offset);
+}
+
+void gdb_if_consume(const size_t count)
+{
+	tail_out += count;
+}
+
 char gdb_if_getchar_to(uint32_t timeout)
 {
 	platform_timeout_s receive_timeout;
@@ -88,6 +103,7 @@ char gdb_if_getchar_to(uint32_t timeout)
 		if (!gdb_serial_get_dtr())
 			return '\x04';
 
+		scheduler_yield();
 		while (usb_get_config() != 1)
 			continue;
 	}
@@ -0,0 +1,121 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements the optional (ENABLE_PROBE_STATS=1) hot path instrumentation: counters
+ * for SWD transactions and their acks, target memory traffic and USB packets, along with the
+ * time spent in a few key functions as measured by the probe's own DWT cycle counter.
+ * The counters are shown by "monitor stats" and can be fetched over the remote protocol.
+ */
+
+#include "general.h"
+#include "gdb_packet.h"
+#include "probe_stats.h"
+
+#if PC_HOSTED == 0
+#include <libopencm3/cm3/dwt.h>
+#else
+#include <sys/time.h>
+#include "bmp_hosted.h"
+#include "bmp_remote.h"
+#endif
+
+probe_stats_s probe_stats;
+
+#if PC_HOSTED == 0
+static bool probe_stats_cycle_counter = false;
+#endif
+
+static const char *const probe_stats_timer_names[PROBE_STATS_TIMERS] = {
+	"firmware_swdp_low_access",
+	"target_flash_write",
+	"poll_rtt",
+};
+
+uint32_t probe_stats_timestamp(void)
+{
+#if PC_HOSTED == 0
+	/* Switch the cycle counter on the first time it's needed, this fails on ARMv6-M which lacks one */
+	if (!probe_stats_cycle_counter)
+		probe_stats_cycle_counter = dwt_enable_cycle_counter();
+	return dwt_read_cycle_counter();
+#else
+	timeval_s tv;
+	gettimeofday(&tv, NULL);
+	return (uint32_t)((tv.tv_sec * 1000000U) + tv.tv_usec);
+#endif
+}
+
+void probe_stats_time(const probe_stats_timer_e timer, const uint32_t start)
+{
+	const uint32_t elapsed = probe_stats_timestamp() - start;
+	probe_stats_time_s *const time = &probe_stats.time[timer];
+	time->total += elapsed;
+	++time->calls;
+	if (elapsed > time->max)
+		time->max = elapsed;
+}
+
+void probe_stats_reset(void)
+{
+	memset(&probe_stats, 0, sizeof(probe_stats));
+}
+
+static void probe_stats_report(const probe_stats_s *const stats, const bool in_cycles)
+{
+	gdb_outf("SWD accesses: %" PRIu32 ", WAIT acks: %" PRIu32 ", FAULT acks: %" PRIu32 ", retries: %" PRIu32 "\n",
+		stats->swd_accesses, stats->swd_wait_acks, stats->swd_fault_acks, stats->swd_retries);
+	gdb_outf("Target memory: %" PRIu32 " bytes read, %" PRIu32 " bytes written\n", stats->bytes_read,
+		stats->bytes_written);
+	gdb_outf("USB packets: %" PRIu32 " received, %" PRIu32 " sent\n", stats->usb_packets_received,
+		stats->usb_packets_sent);
+	for (size_t i = 0; i < PROBE_STATS_TIMERS; ++i) {
+		const probe_stats_time_s *const time = &stats->time[i];
+		/* Totals are shown in thousands to stay clear of 64-bit printf support */
+		gdb_outf("%s: %" PRIu32 " calls, %" PRIu32 " %s total, %" PRIu32 " %s max\n", probe_stats_timer_names[i],
+			time->calls, (uint32_t)(time->total / 1000U), in_cycles ? "kcycles" : "ms", time->max,
+			in_cycles ? "cycles" : "us");
+	}
+}
+
+void probe_stats_show(void)
+{
+	probe_stats_report(&probe_stats, PC_HOSTED == 0);
+#if PC_HOSTED == 1
+	/* A BMP running firmware built with the counters can tell us about its side of things too */
+	probe_stats_s remote_stats;
+	if (info.bmp_type == BMP_TYPE_BMP && remote_probe_stats(&remote_stats)) {
+		gdb_out("Probe:\n");
+		probe_stats_report(&remote_stats, true);
+	}
+#endif
+}
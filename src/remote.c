@@ -31,6 +31,10 @@
 #include "target/adiv5.h"
 #include "target.h"
 #include "hex_utils.h"
+#include "probe_stats.h"
+#ifdef PLATFORM_HAS_REMOTE_BULK
+#include "remote_if.h"
+#endif
 
 #define NTOH(x)    (((x) <= 9) ? (x) + '0' : 'a' + (x)-10)
 #define HTON(x)    (((x) <= '9') ? (x) - '0' : ((TOUPPER(x)) - 'A' + 10))
@@ -51,6 +55,18 @@ uint64_t remotehston(const uint32_t max, const char *const str)
 }
 
 #if PC_HOSTED == 0
+/* Responses go back out over whichever interface the request arrived on */
+static void remote_putchar(const char c, const int flush)
+{
+#ifdef PLATFORM_HAS_REMOTE_BULK
+	if (remote_if_processing()) {
+		remote_if_putchar(c, flush);
+		return;
+	}
+#endif
+	gdb_if_putchar(c, flush);
+}
+
 static void remote_send_buf(uint8_t *buffer, size_t len)
 {
 	uint8_t *p = buffer;
@@ -58,20 +74,66 @@ static void remote_send_buf(uint8_t *buffer, size_t len)
 	do {
 		hexify(hex, (const void *)p++, 1);
 
-		gdb_if_putchar(hex[0], 0);
-		gdb_if_putchar(hex[1], 0);
+		remote_putchar(hex[0], 0);
+		remote_putchar(hex[1], 0);
 
 	} while (p < (buffer + len));
 }
 
 static void remote_respond_buf(char respCode, uint8_t *buffer, size_t len)
 {
-	gdb_if_putchar(REMOTE_RESP, 0);
-	gdb_if_putchar(respCode, 0);
+	remote_putchar(REMOTE_RESP, 0);
+	remote_putchar(respCode, 0);
 
 	remote_send_buf(buffer, len);
 
-	gdb_if_putchar(REMOTE_EOM, 1);
+	remote_putchar(REMOTE_EOM, 1);
+}
+
+/* Send a single binary payload byte, escaping it if it would clash with the framing */
+static void remote_putchar_escaped(const uint8_t value)
+{
+	if (remote_needs_escape(value)) {
+		remote_putchar(REMOTE_ESCAPE, 0);
+		remote_putchar((char)(value ^ REMOTE_ESCAPE_XOR), 0);
+	} else
+		remote_putchar((char)value, 0);
+}
+
+/* Send a response carrying a raw binary payload, escaping any bytes that would clash with the framing */
+static void remote_respond_buf_binary(const char resp_code, const uint8_t *const buffer, const size_t len)
+{
+	remote_putchar(REMOTE_RESP, 0);
+	remote_putchar(resp_code, 0);
+
+	for (size_t offset = 0; offset < len; ++offset)
+		remote_putchar_escaped(buffer[offset]);
+
+	remote_putchar(REMOTE_EOM, 1);
+}
+
+/* Send a response carrying a run-length encoded binary payload, encoding it on the fly */
+static void remote_respond_buf_rle(const char resp_code, const uint8_t *const buffer, const size_t len)
+{
+	remote_putchar(REMOTE_RESP, 0);
+	remote_putchar(resp_code, 0);
+
+	for (size_t offset = 0; offset < len;) {
+		const size_t run = remote_rle_run_length(buffer + offset, len - offset);
+		if (run >= REMOTE_RLE_MIN_RUN) {
+			remote_putchar_escaped(REMOTE_RLE_RUN + run - REMOTE_RLE_MIN_RUN);
+			remote_putchar_escaped(buffer[offset]);
+			offset += run;
+			continue;
+		}
+		const size_t literal = remote_rle_literal_length(buffer + offset, len - offset);
+		remote_putchar_escaped(literal - 1U);
+		for (size_t idx = 0; idx < literal; ++idx)
+			remote_putchar_escaped(buffer[offset + idx]);
+		offset += literal;
+	}
+
+	remote_putchar(REMOTE_EOM, 1);
 }
 
 /* Send response to far end */
@@ -80,8 +142,8 @@ static void remote_respond(char respCode, uint64_t param)
 	char buf[35]; /*Response, code, EOM and 2*16 hex nibbles*/
 	char *p = buf;
 
-	gdb_if_putchar(REMOTE_RESP, 0);
-	gdb_if_putchar(respCode, 0);
+	remote_putchar(REMOTE_RESP, 0);
+	remote_putchar(respCode, 0);
 
 	do {
 		*p++ = NTOH(param & 0x0fU);
@@ -90,25 +152,79 @@ static void remote_respond(char respCode, uint64_t param)
 
 	/* At this point the number to print is the buf, but backwards, so spool it out */
 	do {
-		gdb_if_putchar(*--p, 0);
+		remote_putchar(*--p, 0);
 	} while (p > buf);
-	gdb_if_putchar(REMOTE_EOM, 1);
+	remote_putchar(REMOTE_EOM, 1);
 }
 
 static void remote_respond_string(char respCode, const char *s)
 /* Send response to far end */
 {
-	gdb_if_putchar(REMOTE_RESP, 0);
-	gdb_if_putchar(respCode, 0);
+	remote_putchar(REMOTE_RESP, 0);
+	remote_putchar(respCode, 0);
 	while (*s) {
 		/* Just clobber illegal characters so they don't disturb the protocol */
 		if ((*s == '$') || (*s == REMOTE_SOM) || (*s == REMOTE_EOM))
-			gdb_if_putchar(' ', 0);
+			remote_putchar(' ', 0);
 		else
-			gdb_if_putchar(*s, 0);
+			remote_putchar(*s, 0);
 		s++;
 	}
-	gdb_if_putchar(REMOTE_EOM, 1);
+	remote_putchar(REMOTE_EOM, 1);
+}
+
+/* Length of a batch entry given the sequence it encodes, or 0 if that isn't a sequence we know */
+static size_t remote_swd_batch_entry_length(const char op)
+{
+	if (op == REMOTE_IN || op == REMOTE_IN_PAR)
+		return REMOTE_SWDP_BATCH_IN_LENGTH;
+	if (op == REMOTE_OUT || op == REMOTE_OUT_PAR)
+		return REMOTE_SWDP_BATCH_OUT_LENGTH;
+	return 0U;
+}
+
+/* Check every entry of a batch of SWD sequences is complete and known before any of them get run */
+static bool remote_swd_batch_valid(const char *const entries, const size_t length)
+{
+	for (size_t offset = 0; offset < length;) {
+		const size_t entry_length = remote_swd_batch_entry_length(entries[offset]);
+		if (!entry_length || length - offset < entry_length)
+			return false;
+		offset += entry_length;
+	}
+	return true;
+}
+
+/* Send the 8 hex digits of one in's result as part of a batch response */
+static void remote_send_word(const uint32_t value)
+{
+	for (size_t shift = 32U; shift;) {
+		shift -= 4U;
+		remote_putchar(NTOH((value >> shift) & 0x0fU), 0);
+	}
+}
+
+/* Run a validated batch of SWD sequences back to back, streaming the ins' results out as they complete */
+static void remote_swd_batch_run(const char *const entries, const size_t length)
+{
+	remote_putchar(REMOTE_RESP, 0);
+	remote_putchar(REMOTE_RESP_OK, 0);
+	for (size_t offset = 0; offset < length; offset += remote_swd_batch_entry_length(entries[offset])) {
+		const char op = entries[offset];
+		const size_t ticks = remotehston(2, &entries[offset + 1U]);
+		if (op == REMOTE_IN_PAR) {
+			uint32_t value = 0;
+			const bool parity_error = swd_proc.seq_in_parity(&value, ticks);
+			remote_putchar(parity_error ? REMOTE_RESP_PARERR : REMOTE_RESP_OK, 0);
+			remote_send_word(value);
+		} else if (op == REMOTE_IN)
+			remote_send_word(swd_proc.seq_in(ticks));
+		else if (op == REMOTE_OUT_PAR)
+			swd_proc.seq_out_parity(remotehston(8, &entries[offset + 3U]), ticks);
+		else
+			swd_proc.seq_out(remotehston(8, &entries[offset + 3U]), ticks);
+	}
+	remote_putchar(REMOTE_EOM, 1);
 }
 
 static adiv5_debug_port_s remote_dp = {
@@ -163,6 +279,13 @@ static void remote_packet_process_swd(unsigned i, char *packet)
 		remote_respond(REMOTE_RESP_OK, 0);
 		break;
 
+	case REMOTE_SEQ_BATCH: /* SB = Batch of sequences ===================== */
+		if (remote_swd_batch_valid(&packet[2], i - 2U))
+			remote_swd_batch_run(&packet[2], i - 2U);
+		else
+			remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+		break;
+
 	default:
 		remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_UNRECOGNISED);
 		break;
@@ -325,19 +448,124 @@ static void remote_packet_process_general(unsigned i, char *packet)
 		remote_respond(REMOTE_RESP_OK, 0);
 		break;
 
+	case REMOTE_STATS_GET:
+#ifdef ENABLE_PROBE_STATS
+		remote_respond_buf(REMOTE_RESP_OK, (uint8_t *)&probe_stats, sizeof(probe_stats));
+#else
+		remote_respond(REMOTE_RESP_NOTSUP, 0);
+#endif
+		break;
+
 	default:
 		remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_UNRECOGNISED);
 		break;
 	}
 }
 
+/* Number of queue entries the batch handler runs at a time */
+#define REMOTE_BATCH_QUEUE_DEPTH 16U
+
+static bool remote_batch_op_is_write(const char op)
+{
+	return op == REMOTE_BATCH_DP_WRITE || op == REMOTE_BATCH_AP_WRITE;
+}
+
+static void remote_packet_process_batch(adiv5_access_port_s *const ap, const char *packet, const char *const end)
+{
+	/* Validate the whole batch before running any of it so a malformed packet has no side effects */
+	size_t reads = 0;
+	for (const char *op = packet; op < end;) {
+		const size_t length = remote_batch_op_is_write(*op) ? 13U : 5U;
+		if ((size_t)(end - op) < length) {
+			remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+			return;
+		}
+		if (*op == REMOTE_BATCH_DP_READ || *op == REMOTE_BATCH_AP_READ)
+			++reads;
+		else if (!remote_batch_op_is_write(*op)) {
+			remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_UNRECOGNISED);
+			return;
+		}
+		op += length;
+	}
+	if (reads > REMOTE_BATCH_MAX_READS) {
+		remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+		return;
+	}
+
+	adiv5_queue_entry_s entries[REMOTE_BATCH_QUEUE_DEPTH];
+	uint32_t results[REMOTE_BATCH_MAX_READS];
+	adiv5_queue_s queue;
+	adiv5_queue_init(&queue, ap->dp, entries, REMOTE_BATCH_QUEUE_DEPTH);
+	reads = 0;
+	while (packet < end) {
+		const char op = packet[0];
+		const uint16_t addr = remotehston(4, packet + 1);
+		if (remote_batch_op_is_write(op)) {
+			const uint32_t value = remotehston(8, packet + 5);
+			if (op == REMOTE_BATCH_DP_WRITE)
+				adiv5_queue_dp_write(&queue, addr, value);
+			else
+				adiv5_queue_ap_write(&queue, ap, addr, value);
+			packet += 13U;
+		} else {
+			if (op == REMOTE_BATCH_DP_READ)
+				adiv5_queue_dp_read(&queue, addr, &results[reads++]);
+			else
+				adiv5_queue_ap_read(&queue, ap, addr, &results[reads++]);
+			packet += 5U;
+		}
+	}
+
+	if (!adiv5_queue_run(&queue)) {
+		remote_respond(REMOTE_RESP_ERR, 0);
+		ap->dp->fault = 0;
+		return;
+	}
+	remote_respond_buf(REMOTE_RESP_OK, (uint8_t *)results, reads * 4U);
+}
+
+/*
+ * Decode a run-length encoded payload straight out to target memory a buffer's worth at a time,
+ * as the decoded data can be far bigger than the packet buffer. Returns false if the payload
+ * is malformed or doesn't decode to exactly len bytes; faults are left for the caller to check.
+ */
+static bool remote_mem_write_rle(adiv5_access_port_s *const ap, const uint32_t dest, const uint8_t *const payload,
+	const size_t payload_len, const size_t len, const align_e align)
+{
+	uint32_t chunk[64U];
+	uint8_t *const buffer = (uint8_t *)chunk;
+	size_t fill = 0;
+	size_t written = 0;
+	for (size_t offset = 0; offset < payload_len && !ap->dp->fault;) {
+		const uint8_t control = payload[offset++];
+		const bool is_run = control >= REMOTE_RLE_RUN;
+		const size_t amount = is_run ? control - REMOTE_RLE_RUN + REMOTE_RLE_MIN_RUN : control + 1U;
+		if ((is_run ? 1U : amount) > payload_len - offset || written + fill + amount > len)
+			return false;
+		const uint8_t *const data = payload + offset;
+		offset += is_run ? 1U : amount;
+		for (size_t idx = 0; idx < amount; ++idx) {
+			buffer[fill++] = is_run ? data[0] : data[idx];
+			if (fill == sizeof(chunk)) {
+				adiv5_mem_write_sized(ap, dest + written, buffer, fill, align);
+				written += fill;
+				fill = 0;
+			}
+		}
+	}
+	if (fill && !ap->dp->fault)
+		adiv5_mem_write_sized(ap, dest + written, buffer, fill, align);
+	return ap->dp->fault || written + fill == len;
+}
+
 static void remote_packet_process_high_level(unsigned i, char *packet)
 
 {
-	(void)i;
 	SET_IDLE_STATE(0);
 
-	adiv5_access_port_s remote_ap;
+	adiv5_access_port_s remote_ap = {};
+	const char *const packet_start = packet;
 	/* Re-use packet buffer. Align to DWORD! */
 	void *src = (void *)(((uint32_t)packet + 7U) & ~7U);
 	char index = packet[1];
@@ -347,6 +575,8 @@ static void remote_packet_process_high_level(unsigned i, char *packet)
 	}
 	packet += 2;
 	remote_dp.dp_jd_index = remotehston(2, packet);
+	/* The host drives SELECT and the AP registers directly too, so nothing cached can be trusted */
+	adiv5_dp_shadow_invalidate(&remote_dp);
 	packet += 2;
 	remote_ap.apsel = remotehston(2, packet);
 	remote_ap.dp = &remote_dp;
@@ -379,7 +609,13 @@ static void remote_packet_process_high_level(unsigned i, char *packet)
 		adiv5_ap_write(&remote_ap, addr16, value);
 		remote_respond(REMOTE_RESP_OK, 0);
 		break;
-	case REMOTE_AP_MEM_READ: /* HM = Read from Mem and set csw */
+	case REMOTE_BATCH: /* HQ = Run a batch of register accesses */
+		packet += 2;
+		remote_packet_process_batch(&remote_ap, packet, packet_start + i);
+		break;
+	case REMOTE_AP_MEM_READ_RLE: /* Hz = Read from Mem and set csw, run-length encoded response */
+	case REMOTE_AP_MEM_READ_BIN: /* Hb = Read from Mem and set csw, binary response */
+	case REMOTE_AP_MEM_READ:     /* HM = Read from Mem and set csw */
 		packet += 2;
 		remote_ap.csw = remotehston(8, packet);
 		packet += 6;
@@ -392,13 +628,106 @@ static void remote_packet_process_high_level(unsigned i, char *packet)
 		packet += 8;
 		adiv5_mem_read(&remote_ap, src, address, count);
 		if (remote_ap.dp->fault == 0) {
-			remote_respond_buf(REMOTE_RESP_OK, src, count);
+			if (index == REMOTE_AP_MEM_READ_RLE)
+				remote_respond_buf_rle(REMOTE_RESP_OK, src, count);
+			else if (index == REMOTE_AP_MEM_READ_BIN)
+				remote_respond_buf_binary(REMOTE_RESP_OK, src, count);
+			else
+				remote_respond_buf(REMOTE_RESP_OK, src, count);
 			break;
 		}
 		remote_respond(REMOTE_RESP_ERR, 0);
 		remote_ap.dp->fault = 0;
 		break;
-	case REMOTE_AP_MEM_WRITE_SIZED: /* Hm = Write to memory and set csw */
+	case REMOTE_AP_MEM_POLL: { /* HW = Wait for a memory location to match, with csw */
+		packet += 2;
+		remote_ap.csw = remotehston(8, packet);
+		packet += 8;
+		const uint32_t poll_addr = remotehston(8, packet);
+		packet += 8;
+		const uint32_t mask = remotehston(8, packet);
+		packet += 8;
+		const uint32_t expected = remotehston(8, packet);
+		packet += 8;
+		const uint32_t timeout = MIN(remotehston(8, packet), REMOTE_MEM_POLL_MAX_TIMEOUT);
+		uint32_t result = 0;
+		adiv5_mem_poll32(&remote_ap, poll_addr, mask, expected, timeout, &result);
+		if (remote_ap.dp->fault) {
+			remote_respond(REMOTE_RESP_ERR, 0);
+			remote_ap.dp->fault = 0;
+			break;
+		}
+		remote_respond_buf(REMOTE_RESP_OK, (uint8_t *)&result, 4);
+		break;
+	}
+	case REMOTE_AP_MEM_WRITE_LOOP: { /* HF = Run a Flash programming loop over a binary payload, with csw */
+		packet += 2;
+		remote_ap.csw = remotehston(8, packet);
+		packet += 8;
+		const align_e loop_align = remotehston(2, packet);
+		packet += 2;
+		const uint32_t loop_dest = remotehston(8, packet);
+		packet += 8;
+		const size_t loop_len = remotehston(8, packet);
+		packet += 8;
+		adiv5_mem_write_loop_s loop;
+		loop.stride = remotehston(8, packet);
+		packet += 8;
+		loop.cmd_addr = remotehston(8, packet);
+		packet += 8;
+		loop.cmd_value = remotehston(8, packet);
+		packet += 8;
+		loop.status_addr = remotehston(8, packet);
+		packet += 8;
+		loop.status_mask = remotehston(8, packet);
+		packet += 8;
+		loop.status_value = remotehston(8, packet);
+		packet += 8;
+		loop.timeout_ms = MIN(remotehston(8, packet), REMOTE_MEM_POLL_MAX_TIMEOUT);
+		packet += 8;
+		if (!loop.stride || (loop.stride | loop_len) & ((1U << loop_align) - 1U) ||
+			(size_t)(packet - packet_start) + loop_len > i) {
+			remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+			break;
+		}
+		memmove(src, packet, loop_len);
+		uint32_t status = 0;
+		adiv5_mem_write_loop(&remote_ap, loop_dest, src, loop_len, loop_align, &loop, &status);
+		if (remote_ap.dp->fault) {
+			remote_respond(REMOTE_RESP_ERR, 0);
+			remote_ap.dp->fault = 0;
+			break;
+		}
+		remote_respond_buf(REMOTE_RESP_OK, (uint8_t *)&status, 4);
+		break;
+	}
+	case REMOTE_AP_MEM_WRITE_SIZED_RLE: { /* HZ = Write run-length encoded data to memory and set csw */
+		packet += 2;
+		remote_ap.csw = remotehston(8, packet);
+		packet += 8;
+		const align_e rle_align = remotehston(2, packet);
+		packet += 2;
+		const uint32_t rle_dest = remotehston(8, packet);
+		packet += 8;
+		const size_t rle_len = remotehston(8, packet);
+		packet += 8;
+		const size_t payload_len = i - MIN((size_t)(packet - packet_start), i);
+		if (rle_len > REMOTE_RLE_MAX_LENGTH || rle_len & ((1U << rle_align) - 1U) ||
+			!remote_mem_write_rle(&remote_ap, rle_dest, (const uint8_t *)packet, payload_len, rle_len, rle_align)) {
+			remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+			remote_ap.dp->fault = 0;
+			break;
+		}
+		if (remote_ap.dp->fault) {
+			remote_respond(REMOTE_RESP_ERR, 0);
+			remote_ap.dp->fault = 0;
+			break;
+		}
+		remote_respond(REMOTE_RESP_OK, 0);
+		break;
+	}
+	case REMOTE_AP_MEM_WRITE_SIZED_BIN: /* HB = Write binary data to memory and set csw */
+	case REMOTE_AP_MEM_WRITE_SIZED:     /* Hm = Write to memory and set csw */
 		packet += 2;
 		remote_ap.csw = remotehston(8, packet);
 		packet += 6;
@@ -416,8 +745,16 @@ static void remote_packet_process_high_level(unsigned i, char *packet)
 			remote_respond(REMOTE_RESP_ERR, 0);
 			break;
 		}
-		/* Read as stream of hexified bytes*/
-		unhexify(src, packet, len);
+		if (index == REMOTE_AP_MEM_WRITE_SIZED_BIN) {
+			/* The payload was already unescaped on reception, so just check it's all there */
+			if ((size_t)(packet - packet_start) + len > i) {
+				remote_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+				break;
+			}
+			memmove(src, packet, len);
+		} else
+			/* Read as stream of hexified bytes*/
+			unhexify(src, packet, len);
 		adiv5_mem_write_sized(&remote_ap, dest, src, len, align);
 		if (remote_ap.dp->fault) {
 			/* Errors handles on hosted side.*/
@@ -24,7 +24,7 @@
 #include <inttypes.h>
 #include "general.h"
 
-#define REMOTE_HL_VERSION 2
+#define REMOTE_HL_VERSION 7
 
 /*
  * Commands to remote end, and responses
@@ -46,6 +46,38 @@
  *       resp: F<PARAM> - hex value returned, bad parity.
  *             X<err>   - error occurred
  *
+ * From HL version 3 on, memory payloads can also be sent as raw binary using the
+ * REMOTE_AP_MEM_READ_BIN and REMOTE_AP_MEM_WRITE_SIZED_BIN commands. Command headers
+ * stay hex encoded, and any payload byte that would clash with the framing
+ * characters (!, #, &, $ and the escape character itself) is sent as
+ * REMOTE_ESCAPE followed by the byte XOR REMOTE_ESCAPE_XOR.
+ *
+ * From HL version 4 on, REMOTE_BATCH carries a list of DP and AP register accesses
+ * against one DP and AP, which are run in order. Each access is an operation
+ * character, a 4 digit register address and, for writes, an 8 digit value. The
+ * response carries the results of all the reads, in order, hex encoded as with
+ * REMOTE_AP_READ. Processing stops at the first fault, answered with REMOTE_RESP_ERR.
+ *
+ * From HL version 5 on, REMOTE_AP_MEM_POLL reads a 32-bit memory location until its
+ * value masked matches the expected one or the timeout (in milliseconds, capped at
+ * REMOTE_MEM_POLL_MAX_TIMEOUT) expires. The response is the last value read, so the
+ * host tells a match from a timeout itself. A fault is answered with REMOTE_RESP_ERR.
+ *
+ * From HL version 6 on, REMOTE_AP_MEM_WRITE_LOOP runs a Flash programming loop on the
+ * probe. The binary payload is written out in stride sized pieces, each followed by an
+ * optional 32-bit command write (skipped when the command address is 0) and a poll of a
+ * status register as for REMOTE_AP_MEM_POLL, with the timeout applying to each poll.
+ * The response is the last status value read, or REMOTE_RESP_ERR on a fault.
+ *
+ * From HL version 7 on, REMOTE_AP_MEM_READ_RLE and REMOTE_AP_MEM_WRITE_SIZED_RLE work as
+ * their binary counterparts but with a run-length encoded payload, which keeps padding and
+ * zeroed buffers from costing their full size on the wire. The encoding is PackBits-like:
+ * a control byte below REMOTE_RLE_RUN is followed by that many plus one literal bytes,
+ * while one at or above it is followed by a single byte which is repeated control byte -
+ * REMOTE_RLE_RUN + REMOTE_RLE_MIN_RUN times. The encoded stream is then escaped as for
+ * binary payloads. The length in both headers is the decoded length, which for writes
+ * may be up to REMOTE_RLE_MAX_LENGTH.
+ *
  * The whole protocol is defined in this header file. Parameters have
  * to be marshalled in remote.c, swdptap.c and jtagtap.c, so be
  * careful to ensure the parameter handling matches the protocol
@@ -61,6 +93,10 @@
 #define REMOTE_EOM  '#'
 #define REMOTE_RESP '&'
 
+/* Binary payload escaping */
+#define REMOTE_ESCAPE     '}'
+#define REMOTE_ESCAPE_XOR 0x20U
+
 /* Generic protocol elements */
 #define REMOTE_START         'A'
 #define REMOTE_TDITDO_TMS    'D'
@@ -83,6 +119,8 @@
 #define REMOTE_NRST_SET      'Z'
 #define REMOTE_NRST_GET      'z'
 #define REMOTE_ADD_JTAG_DEV  'J'
+#define REMOTE_STATS_GET     'x'
+#define REMOTE_SEQ_BATCH     'B'
 
 /* Protocol response options */
 #define REMOTE_RESP_OK     'K'
@@ -101,6 +139,31 @@
 #define REMOTE_MEM_READ           'h'
 #define REMOTE_MEM_WRITE_SIZED    'H'
 #define REMOTE_AP_MEM_WRITE_SIZED 'm'
+/* Binary payload variants of REMOTE_AP_MEM_READ and REMOTE_AP_MEM_WRITE_SIZED, HL version 3 and up */
+#define REMOTE_AP_MEM_READ_BIN        'b'
+#define REMOTE_AP_MEM_WRITE_SIZED_BIN 'B'
+#define REMOTE_BATCH                  'Q'
+#define REMOTE_AP_MEM_POLL            'W'
+#define REMOTE_AP_MEM_WRITE_LOOP      'F'
+#define REMOTE_AP_MEM_READ_RLE        'z'
+#define REMOTE_AP_MEM_WRITE_SIZED_RLE 'Z'
+/* Longest REMOTE_AP_MEM_POLL wait, kept well inside the host's response timeout */
+#define REMOTE_MEM_POLL_MAX_TIMEOUT 1000U
+
+/* Run-length encoding parameters for the RLE memory commands */
+#define REMOTE_RLE_RUN         0x80U
+#define REMOTE_RLE_MIN_RUN     3U
+#define REMOTE_RLE_MAX_RUN     (0xffU - REMOTE_RLE_RUN + REMOTE_RLE_MIN_RUN)
+#define REMOTE_RLE_MAX_LITERAL REMOTE_RLE_RUN
+#define REMOTE_RLE_MAX_LENGTH  0x4000U
+
+/* REMOTE_BATCH operations */
+#define REMOTE_BATCH_DP_READ  'd'
+#define REMOTE_BATCH_DP_WRITE 'D'
+#define REMOTE_BATCH_AP_READ  'a'
+#define REMOTE_BATCH_AP_WRITE 'A'
+/* Most reads a single batch may carry, bounded by the response size */
+#define REMOTE_BATCH_MAX_READS 32U
 
 /* Generic protocol elements */
 #define REMOTE_GEN_PACKET 'G'
@@ -149,6 +212,11 @@
 	{                                                                                \
 		REMOTE_SOM, REMOTE_GEN_PACKET, REMOTE_TARGET_CLK_OE, '%', 'c', REMOTE_EOM, 0 \
 	}
+#define REMOTE_STATS_GET_STR                                           \
+	(char[])                                                           \
+	{                                                                  \
+		REMOTE_SOM, REMOTE_GEN_PACKET, REMOTE_STATS_GET, REMOTE_EOM, 0 \
+	}
 
 /* SWDP protocol elements */
 #define REMOTE_SWDP_PACKET 'S'
@@ -182,6 +250,21 @@
 		REMOTE_SOM, REMOTE_SWDP_PACKET, REMOTE_OUT_PAR, '%', '0', '2', 'x', '%', 'x', REMOTE_EOM, 0 \
 	}
 
+/*
+ * A batch of SWD sequences run back to back: the prefix is followed by one entry per sequence, the
+ * REMOTE_IN, REMOTE_IN_PAR, REMOTE_OUT or REMOTE_OUT_PAR it is, 2 hex digits of clock cycles and for the
+ * outs 8 hex digits of data. The response carries 8 hex digits for each in, in order, those for the ins
+ * with parity each preceded by REMOTE_RESP_OK or REMOTE_RESP_PARERR. Firmware without this reports the
+ * empty batch as unrecognised.
+ */
+#define REMOTE_SWDP_BATCH_STR                               \
+	(char[])                                                \
+	{                                                       \
+		REMOTE_SOM, REMOTE_SWDP_PACKET, REMOTE_SEQ_BATCH, 0 \
+	}
+#define REMOTE_SWDP_BATCH_IN_LENGTH  3U
+#define REMOTE_SWDP_BATCH_OUT_LENGTH 11U
+
 /* JTAG protocol elements */
 #define REMOTE_JTAG_PACKET 'J'
 #define REMOTE_JTAG_INIT_STR                                                        \
@@ -278,6 +361,59 @@
 		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_WRITE_SIZED, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
 			'%', '0', '2', 'x', HEX_U32(address), HEX_U32(count), 0                                                    \
 	}
+#define REMOTE_AP_MEM_READ_BIN_STR                                                                                  \
+	(char[])                                                                                                        \
+	{                                                                                                               \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_READ_BIN, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
+			HEX_U32(address), HEX_U32(count), REMOTE_EOM, 0                                                         \
+	}
+#define REMOTE_AP_MEM_WRITE_SIZED_BIN_STR                                                                    \
+	(char[])                                                                                                 \
+	{                                                                                                        \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_WRITE_SIZED_BIN, '%', '0', '2', 'x', '%', '0', '2', 'x', \
+			HEX_U32(csw), '%', '0', '2', 'x', HEX_U32(address), HEX_U32(count), 0                            \
+	}
+#define REMOTE_AP_MEM_READ_RLE_STR                                                                                  \
+	(char[])                                                                                                        \
+	{                                                                                                               \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_READ_RLE, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
+			HEX_U32(address), HEX_U32(count), REMOTE_EOM, 0                                                         \
+	}
+#define REMOTE_AP_MEM_WRITE_SIZED_RLE_STR                                                                    \
+	(char[])                                                                                                 \
+	{                                                                                                        \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_WRITE_SIZED_RLE, '%', '0', '2', 'x', '%', '0', '2', 'x', \
+			HEX_U32(csw), '%', '0', '2', 'x', HEX_U32(address), HEX_U32(count), 0                            \
+	}
+#define REMOTE_BATCH_STR                                                                         \
+	(char[])                                                                                     \
+	{                                                                                            \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_BATCH, '%', '0', '2', 'x', '%', '0', '2', 'x', 0 \
+	}
+#define REMOTE_BATCH_READ_STR                  \
+	(char[])                                   \
+	{                                          \
+		'%', 'c', '%', '0', '4', 'x', 0 \
+	}
+#define REMOTE_BATCH_WRITE_STR                                \
+	(char[])                                                  \
+	{                                                         \
+		'%', 'c', '%', '0', '4', 'x', HEX_U32(value), 0 \
+	}
+#define REMOTE_AP_MEM_POLL_STR                                                                                  \
+	(char[])                                                                                                    \
+	{                                                                                                           \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_POLL, '%', '0', '2', 'x', '%', '0', '2', 'x', HEX_U32(csw), \
+			HEX_U32(address), HEX_U32(mask), HEX_U32(value), HEX_U32(timeout), REMOTE_EOM, 0                    \
+	}
+#define REMOTE_AP_MEM_WRITE_LOOP_STR                                                                    \
+	(char[])                                                                                            \
+	{                                                                                                   \
+		REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_WRITE_LOOP, '%', '0', '2', 'x', '%', '0', '2', 'x', \
+			HEX_U32(csw), '%', '0', '2', 'x', HEX_U32(address), HEX_U32(count), HEX_U32(stride),        \
+			HEX_U32(cmd_addr), HEX_U32(cmd_value), HEX_U32(status_addr), HEX_U32(mask), HEX_U32(value), \
+			HEX_U32(timeout), 0                                                                         \
+	}
 #define REMOTE_MEM_WRITE_SIZED_STR                                                                       \
 	(char[])                                                                                             \
 	{                                                                                                    \
@@ -286,6 +422,31 @@
 	}
 
 uint64_t remotehston(uint32_t limit, const char *s);
+
+static inline bool remote_needs_escape(const uint8_t value)
+{
+	return value == REMOTE_SOM || value == REMOTE_EOM || value == REMOTE_RESP || value == '$' || value == REMOTE_ESCAPE;
+}
+
+/* Length of the run of identical bytes at the start of data, capped at what one RLE control byte describes */
+static inline size_t remote_rle_run_length(const uint8_t *const data, const size_t len)
+{
+	size_t run = 1U;
+	while (run < len && run < REMOTE_RLE_MAX_RUN && data[run] == data[0])
+		++run;
+	return run;
+}
+
+/* Length of the literal stretch at the start of data, which ends where a run worth encoding begins */
+static inline size_t remote_rle_literal_length(const uint8_t *const data, const size_t len)
+{
+	size_t literal = 1U;
+	while (literal < len && literal < REMOTE_RLE_MAX_LITERAL &&
+		remote_rle_run_length(data + literal, len - literal) < REMOTE_RLE_MIN_RUN)
+		++literal;
+	return literal;
+}
+
 void remote_packet_process(unsigned int i, char *packet);
 
 #endif /* REMOTE_H */
@@ -27,10 +27,16 @@
 #include "general.h"
 #include "platform.h"
 #include "gdb_packet.h"
+#include "gdb_main.h"
 #include "target.h"
 #include "target/target_internal.h"
 #include "rtt.h"
+#include "gdb_symbol.h"
 #include "rtt_if.h"
+#include "probe_stats.h"
+#if defined(BUFFER_POOL_SIZE)
+#include "buffer_pool.h"
+#endif
 
 bool rtt_enabled = false;
 bool rtt_found = false;
@@ -42,12 +48,18 @@ bool rtt_auto_channel = true;
 bool rtt_channel_enabled[MAX_RTT_CHAN] = {0}; // true if user wants to see channel
 rtt_channel_s rtt_channel[MAX_RTT_CHAN];
 
-uint32_t rtt_min_poll_ms = 8;   /* 8 ms */
+#if PC_HOSTED == 1
+/* BMDA isn't sharing the probe with a USB stack so can afford to poll much harder */
+uint32_t rtt_min_poll_ms = 1; /* 1 ms */
+#else
+uint32_t rtt_min_poll_ms = 8; /* 8 ms */
+#endif
 uint32_t rtt_max_poll_ms = 256; /* 0.256 s */
 uint32_t rtt_max_poll_errs = 10;
 static uint32_t poll_ms;
 static uint32_t poll_errs;
 static uint32_t last_poll_ms;
+static bool rtt_backlog; /* an up channel had more data than the transmit buffer could take */
 /* flags for data from host to target */
 bool rtt_flag_skip = false;
 bool rtt_flag_block = false;
@@ -71,8 +83,20 @@ char rtt_ident[16] = QUOTE(RTT_IDENT);
 char rtt_ident[16] = {0};
 #endif
 
-/* usb uart transmit buffer */
-static char xmit_buf[RTT_UP_BUF_SIZE];
+#if !defined(BUFFER_POOL_SIZE)
+static char rtt_xmit_storage[RTT_UP_BUF_SIZE];
+#endif
+
+/* usb uart transmit buffer, taken from the platform's shared buffer pool when it has one */
+static char *rtt_xmit_buf(size_t *const size)
+{
+#if defined(BUFFER_POOL_SIZE)
+	return buffer_pool_rtt(size);
+#else
+	*size = sizeof(rtt_xmit_storage);
+	return rtt_xmit_storage;
+#endif
+}
 
 /*********************************************************************
 *
@@ -81,57 +105,80 @@ static char xmit_buf[RTT_UP_BUF_SIZE];
 **********************************************************************
 */
 
-static uint32_t fast_search(target_s *const cur_target, const uint32_t ram_start, const uint32_t ram_end)
+/* RAM is searched in chunks of this size, word aligned so the reads take the block transfer path */
+#if PC_HOSTED == 1
+#define RTT_SEARCH_CHUNK 4096U
+#else
+#define RTT_SEARCH_CHUNK 256U
+#endif
+
+/* Where, and on what, the control block was last found - tried first on the next search */
+static uint32_t last_cbaddr = 0;
+static const char *last_cbaddr_driver = NULL;
+
+/*
+ * Fill in the control block ID to search for, returning its length. This is either the
+ * user's ident, or SEGGER's default ID padded out to the full 16 byte acID field.
+ */
+static size_t rtt_search_pattern(uint32_t *const pattern, uint32_t *const first_mask)
+{
+	memset(pattern, 0, 16U);
+	size_t len = strnlen(rtt_ident, sizeof(rtt_ident));
+	if (len == 0) {
+		memcpy(pattern, "SEGGER RTT", 10U);
+		len = 16U;
+	} else
+		memcpy(pattern, rtt_ident, len);
+	*first_mask = 0;
+	memset(first_mask, 0xff, MIN(len, 4U));
+	return len;
+}
+
+/*
+ * The control block is a structure of words the compiler always aligns, so it's enough to
+ * look for the ID at word aligned addresses, and a mismatch is nearly always caught by the
+ * first word compare.
+ */
+static uint32_t rtt_search(target_s *const cur_target, const uint32_t ram_start, const uint32_t ram_end)
 {
-	static const uint32_t m = 16;
-	static const uint64_t p = 0x444110cd;
-	static const uint64_t q = 0x797a9691; /* prime */
-	static const uint64_t r = 0x73b07d01;
-	static const uint32_t stride = 128;
-	uint64_t t = 0;
-	uint8_t srch_buf[m + stride];
-
-	memset(srch_buf, 0, sizeof(srch_buf));
-
-	for (uint32_t addr = ram_start; addr < ram_end; addr += stride) {
-		uint32_t buf_siz = MIN(stride, ram_end - addr);
-		memcpy(srch_buf, srch_buf + stride, m);
-		if (target_mem_read(cur_target, srch_buf + m, addr, buf_siz)) {
+	uint32_t pattern[4];
+	uint32_t first_mask;
+	const size_t pattern_len = rtt_search_pattern(pattern, &first_mask);
+	/* Consecutive chunks overlap, so an ID straddling two of them is still seen whole */
+	const uint32_t overlap = ALIGN(pattern_len, 4U) - 4U;
+	uint32_t buf[RTT_SEARCH_CHUNK / 4U];
+
+	for (uint32_t addr = ALIGN(ram_start, 4U); addr < ram_end; addr += sizeof(buf) - overlap) {
+		const uint32_t len = MIN(sizeof(buf), (ram_end - addr) & ~3U);
+		if (len < pattern_len)
+			break;
+		if (target_mem_read(cur_target, buf, addr, len)) {
 			gdb_outf("rtt: read fail at 0x%" PRIx32 "\r\n", addr);
 			return 0;
 		}
-		for (uint32_t i = 0; i < buf_siz; i++) {
-			t = (t + q - r * srch_buf[i] % q) % q;
-			t = ((t << 8U) + srch_buf[i + m]) % q;
-			if (p == t)
-				return addr + i - m + 1U;
+		for (size_t i = 0; (i * 4U) + pattern_len <= len; ++i) {
+			if ((buf[i] & first_mask) == pattern[0] && memcmp(buf + i, pattern, pattern_len) == 0)
+				return addr + (i * 4U);
 		}
+		if (len < sizeof(buf))
+			break;
 	}
 	/* no match */
 	return 0;
 }
 
-static uint32_t memory_search(target_s *const cur_target, const uint32_t ram_start, const uint32_t ram_end)
+/* Check if the control block address found last time is somewhere we'd search now */
+static bool rtt_last_cbaddr_valid(const target_s *const cur_target)
 {
-	const char *const srch_str = rtt_ident;
-	const uint32_t srch_str_len = strlen(srch_str);
-	uint8_t srch_buf[128];
-
-	if (srch_str_len == 0 || srch_str_len > sizeof(srch_buf) / 2U)
-		return 0;
-
-	for (uint32_t addr = ram_start; addr < ram_end; addr += sizeof(srch_buf) - srch_str_len - 1U) {
-		uint32_t buf_siz = MIN(ram_end - addr, sizeof(srch_buf));
-		if (target_mem_read(cur_target, srch_buf, addr, buf_siz)) {
-			gdb_outf("rtt: read fail at 0x%" PRIx32 "\r\n", addr);
-			continue;
-		}
-		for (uint32_t offset = 0; offset + srch_str_len + 1U < buf_siz; offset++) {
-			if (strncmp((const char *)(srch_buf + offset), srch_str, srch_str_len) == 0)
-				return addr + offset;
-		}
+	if (!last_cbaddr || cur_target->driver != last_cbaddr_driver)
+		return false;
+	if (rtt_flag_ram)
+		return last_cbaddr >= rtt_ram_start && last_cbaddr + 16U <= rtt_ram_end;
+	for (const target_ram_s *r = cur_target->ram; r; r = r->next) {
+		if (last_cbaddr >= r->start && last_cbaddr + 16U <= r->start + r->length)
+			return true;
 	}
-	return 0;
+	return false;
 }
 
 static void find_rtt(target_s *const cur_target)
@@ -140,30 +187,29 @@ static void find_rtt(target_s *const cur_target)
 	poll_ms = rtt_max_poll_ms;
 	poll_errs = 0;
 	last_poll_ms = 0;
+	rtt_backlog = false;
 
 	if (!cur_target || !rtt_enabled)
 		return;
 
 	rtt_cbaddr = 0;
-	if (!rtt_flag_ram) {
+	/* if GDB told us where the control block is, check it's been set up and skip searching for it */
+	const target_addr_t symbol_cbaddr = gdb_symbol_address(GDB_SYMBOL_SEGGER_RTT);
+	if (symbol_cbaddr)
+		rtt_cbaddr = rtt_search(cur_target, symbol_cbaddr, symbol_cbaddr + 16U);
+	/* firmware rarely moves its control block between runs, so next look where it was last */
+	if (!rtt_cbaddr && rtt_last_cbaddr_valid(cur_target))
+		rtt_cbaddr = rtt_search(cur_target, last_cbaddr, last_cbaddr + 16U);
+	if (!rtt_cbaddr && !rtt_flag_ram) {
 		/* search all of target ram */
 		for (const target_ram_s *r = cur_target->ram; r; r = r->next) {
-			const uint32_t ram_start = r->start;
-			const uint32_t ram_end = r->start + r->length;
-			if (rtt_ident[0] == 0)
-				rtt_cbaddr = fast_search(cur_target, ram_start, ram_end);
-			else
-				rtt_cbaddr = memory_search(cur_target, ram_start, ram_end);
+			rtt_cbaddr = rtt_search(cur_target, r->start, r->start + r->length);
 			if (rtt_cbaddr)
 				break;
 		}
-	} else {
+	} else if (!rtt_cbaddr)
 		/* search  only given target address range */
-		if (rtt_ident[0] == 0)
-			rtt_cbaddr = fast_search(cur_target, rtt_ram_start, rtt_ram_end);
-		else
-			rtt_cbaddr = memory_search(cur_target, rtt_ram_start, rtt_ram_end);
-	}
+		rtt_cbaddr = rtt_search(cur_target, rtt_ram_start, rtt_ram_end);
 	DEBUG_INFO("rtt: match at 0x%" PRIx32 "\r\n", rtt_cbaddr);
 
 	if (rtt_cbaddr) {
@@ -208,6 +254,8 @@ static void find_rtt(target_s *const cur_target)
 			return;
 
 		rtt_found = true;
+		last_cbaddr = rtt_cbaddr;
+		last_cbaddr_driver = cur_target->driver;
 		DEBUG_INFO("rtt found\n");
 	}
 }
@@ -232,19 +280,35 @@ static rtt_retval_e read_rtt(target_s *const cur_target, const uint32_t i)
 	if (rtt_channel[i].head >= rtt_channel[i].buf_size || rtt_channel[i].tail >= rtt_channel[i].buf_size)
 		return RTT_ERR;
 
-	/* write recv_buf to target rtt 'down' buf */
-	while (true) {
-		const uint32_t next_head = (rtt_channel[i].head + 1U) % rtt_channel[i].buf_size;
-		if (rtt_channel[i].tail == next_head)
-			break;
-		const int ch = rtt_getchar();
+	/* free space in the target rtt 'down' buf, one slot is always left empty to tell full from empty */
+	const uint32_t head = rtt_channel[i].head;
+	const uint32_t buf_size = rtt_channel[i].buf_size;
+	size_t xmit_size;
+	char *const xmit_buf = rtt_xmit_buf(&xmit_size);
+	const uint32_t space = MIN((rtt_channel[i].tail + buf_size - head - 1U) % buf_size, xmit_size);
+
+	/*
+	 * gather what the host has for us into one chunk, xmit_buf is free for this as the 'up'
+	 * channels are done with it by the time we get here
+	 */
+	uint32_t len = 0;
+	for (; len < space; ++len) {
+		const int32_t ch = rtt_getchar();
 		if (ch == -1)
 			break;
-		if (target_mem_write(cur_target, rtt_channel[i].buf_addr + rtt_channel[i].head, &ch, 1))
-			return RTT_ERR;
-		/* advance head pointer */
-		rtt_channel[i].head = next_head;
+		xmit_buf[len] = (char)ch;
 	}
+	if (len == 0)
+		return RTT_OK;
+
+	/* write chunk to target rtt 'down' buf, in two parts if it wraps round the end */
+	const uint32_t first_len = MIN(len, buf_size - head);
+	if (target_mem_write(cur_target, rtt_channel[i].buf_addr + head, xmit_buf, first_len))
+		return RTT_ERR;
+	if (len > first_len && target_mem_write(cur_target, rtt_channel[i].buf_addr, xmit_buf + first_len, len - first_len))
+		return RTT_ERR;
+	/* advance head pointer */
+	rtt_channel[i].head = (head + len) % buf_size;
 
 	/* update head of target 'down' buffer */
 	const uint32_t head_addr = rtt_cbaddr + 24U + i * 24U + 12U;
@@ -290,7 +354,11 @@ static rtt_retval_e print_rtt(target_s *const cur_target, const uint32_t i)
 	if (rtt_channel[i].head == rtt_channel[i].tail)
 		return RTT_IDLE;
 
-	uint32_t bytes_free = sizeof(xmit_buf) - 8U; /* need 8 bytes for alignment and padding */
+	size_t xmit_size;
+	char *const xmit_buf = rtt_xmit_buf(&xmit_size);
+	if (xmit_size <= 8U)
+		return RTT_IDLE;
+	uint32_t bytes_free = xmit_size - 8U; /* need 8 bytes for alignment and padding */
 	uint32_t bytes_read = 0;
 
 	if (rtt_channel[i].tail > rtt_channel[i].head) {
@@ -314,13 +382,17 @@ static rtt_retval_e print_rtt(target_s *const cur_target, const uint32_t i)
 		rtt_channel[i].tail = (rtt_channel[i].tail + len) % rtt_channel[i].buf_size;
 	}
 
+	/* the transmit buffer filled before we caught up with the head, come straight back for the rest */
+	if (rtt_channel[i].tail != rtt_channel[i].head)
+		rtt_backlog = true;
+
 	/* update tail of target 'up' buffer */
 	const uint32_t tail_addr = rtt_cbaddr + 24U + i * 24U + 16U;
 	if (target_mem_write(cur_target, tail_addr, &rtt_channel[i].tail, sizeof(rtt_channel[i].tail)))
 		return RTT_ERR;
 
 	/* write buffer to usb */
-	rtt_write(xmit_buf, bytes_read);
+	rtt_write(i, xmit_buf, bytes_read);
 
 	return RTT_OK;
 }
@@ -332,7 +404,7 @@ static rtt_retval_e print_rtt(target_s *const cur_target, const uint32_t i)
 **********************************************************************
 */
 
-void poll_rtt(target_s *const cur_target)
+static void rtt_poll(target_s *const cur_target)
 {
 	/* rtt off */
 	if (!cur_target || !rtt_enabled)
@@ -341,46 +413,62 @@ void poll_rtt(target_s *const cur_target)
 	/* target present and rtt enabled */
 	uint32_t now = platform_time_ms();
 
-	if (last_poll_ms + poll_ms <= now || now < last_poll_ms) {
+	if (rtt_backlog || last_poll_ms + poll_ms <= now || now < last_poll_ms) {
+		rtt_backlog = false;
 		if (!rtt_found)
 			/* check if target needs to be halted during memory access */
 			rtt_halt = target_mem_access_needs_halt(cur_target);
 
 		bool resume_target = false;
-		target_addr_t watch;
-		if (rtt_halt && target_halt_poll(cur_target, &watch) == TARGET_HALT_RUNNING) {
+		target_addr_t watch = 0;
+		/*
+		 * Poll for halt alongside the RTT accesses and hand the result to the GDB poll loop,
+		 * which then needn't do its own poll and gets told about any halt we happen to see
+		 */
+		target_halt_reason_e reason = target_halt_poll(cur_target, &watch);
+		if (rtt_halt && reason == TARGET_HALT_RUNNING) {
 			/* briefly halt target during target memory access */
 			target_halt_request(cur_target);
 
-			target_halt_reason_e reason = TARGET_HALT_RUNNING;
+			reason = TARGET_HALT_RUNNING;
 			while (reason == TARGET_HALT_RUNNING)
 				reason = target_halt_poll(cur_target, &watch);
 
 			resume_target = reason == TARGET_HALT_REQUEST;
-		}
+			/* It stopped for some other reason before our request got to it */
+			if (!resume_target)
+				gdb_poll_report(reason, watch);
+		} else
+			gdb_poll_report(reason, watch);
+		/* The target has gone away, leave it to the GDB poll loop to report */
+		if (reason == TARGET_HALT_ERROR)
+			return;
 
 		if (!rtt_found)
 			/* find rtt control block in target memory */
 			find_rtt(cur_target);
 
-		if (rtt_found) {
-			uint32_t cblock_header[6]; // first 24 bytes of control block
-			/* check control block not changed or corrupted */
-			if (target_mem_read(cur_target, cblock_header, rtt_cbaddr, sizeof(cblock_header)) ||
-				memcmp(saved_cblock_header, cblock_header, sizeof(cblock_header)) != 0)
-				rtt_found = false; // force searching control block next poll_rtt()
-		}
-
 		bool rtt_err = false;
 		bool rtt_busy = false;
 		/* do rtt i/o if control block found */
 		if (rtt_found && rtt_cbaddr) {
-			/* copy control block from target */
-			uint32_t rtt_cblock_size = sizeof(rtt_channel[0]) * (rtt_num_up_chan + rtt_num_down_chan);
-			if (target_mem_read(cur_target, rtt_channel, rtt_cbaddr + 24U, rtt_cblock_size)) {
-				gdb_outf("rtt: read fail at 0x%" PRIx32 "\r\n", rtt_cbaddr + 24U);
+			/*
+			 * copy control block from target, header and channel descriptors together in one
+			 * block read so a poll tick costs a single transfer when there is no data to move
+			 */
+			uint32_t cblock[(sizeof(saved_cblock_header) + sizeof(rtt_channel)) / sizeof(uint32_t)];
+			const uint32_t rtt_cblock_size =
+				sizeof(saved_cblock_header) + sizeof(rtt_channel[0]) * (rtt_num_up_chan + rtt_num_down_chan);
+			if (target_mem_read(cur_target, cblock, rtt_cbaddr, rtt_cblock_size)) {
+				gdb_outf("rtt: read fail at 0x%" PRIx32 "\r\n", rtt_cbaddr);
+				rtt_found = false; // force searching control block next poll_rtt()
 				rtt_err = true;
-			} else {
+			} else if (memcmp(saved_cblock_header, cblock, sizeof(saved_cblock_header)) != 0)
+				/* control block changed or corrupted */
+				rtt_found = false; // force searching control block next poll_rtt()
+			else {
+				memcpy(rtt_channel, cblock + 6U, rtt_cblock_size - sizeof(saved_cblock_header));
+				/* up channels whose head hasn't moved are skipped by print_rtt without further reads */
 				for (uint32_t i = 0; i < rtt_num_up_chan + rtt_num_down_chan; i++) {
 					if (rtt_channel_enabled[i]) {
 						rtt_retval_e result;
@@ -429,3 +517,15 @@ void poll_rtt(target_s *const cur_target)
 		}
 	}
 }
+
+bool rtt_poll_busy(void)
+{
+	return rtt_enabled && rtt_found && (rtt_backlog || poll_ms <= rtt_min_poll_ms);
+}
+
+void poll_rtt(target_s *const cur_target)
+{
+	PROBE_STATS_TIME_BEGIN(start);
+	rtt_poll(cur_target);
+	PROBE_STATS_TIME_END(PROBE_STATS_POLL_RTT, start);
+}
@@ -0,0 +1,166 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2026 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Cooperative main loop task scheduler, see include/scheduler.h */
+
+#include "general.h"
+#include "exception.h"
+#include "scheduler.h"
+
+static scheduler_task_s *scheduler_tasks;
+/* Where the last yield left off, so background tasks take turns */
+static scheduler_task_s *scheduler_next_yield;
+static scheduler_task_s *scheduler_current;
+static bool scheduler_in_task;
+static bool scheduler_yield_allowed;
+
+/* Window over which unused link budget can build up into a burst */
+#define SCHEDULER_BURST_MS 16U
+
+uint32_t scheduler_link_budget = 0;
+uint32_t scheduler_gdb_holdoff_ms = 5U;
+/* Bytes the budgeted tasks may still move, negative once overdrawn, and when that was last topped up */
+static int32_t scheduler_link_credit;
+static uint32_t scheduler_link_credit_ms;
+static uint32_t scheduler_gdb_active_ms;
+
+void scheduler_register(scheduler_task_s *const task)
+{
+	/* Append, so tasks run in the order they were registered */
+	scheduler_task_s **tail = &scheduler_tasks;
+	while (*tail) {
+		if (*tail == task)
+			return;
+		tail = &(*tail)->next;
+	}
+	task->next = NULL;
+	task->last_run_ms = platform_time_ms() - task->period_ms;
+	*tail = task;
+}
+
+void scheduler_yield_enable(const bool enable)
+{
+	scheduler_yield_allowed = enable;
+}
+
+void scheduler_gdb_active(void)
+{
+	scheduler_gdb_active_ms = platform_time_ms();
+}
+
+void scheduler_link_charge(const size_t bytes)
+{
+	if (!scheduler_current || !scheduler_current->budgeted || !scheduler_link_budget)
+		return;
+	/* Keep well clear of wrapping on a huge transfer, it only has to be paid back */
+	if (scheduler_link_credit < INT32_MIN / 2)
+		return;
+	scheduler_link_credit -= (int32_t)MIN(bytes, (size_t)INT32_MAX / 2U);
+}
+
+static bool scheduler_link_free(const scheduler_task_s *const task, const uint32_t now)
+{
+	/* GDB goes first, but not to the point of starving the task */
+	if (now - scheduler_gdb_active_ms < scheduler_gdb_holdoff_ms && now - task->last_run_ms < SCHEDULER_STARVE_MS)
+		return false;
+	if (!scheduler_link_budget)
+		return true;
+
+	/* Top the credit up for the time since it was last, to at most a burst's worth */
+	const uint32_t budget = MIN(scheduler_link_budget, SCHEDULER_MAX_LINK_BUDGET);
+	const uint32_t elapsed = MIN(now - scheduler_link_credit_ms, SCHEDULER_BURST_MS);
+	const int32_t burst = (int32_t)(budget * SCHEDULER_BURST_MS);
+	scheduler_link_credit_ms = now;
+	scheduler_link_credit += (int32_t)(budget * elapsed);
+	if (scheduler_link_credit > burst)
+		scheduler_link_credit = burst;
+	return scheduler_link_credit > 0;
+}
+
+static bool scheduler_task_due(const scheduler_task_s *const task, const uint32_t now)
+{
+	if (task->period_ms && now - task->last_run_ms < task->period_ms)
+		return false;
+	return !task->budgeted || scheduler_link_free(task, now);
+}
+
+static void scheduler_task_run(scheduler_task_s *const task, const uint32_t now)
+{
+	task->last_run_ms = now;
+	/*
+	 * Tasks may wait on GDB themselves (a stop reply waits for its ack), so stop
+	 * them re-entering the scheduler, and don't leave it locked if one throws.
+	 */
+	scheduler_in_task = true;
+	scheduler_current = task;
+	volatile exception_s e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		task->run();
+	}
+	scheduler_current = NULL;
+	scheduler_in_task = false;
+	if (e.type) {
+		scheduler_yield_allowed = false;
+		raise_exception(e.type, e.msg);
+	}
+}
+
+void scheduler_run(void)
+{
+	if (scheduler_in_task)
+		return;
+	for (scheduler_task_s *task = scheduler_tasks; task; task = task->next) {
+		const uint32_t now = platform_time_ms();
+		if (scheduler_task_due(task, now))
+			scheduler_task_run(task, now);
+	}
+}
+
+void scheduler_yield(void)
+{
+	if (!scheduler_yield_allowed || scheduler_in_task || !scheduler_tasks)
+		return;
+	const uint32_t now = platform_time_ms();
+	scheduler_task_s *task = scheduler_next_yield ? scheduler_next_yield : scheduler_tasks;
+	/* Walk the list once round from where we left off, running the first due background task */
+	for (scheduler_task_s *const first = task;;) {
+		scheduler_task_s *const next = task->next ? task->next : scheduler_tasks;
+		if (task->background && scheduler_task_due(task, now)) {
+			scheduler_next_yield = next;
+			scheduler_task_run(task, now);
+			return;
+		}
+		task = next;
+		if (task == first)
+			return;
+	}
+}
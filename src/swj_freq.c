@@ -0,0 +1,118 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements the adaptive SWJ frequency mode ("monitor frequency auto"). The interface
+ * starts out at the fastest the platform can do, and every access made by the SWD and JTAG-DP
+ * layers is accounted here. A window with too many parity errors or missing responses steps
+ * the frequency down, while a long enough run of clean windows steps it back up again.
+ */
+
+#include "general.h"
+#include "swj_freq.h"
+
+/* Number of accesses making up one accounting window */
+#define SWJ_FREQ_WINDOW 256U
+/* Errors within a window that make the frequency step down */
+#define SWJ_FREQ_MAX_ERRORS 2U
+/* Clean windows needed before trying the next frequency up */
+#define SWJ_FREQ_CLEAN_WINDOWS 16U
+/* Never step down below this */
+#define SWJ_FREQ_MIN 100000U
+
+static bool swj_freq_adaptive = false;
+static uint32_t swj_freq_ceiling;
+static uint16_t swj_freq_accesses;
+static uint8_t swj_freq_errors;
+static uint8_t swj_freq_clean_windows;
+
+static void swj_freq_window_reset(void)
+{
+	swj_freq_accesses = 0;
+	swj_freq_errors = 0;
+}
+
+bool swj_freq_adaptive_enable(const bool enable)
+{
+	swj_freq_adaptive = false;
+	if (enable) {
+		platform_max_frequency_set(UINT32_MAX);
+		swj_freq_ceiling = platform_max_frequency_get();
+		if (swj_freq_ceiling == FREQ_FIXED)
+			return false;
+		swj_freq_adaptive = true;
+	}
+	swj_freq_window_reset();
+	swj_freq_clean_windows = 0;
+	return true;
+}
+
+bool swj_freq_is_adaptive(void)
+{
+	return swj_freq_adaptive;
+}
+
+static void swj_freq_step(const bool down)
+{
+	const uint32_t frequency = platform_max_frequency_get();
+	uint32_t target;
+	if (down)
+		target = MAX(frequency / 2U, SWJ_FREQ_MIN);
+	else
+		target = MIN(frequency + frequency / 2U, swj_freq_ceiling);
+	if (target == frequency)
+		return;
+	platform_max_frequency_set(target);
+	DEBUG_INFO("Adaptive SWJ frequency stepped %s to %" PRIu32 "Hz\n", down ? "down" : "up",
+		platform_max_frequency_get());
+}
+
+void swj_freq_account(const bool error)
+{
+	if (!swj_freq_adaptive)
+		return;
+	if (error && ++swj_freq_errors >= SWJ_FREQ_MAX_ERRORS) {
+		swj_freq_step(true);
+		swj_freq_window_reset();
+		swj_freq_clean_windows = 0;
+		return;
+	}
+	if (++swj_freq_accesses < SWJ_FREQ_WINDOW)
+		return;
+	if (swj_freq_errors)
+		swj_freq_clean_windows = 0;
+	else if (++swj_freq_clean_windows >= SWJ_FREQ_CLEAN_WINDOWS) {
+		swj_freq_step(false);
+		swj_freq_clean_windows = 0;
+	}
+	swj_freq_window_reset();
+}
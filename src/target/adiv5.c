@@ -45,6 +45,27 @@
 #define ARM_AP_TYPE_AXI  4U
 #define ARM_AP_TYPE_AHB5 5U
 
+/* AP IDR class field, identifying MEM-APs */
+#define ADIV5_AP_IDR_CLASS_SHIFT 13U
+#define ADIV5_AP_IDR_CLASS_MASK  (0xfU << ADIV5_AP_IDR_CLASS_SHIFT)
+#define ADIV5_AP_IDR_CLASS_MEM   (8U << ADIV5_AP_IDR_CLASS_SHIFT)
+
+/* The AP scan reads IDR and BASE for this many APs a batch, and gives up after as many invalid ones in a row */
+#define ADIV5_AP_SCAN_BATCH   8U
+#define ADIV5_AP_SCAN_INVALID 8U
+
+/* Parts whose DP TARGETID pins down how many APs there are, so the scan can stop there */
+typedef struct adiv5_ap_count {
+	uint16_t designer_code;
+	uint16_t partno;
+	uint16_t ap_count;
+} adiv5_ap_count_s;
+
+static const adiv5_ap_count_s adiv5_ap_counts[] = {
+	/* RP2040: each core sits behind its own DP instance, with just the one AHB-AP */
+	{JEP106_MANUFACTURER_RASPBERRY, 0x1002U, 1U},
+};
+
 /* ROM table CIDR values */
 #define CIDR0_OFFSET 0xff0U /* DBGCID0 */
 #define CIDR1_OFFSET 0xff4U /* DBGCID1 */
@@ -133,6 +154,13 @@ typedef enum arm_arch {
 	aa_nosupport,
 	aa_cortexm,
 	aa_cortexa,
+	/* CoreSight debug and trace components handled by coresight.c */
+	aa_etb,
+	aa_tmc,
+	aa_funnel,
+	aa_etm3,
+	aa_etm4,
+	aa_cti,
 	aa_end
 } arm_arch_e;
 
@@ -210,9 +238,9 @@ static const struct {
 	{0x4c7, 0x00, 0, aa_nosupport, cidc_unknown,
 		ARM_COMPONENT_STR("Cortex-M7 PPB", "(Cortex-M7 Private Peripheral Bus ROM Table)")},
 	{0x4c8, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-M7 ROM", "(Cortex-M7 ROM)")},
-	{0x906, 0x14, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight CTI", "(Cross Trigger)")},
-	{0x907, 0x21, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight ETB", "(Trace Buffer)")},
-	{0x908, 0x12, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight CSTF", "(Trace Funnel)")},
+	{0x906, 0x14, 0, aa_cti, cidc_unknown, ARM_COMPONENT_STR("CoreSight CTI", "(Cross Trigger)")},
+	{0x907, 0x21, 0, aa_etb, cidc_unknown, ARM_COMPONENT_STR("CoreSight ETB", "(Trace Buffer)")},
+	{0x908, 0x12, 0, aa_funnel, cidc_unknown, ARM_COMPONENT_STR("CoreSight CSTF", "(Trace Funnel)")},
 	{0x910, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight ETM9", "(Embedded Trace)")},
 	{0x912, 0x11, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight TPIU", "(Trace Port Interface Unit)")},
 	{0x913, 0x00, 0, aa_nosupport, cidc_unknown,
@@ -220,11 +248,11 @@ static const struct {
 	{0x914, 0x11, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight SWO", "(Single Wire Output)")},
 	{0x917, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight HTM", "(AHB Trace Macrocell)")},
 	{0x920, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight ETM11", "(Embedded Trace)")},
-	{0x921, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-A8 ETM", "(Embedded Trace)")},
-	{0x922, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-A8 CTI", "(Cross Trigger)")},
+	{0x921, 0x00, 0, aa_etm3, cidc_unknown, ARM_COMPONENT_STR("Cortex-A8 ETM", "(Embedded Trace)")},
+	{0x922, 0x00, 0, aa_cti, cidc_unknown, ARM_COMPONENT_STR("Cortex-A8 CTI", "(Cross Trigger)")},
 	{0x923, 0x11, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-M3 TPIU", "(Trace Port Interface Unit)")},
-	{0x924, 0x13, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-M3 ETM", "(Embedded Trace)")},
-	{0x925, 0x13, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-M4 ETM", "(Embedded Trace)")},
+	{0x924, 0x13, 0, aa_etm3, cidc_unknown, ARM_COMPONENT_STR("Cortex-M3 ETM", "(Embedded Trace)")},
+	{0x925, 0x13, 0, aa_etm3, cidc_unknown, ARM_COMPONENT_STR("Cortex-M4 ETM", "(Embedded Trace)")},
 	{0x930, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-R4 ETM", "(Embedded Trace)")},
 	{0x932, 0x31, 0x0a31, aa_nosupport, cidc_unknown,
 		ARM_COMPONENT_STR("CoreSight MTB-M0+", "(Simple Execution Trace)")},
@@ -234,18 +262,18 @@ static const struct {
 		ARM_COMPONENT_STR("CoreSight Component", "(unidentified Cortex-A9 component)")},
 	{0x955, 0x00, 0, aa_nosupport, cidc_unknown,
 		ARM_COMPONENT_STR("CoreSight Component", "(unidentified Cortex-A5 component)")},
-	{0x956, 0x13, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-A7 ETM", "(Embedded Trace)")},
-	{0x95f, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-A15 PTM", "(Program Trace Macrocell)")},
-	{0x961, 0x32, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight TMC", "(Trace Memory Controller)")},
-	{0x961, 0x21, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight TMC", "(Trace Buffer)")},
+	{0x956, 0x13, 0, aa_etm3, cidc_unknown, ARM_COMPONENT_STR("Cortex-A7 ETM", "(Embedded Trace)")},
+	{0x95f, 0x00, 0, aa_etm3, cidc_unknown, ARM_COMPONENT_STR("Cortex-A15 PTM", "(Program Trace Macrocell)")},
+	{0x961, 0x32, 0, aa_tmc, cidc_unknown, ARM_COMPONENT_STR("CoreSight TMC", "(Trace Memory Controller)")},
+	{0x961, 0x21, 0, aa_tmc, cidc_unknown, ARM_COMPONENT_STR("CoreSight TMC", "(Trace Buffer)")},
 	{0x962, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight STM", "(System Trace Macrocell)")},
 	{0x963, 0x63, 0x0a63, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight STM", "(System Trace Macrocell)")},
-	{0x975, 0x13, 0x4a13, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-M7 ETM", "(Embedded Trace)")},
+	{0x975, 0x13, 0x4a13, aa_etm4, cidc_unknown, ARM_COMPONENT_STR("Cortex-M7 ETM", "(Embedded Trace)")},
 	{0x9a0, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("CoreSight PMU", "(Performance Monitoring Unit)")},
 	{0x9a1, 0x11, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-M4 TPIU", "(Trace Port Interface Unit)")},
-	{0x9a6, 0x14, 0x1a14, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M0+ CTI", "(Cross Trigger Interface)")},
+	{0x9a6, 0x14, 0x1a14, aa_cti, cidc_dc, ARM_COMPONENT_STR("Cortex-M0+ CTI", "(Cross Trigger Interface)")},
 	{0x9a9, 0x11, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-M7 TPIU", "(Trace Port Interface Unit)")},
-	{0x9a5, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-A5 ETM", "(Embedded Trace)")},
+	{0x9a5, 0x00, 0, aa_etm3, cidc_unknown, ARM_COMPONENT_STR("Cortex-A5 ETM", "(Embedded Trace)")},
 	{0x9a7, 0x16, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-A7 PMU", "(Performance Monitor Unit)")},
 	{0x9af, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Cortex-A15 PMU", "(Performance Monitor Unit)")},
 	{0xc05, 0x00, 0, aa_cortexa, cidc_dc, ARM_COMPONENT_STR("Cortex-A5 Debug", "(Debug Unit)")},
@@ -257,24 +285,24 @@ static const struct {
 	{0xcd0, 0x00, 0, aa_nosupport, cidc_unknown, ARM_COMPONENT_STR("Atmel DSU", "(Device Service Unit)")},
 	{0xd20, 0x00, 0x2a04, aa_cortexm, cidc_gipc, ARM_COMPONENT_STR("Cortex-M23", "(System Control Space)")},
 	{0xd20, 0x11, 0, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M23", "(Trace Port Interface Unit)")},
-	{0xd20, 0x13, 0, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M23", "(Embedded Trace)")},
+	{0xd20, 0x13, 0, aa_etm4, cidc_dc, ARM_COMPONENT_STR("Cortex-M23", "(Embedded Trace)")},
 	{0xd20, 0x31, 0x0a31, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M23", "(Micro Trace Buffer)")},
 	{0xd20, 0x00, 0x1a02, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M23", "(Data Watchpoint and Trace)")},
 	{0xd20, 0x00, 0x1a03, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M23", "(Breakpoint Unit)")},
-	{0xd20, 0x14, 0x1a14, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M23", "(Cross Trigger)")},
+	{0xd20, 0x14, 0x1a14, aa_cti, cidc_dc, ARM_COMPONENT_STR("Cortex-M23", "(Cross Trigger)")},
 	{0xd21, 0x00, 0x2a04, aa_cortexm, cidc_gipc, ARM_COMPONENT_STR("Cortex-M33", "(System Control Space)")},
 	{0xd21, 0x31, 0x0a31, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Micro Trace Buffer)")},
 	{0xd21, 0x43, 0x1a01, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Instrumentation Trace Macrocell)")},
 	{0xd21, 0x00, 0x1a02, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Data Watchpoint and Trace)")},
 	{0xd21, 0x00, 0x1a03, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Breakpoint Unit)")},
-	{0xd21, 0x14, 0x1a14, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Cross Trigger)")},
-	{0xd21, 0x13, 0x4a13, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Embedded Trace)")},
+	{0xd21, 0x14, 0x1a14, aa_cti, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Cross Trigger)")},
+	{0xd21, 0x13, 0x4a13, aa_etm4, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Embedded Trace)")},
 	{0xd21, 0x11, 0, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("Cortex-M33", "(Trace Port Interface Unit)")},
 	{0x132, 0x31, 0x0a31, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("STAR-MC1 MTB", "(Execution Trace)")},
 	{0x132, 0x43, 0x1a01, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("STAR-MC1 ITM", "(Instrumentation Trace Module)")},
 	{0x132, 0x00, 0x1a02, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("STAR-MC1 DWT", "(Data Watchpoint and Trace)")},
 	{0x132, 0x00, 0x1a03, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("STAR-MC1 BPU", "(Breakpoint Unit)")},
-	{0x132, 0x14, 0x1a14, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("STAR-MC1 CTI", "(Cross Trigger)")},
+	{0x132, 0x14, 0x1a14, aa_cti, cidc_dc, ARM_COMPONENT_STR("STAR-MC1 CTI", "(Cross Trigger)")},
 	{0x132, 0x00, 0x2a04, aa_cortexm, cidc_dc, ARM_COMPONENT_STR("STAR-MC1 SCS", "(System Control Space)")},
 	{0x132, 0x13, 0x4a13, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("STAR-MC1 ETM", "(Embedded Trace)")},
 	{0x132, 0x11, 0, aa_nosupport, cidc_dc, ARM_COMPONENT_STR("STAR-MC1 TPIU", "(Trace Port Interface Unit)")},
@@ -295,14 +323,14 @@ void adiv5_ap_ref(adiv5_access_port_s *ap)
 static void adiv5_dp_unref(adiv5_debug_port_s *dp)
 {
 	if (--(dp->refcnt) == 0)
-		free(dp);
+		target_arena_free(dp);
 }
 
 void adiv5_ap_unref(adiv5_access_port_s *ap)
 {
 	if (--(ap->refcnt) == 0) {
 		adiv5_dp_unref(ap->dp);
-		free(ap);
+		target_arena_free(ap);
 	}
 }
 
@@ -313,21 +341,33 @@ static uint32_t adiv5_mem_read32(adiv5_access_port_s *ap, uint32_t addr)
 	return ret;
 }
 
-static uint32_t adiv5_ap_read_id(adiv5_access_port_s *ap, uint32_t addr)
+/* ID registers each hold one byte of the ID in their low 8 bits, assemble 4 of them into a word */
+static uint32_t adiv5_decode_id(const uint8_t *const data)
 {
 	uint32_t res = 0;
-	uint8_t data[16];
-	adiv5_mem_read(ap, data, addr, sizeof(data));
 	for (size_t i = 0; i < 4U; ++i)
-		res |= (data[4U * i] << (i * 8U));
+		res |= (uint32_t)data[4U * i] << (i * 8U);
 	return res;
 }
 
 uint64_t adiv5_ap_read_pidr(adiv5_access_port_s *ap, uint32_t addr)
 {
-	uint64_t pidr = adiv5_ap_read_id(ap, addr + PIDR4_OFFSET);
-	pidr = pidr << 32U | adiv5_ap_read_id(ap, addr + PIDR0_OFFSET);
-	return pidr;
+	/* PIDR4-7 are directly followed by PIDR0-3, so read them all in one go */
+	uint8_t data[32];
+	adiv5_mem_read(ap, data, addr + PIDR4_OFFSET, sizeof(data));
+	return (uint64_t)adiv5_decode_id(data) << 32U | adiv5_decode_id(data + (PIDR0_OFFSET - PIDR4_OFFSET));
+}
+
+/*
+ * A component's PIDR4-7, PIDR0-3 and CIDR0-3 registers fill the window from 0xfd0 to 0xfff,
+ * so fetch it in a single block transfer and decode the IDs locally
+ */
+static uint64_t adiv5_ap_read_component_ids(adiv5_access_port_s *const ap, const uint32_t addr, uint32_t *const cidr)
+{
+	uint8_t data[48];
+	adiv5_mem_read(ap, data, addr + PIDR4_OFFSET, sizeof(data));
+	*cidr = adiv5_decode_id(data + (CIDR0_OFFSET - PIDR4_OFFSET));
+	return (uint64_t)adiv5_decode_id(data) << 32U | adiv5_decode_id(data + (PIDR0_OFFSET - PIDR4_OFFSET));
 }
 
 /* Halt CortexM
@@ -351,6 +391,7 @@ static uint32_t cortexm_initial_halt(adiv5_access_port_s *ap)
 		/* ap_mem_access_setup() sets ADIV5_AP_CSW_ADDRINC_SINGLE -> unusable!*/
 		adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
 		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
+		adiv5_ap_shadow_invalidate(ap);
 	}
 
 	/* Workaround for CMSIS-DAP Bulk orbtrace
@@ -401,6 +442,34 @@ static uint32_t cortexm_initial_halt(adiv5_access_port_s *ap)
 	return 0;
 }
 
+/*
+ * Fast attach while nRST is held asserted: request the halt and arm the reset vector catch in a
+ * single batched sequence, without the retry loop of cortexm_initial_halt(). Returns the DHCSR
+ * value read back, or 0 if the debug logic is not answering yet and the slow path has to be used.
+ */
+static uint32_t cortexm_reset_catch_setup(adiv5_access_port_s *const ap)
+{
+	const uint32_t dhcsr_ctl = CORTEXM_DHCSR_DBGKEY | CORTEXM_DHCSR_C_DEBUGEN | CORTEXM_DHCSR_C_HALT;
+	const uint32_t demcr = CORTEXM_DEMCR_TRCENA | CORTEXM_DEMCR_VC_HARDERR | CORTEXM_DEMCR_VC_CORERESET;
+	uint32_t dhcsr = 0;
+	adiv5_queue_entry_s entries[12];
+	adiv5_queue_s queue;
+	adiv5_queue_init(&queue, ap->dp, entries, ARRAY_LENGTH(entries));
+	adiv5_queue_mem_read32(&queue, ap, CORTEXM_DEMCR, &ap->ap_cortexm_demcr);
+	adiv5_queue_mem_write32(&queue, ap, CORTEXM_DHCSR, dhcsr_ctl);
+	adiv5_queue_mem_write32(&queue, ap, CORTEXM_DEMCR, demcr);
+	adiv5_queue_mem_read32(&queue, ap, CORTEXM_DHCSR, &dhcsr);
+	if (!adiv5_queue_run(&queue)) {
+		adiv5_dp_error(ap->dp);
+		return 0;
+	}
+	/* Same plausibility check as cortexm_initial_halt(), and the core must be seen held in reset */
+	if (dhcsr == 0xffffffffU || (dhcsr & 0xf000fff0U) || !(dhcsr & CORTEXM_DHCSR_C_DEBUGEN) ||
+		!(dhcsr & CORTEXM_DHCSR_S_RESET_ST))
+		return 0;
+	return dhcsr;
+}
+
 /* Prepare to read SYSROM and SYSROM PIDR
  *
  * Try hard to halt, if not connecting under reset
@@ -425,7 +494,20 @@ static bool cortexm_prepare(adiv5_access_port_s *ap)
 #if PC_HOSTED == 1 || ENABLE_DEBUG == 1
 	uint32_t start_time = platform_time_ms();
 #endif
-	uint32_t dhcsr = cortexm_initial_halt(ap);
+	uint32_t dhcsr = connect_assert_nrst ? cortexm_reset_catch_setup(ap) : 0;
+	if (dhcsr) {
+		/* Release reset; the vector catch halts the core as soon as it leaves reset */
+		platform_nrst_set_val(false);
+		if (!adiv5_mem_poll32(ap, CORTEXM_DHCSR, CORTEXM_DHCSR_S_RESET_ST | CORTEXM_DHCSR_S_HALT,
+				CORTEXM_DHCSR_S_HALT, cortexm_wait_timeout, &dhcsr)) {
+			DEBUG_WARN("Error releasing from reset\n");
+			return false;
+		}
+		DEBUG_INFO("Halt via reset catch(%08" PRIx32 "): success after %" PRId32 "ms\n", dhcsr,
+			platform_time_ms() - start_time);
+		return true;
+	}
+	dhcsr = cortexm_initial_halt(ap);
 	if (!dhcsr) {
 		DEBUG_WARN("Halt via DHCSR(%08" PRIx32 "): failure after %" PRId32 "ms\nTry again, evt. with longer "
 				   "timeout or connect under reset\n",
@@ -461,6 +543,86 @@ static cid_class_e adiv5_class_from_cid(const uint16_t part_number, const uint16
 	return cid_class;
 }
 
+/*
+ * Discovery cache: the ROM table walk of each AP is remembered as the list of debuggable and trace
+ * components it found, keyed by the DP's IDCODE and TARGETID and the AP's IDR and BASE. On a later
+ * scan of the same AP only those components' ID registers are read back, and if they all still match,
+ * their probes are run directly instead of walking the whole ROM table again.
+ */
+#if PC_HOSTED == 1
+#define ADIV5_DISCOVERY_CACHE_ENTRIES    16U
+#define ADIV5_DISCOVERY_CACHE_COMPONENTS 8U
+#else
+#define ADIV5_DISCOVERY_CACHE_ENTRIES    4U
+#define ADIV5_DISCOVERY_CACHE_COMPONENTS 4U
+#endif
+
+typedef struct adiv5_discovery_component {
+	uint32_t addr;
+	uint32_t cidr;
+	uint64_t pidr;
+	arm_arch_e arch;
+} adiv5_discovery_component_s;
+
+typedef struct adiv5_discovery_entry {
+	bool valid;
+	bool overflow;
+	uint32_t dp_idcode;
+	uint32_t dp_targetid;
+	uint8_t apsel;
+	uint32_t ap_idr;
+	uint32_t ap_base;
+	uint16_t designer_code;
+	uint16_t partno;
+	uint8_t component_count;
+	adiv5_discovery_component_s components[ADIV5_DISCOVERY_CACHE_COMPONENTS];
+} adiv5_discovery_entry_s;
+
+static adiv5_discovery_entry_s adiv5_discovery_cache[ADIV5_DISCOVERY_CACHE_ENTRIES];
+static size_t adiv5_discovery_next;
+/* The entry the ROM table walk in progress is being recorded into */
+static adiv5_discovery_entry_s *adiv5_discovery_recording;
+
+static void adiv5_discovery_record(const uint32_t addr, const uint32_t cidr, const uint64_t pidr, const arm_arch_e arch)
+{
+	adiv5_discovery_entry_s *const entry = adiv5_discovery_recording;
+	if (!entry)
+		return;
+	if (entry->component_count == ADIV5_DISCOVERY_CACHE_COMPONENTS) {
+		entry->overflow = true;
+		return;
+	}
+	adiv5_discovery_component_s *const component = &entry->components[entry->component_count++];
+	component->addr = addr;
+	component->cidr = cidr;
+	component->pidr = pidr;
+	component->arch = arch;
+}
+
+/* Note a component for the 'etb' command and for cross triggering, keeping to the first few found */
+static void adiv5_coresight_record(adiv5_access_port_s *const ap, const uint32_t addr, const arm_arch_e arch)
+{
+	adiv5_debug_port_s *const dp = ap->dp;
+	if (dp->coresight_count == ADIV5_CORESIGHT_COMPONENTS)
+		return;
+	static const adiv5_coresight_kind_e kinds[] = {
+		[aa_cortexm] = ADIV5_CORESIGHT_CORE,
+		[aa_cortexa] = ADIV5_CORESIGHT_CORE,
+		[aa_etb] = ADIV5_CORESIGHT_ETB,
+		[aa_tmc] = ADIV5_CORESIGHT_TMC,
+		[aa_funnel] = ADIV5_CORESIGHT_FUNNEL,
+		[aa_etm3] = ADIV5_CORESIGHT_ETM3,
+		[aa_etm4] = ADIV5_CORESIGHT_ETM4,
+		[aa_cti] = ADIV5_CORESIGHT_CTI,
+	};
+	dp->coresight[dp->coresight_count++] = (adiv5_coresight_component_s){
+		.addr = addr,
+		.csw = ap->csw,
+		.apsel = ap->apsel,
+		.kind = kinds[arch],
+	};
+}
+
 /*
  * Return true if we find a debuggable device.
  * NOLINTNEXTLINE(misc-no-recursion) */
@@ -473,7 +635,8 @@ static void adiv5_component_probe(
 	if (addr == 0)       /* No rom table on this AP */
 		return;
 
-	const volatile uint32_t cidr = adiv5_ap_read_id(ap, addr + CIDR0_OFFSET);
+	uint32_t cidr = 0;
+	const uint64_t pidr = adiv5_ap_read_component_ids(ap, addr, &cidr);
 	if (ap->dp->fault) {
 		DEBUG_WARN("CIDR read timeout on AP%d, aborting.\n", ap->apsel);
 		return;
@@ -503,7 +666,6 @@ static void adiv5_component_probe(
 
 	/* Extract Component ID class nibble */
 	const uint32_t cid_class = (cidr & CID_CLASS_MASK) >> CID_CLASS_SHIFT;
-	const uint64_t pidr = adiv5_ap_read_pidr(ap, addr);
 
 	uint16_t designer_code;
 	if (pidr & PIDR_JEP106_USED) {
@@ -541,6 +703,8 @@ static void adiv5_component_probe(
 					 * Handle it here, as access only to limited memory region
 					 * is allowed
 					 */
+					adiv5_discovery_record(addr, cidr, pidr, aa_cortexm);
+					adiv5_coresight_record(ap, addr, aa_cortexm);
 					cortexm_probe(ap);
 					return;
 				}
@@ -619,6 +783,10 @@ static void adiv5_component_probe(
 				DEBUG_WARN("%sWARNING: \"%s\" expected, got \"%s\"\n", indent + 1,
 					cidc_debug_strings[arm_component_lut[i].cidc], cidc_debug_strings[adjusted_class]);
 
+			if (arm_component_lut[i].arch != aa_nosupport) {
+				adiv5_discovery_record(addr, cidr, pidr, arm_component_lut[i].arch);
+				adiv5_coresight_record(ap, addr, arm_component_lut[i].arch);
+			}
 			switch (arm_component_lut[i].arch) {
 			case aa_cortexm:
 				DEBUG_INFO("%s-> cortexm_probe\n", indent + 1);
@@ -643,15 +811,89 @@ static void adiv5_component_probe(
 	}
 }
 
-adiv5_access_port_s *adiv5_new_ap(adiv5_debug_port_s *dp, uint8_t apsel)
+static adiv5_discovery_entry_s *adiv5_discovery_lookup(
+	const adiv5_access_port_s *const ap, const uint32_t dp_idcode, const uint32_t dp_targetid)
+{
+	for (size_t i = 0; i < ADIV5_DISCOVERY_CACHE_ENTRIES; ++i) {
+		adiv5_discovery_entry_s *const entry = &adiv5_discovery_cache[i];
+		if (entry->valid && entry->dp_idcode == dp_idcode && entry->dp_targetid == dp_targetid &&
+			entry->apsel == ap->apsel && entry->ap_idr == ap->idr && entry->ap_base == ap->base)
+			return entry;
+	}
+	return NULL;
+}
+
+/* Re-validate a cached walk by reading back each component's ID registers, then run their probes */
+static bool adiv5_discovery_replay(adiv5_access_port_s *const ap, const adiv5_discovery_entry_s *const entry)
+{
+	for (size_t i = 0; i < entry->component_count; ++i) {
+		const adiv5_discovery_component_s *const component = &entry->components[i];
+		uint32_t cidr = 0;
+		const uint64_t pidr = adiv5_ap_read_component_ids(ap, component->addr, &cidr);
+		if (adiv5_dp_error(ap->dp) || cidr != component->cidr || pidr != component->pidr) {
+			DEBUG_INFO("AP %3u: Cached components changed, walking the ROM table\n", ap->apsel);
+			return false;
+		}
+	}
+
+	DEBUG_INFO("AP %3u: Using %u cached component(s)\n", ap->apsel, entry->component_count);
+	ap->designer_code = entry->designer_code;
+	ap->partno = entry->partno;
+	for (size_t i = 0; i < entry->component_count; ++i) {
+		const adiv5_discovery_component_s *const component = &entry->components[i];
+		adiv5_coresight_record(ap, component->addr, component->arch);
+		if (component->arch == aa_cortexm)
+			cortexm_probe(ap);
+		else if (component->arch == aa_cortexa)
+			cortexa_probe(ap, component->addr);
+	}
+	return true;
+}
+
+static void adiv5_ap_discover(adiv5_access_port_s *const ap, const uint32_t dp_idcode, const uint32_t dp_targetid)
+{
+	/* Only a MEM-AP whose BASE says there are debug entries has a ROM table to walk */
+	if ((ap->idr & ADIV5_AP_IDR_CLASS_MASK) != ADIV5_AP_IDR_CLASS_MEM ||
+		(ap->base & (ADIV5_AP_BASE_FORMAT | ADIV5_AP_BASE_PRESENT)) == ADIV5_AP_BASE_FORMAT)
+		return;
+
+	adiv5_discovery_entry_s *entry = adiv5_discovery_lookup(ap, dp_idcode, dp_targetid);
+	if (entry && adiv5_discovery_replay(ap, entry))
+		return;
+
+	/* Walk the ROM table, recording what it turns up over the old entry or the next free one */
+	if (!entry) {
+		entry = &adiv5_discovery_cache[adiv5_discovery_next];
+		adiv5_discovery_next = (adiv5_discovery_next + 1U) % ADIV5_DISCOVERY_CACHE_ENTRIES;
+	}
+	memset(entry, 0, sizeof(*entry));
+	adiv5_discovery_recording = entry;
+	adiv5_component_probe(ap, ap->base, 0, 0);
+	adiv5_discovery_recording = NULL;
+
+	/* Only a complete, fault-free walk can stand in for the next one */
+	if (entry->overflow || ap->dp->fault || !entry->component_count)
+		return;
+	entry->dp_idcode = dp_idcode;
+	entry->dp_targetid = dp_targetid;
+	entry->apsel = ap->apsel;
+	entry->ap_idr = ap->idr;
+	entry->ap_base = ap->base;
+	entry->designer_code = ap->designer_code;
+	entry->partno = ap->partno;
+	entry->valid = true;
+}
+
+/* Set up an AP given the IDR and BASE values already read from it, returning NULL if it's not usable */
+static adiv5_access_port_s *adiv5_new_ap_probed(
+	adiv5_debug_port_s *const dp, const uint8_t apsel, const uint32_t idr, const uint32_t base)
 {
 	adiv5_access_port_s tmpap;
-	/* Assume valid and try to read IDR */
 	memset(&tmpap, 0, sizeof(tmpap));
 	tmpap.dp = dp;
 	tmpap.apsel = apsel;
-	tmpap.idr = adiv5_ap_read(&tmpap, ADIV5_AP_IDR);
-	tmpap.base = adiv5_ap_read(&tmpap, ADIV5_AP_BASE);
+	tmpap.idr = idr;
+	tmpap.base = base;
 	/*
 	 * Check the Debug Base Address register. See ADIv5
 	 * Specification C2.6.1
@@ -674,10 +916,21 @@ adiv5_access_port_s *adiv5_new_ap(adiv5_debug_port_s *dp, uint8_t apsel)
 		return NULL;
 	}
 
+	/*
+	 * Packed transfer support is implementation defined, and is indicated by AddrInc reading back
+	 * as packed after being set so. Restore the original CSW afterwards.
+	 */
+	if ((tmpap.idr & ADIV5_AP_IDR_CLASS_MASK) == ADIV5_AP_IDR_CLASS_MEM) {
+		adiv5_ap_write(&tmpap, ADIV5_AP_CSW, tmpap.csw | ADIV5_AP_CSW_ADDRINC_PACKED | ADIV5_AP_CSW_SIZE_BYTE);
+		const uint32_t csw = adiv5_ap_read(&tmpap, ADIV5_AP_CSW);
+		tmpap.packed_transfers = (csw & ADIV5_AP_CSW_ADDRINC_MASK) == ADIV5_AP_CSW_ADDRINC_PACKED;
+		adiv5_ap_write(&tmpap, ADIV5_AP_CSW, tmpap.csw);
+	}
+
 	/* It's valid to so create a heap copy */
-	adiv5_access_port_s *ap = malloc(sizeof(*ap));
-	if (!ap) { /* malloc failed: heap exhaustion */
-		DEBUG_WARN("malloc: failed in %s\n", __func__);
+	adiv5_access_port_s *ap = target_arena_calloc(sizeof(*ap));
+	if (!ap) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return NULL;
 	}
 
@@ -693,6 +946,55 @@ adiv5_access_port_s *adiv5_new_ap(adiv5_debug_port_s *dp, uint8_t apsel)
 	return ap;
 }
 
+adiv5_access_port_s *adiv5_new_ap(adiv5_debug_port_s *dp, uint8_t apsel)
+{
+	adiv5_access_port_s tmpap;
+	/* Assume valid and try to read IDR */
+	memset(&tmpap, 0, sizeof(tmpap));
+	tmpap.dp = dp;
+	tmpap.apsel = apsel;
+	const uint32_t idr = adiv5_ap_read(&tmpap, ADIV5_AP_IDR);
+	const uint32_t base = adiv5_ap_read(&tmpap, ADIV5_AP_BASE);
+	return adiv5_new_ap_probed(dp, apsel, idr, base);
+}
+
+/* How many APs there are to scan for on this DP, which TARGETID can narrow down for known parts */
+static size_t adiv5_dp_ap_count(const adiv5_debug_port_s *const dp)
+{
+	if (dp->version >= 2U) {
+		for (size_t i = 0; i < ARRAY_LENGTH(adiv5_ap_counts); ++i) {
+			const adiv5_ap_count_s *const entry = &adiv5_ap_counts[i];
+			if (entry->designer_code == dp->target_designer_code && entry->partno == dp->target_partno)
+				return entry->ap_count;
+		}
+	}
+	return 256U;
+}
+
+/*
+ * Read IDR and BASE for a run of APs in one batch. Returns false if anything faulted, in which case
+ * the run gets probed an AP at a time instead as it may well be an absent AP that's faulting.
+ */
+static bool adiv5_ap_scan_batch(adiv5_debug_port_s *const dp, const size_t first, const size_t count,
+	uint32_t *const idr, uint32_t *const base)
+{
+	adiv5_access_port_s aps[ADIV5_AP_SCAN_BATCH];
+	adiv5_queue_entry_s entries[ADIV5_AP_SCAN_BATCH * 2U];
+	adiv5_queue_s queue;
+	memset(aps, 0, sizeof(aps));
+	adiv5_queue_init(&queue, dp, entries, ARRAY_LENGTH(entries));
+	for (size_t i = 0; i < count; ++i) {
+		aps[i].dp = dp;
+		aps[i].apsel = first + i;
+		adiv5_queue_ap_read(&queue, &aps[i], ADIV5_AP_IDR, &idr[i]);
+		adiv5_queue_ap_read(&queue, &aps[i], ADIV5_AP_BASE, &base[i]);
+	}
+	if (adiv5_queue_run(&queue))
+		return true;
+	adiv5_dp_error(dp);
+	return false;
+}
+
 /* No real AP on RP2040. Special setup.*/
 static void rp_rescue_setup(adiv5_debug_port_s *dp)
 {
@@ -732,13 +1034,14 @@ void adiv5_dp_init(adiv5_debug_port_s *dp, const uint32_t idcode)
 	 */
 	volatile uint32_t dpidr = 0;
 	volatile exception_s e;
+	adiv5_dp_shadow_invalidate(dp);
 	TRY_CATCH (e, EXCEPTION_ALL) {
 		if (idcode != JTAG_IDCODE_ARM_DPv0)
 			dpidr = adiv5_dp_read(dp, ADIV5_DP_DPIDR);
 	}
-	if (e.type) {
+	if (e.type || dp->fault) {
 		DEBUG_WARN("DP not responding!...\n");
-		free(dp);
+		target_arena_free(dp);
 		return;
 	}
 
@@ -782,11 +1085,13 @@ void adiv5_dp_init(adiv5_debug_port_s *dp, const uint32_t idcode)
 	 */
 	adiv5_dp_clear_sticky_errors(dp);
 
+	volatile uint32_t targetid = 0;
 	if (dp->version >= 2) {
 		/* TARGETID is on bank 2 */
 		adiv5_dp_write(dp, ADIV5_DP_SELECT, ADIV5_DP_BANK2);
-		const uint32_t targetid = adiv5_dp_read(dp, ADIV5_DP_TARGETID);
+		targetid = adiv5_dp_read(dp, ADIV5_DP_TARGETID);
 		adiv5_dp_write(dp, ADIV5_DP_SELECT, ADIV5_DP_BANK0);
+		adiv5_dp_shadow_invalidate(dp);
 
 		/* Use TARGETID register to identify target */
 		const uint16_t tdesigner = (targetid & ADIV5_DP_TARGETID_TDESIGNER_MASK) >> ADIV5_DP_TARGETID_TDESIGNER_OFFSET;
@@ -813,6 +1118,11 @@ void adiv5_dp_init(adiv5_debug_port_s *dp, const uint32_t idcode)
 	dp->ap_read = firmware_ap_read;
 	dp->mem_read = advi5_mem_read_bytes;
 	dp->mem_write = adiv5_mem_write_bytes;
+	/* Bit-banged SWD can stream block transfers under overrun detection */
+	if (dp->low_access == firmware_swdp_low_access) {
+		dp->mem_read = firmware_swdp_mem_read;
+		dp->mem_write = firmware_swdp_mem_write;
+	}
 #if PC_HOSTED == 1
 	platform_adiv5_dp_defaults(dp);
 #endif
@@ -839,7 +1149,7 @@ void adiv5_dp_init(adiv5_debug_port_s *dp, const uint32_t idcode)
 			break;
 		if (platform_timeout_is_expired(&timeout)) {
 			DEBUG_INFO("DEBUG Power-Up failed\n");
-			free(dp); /* No AP that referenced this DP so long*/
+			target_arena_free(dp); /* No AP that referenced this DP so long*/
 			return;
 		}
 	}
@@ -866,15 +1176,34 @@ void adiv5_dp_init(adiv5_debug_port_s *dp, const uint32_t idcode)
 	adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, ctrlstat & ~ADIV5_DP_CTRLSTAT_CDBGRSTREQ);
 
 	/* Probe for APs on this DP */
+	const size_t ap_count = adiv5_dp_ap_count(dp);
+	if (ap_count != 256U)
+		DEBUG_INFO("Part has %zu AP(s)\n", ap_count);
+	uint32_t idr[ADIV5_AP_SCAN_BATCH];
+	uint32_t base[ADIV5_AP_SCAN_BATCH];
+	bool batched = false;
 	size_t invalid_aps = 0;
 	dp->refcnt++;
-	for (size_t i = 0; i < 256U && invalid_aps < 8U; ++i) {
+	for (size_t i = 0; i < ap_count && invalid_aps < ADIV5_AP_SCAN_INVALID; ++i) {
+		const size_t slot = i % ADIV5_AP_SCAN_BATCH;
+		if (!slot) {
+			const size_t count = MIN(ap_count - i, ADIV5_AP_SCAN_BATCH);
+#if PC_HOSTED == 1
+			/* Probes needing per-AP setup can't batch, so they get every AP probed one by one */
+			batched = !dp->ap_setup && adiv5_ap_scan_batch(dp, i, count, idr, base);
+#else
+			batched = adiv5_ap_scan_batch(dp, i, count, idr, base);
+#endif
+		}
 		adiv5_access_port_s *ap = NULL;
+		if (batched)
+			ap = adiv5_new_ap_probed(dp, i, idr[slot], base[slot]);
 #if PC_HOSTED == 1
-		if ((!dp->ap_setup) || dp->ap_setup(i))
+		else if ((!dp->ap_setup) || dp->ap_setup(i))
 			ap = adiv5_new_ap(dp, i);
 #else
-		ap = adiv5_new_ap(dp, i);
+		else
+			ap = adiv5_new_ap(dp, i);
 #endif
 		if (ap == NULL) {
 			/* Clear sticky errors in case scanning for this AP triggered any */
@@ -886,7 +1215,7 @@ void adiv5_dp_init(adiv5_debug_port_s *dp, const uint32_t idcode)
 			/* We have probably found all APs on this DP so no need to keep looking.
 			 * Continue with rest of init function down below.
 			 */
-			if (++invalid_aps == 8)
+			if (++invalid_aps == ADIV5_AP_SCAN_INVALID)
 				break;
 
 			continue;
@@ -904,7 +1233,7 @@ void adiv5_dp_init(adiv5_debug_port_s *dp, const uint32_t idcode)
 		 */
 
 		/* The rest should only be added after checking ROM table */
-		adiv5_component_probe(ap, ap->base, 0, 0);
+		adiv5_ap_discover(ap, dpidr ? dpidr : idcode, targetid);
 		adiv5_ap_unref(ap);
 	}
 	/* We halted at least CortexM for Romtable scan.
@@ -922,10 +1251,45 @@ void adiv5_dp_init(adiv5_debug_port_s *dp, const uint32_t idcode)
 
 #define ALIGNOF(x) (((x)&3U) == 0 ? ALIGN_WORD : (((x)&1U) == 0 ? ALIGN_HALFWORD : ALIGN_BYTE))
 
+static bool adiv5_ap_shadow_valid(const adiv5_access_port_s *const ap, const uint8_t shadow)
+{
+	return !ap->dp->fault && ap->shadow_generation == ap->dp->shadow_generation && (ap->shadow_valid & shadow);
+}
+
+static void adiv5_ap_shadow_set(adiv5_access_port_s *const ap, const uint8_t shadow, const uint32_t value)
+{
+	/* Shadows taken against an older generation are stale, so start over */
+	if (ap->shadow_generation != ap->dp->shadow_generation) {
+		ap->shadow_valid = 0;
+		ap->shadow_generation = ap->dp->shadow_generation;
+	}
+	if (ap->dp->fault) {
+		ap->shadow_valid &= ~shadow;
+		return;
+	}
+	if (shadow == ADIV5_AP_SHADOW_CSW)
+		ap->shadow_csw = value;
+	else
+		ap->shadow_tar = value;
+	ap->shadow_valid |= shadow;
+}
+
+/* Point SELECT at the AP register bank holding addr, unless it already is */
+static void adiv5_ap_select(adiv5_access_port_s *const ap, const uint16_t addr)
+{
+	adiv5_debug_port_s *const dp = ap->dp;
+	const uint32_t select = ((uint32_t)ap->apsel << 24U) | (addr & 0xf0U);
+	if (dp->select_valid && dp->select == select && !dp->fault)
+		return;
+	adiv5_dp_recoverable_access(dp, ADIV5_LOW_WRITE, ADIV5_DP_SELECT, select);
+	dp->select = select;
+	dp->select_valid = !dp->fault;
+}
+
 /* Program the CSW and TAR for sequential access at a given width */
-void ap_mem_access_setup(adiv5_access_port_s *ap, uint32_t addr, align_e align)
+static void adiv5_ap_mem_setup(adiv5_access_port_s *ap, uint32_t addr, align_e align, uint32_t addrinc)
 {
-	uint32_t csw = ap->csw | ADIV5_AP_CSW_ADDRINC_SINGLE;
+	uint32_t csw = ap->csw | addrinc;
 
 	switch (align) {
 	case ALIGN_BYTE:
@@ -939,8 +1303,43 @@ void ap_mem_access_setup(adiv5_access_port_s *ap, uint32_t addr, align_e align)
 		csw |= ADIV5_AP_CSW_SIZE_WORD;
 		break;
 	}
-	adiv5_ap_write(ap, ADIV5_AP_CSW, csw);
-	adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, addr);
+	/* Skip the CSW and TAR writes if the AP already holds the values we want */
+	if (adiv5_ap_shadow_valid(ap, ADIV5_AP_SHADOW_CSW) && ap->shadow_csw == csw)
+		adiv5_ap_select(ap, ADIV5_AP_TAR);
+	else
+		adiv5_ap_write(ap, ADIV5_AP_CSW, csw);
+	if (!adiv5_ap_shadow_valid(ap, ADIV5_AP_SHADOW_TAR) || ap->shadow_tar != addr) {
+		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, addr);
+		adiv5_ap_shadow_set(ap, ADIV5_AP_SHADOW_TAR, addr);
+	}
+}
+
+void ap_mem_access_setup(adiv5_access_port_s *ap, uint32_t addr, align_e align)
+{
+	adiv5_ap_mem_setup(ap, addr, align, ADIV5_AP_CSW_ADDRINC_SINGLE);
+}
+
+/*
+ * As above, but in packed mode: each DRW access is split by the AP into a word's worth of accesses
+ * at the given width, with the data in the byte lanes matching their addresses. Only valid when
+ * adiv5_mem_packed() says so, and the transfer starts word aligned.
+ */
+void ap_mem_access_setup_packed(adiv5_access_port_s *ap, uint32_t addr, align_e align)
+{
+	adiv5_ap_mem_setup(ap, addr, align, ADIV5_AP_CSW_ADDRINC_PACKED);
+}
+
+/*
+ * Record where TAR was left by an auto-incrementing transfer that ended at next_addr, having last
+ * written TAR with block_addr. Auto-increment is only guaranteed within a 1KiB block, so if the
+ * transfer ran up to the end of the block TAR is left in an unknown state.
+ */
+static void adiv5_ap_shadow_tar_advance(adiv5_access_port_s *ap, const uint32_t block_addr, const uint32_t next_addr)
+{
+	if (ap->dp->fault || ((next_addr ^ block_addr) & 0xfffffc00U))
+		ap->shadow_valid &= ~ADIV5_AP_SHADOW_TAR;
+	else
+		adiv5_ap_shadow_set(ap, ADIV5_AP_SHADOW_TAR, next_addr);
 }
 
 /* Unpack data from the source uint32_t value based on data alignment and source address */
@@ -1010,13 +1409,14 @@ const void *adiv5_pack_data(const uint32_t dest, const void *const src, uint32_t
 	return (const uint8_t *)src + (1 << align);
 }
 
-void advi5_mem_read_bytes(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len)
+/*
+ * Read len bytes, which must be a multiple of the access width, using a single pipelined run of DRW reads.
+ * SW-DP AP reads are posted, so each DRW read returns the result of the one before it and the last value
+ * is collected from RDBUFF. TAR only auto-increments within a 1KiB block, so it is rewritten on crossing one.
+ */
+static void adiv5_mem_read_pipelined(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len, align_e align)
 {
 	uint32_t osrc = src;
-	const align_e align = MIN(ALIGNOF(src), ALIGNOF(len));
-
-	if (len == 0)
-		return;
 
 	len >>= align;
 	ap_mem_access_setup(ap, src, align);
@@ -1035,20 +1435,45 @@ void advi5_mem_read_bytes(adiv5_access_port_s *ap, void *dest, uint32_t src, siz
 	}
 	const uint32_t value = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
 	adiv5_unpack_data(dest, src, value, align);
+	adiv5_ap_shadow_tar_advance(ap, osrc, src + (1U << align));
+}
+
+void advi5_mem_read_bytes(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len)
+{
+	/*
+	 * Rather than dropping the whole read to the narrowest width the start address and length allow,
+	 * split it into a narrow unaligned head, a word-wide body and a narrow tail so the bulk of
+	 * the data moves in one pipelined run of word accesses.
+	 */
+	while (len) {
+		const align_e align = MIN(ALIGNOF(src), len >= 4U ? ALIGN_WORD : ALIGNOF(len));
+		const size_t amount = align == ALIGN_WORD ? len & ~3U : 1U << align;
+		adiv5_mem_read_pipelined(ap, dest, src, amount, align);
+		dest = (uint8_t *)dest + amount;
+		src += amount;
+		len -= amount;
+	}
 }
 
 void adiv5_mem_write_bytes(adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len, align_e align)
 {
 	uint32_t odest = dest;
-
-	len >>= align;
-	ap_mem_access_setup(ap, dest, align);
+	/* Narrow writes move a word per DRW access in packed mode, leaving any partial word for afterwards */
+	const bool packed = adiv5_mem_packed(ap, dest, len, align);
+	const align_e step = packed ? ALIGN_WORD : align;
+	const size_t tail = packed ? len & 3U : 0U;
+
+	len >>= step;
+	if (packed)
+		ap_mem_access_setup_packed(ap, dest, align);
+	else
+		ap_mem_access_setup(ap, dest, align);
 	while (len--) {
 		uint32_t value = 0;
-		src = adiv5_pack_data(dest, src, &value, align);
+		src = adiv5_pack_data(dest, src, &value, step);
 		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, value);
 
-		dest += 1U << align;
+		dest += 1U << step;
 		/* Check for 10 bit address overflow */
 		if ((dest ^ odest) & 0xfffffc00U) {
 			odest = dest;
@@ -1057,26 +1482,262 @@ void adiv5_mem_write_bytes(adiv5_access_port_s *ap, uint32_t dest, const void *s
 	}
 	/* Make sure this write is complete by doing a dummy read */
 	adiv5_dp_read(ap->dp, ADIV5_DP_RDBUFF);
+	/* The final address increment crossing into a new block isn't followed by a TAR write */
+	adiv5_ap_shadow_tar_advance(ap, odest, dest);
+	if (tail)
+		adiv5_mem_write_bytes(ap, dest, src, tail, align);
 }
 
 void firmware_ap_write(adiv5_access_port_s *ap, uint16_t addr, uint32_t value)
 {
-	adiv5_dp_recoverable_access(
-		ap->dp, ADIV5_LOW_WRITE, ADIV5_DP_SELECT, ((uint32_t)ap->apsel << 24U) | (addr & 0xf0U));
+	/* Writing CSW with the value it already holds is a no-op, so elide it */
+	if (addr == ADIV5_AP_CSW && adiv5_ap_shadow_valid(ap, ADIV5_AP_SHADOW_CSW) && ap->shadow_csw == value) {
+		adiv5_ap_select(ap, addr);
+		return;
+	}
+	adiv5_ap_select(ap, addr);
 	adiv5_dp_write(ap->dp, addr, value);
+
+	if (addr == ADIV5_AP_CSW)
+		adiv5_ap_shadow_set(ap, ADIV5_AP_SHADOW_CSW, value);
+	else if (addr == ADIV5_AP_TAR)
+		adiv5_ap_shadow_set(ap, ADIV5_AP_SHADOW_TAR, value);
+	else if (addr == ADIV5_AP_DRW)
+		ap->shadow_valid &= ~ADIV5_AP_SHADOW_TAR;
 }
 
 uint32_t firmware_ap_read(adiv5_access_port_s *ap, uint16_t addr)
 {
-	uint32_t ret;
-	adiv5_dp_recoverable_access(
-		ap->dp, ADIV5_LOW_WRITE, ADIV5_DP_SELECT, ((uint32_t)ap->apsel << 24U) | (addr & 0xf0U));
-	ret = adiv5_dp_read(ap->dp, addr);
+	adiv5_ap_select(ap, addr);
+	const uint32_t ret = adiv5_dp_read(ap->dp, addr);
+	if (addr == ADIV5_AP_DRW)
+		ap->shadow_valid &= ~ADIV5_AP_SHADOW_TAR;
 	return ret;
 }
 
+/*
+ * Register access queues let driver code describe a run of DP and AP accesses up front so they can be
+ * issued back to back: consecutive reads from the same AP register bank are pipelined through the
+ * posted read mechanism rather than each paying for a trailing RDBUFF read, and the SELECT write is
+ * only issued when the bank changes. The queue runs itself when full, so callers can enqueue as much
+ * as they like and then call adiv5_queue_run() to flush the remainder and check for faults.
+ */
+void adiv5_queue_init(adiv5_queue_s *const queue, adiv5_debug_port_s *const dp, adiv5_queue_entry_s *const entries,
+	const size_t size)
+{
+	queue->dp = dp;
+	queue->entries = entries;
+	queue->size = size;
+	queue->count = 0;
+}
+
+static void adiv5_queue_add(adiv5_queue_s *const queue, adiv5_access_port_s *const ap, const uint8_t rnw,
+	const uint16_t addr, const uint32_t value, uint32_t *const result)
+{
+	if (queue->count == queue->size)
+		adiv5_queue_run(queue);
+	adiv5_queue_entry_s *const entry = &queue->entries[queue->count++];
+	entry->ap = ap;
+	entry->addr = addr;
+	entry->rnw = rnw;
+	entry->value = value;
+	entry->result = result;
+	entry->mask = 0;
+}
+
+void adiv5_queue_dp_read(adiv5_queue_s *const queue, const uint16_t addr, uint32_t *const result)
+{
+	adiv5_queue_add(queue, NULL, ADIV5_LOW_READ, addr, 0, result);
+}
+
+void adiv5_queue_dp_write(adiv5_queue_s *const queue, const uint16_t addr, const uint32_t value)
+{
+	adiv5_queue_add(queue, NULL, ADIV5_LOW_WRITE, addr, value, NULL);
+}
+
+void adiv5_queue_ap_read(
+	adiv5_queue_s *const queue, adiv5_access_port_s *const ap, const uint16_t addr, uint32_t *const result)
+{
+	adiv5_queue_add(queue, ap, ADIV5_LOW_READ, addr, 0, result);
+}
+
+void adiv5_queue_ap_write(
+	adiv5_queue_s *const queue, adiv5_access_port_s *const ap, const uint16_t addr, const uint32_t value)
+{
+	adiv5_queue_add(queue, ap, ADIV5_LOW_WRITE, addr, value, NULL);
+}
+
+/*
+ * Queue a wait for an AP register to read back as value under mask before the accesses after it,
+ * such as for a debug register's ready flag. Backends that can retry the read probe-side (CMSIS-DAP
+ * value matching) do so at no cost in round trips. The other runners skip it, as their per-access
+ * overhead already outlasts the few core cycles such flags take to settle.
+ */
+void adiv5_queue_ap_match(adiv5_queue_s *const queue, adiv5_access_port_s *const ap, const uint16_t addr,
+	const uint32_t mask, const uint32_t value)
+{
+	adiv5_queue_add(queue, ap, ADIV5_LOW_READ, addr, value, NULL);
+	queue->entries[queue->count - 1U].mask = mask;
+}
+
+/*
+ * Queue a single 32-bit target memory access through the AP. CSW is set up the same way as for a
+ * regular memory access, so it costs nothing when it already holds that value.
+ */
+static void adiv5_queue_mem_setup(adiv5_queue_s *const queue, adiv5_access_port_s *const ap, const uint32_t addr)
+{
+	adiv5_queue_ap_write(queue, ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_ADDRINC_SINGLE | ADIV5_AP_CSW_SIZE_WORD);
+	adiv5_queue_ap_write(queue, ap, ADIV5_AP_TAR, addr);
+}
+
+void adiv5_queue_mem_read32(
+	adiv5_queue_s *const queue, adiv5_access_port_s *const ap, const uint32_t src, uint32_t *const result)
+{
+	adiv5_queue_mem_setup(queue, ap, src);
+	adiv5_queue_ap_read(queue, ap, ADIV5_AP_DRW, result);
+}
+
+void adiv5_queue_mem_write32(
+	adiv5_queue_s *const queue, adiv5_access_port_s *const ap, const uint32_t dest, const uint32_t value)
+{
+	adiv5_queue_mem_setup(queue, ap, dest);
+	adiv5_queue_ap_write(queue, ap, ADIV5_AP_DRW, value);
+}
+
+/* Fallback for DPs whose AP accesses are handled by a backend, one access at a time through its hooks */
+static void adiv5_queue_run_sequential(adiv5_queue_s *const queue)
+{
+	adiv5_debug_port_s *const dp = queue->dp;
+	for (size_t idx = 0; idx < queue->count && !dp->fault; ++idx) {
+		const adiv5_queue_entry_s *const entry = &queue->entries[idx];
+		if (entry->mask)
+			continue;
+		if (entry->rnw == ADIV5_LOW_READ)
+			*entry->result = entry->ap ? adiv5_ap_read(entry->ap, entry->addr) : adiv5_dp_read(dp, entry->addr);
+		else if (entry->ap)
+			adiv5_ap_write(entry->ap, entry->addr, entry->value);
+		else
+			adiv5_dp_write(dp, entry->addr, entry->value);
+	}
+}
+
+static void adiv5_queue_run_pipelined(adiv5_queue_s *const queue)
+{
+	adiv5_debug_port_s *const dp = queue->dp;
+	/* AP read whose result has not been clocked out of the DP yet */
+	const adiv5_queue_entry_s *pending = NULL;
+	for (size_t idx = 0; idx < queue->count && !dp->fault; ++idx) {
+		const adiv5_queue_entry_s *const entry = &queue->entries[idx];
+		if (entry->mask)
+			continue;
+		const bool ap_read = entry->ap && entry->rnw == ADIV5_LOW_READ;
+		/*
+		 * A pending read can only be chained into the next one if that is an AP read that needs
+		 * no SELECT change, otherwise collect the result from RDBUFF first.
+		 */
+		if (pending &&
+			(!ap_read || entry->ap != pending->ap || (entry->addr & 0xf0U) != (pending->addr & 0xf0U))) {
+			*pending->result = adiv5_dp_low_access(dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
+			pending = NULL;
+			if (dp->fault)
+				break;
+		}
+
+		if (ap_read) {
+			if (!pending)
+				adiv5_ap_select(entry->ap, entry->addr);
+			const uint32_t value = adiv5_dp_low_access(dp, ADIV5_LOW_READ, entry->addr, 0);
+			if (pending)
+				*pending->result = value;
+			pending = entry;
+			if (entry->addr == ADIV5_AP_DRW)
+				entry->ap->shadow_valid &= ~ADIV5_AP_SHADOW_TAR;
+		} else if (entry->ap)
+			firmware_ap_write(entry->ap, entry->addr, entry->value);
+		else if (entry->rnw == ADIV5_LOW_READ)
+			*entry->result = adiv5_dp_read(dp, entry->addr);
+		else {
+			adiv5_dp_write(dp, entry->addr, entry->value);
+			if (entry->addr == ADIV5_DP_SELECT)
+				dp->select_valid = false;
+		}
+	}
+	if (pending && !dp->fault)
+		*pending->result = adiv5_dp_low_access(dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
+}
+
+/* Issue all queued accesses, returning false if any of them faulted */
+bool adiv5_queue_run(adiv5_queue_s *const queue)
+{
+	if (queue->dp->run_queue)
+		queue->dp->run_queue(queue);
+	else if (queue->dp->ap_read == firmware_ap_read)
+		adiv5_queue_run_pipelined(queue);
+	else
+		adiv5_queue_run_sequential(queue);
+	queue->count = 0;
+	return !queue->dp->fault;
+}
+
+/*
+ * Read the 32-bit value at addr until its masked value matches, for at most timeout_ms. Returns
+ * false on timeout or fault, leaving the last value read in result either way.
+ */
+bool adiv5_mem_poll32(adiv5_access_port_s *const ap, const uint32_t addr, const uint32_t mask, const uint32_t value,
+	const uint32_t timeout_ms, uint32_t *const result)
+{
+	if (ap->dp->mem_poll32)
+		return ap->dp->mem_poll32(ap, addr, mask, value, timeout_ms, result);
+
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, timeout_ms);
+	while (true) {
+		adiv5_mem_read(ap, result, addr, sizeof(*result));
+		if (ap->dp->fault)
+			return false;
+		if ((*result & mask) == value)
+			return true;
+		if (platform_timeout_is_expired(&timeout))
+			return false;
+	}
+}
+
+/*
+ * Write len bytes of data out in loop->stride sized pieces, following each with the optional
+ * command write and a wait for the status register to match. Returns false on the first timeout
+ * or fault, leaving the last status value read in status either way.
+ */
+bool adiv5_mem_write_loop(adiv5_access_port_s *const ap, const uint32_t dest, const void *const src, const size_t len,
+	const align_e align, const adiv5_mem_write_loop_s *const loop, uint32_t *const status)
+{
+	if (ap->dp->mem_write_loop)
+		return ap->dp->mem_write_loop(ap, dest, src, len, align, loop, status);
+
+	const uint8_t *const data = (const uint8_t *)src;
+	for (size_t offset = 0; offset < len; offset += loop->stride) {
+		adiv5_mem_write_sized(ap, dest + offset, data + offset, MIN(loop->stride, len - offset), align);
+		if (loop->cmd_addr)
+			adiv5_mem_write_sized(ap, loop->cmd_addr, &loop->cmd_value, sizeof(loop->cmd_value), ALIGN_WORD);
+		if (!adiv5_mem_poll32(ap, loop->status_addr, loop->status_mask, loop->status_value, loop->timeout_ms, status))
+			return false;
+	}
+	return true;
+}
+
 void adiv5_mem_write(adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len)
 {
-	align_e align = MIN(ALIGNOF(dest), ALIGNOF(len));
-	adiv5_mem_write_sized(ap, dest, src, len, align);
+	/*
+	 * As for reads, split mixed-alignment writes into a narrow head, one word-wide burst and a narrow tail.
+	 * Callers that need a specific access width (e.g. Flash programming) use adiv5_mem_write_sized() directly.
+	 */
+	while (len) {
+		const align_e align = MIN(ALIGNOF(dest), len >= 4U ? ALIGN_WORD : ALIGNOF(len));
+		const size_t amount = align == ALIGN_WORD ? len & ~3U : 1U << align;
+		adiv5_mem_write_sized(ap, dest, src, amount, align);
+		if (ap->dp->fault)
+			return;
+		src = (const uint8_t *)src + amount;
+		dest += amount;
+		len -= amount;
+	}
 }
@@ -153,6 +153,7 @@
 /* AP Debug Base Address Register (BASE) */
 #define ADIV5_AP_BASE_BASEADDR UINT32_C(0xfffff000)
 #define ADIV5_AP_BASE_PRESENT  (1U << 0U)
+#define ADIV5_AP_BASE_FORMAT   (1U << 1U)
 
 /* ADIv5 Class 0x1 ROM Table Registers */
 #define ADIV5_ROM_MEMTYPE          0xfccU
@@ -178,6 +179,8 @@
 #define SWDP_ACK_WAIT        0x02U
 #define SWDP_ACK_FAULT       0x04U
 #define SWDP_ACK_NO_RESPONSE 0x07U
+/* Not an ACK: the DP fault left by a parity error or invalid ACK, which takes protocol recovery to clear */
+#define ADIV5_FAULT_PROTOCOL 0x08U
 
 typedef enum align {
 	ALIGN_BYTE = 0,
@@ -188,6 +191,40 @@ typedef enum align {
 
 typedef struct adiv5_access_port adiv5_access_port_s;
 typedef struct adiv5_debug_port adiv5_debug_port_s;
+typedef struct adiv5_queue adiv5_queue_s;
+
+/* A Flash programming loop for adiv5_mem_write_loop(): each stride of data is followed by a status poll */
+typedef struct adiv5_mem_write_loop {
+	uint32_t stride;
+	/* Optional command register write after each stride, skipped if cmd_addr is 0 */
+	uint32_t cmd_addr;
+	uint32_t cmd_value;
+	uint32_t status_addr;
+	uint32_t status_mask;
+	uint32_t status_value;
+	/* How long each status poll may take */
+	uint32_t timeout_ms;
+} adiv5_mem_write_loop_s;
+
+/* CoreSight debug and trace components found in the ROM tables of a DP's APs, see coresight.c */
+#define ADIV5_CORESIGHT_COMPONENTS 12U
+
+typedef enum adiv5_coresight_kind {
+	ADIV5_CORESIGHT_ETB,    /* CoreSight ETB */
+	ADIV5_CORESIGHT_TMC,    /* Trace Memory Controller, used as an ETB or ETF */
+	ADIV5_CORESIGHT_FUNNEL, /* CoreSight trace funnel (CSTF) */
+	ADIV5_CORESIGHT_ETM3,   /* ETMv3 or PTM, programmed through the ETMv3 register model */
+	ADIV5_CORESIGHT_ETM4,   /* ETMv4 */
+	ADIV5_CORESIGHT_CTI,    /* Cross Trigger Interface */
+	ADIV5_CORESIGHT_CORE,   /* A Cortex-M SCS or Cortex-A debug unit, for pairing cores with their CTIs */
+} adiv5_coresight_kind_e;
+
+typedef struct adiv5_coresight_component {
+	uint32_t addr;
+	uint32_t csw; /* CSW of the AP the component sits behind */
+	uint8_t apsel;
+	adiv5_coresight_kind_e kind;
+} adiv5_coresight_component_s;
 
 /* Try to keep this somewhat absract for later adding SW-DP */
 struct adiv5_debug_port {
@@ -214,6 +251,14 @@ struct adiv5_debug_port {
 
 	void (*mem_read)(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len);
 	void (*mem_write)(adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len, align_e align);
+	/* Optional backend hook to run a queue of register accesses in as few round trips as possible */
+	void (*run_queue)(adiv5_queue_s *queue);
+	/* Optional backend hook to wait for a memory location to match without a round trip per read */
+	bool (*mem_poll32)(adiv5_access_port_s *ap, uint32_t addr, uint32_t mask, uint32_t value, uint32_t timeout_ms,
+		uint32_t *result);
+	/* Optional backend hook to run a whole Flash programming loop without a round trip per stride */
+	bool (*mem_write_loop)(adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len, align_e align,
+		const adiv5_mem_write_loop_s *loop, uint32_t *status);
 	uint8_t dp_jd_index;
 	uint8_t fault;
 
@@ -232,8 +277,26 @@ struct adiv5_debug_port {
 	/* TARGETID designer and partno, present on DPv2 */
 	uint16_t target_designer_code;
 	uint16_t target_partno;
+
+	/*
+	 * Shadow copy of the SELECT register, used to elide redundant writes.
+	 * shadow_generation is bumped whenever the shadows might be stale (errors, aborts) so that
+	 * the AP CSW and TAR shadows taken against an older generation are discarded too.
+	 */
+	bool select_valid;
+	uint32_t select;
+	uint32_t shadow_generation;
+
+	adiv5_coresight_component_s coresight[ADIV5_CORESIGHT_COMPONENTS];
+	uint8_t coresight_count;
+	bool trace_capturing;
+	/* coresight[] bits of the CTIs joined into the cross-triggered halt group */
+	uint16_t halt_group;
 };
 
+#define ADIV5_AP_SHADOW_CSW (1U << 0U)
+#define ADIV5_AP_SHADOW_TAR (1U << 1U)
+
 struct adiv5_access_port {
 	int refcnt;
 
@@ -249,10 +312,50 @@ struct adiv5_access_port {
 	/* AP designer and partno */
 	uint16_t designer_code;
 	uint16_t partno;
+
+	/* CSW.AddrInc accepts packed mode, so narrow accesses can be moved a word at a time */
+	bool packed_transfers;
+
+	/* Shadow copies of CSW and TAR, valid per the ADIV5_AP_SHADOW_* flags and matching DP shadow_generation */
+	uint8_t shadow_valid;
+	uint32_t shadow_generation;
+	uint32_t shadow_csw;
+	uint32_t shadow_tar;
+};
+
+/* A single queued DP or AP register access, see adiv5_queue_run() */
+typedef struct adiv5_queue_entry {
+	adiv5_access_port_s *ap; /* NULL for DP register accesses */
+	uint16_t addr;
+	uint8_t rnw;
+	uint32_t value;   /* Value to write, or to wait for when mask is set */
+	uint32_t *result; /* Where to store the value read */
+	uint32_t mask;    /* Non-zero for a wait on the register, see adiv5_queue_ap_match() */
+} adiv5_queue_entry_s;
+
+/* A batch of register accesses against a single DP, backed by caller provided storage */
+struct adiv5_queue {
+	adiv5_debug_port_s *dp;
+	adiv5_queue_entry_s *entries;
+	size_t size;
+	size_t count;
 };
 
 uint8_t make_packet_request(uint8_t RnW, uint16_t addr);
 
+/* Discard the SELECT shadow of a DP along with the CSW and TAR shadows of all its APs */
+static inline void adiv5_dp_shadow_invalidate(adiv5_debug_port_s *dp)
+{
+	dp->select_valid = false;
+	++dp->shadow_generation;
+}
+
+/* Discard the CSW and TAR shadows of an AP, needed after accessing TAR or DRW behind the AP layer's back */
+static inline void adiv5_ap_shadow_invalidate(adiv5_access_port_s *ap)
+{
+	ap->shadow_valid = 0;
+}
+
 #if PC_HOSTED == 0
 static inline uint32_t adiv5_dp_read(adiv5_debug_port_s *dp, uint16_t addr)
 {
@@ -261,6 +364,7 @@ static inline uint32_t adiv5_dp_read(adiv5_debug_port_s *dp, uint16_t addr)
 
 static inline uint32_t adiv5_dp_error(adiv5_debug_port_s *dp)
 {
+	adiv5_dp_shadow_invalidate(dp);
 	return dp->error(dp, false);
 }
 
@@ -271,6 +375,7 @@ static inline uint32_t adiv5_dp_low_access(adiv5_debug_port_s *dp, uint8_t RnW,
 
 static inline void adiv5_dp_abort(adiv5_debug_port_s *dp, uint32_t abort)
 {
+	adiv5_dp_shadow_invalidate(dp);
 	return dp->abort(dp, abort);
 }
 
@@ -321,6 +426,7 @@ static inline uint32_t adiv5_dp_recoverable_access(adiv5_debug_port_s *dp, uint8
 		/* Wait the response period, then clear the error */
 		swd_proc.seq_in_parity(&response, 32);
 		DEBUG_WARN("Recovering and re-trying access\n");
+		adiv5_dp_shadow_invalidate(dp);
 		dp->error(dp, true);
 		return dp->low_access(dp, RnW, addr, value);
 	}
@@ -347,13 +453,37 @@ void *adiv5_unpack_data(void *dest, uint32_t src, uint32_t val, align_e align);
 const void *adiv5_pack_data(uint32_t dest, const void *src, uint32_t *data, align_e align);
 
 void ap_mem_access_setup(adiv5_access_port_s *ap, uint32_t addr, align_e align);
+void ap_mem_access_setup_packed(adiv5_access_port_s *ap, uint32_t addr, align_e align);
+
+/* Whether a narrow access run can be moved in packed mode, a word's worth of accesses per DRW access */
+static inline bool adiv5_mem_packed(const adiv5_access_port_s *const ap, const uint32_t addr, const size_t len,
+	const align_e align)
+{
+	return ap->packed_transfers && align < ALIGN_WORD && !(addr & 3U) && len >= 4U;
+}
 void adiv5_mem_write_bytes(adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len, align_e align);
 void advi5_mem_read_bytes(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len);
 void firmware_ap_write(adiv5_access_port_s *ap, uint16_t addr, uint32_t value);
 uint32_t firmware_ap_read(adiv5_access_port_s *ap, uint16_t addr);
+
+void adiv5_queue_init(adiv5_queue_s *queue, adiv5_debug_port_s *dp, adiv5_queue_entry_s *entries, size_t size);
+void adiv5_queue_dp_read(adiv5_queue_s *queue, uint16_t addr, uint32_t *result);
+void adiv5_queue_dp_write(adiv5_queue_s *queue, uint16_t addr, uint32_t value);
+void adiv5_queue_ap_read(adiv5_queue_s *queue, adiv5_access_port_s *ap, uint16_t addr, uint32_t *result);
+void adiv5_queue_ap_write(adiv5_queue_s *queue, adiv5_access_port_s *ap, uint16_t addr, uint32_t value);
+void adiv5_queue_ap_match(adiv5_queue_s *queue, adiv5_access_port_s *ap, uint16_t addr, uint32_t mask, uint32_t value);
+bool adiv5_queue_run(adiv5_queue_s *queue);
+void adiv5_queue_mem_read32(adiv5_queue_s *queue, adiv5_access_port_s *ap, uint32_t src, uint32_t *result);
+void adiv5_queue_mem_write32(adiv5_queue_s *queue, adiv5_access_port_s *ap, uint32_t dest, uint32_t value);
+bool adiv5_mem_poll32(adiv5_access_port_s *ap, uint32_t addr, uint32_t mask, uint32_t value, uint32_t timeout_ms,
+	uint32_t *result);
+bool adiv5_mem_write_loop(adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len, align_e align,
+	const adiv5_mem_write_loop_s *loop, uint32_t *status);
 uint32_t firmware_swdp_low_access(adiv5_debug_port_s *dp, uint8_t RnW, uint16_t addr, uint32_t value);
 uint32_t fw_adiv5_jtagdp_low_access(adiv5_debug_port_s *dp, uint8_t RnW, uint16_t addr, uint32_t value);
 uint32_t firmware_swdp_read(adiv5_debug_port_s *dp, uint16_t addr);
+void firmware_swdp_mem_read(adiv5_access_port_s *ap, void *dest, uint32_t src, size_t len);
+void firmware_swdp_mem_write(adiv5_access_port_s *ap, uint32_t dest, const void *src, size_t len, align_e align);
 uint32_t fw_adiv5_jtagdp_read(adiv5_debug_port_s *dp, uint16_t addr);
 
 uint32_t firmware_swdp_error(adiv5_debug_port_s *dp, bool protocol_recovery);
@@ -361,4 +491,10 @@ uint32_t firmware_swdp_error(adiv5_debug_port_s *dp, bool protocol_recovery);
 void firmware_swdp_abort(adiv5_debug_port_s *dp, uint32_t abort);
 void adiv5_jtagdp_abort(adiv5_debug_port_s *dp, uint32_t abort);
 
+void adiv5_jtagdp_multi_write(adiv5_debug_port_s *const *dps, size_t count, uint16_t addr, const uint32_t *values);
+void adiv5_jtagdp_multi_read(adiv5_debug_port_s *const *dps, size_t count, uint16_t addr, uint32_t *results);
+void adiv5_jtagdp_multi_mem_write32(
+	adiv5_access_port_s *const *aps, size_t count, uint32_t dest, const uint32_t *values);
+void adiv5_jtagdp_multi_mem_read32(adiv5_access_port_s *const *aps, size_t count, uint32_t src, uint32_t *results);
+
 #endif /* TARGET_ADIV5_H */
@@ -25,9 +25,12 @@
 #include "general.h"
 #include "exception.h"
 #include "adiv5.h"
+#include "target.h"
+#include "target_internal.h"
 #include "jtag_scan.h"
 #include "jtagtap.h"
 #include "morse.h"
+#include "swj_freq.h"
 
 #define JTAGDP_ACK_OK   0x02U
 #define JTAGDP_ACK_WAIT 0x01U
@@ -41,7 +44,7 @@ static uint32_t adiv5_jtagdp_error(adiv5_debug_port_s *dp, bool protocol_recover
 
 void adiv5_jtag_dp_handler(uint8_t jd_index)
 {
-	adiv5_debug_port_s *dp = calloc(1, sizeof(*dp));
+	adiv5_debug_port_s *dp = target_arena_calloc(sizeof(*dp));
 	if (!dp) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
@@ -84,13 +87,13 @@ uint32_t fw_adiv5_jtagdp_low_access(adiv5_debug_port_s *dp, uint8_t RnW, uint16_
 	uint32_t result;
 	uint8_t ack;
 
-	jtag_dev_write_ir(dp->dp_jd_index, APnDP ? IR_APACC : IR_DPACC);
-
 	platform_timeout_s timeout;
 	platform_timeout_set(&timeout, 250);
 	do {
 		uint64_t response;
-		jtag_dev_shift_dr(dp->dp_jd_index, (uint8_t *)&response, (uint8_t *)&request, 35);
+		/* Only the first attempt has to load the IR, so retries on WAIT are plain DR scans */
+		jtag_dev_shift_ir_dr(dp->dp_jd_index, APnDP ? IR_APACC : IR_DPACC, (uint8_t *)&response,
+			(const uint8_t *)&request, 35);
 		result = response >> 3U;
 		ack = response & 0x07U;
 	} while (!platform_timeout_is_expired(&timeout) && ack == JTAGDP_ACK_WAIT);
@@ -102,9 +105,12 @@ uint32_t fw_adiv5_jtagdp_low_access(adiv5_debug_port_s *dp, uint8_t RnW, uint16_
 		return 0;
 	}
 
+	/* JTAG has no parity, so an invalid ACK is the one sign of a line error */
+	swj_freq_account(ack != JTAGDP_ACK_OK);
 	if (ack != JTAGDP_ACK_OK) {
 		DEBUG_WARN("JTAG access resulted in: %" PRIx32 ":%x\n", result, ack);
-		raise_exception(EXCEPTION_ERROR, "JTAG-DP invalid ACK");
+		dp->fault = ADIV5_FAULT_PROTOCOL;
+		return 0;
 	}
 
 	return result;
@@ -113,6 +119,111 @@ uint32_t fw_adiv5_jtagdp_low_access(adiv5_debug_port_s *dp, uint8_t RnW, uint16_
 void adiv5_jtagdp_abort(adiv5_debug_port_s *dp, uint32_t abort)
 {
 	uint64_t request = (uint64_t)abort << 3U;
-	jtag_dev_write_ir(dp->dp_jd_index, IR_ABORT);
-	jtag_dev_shift_dr(dp->dp_jd_index, NULL, (const uint8_t *)&request, 35);
+	jtag_dev_shift_ir_dr(dp->dp_jd_index, IR_ABORT, NULL, (const uint8_t *)&request, 35);
+}
+
+/*
+ * Carry the same kind of access to several JTAG-DPs on the chain in one IR scan and one DR scan,
+ * each DP being sent its own value. Like fw_adiv5_jtagdp_low_access(), each result is what the DP
+ * returned for its previous access. Any DP that answers WAIT is retried on its own.
+ */
+static void adiv5_jtagdp_multi_scan(adiv5_debug_port_s *const *const dps, const size_t count, const uint8_t RnW,
+	const uint16_t addr, const uint32_t *const values, uint32_t *const results)
+{
+	const bool APnDP = addr & ADIV5_APnDP;
+	uint32_t ir[JTAG_MAX_DEVS];
+	uint64_t request[JTAG_MAX_DEVS];
+	uint64_t response[JTAG_MAX_DEVS];
+	uint8_t cycles[JTAG_MAX_DEVS] = {0};
+
+	for (size_t device = 0; device < jtag_dev_count; ++device)
+		ir[device] = (1U << jtag_devs[device].ir_len) - 1U;
+	for (size_t idx = 0; idx < count; ++idx) {
+		const uint8_t device = dps[idx]->dp_jd_index;
+		ir[device] = APnDP ? IR_APACC : IR_DPACC;
+		cycles[device] = 35U;
+		request[device] =
+			((uint64_t)(values ? values[idx] : 0U) << 3U) | ((addr >> 1U) & 0x06U) | (RnW ? 1U : 0U);
+	}
+
+	jtag_devs_write_ir(ir);
+	jtag_devs_shift_dr(response, request, cycles);
+
+	for (size_t idx = 0; idx < count; ++idx) {
+		adiv5_debug_port_s *const dp = dps[idx];
+		const uint8_t ack = response[dp->dp_jd_index] & 0x07U;
+		uint32_t result = response[dp->dp_jd_index] >> 3U;
+		if (ack == JTAGDP_ACK_WAIT)
+			result = fw_adiv5_jtagdp_low_access(dp, RnW, addr, values ? values[idx] : 0U);
+		else if (ack != JTAGDP_ACK_OK) {
+			DEBUG_WARN("JTAG access resulted in: %" PRIx32 ":%x\n", result, ack);
+			dp->fault = ADIV5_FAULT_PROTOCOL;
+			result = 0;
+		}
+		if (results)
+			results[idx] = result;
+	}
+}
+
+/*
+ * Write a value to the same register on several JTAG-DPs at once, one scan carrying all of them,
+ * such as to halt several cores on the same clock. dps must all be on different devices of the chain.
+ */
+void adiv5_jtagdp_multi_write(
+	adiv5_debug_port_s *const *const dps, const size_t count, const uint16_t addr, const uint32_t *const values)
+{
+	adiv5_jtagdp_multi_scan(dps, count, ADIV5_LOW_WRITE, addr, values, NULL);
+}
+
+/* Read the same register from several JTAG-DPs at once, such as to poll the state of several cores */
+void adiv5_jtagdp_multi_read(
+	adiv5_debug_port_s *const *const dps, const size_t count, const uint16_t addr, uint32_t *const results)
+{
+	adiv5_jtagdp_multi_scan(dps, count, ADIV5_LOW_READ, addr, NULL, NULL);
+	adiv5_jtagdp_multi_scan(dps, count, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, NULL, results);
+}
+
+/* Point each DP's SELECT, CSW and TAR at a 32-bit access to addr through its MEM-AP, a scan per register */
+static size_t adiv5_jtagdp_multi_mem_setup(adiv5_access_port_s *const *const aps, const size_t count,
+	const uint32_t addr, adiv5_debug_port_s **const dps)
+{
+	const size_t total = MIN(count, JTAG_MAX_DEVS);
+	uint32_t values[JTAG_MAX_DEVS];
+	for (size_t idx = 0; idx < total; ++idx) {
+		dps[idx] = aps[idx]->dp;
+		values[idx] = (uint32_t)aps[idx]->apsel << 24U;
+	}
+	adiv5_jtagdp_multi_write(dps, total, ADIV5_DP_SELECT, values);
+	for (size_t idx = 0; idx < total; ++idx) {
+		dps[idx]->select = values[idx];
+		dps[idx]->select_valid = !dps[idx]->fault;
+		/* The CSW and TAR are changed behind the AP layer's back */
+		adiv5_ap_shadow_invalidate(aps[idx]);
+		values[idx] = aps[idx]->csw | ADIV5_AP_CSW_SIZE_WORD | ADIV5_AP_CSW_ADDRINC_SINGLE;
+	}
+	adiv5_jtagdp_multi_write(dps, total, ADIV5_AP_CSW, values);
+	for (size_t idx = 0; idx < total; ++idx)
+		values[idx] = addr;
+	adiv5_jtagdp_multi_write(dps, total, ADIV5_AP_TAR, values);
+	return total;
+}
+
+/* Write a 32-bit value to the same address through the MEM-AP of several JTAG-DPs, the data in one scan */
+void adiv5_jtagdp_multi_mem_write32(
+	adiv5_access_port_s *const *const aps, const size_t count, const uint32_t dest, const uint32_t *const values)
+{
+	adiv5_debug_port_s *dps[JTAG_MAX_DEVS];
+	const size_t total = adiv5_jtagdp_multi_mem_setup(aps, count, dest, dps);
+	adiv5_jtagdp_multi_write(dps, total, ADIV5_AP_DRW, values);
+	/* Collect the outcome of the writes, so they have happened on return */
+	adiv5_jtagdp_multi_scan(dps, total, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, NULL, NULL);
+}
+
+/* Read a 32-bit value from the same address through the MEM-AP of several JTAG-DPs, such as each core's DHCSR */
+void adiv5_jtagdp_multi_mem_read32(
+	adiv5_access_port_s *const *const aps, const size_t count, const uint32_t src, uint32_t *const results)
+{
+	adiv5_debug_port_s *dps[JTAG_MAX_DEVS];
+	const size_t total = adiv5_jtagdp_multi_mem_setup(aps, count, src, dps);
+	adiv5_jtagdp_multi_read(dps, total, ADIV5_AP_DRW, results);
 }
@@ -29,6 +29,8 @@
 #include "swd.h"
 #include "target.h"
 #include "target_internal.h"
+#include "probe_stats.h"
+#include "swj_freq.h"
 
 uint8_t make_packet_request(uint8_t RnW, uint16_t addr)
 {
@@ -51,12 +53,17 @@ uint8_t make_packet_request(uint8_t RnW, uint16_t addr)
 	return request;
 }
 
+/* The TARGETSEL value of the DPv2 multi-drop target selected on the wire, 0 when none is known to be */
+static uint32_t swd_selected_target = 0;
+
 /* Provide bare DP access functions without timeout and exception */
 
 static void swd_line_reset(void)
 {
 	swd_proc.seq_out(0xffffffffU, 32U);
 	swd_proc.seq_out(0x0fffffffU, 32U);
+	/* A line reset deselects every multi-drop target */
+	swd_selected_target = 0;
 }
 
 bool firmware_dp_low_write(const uint16_t addr, const uint32_t data)
@@ -79,6 +86,22 @@ static uint32_t firmware_dp_low_read(const uint16_t addr)
 	return res == SWDP_ACK_OK ? data : 0;
 }
 
+/*
+ * Make a DPv2 multi-drop target the selected one on the wire, unless it already is. Switching
+ * only takes the minimal line reset (50 cycles high, 2 idle), the TARGETSEL write and the DPIDR
+ * read that has to follow it - the target is not dormant, so no wake up sequence is needed.
+ */
+static void firmware_swdp_select(const adiv5_debug_port_s *const dp)
+{
+	if (dp->version < 2U || !dp->targetsel || dp->targetsel == swd_selected_target)
+		return;
+	swd_proc.seq_out(0xffffffffU, 32U);
+	swd_proc.seq_out(0x0003ffffU, 20U);
+	firmware_dp_low_write(ADIV5_DP_TARGETSEL, dp->targetsel);
+	firmware_dp_low_read(ADIV5_DP_DPIDR);
+	swd_selected_target = dp->targetsel;
+}
+
 /* Try first the dormant to SWD procedure.
  * If target id given, scan DPs 0 .. 15 on that device and return.
  * Otherwise
@@ -181,9 +204,9 @@ uint32_t adiv5_swdp_scan(uint32_t targetid)
 			initial_dp->fault = 0;
 			swd_line_reset();
 
-			initial_dp->dp_low_write(ADIV5_DP_TARGETSEL,
-				i << ADIV5_DP_TARGETSEL_TINSTANCE_OFFSET |
-					(dp_targetid & (ADIV5_DP_TARGETID_TDESIGNER_MASK | ADIV5_DP_TARGETID_TPARTNO_MASK)) | 1U);
+			swd_selected_target = i << ADIV5_DP_TARGETSEL_TINSTANCE_OFFSET |
+				(dp_targetid & (ADIV5_DP_TARGETID_TDESIGNER_MASK | ADIV5_DP_TARGETID_TPARTNO_MASK)) | 1U;
+			initial_dp->dp_low_write(ADIV5_DP_TARGETSEL, swd_selected_target);
 
 			TRY_CATCH (e, EXCEPTION_ALL) {
 				adiv5_dp_read(initial_dp, ADIV5_DP_DPIDR);
@@ -192,7 +215,7 @@ uint32_t adiv5_swdp_scan(uint32_t targetid)
 				continue;
 		}
 
-		adiv5_debug_port_s *dp = calloc(1, sizeof(*dp));
+		adiv5_debug_port_s *dp = target_arena_calloc(sizeof(*dp));
 		if (!dp) { /* calloc failed: heap exhaustion */
 			DEBUG_WARN("calloc: failed in %s\n", __func__);
 			continue;
@@ -218,7 +241,7 @@ uint32_t firmware_swdp_read(adiv5_debug_port_s *dp, uint16_t addr)
 uint32_t firmware_swdp_error(adiv5_debug_port_s *dp, const bool protocol_recovery)
 {
 	/* Only do the comms reset dance on DPv2+ w/ fault or to perform protocol recovery. */
-	if ((dp->version >= 2 && dp->fault) || protocol_recovery) {
+	if ((dp->version >= 2 && dp->fault) || dp->fault == ADIV5_FAULT_PROTOCOL || protocol_recovery) {
 		/*
 		 * Note that on DPv2+ devices, during a protocol error condition
 		 * the target becomes deselected during line reset. Once reset,
@@ -226,8 +249,10 @@ uint32_t firmware_swdp_error(adiv5_debug_port_s *dp, const bool protocol_recover
 		 * into the expected state.
 		 */
 		swd_line_reset();
-		if (dp->version >= 2)
+		if (dp->version >= 2) {
 			firmware_dp_low_write(ADIV5_DP_TARGETSEL, dp->targetsel);
+			swd_selected_target = dp->targetsel;
+		}
 		firmware_dp_low_read(ADIV5_DP_DPIDR);
 		/* Exception here is unexpected, so do not catch */
 	}
@@ -251,20 +276,30 @@ uint32_t firmware_swdp_error(adiv5_debug_port_s *dp, const bool protocol_recover
 	return err;
 }
 
-uint32_t firmware_swdp_low_access(adiv5_debug_port_s *dp, const uint8_t RnW, const uint16_t addr, const uint32_t value)
+static uint32_t firmware_swdp_transfer(
+	adiv5_debug_port_s *const dp, const uint8_t RnW, const uint16_t addr, const uint32_t value)
 {
 	if ((addr & ADIV5_APnDP) && dp->fault)
 		return 0;
+	firmware_swdp_select(dp);
 
 	const uint8_t request = make_packet_request(RnW, addr);
 	uint32_t response = 0;
 	uint8_t ack = SWDP_ACK_WAIT;
 	platform_timeout_s timeout;
 	platform_timeout_set(&timeout, 250);
+	PROBE_STATS_COUNT(swd_accesses);
+	bool retry = false;
 	do {
+		if (retry)
+			PROBE_STATS_COUNT(swd_retries);
+		retry = true;
 		swd_proc.seq_out(request, 8);
 		ack = swd_proc.seq_in(3);
+		if (ack == SWDP_ACK_WAIT)
+			PROBE_STATS_COUNT(swd_wait_acks);
 		if (ack == SWDP_ACK_FAULT) {
+			PROBE_STATS_COUNT(swd_fault_acks);
 			DEBUG_WARN("SWD access resulted in fault, retrying\n");
 			/* On fault, abort the request and repeat */
 			/* Yes, this is self-recursive.. no, we can't think of a better option */
@@ -289,22 +324,33 @@ uint32_t firmware_swdp_low_access(adiv5_debug_port_s *dp, const uint8_t RnW, con
 
 	if (ack == SWDP_ACK_NO_RESPONSE) {
 		DEBUG_WARN("SWD access resulted in no response\n");
+		swj_freq_account(true);
 		dp->fault = ack;
 		return 0;
 	}
 
+	/*
+	 * Line errors are reported through the fault state like any other failed access rather than by
+	 * raising, so the hot memory access loops need no exception frames - the AP accesses that follow
+	 * are skipped until target_check_error() runs the protocol recovery.
+	 */
 	if (ack != SWDP_ACK_OK) {
 		DEBUG_WARN("SWD access has invalid ack %x\n", ack);
-		raise_exception(EXCEPTION_ERROR, "SWD invalid ACK");
+		swj_freq_account(true);
+		dp->fault = ADIV5_FAULT_PROTOCOL;
+		return 0;
 	}
 
 	if (RnW) {
-		if (swd_proc.seq_in_parity(&response, 32)) { /* Give up on parity error */
-			dp->fault = 1;
+		const bool parity_error = swd_proc.seq_in_parity(&response, 32);
+		swj_freq_account(parity_error);
+		if (parity_error) { /* Give up on parity error */
 			DEBUG_WARN("SWD access resulted in parity error\n");
-			raise_exception(EXCEPTION_ERROR, "SWD parity error");
+			dp->fault = ADIV5_FAULT_PROTOCOL;
+			return 0;
 		}
 	} else {
+		swj_freq_account(false);
 		swd_proc.seq_out_parity(value, 32);
 		/* ARM Debug Interface Architecture Specification ADIv5.0 to ADIv5.2
 		 * tells to clock the data through SW-DP to either :
@@ -320,7 +366,184 @@ uint32_t firmware_swdp_low_access(adiv5_debug_port_s *dp, const uint8_t RnW, con
 	return response;
 }
 
+uint32_t firmware_swdp_low_access(adiv5_debug_port_s *dp, const uint8_t RnW, const uint16_t addr, const uint32_t value)
+{
+	PROBE_STATS_TIME_BEGIN(start);
+	const uint32_t response = firmware_swdp_transfer(dp, RnW, addr, value);
+	PROBE_STATS_TIME_END(PROBE_STATS_SWD_ACCESS, start);
+	return response;
+}
+
 void firmware_swdp_abort(adiv5_debug_port_s *dp, uint32_t abort)
 {
 	adiv5_dp_write(dp, ADIV5_DP_ABORT, abort);
 }
+
+/* Runs of DRW accesses shorter than this aren't worth streaming */
+#define SWDP_STREAM_MIN 8U
+
+/* Run the accesses of a stream one after the other, returning true if any of them failed */
+static bool firmware_swdp_stream_accesses(const uint8_t RnW, const uint8_t request, uint32_t target_addr,
+	void *dest, const void *src, const size_t count, const align_e step)
+{
+	bool failed = false;
+	/* Reads are posted, so each response belongs to the access before it and RDBUFF picks up the last */
+	for (size_t idx = 0; idx < count + (RnW ? 1U : 0U); ++idx) {
+		const bool last = idx == count;
+		swd_proc.seq_out(last ? make_packet_request(ADIV5_LOW_READ, ADIV5_DP_RDBUFF) : request, 8U);
+		failed |= swd_proc.seq_in(3U) != SWDP_ACK_OK;
+		if (RnW) {
+			uint32_t value = 0;
+			failed |= swd_proc.seq_in_parity(&value, 32U);
+			if (idx) {
+				dest = adiv5_unpack_data(dest, target_addr, value, step);
+				target_addr += 1U << step;
+			}
+		} else {
+			uint32_t value = 0;
+			src = adiv5_pack_data(target_addr, src, &value, step);
+			swd_proc.seq_out_parity(value, 32U);
+			target_addr += 1U << step;
+		}
+	}
+	if (!RnW)
+		swd_proc.seq_out(0, 8U);
+	return failed;
+}
+
+#if PC_HOSTED == 1
+/* A stream is at most a TAR block of byte accesses, plus the RDBUFF read ending a read stream */
+#define SWDP_STREAM_MAX (0x400U + 1U)
+
+/*
+ * As firmware_swdp_stream_accesses(), but queueing the ACKs and read data with the probe's deferred reads
+ * so the whole stream goes out in as few batches as the probe can take, then looking at them at the end
+ */
+static bool firmware_swdp_stream_deferred(const uint8_t RnW, const uint8_t request, uint32_t target_addr,
+	void *dest, const void *src, const size_t count, const align_e step)
+{
+	static uint32_t acks[SWDP_STREAM_MAX];
+	static uint32_t values[SWDP_STREAM_MAX];
+	static bool parity_errors[SWDP_STREAM_MAX];
+	const size_t accesses = count + (RnW ? 1U : 0U);
+	for (size_t idx = 0; idx < accesses; ++idx) {
+		const bool last = idx == count;
+		swd_proc.seq_out(last ? make_packet_request(ADIV5_LOW_READ, ADIV5_DP_RDBUFF) : request, 8U);
+		swd_proc.seq_in_deferred(&acks[idx], NULL, 3U);
+		if (RnW)
+			swd_proc.seq_in_deferred(&values[idx], &parity_errors[idx], 32U);
+		else {
+			uint32_t value = 0;
+			src = adiv5_pack_data(target_addr, src, &value, step);
+			swd_proc.seq_out_parity(value, 32U);
+			target_addr += 1U << step;
+		}
+	}
+	if (!RnW)
+		swd_proc.seq_out(0, 8U);
+	swd_proc.flush();
+
+	bool failed = false;
+	for (size_t idx = 0; idx < accesses; ++idx) {
+		failed |= acks[idx] != SWDP_ACK_OK;
+		if (RnW) {
+			failed |= parity_errors[idx];
+			if (idx) {
+				dest = adiv5_unpack_data(dest, target_addr, values[idx], step);
+				target_addr += 1U << step;
+			}
+		}
+	}
+	return failed;
+}
+#endif
+
+/*
+ * Stream a run of DRW accesses within one 1KiB TAR block with CTRL/STAT.ORUNDETECT set, so the
+ * ACKs need not be acted on as they come in: with overrun detection on, the data phase always
+ * takes place, and a WAIT or FAULT latches STICKYORUN, making every access after it fail too.
+ * The sticky flags are checked once at the end, and false is returned if the run must be redone.
+ */
+static bool firmware_swdp_stream(adiv5_access_port_s *const ap, const uint8_t RnW, const uint32_t addr,
+	void *const dest_data, const void *const src_data, const size_t count, const align_e align, const bool packed)
+{
+	adiv5_debug_port_s *const dp = ap->dp;
+	/* In packed mode each DRW access carries a whole word of accesses at the given width */
+	const align_e step = packed ? ALIGN_WORD : align;
+	if (packed)
+		ap_mem_access_setup_packed(ap, addr, align);
+	else
+		ap_mem_access_setup(ap, addr, align);
+
+	adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT,
+		ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ | ADIV5_DP_CTRLSTAT_ORUNDETECT);
+	if (dp->fault)
+		return false;
+
+	const uint8_t request = make_packet_request(RnW, ADIV5_AP_DRW);
+#if PC_HOSTED == 1
+	bool failed = swd_proc.flush ?
+		firmware_swdp_stream_deferred(RnW, request, addr, dest_data, src_data, count, step) :
+		firmware_swdp_stream_accesses(RnW, request, addr, dest_data, src_data, count, step);
+#else
+	bool failed = firmware_swdp_stream_accesses(RnW, request, addr, dest_data, src_data, count, step);
+#endif
+	PROBE_STATS_ADD(swd_accesses, count);
+
+	/* Reading CTRL/STAT also makes sure the last write has completed */
+	const uint32_t ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
+	failed |= (ctrlstat & (ADIV5_DP_CTRLSTAT_STICKYORUN | ADIV5_DP_CTRLSTAT_STICKYERR)) != 0U || dp->fault;
+	if (failed) {
+		DEBUG_WARN("SWD streaming %s of %zu accesses at 0x%08" PRIx32 " failed, redoing it\n",
+			RnW ? "read" : "write", count, addr);
+		dp->fault = 0;
+		adiv5_dp_write(dp, ADIV5_DP_ABORT,
+			ADIV5_DP_ABORT_ORUNERRCLR | ADIV5_DP_ABORT_WDERRCLR | ADIV5_DP_ABORT_STKERRCLR | ADIV5_DP_ABORT_STKCMPCLR);
+	}
+	adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ);
+	/* The streamed accesses moved TAR behind the AP layer's back */
+	ap->shadow_valid &= ~ADIV5_AP_SHADOW_TAR;
+	return !failed;
+}
+
+/* Read target memory, streaming the word-wide body of the transfer a TAR block at a time */
+void firmware_swdp_mem_read(adiv5_access_port_s *const ap, void *dest, uint32_t src, size_t len)
+{
+	const size_t head = MIN((4U - (src & 3U)) & 3U, len);
+	if (head) {
+		advi5_mem_read_bytes(ap, dest, src, head);
+		dest = (uint8_t *)dest + head;
+		src += head;
+		len -= head;
+	}
+	while (len >= SWDP_STREAM_MIN * 4U) {
+		const size_t amount = MIN(len & ~3U, 0x400U - (src & 0x3ffU));
+		if (!firmware_swdp_stream(ap, ADIV5_LOW_READ, src, dest, NULL, amount >> 2U, ALIGN_WORD, false))
+			advi5_mem_read_bytes(ap, dest, src, amount);
+		dest = (uint8_t *)dest + amount;
+		src += amount;
+		len -= amount;
+	}
+	if (len)
+		advi5_mem_read_bytes(ap, dest, src, len);
+}
+
+/* Write target memory at the given access width, streaming it a TAR block at a time */
+void firmware_swdp_mem_write(
+	adiv5_access_port_s *const ap, uint32_t dest, const void *src, size_t len, const align_e align)
+{
+	while (len) {
+		size_t amount = MIN(len, 0x400U - (dest & 0x3ffU));
+		/* Narrow writes go a word at a time in packed mode where the AP can, any partial word is left for later */
+		const bool packed = adiv5_mem_packed(ap, dest, amount, align);
+		if (packed)
+			amount &= ~3U;
+		const align_e step = packed ? ALIGN_WORD : align;
+		if ((amount >> step) < SWDP_STREAM_MIN ||
+			!firmware_swdp_stream(ap, ADIV5_LOW_WRITE, dest, NULL, src, amount >> step, align, packed))
+			adiv5_mem_write_bytes(ap, dest, src, amount, align);
+		src = (const uint8_t *)src + amount;
+		dest += amount;
+		len -= amount;
+	}
+}
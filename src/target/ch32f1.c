@@ -31,11 +31,23 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flash_loader.h"
 
 extern const command_s stm32f1_cmd_list[]; // Reuse stm32f1 stuff
 
 static bool ch32f1_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool ch32f1_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool ch32f1_flash_done(target_flash_s *f);
+
+/* Resident double-buffered loader for fast page programming, see flashstub/ch32f1_loader.s */
+static const uint16_t ch32f1_loader_stub[] = {
+#include "flashstub/ch32f1_loader.stub"
+};
+
+typedef struct ch32f1_flash {
+	target_flash_s f;
+	flash_loader_s loader;
+} ch32f1_flash_s;
 
 // These are common with stm32f1/gd32f1/...
 #define FPEC_BASE     0x40022000U
@@ -64,21 +76,27 @@ static bool ch32f1_flash_write(target_flash_s *f, target_addr_t dest, const void
 #define FLASH_CR_BUF_RESET_CH32  (1U << 19U)         // Buffer reset
 #define FLASH_SR_EOP             (1U << 5U)          // End of programming
 #define FLASH_BEGIN_ADDRESS_CH32 0x8000000U
+#define FLASH_PAGE_SIZE_CH32     128U // Fast erase and program page size
 
-/* "fast" Flash driver for CH32F10x chips */
+/*
+ * "fast" Flash driver for CH32F10x chips. Erase and programming work on 128 byte fast mode pages,
+ * a number of which make up each block handed to the driver.
+ */
 static void ch32f1_add_flash(target_s *t, uint32_t addr, size_t length, size_t erasesize)
 {
-	target_flash_s *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
+	ch32f1_flash_s *sf = calloc(1, sizeof(*sf));
+	if (!sf) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	target_flash_s *f = &sf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = erasesize;
 	f->erase = ch32f1_flash_erase;
 	f->write = ch32f1_flash_write;
+	f->done = ch32f1_flash_done;
 	f->writesize = erasesize;
 	f->erased = 0xffU;
 	target_add_flash(t, f);
@@ -217,7 +235,7 @@ bool ch32f1_probe(target_s *t)
 	uint32_t flashSize = signature & 0xffffU;
 
 	target_add_ram(t, 0x20000000, 0x5000);
-	ch32f1_add_flash(t, FLASH_BEGIN_ADDRESS_CH32, flashSize * 1024U, 128);
+	ch32f1_add_flash(t, FLASH_BEGIN_ADDRESS_CH32, flashSize * 1024U, 1024);
 	target_add_commands(t, stm32f1_cmd_list, "STM32 LD/MD/VL-LD/VL-MD");
 	t->driver = "CH32F1 medium density (stm32f1 clone)";
 	return true;
@@ -230,6 +248,9 @@ bool ch32f1_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 	target_s *t = f->t;
 	DEBUG_INFO("CH32: flash erase \n");
 
+	/* The loader has to be done with any programming before the controller can be used for erasing */
+	if (!ch32f1_flash_done(f))
+		return false;
 	if (!ch32f1_flash_unlock(t)) {
 		DEBUG_WARN("CH32: Unlock failed\n");
 		return false;
@@ -246,11 +267,11 @@ bool ch32f1_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 		CLEAR_CR(FLASH_CR_STRT);
 		// Magic
 		MAGIC(addr);
-		if (len > 128U)
-			len -= 128U;
+		if (len > FLASH_PAGE_SIZE_CH32)
+			len -= FLASH_PAGE_SIZE_CH32;
 		else
 			len = 0;
-		addr += 128U;
+		addr += FLASH_PAGE_SIZE_CH32;
 	}
 	sr = target_mem_read32(t, FLASH_SR);
 	ch32f1_flash_lock(t);
@@ -324,6 +345,21 @@ static bool ch32f1_flash_write(target_flash_s *f, target_addr_t dest, const void
 #endif
 	DEBUG_INFO("CH32: flash write 0x%" PRIx32 " ,size=%" PRIu32 "\n", dest, (uint32_t)len);
 
+	/*
+	 * Fill and commit the page buffer from the SRAM loader where it can run, which leaves the
+	 * controller fast unlocked until ch32f1_flash_done()
+	 */
+	ch32f1_flash_s *const sf = (ch32f1_flash_s *)f;
+	if (!sf->loader.running) {
+		const flash_loader_config_s config = {
+			FLASH_CR, FLASH_CR_FTPG_CH32, FLASH_SR, FLASH_SR_BSY, SR_ERROR_MASK, FLASH_PAGE_SIZE_CH32};
+		if (ch32f1_flash_unlock(t) &&
+			!flash_loader_start_stub(f, &sf->loader, &config, ch32f1_loader_stub, sizeof(ch32f1_loader_stub)))
+			ch32f1_flash_lock(t);
+	}
+	if (sf->loader.running)
+		return flash_loader_write(f, &sf->loader, dest, src, len, 0);
+
 	while (length > 0) {
 		if (!ch32f1_flash_unlock(t)) {
 			DEBUG_WARN("ch32f1 cannot fast unlock\n");
@@ -355,12 +391,12 @@ static bool ch32f1_flash_write(target_flash_s *f, target_addr_t dest, const void
 		MAGIC(dest);
 
 		// next
-		if (length > 128U)
-			length -= 128U;
+		if (length > FLASH_PAGE_SIZE_CH32)
+			length -= FLASH_PAGE_SIZE_CH32;
 		else
 			length = 0;
-		dest += 128U;
-		src += 128U;
+		dest += FLASH_PAGE_SIZE_CH32;
+		src += FLASH_PAGE_SIZE_CH32;
 
 		sr = target_mem_read32(t, FLASH_SR); // 13
 		ch32f1_flash_lock(t);
@@ -386,3 +422,13 @@ static bool ch32f1_flash_write(target_flash_s *f, target_addr_t dest, const void
 
 	return true;
 }
+
+static bool ch32f1_flash_done(target_flash_s *const f)
+{
+	ch32f1_flash_s *const sf = (ch32f1_flash_s *)f;
+	if (!sf->loader.running)
+		return true;
+	const bool result = flash_loader_stop(f, &sf->loader);
+	ch32f1_flash_lock(f->t);
+	return result;
+}
@@ -0,0 +1,658 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2026 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements support for CoreSight debug and trace components found by the ROM table walk.
+ *
+ * The CTIs of the attached cores on a DP join a halt group on cross trigger channel 0, which raises
+ * every member's external debug request, so a single application pulse on any of the CTIs stops all
+ * the cores within a few cycles of each other. The cores halting themselves is deliberately not routed
+ * onto the channel, so a semihosting call on one core doesn't stop the rest. Restarts still go through
+ * each core's own debug registers as each needs its registers written back first, the core's latched
+ * debug request being acknowledged beforehand so it doesn't immediately halt again.
+ *
+ * Instruction trace is captured into an on-chip trace buffer, for parts without a parallel trace
+ * port. The ETB and TMC sinks, trace funnels and ETM/PTM sources noted on the DP during the ROM
+ * table walk are set up so every core traces continuously into the sink's RAM, in circular buffer
+ * mode and with the formatter on so each source's trace is tagged with its trace ID. Once stopped,
+ * the buffer is read out oldest data first with queued non-incrementing reads of its RAM read data
+ * register, as raw formatter frames for a trace decoder such as OpenCSD.
+ *
+ * References:
+ * DDI0314  - CoreSight Components Technical Reference Manual (ETB, funnel)
+ * DDI0461  - CoreSight Trace Memory Controller Technical Reference Manual
+ * IHI0014  - Embedded Trace Macrocell Architecture Specification, ETMv1.0 to ETMv3.5
+ * IHI0064  - ARM Embedded Trace Macrocell Architecture Specification, ETMv4
+ * DDI0480  - CoreSight SoC Technical Reference Manual (CTI)
+ */
+
+#include "general.h"
+#include "target_internal.h"
+#include "coresight.h"
+
+/* CoreSight management registers common to all the components */
+#define CORESIGHT_LAR     0xfb0U
+#define CORESIGHT_LAR_KEY 0xc5acce55U
+
+/* ETB and TMC registers, the TMC's layout being a superset of the ETB's */
+#define TRACE_SINK_RDP   0x004U /* RAM depth (ETB) or size (TMC), in words */
+#define TRACE_SINK_STS   0x00cU
+#define TRACE_SINK_RRD   0x010U
+#define TRACE_SINK_RRP   0x014U
+#define TRACE_SINK_RWP   0x018U /* In words on the ETB, bytes on the TMC */
+#define TRACE_SINK_TRG   0x01cU
+#define TRACE_SINK_CTL   0x020U
+#define TRACE_SINK_MODE  0x028U /* TMC only */
+#define TRACE_SINK_FFSR  0x300U
+#define TRACE_SINK_FFCR  0x304U
+#define TRACE_SINK_DEVID 0xfc8U
+
+#define TRACE_SINK_STS_FULL          (1U << 0U)
+#define TRACE_SINK_STS_TMC_READY     (1U << 2U)
+#define TRACE_SINK_CTL_CAPTURE       (1U << 0U)
+#define TRACE_SINK_MODE_CIRCULAR     0U
+#define TRACE_SINK_FFSR_STOPPED      (1U << 1U)
+#define TRACE_SINK_FFCR_FORMAT       (1U << 0U)
+#define TRACE_SINK_FFCR_FLUSH        (1U << 6U)
+#define TRACE_SINK_FFCR_STOP_FLUSH   (1U << 12U)
+#define TRACE_SINK_DEVID_CONFIG_MASK (3U << 6U)
+#define TRACE_SINK_DEVID_CONFIG_ETR  (1U << 6U)
+
+/* Trace funnel */
+#define TRACE_FUNNEL_CTRL            0x000U
+#define TRACE_FUNNEL_CTRL_ENABLE_ALL 0xffU
+
+/* ETMv3 and PTM */
+#define ETM3_CR       0x000U
+#define ETM3_TRIGGER  0x008U
+#define ETM3_SR       0x010U
+#define ETM3_TEEVR    0x020U
+#define ETM3_TECR1    0x024U
+#define ETM3_TRACEIDR 0x200U
+#define ETM3_OSLAR    0x300U
+
+#define ETM3_CR_POWER_DOWN     (1U << 0U)
+#define ETM3_CR_PROGRAM        (1U << 10U)
+#define ETM3_CR_ENABLE         (1U << 11U)
+#define ETM3_CR_CYCLE_ACCURATE (1U << 12U)
+#define ETM3_SR_PROGRAM        (1U << 1U)
+#define ETM3_EVENT_ALWAYS      0x006fU /* The hard-wired always true resource */
+#define ETM3_EVENT_NEVER       0x406fU /* NOT always true */
+#define ETM3_TECR1_EXCLUDE     (1U << 24U)
+
+/* ETMv4 */
+#define ETM4_PRGCTLR    0x004U
+#define ETM4_STATR      0x00cU
+#define ETM4_CONFIGR    0x010U
+#define ETM4_EVENTCTL0R 0x020U
+#define ETM4_EVENTCTL1R 0x024U
+#define ETM4_STALLCTLR  0x02cU
+#define ETM4_TSCTLR     0x030U
+#define ETM4_SYNCPR     0x034U
+#define ETM4_CCCTLR     0x038U
+#define ETM4_BBCTLR     0x03cU
+#define ETM4_TRACEIDR   0x040U
+#define ETM4_VICTLR     0x080U
+#define ETM4_VIIECTLR   0x084U
+#define ETM4_VISSCTLR   0x088U
+#define ETM4_OSLAR      0x300U
+#define ETM4_PDCR       0x310U
+
+#define ETM4_PRGCTLR_ENABLE  (1U << 0U)
+#define ETM4_STATR_IDLE      (1U << 0U)
+#define ETM4_CONFIGR_CCI     (1U << 4U)
+#define ETM4_VICTLR_ALWAYS   (1U << 0U) /* Resource selector 1 is always true */
+#define ETM4_VICTLR_SSSTATUS (1U << 9U) /* Start the ViewInst start/stop logic in the started state */
+#define ETM4_PDCR_POWER_UP   (1U << 3U)
+#define ETM4_SYNC_PERIOD     12U    /* A trace synchronisation point every 4KiB */
+#define ETM4_CC_THRESHOLD    0x10U
+
+/* Cross Trigger Interface */
+#define CTI_CONTROL  0x000U
+#define CTI_INTACK   0x010U
+#define CTI_APPPULSE 0x01cU
+#define CTI_INEN(n)  (0x020U + ((n) * 4U))
+#define CTI_OUTEN(n) (0x0a0U + ((n) * 4U))
+#define CTI_GATE     0x140U
+
+#define CTI_CONTROL_GLBEN (1U << 0U)
+/* Trigger output 0 is the core's external debug request (EDBGRQ), for the Cortex-M and Cortex-A CTIs alike */
+#define CTI_TRIGGER_HALT 0U
+#define CTI_CHANNEL_HALT (1U << 0U)
+
+/* Sources get consecutive trace IDs from here, clear of the ITM's usual ID 1 */
+#define CORESIGHT_TRACE_ID_BASE 0x10U
+
+#define CORESIGHT_TRACE_TIMEOUT_MS 100U
+
+/* Trace RAM words read per queue run */
+#if PC_HOSTED == 1
+#define CORESIGHT_TRACE_BATCH 256U
+#else
+#define CORESIGHT_TRACE_BATCH 16U
+#endif
+
+static const char *const coresight_component_names[] = {
+	[ADIV5_CORESIGHT_ETB] = "ETB",
+	[ADIV5_CORESIGHT_TMC] = "TMC",
+	[ADIV5_CORESIGHT_FUNNEL] = "Funnel",
+	[ADIV5_CORESIGHT_ETM3] = "ETMv3/PTM",
+	[ADIV5_CORESIGHT_ETM4] = "ETMv4",
+	[ADIV5_CORESIGHT_CTI] = "CTI",
+	[ADIV5_CORESIGHT_CORE] = "Core",
+};
+
+/* Make an AP to reach a component through, based on the target's own but for the component's AP */
+static void coresight_component_ap(adiv5_access_port_s *const ap, const adiv5_access_port_s *const base,
+	const adiv5_coresight_component_s *const component)
+{
+	*ap = *base;
+	ap->apsel = component->apsel;
+	ap->csw = component->csw;
+	ap->packed_transfers = false;
+	adiv5_ap_shadow_invalidate(ap);
+}
+
+static uint32_t coresight_read(adiv5_access_port_s *const ap, const uint32_t addr)
+{
+	uint32_t value = 0;
+	adiv5_mem_read(ap, &value, addr, sizeof(value));
+	return value;
+}
+
+static void coresight_write(adiv5_access_port_s *const ap, const uint32_t addr, const uint32_t value)
+{
+	adiv5_mem_write(ap, addr, &value, sizeof(value));
+}
+
+static bool coresight_is_source(const adiv5_coresight_component_s *const component)
+{
+	return component->kind == ADIV5_CORESIGHT_ETM3 || component->kind == ADIV5_CORESIGHT_ETM4;
+}
+
+/* The first ETB, or TMC configured as an ETB or ETF, a TMC ETR writing to system memory not being handled */
+static const adiv5_coresight_component_s *coresight_trace_sink(adiv5_access_port_s *const base)
+{
+	const adiv5_debug_port_s *const dp = base->dp;
+	for (size_t i = 0; i < dp->coresight_count; ++i) {
+		const adiv5_coresight_component_s *const component = &dp->coresight[i];
+		if (component->kind == ADIV5_CORESIGHT_ETB)
+			return component;
+		if (component->kind == ADIV5_CORESIGHT_TMC) {
+			adiv5_access_port_s ap;
+			coresight_component_ap(&ap, base, component);
+			const uint32_t devid = coresight_read(&ap, component->addr + TRACE_SINK_DEVID);
+			if ((devid & TRACE_SINK_DEVID_CONFIG_MASK) != TRACE_SINK_DEVID_CONFIG_ETR)
+				return component;
+		}
+	}
+	return NULL;
+}
+
+static void coresight_sink_start(adiv5_access_port_s *const ap, const adiv5_coresight_component_s *const sink)
+{
+	coresight_write(ap, sink->addr + CORESIGHT_LAR, CORESIGHT_LAR_KEY);
+	coresight_write(ap, sink->addr + TRACE_SINK_CTL, 0);
+	if (sink->kind == ADIV5_CORESIGHT_TMC) {
+		adiv5_mem_poll32(ap, sink->addr + TRACE_SINK_STS, TRACE_SINK_STS_TMC_READY, TRACE_SINK_STS_TMC_READY,
+			CORESIGHT_TRACE_TIMEOUT_MS, NULL);
+		coresight_write(ap, sink->addr + TRACE_SINK_MODE, TRACE_SINK_MODE_CIRCULAR);
+	}
+	coresight_write(ap, sink->addr + TRACE_SINK_RWP, 0);
+	coresight_write(ap, sink->addr + TRACE_SINK_TRG, 0);
+	coresight_write(ap, sink->addr + TRACE_SINK_FFCR, TRACE_SINK_FFCR_FORMAT);
+	coresight_write(ap, sink->addr + TRACE_SINK_CTL, TRACE_SINK_CTL_CAPTURE);
+}
+
+/*
+ * Flush the formatter and stop capture. The ETB is then disabled, which is when its RAM may be read,
+ * while the TMC is left in its stopped state, from which it presents the circular buffer oldest first.
+ */
+static bool coresight_sink_stop(adiv5_access_port_s *const ap, const adiv5_coresight_component_s *const sink)
+{
+	const uint32_t ffcr = coresight_read(ap, sink->addr + TRACE_SINK_FFCR);
+	coresight_write(ap, sink->addr + TRACE_SINK_FFCR, ffcr | TRACE_SINK_FFCR_STOP_FLUSH | TRACE_SINK_FFCR_FLUSH);
+	if (sink->kind == ADIV5_CORESIGHT_TMC)
+		return adiv5_mem_poll32(ap, sink->addr + TRACE_SINK_STS, TRACE_SINK_STS_TMC_READY, TRACE_SINK_STS_TMC_READY,
+			CORESIGHT_TRACE_TIMEOUT_MS, NULL);
+	const bool stopped = adiv5_mem_poll32(ap, sink->addr + TRACE_SINK_FFSR, TRACE_SINK_FFSR_STOPPED,
+		TRACE_SINK_FFSR_STOPPED, CORESIGHT_TRACE_TIMEOUT_MS, NULL);
+	coresight_write(ap, sink->addr + TRACE_SINK_CTL, 0);
+	return stopped;
+}
+
+static void coresight_funnel_enable(adiv5_access_port_s *const ap, const adiv5_coresight_component_s *const funnel)
+{
+	coresight_write(ap, funnel->addr + CORESIGHT_LAR, CORESIGHT_LAR_KEY);
+	const uint32_t ctrl = coresight_read(ap, funnel->addr + TRACE_FUNNEL_CTRL);
+	coresight_write(ap, funnel->addr + TRACE_FUNNEL_CTRL, ctrl | TRACE_FUNNEL_CTRL_ENABLE_ALL);
+}
+
+/* ETMv3 and PTM registers may only be changed with the programming bit set and seen to be set */
+static bool coresight_etm3_program(adiv5_access_port_s *const ap, const uint32_t base, const bool programming)
+{
+	const uint32_t cr = coresight_read(ap, base + ETM3_CR) & ~(ETM3_CR_POWER_DOWN | ETM3_CR_PROGRAM);
+	coresight_write(ap, base + ETM3_CR, cr | (programming ? ETM3_CR_PROGRAM : 0U));
+	return adiv5_mem_poll32(
+		ap, base + ETM3_SR, ETM3_SR_PROGRAM, programming ? ETM3_SR_PROGRAM : 0U, CORESIGHT_TRACE_TIMEOUT_MS, NULL);
+}
+
+static bool coresight_etm3_start(
+	adiv5_access_port_s *const ap, const uint32_t base, const uint8_t trace_id, const bool cycle_accurate)
+{
+	coresight_write(ap, base + CORESIGHT_LAR, CORESIGHT_LAR_KEY);
+	coresight_write(ap, base + ETM3_OSLAR, 0);
+	if (!coresight_etm3_program(ap, base, true))
+		return false;
+	/* Trace everything: no trigger, TraceEnable always on and no address range exclusions */
+	coresight_write(ap, base + ETM3_TRIGGER, ETM3_EVENT_NEVER);
+	coresight_write(ap, base + ETM3_TEEVR, ETM3_EVENT_ALWAYS);
+	coresight_write(ap, base + ETM3_TECR1, ETM3_TECR1_EXCLUDE);
+	coresight_write(ap, base + ETM3_TRACEIDR, trace_id);
+	uint32_t cr = coresight_read(ap, base + ETM3_CR) & ~ETM3_CR_CYCLE_ACCURATE;
+	cr |= ETM3_CR_ENABLE | (cycle_accurate ? ETM3_CR_CYCLE_ACCURATE : 0U);
+	coresight_write(ap, base + ETM3_CR, cr);
+	return coresight_etm3_program(ap, base, false);
+}
+
+static bool coresight_etm4_start(
+	adiv5_access_port_s *const ap, const uint32_t base, const uint8_t trace_id, const bool cycle_accurate)
+{
+	coresight_write(ap, base + CORESIGHT_LAR, CORESIGHT_LAR_KEY);
+	coresight_write(ap, base + ETM4_OSLAR, 0);
+	coresight_write(ap, base + ETM4_PDCR, ETM4_PDCR_POWER_UP);
+	coresight_write(ap, base + ETM4_PRGCTLR, 0);
+	if (!adiv5_mem_poll32(
+			ap, base + ETM4_STATR, ETM4_STATR_IDLE, ETM4_STATR_IDLE, CORESIGHT_TRACE_TIMEOUT_MS, NULL))
+		return false;
+	coresight_write(ap, base + ETM4_CONFIGR, cycle_accurate ? ETM4_CONFIGR_CCI : 0U);
+	coresight_write(ap, base + ETM4_EVENTCTL0R, 0);
+	coresight_write(ap, base + ETM4_EVENTCTL1R, 0);
+	coresight_write(ap, base + ETM4_STALLCTLR, 0);
+	coresight_write(ap, base + ETM4_TSCTLR, 0);
+	coresight_write(ap, base + ETM4_SYNCPR, ETM4_SYNC_PERIOD);
+	coresight_write(ap, base + ETM4_CCCTLR, ETM4_CC_THRESHOLD);
+	coresight_write(ap, base + ETM4_BBCTLR, 0);
+	coresight_write(ap, base + ETM4_TRACEIDR, trace_id);
+	/* Trace everything: ViewInst always on, with no address range or start/stop point filtering */
+	coresight_write(ap, base + ETM4_VICTLR, ETM4_VICTLR_SSSTATUS | ETM4_VICTLR_ALWAYS);
+	coresight_write(ap, base + ETM4_VIIECTLR, 0);
+	coresight_write(ap, base + ETM4_VISSCTLR, 0);
+	coresight_write(ap, base + ETM4_PRGCTLR, ETM4_PRGCTLR_ENABLE);
+	return adiv5_mem_poll32(ap, base + ETM4_STATR, ETM4_STATR_IDLE, 0, CORESIGHT_TRACE_TIMEOUT_MS, NULL);
+}
+
+static void coresight_source_stop(adiv5_access_port_s *const ap, const adiv5_coresight_component_s *const source)
+{
+	if (source->kind == ADIV5_CORESIGHT_ETM3) {
+		/* Setting the programming bit stops trace generation, leaving it set keeps the ETM quiet */
+		coresight_etm3_program(ap, source->addr, true);
+		return;
+	}
+	coresight_write(ap, source->addr + ETM4_PRGCTLR, 0);
+	adiv5_mem_poll32(
+		ap, source->addr + ETM4_STATR, ETM4_STATR_IDLE, ETM4_STATR_IDLE, CORESIGHT_TRACE_TIMEOUT_MS, NULL);
+}
+
+static bool coresight_trace_stop(
+	target_s *const t, adiv5_access_port_s *const base, const adiv5_coresight_component_s *const sink)
+{
+	adiv5_debug_port_s *const dp = base->dp;
+	adiv5_access_port_s ap;
+	for (size_t i = 0; i < dp->coresight_count; ++i) {
+		if (!coresight_is_source(&dp->coresight[i]))
+			continue;
+		coresight_component_ap(&ap, base, &dp->coresight[i]);
+		coresight_source_stop(&ap, &dp->coresight[i]);
+	}
+	coresight_component_ap(&ap, base, sink);
+	const bool stopped = coresight_sink_stop(&ap, sink);
+	dp->trace_capturing = false;
+	if (!stopped)
+		tc_printf(t, "Timed out flushing the %s\n", coresight_component_names[sink->kind]);
+	return stopped;
+}
+
+static bool coresight_trace_start(target_s *const t, adiv5_access_port_s *const base,
+	const adiv5_coresight_component_s *const sink, const bool cycle_accurate)
+{
+	adiv5_debug_port_s *const dp = base->dp;
+	adiv5_access_port_s ap;
+	if (dp->trace_capturing)
+		coresight_trace_stop(t, base, sink);
+
+	coresight_component_ap(&ap, base, sink);
+	coresight_sink_start(&ap, sink);
+	for (size_t i = 0; i < dp->coresight_count; ++i) {
+		if (dp->coresight[i].kind != ADIV5_CORESIGHT_FUNNEL)
+			continue;
+		coresight_component_ap(&ap, base, &dp->coresight[i]);
+		coresight_funnel_enable(&ap, &dp->coresight[i]);
+	}
+
+	uint8_t trace_id = CORESIGHT_TRACE_ID_BASE;
+	for (size_t i = 0; i < dp->coresight_count; ++i) {
+		const adiv5_coresight_component_s *const source = &dp->coresight[i];
+		if (!coresight_is_source(source))
+			continue;
+		coresight_component_ap(&ap, base, source);
+		const bool started = source->kind == ADIV5_CORESIGHT_ETM3 ?
+			coresight_etm3_start(&ap, source->addr, trace_id, cycle_accurate) :
+			coresight_etm4_start(&ap, source->addr, trace_id, cycle_accurate);
+		if (started)
+			tc_printf(t, "%s at 0x%08" PRIx32 " on AP %u: trace ID 0x%02x\n", coresight_component_names[source->kind],
+				source->addr, source->apsel, trace_id);
+		else
+			tc_printf(t, "%s at 0x%08" PRIx32 " on AP %u did not respond\n", coresight_component_names[source->kind],
+				source->addr, source->apsel);
+		++trace_id;
+	}
+	if (trace_id == CORESIGHT_TRACE_ID_BASE) {
+		tc_printf(t, "No ETM or PTM found to trace from\n");
+		return false;
+	}
+	dp->trace_capturing = true;
+	tc_printf(t, "Capturing into the %s at 0x%08" PRIx32 "\n", coresight_component_names[sink->kind], sink->addr);
+	return !target_check_error(t);
+}
+
+/* How many words of trace the sink holds, and whether it has wrapped */
+static size_t coresight_sink_fill(adiv5_access_port_s *const ap, const adiv5_coresight_component_s *const sink,
+	size_t *const depth, bool *const wrapped)
+{
+	*depth = coresight_read(ap, sink->addr + TRACE_SINK_RDP);
+	*wrapped = coresight_read(ap, sink->addr + TRACE_SINK_STS) & TRACE_SINK_STS_FULL;
+	uint32_t write_pointer = coresight_read(ap, sink->addr + TRACE_SINK_RWP);
+	if (sink->kind == ADIV5_CORESIGHT_TMC)
+		write_pointer /= 4U;
+	return *wrapped ? *depth : MIN(write_pointer, *depth);
+}
+
+static void coresight_trace_status(
+	target_s *const t, adiv5_access_port_s *const base, const adiv5_coresight_component_s *const sink)
+{
+	const adiv5_debug_port_s *const dp = base->dp;
+	for (size_t i = 0; i < dp->coresight_count; ++i) {
+		const adiv5_coresight_component_s *const component = &dp->coresight[i];
+		tc_printf(t, "%-10s at 0x%08" PRIx32 " on AP %u%s\n", coresight_component_names[component->kind],
+			component->addr, component->apsel, component == sink ? " (sink)" : "");
+	}
+	if (!sink) {
+		tc_printf(t, "No usable ETB or ETF\n");
+		return;
+	}
+	adiv5_access_port_s ap;
+	coresight_component_ap(&ap, base, sink);
+	size_t depth;
+	bool wrapped;
+	const size_t fill = coresight_sink_fill(&ap, sink, &depth, &wrapped);
+	tc_printf(t, "%s, %zu of %zu bytes used%s\n", dp->trace_capturing ? "Capturing" : "Stopped", fill * 4U,
+		depth * 4U, wrapped ? ", wrapped" : "");
+}
+
+#if PC_HOSTED == 1
+static void coresight_trace_output(
+	target_s *const t, FILE *const file, const size_t offset, const uint32_t *const words, const size_t count)
+#else
+static void coresight_trace_output(
+	target_s *const t, void *const file, const size_t offset, const uint32_t *const words, const size_t count)
+#endif
+{
+	uint8_t bytes[CORESIGHT_TRACE_BATCH * 4U];
+	for (size_t i = 0; i < count; ++i) {
+		for (size_t byte = 0; byte < 4U; ++byte)
+			bytes[i * 4U + byte] = (words[i] >> (byte * 8U)) & 0xffU;
+	}
+#if PC_HOSTED == 1
+	if (file) {
+		fwrite(bytes, 1, count * 4U, file);
+		return;
+	}
+#else
+	(void)file;
+#endif
+	for (size_t line = 0; line < count * 4U; line += 16U) {
+		tc_printf(t, "%08zx:", offset + line);
+		for (size_t i = line; i < line + 16U && i < count * 4U; ++i)
+			tc_printf(t, " %02x", bytes[i]);
+		tc_printf(t, "\n");
+	}
+}
+
+/* Stop capture if need be, then read the buffer out oldest word first, to a file in BMDA given one */
+static bool coresight_trace_dump(target_s *const t, adiv5_access_port_s *const base,
+	const adiv5_coresight_component_s *const sink, const char *const name)
+{
+	if (base->dp->trace_capturing && !coresight_trace_stop(t, base, sink))
+		return false;
+
+#if PC_HOSTED == 1
+	FILE *file = NULL;
+	if (name) {
+		file = fopen(name, "wb");
+		if (!file) {
+			tc_printf(t, "Could not open %s\n", name);
+			return false;
+		}
+	}
+#else
+	void *const file = NULL;
+	if (name) {
+		tc_printf(t, "Dumping to a file needs BMDA\n");
+		return false;
+	}
+#endif
+
+	adiv5_access_port_s ap;
+	coresight_component_ap(&ap, base, sink);
+	size_t depth;
+	bool wrapped;
+	const size_t count = coresight_sink_fill(&ap, sink, &depth, &wrapped);
+	/* The ETB reads from wherever RRP points, so start it at the oldest word */
+	if (sink->kind == ADIV5_CORESIGHT_ETB)
+		coresight_write(&ap, sink->addr + TRACE_SINK_RRP,
+			wrapped ? coresight_read(&ap, sink->addr + TRACE_SINK_RWP) : 0U);
+
+	adiv5_queue_entry_s entries[CORESIGHT_TRACE_BATCH + 2U];
+	uint32_t words[CORESIGHT_TRACE_BATCH];
+	adiv5_queue_s queue;
+	bool ok = true;
+	for (size_t offset = 0; offset < count && ok; offset += CORESIGHT_TRACE_BATCH) {
+		const size_t batch = MIN(CORESIGHT_TRACE_BATCH, count - offset);
+		adiv5_queue_init(&queue, ap.dp, entries, ARRAY_LENGTH(entries));
+		adiv5_queue_ap_write(&queue, &ap, ADIV5_AP_CSW, ap.csw | ADIV5_AP_CSW_SIZE_WORD | ADIV5_AP_CSW_ADDRINC_NONE);
+		adiv5_queue_ap_write(&queue, &ap, ADIV5_AP_TAR, sink->addr + TRACE_SINK_RRD);
+		for (size_t i = 0; i < batch; ++i)
+			adiv5_queue_ap_read(&queue, &ap, ADIV5_AP_DRW, &words[i]);
+		ok = adiv5_queue_run(&queue);
+		if (ok)
+			coresight_trace_output(t, file, offset * 4U, words, batch);
+	}
+	/* Take the TMC out of its stopped state */
+	if (sink->kind == ADIV5_CORESIGHT_TMC)
+		coresight_write(&ap, sink->addr + TRACE_SINK_CTL, 0);
+	adiv5_ap_shadow_invalidate(&ap);
+	adiv5_ap_shadow_invalidate(base);
+
+#if PC_HOSTED == 1
+	if (file && fclose(file) != 0)
+		ok = false;
+#endif
+	if (!ok) {
+		tc_printf(t, "Failed reading the trace buffer\n");
+		return false;
+	}
+	tc_printf(t, "Read %zu bytes of trace%s\n", count * 4U, wrapped ? ", the buffer had wrapped" : "");
+	return !target_check_error(t);
+}
+
+bool coresight_trace_command(target_s *const t, adiv5_access_port_s *const ap, const int argc, const char **const argv)
+{
+	const adiv5_coresight_component_s *const sink = coresight_trace_sink(ap);
+	if (argc == 1 || !strcmp(argv[1], "status")) {
+		coresight_trace_status(t, ap, sink);
+		return true;
+	}
+	if (!sink) {
+		tc_printf(t, "No usable ETB or ETF found on this debug port\n");
+		return false;
+	}
+	if (!strcmp(argv[1], "start") && argc <= 3) {
+		const bool cycle_accurate = argc == 3 && !strcmp(argv[2], "cycle");
+		if (argc == 3 && !cycle_accurate) {
+			tc_printf(t, "Unknown start option '%s'\n", argv[2]);
+			return false;
+		}
+		return coresight_trace_start(t, ap, sink, cycle_accurate);
+	}
+	if (!strcmp(argv[1], "stop") && argc == 2)
+		return coresight_trace_stop(t, ap, sink) && !target_check_error(t);
+	if (!strcmp(argv[1], "dump") && argc <= 3)
+		return coresight_trace_dump(t, ap, sink, argc == 3 ? argv[2] : NULL);
+	tc_printf(t, "usage: monitor etb [start [cycle]|stop|status|dump [file]]\n");
+	return false;
+}
+
+static bool coresight_ap_has(const adiv5_debug_port_s *const dp, const uint8_t apsel, const adiv5_coresight_kind_e kind)
+{
+	for (size_t i = 0; i < dp->coresight_count; ++i) {
+		if (dp->coresight[i].apsel == apsel && dp->coresight[i].kind == kind)
+			return true;
+	}
+	return false;
+}
+
+/* The index'th CTI either behind the AP given, or behind any AP without cores */
+static const adiv5_coresight_component_s *coresight_cti_nth(
+	const adiv5_debug_port_s *const dp, const bool local, const uint8_t apsel, size_t index)
+{
+	for (size_t i = 0; i < dp->coresight_count; ++i) {
+		const adiv5_coresight_component_s *const component = &dp->coresight[i];
+		if (component->kind != ADIV5_CORESIGHT_CTI)
+			continue;
+		if (local ? component->apsel != apsel : coresight_ap_has(dp, component->apsel, ADIV5_CORESIGHT_CORE))
+			continue;
+		if (!index--)
+			return component;
+	}
+	return NULL;
+}
+
+/*
+ * Find the CTI of the core whose SCS or debug unit is at core_addr behind ap, any core behind it for 0.
+ * Cores sharing an AP with CTIs take those in ROM table order, which is how the Cortex-A clusters and
+ * Cortex-M cores with their own CTI lay them out. The rest take the CTIs of the system APs in order,
+ * as on the STM32H7 dual core parts.
+ */
+static const adiv5_coresight_component_s *coresight_cti_find(
+	const adiv5_access_port_s *const ap, const uint32_t core_addr)
+{
+	const adiv5_debug_port_s *const dp = ap->dp;
+	const bool local = coresight_ap_has(dp, ap->apsel, ADIV5_CORESIGHT_CTI);
+	size_t index = 0;
+	for (size_t i = 0; i < dp->coresight_count; ++i) {
+		const adiv5_coresight_component_s *const component = &dp->coresight[i];
+		if (component->kind != ADIV5_CORESIGHT_CORE)
+			continue;
+		if (component->apsel == ap->apsel && (!core_addr || component->addr == core_addr))
+			return coresight_cti_nth(dp, local, ap->apsel, index);
+		if (local ? component->apsel == ap->apsel : !coresight_ap_has(dp, component->apsel, ADIV5_CORESIGHT_CTI))
+			++index;
+	}
+	return NULL;
+}
+
+bool coresight_cti_join(target_s *const t, adiv5_access_port_s *const ap, const uint32_t core_addr)
+{
+	adiv5_debug_port_s *const dp = ap->dp;
+	const adiv5_coresight_component_s *const cti = coresight_cti_find(ap, core_addr);
+	if (!cti)
+		return false;
+	adiv5_access_port_s cti_ap;
+	coresight_component_ap(&cti_ap, ap, cti);
+	coresight_write(&cti_ap, cti->addr + CORESIGHT_LAR, CORESIGHT_LAR_KEY);
+	coresight_write(&cti_ap, cti->addr + CTI_INTACK, 1U << CTI_TRIGGER_HALT);
+	const uint32_t gate = coresight_read(&cti_ap, cti->addr + CTI_GATE);
+	coresight_write(&cti_ap, cti->addr + CTI_GATE, gate | CTI_CHANNEL_HALT);
+	coresight_write(&cti_ap, cti->addr + CTI_OUTEN(CTI_TRIGGER_HALT), CTI_CHANNEL_HALT);
+	coresight_write(&cti_ap, cti->addr + CTI_CONTROL, CTI_CONTROL_GLBEN);
+	if (target_check_error(t))
+		return false;
+
+	dp->halt_group |= 1U << (size_t)(cti - dp->coresight);
+	t->halt_group = (uintptr_t)dp;
+	DEBUG_INFO("Cross triggering through the CTI at 0x%08" PRIx32 " on AP %u\n", cti->addr, cti->apsel);
+	return true;
+}
+
+void coresight_cti_leave(target_s *const t, adiv5_access_port_s *const ap, const uint32_t core_addr)
+{
+	if (!t->halt_group)
+		return;
+	adiv5_debug_port_s *const dp = ap->dp;
+	t->halt_group = 0;
+	const adiv5_coresight_component_s *const cti = coresight_cti_find(ap, core_addr);
+	if (!cti)
+		return;
+	const uint16_t bit = 1U << (size_t)(cti - dp->coresight);
+	dp->halt_group &= ~bit;
+	adiv5_access_port_s cti_ap;
+	coresight_component_ap(&cti_ap, ap, cti);
+	coresight_write(&cti_ap, cti->addr + CTI_OUTEN(CTI_TRIGGER_HALT), 0U);
+	coresight_write(&cti_ap, cti->addr + CTI_INTACK, 1U << CTI_TRIGGER_HALT);
+}
+
+bool coresight_cti_halt(adiv5_access_port_s *const ap)
+{
+	adiv5_debug_port_s *const dp = ap->dp;
+	for (size_t i = 0; i < dp->coresight_count; ++i) {
+		if (!(dp->halt_group & (1U << i)))
+			continue;
+		adiv5_access_port_s cti_ap;
+		coresight_component_ap(&cti_ap, ap, &dp->coresight[i]);
+		coresight_write(&cti_ap, dp->coresight[i].addr + CTI_APPPULSE, CTI_CHANNEL_HALT);
+		return true;
+	}
+	return false;
+}
+
+void coresight_cti_resume(target_s *const t, adiv5_access_port_s *const ap, const uint32_t core_addr)
+{
+	if (!t->halt_group)
+		return;
+	const adiv5_coresight_component_s *const cti = coresight_cti_find(ap, core_addr);
+	if (!cti)
+		return;
+	adiv5_access_port_s cti_ap;
+	coresight_component_ap(&cti_ap, ap, cti);
+	coresight_write(&cti_ap, cti->addr + CTI_INTACK, 1U << CTI_TRIGGER_HALT);
+}
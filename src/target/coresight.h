@@ -0,0 +1,53 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2026 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TARGET_CORESIGHT_H
+#define TARGET_CORESIGHT_H
+
+#include "target.h"
+#include "adiv5.h"
+
+/* Handle 'monitor etb' for a target whose debug registers are reached through ap */
+bool coresight_trace_command(target_s *t, adiv5_access_port_s *ap, int argc, const char **argv);
+
+/*
+ * Cross-triggered halting for the core whose SCS or debug unit is at core_addr behind ap, 0 meaning
+ * the only one there. Joining returns false if the core has no CTI to join the DP's halt group with.
+ */
+bool coresight_cti_join(target_s *t, adiv5_access_port_s *ap, uint32_t core_addr);
+void coresight_cti_leave(target_s *t, adiv5_access_port_s *ap, uint32_t core_addr);
+/* Halt every core in the group with one pulse, returning false if there's no group on ap's DP */
+bool coresight_cti_halt(adiv5_access_port_s *ap);
+/* Acknowledge the core's latched debug request ahead of restarting it */
+void coresight_cti_resume(target_s *t, adiv5_access_port_s *ap, uint32_t core_addr);
+
+#endif /* TARGET_CORESIGHT_H */
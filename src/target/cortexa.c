@@ -33,12 +33,21 @@
 #include "target.h"
 #include "gdb_reg.h"
 #include "target_internal.h"
+#include "coresight.h"
 
 #include <stdlib.h>
 #include <assert.h>
 
 static const char cortexa_driver_str[] = "ARM Cortex-A";
 
+static bool cortexa_etb(target_s *t, int argc, const char **argv);
+
+static const command_s cortexa_cmd_list[] = {
+	{"etb", cortexa_etb,
+		"Capture ETM/PTM instruction trace in the on-chip ETB/ETF: [start [cycle]|stop|status|dump [file]]"},
+	{NULL, NULL, NULL},
+};
+
 static bool cortexa_attach(target_s *t);
 static void cortexa_detach(target_s *t);
 static void cortexa_halt_resume(target_s *t, bool step);
@@ -82,6 +91,13 @@ typedef struct cortexa_priv {
 	unsigned hw_watchpoint_max;
 	uint16_t hw_watchpoint_mask;
 	bool mmu_fault;
+	/* The VFP registers are only read out of the core when first asked for after a halt */
+	bool vfp_cached;
+
+	/* Last VA to PA translation, by page, valid until the core next runs */
+	bool pa_cache_valid;
+	uint32_t pa_cache_va;
+	uint32_t pa_cache_pa;
 } cortexa_priv_s;
 
 /* This may be specific to Cortex-A9 */
@@ -106,6 +122,7 @@ typedef struct cortexa_priv {
 #define DBGDSCR_SDABORT_L        (1U << 6U)
 #define DBGDSCR_MOE_MASK         (0xfU << 2U)
 #define DBGDSCR_MOE_HALT_REQ     (0x0U << 2U)
+#define DBGDSCR_MOE_EXT_DBGRQ    (0x4U << 2U)
 #define DBGDSCR_MOE_WATCH_ASYNC  (0x2U << 2U)
 #define DBGDSCR_MOE_WATCH_SYNC   (0xaU << 2U)
 #define DBGDSCR_RESTARTED        (1U << 1U)
@@ -323,6 +340,7 @@ static void apb_write(target_s *t, uint16_t reg, uint32_t val)
 	uint32_t addr = priv->base + 4U * reg;
 	adiv5_ap_write(ap, ADIV5_AP_TAR, addr);
 	adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, val);
+	adiv5_ap_shadow_invalidate(ap);
 }
 
 static uint32_t apb_read(target_s *t, uint16_t reg)
@@ -332,18 +350,83 @@ static uint32_t apb_read(target_s *t, uint16_t reg)
 	uint32_t addr = priv->base + 4U * reg;
 	adiv5_ap_write(ap, ADIV5_AP_TAR, addr);
 	adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+	adiv5_ap_shadow_invalidate(ap);
 	return adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
 }
 
+/*
+ * Streaming data through the DCC in fast mode accesses the same register over and over. The APB-AP
+ * doesn't auto-increment TAR, so it's set just once and the DRW accesses issued back to back,
+ * each posted read returning the result of the one before it.
+ */
+static void apb_read_repeated(target_s *t, uint16_t reg, uint32_t *data, size_t count)
+{
+	cortexa_priv_s *priv = t->priv;
+	adiv5_access_port_s *ap = priv->apb;
+	adiv5_ap_write(ap, ADIV5_AP_TAR, priv->base + 4U * reg);
+	adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+	for (size_t i = 1; i < count; ++i)
+		data[i - 1U] = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+	data[count - 1U] = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
+	adiv5_ap_shadow_invalidate(ap);
+}
+
+static void apb_write_repeated(target_s *t, uint16_t reg, const uint8_t *data, size_t count)
+{
+	cortexa_priv_s *priv = t->priv;
+	adiv5_access_port_s *ap = priv->apb;
+	adiv5_ap_write(ap, ADIV5_AP_TAR, priv->base + 4U * reg);
+	for (size_t i = 0; i < count; ++i, data += 4U) {
+		uint32_t value;
+		memcpy(&value, data, sizeof(value));
+		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, value);
+	}
+	adiv5_ap_shadow_invalidate(ap);
+}
+
+/*
+ * Queue the same accesses apb_write() and apb_read() make, so a whole sequence of them can be
+ * run pipelined, or in a single round trip where the backend supports that
+ */
+#define CORTEXA_QUEUE_SIZE 32U
+
+static void apb_queue_write(adiv5_queue_s *queue, target_s *t, uint16_t reg, uint32_t val)
+{
+	cortexa_priv_s *priv = t->priv;
+	adiv5_queue_ap_write(queue, priv->apb, ADIV5_AP_TAR, priv->base + 4U * reg);
+	adiv5_queue_ap_write(queue, priv->apb, ADIV5_AP_DRW, val);
+}
+
+static void apb_queue_read(adiv5_queue_s *queue, target_s *t, uint16_t reg, uint32_t *result)
+{
+	cortexa_priv_s *priv = t->priv;
+	adiv5_queue_ap_write(queue, priv->apb, ADIV5_AP_TAR, priv->base + 4U * reg);
+	adiv5_queue_ap_read(queue, priv->apb, ADIV5_AP_DRW, result);
+}
+
+/* As read_gpreg(), the DCC being in stall mode keeps each step waiting on the one before */
+static void queue_read_gpreg(adiv5_queue_s *queue, target_s *t, uint8_t regno, uint32_t *result)
+{
+	apb_queue_write(queue, t, DBGITR, MCR | DBGDTRTXint | ((regno & 0xfU) << 12U));
+	apb_queue_read(queue, t, DBGDTRTX, result);
+}
+
 static uint32_t va_to_pa(target_s *t, uint32_t va)
 {
 	cortexa_priv_s *priv = t->priv;
+	if (priv->pa_cache_valid && priv->pa_cache_va == (va & ~0xfffU))
+		return priv->pa_cache_pa | (va & 0xfffU);
 	write_gpreg(t, 0, va);
 	apb_write(t, DBGITR, MCR | ATS1CPR);
 	apb_write(t, DBGITR, MRC | PAR);
 	uint32_t par = read_gpreg(t, 0);
 	if (par & 1U)
 		priv->mmu_fault = true;
+	else {
+		priv->pa_cache_valid = true;
+		priv->pa_cache_va = va & ~0xfffU;
+		priv->pa_cache_pa = par & ~0xfffU;
+	}
 	uint32_t pa = (par & ~0xfffU) | (va & 0xfffU);
 	DEBUG_INFO("%s: VA = 0x%08" PRIx32 ", PAR = 0x%08" PRIx32 ", PA = 0x%08" PRIX32 "\n", __func__, va, par, pa);
 	return pa;
@@ -353,7 +436,8 @@ static void cortexa_slow_mem_read(target_s *t, void *dest, target_addr_t src, si
 {
 	cortexa_priv_s *priv = t->priv;
 	unsigned words = (len + (src & 3U) + 3U) / 4U;
-	uint32_t dest32[words];
+	/* One extra for the junk first read below */
+	uint32_t dest32[words + 1U];
 
 	/* Set r0 to aligned src address */
 	write_gpreg(t, 0, src & ~3);
@@ -366,14 +450,10 @@ static void cortexa_slow_mem_read(target_s *t, void *dest, target_addr_t src, si
 	apb_write(t, DBGITR, 0xecb05e01); /* ldc 14, cr5, [r0], #4 */
 	/* According to the ARMv7-A ARM, in fast mode, the first read from
 	 * DBGDTRTX is  supposed to block until the instruction is complete,
-	 * but we see the first read returns junk, so it's read here and
-	 * ignored. */
-	apb_read(t, DBGDTRTX);
-
-	for (unsigned i = 0; i < words; i++)
-		dest32[i] = apb_read(t, DBGDTRTX);
+	 * but we see the first read returns junk, so it's read and ignored. */
+	apb_read_repeated(t, DBGDTRTX, dest32, words + 1U);
 
-	memcpy(dest, (uint8_t *)dest32 + (src & 3U), len);
+	memcpy(dest, (uint8_t *)(dest32 + 1U) + (src & 3U), len);
 
 	/* Switch back to stalling DCC mode */
 	dbgdscr = (dbgdscr & ~DBGDSCR_EXTDCCMODE_MASK) | DBGDSCR_EXTDCCMODE_STALL;
@@ -410,16 +490,27 @@ static void cortexa_slow_mem_write_bytes(target_s *t, target_addr_t dest, const
 static void cortexa_slow_mem_write(target_s *t, target_addr_t dest, const void *src, size_t len)
 {
 	cortexa_priv_s *priv = t->priv;
-	if (len == 0)
-		return;
+	const uint8_t *src8 = src;
 
-	if ((dest & 3U) || (len & 3U)) {
-		cortexa_slow_mem_write_bytes(t, dest, src, len);
-		return;
+	/* Bytes up to the first word boundary and after the last go one at a time, the words in between in fast mode */
+	const size_t head = MIN((4U - (dest & 3U)) & 3U, len);
+	if (head) {
+		cortexa_slow_mem_write_bytes(t, dest, src8, head);
+		if (priv->mmu_fault)
+			return;
+		dest += head;
+		src8 += head;
+		len -= head;
 	}
+	const size_t tail = len & 3U;
+	if (tail) {
+		cortexa_slow_mem_write_bytes(t, dest + len - tail, src8 + len - tail, tail);
+		len -= tail;
+	}
+	if (len == 0)
+		return;
 
 	write_gpreg(t, 0, dest);
-	const uint32_t *src32 = src;
 
 	/* Switch to fast DCC mode */
 	uint32_t dbgdscr = apb_read(t, DBGDSCR);
@@ -428,8 +519,7 @@ static void cortexa_slow_mem_write(target_s *t, target_addr_t dest, const void *
 
 	apb_write(t, DBGITR, 0xeca05e01); /* stc 14, cr5, [r0], #4 */
 
-	for (; len; len -= 4U)
-		apb_write(t, DBGDTRRX, *src32++);
+	apb_write_repeated(t, DBGDTRRX, src8, len / 4U);
 
 	/* Switch back to stalling DCC mode */
 	dbgdscr = (dbgdscr & ~DBGDSCR_EXTDCCMODE_MASK) | DBGDSCR_EXTDCCMODE_STALL;
@@ -453,10 +543,14 @@ static bool cortexa_check_error(target_s *t)
 const char *cortexa_regs_description(target_s *t)
 {
 	(void)t;
-	const size_t description_length = create_tdesc_cortex_a(NULL, 0) + 1U;
-	char *const description = malloc(description_length);
-	if (description)
-		create_tdesc_cortex_a(description, description_length);
+	/* The description is the same for every Cortex-A, so it's built once and kept */
+	static char *description = NULL;
+	if (!description) {
+		const size_t description_length = create_tdesc_cortex_a(NULL, 0) + 1U;
+		description = malloc(description_length);
+		if (description)
+			create_tdesc_cortex_a(description, description_length);
+	}
 	return description;
 }
 
@@ -510,9 +604,16 @@ bool cortexa_probe(adiv5_access_port_s *apb, uint32_t debug_base)
 	t->breakwatch_set = cortexa_breakwatch_set;
 	t->breakwatch_clear = cortexa_breakwatch_clear;
 
+	target_add_commands(t, cortexa_cmd_list, cortexa_driver_str);
 	return true;
 }
 
+static bool cortexa_etb(target_s *t, int argc, const char **argv)
+{
+	cortexa_priv_s *priv = t->priv;
+	return coresight_trace_command(t, priv->apb, argc, argv);
+}
+
 bool cortexa_attach(target_s *t)
 {
 	cortexa_priv_s *priv = t->priv;
@@ -543,6 +644,8 @@ bool cortexa_attach(target_s *t)
 
 	platform_nrst_set_val(false);
 
+	/* Halt along with the other attached cores on the DP where there's a CTI to do it through */
+	coresight_cti_join(t, priv->apb, priv->base);
 	return true;
 }
 
@@ -553,6 +656,7 @@ void cortexa_detach(target_s *t)
 	/* Clear any stale breakpoints */
 	for (size_t i = 0; i < priv->hw_breakpoint_max; i++)
 		apb_write(t, DBGBCR(i), 0);
+	coresight_cti_leave(t, priv->apb, priv->base);
 
 	/* Restore any clobbered registers */
 	cortexa_regs_write_internal(t);
@@ -595,9 +699,12 @@ static void write_gpreg(target_s *t, uint8_t regno, uint32_t val)
 	apb_write(t, DBGITR, instr);
 }
 
+static void cortexa_vfp_read(target_s *t);
+
 static void cortexa_regs_read(target_s *t, void *data)
 {
 	cortexa_priv_s *priv = (cortexa_priv_s *)t->priv;
+	cortexa_vfp_read(t);
 	memcpy(data, &priv->reg_cache, t->regs_size);
 }
 
@@ -605,6 +712,7 @@ static void cortexa_regs_write(target_s *t, const void *data)
 {
 	cortexa_priv_s *priv = (cortexa_priv_s *)t->priv;
 	memcpy(&priv->reg_cache, data, t->regs_size);
+	priv->vfp_cached = true;
 }
 
 static ssize_t ptr_for_reg(target_s *t, int reg, void **r)
@@ -630,6 +738,8 @@ static ssize_t ptr_for_reg(target_s *t, int reg, void **r)
 
 static ssize_t cortexa_reg_read(target_s *t, int reg, void *data, size_t max)
 {
+	if (reg >= 17)
+		cortexa_vfp_read(t);
 	void *r = NULL;
 	size_t s = ptr_for_reg(t, reg, &r);
 	if (s > max)
@@ -640,6 +750,8 @@ static ssize_t cortexa_reg_read(target_s *t, int reg, void *data, size_t max)
 
 static ssize_t cortexa_reg_write(target_s *t, int reg, const void *data, size_t max)
 {
+	if (reg >= 17)
+		cortexa_vfp_read(t);
 	void *r = NULL;
 	size_t s = ptr_for_reg(t, reg, &r);
 	if (s > max)
@@ -648,43 +760,73 @@ static ssize_t cortexa_reg_write(target_s *t, int reg, const void *data, size_t
 	return s;
 }
 
+/* Read the core registers out in one queued sequence, leaving the VFP registers for when they're wanted */
 static void cortexa_regs_read_internal(target_s *t)
 {
 	cortexa_priv_s *priv = (cortexa_priv_s *)t->priv;
+	adiv5_queue_entry_s entries[CORTEXA_QUEUE_SIZE];
+	adiv5_queue_s queue;
+	adiv5_queue_init(&queue, priv->apb->dp, entries, ARRAY_LENGTH(entries));
+
 	/* Read general purpose registers */
 	for (size_t i = 0; i < 15U; i++)
-		priv->reg_cache.r[i] = read_gpreg(t, i);
+		queue_read_gpreg(&queue, t, i, &priv->reg_cache.r[i]);
 
 	/* Read PC, via r0.  MCR is UNPREDICTABLE for Rt = r15. */
-	apb_write(t, DBGITR, 0xe1a0000f); /* mov r0, pc */
-	priv->reg_cache.r[15] = read_gpreg(t, 0);
+	apb_queue_write(&queue, t, DBGITR, 0xe1a0000f); /* mov r0, pc */
+	queue_read_gpreg(&queue, t, 0, &priv->reg_cache.r[15]);
 	/* Read CPSR */
-	apb_write(t, DBGITR, 0xe10f0000); /* mrs r0, CPSR */
-	priv->reg_cache.cpsr = read_gpreg(t, 0);
+	apb_queue_write(&queue, t, DBGITR, 0xe10f0000); /* mrs r0, CPSR */
+	queue_read_gpreg(&queue, t, 0, &priv->reg_cache.cpsr);
+	adiv5_queue_run(&queue);
+	adiv5_ap_shadow_invalidate(priv->apb);
+
+	priv->reg_cache.r[15] -= (priv->reg_cache.cpsr & CPSR_THUMB) ? 4 : 8;
+	priv->vfp_cached = false;
+}
+
+static void cortexa_vfp_read(target_s *t)
+{
+	cortexa_priv_s *priv = (cortexa_priv_s *)t->priv;
+	if (priv->vfp_cached)
+		return;
+	adiv5_queue_entry_s entries[CORTEXA_QUEUE_SIZE];
+	adiv5_queue_s queue;
+	adiv5_queue_init(&queue, priv->apb->dp, entries, ARRAY_LENGTH(entries));
+
 	/* Read FPSCR */
-	apb_write(t, DBGITR, 0xeef10a10); /* vmrs r0, fpscr */
-	priv->reg_cache.fpscr = read_gpreg(t, 0);
+	apb_queue_write(&queue, t, DBGITR, 0xeef10a10); /* vmrs r0, fpscr */
+	queue_read_gpreg(&queue, t, 0, &priv->reg_cache.fpscr);
 	/* Read out VFP registers */
+	uint32_t halves[16U][2U];
 	for (size_t i = 0; i < 16U; i++) {
 		/* Read D[i] to R0/R1 */
-		apb_write(t, DBGITR, 0xec510b10 | i); /* vmov r0, r1, d0 */
-		priv->reg_cache.d[i] = ((uint64_t)read_gpreg(t, 1) << 32U) | read_gpreg(t, 0);
+		apb_queue_write(&queue, t, DBGITR, 0xec510b10 | i); /* vmov r0, r1, d0 */
+		queue_read_gpreg(&queue, t, 0, &halves[i][0]);
+		queue_read_gpreg(&queue, t, 1, &halves[i][1]);
 	}
-	priv->reg_cache.r[15] -= (priv->reg_cache.cpsr & CPSR_THUMB) ? 4 : 8;
+	adiv5_queue_run(&queue);
+	adiv5_ap_shadow_invalidate(priv->apb);
+
+	for (size_t i = 0; i < 16U; i++)
+		priv->reg_cache.d[i] = ((uint64_t)halves[i][1] << 32U) | halves[i][0];
+	priv->vfp_cached = true;
 }
 
 static void cortexa_regs_write_internal(target_s *t)
 {
 	cortexa_priv_s *priv = (cortexa_priv_s *)t->priv;
-	/* First write back floats */
-	for (size_t i = 0; i < 16U; i++) {
-		write_gpreg(t, 1, priv->reg_cache.d[i] >> 32U);
-		write_gpreg(t, 0, priv->reg_cache.d[i]);
-		apb_write(t, DBGITR, 0xec410b10U | i); /* vmov d[i], r0, r1 */
+	/* First write back floats, provided they were read out, otherwise the core still holds them as they were */
+	if (priv->vfp_cached) {
+		for (size_t i = 0; i < 16U; i++) {
+			write_gpreg(t, 1, priv->reg_cache.d[i] >> 32U);
+			write_gpreg(t, 0, priv->reg_cache.d[i]);
+			apb_write(t, DBGITR, 0xec410b10U | i); /* vmov d[i], r0, r1 */
+		}
+		/* Write back FPSCR */
+		write_gpreg(t, 0, priv->reg_cache.fpscr);
+		apb_write(t, DBGITR, 0xeee10a10); /* vmsr fpscr, r0 */
 	}
-	/* Write back FPSCR */
-	write_gpreg(t, 0, priv->reg_cache.fpscr);
-	apb_write(t, DBGITR, 0xeee10a10); /* vmsr fpscr, r0 */
 	/* Write back the CPSR */
 	write_gpreg(t, 0, priv->reg_cache.cpsr);
 	apb_write(t, DBGITR, 0xe12ff000); /* msr CPSR_fsxc, r0 */
@@ -732,7 +874,10 @@ static void cortexa_halt_request(target_s *t)
 {
 	volatile exception_s e;
 	TRY_CATCH (e, EXCEPTION_TIMEOUT) {
-		apb_write(t, DBGDRCR, DBGDRCR_HRQ);
+		/* A core in a cross-triggered halt group takes the rest of the group with it */
+		cortexa_priv_s *priv = t->priv;
+		if (!t->halt_group || !coresight_cti_halt(priv->apb))
+			apb_write(t, DBGDRCR, DBGDRCR_HRQ);
 	}
 	if (e.type) {
 		tc_printf(t, "Timeout sending interrupt, is target in WFI?\n");
@@ -770,6 +915,7 @@ static target_halt_reason_e cortexa_halt_poll(target_s *t, target_addr_t *watch)
 	target_halt_reason_e reason = TARGET_HALT_BREAKPOINT;
 	switch (dbgdscr & DBGDSCR_MOE_MASK) {
 	case DBGDSCR_MOE_HALT_REQ:
+	case DBGDSCR_MOE_EXT_DBGRQ:
 		reason = TARGET_HALT_REQUEST;
 		break;
 	case DBGDSCR_MOE_WATCH_ASYNC:
@@ -802,6 +948,8 @@ static target_halt_reason_e cortexa_halt_poll(target_s *t, target_addr_t *watch)
 void cortexa_halt_resume(target_s *t, bool step)
 {
 	cortexa_priv_s *priv = t->priv;
+	/* The page tables may change while the core runs */
+	priv->pa_cache_valid = false;
 	/* Set breakpoint comarator for single stepping if needed */
 	if (step) {
 		uint32_t addr = priv->reg_cache.r[15];
@@ -837,6 +985,7 @@ void cortexa_halt_resume(target_s *t, bool step)
 	dbgdscr &= ~DBGDSCR_ITREN;
 	apb_write(t, DBGDSCR, dbgdscr);
 
+	coresight_cti_resume(t, priv->apb, priv->base);
 	do {
 		apb_write(t, DBGDRCR, DBGDRCR_CSE | DBGDRCR_RRQ);
 		dbgdscr = apb_read(t, DBGDSCR);
@@ -35,10 +35,12 @@
 #include "target_probe.h"
 #include "jep106.h"
 #include "cortexm.h"
+#include "coresight.h"
 #include "gdb_reg.h"
 #include "command.h"
 #include "gdb_packet.h"
 #include "semihosting.h"
+#include "crc32.h"
 #include "platform.h"
 
 #include <string.h>
@@ -72,12 +74,22 @@
 static const char cortexm_driver_str[] = "ARM Cortex-M";
 
 static bool cortexm_vector_catch(target_s *t, int argc, const char **argv);
+static bool cortexm_profile(target_s *t, int argc, const char **argv);
+static bool cortexm_cycles(target_s *t, int argc, const char **argv);
+static bool cortexm_trace_watch(target_s *t, int argc, const char **argv);
+static bool cortexm_etb(target_s *t, int argc, const char **argv);
 #if PC_HOSTED == 0
 static bool cortexm_redirect_stdout(target_s *t, int argc, const char **argv);
 #endif
 
 const command_s cortexm_cmd_list[] = {
 	{"vector_catch", cortexm_vector_catch, "Catch exception vectors"},
+	{"profile", cortexm_profile, "Sample the PC while running: <duration_ms> [period_ms [start end]]"},
+	{"cycles", cortexm_cycles, "Show the DWT cycle count of the last run: [reset|report (enable|disable)]"},
+	{"trace_watch", cortexm_trace_watch,
+		"Trace data accesses over SWO without halting: [(read|write|access) <addr> [size [pc]]|clear]"},
+	{"etb", cortexm_etb,
+		"Capture ETM instruction trace in the on-chip ETB/ETF: [start [cycle]|stop|status|dump [file]]"},
 #if PC_HOSTED == 0
 	{"redirect_stdout", cortexm_redirect_stdout, "Redirect semihosting stdout to USB UART"},
 #endif
@@ -90,7 +102,9 @@ const command_s cortexm_cmd_list[] = {
 
 static const char *cortexm_regs_description(target_s *t);
 static void cortexm_regs_read(target_s *t, void *data);
+static bool cortexm_regs_unstack(target_s *t, void *data, target_addr_t stack, const uint32_t *callee_saved);
 static void cortexm_regs_write(target_s *t, const void *data);
+static void cortexm_regs_flush(target_s *t);
 static uint32_t cortexm_pc_read(target_s *t);
 static ssize_t cortexm_reg_read(target_s *t, int reg, void *data, size_t max);
 static ssize_t cortexm_reg_write(target_s *t, int reg, const void *data, size_t max);
@@ -98,35 +112,116 @@ static ssize_t cortexm_reg_write(target_s *t, int reg, const void *data, size_t
 static void cortexm_reset(target_s *t);
 static target_halt_reason_e cortexm_halt_poll(target_s *t, target_addr_t *watch);
 static void cortexm_halt_request(target_s *t);
-static int cortexm_fault_unwind(target_s *t);
+static int cortexm_fault_unwind(target_s *t, uint32_t hfsr, uint32_t cfsr);
 
 static int cortexm_breakwatch_set(target_s *t, breakwatch_s *bw);
 static int cortexm_breakwatch_clear(target_s *t, breakwatch_s *bw);
 static target_addr_t cortexm_check_watch(target_s *t);
+static int cortexm_soft_watch_set(target_s *t, breakwatch_s *bw);
+static uint32_t cortexm_soft_watch_step(target_s *t, target_addr_t *watch, target_halt_reason_e *reason);
 
 #define CORTEXM_MAX_WATCHPOINTS 4U /* architecture says up to 15, no implementation has > 4 */
 #define CORTEXM_MAX_BREAKPOINTS 8U /* architecture says up to 127, no implementation has > 8 */
 
+/* Software breakpoints injected into RAM are marked in breakwatch_s reserved[1] */
+#define CORTEXM_BREAK_SOFT_RAM 1U
+/* As are write watchpoints the probe checks by stepping the core when the DWT comparators are all in use */
+#define CORTEXM_WATCH_SOFT 2U
+
+/* Number and maximum length of the software watchpoints, and how long to step for at most per poll */
+#if PC_HOSTED == 1
+#define CORTEXM_SOFT_WATCHPOINTS 8U
+#define CORTEXM_SOFT_WATCH_SIZE  64U
+#else
+#define CORTEXM_SOFT_WATCHPOINTS 4U
+#define CORTEXM_SOFT_WATCH_SIZE  16U
+#endif
+#define CORTEXM_SOFT_WATCH_SLICE_MS 20U
+
+/* FPBv1 comparator fields: which halfwords of the matched word to replace with a BKPT */
+#define CORTEXM_FPB_V1_ADDR_MASK     0x1ffffffcU
+#define CORTEXM_FPB_V1_REPLACE_LOWER 0x40000000U
+#define CORTEXM_FPB_V1_REPLACE_UPPER 0x80000000U
+#define CORTEXM_FPB_V1_REPLACE_MASK  0xc0000000U
+
+/*
+ * Number of AP accesses batched at a time when reading or writing the core registers. BMDA can afford
+ * enough for the whole register file, letting backends that pack queues into packets do it in one go.
+ */
+#if PC_HOSTED == 1
+#define CORTEXM_REGS_QUEUE_DEPTH 192U
+#else
+#define CORTEXM_REGS_QUEUE_DEPTH 16U
+#endif
+/* Room for reading or clearing DFSR, HFSR and CFSR and reading one more word, on halting */
+#define CORTEXM_STATUS_QUEUE_DEPTH 12U
+/* Number of core registers held in the register cache, one per regnum_cortex_m and regnum_cortex_mf entry */
+#define CORTEXM_CACHED_REGS 53U
+
+/* Bytes handed to the CRC32 stub per run, keeping each well inside cortexm_run_stub()'s timeout */
+#define CORTEXM_CRC32_STUB_CHUNK 0x8000U
+
+/* PC sampling histogram size, BMDA can afford one fine enough for gprof */
+#if PC_HOSTED == 1
+#define CORTEXM_PROFILE_BINS 16384U
+#else
+#define CORTEXM_PROFILE_BINS 64U
+#endif
+/* Number of PCSR reads queued at a time when sampling as fast as possible, and how many bins get displayed */
+#define CORTEXM_PROFILE_BATCH 16U
+#define CORTEXM_PROFILE_TOP   10U
+/* Block size (and alignment) used when reading semihosting console strings */
+#define CORTEXM_HOSTIO_BLOCK_SIZE 64U
+/* Probe-side staging buffer for semihosting file reads and writes serviced by GDB */
+#define CORTEXM_HOSTIO_BUFFER_SIZE 1024U
+
 static int cortexm_hostio_request(target_s *t);
+static bool cortexm_soft_breakpoint_at(target_s *t, target_addr_t addr);
+static bool cortexm_mem_crc32(target_s *t, uint32_t *crc_res, target_addr_t base, size_t len);
 
 static uint32_t time0_sec = UINT32_MAX; /* sys_clock time origin */
 
+/* A software watchpoint, the range watched (size 0 if the slot is free) and what it last held */
+typedef struct cortexm_soft_watch {
+	target_addr_t addr;
+	size_t size;
+	uint8_t value[CORTEXM_SOFT_WATCH_SIZE];
+} cortexm_soft_watch_s;
+
 typedef struct cortexm_priv {
 	adiv5_access_port_s *ap;
 	bool stepping;
 	bool on_bkpt;
-	/* Watchpoint unit status */
+	/* Watchpoint unit status, and which of the comparators in use are emitting data trace */
 	bool hw_watchpoint[CORTEXM_MAX_WATCHPOINTS];
+	uint8_t trace_watchpoints;
 	unsigned flash_patch_revision;
 	unsigned hw_watchpoint_max;
-	/* Breakpoint unit status */
-	bool hw_breakpoint[CORTEXM_MAX_BREAKPOINTS];
+	/*
+	 * Software watchpoints, and whether the core is being stepped along to check them in place of running
+	 * (and if a halt request came in while it was)
+	 */
+	cortexm_soft_watch_s soft_watch[CORTEXM_SOFT_WATCHPOINTS];
+	uint8_t soft_watches;
+	bool watch_stepping;
+	bool watch_interrupted;
+	/* Breakpoint unit status, the value programmed into each comparator or 0 if it's free */
+	uint32_t hw_breakpoint[CORTEXM_MAX_BREAKPOINTS];
 	unsigned hw_breakpoint_max;
 	/* Copy of DEMCR for vector-catch */
 	uint32_t demcr;
 	/* Cache parameters */
 	bool has_cache;
 	uint32_t dcache_minline;
+	/* DWT cycle counter snapshots taken on resume and on halt, for timing the last run */
+	bool has_cyccnt;
+	bool cycles_report;
+	uint32_t cycles_resume;
+	uint32_t cycles_halt;
+	/* Core register cache, filled on first use after a halt and written back before the core resumes */
+	bool regs_cached;
+	uint64_t regs_dirty;
+	uint32_t regs_cache[CORTEXM_CACHED_REGS];
 } cortexm_priv_s;
 
 /* Register number tables */
@@ -146,306 +241,187 @@ static const uint32_t regnum_cortex_mf[] = {
 	0x58, 0x59, 0x5a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f, /* s24-s31 */
 };
 
-/**
- * Fields for Cortex-M special purpose registers, used in the generation of GDB's target description XML.
- * The general purpose registers r0-r12 and the vector floating point registers d0-d15 all follow a very
- * regular format, so we only need to store fields for the special purpose registers.
- * The arrays for each SPR field have the same order as each other, making each of them a pseudo
- * 'associative array'.
- */
-
-// Strings for the names of the Cortex-M's special purpose registers.
-static const char *cortex_m_spr_names[] = {
-	"sp",
-	"lr",
-	"pc",
-	"xpsr",
-	"msp",
-	"psp",
-	"primask",
-	"basepri",
-	"faultmask",
-	"control",
-};
-
-// The "type" field for each Cortex-M special purpose register.
-static const gdb_reg_type_e cortex_m_spr_types[] = {
-	GDB_TYPE_DATA_PTR,    // sp
-	GDB_TYPE_CODE_PTR,    // lr
-	GDB_TYPE_CODE_PTR,    // pc
-	GDB_TYPE_UNSPECIFIED, // xpsr
-	GDB_TYPE_DATA_PTR,    // msp
-	GDB_TYPE_DATA_PTR,    // psp
-	GDB_TYPE_UNSPECIFIED, // primask
-	GDB_TYPE_UNSPECIFIED, // basepri
-	GDB_TYPE_UNSPECIFIED, // faultmask
-	GDB_TYPE_UNSPECIFIED, // control
-};
-
 // clang-format off
-static_assert(ARRAY_LENGTH(cortex_m_spr_types) == ARRAY_LENGTH(cortex_m_spr_names),
-	"SPR array length mismatch! SPR type array should have the same length as SPR name array."
+static_assert(ARRAY_LENGTH(regnum_cortex_m) + ARRAY_LENGTH(regnum_cortex_mf) == CORTEXM_CACHED_REGS,
+	"Register cache size mismatch! CORTEXM_CACHED_REGS should cover both register number tables."
 );
 // clang-format on
 
-// The "save-restore" field of each SPR.
-static const gdb_reg_save_restore_e cortex_m_spr_save_restores[] = {
-	GDB_SAVE_RESTORE_UNSPECIFIED, // sp
-	GDB_SAVE_RESTORE_UNSPECIFIED, // lr
-	GDB_SAVE_RESTORE_UNSPECIFIED, // pc
-	GDB_SAVE_RESTORE_UNSPECIFIED, // xpsr
-	GDB_SAVE_RESTORE_NO,          // msp
-	GDB_SAVE_RESTORE_NO,          // psp
-	GDB_SAVE_RESTORE_NO,          // primask
-	GDB_SAVE_RESTORE_NO,          // basepri
-	GDB_SAVE_RESTORE_NO,          // faultmask
-	GDB_SAVE_RESTORE_NO,          // control
-};
+/*
+ * GDB register number of the DWT cycle counter, placed after the last FPU register so it
+ * stays out of the 'g' packet in both description variants and GDB fetches it with 'p'.
+ * This must match the regnum given in CORTEXM_TDESC_DWT.
+ */
+#define REG_CYCCNT 40U
+
+/* Registers sent in stop replies: pc, sp, lr, xpsr and r7, the Thumb frame pointer */
+static const uint8_t cortexm_expedited_regs[] = {REG_PC, REG_SP, REG_LR, REG_XPSR, 7U};
+
+/*
+ * GDB target description XML for the Cortex-M, built up by the preprocessor into constant strings
+ * so they live in Flash and need no generating or heap at runtime.
+ * The register descriptions are shared between the plain and the floating point variant.
+ */
+#define CORTEXM_TDESC_GPR(n) "<reg name=\"r" #n "\" bitsize=\"32\"/>"
+#define CORTEXM_TDESC_DPR(n) "<reg name=\"d" #n "\" bitsize=\"64\" type=\"float\"/>"
 
 // clang-format off
-static_assert(ARRAY_LENGTH(cortex_m_spr_save_restores) == ARRAY_LENGTH(cortex_m_spr_names),
-	"SPR array length mismatch! SPR save-restore array should have the same length as SPR name array."
-);
+#define CORTEXM_TDESC_CORE                                                                                                 \
+	GDB_XML_PREAMBLE_FIRST " target " GDB_XML_PREAMBLE_SECOND "arm" GDB_XML_PREAMBLE_THIRD                                 \
+	" <feature name=\"org.gnu.gdb.arm.m-profile\">"                                                                        \
+	CORTEXM_TDESC_GPR(0) CORTEXM_TDESC_GPR(1) CORTEXM_TDESC_GPR(2) CORTEXM_TDESC_GPR(3)                                    \
+	CORTEXM_TDESC_GPR(4) CORTEXM_TDESC_GPR(5) CORTEXM_TDESC_GPR(6) CORTEXM_TDESC_GPR(7)                                    \
+	CORTEXM_TDESC_GPR(8) CORTEXM_TDESC_GPR(9) CORTEXM_TDESC_GPR(10) CORTEXM_TDESC_GPR(11)                                  \
+	CORTEXM_TDESC_GPR(12)                                                                                                  \
+	"<reg name=\"sp\" bitsize=\"32\"" GDB_REG_TYPE_DATA_PTR "/>"                                                           \
+	"<reg name=\"lr\" bitsize=\"32\"" GDB_REG_TYPE_CODE_PTR "/>"                                                           \
+	"<reg name=\"pc\" bitsize=\"32\"" GDB_REG_TYPE_CODE_PTR "/>"                                                           \
+	"<reg name=\"xpsr\" bitsize=\"32\"/>"                                                                                  \
+	"<reg name=\"msp\" bitsize=\"32\"" GDB_REG_SAVE_RESTORE_NO GDB_REG_TYPE_DATA_PTR "/>"                                  \
+	"<reg name=\"psp\" bitsize=\"32\"" GDB_REG_SAVE_RESTORE_NO GDB_REG_TYPE_DATA_PTR "/>"                                  \
+	"<reg name=\"primask\" bitsize=\"8\"" GDB_REG_SAVE_RESTORE_NO "/>"                                                     \
+	"<reg name=\"basepri\" bitsize=\"8\"" GDB_REG_SAVE_RESTORE_NO "/>"                                                     \
+	"<reg name=\"faultmask\" bitsize=\"8\"" GDB_REG_SAVE_RESTORE_NO "/>"                                                   \
+	"<reg name=\"control\" bitsize=\"8\"" GDB_REG_SAVE_RESTORE_NO "/>"                                                     \
+	"</feature>"
+
+#define CORTEXM_TDESC_DWT                                                                                                  \
+	"<feature name=\"org.blackmagic.cortexm.dwt\">"                                                                        \
+	"<reg name=\"cyccnt\" bitsize=\"32\" regnum=\"40\" type=\"uint32\"" GDB_REG_SAVE_RESTORE_NO "/>"                       \
+	"</feature>"
+
+static const char cortexm_tdesc[] = CORTEXM_TDESC_CORE CORTEXM_TDESC_DWT "</target>";
+
+static const char cortexm_tdesc_mf[] =
+	CORTEXM_TDESC_CORE
+	"<feature name=\"org.gnu.gdb.arm.vfp\">"
+	"<reg name=\"fpscr\" bitsize=\"32\"/>"
+	CORTEXM_TDESC_DPR(0) CORTEXM_TDESC_DPR(1) CORTEXM_TDESC_DPR(2) CORTEXM_TDESC_DPR(3)
+	CORTEXM_TDESC_DPR(4) CORTEXM_TDESC_DPR(5) CORTEXM_TDESC_DPR(6) CORTEXM_TDESC_DPR(7)
+	CORTEXM_TDESC_DPR(8) CORTEXM_TDESC_DPR(9) CORTEXM_TDESC_DPR(10) CORTEXM_TDESC_DPR(11)
+	CORTEXM_TDESC_DPR(12) CORTEXM_TDESC_DPR(13) CORTEXM_TDESC_DPR(14) CORTEXM_TDESC_DPR(15)
+	"</feature>"
+	CORTEXM_TDESC_DWT
+	"</target>";
 // clang-format on
 
-// The "bitsize" field of each SPR.
-static const uint8_t cortex_m_spr_bitsizes[] = {
-	32, // sp
-	32, // lr
-	32, // pc
-	32, // xpsr
-	32, // msp
-	32, // psp
-	8,  // primask
-	8,  // basepri
-	8,  // faultmask
-	8,  // control
-};
+adiv5_access_port_s *cortexm_ap(target_s *t)
+{
+	return ((cortexm_priv_s *)t->priv)->ap;
+}
 
-// clang-format off
-static_assert(ARRAY_LENGTH(cortex_m_spr_bitsizes) == ARRAY_LENGTH(cortex_m_spr_names),
-	"SPR array length mismatch! SPR bitsize array should have the same length as SPR name array."
-);
+/* Whether the target is a Cortex-M core, having its register layout regardless of the part's driver */
+bool cortexm_target(const target_s *const t)
+{
+	return t->regs_read == cortexm_regs_read;
+}
 
-// clang-format on
+typedef bool (*cortexm_probe_func)(target_s *t);
+
+typedef struct cortexm_probe_route {
+	uint16_t designer_code;
+	uint16_t part_id;
+	cortexm_probe_func probe;
+} cortexm_probe_route_s;
 
-// Creates the target description XML string for a Cortex-M. Like snprintf(), this function
-// will write no more than max_len and returns the amount of bytes written. Or, if max_len is 0,
-// then this function will return the amount of bytes that _would_ be necessary to create this
-// string.
-//
-// This function is hand-optimized to decrease string duplication and thus code size, making it
-// unfortunately much less readable than the string literal it is equivalent to.
-//
-// The string it creates is XML-equivalent to the following:
-/*
-	"<?xml version=\"1.0\"?>"
-	"<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
-	"<target>"
-	"  <architecture>arm</architecture>"
-	"  <feature name=\"org.gnu.gdb.arm.m-profile\">"
-	"    <reg name=\"r0\" bitsize=\"32\"/>"
-	"    <reg name=\"r1\" bitsize=\"32\"/>"
-	"    <reg name=\"r2\" bitsize=\"32\"/>"
-	"    <reg name=\"r3\" bitsize=\"32\"/>"
-	"    <reg name=\"r4\" bitsize=\"32\"/>"
-	"    <reg name=\"r5\" bitsize=\"32\"/>"
-	"    <reg name=\"r6\" bitsize=\"32\"/>"
-	"    <reg name=\"r7\" bitsize=\"32\"/>"
-	"    <reg name=\"r8\" bitsize=\"32\"/>"
-	"    <reg name=\"r9\" bitsize=\"32\"/>"
-	"    <reg name=\"r10\" bitsize=\"32\"/>"
-	"    <reg name=\"r11\" bitsize=\"32\"/>"
-	"    <reg name=\"r12\" bitsize=\"32\"/>"
-	"    <reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>"
-	"    <reg name=\"lr\" bitsize=\"32\" type=\"code_ptr\"/>"
-	"    <reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
-	"    <reg name=\"xpsr\" bitsize=\"32\"/>"
-	"    <reg name=\"msp\" bitsize=\"32\" save-restore=\"no\" type=\"data_ptr\"/>"
-	"    <reg name=\"psp\" bitsize=\"32\" save-restore=\"no\" type=\"data_ptr\"/>"
-	"    <reg name=\"primask\" bitsize=\"8\" save-restore=\"no\"/>"
-	"    <reg name=\"basepri\" bitsize=\"8\" save-restore=\"no\"/>"
-	"    <reg name=\"faultmask\" bitsize=\"8\" save-restore=\"no\"/>"
-	"    <reg name=\"control\" bitsize=\"8\" save-restore=\"no\"/>"
-	"  </feature>"
-	"</target>"
-*/
-static size_t create_tdesc_cortex_m(char *buffer, size_t max_len)
-{
-	// Minor hack: technically snprintf returns an int for possibility of error, but in this case
-	// these functions are given static input that should not be able to fail -- and if it does,
-	// then there's nothing we can do about it, so we'll repatedly cast this variable to a size_t
-	// when calculating printsz (see below).
-	int total = 0;
-
-	// We can't just repeatedly pass max_len to snprintf, because we keep changing the start
-	// of buffer (effectively changing its size), so we have to repeatedly compute the size
-	// passed to snprintf by subtracting the current total from max_len.
-	// ...Unless max_len is 0, in which case that subtraction will result in an (underflowed)
-	// negative number. So we also have to repatedly check if max_len is 0 before performing
-	// that subtraction.
-	size_t printsz = max_len;
-
-	// Start with the "preamble", which is generic across ARM targets,
-	// ...save for one word, so we'll have to do the preamble in halves.
-	total += snprintf(buffer, printsz, "%s target %sarm%s <feature name=\"org.gnu.gdb.arm.m-profile\">",
-		gdb_xml_preamble_first, gdb_xml_preamble_second, gdb_xml_preamble_third);
-
-	// Then the general purpose registers, which have names of r0 to r12,
-	// and all the same bitsize.
-	for (uint8_t i = 0; i <= 12; ++i) {
-		if (max_len != 0)
-			printsz = max_len - (size_t)total;
-
-		total += snprintf(buffer + total, printsz, "<reg name=\"r%u\" bitsize=\"32\"/>", i);
-	}
-
-	// Now for sp, lr, pc, xpsr, msp, psp, primask, basepri, faultmask, and control.
-	// These special purpose registers are a little more complicated.
-	// Some of them have different bitsizes, specified types, or specified save-restore values.
-	// We'll use the 'associative arrays' defined for those values.
-	// NOTE: unlike the other loops, this loop uses a size_t for its counter, as it's used to index into arrays.
-	for (size_t i = 0; i < ARRAY_LENGTH(cortex_m_spr_names); ++i) {
-		if (max_len != 0)
-			printsz = max_len - (size_t)total;
-
-		gdb_reg_type_e type = cortex_m_spr_types[i];
-		gdb_reg_save_restore_e save_restore = cortex_m_spr_save_restores[i];
-
-		total += snprintf(buffer + total, printsz, "<reg name=\"%s\" bitsize=\"%u\"%s%s/>", cortex_m_spr_names[i],
-			cortex_m_spr_bitsizes[i], gdb_reg_save_restore_strings[save_restore], gdb_reg_type_strings[type]);
-	}
-
-	if (max_len != 0)
-		printsz = max_len - (size_t)total;
-
-	total += snprintf(buffer + total, printsz, "</feature></target>");
-
-	// Minor hack: technically snprintf returns an int for possibility of error, but in this case
-	// these functions are given static input that should not ever be able to fail -- and if it
-	// does, then there's nothing we can do about it, so we'll just discard the signedness
-	// of total when we return it.
-	return (size_t)total;
-}
-
-// Creates the target description XML string for a Cortex-MF. Like snprintf(), this function
-// will write no more than max_len and returns the amount of bytes written. Or, if max_len is 0,
-// then this function will return the amount of bytes that _would_ be necessary to create this
-// string.
-//
-// This function is hand-optimized to decrease string duplication and thus code size, making it
-// unfortunately much less readable than the string literal it is equivalent to.
-//
-// The string it creates is XML-equivalent to the following:
 /*
-	"<?xml version=\"1.0\"?>"
-	"<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
-	"<target>"
-	"  <architecture>arm</architecture>"
-	"  <feature name=\"org.gnu.gdb.arm.m-profile\">"
-	"    <reg name=\"r0\" bitsize=\"32\"/>"
-	"    <reg name=\"r1\" bitsize=\"32\"/>"
-	"    <reg name=\"r2\" bitsize=\"32\"/>"
-	"    <reg name=\"r3\" bitsize=\"32\"/>"
-	"    <reg name=\"r4\" bitsize=\"32\"/>"
-	"    <reg name=\"r5\" bitsize=\"32\"/>"
-	"    <reg name=\"r6\" bitsize=\"32\"/>"
-	"    <reg name=\"r7\" bitsize=\"32\"/>"
-	"    <reg name=\"r8\" bitsize=\"32\"/>"
-	"    <reg name=\"r9\" bitsize=\"32\"/>"
-	"    <reg name=\"r10\" bitsize=\"32\"/>"
-	"    <reg name=\"r11\" bitsize=\"32\"/>"
-	"    <reg name=\"r12\" bitsize=\"32\"/>"
-	"    <reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>"
-	"    <reg name=\"lr\" bitsize=\"32\" type=\"code_ptr\"/>"
-	"    <reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
-	"    <reg name=\"xpsr\" bitsize=\"32\"/>"
-	"    <reg name=\"msp\" bitsize=\"32\" save-restore=\"no\" type=\"data_ptr\"/>"
-	"    <reg name=\"psp\" bitsize=\"32\" save-restore=\"no\" type=\"data_ptr\"/>"
-	"    <reg name=\"primask\" bitsize=\"8\" save-restore=\"no\"/>"
-	"    <reg name=\"basepri\" bitsize=\"8\" save-restore=\"no\"/>"
-	"    <reg name=\"faultmask\" bitsize=\"8\" save-restore=\"no\"/>"
-	"    <reg name=\"control\" bitsize=\"8\" save-restore=\"no\"/>"
-	"  </feature>"
-	"  <feature name=\"org.gnu.gdb.arm.vfp\">"
-	"    <reg name=\"fpscr\" bitsize=\"32\"/>"
-	"    <reg name=\"d0\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d1\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d2\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d3\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d4\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d5\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d6\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d7\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d8\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d9\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d10\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d11\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d12\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d13\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d14\" bitsize=\"64\" type=\"float\"/>"
-	"    <reg name=\"d15\" bitsize=\"64\" type=\"float\"/>"
-	"  </feature>"
-	"</target>"
-*/
-static size_t create_tdesc_cortex_mf(char *buffer, size_t max_len)
-{
-	// Minor hack: technically snprintf returns an int for possibility of error, but in this case
-	// these functions are given static input that should not be able to fail -- and if it does,
-	// then there's not really anything we can do about it, so we repatedly cast this variable
-	// to a size_t when calculating printsz (see below). Likewise, create_tdesc_cortex_m()
-	// has static inputs and shouldn't ever return a value large enough for casting it to a
-	// signed int to change its value, and if it does, then again there's something wrong that
-	// we can't really do anything about.
-
-	// The first part of the target description for the Cortex-MF is identical to the Cortex-M
-	// target description.
-	int total = (int)create_tdesc_cortex_m(buffer, max_len);
-
-	// We can't just repeatedly pass max_len to snprintf, because we keep changing the start
-	// of buffer (effectively changing its size), so we have to repeatedly compute the size
-	// passed to snprintf by subtracting the current total from max_len.
-	// ...Unless max_len is 0, in which case that subtraction will result in an (underflowed)
-	// negative number. So we also have to repatedly check if max_len is 0 before perofmring
-	// that subtraction.
-	size_t printsz = max_len;
-
-	if (max_len != 0) {
-		// Minor hack: subtract the target closing tag, since we have a bit more to add.
-		total -= strlen("</target>");
-
-		printsz = max_len - (size_t)total;
-	}
-
-	total += snprintf(buffer + total, printsz,
-		"<feature name=\"org.gnu.gdb.arm.vfp\">"
-		"<reg name=\"fpscr\" bitsize=\"32\"/>");
-
-	// After fpscr, the rest of the vfp registers follow a regular format: d0-d15, bitsize 64, type float.
-	for (uint8_t i = 0; i <= 15; ++i) {
-		if (max_len != 0)
-			printsz = max_len - (size_t)total;
-
-		total += snprintf(buffer + total, printsz, "<reg name=\"d%u\" bitsize=\"64\" type=\"float\"/>", i);
-	}
-
-	if (max_len != 0)
-		printsz = max_len - (size_t)total;
-
-	total += snprintf(buffer + total, printsz, "</feature></target>");
-
-	// Minor hack: technically snprintf returns an int for possibility of error, but in this case
-	// these functions are given static input that should not ever be able to fail -- and if it
-	// does, then there's nothing we can do about it, so we'll just discard the signedness
-	// of total when we return it.
-	return (size_t)total;
+ * Parts whose designer code and part ID already tell us which driver handles them, so that driver's probe
+ * routine is tried first rather than letting every driver for the designer do its own identification reads.
+ * Anything not listed, or that the routed driver turns down, falls back to the sequential probing.
+ */
+static const cortexm_probe_route_s cortexm_probe_routes[] = {
+	/* STM32F0, F1 and F3 */
+	{JEP106_MANUFACTURER_STM, 0x410U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x412U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x414U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x418U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x420U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x422U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x428U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x430U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x432U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x438U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x439U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x440U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x442U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x444U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x445U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x446U, stm32f1_probe},
+	{JEP106_MANUFACTURER_STM, 0x448U, stm32f1_probe},
+	/* STM32F2, F4 and F7 */
+	{JEP106_MANUFACTURER_STM, 0x411U, stm32f4_probe},
+	{JEP106_MANUFACTURER_STM, 0x413U, stm32f4_probe},
+	{JEP106_MANUFACTURER_STM, 0x419U, stm32f4_probe},
+	{JEP106_MANUFACTURER_STM, 0x421U, stm32f4_probe},
+	{JEP106_MANUFACTURER_STM, 0x423U, stm32f4_probe},
+	{JEP106_MANUFACTURER_STM, 0x431U, stm32f4_probe},
+	{JEP106_MANUFACTURER_STM, 0x433U, stm32f4_probe},
+	{JEP106_MANUFACTURER_STM, 0x434U, stm32f4_probe},
+	{JEP106_MANUFACTURER_STM, 0x441U, stm32f4_probe},
+	{JEP106_MANUFACTURER_STM, 0x449U, stm32f4_probe},
+	{JEP106_MANUFACTURER_STM, 0x451U, stm32f4_probe},
+	{JEP106_MANUFACTURER_STM, 0x452U, stm32f4_probe},
+	{JEP106_MANUFACTURER_STM, 0x463U, stm32f4_probe},
+	/* STM32H7 */
+	{JEP106_MANUFACTURER_STM, 0x4500U, stm32h7_probe},
+	{JEP106_MANUFACTURER_STM, 0x4800U, stm32h7_probe},
+	{JEP106_MANUFACTURER_STM, 0x4830U, stm32h7_probe},
+	/* STM32L0 and L1 */
+	{JEP106_MANUFACTURER_STM, 0x416U, stm32l0_probe},
+	{JEP106_MANUFACTURER_STM, 0x417U, stm32l0_probe},
+	{JEP106_MANUFACTURER_STM, 0x425U, stm32l0_probe},
+	{JEP106_MANUFACTURER_STM, 0x427U, stm32l0_probe},
+	{JEP106_MANUFACTURER_STM, 0x429U, stm32l0_probe},
+	{JEP106_MANUFACTURER_STM, 0x436U, stm32l0_probe},
+	{JEP106_MANUFACTURER_STM, 0x437U, stm32l0_probe},
+	{JEP106_MANUFACTURER_STM, 0x447U, stm32l0_probe},
+	{JEP106_MANUFACTURER_STM, 0x457U, stm32l0_probe},
+	/* STM32L4, L5 and G4 */
+	{JEP106_MANUFACTURER_STM, 0x415U, stm32l4_probe},
+	{JEP106_MANUFACTURER_STM, 0x435U, stm32l4_probe},
+	{JEP106_MANUFACTURER_STM, 0x461U, stm32l4_probe},
+	{JEP106_MANUFACTURER_STM, 0x462U, stm32l4_probe},
+	{JEP106_MANUFACTURER_STM, 0x464U, stm32l4_probe},
+	{JEP106_MANUFACTURER_STM, 0x468U, stm32l4_probe},
+	{JEP106_MANUFACTURER_STM, 0x469U, stm32l4_probe},
+	{JEP106_MANUFACTURER_STM, 0x470U, stm32l4_probe},
+	{JEP106_MANUFACTURER_STM, 0x471U, stm32l4_probe},
+	{JEP106_MANUFACTURER_STM, 0x472U, stm32l4_probe},
+	{JEP106_MANUFACTURER_STM, 0x479U, stm32l4_probe},
+	/* STM32G0 and C0 */
+	{JEP106_MANUFACTURER_STM, 0x456U, stm32g0_probe},
+	{JEP106_MANUFACTURER_STM, 0x460U, stm32g0_probe},
+	{JEP106_MANUFACTURER_STM, 0x466U, stm32g0_probe},
+	{JEP106_MANUFACTURER_STM, 0x467U, stm32g0_probe},
+	/* GD32F4 */
+	{JEP106_MANUFACTURER_GIGADEVICE, 0x2b3U, gd32f4_probe},
+	{JEP106_MANUFACTURER_GIGADEVICE, 0xa2eU, gd32f4_probe},
+	{0U, 0U, NULL},
+};
+
+static cortexm_probe_func cortexm_probe_route(const target_s *const t)
+{
+	for (const cortexm_probe_route_s *route = cortexm_probe_routes; route->probe; ++route) {
+		if (route->designer_code == t->designer_code && route->part_id == t->part_id)
+			return route->probe;
+	}
+	return NULL;
 }
 
-adiv5_access_port_s *cortexm_ap(target_s *t)
+/*
+ * Whether an address is in a region of the default memory map that can be cached at all. The
+ * Peripheral, Device and System regions are never cacheable, so need no maintenance.
+ */
+static inline bool cortexm_addr_cacheable(const target_addr_t addr)
 {
-	return ((cortexm_priv_s *)t->priv)->ap;
+	return addr < 0x40000000U || (addr >= 0x60000000U && addr < 0xa0000000U);
 }
 
+/*
+ * Clean (and optionally invalidate) the data cache lines covering the RAM in a range. Maintenance is
+ * done by writing each line's address to the same SCB register, so it goes out as one queued run of
+ * AP writes with TAR left pointing at that register.
+ */
 static void cortexm_cache_clean(target_s *t, target_addr_t addr, size_t len, bool invalidate)
 {
 	cortexm_priv_s *priv = t->priv;
@@ -453,6 +429,11 @@ static void cortexm_cache_clean(target_s *t, target_addr_t addr, size_t len, boo
 		return;
 	uint32_t cache_reg = invalidate ? CORTEXM_DCCIMVAC : CORTEXM_DCCMVAC;
 	size_t minline = priv->dcache_minline;
+	adiv5_access_port_s *const ap = cortexm_ap(t);
+	adiv5_queue_entry_s entries[CORTEXM_REGS_QUEUE_DEPTH];
+	adiv5_queue_s queue;
+	adiv5_queue_init(&queue, ap->dp, entries, CORTEXM_REGS_QUEUE_DEPTH);
+	bool queued = false;
 
 	/* flush data cache for RAM regions that intersect requested region */
 	target_addr_t mem_end = addr + len; /* following code is NOP if wraparound */
@@ -466,9 +447,20 @@ static void cortexm_cache_clean(target_s *t, target_addr_t addr, size_t len, boo
 		if (mem_end < ram_end)
 			ram_end = mem_end;
 		/* intersection is [ram, ram_end) */
-		for (ram &= ~(minline - 1U); ram < ram_end; ram += minline)
-			adiv5_mem_write(cortexm_ap(t), cache_reg, &ram, 4);
+		for (ram &= ~(minline - 1U); ram < ram_end; ram += minline) {
+			if (!cortexm_addr_cacheable(ram))
+				continue;
+			if (!queued) {
+				/* Without address increment, every write to DRW lands on the maintenance register */
+				adiv5_queue_ap_write(&queue, ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
+				adiv5_queue_ap_write(&queue, ap, ADIV5_AP_TAR, cache_reg);
+				queued = true;
+			}
+			adiv5_queue_ap_write(&queue, ap, ADIV5_AP_DRW, ram);
+		}
 	}
+	if (queued)
+		adiv5_queue_run(&queue);
 }
 
 static void cortexm_mem_read(target_s *t, void *dest, target_addr_t src, size_t len)
@@ -483,6 +475,13 @@ static void cortexm_mem_write(target_s *t, target_addr_t dest, const void *src,
 	adiv5_mem_write(cortexm_ap(t), dest, src, len);
 }
 
+static bool cortexm_mem_poll32(target_s *t, target_addr_t addr, uint32_t mask, uint32_t value, uint32_t timeout_ms,
+	uint32_t *result)
+{
+	cortexm_cache_clean(t, addr, sizeof(*result), false);
+	return adiv5_mem_poll32(cortexm_ap(t), addr, mask, value, timeout_ms, result);
+}
+
 static bool cortexm_check_error(target_s *t)
 {
 	adiv5_access_port_s *ap = cortexm_ap(t);
@@ -542,17 +541,7 @@ static void cortexm_read_cpuid(target_s *const t, const adiv5_access_port_s *con
 
 const char *cortexm_regs_description(target_s *t)
 {
-	const bool is_cortexmf = t->target_options & TOPT_FLAVOUR_V7MF;
-	const size_t description_length =
-		(is_cortexmf ? create_tdesc_cortex_mf(NULL, 0) : create_tdesc_cortex_m(NULL, 0)) + 1U;
-	char *const description = malloc(description_length);
-	if (description) {
-		if (is_cortexmf)
-			create_tdesc_cortex_mf(description, description_length);
-		else
-			create_tdesc_cortex_m(description, description_length);
-	}
-	return description;
+	return t->target_options & TOPT_FLAVOUR_V7MF ? cortexm_tdesc_mf : cortexm_tdesc;
 }
 
 bool cortexm_probe(adiv5_access_port_s *ap)
@@ -590,6 +579,10 @@ bool cortexm_probe(adiv5_access_port_s *ap)
 	t->check_error = cortexm_check_error;
 	t->mem_read = cortexm_mem_read;
 	t->mem_write = cortexm_mem_write;
+	t->mem_crc32 = cortexm_mem_crc32;
+	t->mem_poll32 = cortexm_mem_poll32;
+	/* The System Control Space only defines word accesses, narrower ones being UNPREDICTABLE (ARMv7-M B3.2) */
+	target_add_region(t, CORTEXM_SCS_BASE, CORTEXM_SCS_SIZE, 4U, TARGET_REGION_BLOCK);
 
 	t->driver = cortexm_driver_str;
 
@@ -608,9 +601,13 @@ bool cortexm_probe(adiv5_access_port_s *ap)
 
 	t->regs_description = cortexm_regs_description;
 	t->regs_read = cortexm_regs_read;
+	t->regs_unstack = cortexm_regs_unstack;
 	t->regs_write = cortexm_regs_write;
 	t->reg_read = cortexm_reg_read;
 	t->reg_write = cortexm_reg_write;
+	t->expedited_regs = cortexm_expedited_regs;
+	t->expedited_regs_count = ARRAY_LENGTH(cortexm_expedited_regs);
+	t->pc_reg = REG_PC;
 
 	t->reset = cortexm_reset;
 	t->halt_request = cortexm_halt_request;
@@ -639,21 +636,33 @@ bool cortexm_probe(adiv5_access_port_s *ap)
 	} else
 		target_check_error(t);
 
+	/* Try the driver the part routes to first, and don't repeat it below if it turned the part down */
+	const cortexm_probe_func routed_probe = cortexm_probe_route(t);
+	if (routed_probe) {
+		if (routed_probe(t))
+			return true;
+		target_check_error(t);
+	}
+
 #if PC_HOSTED
 #define STRINGIFY(x) #x
-#define PROBE(x)                                  \
-	do {                                          \
-		DEBUG_INFO("Calling " STRINGIFY(x) "\n"); \
-		if ((x)(t))                               \
-			return true;                          \
-		target_check_error(t);                    \
+#define PROBE(x)                                      \
+	do {                                              \
+		if ((x) != routed_probe) {                    \
+			DEBUG_INFO("Calling " STRINGIFY(x) "\n"); \
+			if ((x)(t))                               \
+				return true;                          \
+			target_check_error(t);                    \
+		}                                             \
 	} while (0)
 #else
-#define PROBE(x)               \
-	do {                       \
-		if ((x)(t))            \
-			return true;       \
-		target_check_error(t); \
+#define PROBE(x)                   \
+	do {                           \
+		if ((x) != routed_probe) { \
+			if ((x)(t))            \
+				return true;       \
+			target_check_error(t); \
+		}                          \
 	} while (0)
 #endif
 
@@ -772,6 +781,7 @@ bool cortexm_attach(target_s *t)
 	/* Clear any pending fault condition */
 	target_check_error(t);
 
+	cortexm_regs_invalidate(t);
 	target_halt_request(t);
 	/* Request halt on reset */
 	target_mem_write32(t, CORTEXM_DEMCR, priv->demcr);
@@ -792,6 +802,14 @@ bool cortexm_attach(target_s *t)
 	if ((watchpoints >> 28U) < priv->hw_watchpoint_max)
 		priv->hw_watchpoint_max = watchpoints >> 28U;
 
+	/* ARMv6-M has no cycle counter, and it's optional on everything else */
+	priv->has_cyccnt = !(t->target_options & TOPT_FLAVOUR_V6M) && !(watchpoints & CORTEXM_DWT_CTRL_NOCYCCNT);
+	if (priv->has_cyccnt) {
+		target_mem_write32(t, CORTEXM_DWT_CTRL, watchpoints | CORTEXM_DWT_CTRL_CYCCNTENA);
+		priv->cycles_halt = target_mem_read32(t, CORTEXM_DWT_CYCCNT);
+		priv->cycles_resume = priv->cycles_halt;
+	}
+
 	/* Clear any stale breakpoints */
 	for (size_t i = 0; i < priv->hw_breakpoint_max; i++) {
 		target_mem_write32(t, CORTEXM_FPB_COMP(i), 0);
@@ -803,6 +821,7 @@ bool cortexm_attach(target_s *t)
 		target_mem_write32(t, CORTEXM_DWT_FUNC(i), 0);
 		priv->hw_watchpoint[i] = 0;
 	}
+	priv->trace_watchpoints = 0;
 
 	/* Flash Patch Control Register: set ENABLE */
 	target_mem_write32(t, CORTEXM_FPB_CTRL, CORTEXM_FPB_CTRL_KEY | CORTEXM_FPB_CTRL_ENABLE);
@@ -822,6 +841,8 @@ bool cortexm_attach(target_s *t)
 			}
 		}
 	}
+	/* Halt along with the other attached cores on the DP where there's a CTI to do it through */
+	coresight_cti_join(t, ap, 0U);
 	return true;
 }
 
@@ -829,10 +850,21 @@ void cortexm_detach(target_s *t)
 {
 	cortexm_priv_s *priv = t->priv;
 
+	/* Make sure register changes made before detaching reach the core */
+	cortexm_regs_flush(t);
+	cortexm_regs_invalidate(t);
+	coresight_cti_leave(t, cortexm_ap(t), 0U);
+
 	/* Clear any stale breakpoints */
 	for (size_t i = 0; i < priv->hw_breakpoint_max; i++)
 		target_mem_write32(t, CORTEXM_FPB_COMP(i), 0);
 
+	/* Put back the code under any software breakpoints GDB didn't remove */
+	for (const breakwatch_s *bw = t->bw_list; bw; bw = bw->next) {
+		if (bw->type == TARGET_BREAK_SOFT && bw->reserved[1] == CORTEXM_BREAK_SOFT_RAM)
+			target_mem_write16(t, bw->addr, bw->reserved[0]);
+	}
+
 	/* Clear any stale watchpoints */
 	for (size_t i = 0; i < priv->hw_watchpoint_max; i++)
 		target_mem_write32(t, CORTEXM_DWT_FUNC(i), 0);
@@ -851,9 +883,24 @@ enum {
 	DB_DEMCR
 };
 
-static void cortexm_regs_read(target_s *t, void *data)
+static int dcrsr_regnum(target_s *t, unsigned reg)
+{
+	if (reg < sizeof(regnum_cortex_m) / 4U)
+		return regnum_cortex_m[reg];
+	if ((t->target_options & TOPT_FLAVOUR_V7MF) && reg < (sizeof(regnum_cortex_m) + sizeof(regnum_cortex_mf)) / 4U)
+		return regnum_cortex_mf[reg - sizeof(regnum_cortex_m) / 4U];
+	return -1;
+}
+
+/* Have the queue wait for the core to finish the register transfer just started through DCRSR */
+static void cortexm_queue_regrdy(adiv5_queue_s *const queue, adiv5_access_port_s *const ap)
+{
+	adiv5_queue_ap_match(queue, ap, ADIV5_AP_DB(DB_DHCSR), CORTEXM_DHCSR_S_REGRDY, CORTEXM_DHCSR_S_REGRDY);
+}
+
+/* Read the whole register file from the core in one batch */
+static void cortexm_regs_fetch(target_s *t, uint32_t *regs)
 {
-	uint32_t *regs = data;
 	adiv5_access_port_s *ap = cortexm_ap(t);
 #if PC_HOSTED == 1
 	if (ap->dp->ap_reg_read && ap->dp->ap_regs_read) {
@@ -867,71 +914,180 @@ static void cortexm_regs_read(target_s *t, void *data)
 	} else
 #endif
 	{
+		adiv5_queue_entry_s entries[CORTEXM_REGS_QUEUE_DEPTH];
+		adiv5_queue_s queue;
+		adiv5_queue_init(&queue, ap->dp, entries, CORTEXM_REGS_QUEUE_DEPTH);
+
 		/* FIXME: Describe what's really going on here */
-		adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
+		adiv5_queue_ap_write(&queue, ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
 
 		/* Map the banked data registers (0x10-0x1c) to the
 		 * debug registers DHCSR, DCRSR, DCRDR and DEMCR respectively */
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
+		adiv5_queue_ap_write(&queue, ap, ADIV5_AP_TAR, CORTEXM_DHCSR);
 
 		/* Walk the regnum_cortex_m array, reading the registers it
 		 * calls out. */
-		adiv5_ap_write(ap, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_m[0]);
-		/* Required to switch banks */
-		*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
-		for (size_t i = 1; i < sizeof(regnum_cortex_m) / 4U; i++) {
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_m[i]);
-			*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
+		for (size_t i = 0; i < sizeof(regnum_cortex_m) / 4U; i++) {
+			adiv5_queue_ap_write(&queue, ap, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_m[i]);
+			cortexm_queue_regrdy(&queue, ap);
+			adiv5_queue_ap_read(&queue, ap, ADIV5_AP_DB(DB_DCRDR), regs++);
 		}
 		if (t->target_options & TOPT_FLAVOUR_V7MF) {
 			for (size_t i = 0; i < sizeof(regnum_cortex_mf) / 4U; i++) {
-				adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_mf[i]);
-				*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
+				adiv5_queue_ap_write(&queue, ap, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_mf[i]);
+				cortexm_queue_regrdy(&queue, ap);
+				adiv5_queue_ap_read(&queue, ap, ADIV5_AP_DB(DB_DCRDR), regs++);
 			}
 		}
+		adiv5_queue_run(&queue);
 	}
 }
 
-static void cortexm_regs_write(target_s *t, const void *data)
+
+/*
+ * Queue the write back of the registers changed since the cache was filled through the banked data
+ * registers, leaving the others alone. TAR is left on DHCSR so the caller can queue more debug
+ * register accesses through ADIV5_AP_DB().
+ */
+static void cortexm_regs_flush_queue(target_s *t, adiv5_queue_s *queue)
 {
-	const uint32_t *regs = data;
+	cortexm_priv_s *priv = t->priv;
+	adiv5_access_port_s *ap = cortexm_ap(t);
+	adiv5_queue_ap_write(queue, ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
+	/* Map the banked data registers (0x10-0x1c) to the debug registers, as in cortexm_regs_fetch() */
+	adiv5_queue_ap_write(queue, ap, ADIV5_AP_TAR, CORTEXM_DHCSR);
+	for (size_t i = 0; priv->regs_dirty && i < t->regs_size / 4U; i++) {
+		if (!(priv->regs_dirty & (1ULL << i)))
+			continue;
+		adiv5_queue_ap_write(queue, ap, ADIV5_AP_DB(DB_DCRDR), priv->regs_cache[i]);
+		adiv5_queue_ap_write(queue, ap, ADIV5_AP_DB(DB_DCRSR), CORTEXM_DCRSR_REGWnR | dcrsr_regnum(t, i));
+		cortexm_queue_regrdy(queue, ap);
+	}
+	priv->regs_dirty = 0;
+}
+
+/* Write back the registers changed since the cache was filled, leaving the others alone */
+static void cortexm_regs_flush(target_s *t)
+{
+	cortexm_priv_s *priv = t->priv;
+	if (!priv->regs_dirty)
+		return;
 	adiv5_access_port_s *ap = cortexm_ap(t);
 #if PC_HOSTED == 1
 	if (ap->dp->ap_reg_write) {
-		for (size_t i = 0; i < sizeof(regnum_cortex_m) / 4U; i++) {
-			ap->dp->ap_reg_write(ap, regnum_cortex_m[i], *regs);
-			regs++;
+		for (size_t i = 0; i < t->regs_size / 4U; i++) {
+			if (priv->regs_dirty & (1ULL << i))
+				ap->dp->ap_reg_write(ap, dcrsr_regnum(t, i), priv->regs_cache[i]);
 		}
-		if (t->target_options & TOPT_FLAVOUR_V7MF)
-			for (size_t i = 0; i < sizeof(regnum_cortex_mf) / 4U; i++) {
-				ap->dp->ap_reg_write(ap, regnum_cortex_mf[i], *regs);
-				regs++;
-			}
-	} else
+		priv->regs_dirty = 0;
+		return;
+	}
 #endif
-	{
-		/* FIXME: Describe what's really going on here */
-		adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
+	adiv5_queue_entry_s entries[CORTEXM_REGS_QUEUE_DEPTH];
+	adiv5_queue_s queue;
+	adiv5_queue_init(&queue, ap->dp, entries, CORTEXM_REGS_QUEUE_DEPTH);
+	cortexm_regs_flush_queue(t, &queue);
+	adiv5_queue_run(&queue);
+}
 
-		/* Map the banked data registers (0x10-0x1c) to the
-		 * debug registers DHCSR, DCRSR, DCRDR and DEMCR respectively */
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
-		/* Walk the regnum_cortex_m array, writing the registers it
-		 * calls out. */
-		adiv5_ap_write(ap, ADIV5_AP_DB(DB_DCRDR), *regs++);
-		/* Required to switch banks */
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), 0x10000 | regnum_cortex_m[0]);
-		for (size_t i = 1; i < sizeof(regnum_cortex_m) / 4U; i++) {
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRDR), *regs++);
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), 0x10000 | regnum_cortex_m[i]);
+static void cortexm_regs_cache_fill(target_s *t)
+{
+	cortexm_priv_s *priv = t->priv;
+	if (priv->regs_cached)
+		return;
+	cortexm_regs_fetch(t, priv->regs_cache);
+	priv->regs_dirty = 0;
+	priv->regs_cached = true;
+}
+
+/* Drop the register cache, any changes not yet written back are lost */
+void cortexm_regs_invalidate(target_s *t)
+{
+	cortexm_priv_s *priv = t->priv;
+	priv->regs_cached = false;
+	priv->regs_dirty = 0;
+}
+
+/* Update a register in the cache if it is filled, otherwise write it straight to the core */
+static void cortexm_reg_store(target_s *t, size_t reg, uint32_t value)
+{
+	cortexm_priv_s *priv = t->priv;
+	if (priv->regs_cached) {
+		if (priv->regs_cache[reg] != value) {
+			priv->regs_cache[reg] = value;
+			priv->regs_dirty |= 1ULL << reg;
 		}
-		if (t->target_options & TOPT_FLAVOUR_V7MF) {
-			for (size_t i = 0; i < sizeof(regnum_cortex_mf) / 4U; i++) {
-				adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRDR), *regs++);
-				adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR), 0x10000 | regnum_cortex_mf[i]);
-			}
+		return;
+	}
+	target_mem_write32(t, CORTEXM_DCRDR, value);
+	target_mem_write32(t, CORTEXM_DCRSR, CORTEXM_DCRSR_REGWnR | dcrsr_regnum(t, reg));
+}
+
+/*
+ * Rebuild the registers of a thread switched out by an RTOS from its exception frame. Without callee_saved
+ * this expects the usual PendSV context switch, which pushes r4-r11 below the frame, along with EXC_RETURN
+ * and (when the thread used the FPU) s16-s31 on parts with an FPU. Registers a context switch doesn't save,
+ * including the FPU's, are left with the core's current values.
+ */
+static bool cortexm_regs_unstack(target_s *t, void *data, target_addr_t stack, const uint32_t *callee_saved)
+{
+	uint32_t *const regs = (uint32_t *)data;
+	cortexm_regs_read(t, data);
+
+	uint32_t saved[9];
+	bool extended_frame = false;
+	if (!callee_saved) {
+		const size_t words = t->target_options & TOPT_FLAVOUR_V7MF ? 9U : 8U;
+		if (target_mem_read(t, saved, stack, words * 4U))
+			return false;
+		stack += words * 4U;
+		/* EXC_RETURN bit 4 clear means the thread had an FPU context, so s16-s31 were pushed too */
+		if (words == 9U && !(saved[8] & CORTEXM_EXC_RETURN_FTYPE)) {
+			stack += 16U * 4U;
+			extended_frame = true;
+		}
+		callee_saved = saved;
+	}
+
+	uint32_t frame[8];
+	if (target_mem_read(t, frame, stack, sizeof(frame)))
+		return false;
+	regs[0] = frame[0];
+	regs[1] = frame[1];
+	regs[2] = frame[2];
+	regs[3] = frame[3];
+	for (size_t i = 0; i < 8U; ++i)
+		regs[4U + i] = callee_saved[i];
+	regs[12] = frame[4];
+	regs[REG_LR] = frame[5];
+	regs[REG_PC] = frame[6];
+	regs[REG_XPSR] = frame[7];
+	/* The extended frame adds s0-s15, FPSCR and a reserved word, and xPSR bit 9 flags an alignment word */
+	stack += sizeof(frame) + (extended_frame ? 18U * 4U : 0U) + (frame[7] & CORTEXM_XPSR_STACK_ALIGN ? 4U : 0U);
+	regs[REG_SP] = stack;
+	regs[REG_PSP] = stack;
+	return true;
+}
+
+static void cortexm_regs_read(target_s *t, void *data)
+{
+	cortexm_priv_s *priv = t->priv;
+	cortexm_regs_cache_fill(t);
+	memcpy(data, priv->regs_cache, t->regs_size);
+}
+
+static void cortexm_regs_write(target_s *t, const void *data)
+{
+	cortexm_priv_s *priv = t->priv;
+	const uint32_t *regs = data;
+	/* Without a filled cache there's nothing to compare against, so everything gets written back */
+	for (size_t i = 0; i < t->regs_size / 4U; i++) {
+		if (!priv->regs_cached || priv->regs_cache[i] != regs[i]) {
+			priv->regs_cache[i] = regs[i];
+			priv->regs_dirty |= 1ULL << i;
 		}
 	}
+	priv->regs_cached = true;
 }
 
 int cortexm_mem_write_sized(target_s *t, target_addr_t dest, const void *src, size_t len, align_e align)
@@ -941,13 +1097,13 @@ int cortexm_mem_write_sized(target_s *t, target_addr_t dest, const void *src, si
 	return target_check_error(t);
 }
 
-static int dcrsr_regnum(target_s *t, unsigned reg)
+/* Run a Flash programming loop, on the probe when talking to one over the remote protocol */
+bool cortexm_mem_write_loop(target_s *const t, const target_addr_t dest, const void *const src, const size_t len,
+	const align_e align, const adiv5_mem_write_loop_s *const loop)
 {
-	if (reg < sizeof(regnum_cortex_m) / 4U)
-		return regnum_cortex_m[reg];
-	if ((t->target_options & TOPT_FLAVOUR_V7MF) && reg < (sizeof(regnum_cortex_m) + sizeof(regnum_cortex_mf)) / 4U)
-		return regnum_cortex_mf[reg - sizeof(regnum_cortex_m) / 4U];
-	return -1;
+	cortexm_cache_clean(t, dest, len, true);
+	uint32_t status = 0;
+	return adiv5_mem_write_loop(cortexm_ap(t), dest, src, len, align, loop, &status) && !target_check_error(t);
 }
 
 static ssize_t cortexm_reg_read(target_s *t, int reg, void *data, size_t max)
@@ -955,8 +1111,17 @@ static ssize_t cortexm_reg_read(target_s *t, int reg, void *data, size_t max)
 	if (max < 4U)
 		return -1;
 	uint32_t *r = data;
-	target_mem_write32(t, CORTEXM_DCRSR, dcrsr_regnum(t, reg));
-	*r = target_mem_read32(t, CORTEXM_DCRDR);
+	cortexm_priv_s *priv = t->priv;
+	/* The cycle counter's number overlaps the FPU part of the register cache, so check for it first */
+	if (reg == REG_CYCCNT)
+		*r = priv->has_cyccnt ? target_mem_read32(t, CORTEXM_DWT_CYCCNT) : 0;
+	else if (reg >= 0 && (size_t)reg < t->regs_size / 4U) {
+		cortexm_regs_cache_fill(t);
+		*r = priv->regs_cache[reg];
+	} else {
+		target_mem_write32(t, CORTEXM_DCRSR, dcrsr_regnum(t, reg));
+		*r = target_mem_read32(t, CORTEXM_DCRDR);
+	}
 	return 4U;
 }
 
@@ -965,27 +1130,36 @@ static ssize_t cortexm_reg_write(target_s *t, int reg, const void *data, size_t
 	if (max < 4U)
 		return -1;
 	const uint32_t *r = data;
-	target_mem_write32(t, CORTEXM_DCRDR, *r);
-	target_mem_write32(t, CORTEXM_DCRSR, CORTEXM_DCRSR_REGWnR | dcrsr_regnum(t, reg));
+	if (reg == REG_CYCCNT) {
+		cortexm_priv_s *priv = t->priv;
+		if (priv->has_cyccnt)
+			target_mem_write32(t, CORTEXM_DWT_CYCCNT, *r);
+	} else if (reg >= 0 && (size_t)reg < t->regs_size / 4U)
+		cortexm_reg_store(t, reg, *r);
+	else {
+		target_mem_write32(t, CORTEXM_DCRDR, *r);
+		target_mem_write32(t, CORTEXM_DCRSR, CORTEXM_DCRSR_REGWnR | dcrsr_regnum(t, reg));
+	}
 	return 4U;
 }
 
 static uint32_t cortexm_pc_read(target_s *t)
 {
-	target_mem_write32(t, CORTEXM_DCRSR, 0x0f);
-	return target_mem_read32(t, CORTEXM_DCRDR);
+	cortexm_priv_s *priv = t->priv;
+	cortexm_regs_cache_fill(t);
+	return priv->regs_cache[REG_PC];
 }
 
 static void cortexm_pc_write(target_s *t, const uint32_t val)
 {
-	target_mem_write32(t, CORTEXM_DCRDR, val);
-	target_mem_write32(t, CORTEXM_DCRSR, CORTEXM_DCRSR_REGWnR | 0x0fU);
+	cortexm_reg_store(t, REG_PC, val);
 }
 
 /* The following three routines implement target halt/resume
  * using the core debug registers in the NVIC. */
 static void cortexm_reset(target_s *t)
 {
+	cortexm_regs_invalidate(t);
 	/* Read DHCSR here to clear S_RESET_ST bit before reset */
 	target_mem_read32(t, CORTEXM_DHCSR);
 	platform_timeout_s reset_timeout;
@@ -1027,19 +1201,72 @@ static void cortexm_reset(target_s *t)
 
 static void cortexm_halt_request(target_s *t)
 {
+	cortexm_priv_s *priv = t->priv;
+	/* Stepping for software watchpoints stops at the end of the current step */
+	if (priv->watch_stepping) {
+		priv->watch_stepping = false;
+		priv->watch_interrupted = true;
+	}
 	volatile exception_s e;
 	TRY_CATCH (e, EXCEPTION_TIMEOUT) {
-		target_mem_write32(t, CORTEXM_DHCSR, CORTEXM_DHCSR_DBGKEY | CORTEXM_DHCSR_C_HALT | CORTEXM_DHCSR_C_DEBUGEN);
+		/* A core in a cross-triggered halt group takes the rest of the group with it */
+		if (!t->halt_group || !coresight_cti_halt(cortexm_ap(t)))
+			target_mem_write32(t, CORTEXM_DHCSR, CORTEXM_DHCSR_DBGKEY | CORTEXM_DHCSR_C_HALT | CORTEXM_DHCSR_C_DEBUGEN);
 	}
 	if (e.type)
 		tc_printf(t, "Timeout sending interrupt, is target in WFI?\n");
 }
 
+/* Read the debug fault status, skipped if dfsr is NULL, and the fault status registers in one batch */
+static void cortexm_halt_status_read(target_s *t, uint32_t *dfsr, uint32_t *hfsr, uint32_t *cfsr)
+{
+	adiv5_access_port_s *ap = cortexm_ap(t);
+	adiv5_queue_entry_s entries[CORTEXM_STATUS_QUEUE_DEPTH];
+	adiv5_queue_s queue;
+	adiv5_queue_init(&queue, ap->dp, entries, CORTEXM_STATUS_QUEUE_DEPTH);
+	if (dfsr)
+		adiv5_queue_mem_read32(&queue, ap, CORTEXM_DFSR, dfsr);
+	adiv5_queue_mem_read32(&queue, ap, CORTEXM_HFSR, hfsr);
+	adiv5_queue_mem_read32(&queue, ap, CORTEXM_CFSR, cfsr);
+	if (!adiv5_queue_run(&queue))
+		target_check_error(t);
+}
+
+/*
+ * Write the status just read back to reset it, the fault status too after a vector catch, and when the
+ * core stopped on a breakpoint fetch the instruction at the PC in the same batch, returning it (or 0)
+ */
+static uint16_t cortexm_halt_status_clear(target_s *t, uint32_t dfsr, uint32_t hfsr, uint32_t cfsr)
+{
+	cortexm_priv_s *priv = t->priv;
+	adiv5_access_port_s *ap = cortexm_ap(t);
+	/* The register cache fills in a batch of its own, and GDB will want it for the stop reply anyway */
+	const uint32_t program_counter = priv->on_bkpt ? cortexm_pc_read(t) : 0U;
+	adiv5_queue_entry_s entries[CORTEXM_STATUS_QUEUE_DEPTH];
+	adiv5_queue_s queue;
+	adiv5_queue_init(&queue, ap->dp, entries, CORTEXM_STATUS_QUEUE_DEPTH);
+	adiv5_queue_mem_write32(&queue, ap, CORTEXM_DFSR, dfsr);
+	if (dfsr & CORTEXM_DFSR_VCATCH) {
+		adiv5_queue_mem_write32(&queue, ap, CORTEXM_HFSR, hfsr);
+		adiv5_queue_mem_write32(&queue, ap, CORTEXM_CFSR, cfsr);
+	}
+	uint32_t instruction = 0;
+	if (priv->on_bkpt)
+		adiv5_queue_mem_read32(&queue, ap, program_counter & ~3U, &instruction);
+	if (!adiv5_queue_run(&queue)) {
+		target_check_error(t);
+		return 0;
+	}
+	return instruction >> ((program_counter & 2U) * 8U);
+}
+
 static target_halt_reason_e cortexm_halt_poll(target_s *t, target_addr_t *watch)
 {
 	cortexm_priv_s *priv = t->priv;
 
 	volatile uint32_t dhcsr = 0;
+#if PC_HOSTED == 1
+	/* Some of the BMDA adaptor backends still report link failures by raising */
 	volatile exception_s e;
 	TRY_CATCH (e, EXCEPTION_ALL) {
 		/* If this times out because the target is in WFI then
@@ -1053,35 +1280,82 @@ static target_halt_reason_e cortexm_halt_poll(target_s *t, target_addr_t *watch)
 		return TARGET_HALT_ERROR;
 	case EXCEPTION_TIMEOUT:
 		/* Timeout isn't a problem, target could be in WFI */
+		cortexm_regs_invalidate(t);
 		return TARGET_HALT_RUNNING;
 	}
-
-	if (!(dhcsr & CORTEXM_DHCSR_S_HALT))
+#else
+	dhcsr = target_mem_read32(t, CORTEXM_DHCSR);
+#endif
+	/* This poll runs constantly while the target is running, so failures come back as DP faults */
+	const uint8_t fault = cortexm_ap(t)->dp->fault;
+	if (fault == ADIV5_FAULT_PROTOCOL) {
+		/* Oh crap, there's no recovery from this... */
+		target_list_free();
+		return TARGET_HALT_ERROR;
+	}
+	if (fault) {
+		/* A WAIT isn't a problem, target could be in WFI */
+		target_check_error(t);
+		cortexm_regs_invalidate(t);
 		return TARGET_HALT_RUNNING;
+	}
 
-	/* We've halted.  Let's find out why. */
-	uint32_t dfsr = target_mem_read32(t, CORTEXM_DFSR);
-	target_mem_write32(t, CORTEXM_DFSR, dfsr); /* write back to reset */
+	if (!(dhcsr & CORTEXM_DHCSR_S_HALT)) {
+		/* Whatever got cached while the core was running is meaningless */
+		cortexm_regs_invalidate(t);
+		return TARGET_HALT_RUNNING;
+	}
 
-	if ((dfsr & CORTEXM_DFSR_VCATCH) && cortexm_fault_unwind(t))
-		return TARGET_HALT_FAULT;
+	/* We've halted.  Let's find out why, picking up the fault status in the same batch in case it was a fault */
+	uint32_t dfsr = 0;
+	uint32_t hfsr = 0;
+	uint32_t cfsr = 0;
+	cortexm_halt_status_read(t, &dfsr, &hfsr, &cfsr);
+
+	/* A step taken for the software watchpoints gets checked and stepping continued if nothing else happened */
+	if (priv->watch_stepping && dfsr == CORTEXM_DFSR_HALTED) {
+		target_mem_write32(t, CORTEXM_DFSR, dfsr); /* write back to reset */
+		target_halt_reason_e reason = TARGET_HALT_RUNNING;
+		dfsr = cortexm_soft_watch_step(t, watch, &reason);
+		if (!dfsr)
+			return reason;
+		/* Something else stopped the core part way, so that's the fault status that counts */
+		cortexm_halt_status_read(t, NULL, &hfsr, &cfsr);
+	}
+	/* Anything else ends the run */
+	const bool watch_stepping = priv->watch_stepping;
+	const bool watch_interrupted = priv->watch_interrupted;
+	priv->watch_stepping = false;
+	priv->watch_interrupted = false;
 
 	/* Remember if we stopped on a breakpoint */
 	priv->on_bkpt = dfsr & CORTEXM_DFSR_BKPT;
+	const uint16_t instruction = cortexm_halt_status_clear(t, dfsr, hfsr, cfsr);
+
+	if ((dfsr & CORTEXM_DFSR_VCATCH) && cortexm_fault_unwind(t, hfsr, cfsr))
+		return TARGET_HALT_FAULT;
+
 	if (priv->on_bkpt) {
 		/* If we've hit a programmed breakpoint, check for semihosting call. */
-		const uint32_t program_counter = cortexm_pc_read(t);
-		const uint16_t instruction = target_mem_read16(t, program_counter);
 		/* 0xbeab encodes the breakpoint instruction used to indicate a semihosting call */
 		if (instruction == 0xbeabU) {
 			if (cortexm_hostio_request(t))
 				return TARGET_HALT_REQUEST;
 
-			target_halt_resume(t, priv->stepping);
+			/* Semihosting stops aren't the end of the run being timed */
+			const uint32_t cycles_resume = priv->cycles_resume;
+			target_halt_resume(t, priv->stepping && !watch_stepping);
+			priv->cycles_resume = cycles_resume;
 			return TARGET_HALT_RUNNING;
 		}
 	}
 
+	if (priv->has_cyccnt) {
+		priv->cycles_halt = target_mem_read32(t, CORTEXM_DWT_CYCCNT);
+		if (priv->cycles_report)
+			tc_printf(t, "%" PRIu32 " cycles\n", priv->cycles_halt - priv->cycles_resume);
+	}
+
 	if (dfsr & CORTEXM_DFSR_DWTTRAP) {
 		if (watch != NULL)
 			*watch = cortexm_check_watch(t);
@@ -1091,43 +1365,69 @@ static target_halt_reason_e cortexm_halt_poll(target_s *t, target_addr_t *watch)
 		return TARGET_HALT_BREAKPOINT;
 
 	if (dfsr & CORTEXM_DFSR_HALTED)
-		return priv->stepping ? TARGET_HALT_STEPPING : TARGET_HALT_REQUEST;
+		return priv->stepping && !watch_interrupted ? TARGET_HALT_STEPPING : TARGET_HALT_REQUEST;
+
+	/* Halted by a cross trigger from another core's halt request */
+	if (dfsr & CORTEXM_DFSR_EXTERNAL)
+		return TARGET_HALT_REQUEST;
 
 	return TARGET_HALT_BREAKPOINT;
 }
 
+/*
+ * Resume the core. Everything that has to happen first (cache invalidation, reading the cycle counter,
+ * writing back the registers that changed and the DHCSR writes themselves) goes out as one batch, and
+ * the breakpoint and watchpoint units are left alone.
+ */
 void cortexm_halt_resume(target_s *t, bool step)
 {
 	cortexm_priv_s *priv = t->priv;
+	adiv5_access_port_s *ap = cortexm_ap(t);
 	uint32_t dhcsr = CORTEXM_DHCSR_DBGKEY | CORTEXM_DHCSR_C_DEBUGEN;
 
+	/* With software watchpoints set, running means stepping along checking the memory after each instruction */
+	priv->watch_stepping = !step && priv->soft_watches;
+	priv->watch_interrupted = false;
+	if (priv->watch_stepping)
+		step = true;
 	if (step)
 		dhcsr |= CORTEXM_DHCSR_C_STEP | CORTEXM_DHCSR_C_MASKINTS;
 
-	/* Disable interrupts while single stepping... */
-	if (step != priv->stepping) {
-		target_mem_write32(t, CORTEXM_DHCSR, dhcsr | CORTEXM_DHCSR_C_HALT);
-		priv->stepping = step;
-	}
-
+	/* Step over a BKPT compiled into the program, but never one of our own software breakpoints */
 	if (priv->on_bkpt) {
 		uint32_t pc = cortexm_pc_read(t);
-		if ((target_mem_read16(t, pc) & 0xff00U) == 0xbe00U)
+		if (!cortexm_soft_breakpoint_at(t, pc) && (target_mem_read16(t, pc) & 0xff00U) == 0xbe00U)
 			cortexm_pc_write(t, pc + 2U);
 	}
 
+#if PC_HOSTED == 1
+	/* Backends with a register write hook of their own take the registers that way */
+	if (ap->dp->ap_reg_write)
+		cortexm_regs_flush(t);
+#endif
+	coresight_cti_resume(t, ap, 0U);
+	adiv5_queue_entry_s entries[CORTEXM_REGS_QUEUE_DEPTH];
+	adiv5_queue_s queue;
+	adiv5_queue_init(&queue, ap->dp, entries, CORTEXM_REGS_QUEUE_DEPTH);
 	if (priv->has_cache)
-		target_mem_write32(t, CORTEXM_ICIALLU, 0);
-
-	target_mem_write32(t, CORTEXM_DHCSR, dhcsr);
+		adiv5_queue_mem_write32(&queue, ap, CORTEXM_ICIALLU, 0);
+	/* The counter stops in Debug state, so this is also where it'll pick up from */
+	if (priv->has_cyccnt)
+		adiv5_queue_mem_read32(&queue, ap, CORTEXM_DWT_CYCCNT, &priv->cycles_resume);
+	cortexm_regs_flush_queue(t, &queue);
+	/* Disable interrupts while single stepping... */
+	if (step != priv->stepping) {
+		adiv5_queue_ap_write(&queue, ap, ADIV5_AP_DB(DB_DHCSR), dhcsr | CORTEXM_DHCSR_C_HALT);
+		priv->stepping = step;
+	}
+	adiv5_queue_ap_write(&queue, ap, ADIV5_AP_DB(DB_DHCSR), dhcsr);
+	adiv5_queue_run(&queue);
+	cortexm_regs_invalidate(t);
 }
 
-static int cortexm_fault_unwind(target_s *t)
+/* Unwind the exception a vector catch stopped on, given the fault status read (and reset) on halting */
+static int cortexm_fault_unwind(target_s *t, const uint32_t hfsr, const uint32_t cfsr)
 {
-	uint32_t hfsr = target_mem_read32(t, CORTEXM_HFSR);
-	uint32_t cfsr = target_mem_read32(t, CORTEXM_CFSR);
-	target_mem_write32(t, CORTEXM_HFSR, hfsr); /* write back to reset */
-	target_mem_write32(t, CORTEXM_CFSR, cfsr); /* write back to reset */
 	/* We check for FORCED in the HardFault Status Register or
 	 * for a configurable fault to avoid catching core resets */
 	if ((hfsr & CORTEXM_HFSR_FORCED) || cfsr) {
@@ -1178,69 +1478,219 @@ static int cortexm_fault_unwind(target_s *t)
 	return 0;
 }
 
-bool cortexm_run_stub(target_s *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+static bool cortexm_stub_call_setup(target_s *t, const cortexm_stub_call_s *const call)
 {
+	/* The stub runs behind the target layer's back and is free to change RAM */
+	target_mem_cache_flush();
 	uint32_t regs[t->regs_size / 4U];
 
 	memset(regs, 0, sizeof(regs));
-	regs[0] = r0;
-	regs[1] = r1;
-	regs[2] = r2;
-	regs[3] = r3;
-	regs[15] = loadaddr;
+	memcpy(regs, call->args, sizeof(call->args));
+	regs[9] = call->static_base;
+	regs[REG_SP] = call->stack_top;
+	/* Returning with a BX to the breakpoint has to stay in Thumb state */
+	regs[REG_LR] = call->return_addr ? call->return_addr | 1U : 0U;
+	regs[REG_PC] = call->func & ~1U;
 	regs[REG_XPSR] = CORTEXM_XPSR_THUMB;
 	regs[19] = 0;
 
 	cortexm_regs_write(t, regs);
+	cortexm_regs_flush(t);
 
-	if (target_check_error(t))
-		return false;
+	return !target_check_error(t);
+}
 
-	/* Execute the stub */
+static bool cortexm_stub_setup(target_s *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+{
+	const cortexm_stub_call_s call = {.func = loadaddr, .args = {r0, r1, r2, r3}};
+	return cortexm_stub_call_setup(t, &call);
+}
+
+/* Wait for a running stub to halt, halting it and returning TARGET_HALT_RUNNING if the timeout expires first */
+static target_halt_reason_e cortexm_stub_halt_wait(target_s *t, const uint32_t timeout_ms)
+{
 	target_halt_reason_e reason = TARGET_HALT_RUNNING;
-#if defined(PLATFORM_HAS_DEBUG)
-	uint32_t arm_regs_start[t->regs_size];
-	target_regs_read(t, arm_regs_start);
-#endif
-	cortexm_halt_resume(t, 0);
 	platform_timeout_s timeout;
-	platform_timeout_set(&timeout, 5000);
+	platform_timeout_set(&timeout, timeout_ms);
 	while (reason == TARGET_HALT_RUNNING) {
 		if (platform_timeout_is_expired(&timeout)) {
 			cortexm_halt_request(t);
-#if defined(PLATFORM_HAS_DEBUG)
-			DEBUG_WARN("Stub hangs\n");
-			uint32_t arm_regs[t->regs_size];
-			target_regs_read(t, arm_regs);
-			for (size_t i = 0; i < 20U; i++)
-				DEBUG_WARN("%2d: %08" PRIx32 ", %08" PRIx32 "\n", i, arm_regs_start[i], arm_regs[i]);
-#endif
-			return false;
+			return TARGET_HALT_RUNNING;
 		}
 		reason = cortexm_halt_poll(t, NULL);
 	}
 
 	if (reason == TARGET_HALT_ERROR)
 		raise_exception(EXCEPTION_ERROR, "Target lost in stub");
+	return reason;
+}
 
-	if (reason != TARGET_HALT_BREAKPOINT) {
-		DEBUG_WARN(" Reason %d\n", reason);
-		return false;
-	}
-
-	uint32_t pc = cortexm_pc_read(t);
-	uint16_t bkpt_instr = target_mem_read16(t, pc);
-	if (bkpt_instr >> 8U != 0xbeU)
+/* Set a stub loaded at loadaddr running without waiting for it, for stubs the debugger talks to while they run */
+bool cortexm_start_stub(target_s *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+{
+	if (!cortexm_stub_setup(t, loadaddr, r0, r1, r2, r3))
 		return false;
 
-	return bkpt_instr & 0xffU;
+	cortexm_halt_resume(t, 0);
+	return true;
 }
 
-/* The following routines implement hardware breakpoints and watchpoints.
- * The Flash Patch and Breakpoint (FPB) and Data Watch and Trace (DWT)
- * systems are used. */
-
-static uint32_t dwt_mask(size_t len)
+bool cortexm_run_stub(target_s *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+{
+	if (!cortexm_stub_setup(t, loadaddr, r0, r1, r2, r3))
+		return false;
+
+	/* Execute the stub */
+#if defined(PLATFORM_HAS_DEBUG)
+	uint32_t arm_regs_start[t->regs_size];
+	target_regs_read(t, arm_regs_start);
+#endif
+	cortexm_halt_resume(t, 0);
+	const target_halt_reason_e reason = cortexm_stub_halt_wait(t, 5000);
+	if (reason == TARGET_HALT_RUNNING) {
+#if defined(PLATFORM_HAS_DEBUG)
+		DEBUG_WARN("Stub hangs\n");
+		uint32_t arm_regs[t->regs_size];
+		target_regs_read(t, arm_regs);
+		for (size_t i = 0; i < 20U; i++)
+			DEBUG_WARN("%2zu: %08" PRIx32 ", %08" PRIx32 "\n", i, arm_regs_start[i], arm_regs[i]);
+#endif
+		return false;
+	}
+
+	if (reason != TARGET_HALT_BREAKPOINT) {
+		DEBUG_WARN(" Reason %d\n", reason);
+		return false;
+	}
+
+	uint32_t pc = cortexm_pc_read(t);
+	uint16_t bkpt_instr = target_mem_read16(t, pc);
+	if (bkpt_instr >> 8U != 0xbeU)
+		return false;
+
+	return bkpt_instr & 0xffU;
+}
+
+/* Set a function call running, returning to the breakpoint at call->return_addr without waiting for it */
+bool cortexm_stub_call_start(target_s *t, const cortexm_stub_call_s *const call)
+{
+	if (!cortexm_stub_call_setup(t, call))
+		return false;
+	cortexm_halt_resume(t, 0);
+	return true;
+}
+
+/*
+ * Wait for a call set running by cortexm_stub_call_start() to hit its return breakpoint,
+ * fetching the value it returned. False if it doesn't get there within the timeout.
+ */
+bool cortexm_stub_call_wait(target_s *t, const cortexm_stub_call_s *const call, const uint32_t timeout_ms,
+	uint32_t *const result)
+{
+	const target_halt_reason_e reason = cortexm_stub_halt_wait(t, timeout_ms);
+	if (reason == TARGET_HALT_RUNNING) {
+		DEBUG_WARN("Call to %08" PRIx32 " timed out\n", call->func);
+		return false;
+	}
+
+	uint32_t regs[t->regs_size / 4U];
+	target_regs_read(t, regs);
+	if (reason != TARGET_HALT_BREAKPOINT || (regs[REG_PC] & ~1U) != call->return_addr) {
+		DEBUG_WARN("Call to %08" PRIx32 " stopped at %08" PRIx32 ", reason %d\n", call->func, regs[REG_PC], reason);
+		return false;
+	}
+	*result = regs[0];
+	return true;
+}
+
+/* Call a function loaded into target RAM and wait for it to return, see cortexm_stub_call_start() */
+bool cortexm_stub_call(target_s *t, const cortexm_stub_call_s *const call, const uint32_t timeout_ms,
+	uint32_t *const result)
+{
+	return cortexm_stub_call_start(t, call) && cortexm_stub_call_wait(t, call, timeout_ms, result);
+}
+
+static const uint16_t cortexm_crc32_stub[] = {
+#include "flashstub/crc32.stub"
+};
+
+/* Run the CRC32 stub loaded at stub_addr over one chunk of memory, continuing from *crc */
+static bool cortexm_crc32_stub_run(target_s *const t, const target_addr_t stub_addr, const target_addr_t base,
+	const size_t len, uint32_t *const crc)
+{
+	/* The stub stores its result in the word just after itself */
+	const target_addr_t result_addr = stub_addr + sizeof(cortexm_crc32_stub);
+	if (!cortexm_run_stub(t, stub_addr, base, len, *crc, result_addr))
+		return false;
+	*crc = target_mem_read32(t, result_addr);
+	return !target_check_error(t);
+}
+
+/*
+ * Compute the CRC32 of a memory region by running a small stub on the core itself, so only
+ * the result crosses the debug link rather than the whole region. This borrows the start of
+ * the first suitable RAM region and the core registers, restoring both afterwards.
+ * Returns false when the stub cannot be used, in which case the caller reads the memory back.
+ */
+static bool cortexm_mem_crc32(target_s *const t, uint32_t *const crc_res, const target_addr_t base, const size_t len)
+{
+	cortexm_priv_s *const priv = t->priv;
+	const size_t work_len = sizeof(cortexm_crc32_stub) + 4U;
+
+	/* The stub needs the core, which may still be busy running a Flash loader */
+	if (!(target_mem_read32(t, CORTEXM_DHCSR) & CORTEXM_DHCSR_S_HALT))
+		return false;
+
+	/* Find somewhere aligned to put the stub that doesn't overlap the region being checked */
+	target_addr_t stub_addr = 0;
+	bool found = false;
+	for (const target_ram_s *ram = t->ram; ram && !found; ram = ram->next) {
+		if ((ram->start & 3U) || ram->length < work_len)
+			continue;
+		if (ram->start + work_len > base && ram->start < base + len)
+			continue;
+		stub_addr = ram->start;
+		found = true;
+	}
+	if (!found)
+		return false;
+
+	uint32_t regs[t->regs_size / 4U];
+	target_regs_read(t, regs);
+	const bool on_bkpt = priv->on_bkpt;
+	uint8_t saved_ram[sizeof(cortexm_crc32_stub) + 4U];
+	if (target_mem_read(t, saved_ram, stub_addr, sizeof(saved_ram)))
+		return false;
+
+	bool result = !target_mem_write(t, stub_addr, cortexm_crc32_stub, sizeof(cortexm_crc32_stub));
+	/* Make sure the stub really runs on this part by having it check itself first */
+	uint32_t crc = 0xffffffffU;
+	result = result && cortexm_crc32_stub_run(t, stub_addr, stub_addr, sizeof(cortexm_crc32_stub), &crc) &&
+		crc == generic_crc32_buffer(cortexm_crc32_stub, sizeof(cortexm_crc32_stub));
+	if (!result) {
+		DEBUG_WARN("CRC32 stub failed, falling back to reading memory back\n");
+		/* Don't pay for loading the stub again on a part where it can't run */
+		t->mem_crc32 = NULL;
+	}
+
+	crc = 0xffffffffU;
+	for (size_t offset = 0; result && offset < len; offset += CORTEXM_CRC32_STUB_CHUNK)
+		result = cortexm_crc32_stub_run(t, stub_addr, base + offset, MIN(len - offset, CORTEXM_CRC32_STUB_CHUNK), &crc);
+
+	target_mem_write(t, stub_addr, saved_ram, sizeof(saved_ram));
+	target_regs_write(t, regs);
+	priv->on_bkpt = on_bkpt;
+
+	if (result)
+		*crc_res = crc;
+	return result;
+}
+
+/* The following routines implement hardware breakpoints and watchpoints.
+ * The Flash Patch and Breakpoint (FPB) and Data Watch and Trace (DWT)
+ * systems are used. */
+
+static uint32_t dwt_mask(size_t len)
 {
 	switch (len) {
 	case 1:
@@ -1273,32 +1723,116 @@ static uint32_t dwt_func(target_s *t, target_breakwatch_e type)
 	}
 }
 
-static int cortexm_breakwatch_set(target_s *t, breakwatch_s *bw)
+static bool cortexm_soft_breakpoint_at(target_s *const t, const target_addr_t addr)
+{
+	for (const breakwatch_s *bw = t->bw_list; bw; bw = bw->next) {
+		if (bw->type == TARGET_BREAK_SOFT && bw->reserved[1] == CORTEXM_BREAK_SOFT_RAM && bw->addr == addr)
+			return true;
+	}
+	return false;
+}
+
+static bool cortexm_addr_is_ram(target_s *const t, const target_addr_t addr, const size_t len)
+{
+	for (const target_ram_s *ram = t->ram; ram; ram = ram->next) {
+		if (addr >= ram->start && addr - ram->start + len <= ram->length)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Insert a BKPT over the first halfword of the instruction, keeping the original in reserved[0].
+ * A 16-bit BKPT is enough for 32-bit Thumb-2 instructions too as the core stops before the second half.
+ * The write is read back so RAM that's really ROM or write-protected falls back to the FPB.
+ */
+static bool cortexm_soft_breakpoint_set(target_s *const t, breakwatch_s *const bw)
+{
+	if ((bw->addr & 1U) || !cortexm_addr_is_ram(t, bw->addr, 2U))
+		return false;
+	const uint16_t instruction = target_mem_read16(t, bw->addr);
+	if (target_check_error(t))
+		return false;
+	target_mem_write16(t, bw->addr, ARM_THUMB_BREAKPOINT);
+	if (target_mem_read16(t, bw->addr) != ARM_THUMB_BREAKPOINT || target_check_error(t)) {
+		target_mem_write16(t, bw->addr, instruction);
+		return false;
+	}
+	bw->reserved[0] = instruction;
+	bw->reserved[1] = CORTEXM_BREAK_SOFT_RAM;
+	return true;
+}
+
+static int cortexm_fpb_set(target_s *const t, breakwatch_s *const bw)
 {
 	cortexm_priv_s *priv = t->priv;
 	size_t i;
 	uint32_t val = bw->addr;
 
-	switch (bw->type) {
-	case TARGET_BREAK_HARD:
-		if (priv->flash_patch_revision == 0) {
-			val &= 0x1ffffffcU;
-			val |= (bw->addr & 2U) ? 0x80000000U : 0x40000000U;
-		}
-		val |= 1U;
-
+	if (priv->flash_patch_revision == 0) {
+		/*
+		 * FPBv1 comparators match a whole word and replace either or both halfwords,
+		 * so a breakpoint in the other half of an already matched word shares its comparator.
+		 */
+		const uint32_t replace = (bw->addr & 2U) ? CORTEXM_FPB_V1_REPLACE_UPPER : CORTEXM_FPB_V1_REPLACE_LOWER;
+		val = (val & CORTEXM_FPB_V1_ADDR_MASK) | replace | 1U;
 		for (i = 0; i < priv->hw_breakpoint_max; i++) {
-			if (!priv->hw_breakpoint[i])
+			const uint32_t comp = priv->hw_breakpoint[i];
+			if (comp && (comp & ~CORTEXM_FPB_V1_REPLACE_MASK) == (val & ~CORTEXM_FPB_V1_REPLACE_MASK))
 				break;
 		}
+		if (i < priv->hw_breakpoint_max) {
+			priv->hw_breakpoint[i] |= replace;
+			target_mem_write32(t, CORTEXM_FPB_COMP(i), priv->hw_breakpoint[i]);
+			bw->reserved[0] = i;
+			return 0;
+		}
+	} else
+		val |= 1U;
 
-		if (i == priv->hw_breakpoint_max)
-			return -1;
+	for (i = 0; i < priv->hw_breakpoint_max; i++) {
+		if (!priv->hw_breakpoint[i])
+			break;
+	}
 
-		priv->hw_breakpoint[i] = true;
-		target_mem_write32(t, CORTEXM_FPB_COMP(i), val);
-		bw->reserved[0] = i;
-		return 0;
+	if (i == priv->hw_breakpoint_max)
+		return -1;
+
+	priv->hw_breakpoint[i] = val;
+	target_mem_write32(t, CORTEXM_FPB_COMP(i), val);
+	bw->reserved[0] = i;
+	return 0;
+}
+
+static void cortexm_fpb_clear(target_s *const t, const breakwatch_s *const bw)
+{
+	cortexm_priv_s *priv = t->priv;
+	const unsigned i = bw->reserved[0];
+	if (priv->flash_patch_revision == 0) {
+		/* Only release the comparator once neither halfword is in use */
+		priv->hw_breakpoint[i] &= ~((bw->addr & 2U) ? CORTEXM_FPB_V1_REPLACE_UPPER : CORTEXM_FPB_V1_REPLACE_LOWER);
+		if (!(priv->hw_breakpoint[i] & CORTEXM_FPB_V1_REPLACE_MASK))
+			priv->hw_breakpoint[i] = 0;
+	} else
+		priv->hw_breakpoint[i] = 0;
+	target_mem_write32(t, CORTEXM_FPB_COMP(i), priv->hw_breakpoint[i]);
+}
+
+static int cortexm_breakwatch_set(target_s *t, breakwatch_s *bw)
+{
+	cortexm_priv_s *priv = t->priv;
+	size_t i;
+	uint32_t val = bw->addr;
+
+	switch (bw->type) {
+	case TARGET_BREAK_SOFT:
+		/* Code running from RAM gets a BKPT written in, anything else has to use the FPB */
+		if (cortexm_soft_breakpoint_set(t, bw))
+			return 0;
+		return cortexm_fpb_set(t, bw);
+
+	case TARGET_BREAK_HARD:
+		return cortexm_fpb_set(t, bw);
 
 	case TARGET_WATCH_WRITE:
 	case TARGET_WATCH_READ:
@@ -1309,7 +1843,7 @@ static int cortexm_breakwatch_set(target_s *t, breakwatch_s *bw)
 		}
 
 		if (i == priv->hw_watchpoint_max)
-			return -1;
+			return cortexm_soft_watch_set(t, bw);
 
 		priv->hw_watchpoint[i] = true;
 
@@ -1329,13 +1863,24 @@ static int cortexm_breakwatch_clear(target_s *t, breakwatch_s *bw)
 	cortexm_priv_s *priv = t->priv;
 	unsigned i = bw->reserved[0];
 	switch (bw->type) {
+	case TARGET_BREAK_SOFT:
+		if (bw->reserved[1] == CORTEXM_BREAK_SOFT_RAM) {
+			target_mem_write16(t, bw->addr, bw->reserved[0]);
+			return target_check_error(t);
+		}
+		cortexm_fpb_clear(t, bw);
+		return 0;
 	case TARGET_BREAK_HARD:
-		priv->hw_breakpoint[i] = false;
-		target_mem_write32(t, CORTEXM_FPB_COMP(i), 0);
+		cortexm_fpb_clear(t, bw);
 		return 0;
 	case TARGET_WATCH_WRITE:
 	case TARGET_WATCH_READ:
 	case TARGET_WATCH_ACCESS:
+		if (bw->reserved[1] == CORTEXM_WATCH_SOFT) {
+			priv->soft_watch[i].size = 0;
+			--priv->soft_watches;
+			return 0;
+		}
 		priv->hw_watchpoint[i] = false;
 		target_mem_write32(t, CORTEXM_DWT_FUNC(i), 0);
 		return 0;
@@ -1344,6 +1889,98 @@ static int cortexm_breakwatch_clear(target_s *t, breakwatch_s *bw)
 	}
 }
 
+/*
+ * Software write watchpoints take over once the DWT comparators are all in use: the core gets stepped along one
+ * instruction at a time by the probe and the watched memory compared after each step, rather than GDB doing the
+ * same thing over the wire. Reads can't be seen this way so read and access watchpoints stay hardware only.
+ */
+static int cortexm_soft_watch_set(target_s *t, breakwatch_s *bw)
+{
+	cortexm_priv_s *priv = t->priv;
+	if (bw->type != TARGET_WATCH_WRITE || bw->size > CORTEXM_SOFT_WATCH_SIZE)
+		return -1;
+
+	size_t i;
+	for (i = 0; i < CORTEXM_SOFT_WATCHPOINTS; ++i) {
+		if (!priv->soft_watch[i].size)
+			break;
+	}
+	if (i == CORTEXM_SOFT_WATCHPOINTS)
+		return -1;
+
+	/* Take what the memory holds now to compare against */
+	cortexm_soft_watch_s *const watch = &priv->soft_watch[i];
+	if (target_mem_read(t, watch->value, bw->addr, bw->size))
+		return -1;
+	watch->addr = bw->addr;
+	watch->size = bw->size;
+	++priv->soft_watches;
+
+	bw->reserved[0] = i;
+	bw->reserved[1] = CORTEXM_WATCH_SOFT;
+	return 0;
+}
+
+/* Check the software watchpoints for a change, taking the new value and giving the address of the first to change */
+static bool cortexm_soft_watch_hit(target_s *t, target_addr_t *addr)
+{
+	cortexm_priv_s *priv = t->priv;
+	for (size_t i = 0; i < CORTEXM_SOFT_WATCHPOINTS; ++i) {
+		cortexm_soft_watch_s *const watch = &priv->soft_watch[i];
+		if (!watch->size)
+			continue;
+		uint8_t value[CORTEXM_SOFT_WATCH_SIZE];
+		if (target_mem_read(t, value, watch->addr, watch->size) || !memcmp(value, watch->value, watch->size))
+			continue;
+		memcpy(watch->value, value, watch->size);
+		*addr = watch->addr;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Keep stepping the core for the software watchpoints, checking them after each step, for up to a time slice.
+ * This returns 0 having set the reason if it's still going or a watchpoint changed, otherwise the DFSR of
+ * whatever else halted the core for cortexm_halt_poll() to deal with.
+ */
+static uint32_t cortexm_soft_watch_step(target_s *t, target_addr_t *watch, target_halt_reason_e *reason)
+{
+	cortexm_priv_s *priv = t->priv;
+	/* All the steps count as the one run for the cycle counter */
+	const uint32_t cycles_resume = priv->cycles_resume;
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, CORTEXM_SOFT_WATCH_SLICE_MS);
+	while (true) {
+		target_addr_t addr = 0;
+		if (cortexm_soft_watch_hit(t, &addr)) {
+			priv->watch_stepping = false;
+			if (watch != NULL)
+				*watch = addr;
+			*reason = TARGET_HALT_WATCHPOINT;
+			return 0;
+		}
+
+		cortexm_halt_resume(t, false);
+		priv->cycles_resume = cycles_resume;
+		/* Out of time, so leave this step for the next poll to pick up */
+		if (platform_timeout_is_expired(&timeout))
+			return 0;
+		/* A step into a WFI might not come back for a while either */
+		uint32_t dhcsr = 0;
+		do
+			dhcsr = target_mem_read32(t, CORTEXM_DHCSR);
+		while (!(dhcsr & CORTEXM_DHCSR_S_HALT) && !platform_timeout_is_expired(&timeout));
+		if (!(dhcsr & CORTEXM_DHCSR_S_HALT) || target_check_error(t))
+			return 0;
+
+		const uint32_t dfsr = target_mem_read32(t, CORTEXM_DFSR);
+		target_mem_write32(t, CORTEXM_DFSR, dfsr);
+		if (dfsr != CORTEXM_DFSR_HALTED)
+			return dfsr;
+	}
+}
+
 static target_addr_t cortexm_check_watch(target_s *t)
 {
 	cortexm_priv_s *priv = t->priv;
@@ -1398,6 +2035,289 @@ static bool cortexm_vector_catch(target_s *t, int argc, const char **argv)
 	return true;
 }
 
+/* Take a batch of PC samples, reading PCSR through a non-incrementing TAR so the reads can be queued */
+static void cortexm_profile_sample(target_s *t, uint32_t *samples, size_t count)
+{
+	adiv5_access_port_s *ap = cortexm_ap(t);
+	adiv5_queue_entry_s entries[CORTEXM_PROFILE_BATCH + 2U];
+	adiv5_queue_s queue;
+	adiv5_queue_init(&queue, ap->dp, entries, ARRAY_LENGTH(entries));
+	adiv5_queue_ap_write(&queue, ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD | ADIV5_AP_CSW_ADDRINC_NONE);
+	adiv5_queue_ap_write(&queue, ap, ADIV5_AP_TAR, CORTEXM_DWT_PCSR);
+	for (size_t i = 0; i < count; ++i)
+		adiv5_queue_ap_read(&queue, ap, ADIV5_AP_DRW, &samples[i]);
+	adiv5_queue_run(&queue);
+}
+
+#if PC_HOSTED == 1
+static void cortexm_profile_put32(FILE *file, uint32_t value)
+{
+	const uint8_t bytes[4] = {value & 0xffU, (value >> 8U) & 0xffU, (value >> 16U) & 0xffU, value >> 24U};
+	fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+/* Write the histogram out as a gprof gmon.out holding a single time histogram record */
+static bool cortexm_profile_write_gmon(const char *name, target_addr_t start, uint32_t shift, const uint32_t *bins,
+	size_t bin_count, uint32_t rate)
+{
+	FILE *file = fopen(name, "wb");
+	if (!file)
+		return false;
+	/* Header: cookie, version 1 and 12 spare bytes */
+	fwrite("gmon", 1, 4, file);
+	cortexm_profile_put32(file, 1);
+	for (size_t i = 0; i < 3U; ++i)
+		cortexm_profile_put32(file, 0);
+	/* Histogram record: tag, low and high PC, bin count, sample rate and dimension */
+	fputc(0, file);
+	cortexm_profile_put32(file, start);
+	cortexm_profile_put32(file, start + (bin_count << shift));
+	cortexm_profile_put32(file, bin_count);
+	cortexm_profile_put32(file, rate);
+	char dimen[15] = "seconds";
+	fwrite(dimen, 1, sizeof(dimen), file);
+	fputc('s', file);
+	for (size_t i = 0; i < bin_count; ++i) {
+		const uint16_t count = bins[i] > UINT16_MAX ? UINT16_MAX : bins[i];
+		const uint8_t bytes[2] = {count & 0xffU, count >> 8U};
+		fwrite(bytes, 1, sizeof(bytes), file);
+	}
+	return fclose(file) == 0;
+}
+#endif
+
+static bool cortexm_profile(target_s *t, int argc, const char **argv)
+{
+	if (argc != 2 && argc != 3 && argc != 5) {
+		tc_printf(t, "usage: monitor profile <duration_ms> [period_ms [start end]]\n");
+		return false;
+	}
+	const uint32_t duration = strtoul(argv[1], NULL, 0);
+	const uint32_t period = argc > 2 ? strtoul(argv[2], NULL, 0) : 0;
+
+	/* Profile the given address range, or by default all of Flash */
+	target_addr_t start = UINT32_MAX;
+	target_addr_t end = 0;
+	if (argc == 5) {
+		start = strtoul(argv[3], NULL, 0);
+		end = strtoul(argv[4], NULL, 0);
+	} else {
+		for (const target_flash_s *f = t->flash; f; f = f->next) {
+			if (f->start < start)
+				start = f->start;
+			if (f->start + f->length > end)
+				end = f->start + f->length;
+		}
+	}
+	if (end <= start) {
+		tc_printf(t, "No address range to profile\n");
+		return false;
+	}
+
+	/* Bins are a power of two bytes wide, at least one halfword, as Thumb instructions are halfword aligned */
+	uint32_t shift = 1U;
+	while (((end - start - 1U) >> shift) >= CORTEXM_PROFILE_BINS)
+		++shift;
+	const size_t bin_count = ((end - start - 1U) >> shift) + 1U;
+	uint32_t *bins = calloc(bin_count, sizeof(*bins));
+	if (!bins) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return false;
+	}
+
+	/* PCSR reads as all ones while the core is halted, so let it run for the duration */
+	tc_printf(t, "Profiling for %" PRIu32 "ms\n", duration);
+	target_halt_resume(t, false);
+	uint32_t total = 0;
+	uint32_t stopped = 0;
+	uint32_t outside = 0;
+	const uint32_t begin = platform_time_ms();
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, duration);
+	while (!platform_timeout_is_expired(&timeout)) {
+		uint32_t samples[CORTEXM_PROFILE_BATCH];
+		const size_t count = period ? 1U : CORTEXM_PROFILE_BATCH;
+		cortexm_profile_sample(t, samples, count);
+		if (target_check_error(t))
+			break;
+		for (size_t i = 0; i < count; ++i) {
+			const uint32_t pc = samples[i];
+			if (pc == UINT32_MAX)
+				++stopped;
+			else if (pc < start || pc >= end)
+				++outside;
+			else
+				++bins[(pc - start) >> shift];
+		}
+		total += count;
+		if (period)
+			platform_delay(period);
+	}
+	const uint32_t elapsed = platform_time_ms() - begin;
+
+	/* Stop the core again, as GDB expects to find it */
+	target_halt_request(t);
+	platform_timeout_set(&timeout, 1000U);
+	while (target_halt_poll(t, NULL) == TARGET_HALT_RUNNING && !platform_timeout_is_expired(&timeout))
+		continue;
+
+	tc_printf(t, "%" PRIu32 " samples, %" PRIu32 " outside 0x%08" PRIx32 "-0x%08" PRIx32 ", %" PRIu32 " halted or asleep\n",
+		total, outside, start, end, stopped);
+	const uint32_t in_range = total - outside - stopped;
+	/* Report the busiest bins, each pass picking the busiest one that sorts after the last shown */
+	uint32_t last_count = UINT32_MAX;
+	size_t last_bin = SIZE_MAX;
+	for (size_t n = 0; n < CORTEXM_PROFILE_TOP && in_range; ++n) {
+		size_t busiest = SIZE_MAX;
+		for (size_t i = 0; i < bin_count; ++i) {
+			const bool after_last = bins[i] < last_count || (bins[i] == last_count && i > last_bin);
+			if (bins[i] && after_last && (busiest == SIZE_MAX || bins[i] > bins[busiest]))
+				busiest = i;
+		}
+		if (busiest == SIZE_MAX)
+			break;
+		const target_addr_t bin_start = start + (busiest << shift);
+		tc_printf(t, "0x%08" PRIx32 "-0x%08" PRIx32 ": %" PRIu32 " (%" PRIu32 "%%)\n", bin_start,
+			bin_start + (1U << shift) - 1U, bins[busiest], (uint32_t)((bins[busiest] * 100ULL) / in_range));
+		last_count = bins[busiest];
+		last_bin = busiest;
+	}
+#if PC_HOSTED == 1
+	const uint32_t rate = elapsed ? (uint32_t)((total * 1000ULL) / elapsed) : 0;
+	if (cortexm_profile_write_gmon("gmon.out", start, shift, bins, bin_count, rate))
+		tc_printf(t, "Histogram written to gmon.out\n");
+	else
+		tc_printf(t, "Could not write gmon.out\n");
+#else
+	(void)elapsed;
+#endif
+	tc_printf(t, "Target halted, registers have changed - use 'flushregs' to have GDB re-read them\n");
+	free(bins);
+	return true;
+}
+
+static bool cortexm_cycles(target_s *t, int argc, const char **argv)
+{
+	cortexm_priv_s *priv = t->priv;
+	if (!priv->has_cyccnt) {
+		tc_printf(t, "No DWT cycle counter on this core\n");
+		return false;
+	}
+	if (argc == 2 && !strcmp(argv[1], "reset")) {
+		target_mem_write32(t, CORTEXM_DWT_CYCCNT, 0);
+		priv->cycles_halt = 0;
+		priv->cycles_resume = 0;
+		return true;
+	}
+	if (argc == 3 && !strcmp(argv[1], "report")) {
+		priv->cycles_report = !strncmp(argv[2], "enable", strlen(argv[2]));
+		return true;
+	}
+	if (argc != 1) {
+		tc_printf(t, "usage: monitor cycles [reset|report (enable|disable)]\n");
+		return false;
+	}
+	tc_printf(t, "Cycle counter: %" PRIu32 ", last run: %" PRIu32 " cycles, reporting on halt %s\n",
+		target_mem_read32(t, CORTEXM_DWT_CYCCNT), priv->cycles_halt - priv->cycles_resume,
+		priv->cycles_report ? "enabled" : "disabled");
+	return true;
+}
+
+static bool cortexm_trace_watch_clear(target_s *const t)
+{
+	cortexm_priv_s *priv = t->priv;
+	for (size_t i = 0; i < priv->hw_watchpoint_max; i++) {
+		if (priv->trace_watchpoints & (1U << i)) {
+			target_mem_write32(t, CORTEXM_DWT_FUNC(i), 0);
+			priv->hw_watchpoint[i] = false;
+		}
+	}
+	priv->trace_watchpoints = 0;
+	return true;
+}
+
+/*
+ * Program a DWT comparator to emit data trace packets through the ITM rather than halt the core,
+ * sending the address offset (or the PC if asked) followed by the value of each matching access.
+ * This only sets up the DWT and ITM, the TPIU/SWO output is configured as for 'traceswo'.
+ */
+static bool cortexm_trace_watch(target_s *t, int argc, const char **argv)
+{
+	cortexm_priv_s *priv = t->priv;
+	if (t->target_options & TOPT_FLAVOUR_V6M) {
+		tc_printf(t, "Data trace is not available on ARMv6-M\n");
+		return false;
+	}
+	if (argc == 1) {
+		for (size_t i = 0; i < priv->hw_watchpoint_max; i++) {
+			if (priv->trace_watchpoints & (1U << i))
+				tc_printf(t, "dwt%zu: 0x%08" PRIx32 " function 0x%02" PRIx32 "\n", i,
+					target_mem_read32(t, CORTEXM_DWT_COMP(i)), target_mem_read32(t, CORTEXM_DWT_FUNC(i)) & 0x3fU);
+		}
+		return true;
+	}
+	if (argc == 2 && !strcmp(argv[1], "clear"))
+		return cortexm_trace_watch_clear(t);
+	if (argc < 3 || argc > 5) {
+		tc_printf(t, "usage: monitor trace_watch [(read|write|access) <addr> [size [pc]]|clear]\n");
+		return false;
+	}
+
+	const bool with_pc = argc == 5 && !strcmp(argv[4], "pc");
+	uint32_t func;
+	if (!strcmp(argv[1], "read"))
+		func = with_pc ? CORTEXM_DWT_FUNC_FUNC_PC_DATA_READ : CORTEXM_DWT_FUNC_FUNC_DATA_READ;
+	else if (!strcmp(argv[1], "write"))
+		func = with_pc ? CORTEXM_DWT_FUNC_FUNC_PC_DATA_WRITE : CORTEXM_DWT_FUNC_FUNC_DATA_WRITE;
+	else if (!strcmp(argv[1], "access"))
+		func = with_pc ? CORTEXM_DWT_FUNC_FUNC_PC_DATA_ACCESS : CORTEXM_DWT_FUNC_FUNC_DATA_ACCESS;
+	else {
+		tc_printf(t, "Unknown access type '%s'\n", argv[1]);
+		return false;
+	}
+	if (!with_pc)
+		func |= CORTEXM_DWT_FUNC_EMITRANGE;
+
+	const target_addr_t addr = strtoul(argv[2], NULL, 0);
+	const size_t size = argc > 3 ? strtoul(argv[3], NULL, 0) : 4U;
+	const uint32_t mask = dwt_mask(size);
+	if (mask == UINT32_MAX || (addr & (size - 1U))) {
+		tc_printf(t, "Size must be 1, 2 or 4 and the address aligned to it\n");
+		return false;
+	}
+
+	size_t i;
+	for (i = 0; i < priv->hw_watchpoint_max; i++) {
+		if (!priv->hw_watchpoint[i])
+			break;
+	}
+	if (i == priv->hw_watchpoint_max) {
+		tc_printf(t, "No free DWT comparators\n");
+		return false;
+	}
+	priv->hw_watchpoint[i] = true;
+	priv->trace_watchpoints |= 1U << i;
+
+	target_mem_write32(t, CORTEXM_DWT_COMP(i), addr);
+	target_mem_write32(t, CORTEXM_DWT_MASK(i), mask);
+	target_mem_write32(t, CORTEXM_DWT_FUNC(i), func);
+
+	/* Let the DWT's packets through the ITM, which needs a trace bus ID if nobody has set one yet */
+	target_mem_write32(t, CORTEXM_ITM_LAR, CORTEXM_ITM_LAR_KEY);
+	uint32_t tcr = target_mem_read32(t, CORTEXM_ITM_TCR);
+	if (!(tcr & CORTEXM_ITM_TCR_TRACEBUSID_MASK))
+		tcr |= CORTEXM_ITM_TCR_TRACEBUSID(1U);
+	target_mem_write32(t, CORTEXM_ITM_TCR, tcr | CORTEXM_ITM_TCR_DWTENA | CORTEXM_ITM_TCR_ITMENA);
+
+	tc_printf(t, "Tracing %s of 0x%08" PRIx32 " on dwt%zu\n", argv[1], addr, i);
+	return !target_check_error(t);
+}
+
+static bool cortexm_etb(target_s *t, int argc, const char **argv)
+{
+	return coresight_trace_command(t, cortexm_ap(t), argc, argv);
+}
+
 #if PC_HOSTED == 0
 static bool cortexm_redirect_stdout(target_s *t, int argc, const char **argv)
 {
@@ -1430,17 +2350,107 @@ static void probe_mem_write(
 	DEBUG_INFO("probe_mem_write\n");
 	memcpy(dst, src, len);
 }
+
+static uint8_t cortexm_hostio_buffer[CORTEXM_HOSTIO_BUFFER_SIZE];
+
+/*
+ * Service SYS_WRITE by reading the target buffer in one block into probe memory and
+ * pointing GDB's File-I/O memory reads at that copy, so its 'm' packets are answered
+ * without touching the target. Large writes are handled a buffer at a time.
+ */
+static int cortexm_hostio_write(target_s *const t, const int fd, const target_addr_t buf_taddr, const uint32_t count)
+{
+	if (t->stdout_redirected && (fd == STDOUT_FILENO || fd == STDERR_FILENO))
+		return tc_write(t, fd, buf_taddr, count);
+
+	void (*saved_mem_read)(target_s * t, void *dest, target_addr_t src, size_t len) = t->mem_read;
+	uint32_t written = 0;
+	while (written < count) {
+		const uint32_t chunk = MIN(count - written, sizeof(cortexm_hostio_buffer));
+		if (target_mem_read(t, cortexm_hostio_buffer, buf_taddr + written, chunk))
+			break;
+		t->mem_read = probe_mem_read;
+		const int rc = tc_write(t, fd, (target_addr_t)cortexm_hostio_buffer, chunk);
+		t->mem_read = saved_mem_read;
+		if (rc < 0)
+			return written ? (int)written : rc;
+		written += rc;
+		if ((uint32_t)rc != chunk || t->tc->interrupted)
+			break;
+	}
+	return written;
+}
+
+/*
+ * Service SYS_READ by letting GDB's File-I/O memory writes land in probe memory and
+ * then writing the result to the target with a single block write per buffer.
+ */
+static int cortexm_hostio_read(target_s *const t, const int fd, const target_addr_t buf_taddr, const uint32_t count)
+{
+	void (*saved_mem_write)(target_s * t, target_addr_t dest, const void *src, size_t len) = t->mem_write;
+	uint32_t read = 0;
+	while (read < count) {
+		const uint32_t chunk = MIN(count - read, sizeof(cortexm_hostio_buffer));
+		t->mem_write = probe_mem_write;
+		const int rc = tc_read(t, fd, (target_addr_t)cortexm_hostio_buffer, chunk);
+		t->mem_write = saved_mem_write;
+		if (rc < 0)
+			return read ? (int)read : rc;
+		if (rc && target_mem_write(t, buf_taddr + read, cortexm_hostio_buffer, rc))
+			return read ? (int)read : -1;
+		read += rc;
+		/* A short read means EOF or an interactive source, either way the target gets what we have */
+		if ((uint32_t)rc != chunk || t->tc->interrupted)
+			break;
+	}
+	return read;
+}
 #endif
 
+/*
+ * Service SYS_WRITE0 by reading the string in blocks rather than a byte at a time.
+ * Blocks are aligned so a read never runs more than one block past the terminator.
+ * When the console is local to the probe (hosted, or stdout redirected to the USB UART),
+ * each block is emitted as it's read and GDB never gets involved.
+ */
+static int32_t cortexm_hostio_write0(target_s *const t, const target_addr_t str_begin)
+{
+	uint8_t buf[CORTEXM_HOSTIO_BLOCK_SIZE];
+	target_addr_t str_end = str_begin;
+	while (true) {
+		const size_t count = CORTEXM_HOSTIO_BLOCK_SIZE - (str_end & (CORTEXM_HOSTIO_BLOCK_SIZE - 1U));
+		if (target_mem_read(t, buf, str_end, count))
+			return -1;
+		const uint8_t *const terminator = memchr(buf, '\0', count);
+		const size_t len = terminator ? (size_t)(terminator - buf) : count;
+#if PC_HOSTED == 1
+		fwrite(buf, 1, len, stderr);
+#else
+		if (t->stdout_redirected)
+			debug_serial_send_stdout(buf, len);
+#endif
+		str_end += len;
+		if (terminator)
+			break;
+	}
+#if PC_HOSTED == 0
+	const int len = str_end - str_begin;
+	if (!t->stdout_redirected && len != 0 && tc_write(t, STDERR_FILENO, str_begin, len) != len)
+		return -1;
+#endif
+	return 0;
+}
+
 static int cortexm_hostio_request(target_s *t)
 {
 	uint32_t arm_regs[t->regs_size];
-	uint32_t params[4];
+	uint32_t params[4] = {0};
 
 	t->tc->interrupted = false;
 	target_regs_read(t, arm_regs);
 	uint32_t syscall = arm_regs[0];
-	if (syscall != SEMIHOSTING_SYS_EXIT)
+	/* SYS_WRITEC and SYS_WRITE0 point r1 at the data itself rather than at a parameter block */
+	if (syscall != SEMIHOSTING_SYS_EXIT && syscall != SEMIHOSTING_SYS_WRITEC && syscall != SEMIHOSTING_SYS_WRITE0)
 		target_mem_read(t, params, arm_regs[1], sizeof(params));
 	int32_t ret = 0;
 
@@ -1567,20 +2577,12 @@ static int cortexm_hostio_request(target_s *t)
 		break;
 	}
 
-	case SEMIHOSTING_SYS_WRITE0: { /* write0 */
+	case SEMIHOSTING_SYS_WRITE0: /* write0 */
 		ret = -1;
-		target_addr_t str_addr = arm_regs[1];
-		if (str_addr == TARGET_NULL)
+		if (arm_regs[1] == TARGET_NULL)
 			break;
-		while (true) {
-			const uint8_t str_c = target_mem_read8(t, str_addr++);
-			if (target_check_error(t) || str_c == 0x00)
-				break;
-			fputc(str_c, stderr);
-		}
-		ret = 0;
+		ret = cortexm_hostio_write0(t, arm_regs[1]);
 		break;
-	}
 
 	case SEMIHOSTING_SYS_ISTTY: /* isatty */
 		ret = isatty(params[0] - 1);
@@ -1761,36 +2763,21 @@ static int cortexm_hostio_request(target_s *t)
 		ret = tc_close(t, params[0] - 1);
 		break;
 	case SEMIHOSTING_SYS_READ: /* read */
-		ret = tc_read(t, params[0] - 1, params[1], params[2]);
+		ret = cortexm_hostio_read(t, params[0] - 1, params[1], params[2]);
 		if (ret >= 0)
 			ret = params[2] - ret;
 		break;
 	case SEMIHOSTING_SYS_WRITE: /* write */
-		ret = tc_write(t, params[0] - 1, params[1], params[2]);
+		ret = cortexm_hostio_write(t, params[0] - 1, params[1], params[2]);
 		if (ret >= 0)
 			ret = params[2] - ret;
 		break;
 	case SEMIHOSTING_SYS_WRITEC: /* writec */
 		ret = tc_write(t, STDERR_FILENO, arm_regs[1], 1);
 		break;
-	case SEMIHOSTING_SYS_WRITE0: { /* write0 */
-		ret = -1;
-		target_addr_t str_begin = arm_regs[1];
-		target_addr_t str_end = str_begin;
-		while (target_mem_read8(t, str_end) != 0) {
-			if (target_check_error(t))
-				break;
-			str_end++;
-		}
-		int len = str_end - str_begin;
-		if (len != 0) {
-			int rc = tc_write(t, STDERR_FILENO, str_begin, len);
-			if (rc != len)
-				break;
-		}
-		ret = 0;
+	case SEMIHOSTING_SYS_WRITE0: /* write0 */
+		ret = cortexm_hostio_write0(t, arm_regs[1]);
 		break;
-	}
 	case SEMIHOSTING_SYS_ISTTY: /* isatty */
 		ret = tc_isatty(t, params[0] - 1);
 		break;
@@ -28,9 +28,11 @@ extern unsigned cortexm_wait_timeout;
 #define CORTEXM_PPB_BASE 0xe0000000U
 
 #define CORTEXM_SCS_BASE (CORTEXM_PPB_BASE + 0xe000U)
+#define CORTEXM_SCS_SIZE 0x1000U
 
 #define CORTEXM_CPUID (CORTEXM_SCS_BASE + 0xd00U)
 #define CORTEXM_AIRCR (CORTEXM_SCS_BASE + 0xd0cU)
+#define CORTEXM_CCR   (CORTEXM_SCS_BASE + 0xd14U)
 #define CORTEXM_CFSR  (CORTEXM_SCS_BASE + 0xd28U)
 #define CORTEXM_HFSR  (CORTEXM_SCS_BASE + 0xd2cU)
 #define CORTEXM_DFSR  (CORTEXM_SCS_BASE + 0xd30U)
@@ -58,9 +60,16 @@ extern unsigned cortexm_wait_timeout;
 #define CORTEXM_FPB_REMAP   (CORTEXM_FPB_BASE + 0x004U)
 #define CORTEXM_FPB_COMP(i) (CORTEXM_FPB_BASE + 0x008U + (4U * (i)))
 
+#define CORTEXM_ITM_BASE CORTEXM_PPB_BASE
+
+#define CORTEXM_ITM_TCR (CORTEXM_ITM_BASE + 0xe80U)
+#define CORTEXM_ITM_LAR (CORTEXM_ITM_BASE + 0xfb0U)
+
 #define CORTEXM_DWT_BASE (CORTEXM_PPB_BASE + 0x1000U)
 
 #define CORTEXM_DWT_CTRL    (CORTEXM_DWT_BASE + 0x000U)
+#define CORTEXM_DWT_CYCCNT  (CORTEXM_DWT_BASE + 0x004U)
+#define CORTEXM_DWT_PCSR    (CORTEXM_DWT_BASE + 0x01cU)
 #define CORTEXM_DWT_COMP(i) (CORTEXM_DWT_BASE + 0x020U + (0x10U * (i)))
 #define CORTEXM_DWT_MASK(i) (CORTEXM_DWT_BASE + 0x024U + (0x10U * (i)))
 #define CORTEXM_DWT_FUNC(i) (CORTEXM_DWT_BASE + 0x028U + (0x10U * (i)))
@@ -76,6 +85,9 @@ extern unsigned cortexm_wait_timeout;
 #define CORTEXM_AIRCR_VECTCLRACTIVE (1U << 1U)
 #define CORTEXM_AIRCR_VECTRESET     (1U << 0U)
 
+/* Configuration and Control Register (CCR) */
+#define CORTEXM_CCR_DC (1U << 16U)
+
 /* HardFault Status Register (HFSR) */
 #define CORTEXM_HFSR_DEBUGEVT (1U << 31U)
 #define CORTEXM_HFSR_FORCED   (1U << 30U)
@@ -146,6 +158,17 @@ extern unsigned cortexm_wait_timeout;
 #define CORTEXM_FPB_CTRL_KEY    (1U << 1U)
 #define CORTEXM_FPB_CTRL_ENABLE (1U << 0U)
 
+/* ITM Trace Control Register (ITM_TCR) */
+#define CORTEXM_ITM_TCR_TRACEBUSID_MASK (0x7fU << 16U)
+#define CORTEXM_ITM_TCR_TRACEBUSID(id)  ((id) << 16U)
+#define CORTEXM_ITM_TCR_DWTENA          (1U << 3U)
+#define CORTEXM_ITM_TCR_ITMENA          (1U << 0U)
+#define CORTEXM_ITM_LAR_KEY             0xc5acce55U
+
+/* Data Watchpoint and Trace Control Register (DWT_CTRL) */
+#define CORTEXM_DWT_CTRL_NOCYCCNT  (1U << 25U)
+#define CORTEXM_DWT_CTRL_CYCCNTENA (1U << 0U)
+
 /* Data Watchpoint and Trace Mask Register (DWT_MASKx)
 *  The value here is the number of address bits we mask out */
 #define CORTEXM_DWT_MASK_BYTE     (0U)
@@ -159,6 +182,14 @@ extern unsigned cortexm_wait_timeout;
 #define CORTEXM_DWT_FUNC_FUNC_READ      (5U << 0U)
 #define CORTEXM_DWT_FUNC_FUNC_WRITE     (6U << 0U)
 #define CORTEXM_DWT_FUNC_FUNC_ACCESS    (7U << 0U)
+/* Data trace functions, v7m only. With EMITRANGE set the address offset is sent instead of the PC */
+#define CORTEXM_DWT_FUNC_EMITRANGE           (1U << 5U)
+#define CORTEXM_DWT_FUNC_FUNC_DATA_ACCESS    (2U << 0U)
+#define CORTEXM_DWT_FUNC_FUNC_PC_DATA_ACCESS (3U << 0U)
+#define CORTEXM_DWT_FUNC_FUNC_DATA_READ      (12U << 0U)
+#define CORTEXM_DWT_FUNC_FUNC_DATA_WRITE     (13U << 0U)
+#define CORTEXM_DWT_FUNC_FUNC_PC_DATA_READ   (14U << 0U)
+#define CORTEXM_DWT_FUNC_FUNC_PC_DATA_WRITE  (15U << 0U)
 
 #define REG_SP      13U
 #define REG_LR      14U
@@ -168,8 +199,10 @@ extern unsigned cortexm_wait_timeout;
 #define REG_PSP     18U
 #define REG_SPECIAL 19U
 
-#define ARM_THUMB_BREAKPOINT 0xbe00U
-#define CORTEXM_XPSR_THUMB   (1U << 24U)
+#define ARM_THUMB_BREAKPOINT     0xbe00U
+#define CORTEXM_XPSR_THUMB       (1U << 24U)
+#define CORTEXM_XPSR_STACK_ALIGN (1U << 9U)
+#define CORTEXM_EXC_RETURN_FTYPE (1U << 4U)
 
 #define CORTEXM_TOPT_INHIBIT_NRST (1U << 2U)
 
@@ -187,11 +220,32 @@ extern unsigned cortexm_wait_timeout;
 #define CPUID_PATCH_MASK    0xfU
 
 adiv5_access_port_s *cortexm_ap(target_s *t);
+bool cortexm_target(const target_s *t);
 
 bool cortexm_attach(target_s *t);
 void cortexm_detach(target_s *t);
 void cortexm_halt_resume(target_s *t, bool step);
+void cortexm_regs_invalidate(target_s *t);
+bool cortexm_start_stub(target_s *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3);
 bool cortexm_run_stub(target_s *t, uint32_t loadaddr, uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3);
+
+/*
+ * A call into a function loaded into target RAM that follows the AAPCS, as CMSIS-Pack flash
+ * algorithms do: it runs on its own stack and returns to a breakpoint instruction
+ */
+typedef struct cortexm_stub_call {
+	target_addr_t func;        /* Address of the function to call */
+	target_addr_t return_addr; /* Address of the breakpoint instruction to return to */
+	target_addr_t stack_top;   /* Initial stack pointer */
+	target_addr_t static_base; /* Static base for position independent code, passed in r9 */
+	uint32_t args[4];          /* Arguments, passed in r0-r3 */
+} cortexm_stub_call_s;
+
+bool cortexm_stub_call_start(target_s *t, const cortexm_stub_call_s *call);
+bool cortexm_stub_call_wait(target_s *t, const cortexm_stub_call_s *call, uint32_t timeout_ms, uint32_t *result);
+bool cortexm_stub_call(target_s *t, const cortexm_stub_call_s *call, uint32_t timeout_ms, uint32_t *result);
 int cortexm_mem_write_sized(target_s *t, target_addr_t dest, const void *src, size_t len, align_e align);
+bool cortexm_mem_write_loop(
+	target_s *t, target_addr_t dest, const void *src, size_t len, align_e align, const adiv5_mem_write_loop_s *loop);
 
 #endif /* TARGET_CORTEXM_H */
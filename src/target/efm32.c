@@ -41,18 +41,30 @@
 #include "target_internal.h"
 #include "cortexm.h"
 #include "adiv5.h"
+#include "flash_loader.h"
 
 #define SRAM_BASE        0x20000000U
 #define STUB_BUFFER_BASE ALIGN(SRAM_BASE + sizeof(efm32_flash_write_stub), 4)
 
 static bool efm32_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool efm32_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool efm32_flash_done(target_flash_s *f);
 static bool efm32_mass_erase(target_s *t);
 
 static const uint16_t efm32_flash_write_stub[] = {
 #include "flashstub/efm32.stub"
 };
 
+/* Resident double-buffered loader, see flashstub/efm32_loader.s */
+static const uint16_t efm32_loader_stub[] = {
+#include "flashstub/efm32_loader.stub"
+};
+
+typedef struct efm32_flash {
+	target_flash_s f;
+	flash_loader_s loader;
+} efm32_flash_s;
+
 static bool efm32_cmd_serial(target_s *t, int argc, const char **argv);
 static bool efm32_cmd_efm_info(target_s *t, int argc, const char **argv);
 static bool efm32_cmd_bootloader(target_s *t, int argc, const char **argv);
@@ -496,17 +508,19 @@ static efm32_v2_di_miscchip_s efm32_v2_read_miscchip(target_s *t, uint8_t di_ver
 
 static void efm32_add_flash(target_s *t, target_addr_t addr, size_t length, size_t page_size)
 {
-	target_flash_s *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
+	efm32_flash_s *ef = calloc(1, sizeof(*ef));
+	if (!ef) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	target_flash_s *f = &ef->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = page_size;
 	f->erase = efm32_flash_erase;
 	f->write = efm32_flash_write;
+	f->done = efm32_flash_done;
 	f->writesize = page_size;
 	target_add_flash(t, f);
 }
@@ -603,6 +617,10 @@ static bool efm32_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 	if (!priv_storage || !priv_storage->device)
 		return false;
 
+	/* The loader has to be done with any programming before the MSC can be used for erasing */
+	if (!flash_loader_stop(f, &((efm32_flash_s *)f)->loader))
+		return false;
+
 	uint32_t msc = priv_storage->device->msc_addr;
 
 	/* Unlock */
@@ -620,7 +638,7 @@ static bool efm32_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 		target_mem_write32(t, EFM32_MSC_WRITECMD(msc), EFM32_MSC_WRITECMD_ERASEPAGE);
 
 		/* Poll MSC Busy */
-		while ((target_mem_read32(t, EFM32_MSC_STATUS(msc)) & EFM32_MSC_STATUS_BUSY)) {
+		while (!target_mem_poll32(t, EFM32_MSC_STATUS(msc), EFM32_MSC_STATUS_BUSY, 0, TARGET_POLL_SLICE_MS, NULL)) {
 			if (target_check_error(t))
 				return false;
 		}
@@ -635,19 +653,41 @@ static bool efm32_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 	return true;
 }
 
+/* Start the resident loader for the session, it expects the MSC unlocked with WREN set */
+static bool efm32_flash_loader_start(target_flash_s *const f, const uint32_t msc)
+{
+	target_s *t = f->t;
+	flash_loader_s *const loader = &((efm32_flash_s *)f)->loader;
+	if (loader->running)
+		return true;
+	target_mem_write32(t, EFM32_MSC_LOCK(msc), EFM32_MSC_LOCK_LOCKKEY);
+	target_mem_write32(t, EFM32_MSC_WRITECTRL(msc), 1);
+	const flash_loader_config_s config = {
+		.cr_addr = msc,
+		.sr_addr = EFM32_MSC_STATUS(msc),
+		.busy_mask = EFM32_MSC_STATUS_BUSY,
+		.error_mask = EFM32_MSC_STATUS_LOCKED | EFM32_MSC_STATUS_INVADDR,
+		.unit = 4U,
+	};
+	return flash_loader_start_stub(f, loader, &config, efm32_loader_stub, sizeof(efm32_loader_stub));
+}
+
 /* Write flash page by page */
 static bool efm32_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
 {
-	(void)len;
-
 	target_s *t = f->t;
 
 	efm32_priv_s *priv_storage = (efm32_priv_s *)t->target_storage;
 	if (!priv_storage || !priv_storage->device)
 		return false;
 
-	/* Write flashloader */
-	target_mem_write(t, SRAM_BASE, efm32_flash_write_stub, sizeof(efm32_flash_write_stub));
+	/* Stream pages through the resident loader, programming one while the next is uploaded */
+	if (efm32_flash_loader_start(f, priv_storage->device->msc_addr))
+		return flash_loader_write(f, &((efm32_flash_s *)f)->loader, dest, src, len, 0);
+
+	/* Write flashloader, once per session */
+	if (!target_flash_stub_load(f, SRAM_BASE, efm32_flash_write_stub, sizeof(efm32_flash_write_stub)))
+		return false;
 	/* Write Buffer */
 	target_mem_write(t, STUB_BUFFER_BASE, src, len);
 	/* Run flashloader */
@@ -662,6 +702,11 @@ static bool efm32_flash_write(target_flash_s *f, target_addr_t dest, const void
 	return ret;
 }
 
+static bool efm32_flash_done(target_flash_s *f)
+{
+	return flash_loader_stop(f, &((efm32_flash_s *)f)->loader);
+}
+
 /* Uses the MSC ERASEMAIN0/1 command to erase the entire flash */
 static bool efm32_mass_erase(target_s *t)
 {
@@ -691,7 +736,7 @@ static bool efm32_mass_erase(target_s *t)
 	platform_timeout_s timeout;
 	platform_timeout_set(&timeout, 500);
 	/* Poll MSC Busy */
-	while ((target_mem_read32(t, EFM32_MSC_STATUS(msc)) & EFM32_MSC_STATUS_BUSY)) {
+	while (!target_mem_poll32(t, EFM32_MSC_STATUS(msc), EFM32_MSC_STATUS_BUSY, 0, TARGET_POLL_SLICE_MS, NULL)) {
 		if (target_check_error(t))
 			return false;
 		target_print_progress(&timeout);
@@ -703,7 +748,7 @@ static bool efm32_mass_erase(target_s *t)
 		target_mem_write32(t, EFM32_MSC_WRITECMD(msc), EFM32_MSC_WRITECMD_ERASEMAIN1);
 
 		/* Poll MSC Busy */
-		while ((target_mem_read32(t, EFM32_MSC_STATUS(msc)) & EFM32_MSC_STATUS_BUSY)) {
+		while (!target_mem_poll32(t, EFM32_MSC_STATUS(msc), EFM32_MSC_STATUS_BUSY, 0, TARGET_POLL_SLICE_MS, NULL)) {
 			if (target_check_error(t))
 				return false;
 			target_print_progress(&timeout);
@@ -873,7 +918,7 @@ static bool efm32_cmd_bootloader(target_s *t, int argc, const char **argv)
 	target_mem_write32(t, EFM32_MSC_WRITECMD(msc), EFM32_MSC_WRITECMD_WRITEONCE);
 
 	/* Poll MSC Busy */
-	while ((target_mem_read32(t, EFM32_MSC_STATUS(msc)) & EFM32_MSC_STATUS_BUSY)) {
+	while (!target_mem_poll32(t, EFM32_MSC_STATUS(msc), EFM32_MSC_STATUS_BUSY, 0, TARGET_POLL_SLICE_MS, NULL)) {
 		if (target_check_error(t))
 			return false;
 	}
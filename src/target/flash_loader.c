@@ -0,0 +1,216 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This file implements the probe side of the double-buffered SRAM Flash loader in
+ * flashstub/flash_loader.s. The stub is left running on the target, programming one buffer
+ * while the probe fills the other, so programming is bound by SWD bandwidth rather than
+ * per-word round trips and status polling from the probe.
+ *
+ * Drivers opt in by embedding a flash_loader_s in their Flash structure, calling
+ * flash_loader_start() and flash_loader_write() from their write routine, and
+ * flash_loader_stop() before erasing and from their done routine. When the loader can't
+ * be started (not enough RAM, data cache enabled) the driver falls back to its own path.
+ * Controllers that don't fit the STM32 model can bring their own stub for the same control
+ * block protocol through flash_loader_start_stub().
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "cortexm.h"
+#include "flash_loader.h"
+
+/* Control block layout, shared with flashstub/flash_loader.s */
+#define FLASH_LOADER_STATUS     0x18U
+#define FLASH_LOADER_SLOT(n)    (0x20U + ((n) * 0x10U))
+#define FLASH_LOADER_CTRL_WORDS 16U
+
+#define FLASH_LOADER_SLOT_DEST       0x00U
+#define FLASH_LOADER_SLOT_SRC        0x04U
+#define FLASH_LOADER_SLOT_REG_OFFSET 0x08U
+#define FLASH_LOADER_SLOT_LENGTH     0x0cU
+/* Length handed to the stub to have it exit */
+#define FLASH_LOADER_STOP UINT32_MAX
+
+#define FLASH_LOADER_TIMEOUT 5000U
+
+static const uint16_t flash_loader_stub[] = {
+#include "flashstub/flash_loader.stub"
+};
+
+static inline target_addr_t flash_loader_ctrl(const flash_loader_s *const loader)
+{
+	return loader->ctrl;
+}
+
+static inline target_addr_t flash_loader_buffer(const flash_loader_s *const loader, const uint8_t slot)
+{
+	return loader->ctrl + (FLASH_LOADER_CTRL_WORDS * 4U) + (slot * loader->buffer_length);
+}
+
+/* Stop the stub after something went wrong, reporting what the controller said if it was a Flash error */
+static void flash_loader_abort(target_s *const t, flash_loader_s *const loader)
+{
+	loader->running = false;
+	if (target_halt_poll(t, NULL) == TARGET_HALT_RUNNING)
+		target_halt_request(t);
+	const uint32_t status = target_mem_read32(t, flash_loader_ctrl(loader) + FLASH_LOADER_STATUS);
+	DEBUG_WARN("Flash loader failed, status 0x%08" PRIx32 "\n", status);
+}
+
+/* Wait for the stub to hand a buffer back, watching for it having stopped or hung */
+static bool flash_loader_wait_slot(target_s *const t, flash_loader_s *const loader, const uint8_t slot)
+{
+	const target_addr_t length_addr = flash_loader_ctrl(loader) + FLASH_LOADER_SLOT(slot) + FLASH_LOADER_SLOT_LENGTH;
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, FLASH_LOADER_TIMEOUT);
+	while (target_mem_read32(t, length_addr)) {
+		if (target_check_error(t) || platform_timeout_is_expired(&timeout) ||
+			target_halt_poll(t, NULL) != TARGET_HALT_RUNNING) {
+			flash_loader_abort(t, loader);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool flash_loader_start(target_flash_s *const f, flash_loader_s *const loader, const flash_loader_config_s *const config)
+{
+	return flash_loader_start_stub(f, loader, config, flash_loader_stub, sizeof(flash_loader_stub));
+}
+
+bool flash_loader_start_stub(target_flash_s *const f, flash_loader_s *const loader,
+	const flash_loader_config_s *const config, const uint16_t *const stub, const size_t stub_length)
+{
+	if (loader->running)
+		return true;
+	target_s *const t = f->t;
+
+	const size_t ctrl_offset = ALIGN(stub_length, 4U);
+
+	/* Find a RAM region that can hold the stub, its control block and two buffers of writesize */
+	const size_t length = ctrl_offset + (FLASH_LOADER_CTRL_WORDS * 4U) + (f->writesize * 2U);
+	const target_ram_s *ram = t->ram;
+	for (; ram; ram = ram->next) {
+		if (!(ram->start & 3U) && ram->length >= length)
+			break;
+	}
+	if (!ram)
+		return false;
+
+	/* A core with its data cache on would not see the buffers being filled behind its back */
+	if (target_mem_read32(t, CORTEXM_CCR) & CORTEXM_CCR_DC)
+		return false;
+
+	loader->base = ram->start;
+	loader->ctrl = ram->start + ctrl_offset;
+	loader->buffer_length = f->writesize;
+	loader->error_mask = config->error_mask;
+	loader->sr_addr = config->sr_addr;
+	loader->reg_offset = 0;
+	loader->slot = 0;
+
+	uint32_t ctrl[FLASH_LOADER_CTRL_WORDS] = {
+		config->cr_addr,
+		config->cr_value,
+		config->sr_addr,
+		config->busy_mask,
+		config->error_mask,
+		config->unit,
+	};
+	for (uint8_t slot = 0; slot < 2U; ++slot)
+		ctrl[(FLASH_LOADER_SLOT(slot) + FLASH_LOADER_SLOT_SRC) / 4U] = flash_loader_buffer(loader, slot);
+
+	/* Clear any stale errors, the stub gives up as soon as it sees one */
+	target_mem_write32(t, config->sr_addr, config->error_mask);
+	target_mem_write(t, loader->base, stub, stub_length);
+	target_mem_write(t, flash_loader_ctrl(loader), ctrl, sizeof(ctrl));
+	if (target_check_error(t) ||
+		!cortexm_start_stub(t, loader->base, flash_loader_ctrl(loader), 0, 0, 0)) {
+		DEBUG_WARN("Flash loader could not be started\n");
+		return false;
+	}
+	loader->running = true;
+	return true;
+}
+
+bool flash_loader_write(target_flash_s *const f, flash_loader_s *const loader, const target_addr_t dest,
+	const void *const src, const size_t len, const uint32_t reg_offset)
+{
+	target_s *const t = f->t;
+	if (!loader->running || len > loader->buffer_length)
+		return false;
+
+	const uint8_t slot = loader->slot;
+	if (!flash_loader_wait_slot(t, loader, slot))
+		return false;
+
+	/* Moving to another bank, clear its stale errors too */
+	if (reg_offset != loader->reg_offset) {
+		target_mem_write32(t, loader->sr_addr + reg_offset, loader->error_mask);
+		loader->reg_offset = reg_offset;
+	}
+
+	/* Fill the buffer, then hand it over - the length is written last as that is what the stub waits on */
+	const target_addr_t buffer = flash_loader_buffer(loader, slot);
+	target_mem_write(t, buffer, src, len);
+	const uint32_t slot_words[4] = {dest, buffer, reg_offset, len};
+	target_mem_write(t, flash_loader_ctrl(loader) + FLASH_LOADER_SLOT(slot), slot_words, sizeof(slot_words));
+	loader->slot = slot ^ 1U;
+
+	if (target_check_error(t)) {
+		flash_loader_abort(t, loader);
+		return false;
+	}
+	return true;
+}
+
+bool flash_loader_stop(target_flash_s *const f, flash_loader_s *const loader)
+{
+	if (!loader->running)
+		return true;
+	target_s *const t = f->t;
+
+	/* Let both buffers finish programming, then tell the stub to exit */
+	const uint8_t slot = loader->slot;
+	if (!flash_loader_wait_slot(t, loader, slot) || !flash_loader_wait_slot(t, loader, slot ^ 1U))
+		return false;
+	target_mem_write32(t, flash_loader_ctrl(loader) + FLASH_LOADER_SLOT(slot) + FLASH_LOADER_SLOT_LENGTH,
+		FLASH_LOADER_STOP);
+
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, FLASH_LOADER_TIMEOUT);
+	target_halt_reason_e reason = TARGET_HALT_RUNNING;
+	while (reason == TARGET_HALT_RUNNING) {
+		if (target_check_error(t) || platform_timeout_is_expired(&timeout)) {
+			flash_loader_abort(t, loader);
+			return false;
+		}
+		reason = target_halt_poll(t, NULL);
+	}
+	loader->running = false;
+
+	const uint32_t status = target_mem_read32(t, flash_loader_ctrl(loader) + FLASH_LOADER_STATUS);
+	if (reason != TARGET_HALT_BREAKPOINT || status) {
+		DEBUG_WARN("Flash loader failed, status 0x%08" PRIx32 "\n", status);
+		return false;
+	}
+	return true;
+}
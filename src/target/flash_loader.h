@@ -0,0 +1,55 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TARGET_FLASH_LOADER_H
+#define TARGET_FLASH_LOADER_H
+
+#include "general.h"
+#include "target_internal.h"
+
+/* Describes how to drive a Flash controller of the "set PG, store, poll BSY" kind */
+typedef struct flash_loader_config {
+	uint32_t cr_addr;    /* Address of the control register */
+	uint32_t cr_value;   /* Value selecting programming, written to the control register for each buffer */
+	uint32_t sr_addr;    /* Address of the status register */
+	uint32_t busy_mask;  /* Status register bits set while an operation is in progress */
+	uint32_t error_mask; /* Status register bits reporting an error, these must be write-1-to-clear */
+	uint32_t unit;       /* Bytes per programming operation, 2 or a multiple of 4 */
+} flash_loader_config_s;
+
+typedef struct flash_loader {
+	target_addr_t base;   /* Address the loader stub is running at */
+	target_addr_t ctrl;   /* Address of the control block, just past the stub */
+	size_t buffer_length; /* Length of each of the two SRAM buffers */
+	uint32_t error_mask;  /* Error bits to clear when moving to another bank */
+	uint32_t sr_addr;     /* Status register address, to clear errors through */
+	uint32_t reg_offset;  /* Register offset of the bank last written */
+	uint8_t slot;         /* Next buffer to fill */
+	bool running;         /* True if the stub is running on the target */
+} flash_loader_s;
+
+bool flash_loader_start(target_flash_s *f, flash_loader_s *loader, const flash_loader_config_s *config);
+/* As flash_loader_start(), with a controller specific stub speaking the same control block protocol */
+bool flash_loader_start_stub(target_flash_s *f, flash_loader_s *loader, const flash_loader_config_s *config,
+	const uint16_t *stub, size_t stub_length);
+bool flash_loader_write(target_flash_s *f, flash_loader_s *loader, target_addr_t dest, const void *src, size_t len,
+	uint32_t reg_offset);
+bool flash_loader_stop(target_flash_s *f, flash_loader_s *loader);
+
+#endif /* TARGET_FLASH_LOADER_H */
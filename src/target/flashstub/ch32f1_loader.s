@@ -0,0 +1,160 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+@ Double-buffered Flash loader for the CH32F1 fast page programming mode. It speaks the same control
+@ block protocol as flash_loader.s, so it is driven through src/target/flash_loader.c as well, but
+@ each 128 byte page is built up in the controller's page buffer 16 bytes at a time and then
+@ committed with FTPG and STRT, following each step with the "magic" flash read CH32 parts need.
+@ Running on the core also avoids the bus arbitration trouble filling the page buffer over SWD has.
+@ The debugger does the fast unlock before starting it. Needs no stack.
+@
+@ r0: address of the control block, whose unit is the page size
+@
+@ Exits with code 1 when stopped, or stores FLASH_SR (or the word found not to be erased) in the
+@ control block and exits with code 2 on an error.
+
+	.syntax unified
+	.cpu cortex-m3
+	.thumb
+
+	.equ FLASH_CR_STRT, (1 << 6)
+	.equ FLASH_CR_FTPG, (1 << 16)
+	.equ FLASH_CR_BUF_LOAD, (1 << 18)
+	.equ FLASH_CR_BUF_RESET, (1 << 19)
+	.equ FLASH_SR_BSY, (1 << 0)
+	.equ FLASH_SR_EOP, (1 << 5)
+	@ Offsets from FLASH_CR
+	.equ FLASH_AR, 0x04
+	.equ FLASH_MAGIC, 0x24
+	.equ MAGIC_WORD, 0x100
+
+	@ FLASH_CR |= bits
+	.macro set_cr bits
+	ldr r6, [r4]
+	orr r6, r6, #\bits
+	str r6, [r4]
+	.endm
+
+	@ FLASH_CR &= ~bits
+	.macro clear_cr bits
+	ldr r6, [r4]
+	bic r6, r6, #\bits
+	str r6, [r4]
+	.endm
+
+	@ Wait for FLASH_SR.EOP, then clear it
+	.macro wait_eop
+1:
+	ldr r6, [r5]
+	tst r6, #FLASH_SR_EOP
+	beq 1b
+	mov r6, #FLASH_SR_EOP
+	str r6, [r5]
+	.endm
+
+	@ FLASH_MAGIC = *(addr ^ MAGIC_WORD)
+	.macro magic addr
+	eor r6, \addr, #MAGIC_WORD
+	ldr r6, [r6]
+	str r6, [r4, #FLASH_MAGIC]
+	.endm
+
+	.global ch32f1_loader_stub
+	.type ch32f1_loader_stub, %function
+ch32f1_loader_stub:
+	add r7, r0, #32
+	ldr r4, [r0, #0]
+	ldr r5, [r0, #8]
+wait:
+	@ A slot is handed over by the debugger writing its length last
+	ldr r3, [r7, #12]
+	cmp r3, #0
+	beq wait
+	adds r6, r3, #1
+	beq stop
+	ldr r1, [r7, #0]
+	ldr r2, [r7, #4]
+page_loop:
+	@ Reset the page buffer
+	set_cr FLASH_CR_FTPG
+	set_cr FLASH_CR_BUF_RESET
+busy:
+	ldr r6, [r5]
+	tst r6, #FLASH_SR_BSY
+	bne busy
+	clear_cr FLASH_CR_FTPG
+	@ The page has to read back erased before its buffer can be filled
+	mov r9, #32
+erased:
+	ldr r6, [r1]
+	adds r6, #1
+	beq load
+	subs r9, #1
+	bne erased
+	ldr r6, [r1]
+	b error
+load:
+	@ Fill the page buffer 16 bytes at a time
+	mov r8, r1
+	ldr r9, [r0, #20]
+load_loop:
+	set_cr FLASH_CR_FTPG
+	ldr r6, [r2], #4
+	str r6, [r8, #0]
+	ldr r6, [r2], #4
+	str r6, [r8, #4]
+	ldr r6, [r2], #4
+	str r6, [r8, #8]
+	ldr r6, [r2], #4
+	str r6, [r8, #12]
+	set_cr FLASH_CR_BUF_LOAD
+	wait_eop
+	clear_cr FLASH_CR_FTPG
+	magic r8
+	add r8, r8, #16
+	subs r9, #16
+	bne load_loop
+	@ Program the page from the buffer
+	set_cr FLASH_CR_FTPG
+	str r1, [r4, #FLASH_AR]
+	set_cr FLASH_CR_STRT
+	wait_eop
+	clear_cr FLASH_CR_FTPG
+	magic r1
+	ldr r6, [r5]
+	ldr r9, [r0, #16]
+	tst r6, r9
+	bne error
+	ldr r6, [r0, #20]
+	add r1, r1, r6
+	subs r3, r3, r6
+	bgt page_loop
+	@ Hand the buffer back and move on to the other slot
+	movs r3, #0
+	str r3, [r7, #12]
+	adds r7, #16
+	add r6, r0, #64
+	cmp r7, r6
+	bne wait
+	subs r7, #32
+	b wait
+error:
+	str r6, [r0, #24]
+	bkpt #2
+stop:
+	bkpt #1
@@ -0,0 +1,57 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ CRC32 (polynomial 0x04c11db7, MSB first, no reflection or final XOR) over target memory,
+@ matching generic_crc32() in src/crc32.c. Runs on any Cortex-M and needs no stack.
+@
+@ r0: address of the data
+@ r1: length of the data in bytes
+@ r2: CRC to continue from (0xffffffff for a fresh CRC)
+@ r3: address to store the resulting CRC at
+@
+@ Exits with code 1 so cortexm_run_stub() reports a successful run as true.
+
+	.syntax unified
+	.cpu cortex-m0
+	.thumb
+
+	.global crc32_stub
+	.type crc32_stub, %function
+crc32_stub:
+	ldr r4, =0x04c11db7
+	cmp r1, #0
+	beq done
+byte_loop:
+	ldrb r5, [r0]
+	adds r0, #1
+	lsls r5, r5, #24
+	eors r2, r5
+	movs r6, #8
+bit_loop:
+	@ Shifting the top bit out into carry tells us whether to apply the polynomial
+	lsls r2, r2, #1
+	bcc no_xor
+	eors r2, r4
+no_xor:
+	subs r6, #1
+	bne bit_loop
+	subs r1, #1
+	bne byte_loop
+done:
+	str r2, [r3]
+	bkpt #1
+	.pool
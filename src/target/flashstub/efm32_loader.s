@@ -0,0 +1,92 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+@ Double-buffered Flash loader for the EFM32/EFR32 MSC. It speaks the same control block protocol as
+@ flash_loader.s, so it is driven through src/target/flash_loader.c as well, but each word is
+@ programmed with the MSC's load address, write data and write once commands. The debugger unlocks
+@ the MSC and sets WREN before starting it. Needs no stack.
+@
+@ r0: address of the control block, whose control register address is the MSC base
+@
+@ Exits with code 1 when stopped, or stores MSC_STATUS in the control block and exits with
+@ code 2 if the MSC reports an error.
+
+	.syntax unified
+	.cpu cortex-m0
+	.thumb
+
+	.global efm32_loader_stub
+	.type efm32_loader_stub, %function
+efm32_loader_stub:
+	movs r7, r0
+	adds r7, #32
+	ldr r5, [r0, #0]
+wait:
+	@ A slot is handed over by the debugger writing its length last
+	ldr r3, [r7, #12]
+	cmp r3, #0
+	beq wait
+	adds r4, r3, #1
+	beq stop
+	ldr r1, [r7, #0]
+	ldr r2, [r7, #4]
+word_loop:
+	@ MSC_ADDRB = dest, MSC_WRITECMD = LADDRIM
+	str r1, [r5, #0x10]
+	movs r4, #1
+	str r4, [r5, #0x0c]
+wdata_wait:
+	ldr r6, [r5, #0x1c]
+	ldr r4, [r0, #16]
+	tst r6, r4
+	bne error
+	movs r4, #8
+	tst r6, r4
+	beq wdata_wait
+	@ MSC_WDATA = word, MSC_WRITECMD = WRITEONCE
+	ldr r4, [r2]
+	str r4, [r5, #0x18]
+	movs r4, #8
+	str r4, [r5, #0x0c]
+busy:
+	ldr r6, [r5, #0x1c]
+	ldr r4, [r0, #16]
+	tst r6, r4
+	bne error
+	ldr r4, [r0, #12]
+	tst r6, r4
+	bne busy
+	adds r1, #4
+	adds r2, #4
+	subs r3, #4
+	bgt word_loop
+	@ Hand the buffer back and move on to the other slot
+	movs r3, #0
+	str r3, [r7, #12]
+	adds r7, #16
+	movs r4, r0
+	adds r4, #64
+	cmp r7, r4
+	bne wait
+	subs r7, #32
+	b wait
+error:
+	str r6, [r0, #24]
+	bkpt #2
+stop:
+	bkpt #1
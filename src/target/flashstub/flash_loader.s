@@ -0,0 +1,99 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ Double-buffered Flash loader for controllers programmed by setting a bit in a control register,
+@ storing the data to Flash and polling a status register - the STM32 family's model. It runs
+@ until told to stop, programming one buffer while the debugger fills the other. Used through
+@ src/target/flash_loader.c, which describes the control block layout. Needs no stack.
+@
+@ r0: address of the control block
+@
+@ Exits with code 1 when stopped, or stores the status register in the control block and exits
+@ with code 2 if the controller reports an error.
+
+	.syntax unified
+	.cpu cortex-m0
+	.thumb
+
+	.global flash_loader_stub
+	.type flash_loader_stub, %function
+flash_loader_stub:
+	movs r7, r0
+	adds r7, #32
+wait:
+	@ A slot is handed over by the debugger writing its length last
+	ldr r3, [r7, #12]
+	cmp r3, #0
+	beq wait
+	adds r4, r3, #1
+	beq stop
+	ldr r1, [r7, #0]
+	ldr r2, [r7, #4]
+	@ Select programming in the control register of this slot's bank
+	ldr r4, [r0, #0]
+	ldr r5, [r7, #8]
+	adds r4, r5
+	ldr r6, [r0, #4]
+	str r6, [r4]
+unit_loop:
+	ldr r5, [r0, #20]
+store_loop:
+	@ 2 byte programming units take halfword stores, anything larger takes words
+	cmp r5, #2
+	bne store_word
+	ldrh r6, [r2]
+	strh r6, [r1]
+	movs r6, #2
+	b stored
+store_word:
+	ldr r6, [r2]
+	str r6, [r1]
+	movs r6, #4
+stored:
+	adds r1, r6
+	adds r2, r6
+	subs r3, r6
+	subs r5, r6
+	bgt store_loop
+busy:
+	ldr r4, [r0, #8]
+	ldr r6, [r7, #8]
+	adds r4, r6
+	ldr r6, [r4]
+	ldr r4, [r0, #16]
+	tst r6, r4
+	bne error
+	ldr r4, [r0, #12]
+	tst r6, r4
+	bne busy
+	cmp r3, #0
+	bgt unit_loop
+	@ Hand the buffer back and move on to the other slot
+	movs r3, #0
+	str r3, [r7, #12]
+	adds r7, #16
+	movs r4, r0
+	adds r4, #64
+	cmp r7, r4
+	bne wait
+	subs r7, #32
+	b wait
+error:
+	str r6, [r0, #24]
+	bkpt #2
+stop:
+	bkpt #1
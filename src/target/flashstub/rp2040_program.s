@@ -0,0 +1,61 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ Double-buffered RP2040 Flash programming trampoline. Chains calls to the boot ROM's
+@ flash_range_program() for each of two buffers in turn, so the debugger can fill one while
+@ the other programs. Driven by rp_flash_write() in src/target/rp.c, which describes the
+@ control block layout and provides a stack for the ROM.
+@
+@ r0: address of the control block
+@
+@ Exits with code 1 when stopped.
+
+	.syntax unified
+	.cpu cortex-m0plus
+	.thumb
+
+	.global rp2040_program_stub
+	.type rp2040_program_stub, %function
+rp2040_program_stub:
+	@ r4 and r5 are preserved across the ROM calls
+	movs r4, r0
+	movs r5, r0
+	adds r5, #8
+wait:
+	@ A slot is handed over by the debugger writing its length last
+	ldr r2, [r5, #8]
+	cmp r2, #0
+	beq wait
+	adds r3, r2, #1
+	beq stop
+	@ flash_range_program(flash_offs, data, count)
+	ldr r0, [r5, #0]
+	ldr r1, [r5, #4]
+	ldr r3, [r4, #0]
+	blx r3
+	@ Hand the buffer back and move on to the other slot
+	movs r2, #0
+	str r2, [r5, #8]
+	adds r5, #12
+	movs r3, r4
+	adds r3, #32
+	cmp r5, r3
+	bne wait
+	subs r5, #24
+	b wait
+stop:
+	bkpt #1
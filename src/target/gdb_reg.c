@@ -21,21 +21,17 @@
 
 #include "gdb_reg.h"
 
-const char *gdb_xml_preamble_first = "<?xml version=\"1.0\"?>"
-									 "<!DOCTYPE";
-
-const char *gdb_xml_preamble_second = "SYSTEM \"gdb-target.dtd\">"
-									  "<target>"
-									  "  <architecture>";
-const char *gdb_xml_preamble_third = "</architecture>";
+const char *gdb_xml_preamble_first = GDB_XML_PREAMBLE_FIRST;
+const char *gdb_xml_preamble_second = GDB_XML_PREAMBLE_SECOND;
+const char *gdb_xml_preamble_third = GDB_XML_PREAMBLE_THIRD;
 
 const char *gdb_reg_type_strings[] = {
-	"",                   // GDB_TYPE_UNSPECIFIED.
-	" type=\"data_ptr\"", // GDB_TYPE_DATA_PTR.
-	" type=\"code_ptr\"", // GDB_TYPE_CODE_PTR.
+	"",                    // GDB_TYPE_UNSPECIFIED.
+	GDB_REG_TYPE_DATA_PTR, // GDB_TYPE_DATA_PTR.
+	GDB_REG_TYPE_CODE_PTR, // GDB_TYPE_CODE_PTR.
 };
 
 const char *gdb_reg_save_restore_strings[] = {
-	"",                    // GDB_SAVE_RESTORE_UNSPECIFIED.
-	" save-restore=\"no\"" // GDB_SAVE_RESTORE_NO.
+	"",                     // GDB_SAVE_RESTORE_UNSPECIFIED.
+	GDB_REG_SAVE_RESTORE_NO // GDB_SAVE_RESTORE_NO.
 };
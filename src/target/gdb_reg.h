@@ -22,6 +22,15 @@
 #ifndef TARGET_GDB_REG_H
 #define TARGET_GDB_REG_H
 
+// The pieces of the preamble and register tag fields as string literals, for building
+// target descriptions into constants at compile time.
+#define GDB_XML_PREAMBLE_FIRST  "<?xml version=\"1.0\"?><!DOCTYPE"
+#define GDB_XML_PREAMBLE_SECOND "SYSTEM \"gdb-target.dtd\"><target>  <architecture>"
+#define GDB_XML_PREAMBLE_THIRD  "</architecture>"
+#define GDB_REG_TYPE_DATA_PTR   " type=\"data_ptr\""
+#define GDB_REG_TYPE_CODE_PTR   " type=\"code_ptr\""
+#define GDB_REG_SAVE_RESTORE_NO " save-restore=\"no\""
+
 // The beginning XML for GDB target descriptions that are common to all targets,
 // save for one word: the word after DOCTYPE, which is "target" for Cortex-M, and "feature"
 // for Cortex-A. The "preamble" is thus split into three parts, with this single word missing
@@ -24,17 +24,27 @@
 #include "adiv5.h"
 #include "jtag_devs.h"
 
-const jtag_dev_descr_s dev_descr[] = {
+/*
+ * Known devices, sorted by the designer field of the IDCODE (bits 11:0, the JEP-106 code and the
+ * always-set bit 0) so the entries for a designer can be found by binary search. Every mask covers
+ * that field. Within a designer, entries are tried in order, so more specific ones must come first.
+ */
+static const jtag_dev_descr_s dev_descr[] = {
+	/* Just for fun, unsupported */
 	{
-		.idcode = 0x0ba00477U,
-		.idmask = 0x0fff0fffU,
-		.descr = "ADIv5 JTAG-DP port.",
-		.handler = adiv5_jtag_dp_handler,
+		.idcode = 0x20270013U,
+		.idmask = 0xffffffffU,
+		.descr = "i80386ex.",
 	},
 	{
-		.idcode = 0x00000477U,
-		.idmask = 0x00000fffU,
-		.descr = "Unknown ARM.",
+		.idcode = 0x8940303fU,
+		.idmask = 0xffffffffU,
+		.descr = "ATMega16.",
+	},
+	{
+		.idcode = 0x0792603fU,
+		.idmask = 0xffffffffU,
+		.descr = "AT91SAM9261.",
 	},
 	{
 		.idcode = 0x06410041U,
@@ -91,51 +101,36 @@ const jtag_dev_descr_s dev_descr[] = {
 		.idmask = 0x00000fffU,
 		.descr = "STM32 BSD.",
 	},
-	{
-		.idcode = 0x0bb11477U,
-		.idmask = 0xffffffffU,
-		.descr = "NPX: LPC11C24.",
-	},
-	{
-		.idcode = 0x4ba00477U,
-		.idmask = 0xffffffffU,
-		.descr = "NXP: LPC17xx family.",
-	},
 	{
 		.idcode = 0x00000093U,
 		.idmask = 0x00000fffU,
 		.descr = "Xilinx.",
 	},
 	{
-		.idcode = 0x0000063dU,
-		.idmask = 0x00000fffU,
-		.descr = "Xambala: RVDBG013.",
-	},
-	{
-		.idcode = 0x000007a3U,
-		.idmask = 0x00000fffU,
-		.descr = "Gigadevice BSD.",
+		.idcode = 0x07b7617fU,
+		.idmask = 0xffffffffU,
+		.descr = "BCM2835.",
 	},
-	/* Just for fun, unsupported */
 	{
-		.idcode = 0x8940303fU,
-		.idmask = 0xffffffffU,
-		.descr = "ATMega16.",
+		.idcode = 0x0ba00477U,
+		.idmask = 0x0fff0fffU,
+		.descr = "ADIv5 JTAG-DP port.",
+		.handler = adiv5_jtag_dp_handler,
 	},
 	{
-		.idcode = 0x0792603fU,
-		.idmask = 0xffffffffU,
-		.descr = "AT91SAM9261.",
+		.idcode = 0x00000477U,
+		.idmask = 0x00000fffU,
+		.descr = "Unknown ARM.",
 	},
 	{
-		.idcode = 0x20270013U,
+		.idcode = 0x0bb11477U,
 		.idmask = 0xffffffffU,
-		.descr = "i80386ex.",
+		.descr = "NPX: LPC11C24.",
 	},
 	{
-		.idcode = 0x07b7617fU,
+		.idcode = 0x4ba00477U,
 		.idmask = 0xffffffffU,
-		.descr = "BCM2835.",
+		.descr = "NXP: LPC17xx family.",
 	},
 	{
 		.idcode = 0x4ba00477U,
@@ -143,8 +138,61 @@ const jtag_dev_descr_s dev_descr[] = {
 		.descr = "BCM2836.",
 	},
 	{
-		.idcode = 0U,
-		.idmask = 0U,
-		.descr = "Unknown",
+		.idcode = 0x0000063dU,
+		.idmask = 0x00000fffU,
+		.descr = "Xambala: RVDBG013.",
+	},
+	{
+		.idcode = 0x000007a3U,
+		.idmask = 0x00000fffU,
+		.descr = "Gigadevice BSD.",
 	},
 };
+
+#define JTAG_DEV_DESIGNER_MASK  0x00000fffU
+#define JTAG_DEV_REGISTERED_MAX 4U
+
+/* Descriptors registered at runtime, tried ahead of the table */
+static const jtag_dev_descr_s *registered_descr[JTAG_DEV_REGISTERED_MAX];
+static size_t registered_descr_count = 0;
+
+bool jtag_dev_register(const jtag_dev_descr_s *const descr)
+{
+	if (registered_descr_count == JTAG_DEV_REGISTERED_MAX)
+		return false;
+	registered_descr[registered_descr_count++] = descr;
+	return true;
+}
+
+static inline bool jtag_dev_descr_match(const jtag_dev_descr_s *const descr, const uint32_t idcode)
+{
+	return (idcode & descr->idmask) == descr->idcode;
+}
+
+const jtag_dev_descr_s *jtag_dev_descr_find(const uint32_t idcode)
+{
+	for (size_t idx = 0; idx < registered_descr_count; ++idx) {
+		if (jtag_dev_descr_match(registered_descr[idx], idcode))
+			return registered_descr[idx];
+	}
+
+	/* Find the first entry for this designer */
+	const uint32_t designer = idcode & JTAG_DEV_DESIGNER_MASK;
+	size_t begin = 0;
+	size_t end = ARRAY_LENGTH(dev_descr);
+	while (begin < end) {
+		const size_t middle = begin + (end - begin) / 2U;
+		if ((dev_descr[middle].idcode & JTAG_DEV_DESIGNER_MASK) < designer)
+			begin = middle + 1U;
+		else
+			end = middle;
+	}
+	/* And then try that designer's entries in order */
+	for (size_t idx = begin; idx < ARRAY_LENGTH(dev_descr); ++idx) {
+		if ((dev_descr[idx].idcode & JTAG_DEV_DESIGNER_MASK) != designer)
+			break;
+		if (jtag_dev_descr_match(&dev_descr[idx], idcode))
+			return &dev_descr[idx];
+	}
+	return NULL;
+}
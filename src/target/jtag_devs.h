@@ -21,6 +21,7 @@
 #ifndef TARGET_JTAG_DEVS_H
 #define TARGET_JTAG_DEVS_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 typedef struct jtag_dev_descr {
@@ -30,6 +31,12 @@ typedef struct jtag_dev_descr {
 	void (*handler)(uint8_t jd_index);
 } jtag_dev_descr_s;
 
-extern const jtag_dev_descr_s dev_descr[];
+/* Look up the descriptor for an IDCODE, returning NULL when the device is unknown */
+const jtag_dev_descr_s *jtag_dev_descr_find(uint32_t idcode);
+/*
+ * Add a descriptor to be matched ahead of the built-in table, so a handler can be hooked in
+ * without editing it. The descriptor must outlive all scans. Returns false if there's no room.
+ */
+bool jtag_dev_register(const jtag_dev_descr_s *descr);
 
 #endif /* TARGET_JTAG_DEVS_H */
@@ -181,6 +181,9 @@ uint32_t jtag_scan(const uint8_t *irlens)
 
 	/* Reset jtagtap: should take all devs to IDCODE */
 	jtag_proc.jtagtap_reset();
+	/* What the reset leaves in each IR isn't known, so no write may be skipped until one's been done */
+	for (size_t device = 0; device < jtag_dev_count; ++device)
+		jtag_devs[device].current_ir = UINT32_MAX;
 	jtagtap_shift_dr();
 	/* Now shift out the ID codes for all the attached devices. */
 	for (size_t device = 0; device < jtag_dev_count; ++device) {
@@ -202,65 +205,176 @@ uint32_t jtag_scan(const uint8_t *irlens)
 		platform_add_jtag_dev(device, jtag_devs + device);
 #endif
 
+	/* Look each device up once, saving the description in the device table */
+	const jtag_dev_descr_s *descrs[JTAG_MAX_DEVS];
 	for (size_t device = 0; device < jtag_dev_count; ++device) {
+		descrs[device] = jtag_dev_descr_find(jtag_devs[device].jd_idcode);
 		DEBUG_INFO("IDCode 0x%08" PRIx32, jtag_devs[device].jd_idcode);
-		for (size_t descr = 0; dev_descr[descr].idcode; ++descr) {
-			if ((jtag_devs[device].jd_idcode & dev_descr[descr].idmask) == dev_descr[descr].idcode) {
-				DEBUG_INFO(": %s", dev_descr[descr].descr ? dev_descr[descr].descr : "Unknown");
-				break;
-			}
+		if (descrs[device]) {
+			jtag_devs[device].jd_descr = descrs[device]->descr;
+			DEBUG_INFO(": %s", descrs[device]->descr ? descrs[device]->descr : "Unknown");
 		}
 		DEBUG_INFO("\n");
 	}
 
-	/* Check for known devices and handle accordingly */
+	/* Check for known devices and call their handlers to initialise/probe them further */
 	for (size_t device = 0; device < jtag_dev_count; device++) {
-		for (size_t descr = 0; dev_descr[descr].idcode; descr++) {
-			if ((jtag_devs[device].jd_idcode & dev_descr[descr].idmask) == dev_descr[descr].idcode) {
-				jtag_devs[device].current_ir = UINT32_MAX;
-				/* Save description in table */
-				jtag_devs[device].jd_descr = dev_descr[descr].descr;
-				/* Call handler to initialise/probe device further */
-				if (dev_descr[descr].handler)
-					dev_descr[descr].handler(device);
-				break;
-			}
-		}
+		if (descrs[device] && descrs[device]->handler)
+			descrs[device]->handler(device);
 	}
 
 	return jtag_dev_count;
 }
 
-void jtag_dev_write_ir(const uint8_t dev_index, const uint32_t ir)
+/*
+ * Update the cached IR state for an instruction write to a device, returning false when that
+ * instruction is already loaded and the write can be skipped.
+ */
+static bool jtag_dev_select_ir(jtag_dev_s *const device, const uint32_t ir)
 {
-	jtag_dev_s *device = &jtag_devs[dev_index];
 	/* If the request would duplicate work already done, do nothing */
 	if (ir == device->current_ir)
-		return;
+		return false;
 
-	/* Set all the other devices IR's to being in bypass */
-	for (size_t device = 0; device < jtag_dev_count; device++)
-		jtag_devs[device].current_ir = UINT32_MAX;
+	/*
+	 * Set all the other devices IR's to being in bypass. Recording the all-ones BYPASS instruction
+	 * rather than invalidating them means an explicit write of BYPASS to one later is skipped too.
+	 */
+	for (size_t idx = 0; idx < jtag_dev_count; idx++)
+		jtag_devs[idx].current_ir = (1U << jtag_devs[idx].ir_len) - 1U;
 	device->current_ir = ir;
+	return true;
+}
 
-	/* Do the work to make the scanchain match the jtag_devs state */
-	jtagtap_shift_ir();
+/* Shift an instruction through Shift-IR, padding it with BYPASS for the rest of the chain, leaving in Exit1-IR */
+static void jtag_dev_shift_ir_bits(const jtag_dev_s *const device, const uint32_t ir)
+{
 	jtag_proc.jtagtap_tdi_seq(false, ones, device->ir_prescan);
 	jtag_proc.jtagtap_tdi_seq(!device->ir_postscan, (const uint8_t *)&ir, device->ir_len);
 	jtag_proc.jtagtap_tdi_seq(true, ones, device->ir_postscan);
-	jtagtap_return_idle(1);
 }
 
-void jtag_dev_shift_dr(const uint8_t dev_index, uint8_t *data_out, const uint8_t *data_in, const size_t clock_cycles)
+/* Shift data through Shift-DR, padding it for the bypass registers of the rest of the chain, leaving in Exit1-DR */
+static void jtag_dev_shift_dr_bits(
+	const jtag_dev_s *const device, uint8_t *const data_out, const uint8_t *const data_in, const size_t clock_cycles)
 {
-	jtag_dev_s *device = &jtag_devs[dev_index];
-	jtagtap_shift_dr();
 	jtag_proc.jtagtap_tdi_seq(false, ones, device->dr_prescan);
 	if (data_out)
-		jtag_proc.jtagtap_tdi_tdo_seq(
-			(uint8_t *)data_out, !device->dr_postscan, (const uint8_t *)data_in, clock_cycles);
+		jtag_proc.jtagtap_tdi_tdo_seq(data_out, !device->dr_postscan, data_in, clock_cycles);
 	else
-		jtag_proc.jtagtap_tdi_seq(!device->dr_postscan, (const uint8_t *)data_in, clock_cycles);
+		jtag_proc.jtagtap_tdi_seq(!device->dr_postscan, data_in, clock_cycles);
 	jtag_proc.jtagtap_tdi_seq(true, ones, device->dr_postscan);
+}
+
+void jtag_dev_write_ir(const uint8_t dev_index, const uint32_t ir)
+{
+	jtag_dev_s *device = &jtag_devs[dev_index];
+	if (!jtag_dev_select_ir(device, ir))
+		return;
+
+	/* Do the work to make the scanchain match the jtag_devs state */
+	jtagtap_shift_ir();
+	jtag_dev_shift_ir_bits(device, ir);
+	jtagtap_return_idle(1);
+}
+
+void jtag_dev_shift_dr(const uint8_t dev_index, uint8_t *data_out, const uint8_t *data_in, const size_t clock_cycles)
+{
+	jtag_dev_s *device = &jtag_devs[dev_index];
+	jtagtap_shift_dr();
+	jtag_dev_shift_dr_bits(device, data_out, data_in, clock_cycles);
+	jtagtap_return_idle(1);
+}
+
+static inline uint64_t jtag_ones(const size_t bits)
+{
+	return bits >= 64U ? UINT64_MAX : (UINT64_C(1) << bits) - 1U;
+}
+
+/*
+ * Load an instruction into a device's IR and shift data through its DR in one TAP traversal, going
+ * from Update-IR straight on to Select-DR-Scan rather than by way of Run-Test/Idle. If the
+ * instruction is already loaded, this is just jtag_dev_shift_dr().
+ */
+void jtag_dev_shift_ir_dr(const uint8_t dev_index, const uint32_t ir, uint8_t *const data_out,
+	const uint8_t *const data_in, const size_t clock_cycles)
+{
+	jtag_dev_s *device = &jtag_devs[dev_index];
+	if (!jtag_dev_select_ir(device, ir)) {
+		jtag_dev_shift_dr(dev_index, data_out, data_in, clock_cycles);
+		return;
+	}
+
+	const size_t ir_cycles = device->ir_prescan + device->ir_len + device->ir_postscan;
+	const size_t dr_cycles = device->dr_prescan + clock_cycles + device->dr_postscan;
+	/* If the adaptor can do the whole traversal in one go and both scans fit its limits, hand it over */
+	if (jtag_proc.jtagtap_ir_dr_seq && ir_cycles <= 64U && dr_cycles <= 64U) {
+		uint64_t ir_seq = jtag_ones(device->ir_prescan) | ((ir & jtag_ones(device->ir_len)) << device->ir_prescan);
+		if (device->ir_postscan)
+			ir_seq |= jtag_ones(device->ir_postscan) << (device->ir_prescan + device->ir_len);
+		uint64_t value = 0;
+		for (size_t idx = 0; idx < ((clock_cycles + 7U) >> 3U); ++idx)
+			value |= (uint64_t)data_in[idx] << (idx * 8U);
+		uint64_t dr_seq = jtag_ones(device->dr_prescan) | ((value & jtag_ones(clock_cycles)) << device->dr_prescan);
+		if (device->dr_postscan)
+			dr_seq |= jtag_ones(device->dr_postscan) << (device->dr_prescan + clock_cycles);
+
+		uint64_t response = 0;
+		jtag_proc.jtagtap_ir_dr_seq((const uint8_t *)&ir_seq, ir_cycles, data_out ? (uint8_t *)&response : NULL,
+			(const uint8_t *)&dr_seq, dr_cycles);
+		if (data_out) {
+			response = (response >> device->dr_prescan) & jtag_ones(clock_cycles);
+			for (size_t idx = 0; idx < ((clock_cycles + 7U) >> 3U); ++idx)
+				data_out[idx] = (uint8_t)(response >> (idx * 8U));
+		}
+		return;
+	}
+
+	jtagtap_shift_ir();
+	jtag_dev_shift_ir_bits(device, ir);
+	/* Exit1-IR -> Update-IR -> Select-DR-Scan -> Capture-DR -> Shift-DR */
+	jtag_proc.jtagtap_tms_seq(0x03U, 4U);
+	jtag_dev_shift_dr_bits(device, data_out, data_in, clock_cycles);
+	jtagtap_return_idle(1);
+}
+
+/*
+ * Load an instruction into every device on the chain in a single IR scan, ir holding one entry per
+ * device in chain order. Devices not taking part should be given their all-ones BYPASS instruction.
+ */
+void jtag_devs_write_ir(const uint32_t *const ir)
+{
+	bool unchanged = true;
+	for (size_t device = 0; device < jtag_dev_count; ++device)
+		unchanged &= jtag_devs[device].current_ir == ir[device];
+	if (unchanged)
+		return;
+
+	jtagtap_shift_ir();
+	for (size_t device = 0; device < jtag_dev_count; ++device) {
+		jtag_devs[device].current_ir = ir[device];
+		jtag_proc.jtagtap_tdi_seq(
+			device + 1U == jtag_dev_count, (const uint8_t *)&ir[device], jtag_devs[device].ir_len);
+	}
+	jtagtap_return_idle(1);
+}
+
+/*
+ * Shift the DRs of every device on the chain in a single DR scan. clock_cycles gives the length of
+ * each device's DR for its current instruction, with 0 marking a device in BYPASS, and data_in and
+ * data_out hold one entry per device in chain order.
+ */
+void jtag_devs_shift_dr(uint64_t *const data_out, const uint64_t *const data_in, const uint8_t *const clock_cycles)
+{
+	jtagtap_shift_dr();
+	for (size_t device = 0; device < jtag_dev_count; ++device) {
+		const bool final_tms = device + 1U == jtag_dev_count;
+		if (clock_cycles[device]) {
+			data_out[device] = 0;
+			jtag_proc.jtagtap_tdi_tdo_seq(
+				(uint8_t *)&data_out[device], final_tms, (const uint8_t *)&data_in[device], clock_cycles[device]);
+		} else
+			jtag_proc.jtagtap_tdi_seq(final_tms, ones, 1U);
+	}
 	jtagtap_return_idle(1);
 }
@@ -50,6 +50,9 @@ extern const uint8_t ones[8];
 
 void jtag_dev_write_ir(uint8_t jd_index, uint32_t ir);
 void jtag_dev_shift_dr(uint8_t jd_index, uint8_t *dout, const uint8_t *din, size_t ticks);
+void jtag_dev_shift_ir_dr(uint8_t jd_index, uint32_t ir, uint8_t *dout, const uint8_t *din, size_t ticks);
+void jtag_devs_write_ir(const uint32_t *ir);
+void jtag_devs_shift_dr(uint64_t *dout, const uint64_t *din, const uint8_t *ticks);
 void jtag_add_device(uint32_t dev_index, const jtag_dev_s *jtag_dev);
 
 #endif /* TARGET_JTAG_SCAN_H */
@@ -75,6 +75,8 @@
 #define FTFx_FSTAT_FPVIOL   (1U << 4U)
 #define FTFx_FSTAT_MGSTAT0  (1U << 0U)
 
+#define FTFx_FCNFG_RAMRDY (1U << 1U)
+
 #define FTFx_FSEC_KEYEN_MSK (0b11U << 6U)
 #define FTFx_FSEC_KEYEN     (0b10U << 6U)
 
@@ -85,12 +87,20 @@
 /* Part of the FTFE module for K64 */
 #define FTFx_CMD_PROGRAM_PHRASE  0x07U
 #define FTFx_CMD_ERASE_SECTOR    0x09U
+#define FTFx_CMD_PROGRAM_SECTION 0x0bU
 #define FTFx_CMD_CHECK_ERASE_ALL 0x40U
 #define FTFx_CMD_READ_ONCE       0x41U
 #define FTFx_CMD_PROGRAM_ONCE    0x43U
 #define FTFx_CMD_ERASE_ALL       0x44U
 #define FTFx_CMD_BACKDOOR_ACCESS 0x45U
 
+/*
+ * On parts with FlexNVM, FlexRAM not partitioned for EEPROM use can stage data for the Program Section
+ * command. Every such part has at least this much of it, and sectors are never smaller.
+ */
+#define KINETIS_FLEXRAM_BASE         0x14000000U
+#define KINETIS_PROGRAM_SECTION_SIZE 0x400U
+
 #define KL_WRITE_LEN 4U
 /* 8 byte phrases need to be written to the k64 flash */
 #define K64_WRITE_LEN 8U
@@ -406,17 +416,15 @@ static bool kinetis_fccob_cmd(target_s *t, uint8_t cmd, uint32_t addr, const uin
 		fstat = target_mem_read8(t, FTFx_FSTAT);
 	} while (!(fstat & FTFx_FSTAT_CCIF));
 
-	/* Write command to FCCOB */
-	addr &= 0x00ffffffU;
-	addr |= cmd << 24U;
-	target_mem_write32(t, FTFx_FCCOB0, addr);
+	/* Write command to FCCOB, all in one block write */
+	uint32_t fccob[3] = {(addr & 0x00ffffffU) | ((uint32_t)cmd << 24U)};
+	size_t fccob_len = sizeof(uint32_t);
 	if (data && n_items) {
-		target_mem_write32(t, FTFx_FCCOB4, data[0]);
-		if (n_items > 1)
-			target_mem_write32(t, FTFx_FCCOB8, data[1]);
-		else
-			target_mem_write32(t, FTFx_FCCOB8, 0);
+		fccob[1] = data[0];
+		fccob[2] = n_items > 1 ? data[1] : 0U;
+		fccob_len = sizeof(fccob);
 	}
+	target_mem_write(t, FTFx_FCCOB0, fccob, fccob_len);
 
 	/* Enable execution by clearing CCIF */
 	target_mem_write8(t, FTFx_FSTAT, FTFx_FSTAT_CCIF);
@@ -457,6 +465,26 @@ static bool kinetis_flash_cmd_write(target_flash_s *f, target_addr_t dest, const
 		((uint8_t *)src)[FLASH_SECURITY_BYTE_ADDRESS - dest] = FLASH_SECURITY_BYTE_UNSECURED;
 	}
 
+	/*
+	 * If FlexRAM is available as RAM, stage the data there and program it a section at a time, rather
+	 * than issuing a command for every longword or phrase
+	 */
+	if (target_mem_read8(f->t, FTFx_FCNFG) & FTFx_FCNFG_RAMRDY) {
+		const uint8_t *data = (const uint8_t *)src;
+		while (len) {
+			const size_t amount = MIN(len, KINETIS_PROGRAM_SECTION_SIZE);
+			target_mem_write(f->t, KINETIS_FLEXRAM_BASE, data, amount);
+			/* The section length goes in FCCOB4 and FCCOB5, in longwords or phrases as the part programs them */
+			const uint32_t count = (uint32_t)(amount / kf->write_len) << 16U;
+			if (!kinetis_fccob_cmd(f->t, FTFx_CMD_PROGRAM_SECTION, dest, &count, 1))
+				return false;
+			len -= amount;
+			dest += amount;
+			data += amount;
+		}
+		return true;
+	}
+
 	/* Determine write command based on the alignment. */
 	uint8_t write_cmd;
 	if (kf->write_len == K64_WRITE_LEN)
@@ -61,6 +61,7 @@
 #define LMI_FLASH_FMC_COMT   (1U << 3U)
 #define LMI_FLASH_FMC_WRKEY  0xa4420000U
 
+static bool lmi_flash_prepare(target_flash_s *f);
 static bool lmi_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool lmi_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 static bool lmi_mass_erase(target_s *t);
@@ -82,6 +83,7 @@ static void lmi_add_flash(target_s *t, size_t length)
 	f->start = 0;
 	f->length = length;
 	f->blocksize = 0x400;
+	f->prepare = lmi_flash_prepare;
 	f->erase = lmi_flash_erase;
 	f->write = lmi_flash_write;
 	f->erased = 0xff;
@@ -183,11 +185,18 @@ static bool lmi_flash_erase(target_flash_s *f, target_addr_t addr, const size_t
 	return true;
 }
 
+/* Upload the write stub once for the whole Flash session */
+static bool lmi_flash_prepare(target_flash_s *f)
+{
+	return target_flash_stub_load(f, SRAM_BASE, lmi_flash_write_stub, sizeof(lmi_flash_write_stub));
+}
+
 static bool lmi_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
 {
 	target_s *t = f->t;
 	target_check_error(t);
-	target_mem_write(t, SRAM_BASE, lmi_flash_write_stub, sizeof(lmi_flash_write_stub));
+	if (!target_flash_stub_load(f, SRAM_BASE, lmi_flash_write_stub, sizeof(lmi_flash_write_stub)))
+		return false;
 	target_mem_write(t, STUB_BUFFER_BASE, src, len);
 	if (target_check_error(t))
 		return false;
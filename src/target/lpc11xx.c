@@ -68,8 +68,9 @@ static void lpc11xx_add_flash(target_s *t, const uint32_t addr, const size_t len
 	lf->f.write = lpc_flash_write_magic_vect;
 	lf->iap_entry = iap_entry;
 	lf->iap_ram = IAP_RAM_BASE;
-	lf->iap_msp = IAP_RAM_BASE + MIN_RAM_SIZE - RAM_USAGE_FOR_IAP_ROUTINES;
+	lf->iap_msp = lpc_ram_end(t, IAP_RAM_BASE, MIN_RAM_SIZE) - RAM_USAGE_FOR_IAP_ROUTINES;
 	lf->reserved_pages = reserved_pages;
+	lpc_flash_register(t, lf);
 }
 
 static bool lpc11xx_detect(target_s *const t)
@@ -63,7 +63,8 @@ static void lpc15xx_add_flash(target_s *t, uint32_t addr, size_t len, size_t era
 	lf->f.write = lpc_flash_write_magic_vect;
 	lf->iap_entry = IAP_ENTRYPOINT;
 	lf->iap_ram = IAP_RAM_BASE;
-	lf->iap_msp = IAP_RAM_BASE + MIN_RAM_SIZE - RAM_USAGE_FOR_IAP_ROUTINES;
+	lf->iap_msp = lpc_ram_end(t, IAP_RAM_BASE, MIN_RAM_SIZE) - RAM_USAGE_FOR_IAP_ROUTINES;
+	lpc_flash_register(t, lf);
 }
 
 bool lpc15xx_probe(target_s *t)
@@ -82,7 +82,8 @@ static void lpc17xx_add_flash(target_s *target, uint32_t addr, size_t len, size_
 	flash->f.write = lpc_flash_write_magic_vect;
 	flash->iap_entry = IAP_ENTRYPOINT;
 	flash->iap_ram = IAP_RAM_BASE;
-	flash->iap_msp = IAP_RAM_BASE + MIN_RAM_SIZE - RAM_USAGE_FOR_IAP_ROUTINES;
+	flash->iap_msp = lpc_ram_end(target, IAP_RAM_BASE, MIN_RAM_SIZE) - RAM_USAGE_FOR_IAP_ROUTINES;
+	lpc_flash_register(target, flash);
 }
 
 bool lpc17xx_probe(target_s *target)
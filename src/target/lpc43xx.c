@@ -26,7 +26,7 @@
 #include "target_internal.h"
 #include "cortexm.h"
 #include "lpc_common.h"
-#include "sfdp.h"
+#include "spi.h"
 
 #define LPC43xx_CHIPID                0x40043200U
 #define LPC43xx_CHIPID_FAMILY_MASK    0x0fffffffU
@@ -214,33 +214,6 @@
 #define LPC43xx_GPIO_PORT0_SET (LPC43xx_GPIO_BASE + 0x2200U)
 #define LPC43xx_GPIO_PORT0_CLR (LPC43xx_GPIO_BASE + 0x2280U)
 
-#define SPI_FLASH_CMD_WRITE_ENABLE                                                              \
-	(LPC43x0_SPIFI_CMD_SERIAL | LPC43x0_SPIFI_FRAME_OPCODE_ONLY | LPC43x0_SPIFI_OPCODE(0x06U) | \
-		LPC43x0_SPIFI_INTER_LENGTH(0))
-#define SPI_FLASH_CMD_PAGE_PROGRAM                                                                \
-	(LPC43x0_SPIFI_CMD_SERIAL | LPC43x0_SPIFI_FRAME_OPCODE_3B_ADDR | LPC43x0_SPIFI_OPCODE(0x02) | \
-		LPC43x0_SPIFI_DATA_OUT | LPC43x0_SPIFI_INTER_LENGTH(0))
-#define SPI_FLASH_CMD_SECTOR_ERASE \
-	(LPC43x0_SPIFI_CMD_SERIAL | LPC43x0_SPIFI_FRAME_OPCODE_3B_ADDR | LPC43x0_SPIFI_INTER_LENGTH(0))
-#define SPI_FLASH_CMD_CHIP_ERASE                                                                \
-	(LPC43x0_SPIFI_CMD_SERIAL | LPC43x0_SPIFI_FRAME_OPCODE_ONLY | LPC43x0_SPIFI_OPCODE(0x60U) | \
-		LPC43x0_SPIFI_INTER_LENGTH(0))
-#define SPI_FLASH_CMD_READ_STATUS                                                               \
-	(LPC43x0_SPIFI_CMD_SERIAL | LPC43x0_SPIFI_FRAME_OPCODE_ONLY | LPC43x0_SPIFI_OPCODE(0x05U) | \
-		LPC43x0_SPIFI_DATA_IN | LPC43x0_SPIFI_INTER_LENGTH(0))
-#define SPI_FLASH_CMD_READ_JEDEC_ID                                                             \
-	(LPC43x0_SPIFI_CMD_SERIAL | LPC43x0_SPIFI_FRAME_OPCODE_ONLY | LPC43x0_SPIFI_OPCODE(0x9fU) | \
-		LPC43x0_SPIFI_DATA_IN | LPC43x0_SPIFI_INTER_LENGTH(0))
-#define SPI_FLASH_CMD_READ_SFDP                                                                    \
-	(LPC43x0_SPIFI_CMD_SERIAL | LPC43x0_SPIFI_FRAME_OPCODE_3B_ADDR | LPC43x0_SPIFI_OPCODE(0x5aU) | \
-		LPC43x0_SPIFI_DATA_IN | LPC43x0_SPIFI_INTER_LENGTH(1))
-#define SPI_FLASH_CMD_WAKE_UP                                                                   \
-	(LPC43x0_SPIFI_CMD_SERIAL | LPC43x0_SPIFI_FRAME_OPCODE_ONLY | LPC43x0_SPIFI_OPCODE(0xabU) | \
-		LPC43x0_SPIFI_INTER_LENGTH(0))
-
-#define SPI_FLASH_STATUS_BUSY          0x01U
-#define SPI_FLASH_STATUS_WRITE_ENABLED 0x02U
-
 typedef enum lpc43x0_flash_interface {
 	FLASH_NONE,
 	FLASH_SPIFI,
@@ -255,19 +228,13 @@ typedef struct lpc43xx_partid {
 	uint8_t flash_config;
 } lpc43xx_partid_s;
 
-typedef struct lpc43xx_spi_flash {
-	target_flash_s flash_low;
-	target_flash_s flash_high;
-	uint32_t page_size;
-	uint8_t sector_erase_opcode;
-} lpc43xx_spi_flash_s;
-
 typedef struct lpc43xx_priv {
 	uint8_t flash_banks;
 } lpc43xx_priv_s;
 
 typedef struct lpc43x0_priv {
-	lpc43xx_spi_flash_s *flash;
+	spi_flash_s *flash_low;
+	spi_flash_s *flash_high;
 	lpc43x0_flash_interface_e interface;
 	uint32_t boot_address;
 	uint32_t spifi_memory_command;
@@ -288,12 +255,11 @@ static void lpc43x0_detach(target_s *t);
 static bool lpc43x0_enter_flash_mode(target_s *t);
 static bool lpc43x0_exit_flash_mode(target_s *t);
 static void lpc43x0_spi_abort(target_s *t);
-static void lpc43x0_spi_read(target_s *t, uint32_t command, target_addr_t address, void *buffer, size_t length);
-static void lpc43x0_spi_write(target_s *t, uint32_t command, target_addr_t address, const void *buffer, size_t length);
-static void lpc43x0_spi_run_command(target_s *t, uint32_t command);
+static uint32_t lpc43x0_spifi_command(uint16_t command, size_t length);
+static void lpc43x0_spi_read(target_s *t, uint16_t command, target_addr_t address, void *buffer, size_t length);
+static void lpc43x0_spi_write(target_s *t, uint16_t command, target_addr_t address, const void *buffer, size_t length);
+static void lpc43x0_spi_run_command(target_s *t, uint16_t command, target_addr_t address);
 static bool lpc43x0_spi_mass_erase(target_s *t);
-static bool lpc43x0_spi_flash_erase(target_flash_s *f, target_addr_t addr, size_t length);
-static bool lpc43x0_spi_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t length);
 
 static bool lpc43xx_iap_init(target_flash_s *flash);
 static lpc43xx_partid_s lpc43xx_iap_read_partid(target_s *t);
@@ -322,6 +288,7 @@ static void lpc43xx_add_iap_flash(
 	lf->iap_ram = IAP_RAM_BASE;
 	lf->iap_msp = IAP_RAM_BASE + IAP_RAM_SIZE;
 	lf->wdt_kick = lpc43xx_wdt_kick;
+	lpc_flash_register(t, lf);
 }
 
 static void lpc43xx_detect(target_s *const t, const lpc43xx_partid_s part_id)
@@ -403,56 +370,18 @@ static void lpc43xx_detect(target_s *const t, const lpc43xx_partid_s part_id)
 	target_add_commands(t, lpc43xx_cmd_list, "LPC43xx");
 }
 
-static void lpc43x0_spi_read_sfdp(target_s *const t, const uint32_t address, void *const buffer, const size_t length)
-{
-	lpc43x0_spi_read(t, SPI_FLASH_CMD_READ_SFDP, address, buffer, length);
-}
-
 static void lpc43x0_add_spi_flash(target_s *const t, const size_t length)
 {
-	lpc43xx_spi_flash_s *const flash = calloc(1, sizeof(*flash));
-	if (!flash) {
-		DEBUG_WARN("calloc: failed in %s\n", __func__);
-		return;
-	}
 	lpc43x0_priv_s *const priv = (lpc43x0_priv_s *)t->target_storage;
-	priv->flash = flash;
-
-	spi_parameters_s spi_parameters;
-	if (!sfdp_read_parameters(t, &spi_parameters, lpc43x0_spi_read_sfdp)) {
-		/* SFDP readout failed, so make some assumptions and hope for the best. */
-		spi_parameters.page_size = 256U;
-		spi_parameters.sector_size = 4096U;
-		spi_parameters.capacity = length;
-		spi_parameters.sector_erase_opcode = 0x20U;
-	}
-
-	/* Add the high region first so it appears second in the map */
-	target_flash_s *const flash_high = &flash->flash_high;
-	flash_high->start = LPC43x0_SPI_FLASH_HIGH_BASE;
-	flash_high->length = MIN(spi_parameters.capacity, LPC43x0_SPI_FLASH_HIGH_SIZE);
-	flash_high->blocksize = spi_parameters.sector_size;
-	flash_high->write = lpc43x0_spi_flash_write;
-	flash_high->erase = lpc43x0_spi_flash_erase;
-	flash_high->erased = 0xffU;
-	target_add_flash(t, flash_high);
-
 	/*
-	 * Then add the low region - the reason for this is that
-	 * target_add_flash inserts new entries to the beginning of the
-	 * Flash linked-list in the target structure, so this becomes t->flash.
+	 * Add the high region first so it appears second in the map - the reason for this is that
+	 * target_add_flash inserts new entries to the beginning of the Flash linked-list in the
+	 * target structure, so the low region becomes t->flash.
 	 */
-	target_flash_s *const flash_low = &flash->flash_low;
-	flash_low->start = LPC43x0_SPI_FLASH_LOW_BASE;
-	flash_low->length = MIN(spi_parameters.capacity, LPC43x0_SPI_FLASH_LOW_SIZE);
-	flash_low->blocksize = spi_parameters.sector_size;
-	flash_low->write = lpc43x0_spi_flash_write;
-	flash_low->erase = lpc43x0_spi_flash_erase;
-	flash_low->erased = 0xffU;
-	target_add_flash(t, flash_low);
-
-	flash->page_size = spi_parameters.page_size;
-	flash->sector_erase_opcode = spi_parameters.sector_erase_opcode;
+	priv->flash_high = bmp_spi_add_flash(t, LPC43x0_SPI_FLASH_HIGH_BASE, MIN(length, LPC43x0_SPI_FLASH_HIGH_SIZE),
+		lpc43x0_spi_read, lpc43x0_spi_write, lpc43x0_spi_run_command);
+	priv->flash_low = bmp_spi_add_flash(t, LPC43x0_SPI_FLASH_LOW_BASE, MIN(length, LPC43x0_SPI_FLASH_LOW_SIZE),
+		lpc43x0_spi_read, lpc43x0_spi_write, lpc43x0_spi_run_command);
 }
 
 static void lpc43x0_detect(target_s *const t, const lpc43xx_partid_s part_id)
@@ -703,8 +632,10 @@ static bool lpc43x0_attach(target_s *const t)
 static void lpc43x0_detach(target_s *const t)
 {
 	lpc43x0_priv_s *const priv = (lpc43x0_priv_s *)t->target_storage;
-	free(priv->flash);
-	priv->flash = NULL;
+	free(priv->flash_low);
+	free(priv->flash_high);
+	priv->flash_low = NULL;
+	priv->flash_high = NULL;
 	t->flash = NULL;
 	cortexm_detach(t);
 }
@@ -783,6 +714,12 @@ static bool lpc43x0_exit_flash_mode(target_s *const t)
 	/* First restore any disturbed configuration */
 	switch (priv->interface) {
 	case FLASH_SPIFI:
+		/*
+		 * If the firmware never put the SPIFI into memory mode, do so with a fast read so the Flash
+		 * windows can be read back (verify, CRC) with block reads rather than a command per chunk
+		 */
+		if (!(priv->spifi_memory_command & LPC43x0_SPIFI_FRAME_MASK) && priv->flash_low)
+			priv->spifi_memory_command = lpc43x0_spifi_command(priv->flash_low->read_command, 0U);
 		target_mem_write32(t, LPC43x0_SPIFI_MCMD, priv->spifi_memory_command);
 		break;
 	default:
@@ -833,7 +770,7 @@ static void lpc43x0_spi_abort(target_s *const t)
 			target_mem_read32(t, LPC43x0_SSP0_DR);
 		target_mem_write32(t, LPC43xx_GPIO_PORT0_CLR, 1U << 6U);
 	}
-	lpc43x0_spi_run_command(t, SPI_FLASH_CMD_WAKE_UP);
+	lpc43x0_spi_run_command(t, SPI_FLASH_CMD_WAKE_UP, 0U);
 }
 
 static inline void lpc43x0_spi_wait_complete(target_s *const t)
@@ -851,30 +788,52 @@ static uint8_t lpc43x0_ssp0_transfer(target_s *const t, const uint8_t value)
 	return target_mem_read32(t, LPC43x0_SSP0_DR) & 0xffU;
 }
 
-static void lpc43x0_ssp0_setup_command(target_s *const t, const uint32_t command, const target_addr_t address)
+static void lpc43x0_ssp0_setup_command(target_s *const t, const uint16_t command, const target_addr_t address)
 {
 	/* Start by sending the command opcode byte */
-	lpc43x0_ssp0_transfer(t, (command >> 24U) & 0xffU);
+	lpc43x0_ssp0_transfer(t, command & SPI_FLASH_OPCODE_MASK);
 	/* Next, if the command has an address, deal with that */
-	const uint8_t address_bytes = ((command & LPC43x0_SPIFI_FRAME_MASK) >> 21U) - 1U;
+	const size_t address_bytes = spi_flash_address_bytes(command);
 	for (size_t i = 0; i < address_bytes; ++i) {
 		const size_t shift = (address_bytes - (i + 1U)) * 8U;
 		lpc43x0_ssp0_transfer(t, (address >> shift) & 0xffU);
 	}
 	/* Now deal with any inter-frame bytes */
-	const uint8_t inter_bytes = (command >> 16) & 7U;
+	const uint8_t inter_bytes = (command & SPI_FLASH_DUMMY_MASK) >> SPI_FLASH_DUMMY_SHIFT;
 	for (size_t i = 0; i < inter_bytes; ++i)
 		lpc43x0_ssp0_transfer(t, 0U);
 }
 
+/* Translate a generic SPI Flash command into its SPIFI CMD register form */
+static uint32_t lpc43x0_spifi_command(const uint16_t command, const size_t length)
+{
+	uint32_t result = LPC43x0_SPIFI_CMD_SERIAL | LPC43x0_SPIFI_OPCODE(command & SPI_FLASH_OPCODE_MASK) |
+		LPC43x0_SPIFI_INTER_LENGTH((command & SPI_FLASH_DUMMY_MASK) >> SPI_FLASH_DUMMY_SHIFT) |
+		LPC43x0_SPIFI_DATA_LENGTH(length);
+	switch (spi_flash_address_bytes(command)) {
+	case 3U:
+		result |= LPC43x0_SPIFI_FRAME_OPCODE_3B_ADDR;
+		break;
+	case 4U:
+		result |= LPC43x0_SPIFI_FRAME_OPCODE_4B_ADDR;
+		break;
+	default:
+		result |= LPC43x0_SPIFI_FRAME_OPCODE_ONLY;
+		break;
+	}
+	if ((command & SPI_FLASH_DATA_MASK) == SPI_FLASH_DATA_OUT)
+		result |= LPC43x0_SPIFI_DATA_OUT;
+	return result;
+}
+
 static void lpc43x0_spi_read(
-	target_s *const t, const uint32_t command, const target_addr_t address, void *const buffer, const size_t length)
+	target_s *const t, const uint16_t command, const target_addr_t address, void *const buffer, const size_t length)
 {
 	lpc43x0_priv_s *const priv = (lpc43x0_priv_s *)t->target_storage;
 	if (priv->interface == FLASH_SPIFI) {
-		if ((command & LPC43x0_SPIFI_FRAME_MASK) != LPC43x0_SPIFI_FRAME_OPCODE_ONLY)
+		if (spi_flash_address_bytes(command))
 			target_mem_write32(t, LPC43x0_SPIFI_ADDR, address);
-		target_mem_write32(t, LPC43x0_SPIFI_CMD, command | LPC43x0_SPIFI_DATA_LENGTH(length));
+		target_mem_write32(t, LPC43x0_SPIFI_CMD, lpc43x0_spifi_command(command, length));
 		uint8_t *const data = (uint8_t *)buffer;
 		for (size_t i = 0; i < length; ++i)
 			data[i] = target_mem_read8(t, LPC43x0_SPIFI_DATA);
@@ -893,14 +852,14 @@ static void lpc43x0_spi_read(
 		memset(buffer, 0xffU, length);
 }
 
-static void lpc43x0_spi_write(target_s *const t, const uint32_t command, const target_addr_t address,
+static void lpc43x0_spi_write(target_s *const t, const uint16_t command, const target_addr_t address,
 	const void *const buffer, const size_t length)
 {
 	lpc43x0_priv_s *const priv = (lpc43x0_priv_s *)t->target_storage;
 	if (priv->interface == FLASH_SPIFI) {
-		if ((command & LPC43x0_SPIFI_FRAME_MASK) != LPC43x0_SPIFI_FRAME_OPCODE_ONLY)
+		if (spi_flash_address_bytes(command))
 			target_mem_write32(t, LPC43x0_SPIFI_ADDR, address);
-		target_mem_write32(t, LPC43x0_SPIFI_CMD, command | LPC43x0_SPIFI_DATA_LENGTH(length));
+		target_mem_write32(t, LPC43x0_SPIFI_CMD, lpc43x0_spifi_command(command, length));
 		const uint8_t *const data = (const uint8_t *)buffer;
 		for (size_t i = 0; i < length; ++i)
 			target_mem_write8(t, LPC43x0_SPIFI_DATA, data[i]);
@@ -918,76 +877,26 @@ static void lpc43x0_spi_write(target_s *const t, const uint32_t command, const t
 	}
 }
 
-static inline uint8_t lpc43x0_spi_read_status(target_s *const t)
-{
-	uint8_t status = 0;
-	lpc43x0_spi_read(t, SPI_FLASH_CMD_READ_STATUS, 0, &status, sizeof(status));
-	return status;
-}
-
-static void lpc43x0_spi_run_command(target_s *const t, const uint32_t command)
+static void lpc43x0_spi_run_command(target_s *const t, const uint16_t command, const target_addr_t address)
 {
 	lpc43x0_priv_s *const priv = (lpc43x0_priv_s *)t->target_storage;
 	if (priv->interface == FLASH_SPIFI) {
-		target_mem_write32(t, LPC43x0_SPIFI_CMD, command);
+		if (spi_flash_address_bytes(command))
+			target_mem_write32(t, LPC43x0_SPIFI_ADDR, address);
+		target_mem_write32(t, LPC43x0_SPIFI_CMD, lpc43x0_spifi_command(command, 0U));
 		lpc43x0_spi_wait_complete(t);
 	} else if (priv->interface == FLASH_SPI)
-		lpc43x0_spi_write(t, command, 0U, NULL, 0U);
+		lpc43x0_spi_write(t, command, address, NULL, 0U);
 }
 
 static bool lpc43x0_spi_mass_erase(target_s *const t)
 {
-	platform_timeout_s timeout;
-	platform_timeout_set(&timeout, 500);
-	lpc43x0_enter_flash_mode(t);
-	lpc43x0_spi_run_command(t, SPI_FLASH_CMD_WRITE_ENABLE);
-	if (!(lpc43x0_spi_read_status(t) & SPI_FLASH_STATUS_WRITE_ENABLED)) {
-		lpc43x0_exit_flash_mode(t);
+	const lpc43x0_priv_s *const priv = (lpc43x0_priv_s *)t->target_storage;
+	if (!priv->flash_low)
 		return false;
-	}
-
-	lpc43x0_spi_run_command(t, SPI_FLASH_CMD_CHIP_ERASE);
-	while (lpc43x0_spi_read_status(t) & SPI_FLASH_STATUS_BUSY)
-		target_print_progress(&timeout);
-
-	return lpc43x0_exit_flash_mode(t);
-}
-
-static bool lpc43x0_spi_flash_erase(target_flash_s *f, target_addr_t addr, size_t length)
-{
-	target_s *const t = f->t;
-	const lpc43xx_spi_flash_s *const flash = (lpc43xx_spi_flash_s *)t->flash;
-	const target_addr_t begin = addr - f->start;
-	for (size_t offset = 0; offset < length; offset += f->blocksize) {
-		lpc43x0_spi_run_command(t, SPI_FLASH_CMD_WRITE_ENABLE);
-		if (!(lpc43x0_spi_read_status(t) & SPI_FLASH_STATUS_WRITE_ENABLED))
-			return false;
-
-		lpc43x0_spi_write(
-			t, SPI_FLASH_CMD_SECTOR_ERASE | LPC43x0_SPIFI_OPCODE(flash->sector_erase_opcode), begin + offset, NULL, 0);
-		while (lpc43x0_spi_read_status(t) & SPI_FLASH_STATUS_BUSY)
-			continue;
-	}
-	return true;
-}
-
-static bool lpc43x0_spi_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t length)
-{
-	target_s *const t = f->t;
-	const lpc43xx_spi_flash_s *const flash = (lpc43xx_spi_flash_s *)t->flash;
-	const target_addr_t begin = dest - f->start;
-	const char *buffer = src;
-	for (size_t offset = 0; offset < length; offset += flash->page_size) {
-		lpc43x0_spi_run_command(t, SPI_FLASH_CMD_WRITE_ENABLE);
-		if (!(lpc43x0_spi_read_status(t) & SPI_FLASH_STATUS_WRITE_ENABLED))
-			return false;
-
-		const size_t amount = MIN(length - offset, flash->page_size);
-		lpc43x0_spi_write(t, SPI_FLASH_CMD_PAGE_PROGRAM, begin + offset, buffer + offset, amount);
-		while (lpc43x0_spi_read_status(t) & SPI_FLASH_STATUS_BUSY)
-			continue;
-	}
-	return true;
+	lpc43x0_enter_flash_mode(t);
+	const bool result = bmp_spi_mass_erase(priv->flash_low);
+	return lpc43x0_exit_flash_mode(t) && result;
 }
 
 /* LPC43xx IAP On-board Flash part routines */
@@ -1013,7 +922,7 @@ static bool lpc43xx_iap_init(target_flash_s *const flash)
 static lpc43xx_partid_s lpc43xx_iap_read_partid(target_s *const t)
 {
 	/* Define a fake Flash structure so we can invoke the IAP system */
-	lpc_flash_s flash;
+	lpc_flash_s flash = {0};
 	flash.f.t = t;
 	flash.wdt_kick = lpc43xx_wdt_kick;
 	flash.iap_entry = target_mem_read32(t, IAP_ENTRYPOINT_LOCATION);
@@ -94,6 +94,7 @@ static void lpc546xx_add_flash(
 	lf->iap_ram = IAP_RAM_BASE;
 	lf->iap_msp = IAP_RAM_BASE + IAP_RAM_SIZE;
 	lf->wdt_kick = lpc546xx_wdt_kick;
+	lpc_flash_register(t, lf);
 }
 
 bool lpc546xx_probe(target_s *t)
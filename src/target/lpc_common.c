@@ -25,14 +25,68 @@
 
 #include <stdarg.h>
 
-typedef struct flash_param {
-	uint16_t opcode;
-	uint16_t pad0;
+/* An IAP command table immediately followed by its result table, as handed to the IAP entry point */
+typedef struct lpc_iap_cmd {
 	uint32_t command;
-	uint32_t words[4];
+	uint32_t params[4];
 	uint32_t status;
 	uint32_t result[4];
-} __attribute__((aligned(4))) flash_param_s;
+} lpc_iap_cmd_s;
+
+/* Most commands in a single run of the trampoline, enough for an erase with its PREPARE and BLANKCHECK */
+#define LPC_IAP_MAX_BATCH 5U
+
+/*
+ * IAP commands are run from a small trampoline placed at the start of IAP RAM which calls the IAP entry
+ * point for each command block in turn, stopping at the first that fails, so a sequence such as PREPARE
+ * then PROGRAM costs one resume and halt rather than one per command. It sticks to Thumb-1 instructions
+ * so it also runs on the Cortex-M0 parts:
+ *
+ *          @ r4 = first command block, r5 = number of blocks, r6 = IAP entry point
+ *   loop:  mov  r0, r4        @ command table
+ *          mov  r1, r4
+ *          adds r1, #20       @ result table
+ *          blx  r6
+ *          ldr  r0, [r4, #20] @ status
+ *          cmp  r0, #0
+ *          bne  done
+ *          adds r4, #40       @ next command block
+ *          subs r5, #1
+ *          bne  loop
+ *   done:  bkpt #0
+ */
+static const uint16_t lpc_iap_trampoline[12] = {
+	0x4620U,
+	0x4621U,
+	0x3114U,
+	0x47b0U,
+	0x6960U,
+	0x2800U,
+	0xd102U,
+	0x3428U,
+	0x3d01U,
+	0xd1f5U,
+	ARM_THUMB_BREAKPOINT,
+	ARM_THUMB_BREAKPOINT,
+};
+
+typedef struct lpc_iap_work {
+	uint16_t trampoline[12];
+	lpc_iap_cmd_s cmds[LPC_IAP_MAX_BATCH];
+} lpc_iap_work_s;
+
+struct lpc_iap_backup {
+	lpc_iap_work_s work;
+	uint32_t regs[];
+};
+
+/* Write staging buffers start just after the IAP work area */
+#define LPC_IAP_BUFFER_OFFSET ALIGN(sizeof(lpc_iap_work_s), 4U)
+/* Stack the IAP routines may use below iap_msp, which must stay clear of the staging buffers */
+#define LPC_IAP_STACK_SIZE 128U
+
+/* The amounts of data the IAP PROGRAM command will take, largest first */
+static const uint16_t lpc_iap_program_sizes[] = {4096U, 1024U, 512U, 256U};
 
 #if defined(ENABLE_DEBUG)
 static const char *const iap_error[] = {
@@ -73,7 +127,11 @@ static const char *const iap_error[] = {
 };
 #endif
 
+static bool lpc_flash_prepare(target_flash_s *tf);
 static bool lpc_flash_write(target_flash_s *tf, target_addr_t dest, const void *src, size_t len);
+static bool lpc_flash_done(target_flash_s *tf);
+static bool lpc_iap_complete(lpc_flash_s *f);
+static bool lpc_flash_blank_check(target_flash_s *tf, target_addr_t addr, size_t len);
 
 lpc_flash_s *lpc_add_flash(target_s *t, target_addr_t addr, size_t length)
 {
@@ -88,13 +146,56 @@ lpc_flash_s *lpc_add_flash(target_s *t, target_addr_t addr, size_t length)
 	f = &lf->f;
 	f->start = addr;
 	f->length = length;
+	f->prepare = lpc_flash_prepare;
 	f->erase = lpc_flash_erase;
 	f->write = lpc_flash_write;
+	f->done = lpc_flash_done;
+	f->blank_check = lpc_flash_blank_check;
 	f->erased = 0xff;
-	target_add_flash(t, f);
+	f->t = t;
+	lf->iap_buffers = 1U;
 	return lf;
 }
 
+/*
+ * Size the write staging buffers from the RAM actually available between the IAP work area and the
+ * IAP stack, then register the Flash with the target. The IAP PROGRAM command takes 256, 512, 1024
+ * or 4096 bytes at a time and no more than a sector, so pick the largest of those of which two fit,
+ * letting the probe upload one while the IAP programs the other. If that would be smaller than the
+ * driver's own write size, which is chosen to fit on the smallest part, keep that single buffered.
+ */
+void lpc_flash_register(target_s *const t, lpc_flash_s *const lf)
+{
+	const uint32_t buffers_start = lf->iap_ram + LPC_IAP_BUFFER_OFFSET;
+	const uint32_t buffers_end = lf->iap_msp - LPC_IAP_STACK_SIZE;
+	const uint32_t space = buffers_end > buffers_start ? buffers_end - buffers_start : 0U;
+
+	for (size_t i = 0; i < ARRAY_LENGTH(lpc_iap_program_sizes); ++i) {
+		const size_t writesize = lpc_iap_program_sizes[i];
+		if (writesize <= lf->f.writesize)
+			break;
+		if (writesize <= lf->f.blocksize && writesize * 2U <= space) {
+			lf->f.writesize = writesize;
+			break;
+		}
+	}
+	lf->iap_buffers = lf->f.writesize * 2U <= space ? 2U : 1U;
+	target_add_flash(t, &lf->f);
+}
+
+/*
+ * Find the end of the RAM region starting at addr, for IAP routines that live at the top of it,
+ * falling back on the smallest size the part family comes in if it is not in the map.
+ */
+uint32_t lpc_ram_end(target_s *const t, const target_addr_t addr, const size_t min_length)
+{
+	for (const target_ram_s *ram = t->ram; ram; ram = ram->next) {
+		if (ram->start == addr && ram->length > min_length)
+			return addr + ram->length;
+	}
+	return addr + min_length;
+}
+
 static uint8_t lpc_sector_for_addr(lpc_flash_s *f, uint32_t addr)
 {
 	return f->base_sector + (addr - f->f.start) / f->f.blocksize;
@@ -107,79 +208,181 @@ static inline bool lpc_is_full_erase(lpc_flash_s *f, const uint32_t begin, const
 	return begin == lpc_sector_for_addr(f, addr) && end == lpc_sector_for_addr(f, addr + len - 1U);
 }
 
-iap_status_e lpc_iap_call(lpc_flash_s *f, void *result, iap_cmd_e cmd, ...)
+static bool lpc_flash_prepare(target_flash_s *const tf)
 {
-	target_s *t = f->f.t;
-	flash_param_s param = {
-		.opcode = ARM_THUMB_BREAKPOINT,
-		.command = cmd,
-		.status = 0xdeadbeef, // To help us see if the IAP didn't execute
-	};
+	lpc_flash_s *const f = (lpc_flash_s *)tf;
+	target_s *const t = tf->t;
+	/* Save IAP RAM and the registers once for the whole session rather than around every IAP call */
+	f->iap_backup = malloc(sizeof(*f->iap_backup) + t->regs_size);
+	if (!f->iap_backup) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	target_mem_read(t, &f->iap_backup->work, f->iap_ram, sizeof(f->iap_backup->work));
+	target_regs_read(t, f->iap_backup->regs);
+	return true;
+}
 
-	/* Pet WDT before each IAP call, if it is on */
-	if (f->wdt_kick)
-		f->wdt_kick(t);
+static bool lpc_flash_done(target_flash_s *const tf)
+{
+	lpc_flash_s *const f = (lpc_flash_s *)tf;
+	target_s *const t = tf->t;
+	if (!f->iap_backup)
+		return true;
+	/* Pick up the result of the last write before putting things back */
+	const bool result = lpc_iap_complete(f);
+	/* Restore the original data in RAM and registers */
+	target_mem_write(t, f->iap_ram, &f->iap_backup->work, sizeof(f->iap_backup->work));
+	target_regs_write(t, f->iap_backup->regs);
+	free(f->iap_backup);
+	f->iap_backup = NULL;
+	return result;
+}
 
-	/* Save IAP RAM to restore after IAP call */
-	flash_param_s backup_param;
-	target_mem_read(t, &backup_param, f->iap_ram, sizeof(backup_param));
+static void lpc_iap_report(const lpc_iap_cmd_s *const cmd)
+{
+#if defined(ENABLE_DEBUG)
+	if (cmd->status > (sizeof(iap_error) / sizeof(char *)))
+		DEBUG_WARN("IAP cmd %" PRIu32 " : %" PRIu32 "\n", cmd->command, cmd->status);
+	else
+		DEBUG_WARN("IAP cmd %" PRIu32 " : %s\n", cmd->command, iap_error[cmd->status]);
+	DEBUG_WARN("return parameters: %08" PRIx32 " %08" PRIx32 " %08" PRIx32 " %08" PRIx32 "\n", cmd->result[0],
+		cmd->result[1], cmd->result[2], cmd->result[3]);
+#else
+	(void)cmd;
+#endif
+}
 
-	/* save registers to restore after IAP call */
-	uint32_t backup_regs[t->regs_size / sizeof(uint32_t)];
-	target_regs_read(t, backup_regs);
+/* Copy the trampoline and commands to IAP RAM, point the core at it and set it running */
+static void lpc_iap_start(lpc_flash_s *const f, const lpc_iap_cmd_s *const cmds, const size_t count,
+	const uint32_t *const base_regs)
+{
+	target_s *const t = f->f.t;
+	lpc_iap_work_s work;
 
-	/* Fill out the remainder of the parameters */
-	va_list ap;
-	va_start(ap, cmd);
-	for (size_t i = 0; i < 4U; ++i)
-		param.words[i] = va_arg(ap, uint32_t);
-	va_end(ap);
+	/* Pet WDT before each IAP run, if it is on */
+	if (f->wdt_kick)
+		f->wdt_kick(t);
 
-	/* Copy the structure to RAM */
-	target_mem_write(t, f->iap_ram, &param, sizeof(param));
+	memcpy(work.trampoline, lpc_iap_trampoline, sizeof(work.trampoline));
+	for (size_t i = 0; i < count; ++i) {
+		work.cmds[i] = cmds[i];
+		work.cmds[i].status = 0xdeadbeefU; // To help us see if the IAP didn't execute
+	}
+	target_mem_write(t, f->iap_ram, &work, offsetof(lpc_iap_work_s, cmds) + count * sizeof(lpc_iap_cmd_s));
 
-	/* Set up for the call to the IAP ROM */
+	/* Set up for the trampoline to call the IAP ROM */
 	uint32_t regs[t->regs_size / sizeof(uint32_t)];
-	target_regs_read(t, regs);
-	regs[0] = f->iap_ram + offsetof(flash_param_s, command);
-	regs[1] = f->iap_ram + offsetof(flash_param_s, status);
+	memcpy(regs, base_regs, t->regs_size);
+	regs[4] = f->iap_ram + offsetof(lpc_iap_work_s, cmds);
+	regs[5] = count;
+	regs[6] = f->iap_entry | 1U;
 	regs[REG_MSP] = f->iap_msp;
-	regs[REG_LR] = f->iap_ram | 1U;
-	regs[REG_PC] = f->iap_entry;
+	regs[REG_PC] = f->iap_ram;
 	target_regs_write(t, regs);
 
+	/* Start the target, it halts again on the trampoline's breakpoint */
+	target_halt_resume(t, false);
+}
+
+/*
+ * Wait for a run started by lpc_iap_start() to halt, then fill in each command's status and results.
+ * Returns the status of the first command that did not succeed, or IAP_STATUS_CMD_SUCCESS.
+ */
+static iap_status_e lpc_iap_finish(lpc_flash_s *const f, lpc_iap_cmd_s *const cmds, const size_t count)
+{
+	target_s *const t = f->f.t;
+
+	bool full_erase = false;
+	for (size_t i = 0; i < count; ++i) {
+		if (cmds[i].command == IAP_CMD_ERASE && lpc_is_full_erase(f, cmds[i].params[0], cmds[i].params[1]))
+			full_erase = true;
+	}
+
 	platform_timeout_s timeout;
 	platform_timeout_set(&timeout, 500);
-	const bool full_erase = cmd == IAP_CMD_ERASE && lpc_is_full_erase(f, param.words[0], param.words[1]);
-	/* Start the target and wait for it to halt again */
-	target_halt_resume(t, false);
 	while (!target_halt_poll(t, NULL)) {
 		if (full_erase)
 			target_print_progress(&timeout);
 	}
 
-	/* Copy back just the parameters structure */
-	target_mem_read(t, &param, f->iap_ram, sizeof(param));
+	/* Copy back just the commands */
+	lpc_iap_cmd_s results[LPC_IAP_MAX_BATCH];
+	target_mem_read(t, results, f->iap_ram + offsetof(lpc_iap_work_s, cmds), count * sizeof(lpc_iap_cmd_s));
+
+	for (size_t i = 0; i < count; ++i) {
+		cmds[i].status = results[i].status;
+		memcpy(cmds[i].result, results[i].result, sizeof(cmds[i].result));
+		if (cmds[i].status != IAP_STATUS_CMD_SUCCESS) {
+			lpc_iap_report(&cmds[i]);
+			return cmds[i].status;
+		}
+	}
+	return IAP_STATUS_CMD_SUCCESS;
+}
+
+/* Wait for any write left running on the target by lpc_flash_write() and check how it went */
+static bool lpc_iap_complete(lpc_flash_s *const f)
+{
+	if (!f->iap_pending)
+		return true;
+	lpc_iap_cmd_s cmds[LPC_IAP_MAX_BATCH];
+	const size_t count = f->iap_pending;
+	/* Only the command codes matter to lpc_iap_finish(), and writes never contain an erase */
+	for (size_t i = 0; i < count; ++i)
+		cmds[i].command = IAP_CMD_PROGRAM;
+	f->iap_pending = 0U;
+	return lpc_iap_finish(f, cmds, count) == IAP_STATUS_CMD_SUCCESS;
+}
+
+/*
+ * Run a sequence of IAP commands back-to-back on the target, filling in each one's status and results.
+ * Returns the status of the first command that did not succeed, or IAP_STATUS_CMD_SUCCESS.
+ */
+static iap_status_e lpc_iap_run(lpc_flash_s *const f, lpc_iap_cmd_s *const cmds, const size_t count)
+{
+	target_s *const t = f->f.t;
+	if (!lpc_iap_complete(f))
+		return IAP_STATUS_BUSY;
+
+	/* Inside a Flash session the backup was taken in lpc_flash_prepare(), otherwise take one just for this run */
+	if (f->iap_backup) {
+		lpc_iap_start(f, cmds, count, f->iap_backup->regs);
+		return lpc_iap_finish(f, cmds, count);
+	}
+
+	const size_t work_len = offsetof(lpc_iap_work_s, cmds) + count * sizeof(lpc_iap_cmd_s);
+	lpc_iap_work_s backup_work;
+	uint32_t backup_regs[t->regs_size / sizeof(uint32_t)];
+	target_mem_read(t, &backup_work, f->iap_ram, work_len);
+	target_regs_read(t, backup_regs);
+
+	lpc_iap_start(f, cmds, count, backup_regs);
+	const iap_status_e status = lpc_iap_finish(f, cmds, count);
 
 	/* Restore the original data in RAM and registers */
-	target_mem_write(t, f->iap_ram, &backup_param, sizeof(param));
+	target_mem_write(t, f->iap_ram, &backup_work, work_len);
 	target_regs_write(t, backup_regs);
+	return status;
+}
+
+iap_status_e lpc_iap_call(lpc_flash_s *f, void *result, iap_cmd_e cmd, ...)
+{
+	lpc_iap_cmd_s iap_cmd = {.command = cmd};
+
+	/* Fill out the remainder of the parameters */
+	va_list ap;
+	va_start(ap, cmd);
+	for (size_t i = 0; i < 4U; ++i)
+		iap_cmd.params[i] = va_arg(ap, uint32_t);
+	va_end(ap);
+
+	const iap_status_e status = lpc_iap_run(f, &iap_cmd, 1U);
 
 	/* If the user expected a result, set the result (16 bytes). */
 	if (result != NULL)
-		memcpy(result, param.result, sizeof(param.result));
-
-#if defined(ENABLE_DEBUG)
-	if (param.status != IAP_STATUS_CMD_SUCCESS) {
-		if (param.status > (sizeof(iap_error) / sizeof(char *)))
-			DEBUG_WARN("IAP cmd %d : %" PRIu32 "\n", cmd, param.status);
-		else
-			DEBUG_WARN("IAP cmd %d : %s\n", cmd, iap_error[param.status]);
-		DEBUG_WARN("return parameters: %08" PRIx32 " %08" PRIx32 " %08" PRIx32 " %08" PRIx32 "\n", param.result[0],
-			param.result[1], param.result[2], param.result[3]);
-	}
-#endif
-	return param.status;
+		memcpy(result, iap_cmd.result, sizeof(iap_cmd.result));
+	return status;
 }
 
 #define LPX80X_SECTOR_SIZE 0x400U
@@ -192,70 +395,104 @@ bool lpc_flash_erase(target_flash_s *tf, target_addr_t addr, size_t len)
 	const uint32_t end = lpc_sector_for_addr(f, addr + len - 1U);
 	uint32_t last_full_sector = end;
 
-	if (lpc_iap_call(f, NULL, IAP_CMD_PREPARE, start, end, f->bank))
-		return false;
+	lpc_iap_cmd_s cmds[LPC_IAP_MAX_BATCH] = {
+		{.command = IAP_CMD_PREPARE, .params = {start, end, f->bank}},
+	};
+	size_t count = 1U;
 
 	/* Only LPC80x has reserved pages!*/
 	if (f->reserved_pages && addr + len >= tf->length - 0x400U)
 		--last_full_sector;
 
 	if (start <= last_full_sector) {
-		/* Sector erase */
-		if (lpc_iap_call(f, NULL, IAP_CMD_ERASE, start, last_full_sector, CPU_CLK_KHZ, f->bank))
-			return false;
-
-		/* Check erase ok */
-		if (lpc_iap_call(f, NULL, IAP_CMD_BLANKCHECK, start, last_full_sector, f->bank))
-			return false;
+		/* Sector erase, then check erase ok */
+		cmds[count++] = (lpc_iap_cmd_s){
+			.command = IAP_CMD_ERASE,
+			.params = {start, last_full_sector, CPU_CLK_KHZ, f->bank},
+		};
+		cmds[count++] = (lpc_iap_cmd_s){
+			.command = IAP_CMD_BLANKCHECK,
+			.params = {start, last_full_sector, f->bank},
+		};
 	}
 
 	if (last_full_sector != end) {
 		const uint32_t page_start = (addr + len - LPX80X_SECTOR_SIZE) / LPX80X_PAGE_SIZE;
 		const uint32_t page_end = page_start + LPX80X_SECTOR_SIZE / LPX80X_PAGE_SIZE - 1U - f->reserved_pages;
 
-		if (lpc_iap_call(f, NULL, IAP_CMD_PREPARE, end, end, f->bank))
-			return false;
-
-		if (lpc_iap_call(f, NULL, IAP_CMD_ERASE_PAGE, page_start, page_end, CPU_CLK_KHZ, f->bank))
-			return false;
+		/* The sector erase above unprepares the sectors again, so prepare the last one for the page erase */
+		cmds[count++] = (lpc_iap_cmd_s){
+			.command = IAP_CMD_PREPARE,
+			.params = {end, end, f->bank},
+		};
+		cmds[count++] = (lpc_iap_cmd_s){
+			.command = IAP_CMD_ERASE_PAGE,
+			.params = {page_start, page_end, CPU_CLK_KHZ, f->bank},
+		};
 		/* Blank check omitted!*/
 	}
-	return true;
+	return lpc_iap_run(f, cmds, count) == IAP_STATUS_CMD_SUCCESS;
+}
+
+/* The IAP blank check reads the sectors on the target itself, which is much cheaper than reading them back */
+static bool lpc_flash_blank_check(target_flash_s *const tf, const target_addr_t addr, const size_t len)
+{
+	lpc_flash_s *const f = (lpc_flash_s *)tf;
+	const uint32_t start = lpc_sector_for_addr(f, addr);
+	const uint32_t end = lpc_sector_for_addr(f, addr + len - 1U);
+	return lpc_iap_call(f, NULL, IAP_CMD_BLANKCHECK, start, end, f->bank, 0U) == IAP_STATUS_CMD_SUCCESS;
 }
 
 static bool lpc_flash_write(target_flash_s *tf, target_addr_t dest, const void *src, size_t len)
 {
 	lpc_flash_s *f = (lpc_flash_s *)tf;
-	/* Prepare... */
 	const uint32_t sector = lpc_sector_for_addr(f, dest);
-	if (lpc_iap_call(f, NULL, IAP_CMD_PREPARE, sector, sector, f->bank)) {
-		DEBUG_WARN("Prepare failed\n");
+	/*
+	 * With two staging buffers, upload into the one not in use while the previous write is still
+	 * programming from the other. With just the one, that write has to finish first.
+	 */
+	if (f->iap_buffers < 2U && !lpc_iap_complete(f))
 		return false;
-	}
-	const uint32_t bufaddr = ALIGN(f->iap_ram + sizeof(flash_param_s), 4);
+	const uint32_t bufaddr = f->iap_ram + LPC_IAP_BUFFER_OFFSET + f->iap_buffer * tf->writesize;
+	f->iap_buffer = (f->iap_buffer + 1U) % f->iap_buffers;
+	/* Write payload to target ram */
 	target_mem_write(f->f.t, bufaddr, src, len);
 	/* Only LPC80x has reserved pages!*/
 	if (!f->reserved_pages || dest + len <= tf->length - len) {
-		/*
-		 * Write payload to target ram,
-		 * set the destination address and program
-		 */
-		if (lpc_iap_call(f, NULL, IAP_CMD_PROGRAM, dest, bufaddr, len, CPU_CLK_KHZ))
+		/* Prepare, then set the destination address and program */
+		lpc_iap_cmd_s cmds[] = {
+			{.command = IAP_CMD_PREPARE, .params = {sector, sector, f->bank}},
+			{.command = IAP_CMD_PROGRAM, .params = {dest, bufaddr, len, CPU_CLK_KHZ}},
+		};
+		if (!f->iap_backup)
+			return lpc_iap_run(f, cmds, ARRAY_LENGTH(cmds)) == IAP_STATUS_CMD_SUCCESS;
+		/* In a Flash session, leave this running and pick up the result on the next IAP operation */
+		if (!lpc_iap_complete(f))
 			return false;
-	} else {
-		/*
-		 * On LPC80x, write top sector in pages.
-		 * Silently ignore write to the 2 reserved pages at top!
-		 */
-		for (size_t offset = 0; offset < len - (0x40U * f->reserved_pages); offset += LPX80X_PAGE_SIZE) {
-			if (lpc_iap_call(f, NULL, IAP_CMD_PREPARE, sector, sector, f->bank)) {
-				DEBUG_WARN("Prepare failed\n");
-				return false;
-			}
-			/* Set the destination address and program */
-			if (lpc_iap_call(f, NULL, IAP_CMD_PROGRAM, dest + offset, bufaddr + offset, LPX80X_PAGE_SIZE, CPU_CLK_KHZ))
-				return false;
+		lpc_iap_start(f, cmds, ARRAY_LENGTH(cmds), f->iap_backup->regs);
+		f->iap_pending = ARRAY_LENGTH(cmds);
+		return true;
+	}
+	/*
+	 * On LPC80x, write top sector in pages, two pages to a run of the trampoline.
+	 * Silently ignore write to the 2 reserved pages at top!
+	 */
+	const size_t pages_len = len - (LPX80X_PAGE_SIZE * f->reserved_pages);
+	for (size_t offset = 0; offset < pages_len;) {
+		lpc_iap_cmd_s cmds[4U];
+		size_t count = 0;
+		for (; count < ARRAY_LENGTH(cmds) && offset < pages_len; offset += LPX80X_PAGE_SIZE) {
+			cmds[count++] = (lpc_iap_cmd_s){
+				.command = IAP_CMD_PREPARE,
+				.params = {sector, sector, f->bank},
+			};
+			cmds[count++] = (lpc_iap_cmd_s){
+				.command = IAP_CMD_PROGRAM,
+				.params = {dest + offset, bufaddr + offset, LPX80X_PAGE_SIZE, CPU_CLK_KHZ},
+			};
 		}
+		if (lpc_iap_run(f, cmds, count))
+			return false;
 	}
 	return true;
 }
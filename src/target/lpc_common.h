@@ -71,6 +71,8 @@ typedef enum iap_status {
 /* CPU Frequency */
 #define CPU_CLK_KHZ 12000U
 
+typedef struct lpc_iap_backup lpc_iap_backup_s;
+
 typedef struct lpc_flash {
 	target_flash_s f;
 	uint8_t base_sector;
@@ -81,9 +83,16 @@ typedef struct lpc_flash {
 	uint32_t iap_entry;
 	uint32_t iap_ram;
 	uint32_t iap_msp;
+	/* IAP RAM and registers saved for the duration of a Flash session, NULL outside of one */
+	lpc_iap_backup_s *iap_backup;
+	uint8_t iap_buffers; /* Number of write staging buffers, sized by lpc_flash_register() */
+	uint8_t iap_buffer;  /* Staging buffer the next write uses */
+	uint8_t iap_pending; /* Number of commands in a write still running on the target, 0 if none */
 } lpc_flash_s;
 
 lpc_flash_s *lpc_add_flash(target_s *t, target_addr_t addr, size_t length);
+void lpc_flash_register(target_s *t, lpc_flash_s *lf);
+uint32_t lpc_ram_end(target_s *t, target_addr_t addr, size_t min_length);
 iap_status_e lpc_iap_call(struct lpc_flash *f, void *result, iap_cmd_e cmd, ...);
 bool lpc_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 bool lpc_flash_write_magic_vect(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
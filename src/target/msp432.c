@@ -88,11 +88,12 @@
 #define P401M_SRAM_SIZE 0x00008000U /* Size of SRAM, M: 32KB */
 #define P401R_SRAM_SIZE 0x00010000U /* Size of SRAM, R: 64KB */
 
-/* Flash write buffer and stack */
+/* Flash write buffers and stack */
 #define SRAM_STACK_OFFSET   0x00000200U /* A bit less than 512 stack room */
 #define SRAM_STACK_PTR      (SRAM_BASE + SRAM_STACK_OFFSET)
-#define SRAM_WRITE_BUFFER   SRAM_STACK_PTR /* Buffer right above stack */
-#define SRAM_WRITE_BUF_SIZE 0x00000400U    /* Write 1024 bytes at a tima */
+#define SRAM_WRITE_BUFFER   SRAM_STACK_PTR /* Buffers right above stack */
+#define SRAM_WRITE_BUF_SIZE SECTOR_SIZE    /* Write a whole sector at a time */
+#define SRAM_WRITE_BUFFERS  2U             /* One is filled while the ROM programs from the other */
 
 /* Watchdog */
 #define WDT_A_WTDCTL 0x4000480cU /* Control register for watchdog */
@@ -104,14 +105,20 @@ typedef struct msp432_flash {
 	target_addr_t flash_protect_register; /* Address of the WEPROT register*/
 	target_addr_t flash_erase_sector_fn;  /* Erase flash sector routine in ROM*/
 	target_addr_t flash_program_fn;       /* Flash programming routine in ROM */
+	uint32_t write_prot;                  /* Protection to restore once the running write completes */
+	uint8_t write_buffer;                 /* Index of the SRAM buffer to fill next */
+	bool write_running;                   /* The program routine is running from the other buffer */
 } msp432_flash_s;
 
 static bool msp432_sector_erase(target_flash_s *f, target_addr_t addr);
 static bool msp432_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool msp432_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool msp432_flash_done(target_flash_s *f);
 
 /* Call a function in the MSP432 ROM (or anywhere else...)*/
 static void msp432_call_rom(target_s *t, uint32_t address, uint32_t *regs);
+static void msp432_start_rom(target_s *t, uint32_t address, uint32_t *regs);
+static void msp432_wait_rom(target_s *t, uint32_t *regs);
 
 /* Protect or unprotect the sector containing address */
 static inline uint32_t msp432_sector_unprotect(msp432_flash_s *mf, target_addr_t addr)
@@ -154,6 +161,7 @@ static void msp432_add_flash(target_s *t, uint32_t addr, size_t length, target_a
 	f->blocksize = SECTOR_SIZE;
 	f->erase = msp432_flash_erase;
 	f->write = msp432_flash_write;
+	f->done = msp432_flash_done;
 	f->writesize = SRAM_WRITE_BUF_SIZE;
 	f->erased = 0xff;
 	target_add_flash(t, f);
@@ -228,6 +236,10 @@ static bool msp432_sector_erase(target_flash_s *f, target_addr_t addr)
 	target_s *t = f->t;
 	msp432_flash_s *mf = (msp432_flash_s *)f;
 
+	/* Let any write still in progress finish first */
+	if (!msp432_flash_done(f))
+		return false;
+
 	/* Unprotect sector */
 	uint32_t old_prot = msp432_sector_unprotect(mf, addr);
 	DEBUG_WARN("Flash protect: 0x%08" PRIX32 "\n", target_mem_read32(t, mf->flash_protect_register));
@@ -258,7 +270,7 @@ static bool msp432_flash_erase(target_flash_s *f, target_addr_t addr, size_t len
 		ret &= msp432_sector_erase(f, addr);
 
 		/* update len and addr */
-		len -= f->blocksize;
+		addr += f->blocksize;
 		if (len > f->blocksize)
 			len -= f->blocksize;
 		else
@@ -268,33 +280,55 @@ static bool msp432_flash_erase(target_flash_s *f, target_addr_t addr, size_t len
 	return ret;
 }
 
-/* Program flash */
+/*
+ * Program flash. The SRAM buffers are used in turn: the next sector's data is uploaded while the ROM
+ * routine is still programming the last one, and only then do we wait for it and start the next call.
+ */
 static bool msp432_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
 {
 	msp432_flash_s *mf = (msp432_flash_s *)f;
 	target_s *t = f->t;
+	const target_addr_t buffer = SRAM_WRITE_BUFFER + mf->write_buffer * SRAM_WRITE_BUF_SIZE;
 
 	/* Prepare RAM buffer in target */
-	target_mem_write(t, SRAM_WRITE_BUFFER, src, len);
+	target_mem_write(t, buffer, src, len);
 
-	/* Unprotect sector, len is always < SECTOR_SIZE */
-	uint32_t old_prot = msp432_sector_unprotect(mf, dest);
+	/* Wait for the previous write, if any, to complete */
+	if (!msp432_flash_done(f))
+		return false;
 
-	DEBUG_WARN("Flash protect: 0x%08" PRIX32 "\n", target_mem_read32(t, mf->flash_protect_register));
+	/* Unprotect sector, len is never more than SECTOR_SIZE */
+	mf->write_prot = msp432_sector_unprotect(mf, dest);
 
 	/* Prepare input data */
 	uint32_t regs[t->regs_size / sizeof(uint32_t)]; // Use of VLA
 	target_regs_read(t, regs);
-	regs[0] = SRAM_WRITE_BUFFER; // Address of buffer to be flashed in R0
-	regs[1] = dest;              // Flash address to be write to in R1
-	regs[2] = len;               // Size of buffer to be flashed in R2
+	regs[0] = buffer; // Address of buffer to be flashed in R0
+	regs[1] = dest;   // Flash address to be write to in R1
+	regs[2] = len;    // Size of buffer to be flashed in R2
+
+	DEBUG_INFO("Writing 0x%04zx bytes at 0x%08" PRIX32 "\n", len, dest);
+	/* Call ROM, leaving it running */
+	msp432_start_rom(t, mf->flash_program_fn, regs);
+	mf->write_running = true;
+	mf->write_buffer = (mf->write_buffer + 1U) % SRAM_WRITE_BUFFERS;
+	return true;
+}
 
-	DEBUG_INFO("Writing 0x%04" PRIX32 " bytes at 0x%08zu\n", dest, len);
-	/* Call ROM */
-	msp432_call_rom(t, mf->flash_program_fn, regs);
+/* Wait for the write in progress to complete */
+static bool msp432_flash_done(target_flash_s *f)
+{
+	msp432_flash_s *mf = (msp432_flash_s *)f;
+	target_s *t = f->t;
+	if (!mf->write_running)
+		return true;
+	mf->write_running = false;
+
+	uint32_t regs[t->regs_size / sizeof(uint32_t)]; // Use of VLA
+	msp432_wait_rom(t, regs);
 
 	/* Restore original protection */
-	target_mem_write32(t, mf->flash_protect_register, old_prot);
+	target_mem_write32(t, mf->flash_protect_register, mf->write_prot);
 
 	DEBUG_INFO("ROM return value: %" PRIu32 "\n", regs[0]);
 
@@ -344,6 +378,13 @@ static bool msp432_cmd_sector_erase(target_s *t, int argc, const char **argv)
 
 /* MSP432 ROM routine invocation */
 static void msp432_call_rom(target_s *t, uint32_t address, uint32_t *regs)
+{
+	msp432_start_rom(t, address, regs);
+	msp432_wait_rom(t, regs);
+}
+
+/* Set up and start a ROM routine, returning with it running */
+static void msp432_start_rom(target_s *t, uint32_t address, uint32_t *regs)
 {
 	/* Kill watchdog */
 	target_mem_write16(t, WDT_A_WTDCTL, WDT_A_HOLD);
@@ -357,8 +398,13 @@ static void msp432_call_rom(target_s *t, uint32_t address, uint32_t *regs)
 	regs[REG_PC] = address;             /* Start at given address */
 	target_regs_write(t, regs);
 
-	/* Start the target and wait for it to halt again, which calls the routine setup above */
+	/* Start the target, which calls the routine setup above */
 	target_halt_resume(t, false);
+}
+
+/* Wait for a ROM routine started by msp432_start_rom() to return and halt on the breakpoint */
+static void msp432_wait_rom(target_s *t, uint32_t *regs)
+{
 	while (!target_halt_poll(t, NULL))
 		continue;
 
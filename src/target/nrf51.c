@@ -28,6 +28,7 @@
 #include "adiv5.h"
 
 static bool nrf51_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
+static bool nrf51_flash_erase_all(target_flash_s *f);
 static bool nrf51_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 static bool nrf51_flash_prepare(target_flash_s *f);
 static bool nrf51_flash_done(target_flash_s *f);
@@ -103,6 +104,9 @@ const command_s nrf51_read_cmd_list[] = {
 #define NRF51_PAGE_SIZE 1024U
 #define NRF52_PAGE_SIZE 4096U
 
+/* The UICR registers all sit in the first 1KiB of the UICR page on both nRF51 and nRF52 */
+#define NRF51_UICR_USED_SIZE 1024U
+
 static void nrf51_add_flash(target_s *t, uint32_t addr, size_t length, size_t erasesize)
 {
 	target_flash_s *f = calloc(1, sizeof(*f));
@@ -120,6 +124,9 @@ static void nrf51_add_flash(target_s *t, uint32_t addr, size_t length, size_t er
 	f->write = nrf51_flash_write;
 	f->prepare = nrf51_flash_prepare;
 	f->done = nrf51_flash_done;
+	/* ERASEALL clears the code region, so only offer it there and not for the UICR */
+	if (addr != NRF51_UICR)
+		f->erase_all = nrf51_flash_erase_all;
 	f->erased = 0xff;
 	target_add_flash(t, f);
 }
@@ -217,6 +224,46 @@ static bool nrf51_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 	return true;
 }
 
+/*
+ * ERASEALL takes about as long as erasing a single page, so when the whole code region is to be
+ * erased it is far quicker than going page by page. It takes the UICR with it though, so save the
+ * UICR registers beforehand and put back the ones that were programmed.
+ */
+static bool nrf51_flash_erase_all(target_flash_s *const f)
+{
+	target_s *const t = f->t;
+	uint32_t *const uicr = malloc(NRF51_UICR_USED_SIZE);
+	if (!uicr) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	target_mem_read(t, uicr, NRF51_UICR, NRF51_UICR_USED_SIZE);
+	bool result = !target_check_error(t);
+
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, 500);
+	/* Erase all, nrf51_flash_prepare() has already enabled erasing */
+	if (result) {
+		target_mem_write32(t, NRF51_NVMC_ERASEALL, 1U);
+		result = nrf51_wait_ready(t, &timeout);
+	}
+
+	/* Restore the UICR, then go back to erasing for the rest of the session */
+	if (result) {
+		target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_WEN);
+		result = nrf51_wait_ready(t, NULL);
+	}
+	for (size_t i = 0; result && i < NRF51_UICR_USED_SIZE / 4U; ++i) {
+		if (uicr[i] == 0xffffffffU)
+			continue;
+		target_mem_write32(t, NRF51_UICR + (i * 4U), uicr[i]);
+		result = nrf51_wait_ready(t, NULL);
+	}
+	free(uicr);
+	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_EEN);
+	return nrf51_wait_ready(t, NULL) && result;
+}
+
 static bool nrf51_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
 {
 	/* nrf51_flash_prepare() and nrf51_flash_done() top-and-tail this, just write the data to the target. */
@@ -401,6 +448,7 @@ static bool nrf51_cmd_read(target_s *t, int argc, const char **argv)
 
 static bool nrf51_mdm_mass_erase(target_s *t);
 
+#define MDM_RESET     ADIV5_AP_REG(0x00U)
 #define MDM_POWER_EN  ADIV5_DP_REG(0x01U)
 #define MDM_SELECT_AP ADIV5_DP_REG(0x02U)
 #define MDM_STATUS    ADIV5_AP_REG(0x08U)
@@ -447,12 +495,23 @@ static bool nrf51_mdm_mass_erase(target_s *t)
 
 	platform_timeout_s timeout;
 	platform_timeout_set(&timeout, 500);
-	// Read until 0, probably should have a timeout here...
+	/* ERASEALL normally completes in well under a second, so give up if it takes much longer */
+	platform_timeout_s erase_timeout;
+	platform_timeout_set(&erase_timeout, 10000);
 	do {
 		status = adiv5_ap_read(ap, MDM_STATUS);
+		if (platform_timeout_is_expired(&erase_timeout)) {
+			DEBUG_WARN("nRF52 CTRL-AP erase timed out\n");
+			return false;
+		}
 		target_print_progress(&timeout);
 	} while (status);
 
+	/* Release ERASEALL and pulse the CTRL-AP soft reset so the core comes back up on the blank Flash */
+	adiv5_ap_write(ap, MDM_CONTROL, 0U);
+	adiv5_ap_write(ap, MDM_RESET, 1U);
+	adiv5_ap_write(ap, MDM_RESET, 0U);
+
 	// The second read will provide true prot status
 	status = adiv5_ap_read(ap, MDM_PROT_EN);
 	status = adiv5_ap_read(ap, MDM_PROT_EN);
@@ -40,6 +40,8 @@
 #include "general.h"
 #include "target.h"
 #include "target_internal.h"
+#include "cortexm.h"
+#include "adiv5.h"
 
 /* KE04 registers and constants */
 
@@ -113,11 +115,19 @@
 /* Length in 16bit words of flash commands */
 static const uint8_t cmd_lens[] = {4, 1, 2, 3, 6, 0, 6, 6, 1, 2, 2, 1, 5, 3, 3};
 
+/*
+ * Each command goes to the FTMRE as one queued batch: a CSW, TAR and DRW write per register written,
+ * two registers per FCCOB word, plus clearing the errors, launching it and reading back FSTAT
+ */
+#define KE04_QUEUE_DEPTH 48U
+
 /* Flash routines */
 static bool ke04_command(target_s *t, uint8_t cmd, uint32_t addr, const uint8_t *data);
 static bool ke04_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool ke04_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 static bool ke04_flash_done(target_flash_s *f);
+static bool ke04_flash_prepare(target_flash_s *f);
+static bool ke04_flash_setup(target_s *t);
 static bool ke04_mass_erase(target_s *t);
 
 /* Target specific commands */
@@ -147,6 +157,8 @@ static bool ke04_cmd_sector_erase(target_s *t, int argc, const char **argv)
 	}
 
 	/* Erase and verify the given sector */
+	if (!ke04_flash_setup(t))
+		return false;
 	ke04_command(t, CMD_ERASE_FLASH_SECTOR, addr, NULL);
 	/* Adjust security byte if needed */
 	ke04_flash_done(f);
@@ -230,6 +242,7 @@ bool ke04_probe(target_s *t)
 	f->blocksize = KE04_SECTOR_SIZE;
 	f->erase = ke04_flash_erase;
 	f->write = ke04_flash_write;
+	f->prepare = ke04_flash_prepare;
 	f->done = ke04_flash_done;
 	f->erased = 0xffU;
 	target_add_flash(t, f);
@@ -242,6 +255,8 @@ bool ke04_probe(target_s *t)
 static bool ke04_mass_erase(target_s *t)
 {
 	/* Erase and verify the whole flash */
+	if (!ke04_flash_setup(t))
+		return false;
 	ke04_command(t, CMD_ERASE_ALL_BLOCKS, 0, NULL);
 	/* Adjust security byte if needed */
 	ke04_flash_done(t->flash);
@@ -260,21 +275,43 @@ static bool ke04_wait_complete(target_s *t)
 	return true;
 }
 
-static bool ke04_command(target_s *t, uint8_t cmd, uint32_t addr, const uint8_t *data)
+/* Set FCLKDIV to 0x17 for 24MHz (default at reset), once for a run of commands */
+static bool ke04_flash_setup(target_s *t)
 {
-	/* Set FCLKDIV to 0x17 for 24MHz (default at reset) */
-	uint8_t fclkdiv = target_mem_read8(t, FTMRE_FCLKDIV);
+	const uint8_t fclkdiv = target_mem_read8(t, FTMRE_FCLKDIV);
 	if ((fclkdiv & 0x1fU) != 0x17U) {
 		if (!ke04_wait_complete(t))
 			return false;
 		/* Write correct value */
 		target_mem_write8(t, FTMRE_FCLKDIV, 0x17U);
 	}
+	/* Commands leave CCIF set as they finish, so only the first has to wait for one still running */
+	return ke04_wait_complete(t);
+}
+
+static bool ke04_flash_prepare(target_flash_s *f)
+{
+	return ke04_flash_setup(f->t);
+}
+
+/* Queue a byte or halfword FTMRE register write, the value going on the byte lanes its address selects */
+static void ke04_queue_write(adiv5_queue_s *const queue, adiv5_access_port_s *const ap, const uint32_t addr,
+	const uint32_t value, const uint32_t size)
+{
+	adiv5_queue_ap_write(queue, ap, ADIV5_AP_CSW, ap->csw | size | ADIV5_AP_CSW_ADDRINC_NONE);
+	adiv5_queue_ap_write(queue, ap, ADIV5_AP_TAR, addr);
+	adiv5_queue_ap_write(queue, ap, ADIV5_AP_DRW, value << ((addr & 3U) * 8U));
+}
+
+static bool ke04_command(target_s *t, uint8_t cmd, uint32_t addr, const uint8_t *data)
+{
+	adiv5_access_port_s *const ap = cortexm_ap(t);
+	adiv5_queue_entry_s entries[KE04_QUEUE_DEPTH];
+	adiv5_queue_s queue;
+	adiv5_queue_init(&queue, ap->dp, entries, KE04_QUEUE_DEPTH);
 
 	/* clear errors unconditionally, so we can start a new operation */
-	target_mem_write8(t, FTMRE_FSTAT, FTMRE_FSTAT_ACCERR | FTMRE_FSTAT_FPVIOL);
-	if (!ke04_wait_complete(t))
-		return false;
+	ke04_queue_write(&queue, ap, FTMRE_FSTAT, FTMRE_FSTAT_ACCERR | FTMRE_FSTAT_FPVIOL, ADIV5_AP_CSW_SIZE_BYTE);
 
 	/* Write the flash command and the needed parameters */
 	uint8_t fccob_idx = 0;
@@ -286,28 +323,36 @@ static bool ke04_command(target_s *t, uint8_t cmd, uint32_t addr, const uint8_t
 		cmd = CMD_PROGRAM_FLASH;
 	const uint16_t fccob_cmd = (cmd << 8U) | (addr >> 16U);
 	/* Write command to FCCOB array */
-	target_mem_write8(t, FTMRE_FCCOBIX, fccob_idx++);
-	target_mem_write16(t, FTMRE_FCCOB, fccob_cmd);
+	ke04_queue_write(&queue, ap, FTMRE_FCCOBIX, fccob_idx++, ADIV5_AP_CSW_SIZE_BYTE);
+	ke04_queue_write(&queue, ap, FTMRE_FCCOB, fccob_cmd, ADIV5_AP_CSW_SIZE_HALFWORD);
 
 	/* Write first argument (low partof address) */
 	if (cmd_len >= 1) {
-		target_mem_write8(t, FTMRE_FCCOBIX, fccob_idx++);
-		target_mem_write16(t, FTMRE_FCCOB, addr & 0xffffU);
+		ke04_queue_write(&queue, ap, FTMRE_FCCOBIX, fccob_idx++, ADIV5_AP_CSW_SIZE_BYTE);
+		ke04_queue_write(&queue, ap, FTMRE_FCCOB, addr & 0xffffU, ADIV5_AP_CSW_SIZE_HALFWORD);
 	}
 
 	/* Write one or two 32 bit words of data */
 	for (uint8_t offset = 0; fccob_idx < cmd_len; ++fccob_idx, offset += 2U) {
-		target_mem_write8(t, FTMRE_FCCOBIX, fccob_idx);
-		target_mem_write16(t, FTMRE_FCCOB, *(uint16_t *)(data + offset));
+		ke04_queue_write(&queue, ap, FTMRE_FCCOBIX, fccob_idx, ADIV5_AP_CSW_SIZE_BYTE);
+		ke04_queue_write(
+			&queue, ap, FTMRE_FCCOB, data[offset] | ((uint32_t)data[offset + 1U] << 8U), ADIV5_AP_CSW_SIZE_HALFWORD);
 	}
 
-	/* Enable execution by clearing CCIF */
-	target_mem_write8(t, FTMRE_FSTAT, FTMRE_FSTAT_CCIF);
+	/* Enable execution by clearing CCIF, and see where it got to, which for a program is usually done already */
+	ke04_queue_write(&queue, ap, FTMRE_FSTAT, FTMRE_FSTAT_CCIF, ADIV5_AP_CSW_SIZE_BYTE);
+	uint32_t status = 0;
+	adiv5_queue_ap_read(&queue, ap, ADIV5_AP_DRW, &status);
+	if (!adiv5_queue_run(&queue))
+		return false;
 
 	platform_timeout_s timeout;
 	platform_timeout_set(&timeout, 500);
 	/* Wait for execution to complete */
-	uint8_t fstat = 0;
+	uint8_t fstat = (status >> ((FTMRE_FSTAT & 3U) * 8U)) & 0xffU;
+	/* A command the FTMRE refused never clears CCIF, it just flags the error */
+	if (fstat & (FTMRE_FSTAT_ACCERR | FTMRE_FSTAT_FPVIOL))
+		return false;
 	while (!(fstat & FTMRE_FSTAT_CCIF)) {
 		fstat = target_mem_read8(t, FTMRE_FSTAT);
 		/* Check ACCERR and FPVIOL are zero in FSTAT */
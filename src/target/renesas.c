@@ -226,6 +226,9 @@ typedef enum {
 #define RV40_CF_WRITE_SIZE         (0x80U)
 #define RV40_DF_WRITE_SIZE         (0x4U)
 
+/* FSADDR setup, command, count, CSW switches and final command plus one entry per data halfword */
+#define RV40_WRITE_QUEUE_DEPTH ((RV40_CF_WRITE_SIZE / 2U) + 10U)
+
 /* RV40 Flash Commands */
 #define RV40_CMD               UINT32_C(0x407e0000)
 #define RV40_CMD_PROGRAM       0xe8U
@@ -552,6 +555,42 @@ static bool renesas_rv40_flash_erase(target_flash_s *f, target_addr_t addr, size
 	return true;
 }
 
+/*
+ * Queue one complete FACI program command (FSADDR, program, count, data, final) so it goes out as
+ * a single block of AP accesses. The command area is a single non-incrementing address, so the
+ * data halfwords are streamed to it with address increment disabled.
+ */
+static bool renesas_rv40_program_unit(
+	target_s *const t, const target_addr_t dest, const uint8_t *const src, const uint8_t write_size)
+{
+	adiv5_access_port_s *const ap = cortexm_ap(t);
+	adiv5_queue_entry_s entries[RV40_WRITE_QUEUE_DEPTH];
+	adiv5_queue_s queue;
+	adiv5_queue_init(&queue, ap->dp, entries, RV40_WRITE_QUEUE_DEPTH);
+
+	/* set block start address */
+	adiv5_queue_ap_write(&queue, ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
+	adiv5_queue_ap_write(&queue, ap, ADIV5_AP_TAR, RV40_FSADDR);
+	adiv5_queue_ap_write(&queue, ap, ADIV5_AP_DRW, dest);
+
+	/* issue two part Write commands */
+	adiv5_queue_ap_write(&queue, ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_BYTE | ADIV5_AP_CSW_ADDRINC_NONE);
+	adiv5_queue_ap_write(&queue, ap, ADIV5_AP_TAR, RV40_CMD);
+	adiv5_queue_ap_write(&queue, ap, ADIV5_AP_DRW, RV40_CMD_PROGRAM);
+	adiv5_queue_ap_write(&queue, ap, ADIV5_AP_DRW, write_size / 2U);
+
+	/* RV40_CMD is word aligned so both byte and halfword accesses use the low byte lanes */
+	adiv5_queue_ap_write(&queue, ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_HALFWORD | ADIV5_AP_CSW_ADDRINC_NONE);
+	for (size_t i = 0U; i < write_size; i += 2U)
+		adiv5_queue_ap_write(&queue, ap, ADIV5_AP_DRW, src[i] | ((uint32_t)src[i + 1U] << 8U));
+
+	/* issue write end command */
+	adiv5_queue_ap_write(&queue, ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_BYTE | ADIV5_AP_CSW_ADDRINC_NONE);
+	adiv5_queue_ap_write(&queue, ap, ADIV5_AP_DRW, RV40_CMD_FINAL);
+
+	return adiv5_queue_run(&queue);
+}
+
 static bool renesas_rv40_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
 {
 	target_s *t = f->t;
@@ -561,19 +600,17 @@ static bool renesas_rv40_flash_write(target_flash_s *f, target_addr_t dest, cons
 
 	/* write size for code flash / data flash */
 	const uint8_t write_size = code_flash ? RV40_CF_WRITE_SIZE : RV40_DF_WRITE_SIZE;
+	const uint8_t *data = src;
 
 	while (len) {
-		/* set block start address */
-		target_mem_write32(t, RV40_FSADDR, dest);
+		if (!renesas_rv40_program_unit(t, dest, data, write_size))
+			return false;
 
 		/* increment destination address */
 		dest += write_size;
+		data += write_size;
 		len -= write_size;
 
-		/* issue two part Write commands */
-		target_mem_write8(t, RV40_CMD, RV40_CMD_PROGRAM);
-		target_mem_write8(t, RV40_CMD, (uint8_t)(write_size / 2U));
-
 		/* according to reference manual the data buffer full time for 2 bytes is 2 usec.
 		 * this is with a FCLK of 4MHz
 		 * a complete should take less than 1 msec.
@@ -581,18 +618,6 @@ static bool renesas_rv40_flash_write(target_flash_s *f, target_addr_t dest, cons
 		platform_timeout_s timeout;
 		platform_timeout_set(&timeout, 10);
 
-		/* write one chunk */
-		for (size_t i = 0U; i < (write_size / 2U); i++) {
-			/* copy data from source address to destination */
-			target_mem_write16(t, RV40_CMD, *(uint16_t *)src);
-
-			/* 2 bytes of data */
-			src += 2U;
-		}
-
-		/* issue write end command */
-		target_mem_write8(t, RV40_CMD, RV40_CMD_FINAL);
-
 		/* wait until the operation has completed or timeout */
 		/* read FRDY bit until it has been set to 1 indicating that the current operation is complete.*/
 		while (!(target_mem_read32(t, RV40_FSTATR) & RV40_FSTATR_RDY)) {
@@ -751,14 +776,14 @@ bool renesas_probe(target_s *t)
 		if (renesas_pnr_read(t, RENESAS_FIXED2_PNR, pnr)) {
 			DEBUG_WARN("Found renesas chip (%.*s) with pnr location RENESAS_FIXED2_PNR and unsupported Part ID %" PRIx16
 					   " please report it\n",
-				sizeof(pnr), pnr, t->part_id);
+				(int)sizeof(pnr), pnr, t->part_id);
 			break;
 		}
 
 		if (renesas_pnr_read(t, RENESAS_FIXED1_PNR, pnr)) {
 			DEBUG_WARN("Found renesas chip (%.*s) with pnr location RENESAS_FIXED1_PNR and unsupported Part ID "
 					   "0x%" PRIx16 " please report it\n",
-				sizeof(pnr), pnr, t->part_id);
+				(int)sizeof(pnr), pnr, t->part_id);
 			break;
 		}
 
@@ -766,7 +791,7 @@ bool renesas_probe(target_s *t)
 		if (renesas_pnr_read(t, RENESAS_FMIFRT_PNR(flash_root_table), pnr)) {
 			DEBUG_WARN("Found renesas chip (%.*s) with Flash Root Table and unsupported Part ID 0x%" PRIx16 " "
 					   "please report it\n",
-				sizeof(pnr), pnr, t->part_id);
+				(int)sizeof(pnr), pnr, t->part_id);
 			break;
 		}
 
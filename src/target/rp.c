@@ -160,14 +160,15 @@
 #define MAX_FLASH                (16U * 1024U * 1024U)
 #define MAX_WRITE_CHUNK          0x1000U
 
-#define RP_SPI_OPCODE(x)            (x)
-#define RP_SPI_OPCODE_MASK          0x00ffU
-#define RP_SPI_INTER_SHIFT          8U
-#define RP_SPI_INTER_LENGTH(x)      (((x)&7U) << RP_SPI_INTER_SHIFT)
-#define RP_SPI_INTER_MASK           0x0700U
-#define RP_SPI_FRAME_OPCODE_ONLY    (1 << 11U)
-#define RP_SPI_FRAME_OPCODE_3B_ADDR (2 << 11U)
-#define RP_SPI_FRAME_MASK           0x1800U
+/* SRAM layout used by the double-buffered programming trampoline, flashstub/rp2040_program.s */
+#define RP_PROGRAM_STUB_ADDR     RP_SRAM_BASE
+#define RP_PROGRAM_CTRL_ADDR     (RP_SRAM_BASE + 0x40U)
+#define RP_PROGRAM_SLOT(n)       (RP_PROGRAM_CTRL_ADDR + 8U + ((n)*12U))
+#define RP_PROGRAM_SLOT_LENGTH   8U
+#define RP_PROGRAM_BUFFER(n)     (RP_SRAM_BASE + 0x100U + ((n)*MAX_WRITE_CHUNK))
+#define RP_PROGRAM_STOP          UINT32_MAX
+/* Programming takes 3ms per 256 byte page, with plenty of headroom for running without the XOSC */
+#define RP_PROGRAM_TIMEOUT       ((3U * MAX_WRITE_CHUNK * 10U) >> 8U)
 
 /* Instruction codes taken from Winbond W25Q16JV datasheet, as used on the
  * original Pico board from Raspberry Pi.
@@ -177,12 +178,7 @@
  * not support these commands
  */
 
-#define SPI_FLASH_CMD_SECTOR_ERASE  0x20U
-#define FLASHCMD_BLOCK32K_ERASE     0x52U
-#define FLASHCMD_BLOCK64K_ERASE     0xd8U
-#define FLASHCMD_CHIP_ERASE         0x60U
-#define SPI_FLASH_CMD_READ_JEDEC_ID (RP_SPI_OPCODE(0x9fU) | RP_SPI_INTER_LENGTH(0) | RP_SPI_FRAME_OPCODE_ONLY)
-#define SPI_FLASH_CMD_READ_SFDP     (RP_SPI_OPCODE(0x5aU) | RP_SPI_INTER_LENGTH(1U) | RP_SPI_FRAME_OPCODE_3B_ADDR)
+#define FLASHCMD_CHIP_ERASE 0x60U
 
 typedef struct rp_priv {
 	uint16_t rom_debug_trampoline_begin;
@@ -196,6 +192,8 @@ typedef struct rp_priv {
 	uint16_t rom_reset_usb_boot;
 	bool is_prepared;
 	bool is_monitor;
+	bool program_running; /* The programming trampoline is running */
+	uint8_t program_slot; /* Next trampoline buffer to fill */
 	uint32_t regs[0x20]; /* Register playground*/
 } rp_priv_s;
 
@@ -232,10 +230,9 @@ static void rp_flash_enter_xip(target_s *t);
 static void rp_flash_connect_internal(target_s *t);
 static void rp_flash_flush_cache(target_s *t);
 
-static void rp_spi_read_sfdp(target_s *const t, const uint32_t address, void *const buffer, const size_t length)
-{
-	rp_spi_read(t, SPI_FLASH_CMD_READ_SFDP, address, buffer, length);
-}
+static const uint16_t rp_program_stub[] = {
+#include "flashstub/rp2040_program.stub"
+};
 
 static void rp_add_flash(target_s *t)
 {
@@ -252,12 +249,13 @@ static void rp_add_flash(target_s *t)
 	rp_flash_exit_xip(t);
 
 	spi_parameters_s spi_parameters;
-	if (!sfdp_read_parameters(t, &spi_parameters, rp_spi_read_sfdp)) {
+	if (!sfdp_read_parameters(t, &spi_parameters, rp_spi_read)) {
 		/* SFDP readout failed, so make some assumptions and hope for the best. */
 		spi_parameters.page_size = 256U;
 		spi_parameters.sector_size = 4096U;
 		spi_parameters.capacity = rp_get_flash_length(t);
-		spi_parameters.sector_erase_opcode = SPI_FLASH_CMD_SECTOR_ERASE;
+		spi_parameters.sector_erase_opcode = SPI_FLASH_OPCODE_SECTOR_ERASE;
+		spi_parameters.address_mode = SFDP_ADDRESS_MODE_3B;
 	}
 
 	if (por_state)
@@ -424,6 +422,104 @@ static bool rp_rom_call(target_s *t, uint32_t *regs, uint32_t cmd, uint32_t time
 	return result;
 }
 
+/*
+ * Start the double-buffered programming trampoline. It runs on the target chaining
+ * flash_range_program() calls over two SRAM buffers, the ROM using the same stack as rp_rom_call().
+ */
+static bool rp_program_start(target_s *const t)
+{
+	rp_priv_s *const ps = (rp_priv_s *)t->target_storage;
+	if (ps->program_running)
+		return true;
+
+	const uint32_t ctrl[8] = {
+		ps->rom_flash_range_program | 1U,
+		0U,
+		0U,
+		RP_PROGRAM_BUFFER(0U),
+		0U,
+		0U,
+		RP_PROGRAM_BUFFER(1U),
+		0U,
+	};
+	target_mem_write(t, RP_PROGRAM_STUB_ADDR, rp_program_stub, sizeof(rp_program_stub));
+	target_mem_write(t, RP_PROGRAM_CTRL_ADDR, ctrl, sizeof(ctrl));
+
+	memset(ps->regs, 0, sizeof(ps->regs));
+	ps->regs[0] = RP_PROGRAM_CTRL_ADDR;
+	ps->regs[REG_PC] = RP_PROGRAM_STUB_ADDR;
+	ps->regs[REG_MSP] = 0x20042000;
+	ps->regs[REG_XPSR] = CORTEXM_XPSR_THUMB;
+	target_regs_write(t, ps->regs);
+	if (target_check_error(t))
+		return false;
+	target_halt_resume(t, false);
+
+	ps->program_slot = 0;
+	ps->program_running = true;
+	return true;
+}
+
+/* Wait for the trampoline to hand a buffer back, watching for it having stopped or hung */
+static bool rp_program_wait_slot(target_s *const t, const uint8_t slot)
+{
+	rp_priv_s *const ps = (rp_priv_s *)t->target_storage;
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, RP_PROGRAM_TIMEOUT);
+	while (target_mem_read32(t, RP_PROGRAM_SLOT(slot) + RP_PROGRAM_SLOT_LENGTH)) {
+		if (target_check_error(t) || platform_timeout_is_expired(&timeout) ||
+			target_halt_poll(t, NULL) != TARGET_HALT_RUNNING) {
+			DEBUG_WARN("RP programming trampoline failed\n");
+			ps->program_running = false;
+			target_halt_request(t);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool rp_program_queue(target_s *const t, const uint32_t offset, const void *const src, const size_t len)
+{
+	rp_priv_s *const ps = (rp_priv_s *)t->target_storage;
+	const uint8_t slot = ps->program_slot;
+	if (!rp_program_wait_slot(t, slot))
+		return false;
+
+	/* Fill the buffer, then hand it over - the length goes last as that is what the trampoline waits on */
+	target_mem_write(t, RP_PROGRAM_BUFFER(slot), src, len);
+	const uint32_t slot_words[3] = {offset, RP_PROGRAM_BUFFER(slot), len};
+	target_mem_write(t, RP_PROGRAM_SLOT(slot), slot_words, sizeof(slot_words));
+	ps->program_slot = slot ^ 1U;
+	return !target_check_error(t);
+}
+
+/* Let both buffers finish programming, then have the trampoline exit */
+static bool rp_program_stop(target_s *const t)
+{
+	rp_priv_s *const ps = (rp_priv_s *)t->target_storage;
+	if (!ps->program_running)
+		return true;
+
+	const uint8_t slot = ps->program_slot;
+	if (!rp_program_wait_slot(t, slot) || !rp_program_wait_slot(t, slot ^ 1U))
+		return false;
+	target_mem_write32(t, RP_PROGRAM_SLOT(slot) + RP_PROGRAM_SLOT_LENGTH, RP_PROGRAM_STOP);
+	ps->program_running = false;
+
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, RP_PROGRAM_TIMEOUT);
+	target_halt_reason_e reason = TARGET_HALT_RUNNING;
+	while (reason == TARGET_HALT_RUNNING) {
+		if (target_check_error(t) || platform_timeout_is_expired(&timeout)) {
+			DEBUG_WARN("RP programming trampoline did not stop\n");
+			target_halt_request(t);
+			return false;
+		}
+		reason = target_halt_poll(t, NULL);
+	}
+	return reason == TARGET_HALT_BREAKPOINT;
+}
+
 static bool rp_flash_prepare(target_s *t)
 {
 	rp_priv_s *ps = (rp_priv_s *)t->target_storage;
@@ -445,6 +541,7 @@ static bool rp_flash_resume(target_s *t)
 	bool result = true; /* catch false returns with &= */
 	if (ps->is_prepared) {
 		DEBUG_INFO("rp_flash_resume\n");
+		result &= rp_program_stop(t);
 		/* flush */
 		result &= rp_rom_call(t, ps->regs, ps->rom_flash_flush_cache, 100);
 		/* enter_cmd_xip */
@@ -466,6 +563,10 @@ static bool rp_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 	DEBUG_INFO("Erase addr 0x%08" PRIx32 " len 0x%" PRIx32 "\n", addr, (uint32_t)len);
 	target_s *t = f->t;
 
+	/* Programming has to finish before the ROM can be used for anything else */
+	if (!rp_program_stop(t))
+		return false;
+
 	if (addr & (f->blocksize - 1U)) {
 		DEBUG_WARN("Unaligned erase\n");
 		return false;
@@ -490,7 +591,7 @@ static bool rp_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 			ps->regs[0] = addr;
 			ps->regs[1] = chunk;
 			ps->regs[2] = FLASHSIZE_64K_BLOCK;
-			ps->regs[3] = FLASHCMD_BLOCK64K_ERASE;
+			ps->regs[3] = SPI_FLASH_OPCODE_BLOCK64K_ERASE;
 			DEBUG_WARN("64k_ERASE addr 0x%08" PRIx32 " len 0x%" PRIx32 "\n", addr, chunk);
 			result = rp_rom_call(t, ps->regs, ps->rom_flash_range_erase, 25100);
 			len -= chunk;
@@ -500,7 +601,7 @@ static bool rp_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 			ps->regs[0] = addr;
 			ps->regs[1] = chunk;
 			ps->regs[2] = FLASHSIZE_32K_BLOCK;
-			ps->regs[3] = FLASHCMD_BLOCK32K_ERASE;
+			ps->regs[3] = SPI_FLASH_OPCODE_BLOCK32K_ERASE;
 			DEBUG_WARN("32k_ERASE addr 0x%08" PRIx32 " len 0x%" PRIx32 "\n", addr, chunk);
 			result = rp_rom_call(t, ps->regs, ps->rom_flash_range_erase, 1700);
 			len -= chunk;
@@ -540,16 +641,21 @@ static bool rp_flash_write(target_flash_s *f, target_addr_t dest, const void *sr
 	bool result = true;
 	while (len) {
 		uint32_t chunksize = (len <= MAX_WRITE_CHUNK) ? len : MAX_WRITE_CHUNK;
-		target_mem_write(t, RP_SRAM_BASE, src, chunksize);
-		/* Program range */
-		ps->regs[0] = dest;
-		ps->regs[1] = RP_SRAM_BASE;
-		ps->regs[2] = chunksize;
-		/* Loading takes 3 ms per 256 byte page
-		 * however it takes much longer if the XOSC is not enabled
-		 * so lets give ourselves a little bit more time (x10)
-		 */
-		result = rp_rom_call(t, ps->regs, ps->rom_flash_range_program, (3U * chunksize * 10U) >> 8U);
+		if (rp_program_start(t))
+			/* Hand the chunk to the trampoline, it programs while the next one is sent */
+			result = rp_program_queue(t, dest, src, chunksize);
+		else {
+			target_mem_write(t, RP_SRAM_BASE, src, chunksize);
+			/* Program range */
+			ps->regs[0] = dest;
+			ps->regs[1] = RP_SRAM_BASE;
+			ps->regs[2] = chunksize;
+			/* Loading takes 3 ms per 256 byte page
+			 * however it takes much longer if the XOSC is not enabled
+			 * so lets give ourselves a little bit more time (x10)
+			 */
+			result = rp_rom_call(t, ps->regs, ps->rom_flash_range_program, (3U * chunksize * 10U) >> 8U);
+		}
 		if (!result) {
 			DEBUG_WARN("Write failed!\n");
 			break;
@@ -599,22 +705,19 @@ static void rp_spi_read(
 	rp_spi_chip_select(t, RP_GPIO_QSPI_CS_DRIVE_LOW);
 
 	/* Set up the instruction */
-	const uint8_t opcode = command & RP_SPI_OPCODE_MASK;
+	const uint8_t opcode = command & SPI_FLASH_OPCODE_MASK;
 	target_mem_write32(t, RP_SSI_DR0, opcode);
 	target_mem_read32(t, RP_SSI_DR0);
 
-	const uint16_t addr_mode = command & RP_SPI_FRAME_MASK;
-	if (addr_mode == RP_SPI_FRAME_OPCODE_3B_ADDR) {
+	const size_t address_bytes = spi_flash_address_bytes(command);
+	for (size_t i = 0; i < address_bytes; ++i) {
 		/* For each byte sent here, we have to manually clean up from the controller with a read */
-		target_mem_write32(t, RP_SSI_DR0, (address >> 16U) & 0xffU);
-		target_mem_read32(t, RP_SSI_DR0);
-		target_mem_write32(t, RP_SSI_DR0, (address >> 8U) & 0xffU);
-		target_mem_read32(t, RP_SSI_DR0);
-		target_mem_write32(t, RP_SSI_DR0, address & 0xffU);
+		const size_t shift = (address_bytes - (i + 1U)) * 8U;
+		target_mem_write32(t, RP_SSI_DR0, (address >> shift) & 0xffU);
 		target_mem_read32(t, RP_SSI_DR0);
 	}
 
-	const size_t inter_length = (command & RP_SPI_INTER_MASK) >> RP_SPI_INTER_SHIFT;
+	const size_t inter_length = (command & SPI_FLASH_DUMMY_MASK) >> SPI_FLASH_DUMMY_SHIFT;
 	for (size_t i = 0; i < inter_length; ++i) {
 		/* For each byte sent here, we have to manually clean up from the controller with a read */
 		target_mem_write32(t, RP_SSI_DR0, 0);
@@ -31,6 +31,7 @@
 static bool sam_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool sam3_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool sam_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool sam_flash_wait(target_flash_s *f);
 
 static bool sam_gpnvm_get(target_s *t, uint32_t base, uint32_t *gpnvm);
 
@@ -204,6 +205,7 @@ static void sam3_add_flash(target_s *t, uint32_t eefc_base, uint32_t addr, size_
 	f->blocksize = SAM_SMALL_PAGE_SIZE;
 	f->erase = sam3_flash_erase;
 	f->write = sam_flash_write;
+	f->wait = sam_flash_wait;
 	f->writesize = SAM_SMALL_PAGE_SIZE;
 	sf->eefc_base = eefc_base;
 	sf->write_cmd = EEFC_FCR_FCMD_EWP;
@@ -224,6 +226,7 @@ static void sam_add_flash(target_s *t, uint32_t eefc_base, uint32_t addr, size_t
 	f->blocksize = SAM_LARGE_PAGE_SIZE * 8U;
 	f->erase = sam_flash_erase;
 	f->write = sam_flash_write;
+	f->wait = sam_flash_wait;
 	f->writesize = SAM_LARGE_PAGE_SIZE;
 	sf->eefc_base = eefc_base;
 	sf->write_cmd = EEFC_FCR_FCMD_WP;
@@ -479,7 +482,7 @@ bool sam3x_probe(target_s *t)
 	return false;
 }
 
-static bool sam_flash_cmd(target_s *t, uint32_t base, uint8_t cmd, uint16_t arg)
+static bool sam_flash_cmd_start(target_s *t, uint32_t base, uint8_t cmd, uint16_t arg)
 {
 	DEBUG_INFO("%s: base = 0x%08" PRIx32 " cmd = 0x%02X, arg = 0x%06X\n", __func__, base, cmd, arg);
 
@@ -487,16 +490,25 @@ static bool sam_flash_cmd(target_s *t, uint32_t base, uint8_t cmd, uint16_t arg)
 		return false;
 
 	target_mem_write32(t, EEFC_FCR(base), EEFC_FCR_FKEY | cmd | ((uint32_t)arg << 8U));
+	return !target_check_error(t);
+}
 
+/* Wait for the EEFC to go ready again, polling FSR on the probe side, and report if the command failed */
+static bool sam_flash_ready(target_s *t, uint32_t base)
+{
 	uint32_t status = 0;
-	while (!(status & EEFC_FSR_FRDY)) {
-		status = target_mem_read32(t, EEFC_FSR(base));
+	while (!target_mem_poll32(t, EEFC_FSR(base), EEFC_FSR_FRDY, EEFC_FSR_FRDY, TARGET_POLL_SLICE_MS, &status)) {
 		if (target_check_error(t))
 			return false;
 	}
 	return !(status & EEFC_FSR_ERROR);
 }
 
+static bool sam_flash_cmd(target_s *t, uint32_t base, uint8_t cmd, uint16_t arg)
+{
+	return sam_flash_cmd_start(t, base, cmd, arg) && sam_flash_ready(t, base);
+}
+
 static sam_driver_e sam_driver(target_s *t)
 {
 	if (strcmp(t->driver, "Atmel SAM3X") == 0)
@@ -523,7 +535,8 @@ static bool sam_flash_erase(target_flash_s *f, target_addr_t addr, size_t len)
 
 	for (size_t offset = 0; offset < len; offset += f->blocksize) {
 		int16_t arg = chunk | 0x1U;
-		if (!sam_flash_cmd(t, base, EEFC_FCR_FCMD_EPA, arg))
+		/* The last erase is left running, sam_flash_wait() picks it up before the flash is touched again */
+		if ((offset && !sam_flash_ready(t, base)) || !sam_flash_cmd_start(t, base, EEFC_FCR_FCMD_EPA, arg))
 			return false;
 		chunk += 8U;
 	}
@@ -549,8 +562,18 @@ static bool sam_flash_write(target_flash_s *f, target_addr_t dest, const void *s
 	const uint32_t base = sf->eefc_base;
 	const uint32_t chunk = (dest - f->start) / f->writesize;
 
+	/*
+	 * Fill the latch buffer in one go and start the page write, but don't wait for it here.
+	 * The page programs while the next one is streamed in to the probe, sam_flash_wait() then
+	 * checks it completed before the latch buffer gets reused.
+	 */
 	target_mem_write(t, dest, src, len);
-	return sam_flash_cmd(t, base, sf->write_cmd, chunk);
+	return sam_flash_cmd_start(t, base, sf->write_cmd, chunk);
+}
+
+static bool sam_flash_wait(target_flash_s *f)
+{
+	return sam_flash_ready(f->t, ((sam_flash_s *)f)->eefc_base);
 }
 
 static bool sam_gpnvm_get(target_s *t, uint32_t base, uint32_t *gpnvm)
@@ -42,7 +42,9 @@
 #include "cortexm.h"
 
 static bool samd_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
+static bool samd_flash_prepare(target_flash_s *f);
 static bool samd_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool samd_flash_done(target_flash_s *f);
 /* NB: This is not marked static on purpose as it's used by samx5x.c. */
 bool samd_mass_erase(target_s *t);
 
@@ -71,6 +73,9 @@ const command_s samd_cmd_list[] = {
 #define SAMD_ROW_SIZE  256U
 #define SAMD_PAGE_SIZE 64U
 
+/* Generous bound on a page write, which takes a few milliseconds */
+#define SAMD_PAGE_WRITE_TIMEOUT 100U
+
 /* -------------------------------------------------------------------------- */
 /* Non-Volatile Memory Controller (NVMC) Registers */
 /* -------------------------------------------------------------------------- */
@@ -95,6 +100,9 @@ const command_s samd_cmd_list[] = {
 #define SAMD_CTRLA_CMD_SSB             0x0045U
 #define SAMD_CTRLA_CMD_INVALL          0x0046U
 
+/* Control B Register (CTRLB) */
+#define SAMD_CTRLB_MANW (1U << 7U)
+
 /* Interrupt Flag Register (INTFLAG) */
 #define SAMD_NVMC_READY (1U << 0U)
 
@@ -243,6 +251,9 @@ void samd_reset(target_s *t)
 	 * XXX: Should this actually call cortexm_reset()?
 	 */
 
+	/* The core registers are about to change under us */
+	cortexm_regs_invalidate(t);
+
 	/* Read DHCSR here to clear S_RESET_ST bit before reset */
 	target_mem_read32(t, CORTEXM_DHCSR);
 
@@ -481,9 +492,11 @@ static void samd_add_flash(target_s *t, uint32_t addr, size_t length)
 	f->start = addr;
 	f->length = length;
 	f->blocksize = SAMD_ROW_SIZE;
+	f->prepare = samd_flash_prepare;
 	f->erase = samd_flash_erase;
 	f->write = samd_flash_write;
-	f->writesize = SAMD_PAGE_SIZE;
+	f->done = samd_flash_done;
+	f->writesize = SAMD_ROW_SIZE;
 	target_add_flash(t, f);
 }
 
@@ -587,7 +600,7 @@ static void samd_unlock_current_address(target_s *t)
 static bool samd_wait_nvm_ready(target_s *t)
 {
 	/* Poll for NVM Ready */
-	while ((target_mem_read32(t, SAMD_NVMC_INTFLAG) & SAMD_NVMC_READY) == 0) {
+	while (!target_mem_poll32(t, SAMD_NVMC_INTFLAG, SAMD_NVMC_READY, SAMD_NVMC_READY, TARGET_POLL_SLICE_MS, NULL)) {
 		if (target_check_error(t))
 			return false;
 	}
@@ -635,21 +648,51 @@ static bool samd_flash_erase(target_flash_s *const f, const target_addr_t addr,
 }
 
 /*
- * Write flash page by page
+ * Switch the NVMC to automatic page writes for the Flash session, so filling the last word of
+ * the page buffer starts the write without a separate command for each page
  */
-static bool samd_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
+static bool samd_flash_prepare(target_flash_s *const f)
 {
-	target_s *t = f->t;
+	target_s *const t = f->t;
+	const uint32_t ctrlb = target_mem_read32(t, SAMD_NVMC_CTRLB);
+	target_mem_write32(t, SAMD_NVMC_CTRLB, ctrlb & ~SAMD_CTRLB_MANW);
+	return !target_check_error(t);
+}
 
-	/* Write within a single page. This may be part or all of the page */
-	target_mem_write(t, dest, src, len);
+/* Return to manual page writes, which the user row handling relies on */
+static bool samd_flash_done(target_flash_s *const f)
+{
+	target_s *const t = f->t;
+	const uint32_t ctrlb = target_mem_read32(t, SAMD_NVMC_CTRLB);
+	target_mem_write32(t, SAMD_NVMC_CTRLB, ctrlb | SAMD_CTRLB_MANW);
+	return !target_check_error(t);
+}
 
-	/* Unlock */
+/*
+ * Write flash a row at a time. The row is unlocked once, then each page is streamed into the page
+ * buffer with the automatic write kicking off as its last word lands, so the only NVMC access
+ * needed per page is polling for it to finish before the next one is loaded.
+ */
+static bool samd_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
+{
+	target_s *t = f->t;
+	/*
+	 * Writes always cover whole rows, so filling each page starts it being written, after which
+	 * the NVMC has to report ready again. Run this as one loop so BMDA can hand it to the probe.
+	 */
+	const adiv5_mem_write_loop_s loop = {
+		.stride = SAMD_PAGE_SIZE,
+		.status_addr = SAMD_NVMC_INTFLAG,
+		.status_mask = SAMD_NVMC_READY,
+		.status_value = SAMD_NVMC_READY,
+		.timeout_ms = SAMD_PAGE_WRITE_TIMEOUT,
+	};
+
+	/* Unlock, pointing the NVMC at the row first as the page buffer has not been written yet */
+	target_mem_write32(t, SAMD_NVMC_ADDRESS, dest >> 1U);
 	samd_unlock_current_address(t);
 
-	/* Issue the write page command */
-	target_mem_write32(t, SAMD_NVMC_CTRLA, SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_WRITEPAGE);
-	if (!samd_wait_nvm_ready(t))
+	if (!cortexm_mem_write_loop(t, dest, src, len, ALIGN_WORD, &loop))
 		return false;
 
 	/* Lock */
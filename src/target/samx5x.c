@@ -41,7 +41,9 @@
 #include "cortexm.h"
 
 static bool samx5x_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
+static bool samx5x_flash_prepare(target_flash_s *f);
 static bool samx5x_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool samx5x_flash_done(target_flash_s *f);
 static bool samx5x_cmd_lock_flash(target_s *t, int argc, const char **argv);
 static bool samx5x_cmd_unlock_flash(target_s *t, int argc, const char **argv);
 static bool samx5x_cmd_unlock_bootprot(target_s *t, int argc, const char **argv);
@@ -86,6 +88,8 @@ const command_s samx5x_cmd_list[] = {
 /* Non-Volatile Memory Controller (NVMC) Parameters */
 #define SAMX5X_PAGE_SIZE  UINT32_C(512)
 #define SAMX5X_BLOCK_SIZE (SAMX5X_PAGE_SIZE * 16U)
+/* Flash writes are streamed a few pages at a time */
+#define SAMX5X_WRITE_SIZE (SAMX5X_PAGE_SIZE * 4U)
 
 /* Non-Volatile Memory Controller (NVMC) Registers */
 #define SAMX5X_NVMC         0x41004000U
@@ -97,6 +101,12 @@ const command_s samx5x_cmd_list[] = {
 #define SAMX5X_NVMC_ADDRESS (SAMX5X_NVMC + 0x14U)
 #define SAMX5X_NVMC_RUNLOCK (SAMX5X_NVMC + 0x18U)
 
+/* Control A Register (CTRLA) */
+#define SAMX5X_CTRLA_WMODE_MASK (3U << 4U)
+#define SAMX5X_CTRLA_WMODE_MAN  (0U << 4U)
+#define SAMX5X_CTRLA_WMODE_AQW  (2U << 4U)
+#define SAMX5X_CTRLA_WMODE_AP   (3U << 4U)
+
 /* Control B Register (CTRLB) */
 #define SAMX5X_CTRLB_CMD_KEY             0xa500U
 #define SAMX5X_CTRLB_CMD_ERASEPAGE       0x0000U
@@ -304,8 +314,10 @@ static void samx5x_add_flash(target_s *t, uint32_t addr, size_t length, size_t e
 	f->start = addr;
 	f->length = length;
 	f->blocksize = erase_block_size;
+	f->prepare = samx5x_flash_prepare;
 	f->erase = samx5x_flash_erase;
 	f->write = samx5x_flash_write;
+	f->done = samx5x_flash_done;
 	f->writesize = write_page_size;
 	target_add_flash(t, f);
 }
@@ -363,15 +375,15 @@ bool samx5x_probe(target_s *t)
 	default:
 	case 18:
 		target_add_ram(t, 0x20000000, 0x20000);
-		samx5x_add_flash(t, 0x00000000, 0x40000, SAMX5X_BLOCK_SIZE, SAMX5X_PAGE_SIZE);
+		samx5x_add_flash(t, 0x00000000, 0x40000, SAMX5X_BLOCK_SIZE, SAMX5X_WRITE_SIZE);
 		break;
 	case 19:
 		target_add_ram(t, 0x20000000, 0x30000);
-		samx5x_add_flash(t, 0x00000000, 0x80000, SAMX5X_BLOCK_SIZE, SAMX5X_PAGE_SIZE);
+		samx5x_add_flash(t, 0x00000000, 0x80000, SAMX5X_BLOCK_SIZE, SAMX5X_WRITE_SIZE);
 		break;
 	case 20:
 		target_add_ram(t, 0x20000000, 0x40000);
-		samx5x_add_flash(t, 0x00000000, 0x100000, SAMX5X_BLOCK_SIZE, SAMX5X_PAGE_SIZE);
+		samx5x_add_flash(t, 0x00000000, 0x100000, SAMX5X_BLOCK_SIZE, SAMX5X_WRITE_SIZE);
 		break;
 	}
 
@@ -503,10 +515,59 @@ static bool samx5x_flash_erase(target_flash_s *f, target_addr_t addr, size_t len
 	return true;
 }
 
-/* Write flash page by page */
+static bool samx5x_set_write_mode(target_s *const t, const uint16_t mode)
+{
+	const uint16_t ctrla = target_mem_read16(t, SAMX5X_NVMC_CTRLA);
+	target_mem_write16(t, SAMX5X_NVMC_CTRLA, (ctrla & ~SAMX5X_CTRLA_WMODE_MASK) | mode);
+	return !target_check_error(t);
+}
+
+/*
+ * Switch the NVMC to automatic page writes for the Flash session, so filling the last word of
+ * the page buffer starts the write without a separate command for each page
+ */
+static bool samx5x_flash_prepare(target_flash_s *const f)
+{
+	return samx5x_set_write_mode(f->t, SAMX5X_CTRLA_WMODE_AP);
+}
+
+/* Return to manual writes, which is what the part comes out of reset with */
+static bool samx5x_flash_done(target_flash_s *const f)
+{
+	return samx5x_set_write_mode(f->t, SAMX5X_CTRLA_WMODE_MAN);
+}
+
+/*
+ * Poll for the NVMC to go ready. INTFLAG and STATUS sit next to each other, so one 32-bit read
+ * picks up both the ready bit and any error flags.
+ */
+static bool samx5x_wait_nvm_ready(target_s *const t)
+{
+	while (true) {
+		const uint32_t flags = target_mem_read32(t, SAMX5X_NVMC_INTFLAG);
+		if (target_check_error(t))
+			return false;
+		const uint16_t errs = flags &
+			(SAMX5X_INTFLAG_ADDRE | SAMX5X_INTFLAG_PROGE | SAMX5X_INTFLAG_LOCKE | SAMX5X_INTFLAG_NVME);
+		if (errs) {
+			DEBUG_WARN("NVM error(s) detected:");
+			samx5x_print_nvm_error(errs);
+			return false;
+		}
+		if ((flags >> 16U) & SAMX5X_STATUS_READY)
+			return true;
+	}
+}
+
+/*
+ * Write flash a few pages at a time. The region is unlocked once, then each page is streamed into
+ * the page buffer with the automatic write kicking off as its last word lands, so the only NVMC
+ * access needed per page is a single combined status read until it finishes.
+ */
 static bool samx5x_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
 {
 	target_s *t = f->t;
+	const uint8_t *const data = (const uint8_t *)src;
 	const uint16_t errs = samx5x_read_nvm_error(t);
 	if (errs) {
 		DEBUG_INFO(NVM_ERROR_BITS_MSG, "write", dest, (uint32_t)len);
@@ -514,37 +575,29 @@ static bool samx5x_flash_write(target_flash_s *f, target_addr_t dest, const void
 		samx5x_clear_nvm_error(t);
 	}
 
-	bool error = false;
 	/* Unlock */
 	target_mem_write32(t, SAMX5X_NVMC_ADDRESS, dest);
 	samx5x_unlock_current_address(t);
 
-	/* Write within a single page. This may be part or all of the page */
-	target_mem_write(t, dest, src, len);
-
-	/* Issue the write page command */
-	target_mem_write32(t, SAMX5X_NVMC_CTRLB, SAMX5X_CTRLB_CMD_KEY | SAMX5X_CTRLB_CMD_WRITEPAGE);
-
-	/* Poll for NVM Ready */
-	while ((target_mem_read32(t, SAMX5X_NVMC_STATUS) & SAMX5X_STATUS_READY) == 0) {
-		if (target_check_error(t) || samx5x_check_nvm_error(t)) {
-			error = true;
-			break;
+	for (size_t offset = 0; offset < len; offset += SAMX5X_PAGE_SIZE) {
+		/* Writes always cover whole pages, so this fills the page and starts it being written */
+		target_mem_write(t, dest + offset, data + offset, SAMX5X_PAGE_SIZE);
+		if (!samx5x_wait_nvm_ready(t)) {
+			DEBUG_WARN("Error writing flash page at 0x%08" PRIx32 " (len 0x%08" PRIx32 ")\n", (uint32_t)(dest + offset),
+				(uint32_t)SAMX5X_PAGE_SIZE);
+			return false;
 		}
 	}
 
-	if (error || target_check_error(t) || samx5x_check_nvm_error(t)) {
-		DEBUG_WARN("Error writing flash page at 0x%08" PRIx32 " (len 0x%08" PRIx32 ")\n", dest, (uint32_t)len);
-		return false;
-	}
-
 	/* Lock */
 	samx5x_lock_current_address(t);
 	return true;
 }
 
 /**
- * Erase and write the NVM user page
+ * Erase and write the NVM user page. It can only be programmed a quad word at a time, so the
+ * NVMC is put in automatic quad word mode for the write back: each 16 byte write starts its own
+ * programming cycle and the only other access needed per quad word is a combined status read.
  */
 static int samx5x_write_user_page(target_s *t, uint8_t *buffer)
 {
@@ -561,25 +614,23 @@ static int samx5x_write_user_page(target_s *t, uint8_t *buffer)
 	target_mem_write32(t, SAMX5X_NVMC_CTRLB, SAMX5X_CTRLB_CMD_KEY | SAMX5X_CTRLB_CMD_ERASEPAGE);
 
 	/* Poll for NVM Ready */
-	while ((target_mem_read32(t, SAMX5X_NVMC_STATUS) & SAMX5X_STATUS_READY) == 0) {
-		if (target_check_error(t) || samx5x_check_nvm_error(t))
-			return -1;
-	}
+	if (!samx5x_wait_nvm_ready(t))
+		return -1;
 
 	/* Write back */
+	if (!samx5x_set_write_mode(t, SAMX5X_CTRLA_WMODE_AQW))
+		return -2;
+	int result = 0;
 	for (uint32_t offset = 0; offset < SAMX5X_PAGE_SIZE; offset += 16U) {
 		target_mem_write(t, SAMX5X_NVM_USER_PAGE + offset, buffer + offset, 16);
-
-		/* Issue the write page command */
-		target_mem_write32(t, SAMX5X_NVMC_CTRLB, SAMX5X_CTRLB_CMD_KEY | SAMX5X_CTRLB_CMD_WRITEQUADWORD);
-
-		/* Poll for NVM Ready */
-		while ((target_mem_read32(t, SAMX5X_NVMC_STATUS) & SAMX5X_STATUS_READY) == 0) {
-			if (target_check_error(t) || samx5x_check_nvm_error(t))
-				return -2;
+		if (!samx5x_wait_nvm_ready(t)) {
+			result = -2;
+			break;
 		}
 	}
-	return 0;
+	if (!samx5x_set_write_mode(t, SAMX5X_CTRLA_WMODE_MAN))
+		return -2;
+	return result;
 }
 
 static int samx5x_update_user_word(target_s *t, uint32_t addr, uint32_t value, uint32_t *value_written, bool force)
@@ -64,12 +64,18 @@ static inline size_t sfdp_memory_density_to_capacity_bits(const uint8_t *const d
 		return SFDP_DENSITY_VALUE(density) + 1U;
 }
 
+static inline void sfdp_read(
+	target_s *const t, const uint32_t address, void *const buffer, const size_t length, const spi_read_func spi_read)
+{
+	spi_read(t, SPI_FLASH_CMD_READ_SFDP, address, buffer, length);
+}
+
 static spi_parameters_s sfdp_read_basic_parameter_table(
-	target_s *const t, const uint32_t address, const size_t length, const read_sfdp_func sfdp_read)
+	target_s *const t, const uint32_t address, const size_t length, const spi_read_func spi_read)
 {
 	sfdp_basic_parameter_table_s parameter_table;
 	const size_t table_length = MIN(sizeof(sfdp_basic_parameter_table_s), length);
-	sfdp_read(t, address, &parameter_table, table_length);
+	sfdp_read(t, address, &parameter_table, table_length, spi_read);
 
 	spi_parameters_s result;
 	result.capacity = sfdp_memory_density_to_capacity_bits(parameter_table.memory_density) >> 3U;
@@ -82,26 +88,31 @@ static spi_parameters_s sfdp_read_basic_parameter_table(
 		}
 	}
 	result.page_size = SFDP_PAGE_SIZE(parameter_table);
+	result.address_mode = SFDP_ADDRESS_MODE(parameter_table);
+	/* Mode 3 is reserved, so treat it the same as a device that only understands 3 byte addresses */
+	if (result.address_mode > SFDP_ADDRESS_MODE_4B)
+		result.address_mode = SFDP_ADDRESS_MODE_3B;
 	return result;
 }
 
-bool sfdp_read_parameters(target_s *const t, spi_parameters_s *params, const read_sfdp_func sfdp_read)
+bool sfdp_read_parameters(target_s *const t, spi_parameters_s *params, const spi_read_func spi_read)
 {
 	sfdp_header_s header;
-	sfdp_read(t, SFDP_HEADER_ADDRESS, &header, sizeof(header));
+	sfdp_read(t, SFDP_HEADER_ADDRESS, &header, sizeof(header), spi_read);
 	sfdp_debug_print(SFDP_HEADER_ADDRESS, &header, sizeof(header));
 	if (memcmp(header.magic, SFDP_MAGIC, 4) != 0)
 		return false;
 
 	for (size_t i = 0; i <= header.parameter_headers_count; ++i) {
 		sfdp_parameter_table_header_s table_header;
-		sfdp_read(t, SFDP_TABLE_HEADER_ADDRESS + (sizeof(table_header) * i), &table_header, sizeof(table_header));
+		sfdp_read(
+			t, SFDP_TABLE_HEADER_ADDRESS + (sizeof(table_header) * i), &table_header, sizeof(table_header), spi_read);
 		sfdp_debug_print(SFDP_TABLE_HEADER_ADDRESS + (sizeof(table_header) * i), &table_header, sizeof(table_header));
 		const uint16_t jedec_parameter_id = SFDP_JEDEC_PARAMETER_ID(table_header);
 		if (jedec_parameter_id == SFDP_BASIC_SPI_PARAMETER_TABLE) {
 			const uint32_t table_address = SFDP_TABLE_ADDRESS(table_header);
 			const uint16_t table_length = table_header.table_length_in_u32s * 4U;
-			*params = sfdp_read_basic_parameter_table(t, table_address, table_length, sfdp_read);
+			*params = sfdp_read_basic_parameter_table(t, table_address, table_length, spi_read);
 			return true;
 		}
 	}
@@ -39,22 +39,20 @@
 #include <stdbool.h>
 
 #include "target.h"
+#include "spi.h"
 
-typedef struct spi_flash_id {
-	uint8_t manufacturer;
-	uint8_t type;
-	uint8_t capacity;
-} spi_flash_id_s;
+#define SFDP_ADDRESS_MODE_3B    0U
+#define SFDP_ADDRESS_MODE_3B_4B 1U
+#define SFDP_ADDRESS_MODE_4B    2U
 
 typedef struct spi_parameters {
 	uint32_t page_size;
 	uint32_t sector_size;
 	size_t capacity;
 	uint8_t sector_erase_opcode;
+	uint8_t address_mode;
 } spi_parameters_s;
 
-typedef void (*read_sfdp_func)(target_s *t, uint32_t address, void *buffer, size_t length);
-
-bool sfdp_read_parameters(target_s *t, spi_parameters_s *params, read_sfdp_func sfdp_read);
+bool sfdp_read_parameters(target_s *t, spi_parameters_s *params, spi_read_func spi_read);
 
 #endif /* TARGET_SFDP_H */
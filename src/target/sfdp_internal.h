@@ -52,6 +52,8 @@
 #define SFDP_DENSITY_VALUE(density) \
 	((((density)[3] & 0x7fU) << 24U) | ((density)[2] << 16U) | ((density)[1] << 8U) | (density)[0])
 
+#define SFDP_ADDRESS_MODE(parameter_table) (((parameter_table).value2 >> 1U) & 3U)
+
 #define SFDP_ERASE_TYPES            4U
 #define SFDP_ERASE_SIZE(erase_type) (1U << ((erase_type)->erase_size_exponent))
 #define SFDP_PAGE_SIZE(parameter_table) \
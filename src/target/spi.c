@@ -0,0 +1,208 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * Written by Rachel Mant <git@dragonmux.network>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file implements a generic SPI Flash (SPI-NOR) layer using the parameters discovered via SFDP.
+ * Targets provide a transport (their SPI/QSPI/SPIFI controller) through the read, write and
+ * run_command functions, and this layer takes care of the Flash device side of programming.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "spi.h"
+#include "sfdp.h"
+
+/* Typical page program takes <1ms and a 64kiB block erase <1s, give plenty of headroom on both */
+#define SPI_FLASH_PROGRAM_TIMEOUT 100U
+#define SPI_FLASH_ERASE_TIMEOUT   3000U
+
+static bool spi_flash_erase(target_flash_s *flash, target_addr_t addr, size_t length);
+static bool spi_flash_write(target_flash_s *flash, target_addr_t dest, const void *src, size_t length);
+
+static uint8_t spi_flash_4b_erase_opcode(const uint8_t opcode)
+{
+	switch (opcode) {
+	case SPI_FLASH_OPCODE_SECTOR_ERASE:
+		return SPI_FLASH_OPCODE_4B_SECTOR_ERASE;
+	case SPI_FLASH_OPCODE_BLOCK32K_ERASE:
+		return SPI_FLASH_OPCODE_4B_BLOCK32K_ERASE;
+	case SPI_FLASH_OPCODE_BLOCK64K_ERASE:
+		return SPI_FLASH_OPCODE_4B_BLOCK64K_ERASE;
+	default:
+		return 0U;
+	}
+}
+
+/* Pick the page program and erase commands to use based on how big the device is and how it is addressed */
+static size_t spi_flash_setup_commands(spi_flash_s *const flash, const spi_parameters_s *const params)
+{
+	flash->page_program_command = SPI_FLASH_CMD_PAGE_PROGRAM;
+	flash->sector_erase_command = SPI_FLASH_CMD_SECTOR_ERASE | SPI_FLASH_OPCODE(params->sector_erase_opcode);
+	flash->read_command = SPI_FLASH_CMD_FAST_READ;
+	if (params->address_mode == SFDP_ADDRESS_MODE_4B) {
+		/* The device is permanently in 4 byte address mode, so the usual opcodes take 4 byte addresses */
+		flash->page_program_command = (SPI_FLASH_CMD_PAGE_PROGRAM & ~SPI_FLASH_OPCODE_MODE_MASK) |
+			SPI_FLASH_OPCODE_4B_ADDR;
+		flash->sector_erase_command = SPI_FLASH_CMD_4B_SECTOR_ERASE | SPI_FLASH_OPCODE(params->sector_erase_opcode);
+		flash->read_command = (SPI_FLASH_CMD_FAST_READ & ~SPI_FLASH_OPCODE_MODE_MASK) | SPI_FLASH_OPCODE_4B_ADDR;
+		return params->capacity;
+	}
+	if (params->capacity <= SPI_FLASH_3B_ADDR_LIMIT)
+		return params->capacity;
+
+	/*
+	 * The device is bigger than 3 byte addresses can reach. Rather than switch the device into 4 byte
+	 * address mode, which would break any XIP controller in front of it, use the dedicated 4 byte address
+	 * opcodes if the device has them and otherwise only expose the first 16MiB.
+	 */
+	const uint8_t erase_opcode = spi_flash_4b_erase_opcode(params->sector_erase_opcode);
+	if (params->address_mode != SFDP_ADDRESS_MODE_3B_4B || !erase_opcode) {
+		DEBUG_WARN("SPI Flash has no 4 byte address commands, limiting to the first 16MiB\n");
+		return SPI_FLASH_3B_ADDR_LIMIT;
+	}
+	flash->page_program_command = SPI_FLASH_CMD_4B_PAGE_PROGRAM;
+	flash->sector_erase_command = SPI_FLASH_CMD_4B_SECTOR_ERASE | SPI_FLASH_OPCODE(erase_opcode);
+	flash->read_command = SPI_FLASH_CMD_4B_FAST_READ;
+	return params->capacity;
+}
+
+spi_flash_s *bmp_spi_add_flash(target_s *const t, const target_addr_t begin, const size_t length,
+	const spi_read_func spi_read, const spi_write_func spi_write, const spi_run_command_func spi_run_command)
+{
+	spi_flash_s *const spi_flash = calloc(1, sizeof(*spi_flash));
+	if (!spi_flash) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return NULL;
+	}
+
+	spi_parameters_s spi_parameters;
+	if (!sfdp_read_parameters(t, &spi_parameters, spi_read)) {
+		/* SFDP readout failed, so make some assumptions and hope for the best. */
+		spi_parameters.page_size = 256U;
+		spi_parameters.sector_size = 4096U;
+		spi_parameters.capacity = length;
+		spi_parameters.sector_erase_opcode = SPI_FLASH_OPCODE_SECTOR_ERASE;
+		spi_parameters.address_mode = SFDP_ADDRESS_MODE_3B;
+	}
+	spi_flash->read = spi_read;
+	spi_flash->write = spi_write;
+	spi_flash->run_command = spi_run_command;
+	spi_flash->page_size = spi_parameters.page_size;
+	const size_t capacity = spi_flash_setup_commands(spi_flash, &spi_parameters);
+	DEBUG_INFO("SPI Flash: %" PRIu32 " bytes, %" PRIu32 " byte pages, %u byte addresses\n", (uint32_t)capacity,
+		spi_flash->page_size, (unsigned)spi_flash_address_bytes(spi_flash->page_program_command));
+
+	target_flash_s *const flash = &spi_flash->flash;
+	flash->start = begin;
+	flash->length = MIN(length, capacity);
+	flash->blocksize = spi_parameters.sector_size;
+	flash->write = spi_flash_write;
+	flash->erase = spi_flash_erase;
+	flash->erased = 0xffU;
+	target_add_flash(t, flash);
+	return spi_flash;
+}
+
+static inline uint8_t spi_flash_read_status(const spi_flash_s *const flash)
+{
+	uint8_t status = 0;
+	flash->read(flash->flash.t, SPI_FLASH_CMD_READ_STATUS, 0U, &status, sizeof(status));
+	return status;
+}
+
+static bool spi_flash_write_enable(const spi_flash_s *const flash)
+{
+	flash->run_command(flash->flash.t, SPI_FLASH_CMD_WRITE_ENABLE, 0U);
+	return spi_flash_read_status(flash) & SPI_FLASH_STATUS_WRITE_ENABLED;
+}
+
+static bool spi_flash_wait_ready(
+	const spi_flash_s *const flash, const uint32_t timeout_ms, platform_timeout_s *const print_progress)
+{
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, timeout_ms);
+	while (spi_flash_read_status(flash) & SPI_FLASH_STATUS_BUSY) {
+		if (print_progress)
+			target_print_progress(print_progress);
+		else if (platform_timeout_is_expired(&timeout)) {
+			DEBUG_WARN("SPI Flash operation timed out\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool spi_flash_erase(target_flash_s *const flash, const target_addr_t addr, const size_t length)
+{
+	const spi_flash_s *const spi_flash = (const spi_flash_s *)flash;
+	const target_addr_t begin = addr - flash->start;
+	for (size_t offset = 0; offset < length; offset += flash->blocksize) {
+		if (!spi_flash_write_enable(spi_flash))
+			return false;
+		spi_flash->run_command(flash->t, spi_flash->sector_erase_command, begin + offset);
+		if (!spi_flash_wait_ready(spi_flash, SPI_FLASH_ERASE_TIMEOUT, NULL))
+			return false;
+	}
+	return true;
+}
+
+static bool spi_flash_write(
+	target_flash_s *const flash, const target_addr_t dest, const void *const src, const size_t length)
+{
+	const spi_flash_s *const spi_flash = (const spi_flash_s *)flash;
+	const target_addr_t begin = dest - flash->start;
+	const uint8_t *const buffer = (const uint8_t *)src;
+	for (size_t offset = 0; offset < length;) {
+		if (!spi_flash_write_enable(spi_flash))
+			return false;
+		/* Page programs wrap within the page, so never cross a page boundary in one go */
+		const target_addr_t address = begin + offset;
+		const size_t amount = MIN(length - offset, spi_flash->page_size - (address & (spi_flash->page_size - 1U)));
+		spi_flash->write(flash->t, spi_flash->page_program_command, address, buffer + offset, amount);
+		if (!spi_flash_wait_ready(spi_flash, SPI_FLASH_PROGRAM_TIMEOUT, NULL))
+			return false;
+		offset += amount;
+	}
+	return true;
+}
+
+bool bmp_spi_mass_erase(const spi_flash_s *const flash)
+{
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, 500);
+	if (!spi_flash_write_enable(flash))
+		return false;
+	flash->run_command(flash->flash.t, SPI_FLASH_CMD_CHIP_ERASE, 0U);
+	return spi_flash_wait_ready(flash, 0U, &timeout);
+}
@@ -21,9 +21,46 @@
 #ifndef TARGET_STM32_COMMON_H
 #define TARGET_STM32_COMMON_H
 
+#include <strings.h>
 #include "general.h"
 #include "target_internal.h"
 #include "adiv5.h"
+#include "cortexm.h"
+
+/*
+ * Flash controller register script: unlock, program and lock sequences are collected into a
+ * queue and handed to the probe as one batch instead of costing a round trip per register.
+ * Results of reads are only valid once stm32_regs_run() has returned.
+ */
+#define STM32_REGS_DEPTH 16U
+
+typedef struct stm32_regs {
+	adiv5_access_port_s *ap;
+	adiv5_queue_s queue;
+	adiv5_queue_entry_s entries[STM32_REGS_DEPTH];
+} stm32_regs_s;
+
+static inline void stm32_regs_init(stm32_regs_s *const regs, target_s *const t)
+{
+	regs->ap = cortexm_ap(t);
+	adiv5_queue_init(&regs->queue, regs->ap->dp, regs->entries, STM32_REGS_DEPTH);
+}
+
+static inline void stm32_regs_read32(stm32_regs_s *const regs, const uint32_t addr, uint32_t *const result)
+{
+	adiv5_queue_mem_read32(&regs->queue, regs->ap, addr, result);
+}
+
+static inline void stm32_regs_write32(stm32_regs_s *const regs, const uint32_t addr, const uint32_t value)
+{
+	adiv5_queue_mem_write32(&regs->queue, regs->ap, addr, value);
+}
+
+/* Issue everything queued so far, returning false if any access faulted */
+static inline bool stm32_regs_run(stm32_regs_s *const regs)
+{
+	return adiv5_queue_run(&regs->queue);
+}
 
 static inline const char *stm32_psize_to_string(const align_e psize)
 {
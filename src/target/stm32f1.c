@@ -39,6 +39,8 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "stm32_common.h"
+#include "flash_loader.h"
 
 static bool stm32f1_cmd_option(target_s *t, int argc, const char **argv);
 
@@ -49,6 +51,7 @@ const command_s stm32f1_cmd_list[] = {
 
 static bool stm32f1_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool stm32f1_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool stm32f1_flash_done(target_flash_s *f);
 static bool stm32f1_mass_erase(target_s *t);
 
 /* Flash Program ad Erase Controller Register Map */
@@ -104,19 +107,26 @@ static bool stm32f1_mass_erase(target_s *t);
 #define DBGMCU_IDCODE_MM32L0 0x40013400U
 #define DBGMCU_IDCODE_MM32F3 0x40007080U
 
+typedef struct stm32f1_flash {
+	target_flash_s f;
+	flash_loader_s loader;
+} stm32f1_flash_s;
+
 static void stm32f1_add_flash(target_s *t, uint32_t addr, size_t length, size_t erasesize)
 {
-	target_flash_s *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
+	stm32f1_flash_s *sf = calloc(1, sizeof(*sf));
+	if (!sf) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	target_flash_s *f = &sf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = erasesize;
 	f->erase = stm32f1_flash_erase;
 	f->write = stm32f1_flash_write;
+	f->done = stm32f1_flash_done;
 	f->writesize = erasesize;
 	f->erased = 0xff;
 	target_add_flash(t, f);
@@ -308,6 +318,7 @@ void mm32l0_mem_write_sized(adiv5_access_port_s *ap, uint32_t dest, const void *
 	}
 	/* Make sure this write is complete by doing a dummy read */
 	adiv5_dp_read(ap->dp, ADIV5_DP_RDBUFF);
+	adiv5_ap_shadow_invalidate(ap);
 }
 
 /* Identify MM32 devices (Cortex-M0) */
@@ -500,9 +511,15 @@ bool stm32f1_probe(target_s *t)
 
 static bool stm32f1_flash_unlock(target_s *t, uint32_t bank_offset)
 {
-	target_mem_write32(t, FLASH_KEYR + bank_offset, KEY1);
-	target_mem_write32(t, FLASH_KEYR + bank_offset, KEY2);
-	uint32_t cr = target_mem_read32(t, FLASH_CR);
+	/* Key the controller and check the result in a single batch */
+	stm32_regs_s regs;
+	stm32_regs_init(&regs, t);
+	uint32_t cr = FLASH_CR_LOCK;
+	stm32_regs_write32(&regs, FLASH_KEYR + bank_offset, KEY1);
+	stm32_regs_write32(&regs, FLASH_KEYR + bank_offset, KEY2);
+	stm32_regs_read32(&regs, FLASH_CR, &cr);
+	if (!stm32_regs_run(&regs))
+		cr = FLASH_CR_LOCK;
 	if (cr & FLASH_CR_LOCK)
 		DEBUG_WARN("unlock failed, cr: 0x%08" PRIx32 "\n", cr);
 	return !(cr & FLASH_CR_LOCK);
@@ -551,6 +568,10 @@ static bool stm32f1_flash_erase(target_flash_s *flash, target_addr_t addr, size_
 	target_s *target = flash->t;
 	target_addr_t end = addr + len - 1U;
 
+	/* The loader has to be done with any programming before the controller can be used for erasing */
+	if (!flash_loader_stop(flash, &((stm32f1_flash_s *)flash)->loader))
+		return false;
+
 	/* Unlocked an appropriate flash bank */
 	if ((target->part_id == 0x430U && end >= FLASH_BANK_SPLIT && !stm32f1_flash_unlock(target, FLASH_BANK2_OFFSET)) ||
 		(addr < FLASH_BANK_SPLIT && !stm32f1_flash_unlock(target, 0)))
@@ -583,11 +604,23 @@ static size_t stm32f1_bank1_length(target_addr_t addr, size_t len)
 	return len;
 }
 
+static bool stm32f1_flash_loader_start(target_flash_s *const flash)
+{
+	/* Halfword programming, with the bank 2 registers reached through the per-buffer register offset */
+	const flash_loader_config_s config = {FLASH_CR, FLASH_CR_PG, FLASH_SR, FLASH_SR_BSY, SR_ERROR_MASK, 2U};
+	return flash_loader_start(flash, &((stm32f1_flash_s *)flash)->loader, &config);
+}
+
 static bool stm32f1_flash_write(target_flash_s *flash, target_addr_t dest, const void *src, size_t len)
 {
 	target_s *target = flash->t;
 	const size_t offset = stm32f1_bank1_length(dest, len);
 
+	/* Hand buffers that sit within a single bank to the SRAM loader, if it can run on this part */
+	if ((offset == len || (target->part_id == 0x430U && offset == 0)) && stm32f1_flash_loader_start(flash))
+		return flash_loader_write(
+			flash, &((stm32f1_flash_s *)flash)->loader, dest, src, len, stm32f1_bank_offset_for(dest));
+
 	/* Start by writing any bank 1 data */
 	if (offset) {
 		stm32f1_flash_clear_eop(target, FLASH_BANK1_OFFSET);
@@ -617,7 +650,12 @@ static bool stm32f1_flash_write(target_flash_s *flash, target_addr_t dest, const
 	return true;
 }
 
-static bool stm32f1_mass_erase_bank(target_s *const t, const uint32_t bank_offset, platform_timeout_s *const timeout)
+static bool stm32f1_flash_done(target_flash_s *const flash)
+{
+	return flash_loader_stop(flash, &((stm32f1_flash_s *)flash)->loader);
+}
+
+static bool stm32f1_mass_erase_bank(target_s *const t, const uint32_t bank_offset)
 {
 	/* Unlock the bank */
 	if (!stm32f1_flash_unlock(t, bank_offset))
@@ -627,9 +665,7 @@ static bool stm32f1_mass_erase_bank(target_s *const t, const uint32_t bank_offse
 	/* Flash mass erase start instruction */
 	target_mem_write32(t, FLASH_CR + bank_offset, FLASH_CR_MER);
 	target_mem_write32(t, FLASH_CR + bank_offset, FLASH_CR_STRT | FLASH_CR_MER);
-
-	/* Wait for completion or an error */
-	return stm32f1_flash_busy_wait(t, bank_offset, timeout);
+	return true;
 }
 
 static bool stm32f1_mass_erase(target_s *t)
@@ -637,15 +673,18 @@ static bool stm32f1_mass_erase(target_s *t)
 	if (!stm32f1_flash_unlock(t, 0))
 		return false;
 
+	/* If we're on a part that has a second bank, it has its own controller, so erase both banks in parallel */
+	const bool dual_bank = t->part_id == 0x430U;
+	if (!stm32f1_mass_erase_bank(t, FLASH_BANK1_OFFSET) ||
+		(dual_bank && !stm32f1_mass_erase_bank(t, FLASH_BANK2_OFFSET)))
+		return false;
+
 	platform_timeout_s timeout;
 	platform_timeout_set(&timeout, 500);
-	if (!stm32f1_mass_erase_bank(t, FLASH_BANK1_OFFSET, &timeout))
+	/* Wait for completion or an error, the second bank will be done by the time the first is or shortly after */
+	if (!stm32f1_flash_busy_wait(t, FLASH_BANK1_OFFSET, &timeout))
 		return false;
-
-	/* If we're on a part that has a second bank, mass erase that bank too */
-	if (t->part_id == 0x430U)
-		return stm32f1_mass_erase_bank(t, FLASH_BANK2_OFFSET, &timeout);
-	return true;
+	return !dual_bank || stm32f1_flash_busy_wait(t, FLASH_BANK2_OFFSET, &timeout);
 }
 
 static bool stm32f1_option_erase(target_s *t)
@@ -689,11 +728,16 @@ static bool stm32f1_option_write(target_s *const t, const uint32_t addr, const u
 
 	uint16_t opt_val[8];
 	/* Retrieve old values */
-	for (size_t i = 0U; i < 16U; i += 4U) {
-		const size_t offset = i >> 1U;
-		uint32_t val = target_mem_read32(t, FLASH_OBP_RDP + i);
-		opt_val[offset] = val & 0xffffU;
-		opt_val[offset + 1U] = val >> 16U;
+	uint32_t opt_words[4];
+	stm32_regs_s regs;
+	stm32_regs_init(&regs, t);
+	for (size_t i = 0U; i < 4U; ++i)
+		stm32_regs_read32(&regs, FLASH_OBP_RDP + (i * 4U), &opt_words[i]);
+	if (!stm32_regs_run(&regs))
+		return false;
+	for (size_t i = 0U; i < 4U; ++i) {
+		opt_val[i * 2U] = opt_words[i] & 0xffffU;
+		opt_val[(i * 2U) + 1U] = opt_words[i] >> 16U;
 	}
 
 	if (opt_val[index] == value)
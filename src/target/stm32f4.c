@@ -38,13 +38,14 @@
 #include "target_internal.h"
 #include "cortexm.h"
 #include "stm32_common.h"
+#include "flash_loader.h"
 
 static bool stm32f4_cmd_option(target_s *t, int argc, const char **argv);
 static bool stm32f4_cmd_psize(target_s *t, int argc, const char **argv);
 
 const command_s stm32f4_cmd_list[] = {
 	{"option", stm32f4_cmd_option, "Manipulate option bytes"},
-	{"psize", stm32f4_cmd_psize, "Configure flash write parallelism: (x8|x16|x32(default)|x64)"},
+	{"psize", stm32f4_cmd_psize, "Configure flash write parallelism: (auto(default) (vpp)|x8|x16|x32|x64)"},
 	{NULL, NULL, NULL},
 };
 
@@ -52,6 +53,8 @@ static bool stm32f4_attach(target_s *t);
 static void stm32f4_detach(target_s *t);
 static bool stm32f4_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool stm32f4_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool stm32f4_flash_wait(target_flash_s *f);
+static bool stm32f4_flash_done(target_flash_s *f);
 static bool stm32f4_mass_erase(target_s *t);
 
 /* Flash Program and Erase Controller Register Map */
@@ -117,12 +120,24 @@ typedef struct stm32f4_flash {
 	align_e psize;
 	uint8_t base_sector;
 	uint8_t bank_split;
+	flash_loader_s loader;
 } stm32f4_flash_s;
 
 typedef struct stm32f4_priv {
 	uint32_t dbgmcu_cr;
+	/* Pick the parallelism from the target voltage, and whether the fixture drives VPP to allow x64 */
+	bool psize_auto;
+	bool vpp;
 } stm32f4_priv_s;
 
+/*
+ * Lowest target voltages (in tenths of a volt) for each parallelism, from the program/erase
+ * parallelism tables of RM0090, RM0385 and friends (x32 from 2.7V, x16 from 2.1V), with a tenth
+ * of a volt of margin for the probe's measurement. x64 additionally needs VPP on its pin.
+ */
+#define STM32F4_PSIZE32_MIN_VOLTAGE 28U
+#define STM32F4_PSIZE16_MIN_VOLTAGE 22U
+
 #define ID_STM32F20X  0x411U
 #define ID_STM32F40X  0x413U
 #define ID_STM32F42X  0x419U
@@ -158,6 +173,8 @@ static void stm32f4_add_flash(target_s *const t, const uint32_t addr, const size
 	f->blocksize = blocksize;
 	f->erase = stm32f4_flash_erase;
 	f->write = stm32f4_flash_write;
+	f->wait = stm32f4_flash_wait;
+	f->done = stm32f4_flash_done;
 	f->writesize = 1024;
 	f->erased = 0xffU;
 	sf->base_sector = base_sector;
@@ -305,6 +322,67 @@ static uint32_t stm32f4_remaining_bank_length(const uint32_t bank_length, const
 	return 0;
 }
 
+/* The probe's reading of the target voltage in tenths of a volt, 0 if it can't tell */
+static uint32_t stm32f4_target_voltage(void)
+{
+	const char *voltage = platform_target_voltage();
+	if (!voltage || *voltage < '0' || *voltage > '9')
+		return 0;
+	uint32_t tenths = 0;
+	for (; *voltage >= '0' && *voltage <= '9'; ++voltage)
+		tenths = (tenths * 10U) + (uint32_t)(*voltage - '0');
+	tenths *= 10U;
+	if (voltage[0] == '.' && voltage[1] >= '0' && voltage[1] <= '9')
+		tenths += (uint32_t)(voltage[1] - '0');
+	return tenths;
+}
+
+static align_e stm32f4_psize_get(target_s *const t)
+{
+	align_e psize = ALIGN_WORD;
+	/*
+	 * XXX: What is this and why does it exist?
+	 * A dry-run walk-through says it'll pull out the psize for the Flash region added first by stm32f4_attach()
+	 * because all Flash regions added by stm32f4_add_flash match the if condition. This looks redundant and wrong.
+	 */
+	for (target_flash_s *f = t->flash; f; f = f->next) {
+		if (f->write == stm32f4_flash_write)
+			psize = ((stm32f4_flash_s *)f)->psize;
+	}
+	return psize;
+}
+
+static void stm32f4_psize_set(target_s *const t, const align_e psize)
+{
+	for (target_flash_s *f = t->flash; f; f = f->next) {
+		if (f->write == stm32f4_flash_write)
+			((stm32f4_flash_s *)f)->psize = psize;
+	}
+}
+
+/*
+ * In auto mode, use the widest parallelism the target's supply allows. When the probe can't
+ * measure the voltage, stay with x32 as that's what's always been used.
+ */
+static void stm32f4_psize_auto(target_s *const t)
+{
+	const stm32f4_priv_s *const priv = t->target_storage;
+	if (!priv->psize_auto)
+		return;
+	const uint32_t voltage = stm32f4_target_voltage();
+	align_e psize = ALIGN_WORD;
+	if (voltage >= STM32F4_PSIZE32_MIN_VOLTAGE)
+		psize = priv->vpp ? ALIGN_DWORD : ALIGN_WORD;
+	else if (voltage >= STM32F4_PSIZE16_MIN_VOLTAGE)
+		psize = ALIGN_HALFWORD;
+	else if (voltage)
+		psize = ALIGN_BYTE;
+	if (psize != stm32f4_psize_get(t))
+		DEBUG_TARGET("%s: %" PRIu32 ".%" PRIu32 "V, using %s parallelism\n", __func__, voltage / 10U, voltage % 10U,
+			stm32_psize_to_string(psize));
+	stm32f4_psize_set(t, psize);
+}
+
 static bool stm32f4_attach(target_s *t)
 {
 	/* First try and figure out the Flash size (if we don't know the part ID, warn and return false) */
@@ -358,6 +436,7 @@ static bool stm32f4_attach(target_s *t)
 
 	/* Get the current value of the debug control register (and store it for later) */
 	priv_storage->dbgmcu_cr = target_mem_read32(t, DBGMCU_CR);
+	priv_storage->psize_auto = true;
 	/* Enable debugging during all low power modes*/
 	target_mem_write32(
 		t, DBGMCU_CR, priv_storage->dbgmcu_cr | DBGMCU_CR_DBG_SLEEP | DBGMCU_CR_DBG_STANDBY | DBGMCU_CR_DBG_STOP);
@@ -442,6 +521,7 @@ static bool stm32f4_attach(target_s *t)
 			stm32f4_add_flash(t, bank2_base + 0x20000U, remaining_bank_length, 0x20000, 21, split);
 		}
 	}
+	stm32f4_psize_auto(t);
 	return true;
 }
 
@@ -482,34 +562,32 @@ static bool stm32f4_flash_erase(target_flash_s *f, target_addr_t addr, size_t le
 {
 	target_s *t = f->t;
 	stm32f4_flash_s *sf = (stm32f4_flash_s *)f;
+	/* The loader has to be done with any programming before the controller can be used for erasing */
+	if (!flash_loader_stop(f, &sf->loader))
+		return false;
 	stm32f4_flash_unlock(t);
+	/* All the Flash regions share one controller, so wait for any operation a neighbour left running */
+	if (!stm32f4_flash_busy_wait(t, NULL))
+		return false;
 
-	align_e psize = ALIGN_WORD;
-	/*
-	 * XXX: What is this and why does it exist?
-	 * A dry-run walk-through says it'll pull out the psize for the Flash region added first by stm32f4_attach()
-	 * because all Flash regions added by stm32f4_add_flash match the if condition. This looks redundant and wrong.
-	 */
-	for (target_flash_s *currf = t->flash; currf; currf = currf->next) {
-		if (currf->write == stm32f4_flash_write)
-			psize = ((stm32f4_flash_s *)currf)->psize;
-	}
+	/* Each erase starts a Flash operation, so take a fresh look at the supply for auto parallelism */
+	stm32f4_psize_auto(t);
+	const align_e psize = sf->psize;
 
 	/* No address translation is needed here, as we erase by sector number */
 	uint8_t sector = sf->base_sector + ((addr - f->start) / f->blocksize);
 
 	/* Erase the requested chunk of flash, one sector at a time. */
 	for (size_t offset = 0; offset < len; offset += f->blocksize) {
+		/* Wait for the previous sector, the last one is left running for stm32f4_flash_wait() */
+		if (offset && !stm32f4_flash_busy_wait(t, NULL))
+			return false;
 		uint32_t cr = FLASH_CR_EOPIE | FLASH_CR_ERRIE | FLASH_CR_SER | (psize * FLASH_CR_PSIZE16) | (sector << 3U);
 		/* Flash page erase instruction */
 		target_mem_write32(t, FLASH_CR, cr);
 		/* write address to FMA */
 		target_mem_write32(t, FLASH_CR, cr | FLASH_CR_STRT);
 
-		/* Wait for completion or an error */
-		if (!stm32f4_flash_busy_wait(t, NULL))
-			return false;
-
 		++sector;
 		if (sf->bank_split && sector == sf->bank_split)
 			sector = 16;
@@ -523,13 +601,39 @@ static bool stm32f4_flash_write(target_flash_s *f, target_addr_t dest, const voi
 	if (dest >= ITCM_BASE && dest < AXIM_BASE)
 		dest += AXIM_BASE - ITCM_BASE;
 	target_s *t = f->t;
+	stm32f4_flash_s *const sf = (stm32f4_flash_s *)f;
+	const align_e psize = sf->psize;
+
+	/* The SRAM loader handles x16, x32 and x64 (as word pairs) parallelism, x8 keeps to programming over SWD */
+	if (psize != ALIGN_BYTE) {
+		const flash_loader_config_s config = {
+			FLASH_CR, (psize * FLASH_CR_PSIZE16) | FLASH_CR_PG, FLASH_SR, FLASH_SR_BSY, SR_ERROR_MASK, 1U << psize};
+		if (flash_loader_start(f, &sf->loader, &config))
+			return flash_loader_write(f, &sf->loader, dest, src, len, 0);
+	}
+
+	/* Wait for any operation another Flash region left running on the shared controller */
+	if (!stm32f4_flash_busy_wait(t, NULL))
+		return false;
 
-	align_e psize = ((stm32f4_flash_s *)f)->psize;
 	target_mem_write32(t, FLASH_CR, (psize * FLASH_CR_PSIZE16) | FLASH_CR_PG);
 	cortexm_mem_write_sized(t, dest, src, len, psize);
+	/* stm32f4_flash_wait() picks up completion, letting the next buffer arrive meanwhile */
+	return true;
+}
 
+static bool stm32f4_flash_wait(target_flash_s *const f)
+{
+	/* The loader keeps track of its own buffers, only stopping it waits for programming to finish */
+	if (((stm32f4_flash_s *)f)->loader.running)
+		return true;
 	/* Wait for completion or an error */
-	return stm32f4_flash_busy_wait(t, NULL);
+	return stm32f4_flash_busy_wait(f->t, NULL);
+}
+
+static bool stm32f4_flash_done(target_flash_s *const f)
+{
+	return flash_loader_stop(f, &((stm32f4_flash_s *)f)->loader);
 }
 
 static bool stm32f4_mass_erase(target_s *t)
@@ -537,9 +641,11 @@ static bool stm32f4_mass_erase(target_s *t)
 	/* XXX: Is it correct to grab the most recently added Flash region here? What is this really trying to do? */
 	stm32f4_flash_s *sf = (stm32f4_flash_s *)t->flash;
 	stm32f4_flash_unlock(t);
+	/* Mass erase runs at the programming parallelism too, and takes twice as long per halving of it */
+	stm32f4_psize_auto(t);
 
 	/* Flash mass erase start instruction */
-	const uint32_t ctrl = FLASH_CR_MER | (sf->bank_split ? FLASH_CR_MER1 : 0);
+	const uint32_t ctrl = FLASH_CR_MER | (sf->bank_split ? FLASH_CR_MER1 : 0) | (sf->psize * FLASH_CR_PSIZE16);
 	target_mem_write32(t, FLASH_CR, ctrl);
 	target_mem_write32(t, FLASH_CR, ctrl | FLASH_CR_STRT);
 
@@ -760,32 +866,22 @@ static bool stm32f4_cmd_option(target_s *t, int argc, const char **argv)
 
 static bool stm32f4_cmd_psize(target_s *t, int argc, const char **argv)
 {
+	stm32f4_priv_s *const priv = t->target_storage;
 	if (argc == 1) {
-		align_e psize = ALIGN_WORD;
-		/*
-		 * XXX: What is this and why does it exist?
-		 * A dry-run walk-through says it'll pull out the psize for the Flash region added first by stm32f4_attach()
-		 * because all Flash regions added by stm32f4_add_flash match the if condition. This looks redundant and wrong.
-		 */
-		for (target_flash_s *f = t->flash; f; f = f->next) {
-			if (f->write == stm32f4_flash_write)
-				psize = ((stm32f4_flash_s *)f)->psize;
-		}
-		tc_printf(t, "Flash write parallelism: %s\n", stm32_psize_to_string(psize));
+		stm32f4_psize_auto(t);
+		tc_printf(t, "Flash write parallelism: %s%s%s\n", stm32_psize_to_string(stm32f4_psize_get(t)),
+			priv->psize_auto ? " (auto)" : "", priv->vpp ? ", VPP applied" : "");
+	} else if (strcasecmp(argv[1], "auto") == 0) {
+		priv->psize_auto = true;
+		priv->vpp = argc > 2 && strcasecmp(argv[2], "vpp") == 0;
+		stm32f4_psize_auto(t);
 	} else {
 		align_e psize;
 		if (!stm32_psize_from_string(t, argv[1], &psize))
 			return false;
-
-		/*
-		 * XXX: What is this and why does it exist?
-		 * A dry-run walk-through says it'll overwrite psize for every Flash region added by stm32f4_attach()
-		 * because all Flash regions added by stm32f4_add_flash match the if condition. This looks redundant and wrong.
-		 */
-		for (target_flash_s *f = t->flash; f; f = f->next) {
-			if (f->write == stm32f4_flash_write)
-				((stm32f4_flash_s *)f)->psize = psize;
-		}
+		priv->psize_auto = false;
+		priv->vpp = psize == ALIGN_DWORD;
+		stm32f4_psize_set(t, psize);
 	}
 	return true;
 }
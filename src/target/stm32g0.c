@@ -50,12 +50,14 @@
 #include "target_internal.h"
 #include "cortexm.h"
 #include "command.h"
+#include "flash_loader.h"
 
 /* Flash */
 #define FLASH_START            0x08000000U
 #define FLASH_MEMORY_SIZE      0x1fff75e0U
 #define FLASH_PAGE_SIZE        0x800U
 #define FLASH_BANK2_START_PAGE 256U
+#define FLASH_ROW_SIZE         256U
 #define FLASH_OTP_START        0x1fff7000U
 #define FLASH_OTP_SIZE         0x400U
 #define FLASH_OTP_BLOCKSIZE    0x8U
@@ -77,6 +79,7 @@
 #define FLASH_CR            (G0_FLASH_BASE + 0x014U)
 #define FLASH_CR_LOCK       (1U << 31U)
 #define FLASH_CR_OBL_LAUNCH (1U << 27U)
+#define FLASH_CR_FSTPG      (1U << 18U)
 #define FLASH_CR_OPTSTART   (1U << 17U)
 #define FLASH_CR_START      (1U << 16U)
 #define FLASH_CR_MER2       (1U << 15U)
@@ -168,6 +171,15 @@ typedef struct stm32g0_saved_regs {
 	uint32_t dbg_apb_fz1;
 } stm32g0_saved_regs_s;
 
+typedef struct stm32g0_flash {
+	target_flash_s f;
+	flash_loader_s loader;
+	bool fast_capable;          /* FSTPG row programming can be used on this Flash */
+	bool wrote_start;           /* The loader programmed the first word of Flash, see stm32g0_flash_done() */
+	target_addr_t erased_start; /* Range erased since it was last programmed, which rows can be fast programmed in */
+	target_addr_t erased_end;
+} stm32g0_flash_s;
+
 typedef struct stm32g0_priv {
 	stm32g0_saved_regs_s saved_regs;
 	bool irreversible_enabled;
@@ -177,6 +189,7 @@ static bool stm32g0_attach(target_s *t);
 static void stm32g0_detach(target_s *t);
 static bool stm32g0_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool stm32g0_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool stm32g0_flash_done(target_flash_s *f);
 static bool stm32g0_mass_erase(target_s *t);
 
 /* Custom commands */
@@ -193,19 +206,23 @@ const command_s stm32g0_cmd_list[] = {
 
 static void stm32g0_add_flash(target_s *t, uint32_t addr, size_t length, size_t blocksize)
 {
-	target_flash_s *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
+	stm32g0_flash_s *sf = calloc(1, sizeof(*sf));
+	if (!sf) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	target_flash_s *f = &sf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = blocksize;
 	f->erase = stm32g0_flash_erase;
 	f->write = stm32g0_flash_write;
+	f->done = stm32g0_flash_done;
 	f->writesize = blocksize;
 	f->erased = 0xffU;
+	/* Fast programming is a G0 feature, the main Flash only */
+	sf->fast_capable = addr == FLASH_START && t->part_id != STM32C011 && t->part_id != STM32C031;
 	target_add_flash(t, f);
 }
 
@@ -378,11 +395,40 @@ static size_t stm32g0_bank1_end_page(target_flash_s *f)
 	return FLASH_BANK2_START_PAGE - 1U;
 }
 
+/* Note a range as erased, merging it with the one already noted when they meet */
+static void stm32g0_flash_mark_erased(stm32g0_flash_s *const sf, const target_addr_t start, const target_addr_t end)
+{
+	if (sf->erased_start == sf->erased_end || start > sf->erased_end || end < sf->erased_start) {
+		sf->erased_start = start;
+		sf->erased_end = end;
+	} else {
+		sf->erased_start = MIN(sf->erased_start, start);
+		sf->erased_end = MAX(sf->erased_end, end);
+	}
+}
+
+/*
+ * Whether a write can use FSTPG row programming: whole rows, all of them still erased. Programming
+ * is done in address order, so only the start of the erased range need be moved up as it's used.
+ */
+static bool stm32g0_flash_can_fast_program(stm32g0_flash_s *const sf, const target_addr_t dest, const size_t len)
+{
+	if (!sf->fast_capable || (dest & (FLASH_ROW_SIZE - 1U)) || (len & (FLASH_ROW_SIZE - 1U)) ||
+		dest < sf->erased_start || dest + len > sf->erased_end)
+		return false;
+	sf->erased_start = dest + len;
+	return true;
+}
+
 /* Erase pages of Flash. In the OTP case, this function clears any previous error and returns. */
 static bool stm32g0_flash_erase(target_flash_s *f, const target_addr_t addr, const size_t len)
 {
 	target_s *const t = f->t;
 
+	/* The loader has to finish programming and hand the controller back first */
+	if (!stm32g0_flash_done(f))
+		return false;
+
 	/* Wait for Flash ready */
 	if (!stm32g0_wait_busy(t, NULL)) {
 		stm32g0_flash_op_finish(t);
@@ -425,10 +471,21 @@ static bool stm32g0_flash_erase(target_flash_s *f, const target_addr_t addr, con
 	const uint32_t status = target_mem_read32(t, FLASH_SR);
 	if (status & FLASH_SR_ERROR_MASK)
 		DEBUG_WARN("stm32g0 flash erase error: sr 0x%" PRIx32 "\n", status);
+	else
+		stm32g0_flash_mark_erased((stm32g0_flash_s *)f, addr, addr + len);
 	stm32g0_flash_op_finish(t);
 	return !(status & FLASH_SR_ERROR_MASK);
 }
 
+/* Clear the EMPTY bit once the first word of Flash is programmed, so it boots from there without a power cycle */
+static void stm32g0_flash_clear_empty(target_s *const t)
+{
+	if (target_mem_read32(t, FLASH_START) != 0xffffffffU) {
+		const uint32_t acr = target_mem_read32(t, FLASH_ACR) & ~FLASH_ACR_EMPTY;
+		target_mem_write32(t, FLASH_ACR, acr);
+	}
+}
+
 /*
  * Write data to erased Flash.
  * The status register is supposed to be ready and free of any error.
@@ -447,6 +504,26 @@ static bool stm32g0_flash_write(target_flash_s *f, target_addr_t dest, const voi
 		return false;
 	}
 
+	/*
+	 * Rows still erased since their page was erased are written with FSTPG, a whole row per operation,
+	 * through the SRAM loader as the row has to be written without interruption. The controller stays
+	 * unlocked while the loader runs, stm32g0_flash_done() locks it again.
+	 */
+	stm32g0_flash_s *const sf = (stm32g0_flash_s *)f;
+	if (stm32g0_flash_can_fast_program(sf, dest, len)) {
+		if (!sf->loader.running)
+			stm32g0_flash_unlock(t);
+		const flash_loader_config_s config = {
+			FLASH_CR, FLASH_CR_FSTPG, FLASH_SR, FLASH_SR_BSY_MASK, FLASH_SR_ERROR_MASK, FLASH_ROW_SIZE};
+		if (flash_loader_start(f, &sf->loader, &config)) {
+			sf->wrote_start |= dest == FLASH_START;
+			return flash_loader_write(f, &sf->loader, dest, src, len, 0);
+		}
+		stm32g0_flash_lock(t);
+	}
+	if (!stm32g0_flash_done(f))
+		return false;
+
 	stm32g0_flash_unlock(t);
 	/* Write data to Flash */
 	target_mem_write32(t, FLASH_CR, FLASH_CR_PG);
@@ -465,15 +542,27 @@ static bool stm32g0_flash_write(target_flash_s *f, target_addr_t dest, const voi
 		return false;
 	}
 
-	if (dest == FLASH_START && target_mem_read32(t, FLASH_START) != 0xffffffffU) {
-		const uint32_t acr = target_mem_read32(t, FLASH_ACR) & ~FLASH_ACR_EMPTY;
-		target_mem_write32(t, FLASH_ACR, acr);
-	}
+	if (dest == FLASH_START)
+		stm32g0_flash_clear_empty(t);
 
 	stm32g0_flash_op_finish(t);
 	return true;
 }
 
+/* Stop the loader if it's running, finishing off what it programmed */
+static bool stm32g0_flash_done(target_flash_s *const f)
+{
+	stm32g0_flash_s *const sf = (stm32g0_flash_s *)f;
+	if (!sf->loader.running)
+		return true;
+	const bool result = flash_loader_stop(f, &sf->loader);
+	if (result && sf->wrote_start)
+		stm32g0_flash_clear_empty(f->t);
+	sf->wrote_start = false;
+	stm32g0_flash_op_finish(f->t);
+	return result;
+}
+
 static bool stm32g0_mass_erase(target_s *t)
 {
 	const uint32_t ctrl = FLASH_CR_MER1 | FLASH_CR_MER2 | FLASH_CR_START;
@@ -492,7 +581,14 @@ static bool stm32g0_mass_erase(target_s *t)
 	/* Check for error */
 	const uint16_t status = target_mem_read32(t, FLASH_SR);
 	stm32g0_flash_op_finish(t);
-	return !(status & FLASH_SR_ERROR_MASK);
+	if (status & FLASH_SR_ERROR_MASK)
+		return false;
+	/* All of the main Flash is now fair game for fast programming */
+	for (target_flash_s *f = t->flash; f; f = f->next) {
+		if (f->start == FLASH_START)
+			stm32g0_flash_mark_erased((stm32g0_flash_s *)f, f->start, f->start + f->length);
+	}
+	return true;
 }
 
 static bool stm32g0_cmd_erase_bank(target_s *t, int argc, const char **argv)
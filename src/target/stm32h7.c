@@ -24,6 +24,9 @@
  * References:
  * ST doc - RM0433
  *   Reference manual - STM32H7x3 advanced ARM®-based 32-bit MCUs Rev.3
+ *
+ * External SPI Flash behind the QUADSPI controller is programmed through the
+ * generic SPI Flash layer in spi.c when the firmware has already set the controller up.
  */
 
 /*
@@ -38,6 +41,7 @@
 #include "target_internal.h"
 #include "cortexm.h"
 #include "stm32_common.h"
+#include "spi.h"
 
 /* static bool stm32h7_cmd_option(target_s *t, int argc, const char **argv); */
 static bool stm32h7_uid(target_s *t, int argc, const char **argv);
@@ -54,9 +58,12 @@ const command_s stm32h7_cmd_list[] = {
 	{NULL, NULL, NULL},
 };
 
+static bool stm32h7_flash_prepare(target_flash_s *f);
 static bool stm32h7_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool stm32h7_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool stm32h7_flash_wait(target_flash_s *f);
 static bool stm32h7_mass_erase(target_s *t);
+static void stm32h7_qspi_add_flash(target_s *t);
 
 #define FLASH_ACR       0x00U
 #define FLASH_KEYR      0x04U
@@ -144,6 +151,39 @@ static bool stm32h7_mass_erase(target_s *t);
 #define ID_STM32H7Bx 0x4800U /* RM0455 */
 #define ID_STM32H72x 0x4830U /* RM0468 */
 
+/* QUADSPI controller, RM0433 §23. Only the H74x/H75x have this, the others have OCTOSPI instead */
+#define STM32H7_RCC_AHB3ENR       0x580244d4U
+#define STM32H7_RCC_AHB3ENR_QSPI  (1U << 14U)
+#define STM32H7_QSPI_BASE         0x52005000U
+#define STM32H7_QSPI_CR           (STM32H7_QSPI_BASE + 0x000U)
+#define STM32H7_QSPI_DCR          (STM32H7_QSPI_BASE + 0x004U)
+#define STM32H7_QSPI_SR           (STM32H7_QSPI_BASE + 0x008U)
+#define STM32H7_QSPI_FCR          (STM32H7_QSPI_BASE + 0x00cU)
+#define STM32H7_QSPI_DLR          (STM32H7_QSPI_BASE + 0x010U)
+#define STM32H7_QSPI_CCR          (STM32H7_QSPI_BASE + 0x014U)
+#define STM32H7_QSPI_AR           (STM32H7_QSPI_BASE + 0x018U)
+#define STM32H7_QSPI_DR           (STM32H7_QSPI_BASE + 0x020U)
+#define STM32H7_QSPI_MEMORY_BASE  0x90000000U
+#define QSPI_CR_EN                (1U << 0U)
+#define QSPI_CR_ABORT             (1U << 1U)
+#define QSPI_CR_DFM               (1U << 6U)
+#define QSPI_DCR_FSIZE_SHIFT      16U
+#define QSPI_DCR_FSIZE_MASK       (0x1fU << QSPI_DCR_FSIZE_SHIFT)
+#define QSPI_SR_TCF               (1U << 1U)
+#define QSPI_SR_BUSY              (1U << 5U)
+#define QSPI_FCR_CLEAR_ALL        0x0000001bU
+#define QSPI_CCR_IMODE_SINGLE     (1U << 8U)
+#define QSPI_CCR_ADMODE_SINGLE    (1U << 10U)
+#define QSPI_CCR_ADSIZE_24        (2U << 12U)
+#define QSPI_CCR_ADSIZE_32        (3U << 12U)
+#define QSPI_CCR_DCYC(x)          (((x)&0x1fU) << 18U)
+#define QSPI_CCR_DMODE_SINGLE     (1U << 24U)
+#define QSPI_CCR_FMODE_WRITE      (0U << 26U)
+#define QSPI_CCR_FMODE_READ       (1U << 26U)
+#define QSPI_CCR_FMODE_MEMORY_MAP (3U << 26U)
+#define QSPI_CCR_FMODE_MASK       (3U << 26U)
+#define QSPI_TIMEOUT              100U
+
 typedef struct stm32h7_flash {
 	target_flash_s f;
 	align_e psize;
@@ -152,6 +192,8 @@ typedef struct stm32h7_flash {
 
 typedef struct stm32h7_priv {
 	uint32_t dbg_cr;
+	spi_flash_s *qspi_flash;
+	uint32_t qspi_ccr; /* The application's QUADSPI mode, restored once we're done with the controller */
 } stm32h7_priv_s;
 
 static void stm32h7_add_flash(target_s *t, uint32_t addr, size_t length, size_t blocksize)
@@ -166,8 +208,10 @@ static void stm32h7_add_flash(target_s *t, uint32_t addr, size_t length, size_t
 	f->start = addr;
 	f->length = length;
 	f->blocksize = blocksize;
+	f->prepare = stm32h7_flash_prepare;
 	f->erase = stm32h7_flash_erase;
 	f->write = stm32h7_flash_write;
+	f->wait = stm32h7_flash_wait;
 	f->writesize = 2048;
 	f->erased = 0xffU;
 	sf->regbase = FPEC1_BASE;
@@ -181,6 +225,30 @@ static bool stm32h7_attach(target_s *t)
 {
 	if (!cortexm_attach(t))
 		return false;
+
+	/* Save DBGMCU_CR to restore it when detaching */
+	stm32h7_priv_s *const priv = (stm32h7_priv_s *)t->target_storage;
+	priv->dbg_cr = target_mem_read32(t, DBGMCU_CR);
+	/* RM0433 Rev 4 is not really clear, what bits are needed in DBGMCU_CR. Maybe more flags needed? */
+	target_mem_write32(t, DBGMCU_CR, DBGSLEEP_D1 | D1DBGCKEN);
+
+	/* Free any previously built memory map, which also drops any QUADSPI Flash picked up last time */
+	target_mem_map_free(t);
+	priv->qspi_flash = NULL;
+	/* Build the RAM map */
+	/* Table 7. Memory map and default device memory area attributes RM0433, pg130 */
+	target_add_ram(t, 0x00000000, 0x10000); /* ITCM RAM,   64kiB */
+	target_add_ram(t, 0x20000000, 0x20000); /* DTCM RAM,  128kiB */
+	target_add_ram(t, 0x24000000, 0x80000); /* AXI RAM,   512kiB */
+	target_add_ram(t, 0x30000000, 0x20000); /* AHB SRAM1, 128kiB */
+	target_add_ram(t, 0x30020000, 0x20000); /* AHB SRAM2, 128kiB */
+	target_add_ram(t, 0x30040000, 0x08000); /* AHB SRAM3,  32kiB */
+	target_add_ram(t, 0x38000000, 0x10000); /* AHB SRAM4,  64kiB */
+
+	/* Build the Flash map */
+	stm32h7_add_flash(t, 0x8000000, 0x100000, FLASH_SECTOR_SIZE);
+	stm32h7_add_flash(t, 0x8100000, 0x100000, FLASH_SECTOR_SIZE);
+
 	/*
 	 * If IWDG runs as HARDWARE watchdog (§44.3.4) erase
 	 * will be aborted by the Watchdog and erase fails!
@@ -189,6 +257,8 @@ static bool stm32h7_attach(target_s *t)
 	const uint32_t optsr = target_mem_read32(t, FPEC1_BASE + FLASH_OPTSR);
 	if (!(optsr & FLASH_OPTSR_IWDG1_SW))
 		tc_printf(t, "Hardware IWDG running. Expect failure. Set IWDG1_SW!");
+	if (t->part_id == ID_STM32H74x)
+		stm32h7_qspi_add_flash(t);
 	return true;
 }
 
@@ -210,41 +280,28 @@ bool stm32h7_probe(target_s *t)
 	t->mass_erase = stm32h7_mass_erase;
 	target_add_commands(t, stm32h7_cmd_list, t->driver);
 
-	/* Save private storage */
+	/*
+	 * Save private storage. The memory map and debug configuration are only built on attach,
+	 * so a scan doesn't pay for them on every H7 it finds.
+	 */
 	stm32h7_priv_s *priv_storage = calloc(1, sizeof(*priv_storage));
-	priv_storage->dbg_cr = target_mem_read32(t, DBGMCU_CR);
 	t->target_storage = priv_storage;
-
-	/* Build the RAM map */
-	/* Table 7. Memory map and default device memory area attributes RM0433, pg130 */
-	target_add_ram(t, 0x00000000, 0x10000); /* ITCM RAM,   64kiB */
-	target_add_ram(t, 0x20000000, 0x20000); /* DTCM RAM,  128kiB */
-	target_add_ram(t, 0x24000000, 0x80000); /* AXI RAM,   512kiB */
-	target_add_ram(t, 0x30000000, 0x20000); /* AHB SRAM1, 128kiB */
-	target_add_ram(t, 0x30020000, 0x20000); /* AHB SRAM2, 128kiB */
-	target_add_ram(t, 0x30040000, 0x08000); /* AHB SRAM3,  32kiB */
-	target_add_ram(t, 0x38000000, 0x10000); /* AHB SRAM4,  64kiB */
-
-	/* Build the Flash map */
-	stm32h7_add_flash(t, 0x8000000, 0x100000, FLASH_SECTOR_SIZE);
-	stm32h7_add_flash(t, 0x8100000, 0x100000, FLASH_SECTOR_SIZE);
-
-	/* RM0433 Rev 4 is not really clear, what bits are needed in DBGMCU_CR. Maybe more flags needed? */
-	const uint32_t dbgmcu_ctrl = DBGSLEEP_D1 | D1DBGCKEN;
-	target_mem_write32(t, DBGMCU_CR, dbgmcu_ctrl);
 	return true;
 }
 
 static bool stm32h7_flash_busy_wait(target_s *const t, const uint32_t regbase)
 {
-	uint32_t status = FLASH_SR_BSY | FLASH_SR_QW;
-	while (status & (FLASH_SR_BSY | FLASH_SR_QW)) {
-		status = target_mem_read32(t, regbase + FLASH_SR);
-		if ((status & FLASH_SR_ERROR_MASK) || target_check_error(t)) {
-			DEBUG_WARN("stm32h7_flash_write: error status %08" PRIx32 "\n", status);
-			target_mem_write32(t, regbase + FLASH_CCR, status & FLASH_SR_ERROR_MASK);
-			return false;
-		}
+	uint32_t status = 0;
+	bool idle = false;
+	while (!idle) {
+		idle = target_mem_poll32(t, regbase + FLASH_SR, FLASH_SR_BSY | FLASH_SR_QW, 0, TARGET_POLL_SLICE_MS, &status);
+		if (!idle && target_check_error(t))
+			break;
+	}
+	if (!idle || (status & FLASH_SR_ERROR_MASK)) {
+		DEBUG_WARN("stm32h7_flash_write: error status %08" PRIx32 "\n", status);
+		target_mem_write32(t, regbase + FLASH_CCR, status & FLASH_SR_ERROR_MASK);
+		return false;
 	}
 	return true;
 }
@@ -272,21 +329,33 @@ static bool stm32h7_flash_unlock(target_s *const t, const uint32_t addr)
 	return !(target_mem_read32(t, regbase + FLASH_CR) & FLASH_CR_LOCK);
 }
 
-static bool stm32h7_flash_erase(target_flash_s *const f, target_addr_t addr, const size_t len)
+/* Unlock the bank once per Flash session, so erase and write only have to start their operation */
+static bool stm32h7_flash_prepare(target_flash_s *const f)
 {
 	target_s *t = f->t;
 	const stm32h7_flash_s *const sf = (stm32h7_flash_s *)f;
-	/* Unlock the Flash */
-	if (!stm32h7_flash_unlock(t, addr))
+	if (!stm32h7_flash_unlock(t, f->start))
 		return false;
 	/* We come out of reset with HSI 64 MHz. Adapt FLASH_ACR.*/
 	target_mem_write32(t, sf->regbase + FLASH_ACR, 0);
+	return true;
+}
+
+static bool stm32h7_flash_erase(target_flash_s *const f, target_addr_t addr, const size_t len)
+{
+	target_s *t = f->t;
+	const stm32h7_flash_s *const sf = (stm32h7_flash_s *)f;
 	addr &= (NUM_SECTOR_PER_BANK * FLASH_SECTOR_SIZE) - 1U;
 	const size_t end_sector = (addr + len - 1U) / FLASH_SECTOR_SIZE;
 	const align_e psize = sf->psize;
 	const uint32_t reg_base = sf->regbase;
 
-	for (size_t begin_sector = addr / FLASH_SECTOR_SIZE; begin_sector <= end_sector; ++begin_sector) {
+	const size_t first_sector = addr / FLASH_SECTOR_SIZE;
+
+	for (size_t begin_sector = first_sector; begin_sector <= end_sector; ++begin_sector) {
+		/* Wait for the previous sector, the last one is left running for stm32h7_flash_wait() */
+		if (begin_sector != first_sector && !stm32h7_flash_busy_wait(t, reg_base))
+			return false;
 		/* Erase the current Flash sector */
 		const uint32_t ctrl = (psize * FLASH_CR_PSIZE16) | FLASH_CR_SER | (begin_sector * FLASH_CR_SNB_1);
 		target_mem_write32(t, reg_base + FLASH_CR, ctrl);
@@ -295,9 +364,6 @@ static bool stm32h7_flash_erase(target_flash_s *const f, target_addr_t addr, con
 		/* Wait for the operation to complete and report errors */
 		DEBUG_INFO("Erasing, ctrl = %08" PRIx32 " status = %08" PRIx32 "\n", target_mem_read32(t, reg_base + FLASH_CR),
 			target_mem_read32(t, reg_base + FLASH_SR));
-
-		if (!stm32h7_flash_busy_wait(t, reg_base))
-			return false;
 	}
 	return true;
 }
@@ -307,19 +373,27 @@ static bool stm32h7_flash_write(
 {
 	target_s *t = f->t;
 	const stm32h7_flash_s *const sf = (stm32h7_flash_s *)f;
-	/* Unlock the Flash */
-	if (!stm32h7_flash_unlock(t, dest))
-		return false;
-
-	/* Prepare the Flash write operation */
-	const uint32_t ctrl = sf->psize * FLASH_CR_PSIZE16;
-	target_mem_write32(t, sf->regbase + FLASH_CR, ctrl);
-	target_mem_write32(t, sf->regbase + FLASH_CR, ctrl | FLASH_CR_PG);
-	/* does H7 stall?*/
+	/* Open the write window, the bank was unlocked by stm32h7_flash_prepare() */
+	target_mem_write32(t, sf->regbase + FLASH_CR, (sf->psize * FLASH_CR_PSIZE16) | FLASH_CR_PG);
 
-	/* Write the data to the Flash */
+	/*
+	 * Stream the whole chunk, which is made of complete 256-bit Flash words, as one block write.
+	 * The controller queues each Flash word as it fills and stalls the bus while its write queue
+	 * is full, so there is nothing to poll between words. stm32h7_flash_wait() waits for the
+	 * queue to drain, and until then the other bank's controller can be worked on.
+	 */
 	target_mem_write(t, dest, src, len);
+	return true;
+}
 
+/*
+ * Each bank has its own controller, so an erase or write started on one keeps going while the
+ * other bank is worked on. This finishes the operation and closes the erase or write window.
+ */
+static bool stm32h7_flash_wait(target_flash_s *const f)
+{
+	target_s *t = f->t;
+	const stm32h7_flash_s *const sf = (stm32h7_flash_s *)f;
 	/* Wait for the operation to complete and report errors */
 	if (!stm32h7_flash_busy_wait(t, sf->regbase))
 		return false;
@@ -377,7 +451,7 @@ static bool stm32h7_mass_erase(target_s *t)
 			psize = ((struct stm32h7_flash *)flash)->psize;
 	}
 	/* Send mass erase Flash start instruction */
-	if (!stm32h7_erase_bank(t, psize, BANK1_START, FPEC1_BASE) || stm32h7_erase_bank(t, psize, BANK2_START, FPEC2_BASE))
+	if (!stm32h7_erase_bank(t, psize, BANK1_START, FPEC1_BASE) || !stm32h7_erase_bank(t, psize, BANK2_START, FPEC2_BASE))
 		return false;
 
 	platform_timeout_s timeout;
@@ -390,6 +464,151 @@ static bool stm32h7_mass_erase(target_s *t)
 	return stm32h7_check_bank(t, FPEC1_BASE) && stm32h7_check_bank(t, FPEC2_BASE);
 }
 
+static bool stm32h7_qspi_wait_idle(target_s *const t)
+{
+	if (target_mem_poll32(t, STM32H7_QSPI_SR, QSPI_SR_BUSY, 0U, QSPI_TIMEOUT, NULL))
+		return true;
+	DEBUG_WARN("QUADSPI controller stuck busy\n");
+	return false;
+}
+
+static void stm32h7_qspi_wait_complete(target_s *const t)
+{
+	if (!target_mem_poll32(t, STM32H7_QSPI_SR, QSPI_SR_TCF, QSPI_SR_TCF, QSPI_TIMEOUT, NULL))
+		DEBUG_WARN("QUADSPI transfer timed out\n");
+	target_mem_write32(t, STM32H7_QSPI_FCR, QSPI_FCR_CLEAR_ALL);
+}
+
+/* Translate a generic SPI Flash command into an indirect mode transfer and kick it off */
+static void stm32h7_qspi_setup_command(
+	target_s *const t, const uint16_t command, const target_addr_t address, const size_t length, const uint32_t mode)
+{
+	if (!stm32h7_qspi_wait_idle(t))
+		return;
+	target_mem_write32(t, STM32H7_QSPI_FCR, QSPI_FCR_CLEAR_ALL);
+	const size_t dummy_cycles = ((command & SPI_FLASH_DUMMY_MASK) >> SPI_FLASH_DUMMY_SHIFT) * 8U;
+	uint32_t ccr = mode | QSPI_CCR_IMODE_SINGLE | QSPI_CCR_DCYC(dummy_cycles) | (command & SPI_FLASH_OPCODE_MASK);
+	const size_t address_bytes = spi_flash_address_bytes(command);
+	if (address_bytes)
+		ccr |= QSPI_CCR_ADMODE_SINGLE | (address_bytes == 4U ? QSPI_CCR_ADSIZE_32 : QSPI_CCR_ADSIZE_24);
+	if (length) {
+		ccr |= QSPI_CCR_DMODE_SINGLE;
+		target_mem_write32(t, STM32H7_QSPI_DLR, length - 1U);
+	}
+	/* The transfer starts on the CCR write for opcode-only commands, otherwise on the AR write */
+	target_mem_write32(t, STM32H7_QSPI_CCR, ccr);
+	if (address_bytes)
+		target_mem_write32(t, STM32H7_QSPI_AR, address);
+}
+
+static void stm32h7_qspi_read(
+	target_s *const t, const uint16_t command, const target_addr_t address, void *const buffer, const size_t length)
+{
+	stm32h7_qspi_setup_command(t, command, address, length, QSPI_CCR_FMODE_READ);
+	/* Byte reads of DR pop one byte from the FIFO, and stall the bus until it has one */
+	uint8_t *const data = (uint8_t *)buffer;
+	for (size_t i = 0; i < length; ++i)
+		data[i] = target_mem_read8(t, STM32H7_QSPI_DR);
+	stm32h7_qspi_wait_complete(t);
+}
+
+static void stm32h7_qspi_write(target_s *const t, const uint16_t command, const target_addr_t address,
+	const void *const buffer, const size_t length)
+{
+	stm32h7_qspi_setup_command(t, command, address, length, QSPI_CCR_FMODE_WRITE);
+	const uint8_t *const data = (const uint8_t *)buffer;
+	for (size_t i = 0; i < length; ++i)
+		target_mem_write8(t, STM32H7_QSPI_DR, data[i]);
+	stm32h7_qspi_wait_complete(t);
+}
+
+static void stm32h7_qspi_run_command(target_s *const t, const uint16_t command, const target_addr_t address)
+{
+	stm32h7_qspi_setup_command(t, command, address, 0U, QSPI_CCR_FMODE_WRITE);
+	stm32h7_qspi_wait_complete(t);
+}
+
+/* Take the controller out of memory-mapped mode so indirect mode commands can be issued */
+static bool stm32h7_qspi_enter(target_s *const t)
+{
+	stm32h7_priv_s *const priv = (stm32h7_priv_s *)t->target_storage;
+	priv->qspi_ccr = target_mem_read32(t, STM32H7_QSPI_CCR);
+	if ((priv->qspi_ccr & QSPI_CCR_FMODE_MASK) == QSPI_CCR_FMODE_MEMORY_MAP) {
+		const uint32_t ctrl = target_mem_read32(t, STM32H7_QSPI_CR);
+		target_mem_write32(t, STM32H7_QSPI_CR, ctrl | QSPI_CR_ABORT);
+		if (!target_mem_poll32(t, STM32H7_QSPI_CR, QSPI_CR_ABORT, 0U, QSPI_TIMEOUT, NULL))
+			return false;
+	}
+	return stm32h7_qspi_wait_idle(t);
+}
+
+/* Put the controller back in whatever mode the application had it in */
+static bool stm32h7_qspi_exit(target_s *const t)
+{
+	const stm32h7_priv_s *const priv = (stm32h7_priv_s *)t->target_storage;
+	if (!stm32h7_qspi_wait_idle(t))
+		return false;
+	target_mem_write32(t, STM32H7_QSPI_FCR, QSPI_FCR_CLEAR_ALL);
+	target_mem_write32(t, STM32H7_QSPI_CCR, priv->qspi_ccr);
+	return true;
+}
+
+static bool stm32h7_qspi_prepare(target_flash_s *const f)
+{
+	return stm32h7_qspi_enter(f->t);
+}
+
+static bool stm32h7_qspi_done(target_flash_s *const f)
+{
+	target_s *const t = f->t;
+	stm32h7_priv_s *const priv = (stm32h7_priv_s *)t->target_storage;
+	/*
+	 * If the firmware wasn't using the memory-mapped window, set it up with a fast read anyway so
+	 * verify and CRC can read the Flash back through the window with block reads
+	 */
+	if ((priv->qspi_ccr & QSPI_CCR_FMODE_MASK) != QSPI_CCR_FMODE_MEMORY_MAP) {
+		const uint16_t command = priv->qspi_flash->read_command;
+		const size_t dummy_cycles = ((command & SPI_FLASH_DUMMY_MASK) >> SPI_FLASH_DUMMY_SHIFT) * 8U;
+		priv->qspi_ccr = QSPI_CCR_FMODE_MEMORY_MAP | QSPI_CCR_DMODE_SINGLE | QSPI_CCR_DCYC(dummy_cycles) |
+			QSPI_CCR_ADMODE_SINGLE | QSPI_CCR_IMODE_SINGLE | (command & SPI_FLASH_OPCODE_MASK) |
+			(spi_flash_address_bytes(command) == 4U ? QSPI_CCR_ADSIZE_32 : QSPI_CCR_ADSIZE_24);
+	}
+	return stm32h7_qspi_exit(t);
+}
+
+static void stm32h7_qspi_add_flash(target_s *const t)
+{
+	stm32h7_priv_s *const priv = (stm32h7_priv_s *)t->target_storage;
+	if (priv->qspi_flash)
+		return;
+	/* Only pick up the external Flash if the firmware has clocked and configured the controller for it */
+	if (!(target_mem_read32(t, STM32H7_RCC_AHB3ENR) & STM32H7_RCC_AHB3ENR_QSPI))
+		return;
+	const uint32_t ctrl = target_mem_read32(t, STM32H7_QSPI_CR);
+	if (!(ctrl & QSPI_CR_EN) || (ctrl & QSPI_CR_DFM))
+		return;
+	const uint32_t fsize = (target_mem_read32(t, STM32H7_QSPI_DCR) & QSPI_DCR_FSIZE_MASK) >> QSPI_DCR_FSIZE_SHIFT;
+	/* The QUADSPI memory-mapped window is 256MiB */
+	const size_t length = MIN(1U << (fsize + 1U), 0x10000000U);
+
+	if (!stm32h7_qspi_enter(t))
+		return;
+	spi_flash_id_s flash_id;
+	stm32h7_qspi_read(t, SPI_FLASH_CMD_READ_JEDEC_ID, 0, &flash_id, sizeof(flash_id));
+	if (flash_id.manufacturer != 0xffU && flash_id.manufacturer != 0x00U) {
+		DEBUG_INFO("QUADSPI Flash: mfr = %02x, type = %02x, capacity = %02x\n", flash_id.manufacturer,
+			flash_id.type, flash_id.capacity);
+		priv->qspi_flash = bmp_spi_add_flash(
+			t, STM32H7_QSPI_MEMORY_BASE, length, stm32h7_qspi_read, stm32h7_qspi_write, stm32h7_qspi_run_command);
+		if (priv->qspi_flash) {
+			priv->qspi_flash->flash.prepare = stm32h7_qspi_prepare;
+			priv->qspi_flash->flash.done = stm32h7_qspi_done;
+		}
+	} else
+		DEBUG_INFO("QUADSPI Flash identification failed\n");
+	stm32h7_qspi_exit(t);
+}
+
 static uint32_t stm32h7_part_uid_addr(target_s *const t)
 {
 	if (t->part_id == ID_STM32H7Bx)
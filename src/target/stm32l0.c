@@ -78,6 +78,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flash_loader.h"
 
 #define STM32Lx_NVM_PECR(p)    ((p) + 0x04U)
 #define STM32Lx_NVM_PEKEYR(p)  ((p) + 0x0cU)
@@ -148,6 +149,7 @@
 
 static bool stm32lx_nvm_prog_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool stm32lx_nvm_prog_write(target_flash_s *f, target_addr_t dest, const void *src, size_t size);
+static bool stm32lx_nvm_prog_done(target_flash_s *f);
 
 static bool stm32lx_nvm_data_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool stm32lx_nvm_data_write(target_flash_s *f, target_addr_t dest, const void *src, size_t size);
@@ -197,20 +199,31 @@ static uint32_t stm32lx_nvm_option_size(target_s *t)
 	return STM32L0_NVM_OPT_SIZE;
 }
 
+typedef struct stm32lx_flash {
+	target_flash_s f;
+	flash_loader_s loader;
+} stm32lx_flash_s;
+
+/*
+ * Program flash is written a page at a time, as two half-page programming operations.
+ * The half page is 16 words on the STM32L0, 32 on the STM32L1.
+ */
 static void stm32l_add_flash(target_s *t, uint32_t addr, size_t length, size_t erasesize)
 {
-	target_flash_s *f = calloc(1, sizeof(*f));
-	if (!f) { /* calloc failed: heap exhaustion */
+	stm32lx_flash_s *sf = calloc(1, sizeof(*sf));
+	if (!sf) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	target_flash_s *f = &sf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = erasesize;
 	f->erase = stm32lx_nvm_prog_erase;
 	f->write = stm32lx_nvm_prog_write;
-	f->writesize = erasesize / 2U;
+	f->done = stm32lx_nvm_prog_done;
+	f->writesize = erasesize;
 	target_add_flash(t, f);
 }
 
@@ -324,6 +337,9 @@ static bool stm32lx_nvm_prog_erase(target_flash_s *const f, const target_addr_t
 {
 	target_s *t = f->t;
 	const uint32_t nvm = stm32lx_nvm_phys(t);
+	/* The loader has to be done with any programming before the controller can be used for erasing */
+	if (!stm32lx_nvm_prog_done(f))
+		return false;
 	if (!stm32lx_nvm_prog_data_unlock(t, nvm))
 		return false;
 
@@ -351,11 +367,21 @@ static bool stm32lx_nvm_prog_erase(target_flash_s *const f, const target_addr_t
 	return stm32lx_nvm_busy_wait(t, nvm);
 }
 
-/* Write to program flash using operations through the debug interface. */
+/*
+ * Write to program flash, half a page per programming operation. Half-page programming has to be
+ * done from RAM to be reliable, so this goes through the SRAM flash loader which runs the half pages
+ * back to back and keeps NVM unlocked until stm32lx_nvm_prog_done(). Where the loader can't run,
+ * the half pages are written through the debug interface one operation at a time.
+ */
 static bool stm32lx_nvm_prog_write(target_flash_s *f, target_addr_t dest, const void *src, size_t size)
 {
 	target_s *t = f->t;
+	stm32lx_flash_s *const sf = (stm32lx_flash_s *)f;
 	const uint32_t nvm = stm32lx_nvm_phys(t);
+	const size_t half_page = f->blocksize / 2U;
+
+	if (sf->loader.running)
+		return flash_loader_write(f, &sf->loader, dest, src, size, 0);
 
 	if (!stm32lx_nvm_prog_data_unlock(t, nvm))
 		return false;
@@ -367,14 +393,42 @@ static bool stm32lx_nvm_prog_write(target_flash_s *f, target_addr_t dest, const
 	if (!stm32lx_nvm_busy_wait(t, nvm))
 		return false;
 
-	target_mem_write32(t, STM32Lx_NVM_PECR(nvm), STM32Lx_NVM_PECR_PROG | STM32Lx_NVM_PECR_FPRG);
-	target_mem_write(t, dest, src, size);
+	const flash_loader_config_s config = {
+		STM32Lx_NVM_PECR(nvm),
+		STM32Lx_NVM_PECR_PROG | STM32Lx_NVM_PECR_FPRG,
+		STM32Lx_NVM_SR(nvm),
+		STM32Lx_NVM_SR_BSY,
+		STM32Lx_NVM_SR_ERR_M,
+		half_page,
+	};
+	if (flash_loader_start(f, &sf->loader, &config))
+		return flash_loader_write(f, &sf->loader, dest, src, size, 0);
+
+	const uint8_t *const data = (const uint8_t *)src;
+	for (size_t offset = 0; offset < size; offset += half_page) {
+		target_mem_write32(t, STM32Lx_NVM_PECR(nvm), STM32Lx_NVM_PECR_PROG | STM32Lx_NVM_PECR_FPRG);
+		target_mem_write(t, dest + offset, data + offset, MIN(half_page, size - offset));
+		/* Wait for completion or an error */
+		if (!stm32lx_nvm_busy_wait(t, nvm)) {
+			stm32lx_nvm_lock(t, nvm);
+			return false;
+		}
+	}
 
 	/* Disable further programming by locking PECR */
 	stm32lx_nvm_lock(t, nvm);
+	return true;
+}
 
-	/* Wait for completion or an error */
-	return stm32lx_nvm_busy_wait(t, nvm);
+static bool stm32lx_nvm_prog_done(target_flash_s *const f)
+{
+	stm32lx_flash_s *const sf = (stm32lx_flash_s *)f;
+	if (!sf->loader.running)
+		return true;
+	const bool result = flash_loader_stop(f, &sf->loader);
+	/* Disable further programming by locking PECR */
+	stm32lx_nvm_lock(f->t, stm32lx_nvm_phys(f->t));
+	return result;
 }
 
 /*
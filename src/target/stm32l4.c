@@ -50,7 +50,9 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "stm32_common.h"
 #include "gdb_packet.h"
+#include "flash_loader.h"
 
 static bool stm32l4_cmd_erase_bank1(target_s *t, int argc, const char **argv);
 static bool stm32l4_cmd_erase_bank2(target_s *t, int argc, const char **argv);
@@ -60,6 +62,8 @@ static bool stm32l4_attach(target_s *t);
 static void stm32l4_detach(target_s *t);
 static bool stm32l4_flash_erase(target_flash_s *f, target_addr_t addr, size_t len);
 static bool stm32l4_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+static bool stm32l4_flash_wait(target_flash_s *f);
+static bool stm32l4_flash_done(target_flash_s *f);
 static bool stm32l4_mass_erase(target_s *t);
 
 const command_s stm32l4_cmd_list[] = {
@@ -111,6 +115,8 @@ const command_s stm32l4_cmd_list[] = {
 #define FLASH_SR_BSY        (1U << 16U)
 
 #define STM32L4_FLASH_BANK_1_BASE 0x08000000U
+/* Fast programming writes a row of 32 double-words in one operation, on parts with 2kiB pages */
+#define STM32L4_FLASH_ROW_SIZE 256U
 #define FLASH_SIZE_MAX_G4_CAT4    (512U * 1024U) // 512kiB
 
 #define KEY1 0x45670123U
@@ -194,6 +200,11 @@ typedef struct stm32l4_device_info {
 typedef struct stm32l4_flash {
 	target_flash_s f;
 	uint32_t bank1_start;
+	flash_loader_s loader;
+	bool fast_capable;          /* The controller supports FSTPG row programming of this Flash */
+	bool fast_program;          /* The loader is running with FSTPG rather than PG selected */
+	target_addr_t erased_start; /* Range erased since it was last programmed, which rows can be fast programmed in */
+	target_addr_t erased_end;
 } stm32l4_flash_s;
 
 typedef struct stm32l4_priv {
@@ -477,9 +488,14 @@ static void stm32l4_add_flash(
 	f->blocksize = blocksize;
 	f->erase = stm32l4_flash_erase;
 	f->write = stm32l4_flash_write;
+	f->wait = stm32l4_flash_wait;
+	f->done = stm32l4_flash_done;
 	f->writesize = 2048;
 	f->erased = 0xffU;
 	sf->bank1_start = bank1_start;
+	const stm32l4_priv_s *const ps = (const stm32l4_priv_s *)t->target_storage;
+	sf->fast_capable = blocksize == 0x800U &&
+		(ps->device->family == STM32L4_FAMILY_L4xx || ps->device->family == STM32L4_FAMILY_G4xx);
 	target_add_flash(t, f);
 }
 
@@ -675,10 +691,11 @@ static void stm32l4_flash_unlock(target_s *const t)
 
 static bool stm32l4_flash_busy_wait(target_s *const t, platform_timeout_s *timeout)
 {
-	/* Read FLASH_SR to poll for BSY bit */
-	uint32_t status = FLASH_SR_BSY;
-	while (status & FLASH_SR_BSY) {
-		status = stm32l4_flash_read32(t, FLASH_SR);
+	stm32l4_priv_s *ps = (stm32l4_priv_s *)t->target_storage;
+	const uint32_t flash_sr = ps->device->flash_regs_map[FLASH_SR];
+	/* Poll FLASH_SR for the BSY bit to clear */
+	uint32_t status = 0;
+	while (!target_mem_poll32(t, flash_sr, FLASH_SR_BSY, 0, TARGET_POLL_SLICE_MS, &status)) {
 		if ((status & FLASH_SR_ERROR_MASK) || target_check_error(t)) {
 			DEBUG_WARN("stm32l4 Flash error: status 0x%" PRIx32 "\n", status);
 			return false;
@@ -686,13 +703,46 @@ static bool stm32l4_flash_busy_wait(target_s *const t, platform_timeout_s *timeo
 		if (timeout)
 			target_print_progress(timeout);
 	}
+	if (status & FLASH_SR_ERROR_MASK) {
+		DEBUG_WARN("stm32l4 Flash error: status 0x%" PRIx32 "\n", status);
+		return false;
+	}
+	return true;
+}
+
+/* Note a range as erased, merging it with the one already noted when they meet */
+static void stm32l4_flash_mark_erased(stm32l4_flash_s *const sf, const target_addr_t start, const target_addr_t end)
+{
+	if (sf->erased_start == sf->erased_end || start > sf->erased_end || end < sf->erased_start) {
+		sf->erased_start = start;
+		sf->erased_end = end;
+	} else {
+		sf->erased_start = MIN(sf->erased_start, start);
+		sf->erased_end = MAX(sf->erased_end, end);
+	}
+}
+
+/*
+ * Whether a write can use FSTPG row programming: whole rows, all of them still erased. Programming
+ * is done in address order, so only the start of the erased range need be moved up as it's used.
+ */
+static bool stm32l4_flash_can_fast_program(stm32l4_flash_s *const sf, const target_addr_t dest, const size_t len)
+{
+	if (!sf->fast_capable || (dest & (STM32L4_FLASH_ROW_SIZE - 1U)) || (len & (STM32L4_FLASH_ROW_SIZE - 1U)) ||
+		dest < sf->erased_start || dest + len > sf->erased_end)
+		return false;
+	sf->erased_start = dest + len;
 	return true;
 }
 
 static bool stm32l4_flash_erase(target_flash_s *const f, const target_addr_t addr, const size_t len)
 {
 	target_s *t = f->t;
-	const stm32l4_flash_s *const sf = (stm32l4_flash_s *)f;
+	stm32l4_flash_s *const sf = (stm32l4_flash_s *)f;
+
+	/* The loader has to be done with any programming before the controller can be used for erasing */
+	if (!flash_loader_stop(f, &sf->loader))
+		return false;
 
 	/* STM32WBXX ERRATA ES0394 2.2.9: OPTVERR flag is always set after system reset */
 	stm32l4_flash_write32(t, FLASH_SR, stm32l4_flash_read32(t, FLASH_SR));
@@ -704,6 +754,9 @@ static bool stm32l4_flash_erase(target_flash_s *const f, const target_addr_t add
 
 	/* Erase the requested chunk of flash, one page at a time. */
 	for (size_t offset = 0; offset < len; offset += f->blocksize) {
+		/* Wait for the previous page, the last one is left running for stm32l4_flash_wait() */
+		if (offset && !stm32l4_flash_busy_wait(t, NULL))
+			return false;
 		const uint32_t page = (addr + offset - STM32L4_FLASH_BANK_1_BASE) / f->blocksize;
 		const uint32_t bank_flags = addr + offset >= sf->bank1_start ? FLASH_CR_BKER : 0;
 		const uint32_t ctrl = FLASH_CR_PER | (page << FLASH_CR_PAGE_SHIFT) | bank_flags;
@@ -711,22 +764,60 @@ static bool stm32l4_flash_erase(target_flash_s *const f, const target_addr_t add
 		stm32l4_flash_write32(t, FLASH_CR, ctrl);
 		/* write address to FMA */
 		stm32l4_flash_write32(t, FLASH_CR, ctrl | FLASH_CR_STRT);
-
-		/* Wait for completion or an error */
-		if (!stm32l4_flash_busy_wait(t, NULL))
-			return false;
 	}
+	stm32l4_flash_mark_erased(sf, addr, addr + len);
 	return true;
 }
 
 static bool stm32l4_flash_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
 {
 	target_s *t = f->t;
+	stm32l4_flash_s *const sf = (stm32l4_flash_s *)f;
+	const stm32l4_priv_s *const ps = (stm32l4_priv_s *)t->target_storage;
+	const uint32_t *const regs_map = ps->device->flash_regs_map;
+
+	/*
+	 * Program through the SRAM loader where it can run. Rows still erased since their page was erased
+	 * are written with FSTPG as a whole row per operation, which has to happen without interruption
+	 * and so is only done from the loader. Anything else uses double-word programming.
+	 */
+	const bool fast_program = stm32l4_flash_can_fast_program(sf, dest, len);
+	if (sf->loader.running && sf->fast_program != fast_program && !flash_loader_stop(f, &sf->loader))
+		return false;
+	const flash_loader_config_s config = {
+		regs_map[FLASH_CR],
+		fast_program ? FLASH_CR_FSTPG : FLASH_CR_PG,
+		regs_map[FLASH_SR],
+		FLASH_SR_BSY,
+		FLASH_SR_ERROR_MASK,
+		fast_program ? STM32L4_FLASH_ROW_SIZE : 8U,
+	};
+	if (flash_loader_start(f, &sf->loader, &config)) {
+		sf->fast_program = fast_program;
+		return flash_loader_write(f, &sf->loader, dest, src, len, 0);
+	}
+
+	/* Make sure nothing is still running before changing the operation */
+	if (!stm32l4_flash_busy_wait(t, NULL))
+		return false;
 	stm32l4_flash_write32(t, FLASH_CR, FLASH_CR_PG);
 	target_mem_write(t, dest, src, len);
+	/* stm32l4_flash_wait() picks up completion, letting the next buffer arrive meanwhile */
+	return true;
+}
 
+static bool stm32l4_flash_wait(target_flash_s *const f)
+{
+	/* The loader keeps track of its own buffers, only stopping it waits for programming to finish */
+	if (((stm32l4_flash_s *)f)->loader.running)
+		return true;
 	/* Wait for completion or an error */
-	return stm32l4_flash_busy_wait(t, NULL);
+	return stm32l4_flash_busy_wait(f->t, NULL);
+}
+
+static bool stm32l4_flash_done(target_flash_s *const f)
+{
+	return flash_loader_stop(f, &((stm32l4_flash_s *)f)->loader);
 }
 
 static bool stm32l4_cmd_erase(target_s *const t, const uint32_t action)
@@ -745,7 +836,14 @@ static bool stm32l4_cmd_erase(target_s *const t, const uint32_t action)
 
 static bool stm32l4_mass_erase(target_s *const t)
 {
-	return stm32l4_cmd_erase(t, FLASH_CR_MER1 | FLASH_CR_MER2);
+	if (!stm32l4_cmd_erase(t, FLASH_CR_MER1 | FLASH_CR_MER2))
+		return false;
+	/* All of Flash is now fair game for fast programming */
+	for (target_flash_s *f = t->flash; f; f = f->next) {
+		if (f->erase == stm32l4_flash_erase)
+			stm32l4_flash_mark_erased((stm32l4_flash_s *)f, f->start, f->start + f->length);
+	}
+	return true;
 }
 
 static bool stm32l4_cmd_erase_bank1(target_s *const t, const int argc, const char **const argv)
@@ -771,6 +869,8 @@ static bool stm32l4_cmd_erase_bank2(target_s *const t, const int argc, const cha
 static bool stm32l4_option_write(target_s *const t, const uint32_t *const values, const size_t len,
 	const uint32_t fpec_base, const uint8_t *const opt_reg_offsets)
 {
+	stm32l4_priv_s *ps = (stm32l4_priv_s *)t->target_storage;
+	const uint32_t *const flash_regs = ps->device->flash_regs_map;
 	/* Unlock the option registers Flash */
 	stm32l4_flash_unlock(t);
 	stm32l4_flash_write32(t, FLASH_OPTKEYR, OPTKEY1);
@@ -779,10 +879,14 @@ static bool stm32l4_option_write(target_s *const t, const uint32_t *const values
 	if (!stm32l4_flash_busy_wait(t, NULL))
 		return true;
 
-	/* Write the new option register values and begin the programming operation */
+	/* Write the new option register values and begin the programming operation as one batch */
+	stm32_regs_s regs;
+	stm32_regs_init(&regs, t);
 	for (size_t i = 0; i < len; i++)
-		target_mem_write32(t, fpec_base + opt_reg_offsets[i], values[i]);
-	stm32l4_flash_write32(t, FLASH_CR, FLASH_CR_OPTSTRT);
+		stm32_regs_write32(&regs, fpec_base + opt_reg_offsets[i], values[i]);
+	stm32_regs_write32(&regs, flash_regs[FLASH_CR], FLASH_CR_OPTSTRT);
+	if (!stm32_regs_run(&regs))
+		return true;
 	/* Wait for the operation to complete and report any errors */
 	if (!stm32l4_flash_busy_wait(t, NULL))
 		return false;
@@ -892,8 +996,14 @@ static bool stm32l4_cmd_option(target_s *t, int argc, const char **argv)
 		for (size_t i = 0; i < option_words; ++i)
 			values[i] = strtoul(argv[i + 2U], NULL, 0);
 
+		stm32_regs_s regs;
+		stm32_regs_init(&regs, t);
 		for (size_t i = option_words; i < word_count; ++i)
-			values[i] = target_mem_read32(t, fpec_base + opt_reg_offsets[i]);
+			stm32_regs_read32(&regs, fpec_base + opt_reg_offsets[i], &values[i]);
+		if (!stm32_regs_run(&regs)) {
+			tc_printf(t, "Reading options failed!\n");
+			return false;
+		}
 
 		if ((values[0] & 0xffU) == 0xccU) {
 			++values[0];
@@ -910,10 +1020,13 @@ static bool stm32l4_cmd_option(target_s *t, int argc, const char **argv)
 		return false;
 	}
 
-	for (size_t i = 0; i < word_count; ++i) {
-		const uint32_t addr = fpec_base + opt_reg_offsets[i];
-		const uint32_t val = target_mem_read32(t, fpec_base + opt_reg_offsets[i]);
-		tc_printf(t, "0x%08X: 0x%08X\n", addr, val);
-	}
+	stm32_regs_s regs;
+	stm32_regs_init(&regs, t);
+	for (size_t i = 0; i < word_count; ++i)
+		stm32_regs_read32(&regs, fpec_base + opt_reg_offsets[i], &values[i]);
+	if (!stm32_regs_run(&regs))
+		return false;
+	for (size_t i = 0; i < word_count; ++i)
+		tc_printf(t, "0x%08X: 0x%08X\n", fpec_base + opt_reg_offsets[i], values[i]);
 	return true;
 }
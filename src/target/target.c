@@ -21,6 +21,8 @@
 #include "general.h"
 #include "target_internal.h"
 #include "gdb_packet.h"
+#include "probe_stats.h"
+#include "scheduler.h"
 
 #include <stdarg.h>
 #include <unistd.h>
@@ -30,6 +32,31 @@ target_s *target_list = NULL;
 #define STDOUT_READ_BUF_SIZE       64U
 #define FLASH_WRITE_BUFFER_CEILING 1024U
 
+/*
+ * While a target is halted GDB reads the same stack and data over and over (backtraces, locals,
+ * displays), so RAM reads are served from a small cache of pages. The cache is only live
+ * from the target being seen halted until anything that could change its memory.
+ */
+#define TARGET_MEM_CACHE_PAGE_SIZE 1024U
+#ifndef TARGET_MEM_CACHE_PAGES
+#if PC_HOSTED == 1
+#define TARGET_MEM_CACHE_PAGES 32U
+#else
+#define TARGET_MEM_CACHE_PAGES 2U
+#endif
+#endif
+
+typedef struct target_mem_cache_page {
+	const target_s *target; /* NULL for an unused page */
+	target_addr_t base;
+	uint8_t data[TARGET_MEM_CACHE_PAGE_SIZE];
+} target_mem_cache_page_s;
+
+static target_mem_cache_page_s target_mem_cache[TARGET_MEM_CACHE_PAGES];
+static size_t target_mem_cache_next;
+/* The halted target the cache may currently be used for */
+static const target_s *target_mem_cache_target;
+
 static bool target_cmd_mass_erase(target_s *t, int argc, const char **argv);
 static bool target_cmd_range_erase(target_s *t, int argc, const char **argv);
 
@@ -41,7 +68,7 @@ const command_s target_cmd_list[] = {
 
 target_s *target_new(void)
 {
-	target_s *t = calloc(1, sizeof(*t));
+	target_s *t = target_arena_calloc(sizeof(*t));
 	if (!t) { /* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return NULL;
@@ -56,6 +83,7 @@ target_s *target_new(void)
 		target_list = t;
 
 	t->target_storage = NULL;
+	t->pc_reg = -1;
 
 	target_add_commands(t, target_cmd_list, "Target");
 	return t;
@@ -71,20 +99,24 @@ int target_foreach(void (*cb)(int, target_s *t, void *context), void *context)
 
 void target_ram_map_free(target_s *t)
 {
+	t->region_last.length = 0;
 	while (t->ram) {
 		void *next = t->ram->next;
-		free(t->ram);
+		target_arena_free(t->ram);
 		t->ram = next;
 	}
 }
 
 void target_flash_map_free(target_s *t)
 {
+	t->region_last.length = 0;
 	while (t->flash) {
 		void *next = t->flash->next;
 		if (t->flash->buf)
 			free(t->flash->buf);
-		free(t->flash);
+		free(t->flash->erase_pending);
+		free(t->flash->block_buf);
+		target_arena_free(t->flash);
 		t->flash = next;
 	}
 }
@@ -97,6 +129,7 @@ void target_mem_map_free(target_s *t)
 
 void target_list_free(void)
 {
+	target_mem_cache_flush();
 	target_s *target = target_list;
 	while (target) {
 		target_s *next_target = target->next;
@@ -108,27 +141,35 @@ void target_list_free(void)
 			target->priv_free(target->priv);
 		while (target->commands) {
 			target_command_s *const tc = target->commands->next;
-			free(target->commands);
+			target_arena_free(target->commands);
 			target->commands = tc;
 		}
 		free(target->target_storage);
 		target_mem_map_free(target);
+		while (target->regions) {
+			target_region_s *const region = target->regions->next;
+			target_arena_free(target->regions);
+			target->regions = region;
+		}
 		while (target->bw_list) {
 			void *next = target->bw_list->next;
+			free(target->bw_list->condition);
 			free(target->bw_list);
 			target->bw_list = next;
 		}
-		free(target);
+		target_arena_free(target);
 		target = next_target;
 	}
 	target_list = NULL;
+	/* With the targets gone, nothing allocated from the arena for them is referenced any more */
+	target_arena_reset();
 }
 
 void target_add_commands(target_s *t, const command_s *cmds, const char *name)
 {
-	target_command_s *tc = malloc(sizeof(*tc));
-	if (!tc) { /* malloc failed: heap exhaustion */
-		DEBUG_WARN("malloc: failed in %s\n", __func__);
+	target_command_s *tc = target_arena_calloc(sizeof(*tc));
+	if (!tc) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
@@ -157,6 +198,7 @@ target_s *target_attach_n(const size_t n, target_controller_s *tc)
 
 target_s *target_attach(target_s *t, target_controller_s *tc)
 {
+	target_mem_cache_flush();
 	if (t->tc)
 		t->tc->destroy_callback(t->tc, t);
 
@@ -169,14 +211,16 @@ target_s *target_attach(target_s *t, target_controller_s *tc)
 	}
 
 	t->attached = true;
+	/* Attaching leaves the target halted */
+	target_mem_cache_target = t;
 	return t;
 }
 
 void target_add_ram(target_s *t, target_addr_t start, uint32_t len)
 {
-	target_ram_s *ram = malloc(sizeof(*ram));
-	if (!ram) { /* malloc failed: heap exhaustion */
-		DEBUG_WARN("malloc: failed in %s\n", __func__);
+	target_ram_s *ram = target_arena_calloc(sizeof(*ram));
+	if (!ram) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
@@ -184,6 +228,7 @@ void target_add_ram(target_s *t, target_addr_t start, uint32_t len)
 	ram->length = len;
 	ram->next = t->ram;
 	t->ram = ram;
+	t->region_last.length = 0;
 }
 
 void target_add_flash(target_s *t, target_flash_s *f)
@@ -203,36 +248,110 @@ void target_add_flash(target_s *t, target_flash_s *f)
 	f->t = t;
 	f->next = t->flash;
 	t->flash = f;
+	t->region_last.length = 0;
 }
 
-static ssize_t map_ram(char *buf, size_t len, target_ram_s *ram)
+/*
+ * Tell the memory access layer how a region has to be accessed, overriding the RAM and Flash maps for
+ * any range they share. The most recently added hint wins where hints overlap.
+ */
+void target_add_region(
+	target_s *const t, const target_addr_t start, const size_t length, const uint8_t width, const uint8_t flags)
+{
+	target_region_s *const region = target_arena_calloc(sizeof(*region));
+	if (!region) { /* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return;
+	}
+
+	region->start = start;
+	region->length = length;
+	region->width = width;
+	region->flags = flags;
+	region->next = t->regions;
+	t->regions = region;
+	t->region_last.length = 0;
+}
+
+static bool target_region_contains(
+	const target_addr_t start, const size_t length, const target_addr_t addr, const size_t len)
 {
-	return snprintf(buf, len, "<memory type=\"ram\" start=\"0x%08" PRIx32 "\" length=\"0x%" PRIx32 "\"/>", ram->start,
-		(uint32_t)ram->length);
+	return len <= length && addr >= start && addr - start <= length - len;
 }
 
-static ssize_t map_flash(char *buf, size_t len, target_flash_s *f)
+static bool target_region_set(target_region_s *const region, const target_addr_t start, const size_t length,
+	const uint8_t width, const uint8_t flags)
 {
-	int i = 0;
-	i += snprintf(&buf[i], len - i, "<memory type=\"flash\" start=\"0x%08" PRIx32 "\" length=\"0x%" PRIx32 "\">",
+	region->start = start;
+	region->length = length;
+	region->width = width;
+	region->flags = flags;
+	return true;
+}
+
+/*
+ * Find the attributes of the region holding all of [addr, addr + len), from the driver hints first and then
+ * the RAM and Flash maps. Returns false if no single region does, in which case the defaults apply: any
+ * access width, block transfers allowed and nothing cached.
+ */
+static bool target_region_lookup(target_s *const t, const target_addr_t addr, const size_t len)
+{
+	target_region_s *const last = &t->region_last;
+	if (last->length && target_region_contains(last->start, last->length, addr, len))
+		return true;
+	last->length = 0;
+	for (const target_region_s *region = t->regions; region; region = region->next) {
+		if (target_region_contains(region->start, region->length, addr, len))
+			return target_region_set(last, region->start, region->length, region->width, region->flags);
+	}
+	for (const target_ram_s *ram = t->ram; ram; ram = ram->next) {
+		if (target_region_contains(ram->start, ram->length, addr, len))
+			return target_region_set(
+				last, ram->start, ram->length, 1U, TARGET_REGION_BLOCK | TARGET_REGION_CACHEABLE);
+	}
+	for (const target_flash_s *flash = t->flash; flash; flash = flash->next) {
+		if (target_region_contains(flash->start, flash->length, addr, len))
+			return target_region_set(last, flash->start, flash->length, 1U, TARGET_REGION_BLOCK);
+	}
+	return false;
+}
+
+/* Append to the map being built, only measuring once the buffer has run out */
+#define MAP_PRINTF(buf, len, offset, ...) \
+	(offset) += snprintf((offset) < (len) ? (buf) + (offset) : NULL, (offset) < (len) ? (len) - (offset) : 0U, __VA_ARGS__)
+
+static size_t map_ram(char *buf, size_t len, size_t offset, target_ram_s *ram)
+{
+	MAP_PRINTF(buf, len, offset, "<memory type=\"ram\" start=\"0x%08" PRIx32 "\" length=\"0x%" PRIx32 "\"/>",
+		ram->start, (uint32_t)ram->length);
+	return offset;
+}
+
+static size_t map_flash(char *buf, size_t len, size_t offset, target_flash_s *f)
+{
+	MAP_PRINTF(buf, len, offset, "<memory type=\"flash\" start=\"0x%08" PRIx32 "\" length=\"0x%" PRIx32 "\">",
 		f->start, (uint32_t)f->length);
-	i += snprintf(
-		&buf[i], len - i, "<property name=\"blocksize\">0x%" PRIx32 "</property></memory>", (uint32_t)f->blocksize);
-	return i;
+	MAP_PRINTF(
+		buf, len, offset, "<property name=\"blocksize\">0x%" PRIx32 "</property></memory>", (uint32_t)f->blocksize);
+	return offset;
 }
 
-bool target_mem_map(target_s *t, char *tmp, size_t len)
+/*
+ * Build the XML memory map into buf, returning its full length like snprintf() does,
+ * so calling this with a NULL buffer first gives the size to allocate
+ */
+size_t target_mem_map(target_s *t, char *buf, size_t len)
 {
-	size_t i = 0;
-	i = snprintf(&tmp[i], len - i, "<memory-map>");
+	size_t offset = 0;
+	MAP_PRINTF(buf, len, offset, "<memory-map>");
 	/* Map each defined RAM */
 	for (target_ram_s *r = t->ram; r; r = r->next)
-		i += map_ram(&tmp[i], len - i, r);
+		offset = map_ram(buf, len, offset, r);
 	/* Map each defined Flash */
 	for (target_flash_s *f = t->flash; f; f = f->next)
-		i += map_flash(&tmp[i], len - i, f);
-	i += snprintf(&tmp[i], len - i, "</memory-map>");
-	return i < len - 1U;
+		offset = map_flash(buf, len, offset, f);
+	MAP_PRINTF(buf, len, offset, "</memory-map>");
+	return offset;
 }
 
 void target_print_progress(platform_timeout_s *const timeout)
@@ -246,6 +365,7 @@ void target_print_progress(platform_timeout_s *const timeout)
 /* Wrapper functions */
 void target_detach(target_s *t)
 {
+	target_mem_cache_flush();
 	if (t->detach)
 		t->detach(t);
 	platform_target_clk_output_enable(false);
@@ -267,17 +387,133 @@ bool target_attached(target_s *t)
 	return t->attached;
 }
 
+/* Memory read cache */
+void target_mem_cache_flush(void)
+{
+	for (size_t i = 0; i < TARGET_MEM_CACHE_PAGES; ++i)
+		target_mem_cache[i].target = NULL;
+	target_mem_cache_target = NULL;
+}
+
+/* A page can only be cached if it lies entirely within one cacheable region, such as the target's RAM */
+static bool target_mem_cache_page_cacheable(target_s *const t, const target_addr_t base)
+{
+	return target_region_lookup(t, base, TARGET_MEM_CACHE_PAGE_SIZE) &&
+		(t->region_last.flags & TARGET_REGION_CACHEABLE);
+}
+
+static const target_mem_cache_page_s *target_mem_cache_page(target_s *const t, const target_addr_t base)
+{
+	for (size_t i = 0; i < TARGET_MEM_CACHE_PAGES; ++i) {
+		if (target_mem_cache[i].target == t && target_mem_cache[i].base == base)
+			return &target_mem_cache[i];
+	}
+
+	target_mem_cache_page_s *const page = &target_mem_cache[target_mem_cache_next];
+	target_mem_cache_next = (target_mem_cache_next + 1U) % TARGET_MEM_CACHE_PAGES;
+	page->target = NULL;
+	t->mem_read(t, page->data, base, TARGET_MEM_CACHE_PAGE_SIZE);
+	if (target_check_error(t))
+		return NULL;
+	page->target = t;
+	page->base = base;
+	return page;
+}
+
+static bool target_mem_read_cached(target_s *const t, uint8_t *dest, target_addr_t src, size_t len)
+{
+	const target_addr_t first = src & ~(TARGET_MEM_CACHE_PAGE_SIZE - 1U);
+	const target_addr_t last = (src + len - 1U) & ~(TARGET_MEM_CACHE_PAGE_SIZE - 1U);
+	if (last < first)
+		return false;
+	for (target_addr_t base = first;; base += TARGET_MEM_CACHE_PAGE_SIZE) {
+		if (!target_mem_cache_page_cacheable(t, base))
+			return false;
+		if (base == last)
+			break;
+	}
+
+	while (len) {
+		const target_addr_t base = src & ~(TARGET_MEM_CACHE_PAGE_SIZE - 1U);
+		const target_mem_cache_page_s *const page = target_mem_cache_page(t, base);
+		if (!page)
+			return false;
+		const size_t offset = src - base;
+		const size_t amount = MIN(len, TARGET_MEM_CACHE_PAGE_SIZE - offset);
+		memcpy(dest, page->data + offset, amount);
+		dest += amount;
+		src += amount;
+		len -= amount;
+	}
+	return true;
+}
+
+/*
+ * Read from a region needing wider accesses than the request's alignment gives, or no block transfers:
+ * the partial units at either end are read whole, the rest in one block or unit by unit as allowed
+ */
+static void target_mem_read_region(target_s *const t, uint8_t *dest, target_addr_t src, size_t len)
+{
+	const size_t width = t->region_last.width;
+	const bool block = t->region_last.flags & TARGET_REGION_BLOCK;
+	while (len) {
+		const size_t offset = src & (width - 1U);
+		if (offset || len < width) {
+			uint8_t unit[4];
+			const size_t amount = MIN(len, width - offset);
+			t->mem_read(t, unit, src - offset, width);
+			memcpy(dest, unit + offset, amount);
+			dest += amount;
+			src += amount;
+			len -= amount;
+			continue;
+		}
+		const size_t amount = block ? len & ~(width - 1U) : width;
+		t->mem_read(t, dest, src, amount);
+		dest += amount;
+		src += amount;
+		len -= amount;
+	}
+}
+
 /* Memory access functions */
 int target_mem_read(target_s *t, void *dest, target_addr_t src, size_t len)
 {
-	if (t->mem_read)
+	PROBE_STATS_ADD(bytes_read, len);
+	scheduler_link_charge(len);
+	if (!t->mem_read)
+		return target_check_error(t);
+	/* Anything the cache can't serve, including failed page fills, gets read directly */
+	if (t == target_mem_cache_target && len && target_mem_read_cached(t, dest, src, len))
+		return 0;
+	/* Regions with access constraints get them applied up front rather than found out by faulting */
+	if (len && target_region_lookup(t, src, len) &&
+		((t->region_last.width > 1U && ((src | len) & (t->region_last.width - 1U))) ||
+			!(t->region_last.flags & TARGET_REGION_BLOCK)))
+		target_mem_read_region(t, dest, src, len);
+	else
 		t->mem_read(t, dest, src, len);
 	return target_check_error(t);
 }
 
 int target_mem_write(target_s *t, target_addr_t dest, const void *src, size_t len)
 {
-	if (t->mem_write)
+	target_mem_cache_flush();
+	PROBE_STATS_ADD(bytes_written, len);
+	scheduler_link_charge(len);
+	if (!t->mem_write)
+		return target_check_error(t);
+	/*
+	 * Writes can't be widened without a read-modify-write the region may not tolerate, so only a region's
+	 * lack of block transfer support is applied here, by writing whole units one at a time
+	 */
+	const uint8_t *data = (const uint8_t *)src;
+	if (len && target_region_lookup(t, dest, len) && !(t->region_last.flags & TARGET_REGION_BLOCK) &&
+		!((dest | len) & (t->region_last.width - 1U))) {
+		const size_t width = t->region_last.width;
+		for (size_t offset = 0; offset < len; offset += width)
+			t->mem_write(t, dest + offset, data + offset, width);
+	} else
 		t->mem_write(t, dest, src, len);
 	return target_check_error(t);
 }
@@ -301,6 +537,7 @@ ssize_t target_reg_read(target_s *t, int reg, void *data, size_t max)
 
 ssize_t target_reg_write(target_s *t, int reg, const void *data, size_t size)
 {
+	target_mem_cache_flush();
 	if (t->reg_write)
 		return t->reg_write(t, reg, data, size);
 	return 0;
@@ -316,8 +553,16 @@ void target_regs_read(target_s *t, void *data)
 	}
 }
 
+bool target_regs_unstack(target_s *t, void *data, target_addr_t stack, const uint32_t *callee_saved)
+{
+	if (!t->regs_unstack)
+		return false;
+	return t->regs_unstack(t, data, stack, callee_saved);
+}
+
 void target_regs_write(target_s *t, const void *data)
 {
+	target_mem_cache_flush();
 	if (t->regs_write)
 		t->regs_write(t, data);
 	else {
@@ -329,26 +574,34 @@ void target_regs_write(target_s *t, const void *data)
 /* Halt/resume functions */
 void target_reset(target_s *t)
 {
+	target_mem_cache_flush();
 	if (t->reset)
 		t->reset(t);
 }
 
 void target_halt_request(target_s *t)
 {
+	target_mem_cache_flush();
 	if (t->halt_request)
 		t->halt_request(t);
 }
 
 target_halt_reason_e target_halt_poll(target_s *t, target_addr_t *watch)
 {
-	if (t->halt_poll)
-		return t->halt_poll(t, watch);
+	if (t->halt_poll) {
+		const target_halt_reason_e reason = t->halt_poll(t, watch);
+		/* Memory only stays put once the target has stopped */
+		if (reason != TARGET_HALT_RUNNING && reason != TARGET_HALT_ERROR)
+			target_mem_cache_target = t;
+		return reason;
+	}
 	/* XXX: Is this actually the desired fallback behaviour? */
 	return TARGET_HALT_RUNNING;
 }
 
 void target_halt_resume(target_s *t, bool step)
 {
+	target_mem_cache_flush();
 	if (t->halt_resume)
 		t->halt_resume(t, step);
 }
@@ -385,6 +638,8 @@ int target_breakwatch_set(target_s *t, target_breakwatch_e type, target_addr_t a
 	};
 	int ret = 1;
 
+	/* Software breakpoints are written into memory */
+	target_mem_cache_flush();
 	if (t->breakwatch_set)
 		ret = t->breakwatch_set(t, &bw);
 
@@ -417,6 +672,7 @@ int target_breakwatch_clear(target_s *t, target_breakwatch_e type, target_addr_t
 		return -1;
 
 	int ret = 1;
+	target_mem_cache_flush();
 	if (t->breakwatch_clear)
 		ret = t->breakwatch_clear(t, bw);
 
@@ -425,6 +681,7 @@ int target_breakwatch_clear(target_s *t, target_breakwatch_e type, target_addr_t
 			t->bw_list = bw->next;
 		else
 			bwp->next = bw->next;
+		free(bw->condition);
 		free(bw);
 	}
 	return ret;
@@ -467,8 +724,8 @@ size_t target_regs_size(target_s *t)
 
 /*
  * Get an XML description of the target's registers. Called during the attach phase when
- * GDB supplies request `qXfer:features:read:target.xml:`. The pointer returned by this call
- * must be passed to `free()` on conclusion of its use.
+ * GDB supplies request `qXfer:features:read:target.xml:`. The string returned by this call
+ * is owned by the target driver and stays valid for the life of the target, so must not be freed.
  */
 const char *target_regs_description(target_s *t)
 {
@@ -507,6 +764,7 @@ uint32_t target_mem_read32(target_s *t, uint32_t addr)
 
 void target_mem_write32(target_s *t, uint32_t addr, uint32_t value)
 {
+	target_mem_cache_flush();
 	if (t->mem_write)
 		t->mem_write(t, addr, &value, sizeof(value));
 }
@@ -521,6 +779,7 @@ uint16_t target_mem_read16(target_s *t, uint32_t addr)
 
 void target_mem_write16(target_s *t, uint32_t addr, uint16_t value)
 {
+	target_mem_cache_flush();
 	if (t->mem_write)
 		t->mem_write(t, addr, &value, sizeof(value));
 }
@@ -535,10 +794,38 @@ uint8_t target_mem_read8(target_s *t, uint32_t addr)
 
 void target_mem_write8(target_s *t, uint32_t addr, uint8_t value)
 {
+	target_mem_cache_flush();
 	if (t->mem_write)
 		t->mem_write(t, addr, &value, sizeof(value));
 }
 
+/*
+ * Wait for the masked value of a 32-bit register to match value, for at most timeout_ms. Returns
+ * false if it didn't, use target_check_error() to tell a communication failure from a timeout.
+ * The last value read is left in result, if given, so the caller can check for error flags.
+ * Targets that can do this locally on the probe provide mem_poll32, which saves BMDA a round
+ * trip per read.
+ */
+bool target_mem_poll32(target_s *const t, const target_addr_t addr, const uint32_t mask, const uint32_t value,
+	const uint32_t timeout_ms, uint32_t *result)
+{
+	uint32_t status = 0;
+	if (!result)
+		result = &status;
+	if (t->mem_poll32)
+		return t->mem_poll32(t, addr, mask, value, timeout_ms, result);
+
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, timeout_ms);
+	while (true) {
+		*result = target_mem_read32(t, addr);
+		if ((*result & mask) == value)
+			return true;
+		if (platform_timeout_is_expired(&timeout))
+			return false;
+	}
+}
+
 void target_command_help(target_s *t)
 {
 	for (const target_command_s *tc = t->commands; tc; tc = tc->next) {
@@ -550,6 +837,8 @@ void target_command_help(target_s *t)
 
 int target_command(target_s *t, int argc, const char *argv[])
 {
+	/* Target specific commands can do anything to the target */
+	target_mem_cache_flush();
 	for (const target_command_s *tc = t->commands; tc; tc = tc->next) {
 		for (const command_s *c = tc->cmds; c->cmd; c++) {
 			if (!strncmp(argv[0], c->cmd, strlen(argv[0])))
@@ -602,18 +891,19 @@ int tc_read(target_s *t, int fd, target_addr_t buf, unsigned int count)
 int tc_write(target_s *t, int fd, target_addr_t buf, unsigned int count)
 {
 #if PC_HOSTED == 0
+	/* Console output redirected to the USB UART is serviced locally without a GDB round trip */
 	if (t->stdout_redirected && (fd == STDOUT_FILENO || fd == STDERR_FILENO)) {
-		while (count) {
+		unsigned int written = 0;
+		while (written < count) {
 			uint8_t tmp[STDOUT_READ_BUF_SIZE];
-			unsigned int cnt = sizeof(tmp);
-			if (cnt > count)
-				cnt = count;
-			target_mem_read(t, tmp, buf, cnt);
+			const unsigned int cnt = MIN(count - written, sizeof(tmp));
+			if (target_mem_read(t, tmp, buf + written, cnt))
+				break;
 			debug_serial_send_stdout(tmp, cnt);
-			count -= cnt;
-			buf += cnt;
+			written += cnt;
 		}
-		return 0;
+		/* Report what was actually sent so SYS_WRITE's "bytes not written" result is correct */
+		return written;
 	}
 #endif
 
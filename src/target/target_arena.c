@@ -0,0 +1,90 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2023 1BitSquared <info@1bitsquared.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Objects that live exactly as long as a scan, such as targets and their command lists and RAM
+ * regions and the ADIv5 DPs and APs, are carved out of a static arena rather than the heap. Freeing
+ * them individually is a no-op, the whole arena is reclaimed at once when the target list is freed.
+ * That keeps the many small allocations made by every rescan from fragmenting the probe's heap.
+ * Should the arena run out, allocations fall back to the heap.
+ */
+
+#include "general.h"
+#include "target_internal.h"
+
+#if PC_HOSTED == 1
+#define TARGET_ARENA_SIZE 16384U
+#else
+#define TARGET_ARENA_SIZE 2048U
+#endif
+
+/* Every allocation is kept 8 byte aligned, as suits any of the structures placed here */
+static uint64_t target_arena[TARGET_ARENA_SIZE / sizeof(uint64_t)];
+static size_t target_arena_used;
+static size_t target_arena_high_water;
+
+void *target_arena_calloc(const size_t size)
+{
+	const size_t words = (size + sizeof(uint64_t) - 1U) / sizeof(uint64_t);
+	if (words > ARRAY_LENGTH(target_arena) - target_arena_used)
+		return calloc(1, size);
+	void *const result = &target_arena[target_arena_used];
+	target_arena_used += words;
+	target_arena_high_water = MAX(target_arena_high_water, target_arena_used);
+	memset(result, 0, words * sizeof(uint64_t));
+	return result;
+}
+
+static bool target_arena_owns(const void *const ptr)
+{
+	const uint8_t *const addr = (const uint8_t *)ptr;
+	const uint8_t *const base = (const uint8_t *)target_arena;
+	return addr >= base && addr < base + sizeof(target_arena);
+}
+
+void target_arena_free(void *const ptr)
+{
+	if (!target_arena_owns(ptr))
+		free(ptr);
+}
+
+void target_arena_reset(void)
+{
+	target_arena_used = 0;
+}
+
+void target_arena_usage(size_t *const used, size_t *const high_water, size_t *const size)
+{
+	*used = target_arena_used * sizeof(uint64_t);
+	*high_water = target_arena_high_water * sizeof(uint64_t);
+	*size = sizeof(target_arena);
+}
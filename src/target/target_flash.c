@@ -37,6 +37,22 @@
 
 #include "general.h"
 #include "target_internal.h"
+#include "crc32.h"
+#include "probe_stats.h"
+
+/*
+ * Largest erase block incremental flashing will stage in memory, blocks bigger than this
+ * are always erased and written as normal
+ */
+#if PC_HOSTED == 1
+#define FLASH_INCREMENTAL_MAX_BLOCKSIZE 0x40000U
+#else
+#define FLASH_INCREMENTAL_MAX_BLOCKSIZE 0x800U
+#endif
+
+bool target_flash_incremental = false;
+bool target_flash_blank_check = false;
+bool target_flash_verify = false;
 
 target_flash_s *target_flash_for_addr(target_s *t, uint32_t addr)
 {
@@ -47,8 +63,30 @@ target_flash_s *target_flash_for_addr(target_s *t, uint32_t addr)
 	return NULL;
 }
 
+/*
+ * Make sure a driver's Flash stub is in target RAM at addr, uploading it only once per Flash
+ * session. Whenever it is reused its first and last words are checked, to catch it having been
+ * overwritten in the meantime, in which case it is uploaded again.
+ */
+bool target_flash_stub_load(target_flash_s *const f, const target_addr_t addr, const uint16_t *const stub,
+	const size_t length)
+{
+	target_s *const t = f->t;
+	if (f->stub_resident && length >= 4U) {
+		const size_t last = (length & ~3U) - 4U;
+		uint8_t signature[8];
+		if (!target_mem_read(t, signature, addr, 4U) && !target_mem_read(t, signature + 4U, addr + last, 4U) &&
+			memcmp(signature, stub, 4U) == 0 && memcmp(signature + 4U, (const uint8_t *)stub + last, 4U) == 0)
+			return true;
+		DEBUG_INFO("Flash stub at 0x%08" PRIx32 " was overwritten, reloading\n", addr);
+	}
+	f->stub_resident = !target_mem_write(t, addr, stub, length);
+	return f->stub_resident;
+}
+
 static bool target_enter_flash_mode(target_s *t)
 {
+	target_mem_cache_flush();
 	if (t->flash_mode)
 		return true;
 
@@ -98,14 +136,95 @@ static bool flash_prepare(target_flash_s *f)
 	return ret;
 }
 
+/*
+ * Drivers that provide a wait hook only start erase and write operations, leaving them running while
+ * the probe gets on with the next one. Wait for the outstanding operation before touching the flash again.
+ */
+static bool flash_wait(target_flash_s *const f)
+{
+	if (!f->busy)
+		return true;
+	f->busy = false;
+	return f->wait(f);
+}
+
+static bool flash_erase(target_flash_s *const f, const target_addr_t addr, const size_t len)
+{
+	if (!flash_wait(f))
+		return false;
+	const bool ret = f->erase(f, addr, len);
+	f->busy = ret && f->wait;
+	return ret;
+}
+
+static bool flash_verify_chunk(target_flash_s *const f, const flash_verify_s *const chunk)
+{
+	/* Always read back, the target may be busy running the driver's loader */
+	uint32_t crc = 0;
+	if (!generic_crc32_readback(f->t, &crc, chunk->addr, chunk->len))
+		return false;
+	if (crc != chunk->crc) {
+		DEBUG_WARN("Verify failed at %" PRIx32 "\n", chunk->addr);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Note down a chunk just handed to the driver, and check the oldest one still outstanding, which is
+ * done programming by now. The readback then overlaps with the programming of the chunks after it.
+ */
+static bool flash_verify_queue(
+	target_flash_s *const f, const target_addr_t dest, const void *const src, const size_t len)
+{
+	bool ret = true;
+	if (f->verify_count == FLASH_VERIFY_DEPTH) {
+		ret = flash_verify_chunk(f, &f->verify[0]);
+		memmove(f->verify, f->verify + 1U, sizeof(f->verify[0]) * (FLASH_VERIFY_DEPTH - 1U));
+		--f->verify_count;
+	}
+	f->verify[f->verify_count++] = (flash_verify_s){dest, len, generic_crc32_buffer(src, len)};
+	return ret;
+}
+
+static bool flash_verify_drain(target_flash_s *const f)
+{
+	bool ret = true; /* Catch false returns with &= */
+	for (size_t i = 0; i < f->verify_count; ++i)
+		ret &= flash_verify_chunk(f, &f->verify[i]);
+	f->verify_count = 0;
+	return ret;
+}
+
+static bool flash_write(target_flash_s *const f, const target_addr_t dest, const void *const src, const size_t len)
+{
+	/* Double buffering drivers upload the data for the next write while the last is still running */
+	if (!f->write_overlaps && !flash_wait(f))
+		return false;
+	const bool ret = f->write(f, dest, src, len);
+	f->busy = ret && f->wait;
+	if (ret && target_flash_verify)
+		return flash_verify_queue(f, dest, src, len);
+	return ret;
+}
+
 static bool flash_done(target_flash_s *f)
 {
 	if (!f->ready)
 		return true;
 
+	/*
+	 * Without a done hook there is nothing to wait for here, which lets an erase keep running on
+	 * one bank while another is worked on. target_flash_complete() picks up anything left over.
+	 */
 	bool ret = true;
 	if (f->done)
-		ret = f->done(f);
+		ret = flash_wait(f) && f->done(f);
+	/* With the driver finished, the chunks still queued for verifying have all been programmed */
+	if (f->verify_count) {
+		ret = ret && flash_wait(f) && flash_verify_drain(f);
+		f->verify_count = 0;
+	}
 
 	if (f->buf) {
 		free(f->buf);
@@ -113,10 +232,146 @@ static bool flash_done(target_flash_s *f)
 	}
 
 	f->ready = false;
+	f->stub_resident = false;
+
+	return ret;
+}
+
+/*
+ * Incremental flashing defers erasing a block until its new contents are known, then compares the
+ * CRC of what the target already holds against them and skips the erase and write when they match.
+ */
+static bool flash_incremental_possible(const target_flash_s *const f)
+{
+	return target_flash_incremental && f->blocksize <= FLASH_INCREMENTAL_MAX_BLOCKSIZE;
+}
+
+static size_t flash_block_index(const target_flash_s *const f, const target_addr_t block_addr)
+{
+	return (block_addr - f->start) / f->blocksize;
+}
+
+static bool flash_erase_is_pending(const target_flash_s *const f, const target_addr_t block_addr)
+{
+	if (!f->erase_pending)
+		return false;
+	const size_t block = flash_block_index(f, block_addr);
+	return f->erase_pending[block >> 3U] & (1U << (block & 7U));
+}
+
+static bool flash_incremental_defer_erase(target_flash_s *const f, const target_addr_t block_addr)
+{
+	if (!flash_incremental_possible(f))
+		return false;
+	if (!f->erase_pending) {
+		const size_t blocks = (f->length + f->blocksize - 1U) / f->blocksize;
+		f->erase_pending = calloc((blocks + 7U) >> 3U, 1U);
+		if (!f->erase_pending) { /* calloc failed: heap exhaustion */
+			DEBUG_WARN("calloc: failed in %s\n", __func__);
+			return false;
+		}
+	}
+	const size_t block = flash_block_index(f, block_addr);
+	f->erase_pending[block >> 3U] |= 1U << (block & 7U);
+	return true;
+}
+
+static bool flash_chunk_is_erased(const target_flash_s *const f, const uint8_t *const data, const size_t len)
+{
+	for (size_t i = 0; i < len; ++i) {
+		if (data[i] != f->erased)
+			return false;
+	}
+	return true;
+}
+
+/* Bring the target's copy of the block held in block_buf in line with it, and release the buffer */
+static bool flash_incremental_commit(target_flash_s *const f)
+{
+	const target_addr_t block_addr = f->block_addr;
+	const size_t block = flash_block_index(f, block_addr);
+	f->erase_pending[block >> 3U] &= ~(1U << (block & 7U));
 
+	const uint32_t expected = generic_crc32_buffer(f->block_buf, f->blocksize);
+	uint32_t actual = 0;
+	bool ret = true; /* Catch false returns with &= */
+	/* Reading back the block must not race an operation still running on it */
+	if (!flash_wait(f))
+		ret = false;
+	else if (generic_crc32(f->t, &actual, block_addr, f->blocksize) && actual == expected)
+		DEBUG_INFO("Skipping unchanged block at 0x%08" PRIx32 "\n", block_addr);
+	else if (!flash_prepare(f) || !flash_erase(f, block_addr, f->blocksize)) {
+		DEBUG_WARN("Erase failed at %" PRIx32 "\n", block_addr);
+		ret = false;
+	} else {
+		/* Only program the parts of the block that don't end up in the erased state */
+		for (size_t offset = 0; offset < f->blocksize; offset += f->writesize) {
+			if (!flash_chunk_is_erased(f, f->block_buf + offset, f->writesize))
+				ret &= flash_write(f, block_addr + offset, f->block_buf + offset, f->writesize);
+		}
+	}
+
+	free(f->block_buf);
+	f->block_buf = NULL;
 	return ret;
 }
 
+static bool flash_incremental_stage(target_flash_s *const f, const target_addr_t block_addr)
+{
+	bool ret = true; /* Catch false returns with &= */
+	if (f->block_buf) {
+		if (f->block_addr == block_addr)
+			return true;
+		ret &= flash_incremental_commit(f);
+	}
+	f->block_buf = malloc(f->blocksize);
+	if (!f->block_buf) { /* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return false;
+	}
+	memset(f->block_buf, f->erased, f->blocksize);
+	f->block_addr = block_addr;
+	return ret;
+}
+
+/* Commit the staged block and handle any blocks that were erased but never written */
+static bool flash_incremental_flush(target_flash_s *const f)
+{
+	if (!f->erase_pending)
+		return true;
+	bool ret = true; /* Catch false returns with &= */
+	if (f->block_buf)
+		ret &= flash_incremental_commit(f);
+	for (target_addr_t block_addr = f->start; block_addr < f->start + f->length; block_addr += f->blocksize) {
+		if (!flash_erase_is_pending(f, block_addr))
+			continue;
+		if (!flash_incremental_stage(f, block_addr)) {
+			ret = false;
+			break;
+		}
+		ret &= flash_incremental_commit(f);
+	}
+	free(f->erase_pending);
+	f->erase_pending = NULL;
+	return ret;
+}
+
+/*
+ * Whether a block already reads back fully erased, so erasing it can be skipped. Drivers that have a
+ * hardware blank check provide it as a hook, otherwise the CRC of the block is compared against that of
+ * an erased one, which costs little when the target computes it with a stub.
+ */
+static bool flash_block_is_blank(target_flash_s *const f, const target_addr_t block_addr)
+{
+	if (!target_flash_blank_check || !flash_wait(f))
+		return false;
+	if (f->blank_check)
+		return f->blank_check(f, block_addr, f->blocksize);
+	uint32_t actual = 0;
+	return generic_crc32(f->t, &actual, block_addr, f->blocksize) &&
+		actual == generic_crc32_fill(f->erased, f->blocksize);
+}
+
 bool target_flash_erase(target_s *t, target_addr_t addr, size_t len)
 {
 	if (!target_enter_flash_mode(t))
@@ -143,10 +398,31 @@ bool target_flash_erase(target_s *t, target_addr_t addr, size_t len)
 		const target_addr_t local_start_addr = addr & ~(f->blocksize - 1U);
 		const target_addr_t local_end_addr = local_start_addr + f->blocksize;
 
+		if (flash_incremental_defer_erase(f, local_start_addr)) {
+			len -= MIN(local_end_addr - addr, len);
+			addr = local_end_addr;
+			continue;
+		}
+
 		if (!flash_prepare(f))
 			return false;
 
-		ret &= f->erase(f, local_start_addr, f->blocksize);
+		/* If the whole region is to go and the driver can erase it all at once, let it */
+		if (f->erase_all && addr == f->start && len >= f->length) {
+			ret &= flash_wait(f) && f->erase_all(f);
+			if (!ret) {
+				DEBUG_WARN("Erase failed at %" PRIx32 "\n", addr);
+				break;
+			}
+			len -= f->length;
+			addr += f->length;
+			continue;
+		}
+
+		if (flash_block_is_blank(f, local_start_addr))
+			DEBUG_INFO("Skipping blank block at 0x%08" PRIx32 "\n", local_start_addr);
+		else
+			ret &= flash_erase(f, local_start_addr, f->blocksize);
 		if (!ret) {
 			DEBUG_WARN("Erase failed at %" PRIx32 "\n", local_start_addr);
 			break;
@@ -190,7 +466,7 @@ static bool flash_buffered_flush(target_flash_s *f)
 		uint32_t len = f->buf_addr_high - aligned_addr;
 
 		for (size_t offset = 0; offset < len; offset += f->writesize)
-			ret &= f->write(f, aligned_addr + offset, src + offset, f->writesize);
+			ret &= flash_write(f, aligned_addr + offset, src + offset, f->writesize);
 
 		f->buf_addr_base = UINT32_MAX;
 		f->buf_addr_low = UINT32_MAX;
@@ -200,12 +476,61 @@ static bool flash_buffered_flush(target_flash_s *f)
 	return ret;
 }
 
+static bool flash_direct_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
+{
+	if (!flash_prepare(f))
+		return false;
+
+	bool ret = true; /* Catch false returns with &= */
+	for (size_t offset = 0; offset < len; offset += f->writesize)
+		ret &= flash_write(f, dest + offset, src + offset, f->writesize);
+	return ret;
+}
+
+static bool flash_buffered_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
+
+/* Route writes to blocks with a deferred erase into the staging buffer, and the rest through the write buffer */
+static bool flash_incremental_write(target_flash_s *f, target_addr_t dest, const uint8_t *src, size_t len)
+{
+	bool ret = true; /* Catch false returns with &= */
+	while (len) {
+		const target_addr_t block_addr = dest & ~(f->blocksize - 1U);
+		const size_t local_len = MIN(block_addr + f->blocksize - dest, len);
+		if (flash_erase_is_pending(f, block_addr)) {
+			if (!flash_incremental_stage(f, block_addr))
+				return false;
+			memcpy(f->block_buf + (dest - block_addr), src, local_len);
+		} else
+			ret &= flash_buffered_write(f, dest, src, local_len);
+
+		dest += local_len;
+		src += local_len;
+		len -= local_len;
+	}
+	return ret;
+}
+
 static bool flash_buffered_write(target_flash_s *f, target_addr_t dest, const void *src, size_t len)
 {
 	bool ret = true; /* Catch false returns with &= */
 	while (len) {
 		const target_addr_t base_addr = dest & ~(f->writebufsize - 1U);
 
+		/*
+		 * If the chunk starts on a write buffer boundary, covers at least one whole buffer and
+		 * nothing is pending for that buffer, write it straight from the source - skipping the copy
+		 */
+		if (dest == base_addr && len >= f->writebufsize && base_addr != f->buf_addr_base) {
+			ret &= flash_buffered_flush(f);
+			const size_t direct_len = len - (len % f->writebufsize);
+			ret &= flash_direct_write(f, dest, src, direct_len);
+
+			dest += direct_len;
+			src += direct_len;
+			len -= direct_len;
+			continue;
+		}
+
 		/* Check for base address change */
 		if (base_addr != f->buf_addr_base) {
 			ret &= flash_buffered_flush(f);
@@ -232,7 +557,7 @@ static bool flash_buffered_write(target_flash_s *f, target_addr_t dest, const vo
 	return ret;
 }
 
-bool target_flash_write(target_s *t, target_addr_t dest, const void *src, size_t len)
+static bool target_flash_write_regions(target_s *t, target_addr_t dest, const void *src, size_t len)
 {
 	if (!target_enter_flash_mode(t))
 		return false;
@@ -272,7 +597,10 @@ bool target_flash_write(target_s *t, target_addr_t dest, const void *src, size_t
 		const target_addr_t local_end_addr = MIN(dest + len, f->start + f->length);
 		const target_addr_t local_length = local_end_addr - dest;
 
-		ret &= flash_buffered_write(f, dest, src, local_length);
+		if (f->erase_pending)
+			ret &= flash_incremental_write(f, dest, src, local_length);
+		else
+			ret &= flash_buffered_write(f, dest, src, local_length);
 		if (!ret) {
 			DEBUG_WARN("Write failed at %" PRIx32 "\n", dest);
 			break;
@@ -285,6 +613,14 @@ bool target_flash_write(target_s *t, target_addr_t dest, const void *src, size_t
 	return ret;
 }
 
+bool target_flash_write(target_s *t, target_addr_t dest, const void *src, size_t len)
+{
+	PROBE_STATS_TIME_BEGIN(start);
+	const bool result = target_flash_write_regions(t, dest, src, len);
+	PROBE_STATS_TIME_END(PROBE_STATS_FLASH_WRITE, start);
+	return result;
+}
+
 bool target_flash_complete(target_s *t)
 {
 	if (!t->flash_mode)
@@ -293,6 +629,8 @@ bool target_flash_complete(target_s *t)
 	bool ret = true; /* Catch false returns with &= */
 	for (target_flash_s *f = t->flash; f; f = f->next) {
 		ret &= flash_buffered_flush(f);
+		ret &= flash_incremental_flush(f);
+		ret &= flash_wait(f);
 		ret &= flash_done(f);
 	}
 
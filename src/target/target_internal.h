@@ -37,31 +37,75 @@ struct target_ram {
 	target_ram_s *next;
 };
 
+/*
+ * Access attributes for a span of the address space. RAM and Flash get theirs from the memory map, drivers
+ * add hints for anything else that needs special handling, see target_add_region()
+ */
+typedef struct target_region target_region_s;
+
+#define TARGET_REGION_BLOCK     (1U << 0U) /* Auto-incrementing block transfers are safe */
+#define TARGET_REGION_CACHEABLE (1U << 1U) /* Reads have no side effects, so can be served from the read cache */
+
+struct target_region {
+	target_addr_t start;
+	size_t length;
+	uint8_t width; /* Narrowest access in bytes the region takes, 1, 2 or 4 */
+	uint8_t flags; /* TARGET_REGION_* */
+	target_region_s *next;
+};
+
 typedef struct target_flash target_flash_s;
 
 typedef bool (*flash_prepare_func)(target_flash_s *f);
 typedef bool (*flash_erase_func)(target_flash_s *f, target_addr_t addr, size_t len);
 typedef bool (*flash_write_func)(target_flash_s *f, target_addr_t dest, const void *src, size_t len);
 typedef bool (*flash_done_func)(target_flash_s *f);
+typedef bool (*flash_wait_func)(target_flash_s *f);
+typedef bool (*flash_erase_all_func)(target_flash_s *f);
+typedef bool (*flash_blank_check_func)(target_flash_s *f, target_addr_t addr, size_t len);
+
+/*
+ * Chunks written but not yet read back in inline verify mode. The SRAM loader can have two
+ * buffers in flight, so a chunk is only known to be programmed once two more are handed over.
+ */
+#define FLASH_VERIFY_DEPTH 2U
+
+typedef struct flash_verify {
+	target_addr_t addr;
+	size_t len;
+	uint32_t crc; /* generic_crc32() of the data written */
+} flash_verify_s;
 
 struct target_flash {
-	target_s *t;                 /* Target this flash is attached to */
-	target_addr_t start;         /* Start address of flash */
-	size_t length;               /* Flash length */
-	size_t blocksize;            /* Erase block size */
-	size_t writesize;            /* Write operation size, must be <= blocksize/writebufsize */
-	size_t writebufsize;         /* Size of write buffer, this is calculated and not set in target code */
-	uint8_t erased;              /* Byte erased state */
-	bool ready;                  /* True if flash is in flash mode/prepared */
-	flash_prepare_func prepare;  /* Prepare for flash operations */
-	flash_erase_func erase;      /* Erase a range of flash */
-	flash_write_func write;      /* Write to flash */
-	flash_done_func done;        /* Finish flash operations */
-	void *buf;                   /* Buffer for flash operations */
-	target_addr_t buf_addr_base; /* Address of block this buffer is for */
-	target_addr_t buf_addr_low;  /* Address of lowest byte written */
-	target_addr_t buf_addr_high; /* Address of highest byte written */
-	target_flash_s *next;        /* Next flash in list */
+	target_s *t;                        /* Target this flash is attached to */
+	target_addr_t start;                /* Start address of flash */
+	size_t length;                      /* Flash length */
+	size_t blocksize;                   /* Erase block size */
+	size_t writesize;                   /* Write operation size, must be <= blocksize/writebufsize */
+	size_t writebufsize;                /* Size of write buffer, this is calculated and not set in target code */
+	uint8_t erased;                     /* Byte erased state */
+	bool ready;                         /* True if flash is in flash mode/prepared */
+	flash_prepare_func prepare;         /* Prepare for flash operations */
+	flash_erase_func erase;             /* Erase a range of flash */
+	flash_write_func write;             /* Write to flash */
+	flash_done_func done;               /* Finish flash operations */
+	flash_wait_func wait;               /* Optional, lets erase and write return before the operation completes */
+	flash_erase_all_func erase_all;     /* Optional, erases the whole region faster than block by block */
+	flash_blank_check_func blank_check; /* Optional, true if the range already reads back as erased */
+	bool busy;                          /* True if an erase or write may still be running on the target */
+	bool write_overlaps;                /* True if write is called while busy, to stage its data before waiting */
+	bool stub_resident;                 /* True if the driver's stub was uploaded this session */
+	void *buf;                          /* Buffer for flash operations */
+	target_addr_t buf_addr_base;        /* Address of block this buffer is for */
+	target_addr_t buf_addr_low;         /* Address of lowest byte written */
+	target_addr_t buf_addr_high;        /* Address of highest byte written */
+	uint8_t *erase_pending;             /* Bitmap of blocks with a deferred erase in incremental mode */
+	uint8_t *block_buf;                 /* New contents of the deferred erase block being written */
+	target_addr_t block_addr;           /* Address of the block held in block_buf */
+	target_flash_s *next;               /* Next flash in list */
+	/* Chunks still to be read back in inline verify mode, oldest first */
+	flash_verify_s verify[FLASH_VERIFY_DEPTH];
+	uint8_t verify_count;
 };
 
 typedef bool (*cmd_handler_fn)(target_s *t, int argc, const char **argv);
@@ -88,6 +132,8 @@ struct breakwatch {
 	target_addr_t addr;
 	size_t size;
 	uint32_t reserved[4]; /* For use by the implementing driver */
+	uint8_t *condition;   /* GDB agent expressions a breakpoint only stops on if one is true, see gdb_agent.h */
+	size_t condition_len;
 };
 
 #define MAX_CMDLINE 81
@@ -104,14 +150,30 @@ struct target {
 	/* Memory access functions */
 	void (*mem_read)(target_s *t, void *dest, target_addr_t src, size_t len);
 	void (*mem_write)(target_s *t, target_addr_t dest, const void *src, size_t len);
+	/* Optional on-target CRC32 of a memory region, returns false if the caller should read the memory back */
+	bool (*mem_crc32)(target_s *t, uint32_t *crc_res, target_addr_t base, size_t len);
+	/* Optional probe-side implementation of target_mem_poll32() */
+	bool (*mem_poll32)(
+		target_s *t, target_addr_t addr, uint32_t mask, uint32_t value, uint32_t timeout_ms, uint32_t *result);
 
 	/* Register access functions */
 	size_t regs_size;
 	const char *(*regs_description)(target_s *t);
 	void (*regs_read)(target_s *t, void *data);
 	void (*regs_write)(target_s *t, const void *data);
+	/*
+	 * Optional: fill in the register block of a thread an RTOS has switched out, given the stack pointer
+	 * its context was saved at. callee_saved holds the registers the RTOS kept in its thread control block
+	 * (r4-r11 on Cortex-M), or is NULL if they were pushed onto the stack as part of the context.
+	 */
+	bool (*regs_unstack)(target_s *t, void *data, target_addr_t stack, const uint32_t *callee_saved);
 	ssize_t (*reg_read)(target_s *t, int reg, void *data, size_t max);
 	ssize_t (*reg_write)(target_s *t, int reg, const void *data, size_t size);
+	/* Registers reported along with each stop so GDB doesn't have to read them back itself */
+	const uint8_t *expedited_regs;
+	size_t expedited_regs_count;
+	/* Register number of the program counter, used to step over a range on the probe, -1 if unknown */
+	int pc_reg;
 
 	/* Halt/resume functions */
 	void (*reset)(target_s *t);
@@ -119,6 +181,8 @@ struct target {
 	void (*halt_request)(target_s *t);
 	target_halt_reason_e (*halt_poll)(target_s *t, target_addr_t *watch);
 	void (*halt_resume)(target_s *t, bool step);
+	/* Nonzero while halting or resuming this core does the same to every other core with the same value */
+	uintptr_t halt_group;
 
 	/* Break-/watchpoint functions */
 	int (*breakwatch_set)(target_s *t, breakwatch_s *);
@@ -145,6 +209,9 @@ struct target {
 
 	target_ram_s *ram;
 	target_flash_s *flash;
+	/* Driver hints on regions needing special access, and the last region looked up, valid if length != 0 */
+	target_region_s *regions;
+	target_region_s region_last;
 
 	/* Other stuff */
 	const char *driver;
@@ -178,8 +245,17 @@ void target_mem_map_free(target_s *t);
 void target_add_commands(target_s *t, const command_s *cmds, const char *name);
 void target_add_ram(target_s *t, target_addr_t start, uint32_t len);
 void target_add_flash(target_s *t, target_flash_s *f);
+void target_add_region(target_s *t, target_addr_t start, size_t length, uint8_t width, uint8_t flags);
+void target_mem_cache_flush(void);
+
+/* Zeroed storage for an object that lives until the next target_list_free(), see target_arena.c */
+void *target_arena_calloc(size_t size);
+void target_arena_free(void *ptr);
+void target_arena_reset(void);
+void target_arena_usage(size_t *used, size_t *high_water, size_t *size);
 
 target_flash_s *target_flash_for_addr(target_s *t, uint32_t addr);
+bool target_flash_stub_load(target_flash_s *f, target_addr_t addr, const uint16_t *stub, size_t length);
 
 /* Convenience function for MMIO access */
 uint32_t target_mem_read32(target_s *t, uint32_t addr);
@@ -189,6 +265,10 @@ void target_mem_write32(target_s *t, uint32_t addr, uint32_t value);
 void target_mem_write16(target_s *t, uint32_t addr, uint16_t value);
 void target_mem_write8(target_s *t, uint32_t addr, uint8_t value);
 bool target_check_error(target_s *t);
+bool target_mem_poll32(
+	target_s *t, target_addr_t addr, uint32_t mask, uint32_t value, uint32_t timeout_ms, uint32_t *result);
+/* Slice length for target_mem_poll32() waits that have no deadline, keeps progress reports and error checks going */
+#define TARGET_POLL_SLICE_MS 100U
 
 /* Access to host controller interface */
 void tc_printf(target_s *t, const char *fmt, ...);